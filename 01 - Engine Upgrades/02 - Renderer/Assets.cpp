@@ -11,6 +11,7 @@ using json = nlohmann::json;
 
 #include <DDSTextureLoader.h>
 #include <WICTextureLoader.h>
+#include <chrono>
 
 
 // Singleton requirement
@@ -23,6 +24,17 @@ Assets* Assets::instance;
 // --------------------------------------------------------------------------
 Assets::~Assets()
 {
+	// Stop the texture loading thread, abandoning anything not yet read
+	if (textureLoadThread.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(textureLoadMutex);
+			textureLoadThreadRunning = false;
+			textureLoadQueue.clear();
+		}
+		textureLoadCondition.notify_all();
+		textureLoadThread.join();
+	}
 }
 
 
@@ -467,6 +479,97 @@ unsigned int Assets::GetSamplerCount() { return (unsigned int)samplers.size(); }
 unsigned int Assets::GetTextureCount() { return (unsigned int)textures.size(); }
 
 
+// --------------------------------------------------------------------------
+// Gets the texture residency tracker, which holds the texture memory budget
+// and stats about how much texture memory is in use
+// --------------------------------------------------------------------------
+TextureResidency& Assets::GetTextureResidency() { return textureResidency; }
+
+
+// --------------------------------------------------------------------------
+// Requests all of the streamable textures used by a material at a level of
+// detail appropriate for the given distance from the camera.  Call this for
+// anything drawn this frame, before UpdateTextureResidency().
+// --------------------------------------------------------------------------
+void Assets::RequestMaterialTextures(std::shared_ptr<Material> material, float distance)
+{
+	if (!material)
+		return;
+
+	unsigned int mip = textureResidency.MipForDistance(distance);
+	for (auto& t : material->GetTextureSRVs())
+	{
+		auto it = streamedTextureIDs.find(t.second.Get());
+		if (it != streamedTextureIDs.end())
+			textureResidency.RequestMip(it->second, mip);
+	}
+}
+
+
+// --------------------------------------------------------------------------
+// Enforces the texture memory budget, dropping or restoring mips as
+// necessary.  This should be called once per frame, after drawing, as any
+// texture that changes is swapped out in every material that uses it.
+// --------------------------------------------------------------------------
+void Assets::UpdateTextureResidency()
+{
+	textureResidency.Update();
+}
+
+
+// --------------------------------------------------------------------------
+// Begins watching the asset folder (and its subfolders) and the shader
+// folder for changes.  Call ReloadChangedAssets() each frame to actually
+// reload anything that has changed.  Note that shaders are watched as
+// compiled shader objects (.cso), so edits to .hlsl files are picked up
+// once Visual Studio recompiles them.
+// --------------------------------------------------------------------------
+void Assets::EnableHotReload()
+{
+	if (hotReloadEnabled || rootAssetPath.empty() || rootShaderPath.empty())
+		return;
+
+	bool assetsWatched = fileWatcher.WatchDirectory(FixPath(rootAssetPath), true);
+	bool shadersWatched = fileWatcher.WatchDirectory(FixPath(rootShaderPath), false);
+	hotReloadEnabled = assetsWatched || shadersWatched;
+}
+
+
+// --------------------------------------------------------------------------
+// Reloads any previously loaded shaders, materials and textures whose files
+// have changed.  Assets that have not been loaded yet are skipped, as they
+// will be loaded on demand with the new contents anyway.  Existing objects
+// are updated in place (or swapped everywhere they are referenced), so
+// anything holding onto them sees the changes immediately.
+// --------------------------------------------------------------------------
+void Assets::ReloadChangedAssets()
+{
+	if (!hotReloadEnabled)
+		return;
+
+	for (auto& path : fileWatcher.GetChangedFiles())
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+		bool reloaded = false;
+		if (EndsWith(path, L".cso"))
+			reloaded = ReloadShader(path);
+		else if (EndsWith(path, L".material"))
+			reloaded = ReloadMaterial(path);
+		else if (EndsWith(path, L".jpg") || EndsWith(path, L".png") || EndsWith(path, L".dds"))
+			reloaded = ReloadTexture(path);
+
+		if (reloaded)
+		{
+			std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+			printf("Reloaded ");
+			wprintf(path.c_str());
+			printf(" in %.2f ms\n", elapsed.count());
+		}
+	}
+}
+
+
 
 // --------------------------------------------------------------------------
 // Private helper for loading a mesh from an .obj file
@@ -514,36 +617,56 @@ std::shared_ptr<Material> Assets::LoadMaterial(std::wstring path)
 		printf("\n");
 	}
 
-	// Open the file and parse
+	// Remove the file extension the end of the filename before using as a key
+	filename = RemoveFileExtension(filename);
+
+	// Create the material and fill it in from the file.  If the file is
+	// invalid, the material is left without shaders.
+	std::shared_ptr<Material> mat = std::make_shared<Material>(nullptr, nullptr); // TODO: Default shaders?
+	ReadMaterialFile(path, mat);
+
+	// Add the material to our list and return it
+	materials.insert({ filename, mat });
+	return mat;
+}
+
+
+// --------------------------------------------------------------------------
+// Private helper for reading the contents of a material (.json) file into
+// an existing material.  This is used both for the initial load and when
+// the file is reloaded, so that anything holding the material sees the
+// changes.  If the file cannot be parsed or is missing required members,
+// the material is left unchanged and this returns false.
+// --------------------------------------------------------------------------
+bool Assets::ReadMaterialFile(std::wstring path, std::shared_ptr<Material> mat)
+{
+	// Open the file and parse (without exceptions)
 	std::ifstream file(path);
-	json d = json::parse(file);
+	json d = json::parse(file, nullptr, false);
 	file.close();
 
-	// Remove the file extension the end of the filename before using as a key
-	filename = RemoveFileExtension(filename);
-	
 	// Verify required members (shaders for now)
 	if (d.is_discarded() ||
 		!d.contains("shaders") ||
 		!d["shaders"].contains("pixel") ||
 		!d["shaders"].contains("vertex"))
 	{
-		std::shared_ptr<SimplePixelShader> psInvalid = 0;
-		std::shared_ptr<SimpleVertexShader> vsInvalid = 0;
-		std::shared_ptr<Material> matInvalid = std::make_shared<Material>(psInvalid, vsInvalid); // TODO: Default shaders?
-		AddMaterial(filename, matInvalid);
-		return matInvalid;
+		return false;
 	}
 
 	// Check to see if the requested shaders exist
 	std::wstring psName = NarrowToWide(d["shaders"]["pixel"].get<std::string>());
 	std::wstring vsName = NarrowToWide(d["shaders"]["vertex"].get<std::string>());
 
-	std::shared_ptr<SimplePixelShader> ps = GetPixelShader(psName);
-	std::shared_ptr<SimpleVertexShader> vs = GetVertexShader(vsName);
+	mat->SetPixelShader(GetPixelShader(psName));
+	mat->SetVertexShader(GetVertexShader(vsName));
 
-	// We have enough to make the material
-	std::shared_ptr<Material> mat = std::make_shared<Material>(ps, vs);
+	// Reset everything else, as a reload may remove properties
+	mat->SetColorTint(DirectX::XMFLOAT3(1, 1, 1));
+	mat->SetUVScale(DirectX::XMFLOAT2(1, 1));
+	mat->SetUVOffset(DirectX::XMFLOAT2(0, 0));
+	mat->ClearTextureSRVs();
+	mat->ClearSamplers();
 	
 	// Check for 3-component tint
 	if (d.contains("tint") && d["tint"].size() == 3)
@@ -603,9 +726,7 @@ std::shared_ptr<Material> Assets::LoadMaterial(std::wstring path)
 		}
 	}
 
-	// Add the material to our list and return it
-	materials.insert({ filename, mat });
-	return mat;
+	return true;
 }
 
 
@@ -775,6 +896,7 @@ Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> Assets::LoadTexture(std::wstrin
 
 	// Add to the dictionary
 	textures.insert({ filename, srv });
+	RegisterStreamedTexture(filename, path, srv);
 	return srv;
 }
 
@@ -806,6 +928,7 @@ Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> Assets::LoadDDSTexture(std::wst
 
 	// Add to the dictionary
 	textures.insert({ filename, srv });
+	RegisterStreamedTexture(filename, path, srv);
 	return srv;
 }
 
@@ -1063,6 +1186,427 @@ Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> Assets::CreateFloatTexture(std:
 }
 
 
+// --------------------------------------------------------------------------
+// Helper for determining the size of a single pixel of a given format.
+// Block compressed formats report their average bits per pixel.
+// --------------------------------------------------------------------------
+static unsigned int BitsPerPixel(DXGI_FORMAT format, bool* blockCompressed)
+{
+	*blockCompressed = false;
+	switch (format)
+	{
+	case DXGI_FORMAT_R32G32B32A32_FLOAT:
+	case DXGI_FORMAT_R32G32B32A32_UINT:
+	case DXGI_FORMAT_R32G32B32A32_SINT:
+		return 128;
+
+	case DXGI_FORMAT_R32G32B32_FLOAT:
+		return 96;
+
+	case DXGI_FORMAT_R16G16B16A16_FLOAT:
+	case DXGI_FORMAT_R16G16B16A16_UNORM:
+	case DXGI_FORMAT_R32G32_FLOAT:
+		return 64;
+
+	case DXGI_FORMAT_R8G8_UNORM:
+	case DXGI_FORMAT_R16_FLOAT:
+	case DXGI_FORMAT_R16_UNORM:
+		return 16;
+
+	case DXGI_FORMAT_R8_UNORM:
+	case DXGI_FORMAT_A8_UNORM:
+		return 8;
+
+	case DXGI_FORMAT_BC1_UNORM:
+	case DXGI_FORMAT_BC1_UNORM_SRGB:
+	case DXGI_FORMAT_BC4_UNORM:
+	case DXGI_FORMAT_BC4_SNORM:
+		*blockCompressed = true;
+		return 4;
+
+	case DXGI_FORMAT_BC2_UNORM:
+	case DXGI_FORMAT_BC2_UNORM_SRGB:
+	case DXGI_FORMAT_BC3_UNORM:
+	case DXGI_FORMAT_BC3_UNORM_SRGB:
+	case DXGI_FORMAT_BC5_UNORM:
+	case DXGI_FORMAT_BC5_SNORM:
+	case DXGI_FORMAT_BC6H_UF16:
+	case DXGI_FORMAT_BC6H_SF16:
+	case DXGI_FORMAT_BC7_UNORM:
+	case DXGI_FORMAT_BC7_UNORM_SRGB:
+		*blockCompressed = true;
+		return 8;
+
+	default:
+		// Most other common formats (RGBA8, BGRA8, R10G10B10A2, R32, etc.)
+		return 32;
+	}
+}
+
+
+// --------------------------------------------------------------------------
+// Private helper for reloading a shader that has already been loaded.  The
+// new file is verified before the existing shader is touched, so a bad
+// compile leaves the old shader running.
+// --------------------------------------------------------------------------
+bool Assets::ReloadShader(std::wstring path)
+{
+	size_t shaderPathLength = rootShaderPath.size();
+	size_t shaderPathPosition = path.rfind(rootShaderPath);
+	if (shaderPathPosition == std::wstring::npos)
+		return false;
+
+	std::wstring name = RemoveFileExtension(path.substr(shaderPathPosition + shaderPathLength));
+
+	auto ps = pixelShaders.find(name);
+	if (ps != pixelShaders.end())
+	{
+		SimplePixelShader test(device, context, path.c_str());
+		if (!test.IsShaderValid())
+			return false;
+
+		return ps->second->ReloadShaderFile(path.c_str());
+	}
+
+	auto vs = vertexShaders.find(name);
+	if (vs != vertexShaders.end())
+	{
+		SimpleVertexShader test(device, context, path.c_str());
+		if (!test.IsShaderValid())
+			return false;
+
+		return vs->second->ReloadShaderFile(path.c_str());
+	}
+
+	return false;
+}
+
+
+// --------------------------------------------------------------------------
+// Private helper for reloading a material that has already been loaded.
+// If the file is invalid (perhaps it was saved mid-edit), the material
+// keeps its current values.
+// --------------------------------------------------------------------------
+bool Assets::ReloadMaterial(std::wstring path)
+{
+	size_t assetPathLength = rootAssetPath.size();
+	size_t assetPathPosition = path.rfind(rootAssetPath);
+	if (assetPathPosition == std::wstring::npos)
+		return false;
+
+	std::wstring name = RemoveFileExtension(path.substr(assetPathPosition + assetPathLength));
+
+	auto it = materials.find(name);
+	if (it == materials.end() || !it->second)
+		return false;
+
+	return ReadMaterialFile(path, it->second);
+}
+
+
+// --------------------------------------------------------------------------
+// Private helper for reloading a texture that has already been loaded.  The
+// new texture replaces the old one here and in every loaded material, and
+// the residency tracker is told about its (possibly new) size.
+// --------------------------------------------------------------------------
+bool Assets::ReloadTexture(std::wstring path)
+{
+	size_t assetPathLength = rootAssetPath.size();
+	size_t assetPathPosition = path.rfind(rootAssetPath);
+	if (assetPathPosition == std::wstring::npos)
+		return false;
+
+	std::wstring name = RemoveFileExtension(path.substr(assetPathPosition + assetPathLength));
+
+	auto it = textures.find(name);
+	if (it == textures.end())
+		return false;
+
+	// Load the new version, leaving the old one alone if that fails
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> newSRV;
+	if (EndsWith(path, L".dds"))
+		DirectX::CreateDDSTextureFromFile(device.Get(), context.Get(), path.c_str(), 0, newSRV.GetAddressOf());
+	else
+		DirectX::CreateWICTextureFromFile(device.Get(), context.Get(), path.c_str(), 0, newSRV.GetAddressOf());
+
+	if (!newSRV)
+		return false;
+
+	// Swap the texture everywhere it is referenced
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> oldSRV = it->second;
+	it->second = newSRV;
+	for (auto& m : materials)
+	{
+		if (m.second)
+			m.second->ReplaceTextureSRV(oldSRV, newSRV);
+	}
+
+	// Update the streaming details if this texture is streamed
+	auto streamed = streamedTextureIDs.find(oldSRV.Get());
+	if (streamed != streamedTextureIDs.end())
+	{
+		unsigned int id = streamed->second;
+		streamedTextureIDs.erase(streamed);
+
+		// Any file read for a restore is now out of date
+		{
+			std::lock_guard<std::mutex> lock(textureLoadMutex);
+			textureLoads.erase(id);
+		}
+
+		Microsoft::WRL::ComPtr<ID3D11Resource> resource;
+		Microsoft::WRL::ComPtr<ID3D11Texture2D> texture;
+		newSRV->GetResource(resource.GetAddressOf());
+		if (SUCCEEDED(resource.As(&texture)))
+		{
+			D3D11_TEXTURE2D_DESC desc = {};
+			texture->GetDesc(&desc);
+
+			bool blockCompressed = false;
+			unsigned int bpp = BitsPerPixel(desc.Format, &blockCompressed);
+			textureResidency.UpdateTexture(id, desc.Width, desc.Height, desc.MipLevels, desc.ArraySize, bpp, blockCompressed);
+			streamedTextureIDs.insert({ newSRV.Get(), id });
+		}
+	}
+
+	return true;
+}
+
+
+// --------------------------------------------------------------------------
+// Private helper for adding a texture loaded from a file to the residency
+// tracker.  Only simple 2D textures are streamed, as those are what
+// materials use.  Cube maps and arrays are left alone.
+// --------------------------------------------------------------------------
+void Assets::RegisterStreamedTexture(std::wstring name, std::wstring path, Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> srv)
+{
+	if (!srv)
+		return;
+
+	D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	srv->GetDesc(&srvDesc);
+	if (srvDesc.ViewDimension != D3D11_SRV_DIMENSION_TEXTURE2D)
+		return;
+
+	// Grab the details of the texture itself
+	Microsoft::WRL::ComPtr<ID3D11Resource> resource;
+	Microsoft::WRL::ComPtr<ID3D11Texture2D> texture;
+	srv->GetResource(resource.GetAddressOf());
+	if (FAILED(resource.As(&texture)))
+		return;
+
+	D3D11_TEXTURE2D_DESC desc = {};
+	texture->GetDesc(&desc);
+
+	bool blockCompressed = false;
+	unsigned int bpp = BitsPerPixel(desc.Format, &blockCompressed);
+
+	unsigned int id = textureResidency.RegisterTexture(
+		desc.Width, desc.Height, desc.MipLevels, desc.ArraySize, bpp, blockCompressed);
+
+	streamedTextures.push_back({ name, path });
+	streamedTextureIDs.insert({ srv.Get(), id });
+}
+
+
+// --------------------------------------------------------------------------
+// Private helper that creates a copy of a texture without its first few
+// mips, which frees that memory once the original is released.
+//
+// srv - the existing texture
+// firstMip - the mip of the existing texture that becomes mip 0 of the copy
+// --------------------------------------------------------------------------
+Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> Assets::CopyMipsToNewTexture(Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> srv, unsigned int firstMip)
+{
+	Microsoft::WRL::ComPtr<ID3D11Resource> resource;
+	Microsoft::WRL::ComPtr<ID3D11Texture2D> texture;
+	srv->GetResource(resource.GetAddressOf());
+	if (FAILED(resource.As(&texture)))
+		return 0;
+
+	D3D11_TEXTURE2D_DESC desc = {};
+	texture->GetDesc(&desc);
+	if (firstMip >= desc.MipLevels)
+		return 0;
+
+	// Same texture, just smaller
+	D3D11_TEXTURE2D_DESC newDesc = desc;
+	newDesc.Width = max(1u, desc.Width >> firstMip);
+	newDesc.Height = max(1u, desc.Height >> firstMip);
+	newDesc.MipLevels = desc.MipLevels - firstMip;
+
+	Microsoft::WRL::ComPtr<ID3D11Texture2D> newTexture;
+	if (FAILED(device->CreateTexture2D(&newDesc, 0, newTexture.GetAddressOf())))
+		return 0;
+
+	// Copy the remaining mips over on the GPU
+	for (unsigned int slice = 0; slice < desc.ArraySize; slice++)
+	{
+		for (unsigned int m = 0; m < newDesc.MipLevels; m++)
+		{
+			context->CopySubresourceRegion(
+				newTexture.Get(), D3D11CalcSubresource(m, slice, newDesc.MipLevels), 0, 0, 0,
+				texture.Get(), D3D11CalcSubresource(m + firstMip, slice, desc.MipLevels), 0);
+		}
+	}
+
+	// Matching view of the new texture
+	D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	srv->GetDesc(&srvDesc);
+	srvDesc.Texture2D.MostDetailedMip = 0;
+	srvDesc.Texture2D.MipLevels = newDesc.MipLevels;
+
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> newSRV;
+	device->CreateShaderResourceView(newTexture.Get(), &srvDesc, newSRV.GetAddressOf());
+	return newSRV;
+}
+
+
+// --------------------------------------------------------------------------
+// Called by the residency tracker when a texture needs a different set
+// of mips.  Dropping mips copies the remaining ones into a smaller texture,
+// while restoring mips needs the texture's file.  That file is read on the
+// texture loading thread, so restoring returns false (and the tracker asks
+// again next frame) until the file's contents are ready.  Either way, the
+// new texture is created and swapped in here, on the main thread, and
+// replaces the old one in every loaded material.
+// --------------------------------------------------------------------------
+bool Assets::SetResidentTopMip(unsigned int textureID, unsigned int topMip)
+{
+	const ResidentTexture* info = textureResidency.GetTexture(textureID);
+	if (!info || textureID >= streamedTextures.size())
+		return false;
+
+	StreamedTexture& streamed = streamedTextures[textureID];
+	auto it = textures.find(streamed.Name);
+	if (it == textures.end() || !it->second)
+		return false;
+
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> oldSRV = it->second;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> newSRV;
+	if (topMip > info->ResidentTopMip)
+	{
+		// Dropping: the current texture already has everything we need
+		newSRV = CopyMipsToNewTexture(oldSRV, topMip - info->ResidentTopMip);
+	}
+	else
+	{
+		// Restoring: the dropped mips only exist on disk
+		std::vector<uint8_t> fileData;
+		if (!TakeLoadedTextureFile(textureID, fileData))
+			return false;
+
+		Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> fullSRV;
+		if (EndsWith(streamed.Path, L".dds"))
+			DirectX::CreateDDSTextureFromMemory(device.Get(), context.Get(), fileData.data(), fileData.size(), 0, fullSRV.GetAddressOf());
+		else
+			DirectX::CreateWICTextureFromMemory(device.Get(), context.Get(), fileData.data(), fileData.size(), 0, fullSRV.GetAddressOf());
+
+		if (!fullSRV)
+			return false;
+
+		newSRV = topMip > 0 ? CopyMipsToNewTexture(fullSRV, topMip) : fullSRV;
+	}
+
+	if (!newSRV)
+		return false;
+
+	// Swap the texture everywhere it is referenced
+	it->second = newSRV;
+	streamedTextureIDs.erase(oldSRV.Get());
+	streamedTextureIDs.insert({ newSRV.Get(), textureID });
+	for (auto& m : materials)
+	{
+		if (m.second)
+			m.second->ReplaceTextureSRV(oldSRV, newSRV);
+	}
+
+	return true;
+}
+
+
+// --------------------------------------------------------------------------
+// Private helper that hands over a streamed texture's file once the loading
+// thread has read it.  If the file hasn't been asked for yet, it is queued
+// for loading.  Returns false until the contents are available.
+//
+// textureID - the residency tracker's ID for the texture
+// fileData - receives the contents of the texture's file
+// --------------------------------------------------------------------------
+bool Assets::TakeLoadedTextureFile(unsigned int textureID, std::vector<uint8_t>& fileData)
+{
+	std::lock_guard<std::mutex> lock(textureLoadMutex);
+
+	auto load = textureLoads.find(textureID);
+	if (load == textureLoads.end())
+	{
+		// Start the loading thread the first time it's needed
+		if (!textureLoadThread.joinable())
+		{
+			textureLoadThreadRunning = true;
+			textureLoadThread = std::thread(&Assets::TextureLoadThread, this);
+		}
+
+		unsigned int ticket = nextTextureLoadTicket++;
+		textureLoads[textureID] = { ticket, false, {} };
+		textureLoadQueue.push_back({ textureID, ticket, streamedTextures[textureID].Path });
+		textureLoadCondition.notify_one();
+		return false;
+	}
+
+	if (!load->second.Finished)
+		return false;
+
+	// A file that could not be read is tried again next time
+	fileData = std::move(load->second.FileData);
+	textureLoads.erase(load);
+	return !fileData.empty();
+}
+
+
+// --------------------------------------------------------------------------
+// Body of the texture loading thread, which reads queued texture files
+// into memory.  It never touches the device, context or any other asset,
+// so the only shared state is the queue and the finished loads.
+// --------------------------------------------------------------------------
+void Assets::TextureLoadThread()
+{
+	while (true)
+	{
+		TextureLoadRequest request;
+		{
+			std::unique_lock<std::mutex> lock(textureLoadMutex);
+			textureLoadCondition.wait(lock, [&] { return !textureLoadThreadRunning || !textureLoadQueue.empty(); });
+			if (!textureLoadThreadRunning)
+				return;
+
+			request = textureLoadQueue.front();
+			textureLoadQueue.pop_front();
+		}
+
+		// Read the whole file without holding the lock
+		std::vector<uint8_t> fileData;
+		std::ifstream file(request.Path, std::ios::binary | std::ios::ate);
+		if (file.is_open())
+		{
+			fileData.resize((size_t)file.tellg());
+			file.seekg(0);
+			if (!file.read((char*)fileData.data(), fileData.size()))
+				fileData.clear();
+		}
+
+		// Only keep the results if this load is still wanted
+		std::lock_guard<std::mutex> lock(textureLoadMutex);
+		auto load = textureLoads.find(request.TextureID);
+		if (load != textureLoads.end() && load->second.Ticket == request.Ticket)
+		{
+			load->second.FileData = std::move(fileData);
+			load->second.Finished = true;
+		}
+	}
+}
+
+
 // ----------------------------------------------------
 // Determines if the given string ends with the given ending
 // ----------------------------------------------------
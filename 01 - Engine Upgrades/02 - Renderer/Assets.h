@@ -4,6 +4,11 @@
 #include <string>
 #include <memory>
 #include <unordered_map>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include <WICTextureLoader.h>
 #include <wrl/client.h>
 #include <DirectXMath.h>
@@ -12,9 +17,11 @@
 #include "Mesh.h"
 #include "Material.h"
 #include "SimpleShader.h"
+#include "TextureResidency.h"
+#include "FileWatcher.h"
 
 
-class Assets
+class Assets : public ITextureStreamer
 {
 #pragma region Singleton
 public:
@@ -37,7 +44,13 @@ private:
 	static Assets* instance;
 	Assets() : 
 		allowOnDemandLoading(true),
-		printLoadingProgress(false)	{};
+		printLoadingProgress(false),
+		hotReloadEnabled(false),
+		textureLoadThreadRunning(false),
+		nextTextureLoadTicket(0)
+	{
+		textureResidency.SetStreamer(this);
+	};
 #pragma endregion
 
 public:
@@ -81,6 +94,15 @@ public:
 	unsigned int GetSamplerCount();
 	unsigned int GetTextureCount();
 
+	// Texture memory budget and mip streaming
+	TextureResidency& GetTextureResidency();
+	void RequestMaterialTextures(std::shared_ptr<Material> material, float distance);
+	void UpdateTextureResidency();
+
+	// Reloading assets when their files change
+	void EnableHotReload();
+	void ReloadChangedAssets();
+
 private:
 
 	std::shared_ptr<Mesh> LoadMesh(std::wstring path);
@@ -92,6 +114,19 @@ private:
 	void LoadUnknownShader(std::wstring path);
 	std::shared_ptr<SimplePixelShader> LoadPixelShader(std::wstring path);
 	std::shared_ptr<SimpleVertexShader> LoadVertexShader(std::wstring path);
+	bool ReadMaterialFile(std::wstring path, std::shared_ptr<Material> mat);
+
+	// Hot reload helpers
+	bool ReloadShader(std::wstring path);
+	bool ReloadMaterial(std::wstring path);
+	bool ReloadTexture(std::wstring path);
+
+	// Texture streaming helpers
+	void RegisterStreamedTexture(std::wstring name, std::wstring path, Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> srv);
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> CopyMipsToNewTexture(Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> srv, unsigned int firstMip);
+	bool SetResidentTopMip(unsigned int textureID, unsigned int topMip);
+	bool TakeLoadedTextureFile(unsigned int textureID, std::vector<uint8_t>& fileData);
+	void TextureLoadThread();
 
 	Microsoft::WRL::ComPtr<ID3D11Device> device;
 	Microsoft::WRL::ComPtr<ID3D11DeviceContext> context;
@@ -109,6 +144,42 @@ private:
 	std::unordered_map<std::wstring, Microsoft::WRL::ComPtr<ID3D11SamplerState>> samplers;
 	std::unordered_map<std::wstring, Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>> textures;
 
+	// Textures loaded from files can have their mips streamed
+	struct StreamedTexture
+	{
+		std::wstring Name;
+		std::wstring Path;
+	};
+	TextureResidency textureResidency;
+	std::vector<StreamedTexture> streamedTextures;
+	std::unordered_map<ID3D11ShaderResourceView*, unsigned int> streamedTextureIDs;
+
+	// Restoring mips needs the texture's file, which is read on a
+	// separate thread so the main thread only creates and swaps it
+	struct TextureLoad
+	{
+		unsigned int Ticket;
+		bool Finished;
+		std::vector<uint8_t> FileData;
+	};
+	struct TextureLoadRequest
+	{
+		unsigned int TextureID;
+		unsigned int Ticket;
+		std::wstring Path;
+	};
+	std::thread textureLoadThread;
+	std::mutex textureLoadMutex;
+	std::condition_variable textureLoadCondition;
+	std::deque<TextureLoadRequest> textureLoadQueue;
+	std::unordered_map<unsigned int, TextureLoad> textureLoads;
+	bool textureLoadThreadRunning;
+	unsigned int nextTextureLoadTicket;
+
+	// Watches the asset and shader folders for changes
+	FileWatcher fileWatcher;
+	bool hotReloadEnabled;
+
 	// Helpers for paths
 	bool EndsWith(std::wstring str, std::wstring ending);
 	std::wstring RemoveFileExtension(std::wstring str);
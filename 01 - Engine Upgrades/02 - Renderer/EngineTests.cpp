@@ -0,0 +1,21 @@
+#include "EngineTests.h"
+#include "TextureResidency.h"
+#include "ShaderReflectionCache.h"
+
+#include <cstdio>
+
+// --------------------------------------------------------
+// Runs every check, printing as it goes
+// --------------------------------------------------------
+bool RunEngineTests()
+{
+	printf("\nTexture residency policy (fake streamer):\n");
+	TextureResidencyTestResults residency = TextureResidency::Test();
+	printf("  %u checks, %u failed\n", residency.Checks, residency.Failures);
+
+	printf("\nShader reflection cache format:\n");
+	ShaderReflectionCacheTestResults cacheFormat = ShaderReflectionCache::Test();
+	printf("  %u checks, %u failed\n", cacheFormat.Checks, cacheFormat.Failures);
+
+	return residency.Passed && cacheFormat.Passed;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+// --------------------------------------------------------
+// The device-free half of "-test": the texture residency
+// policy against a fake streamer, and the shader reflection
+// cache's file format.  Nothing here needs Windows or D3D,
+// so it runs from WinMain and from the portable
+// EngineTestsMain.cpp.
+//
+// Prints its results and returns true if everything passed.
+// --------------------------------------------------------
+bool RunEngineTests();
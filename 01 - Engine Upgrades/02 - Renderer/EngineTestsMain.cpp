@@ -0,0 +1,15 @@
+#include <cstdio>
+#include "EngineTests.h"
+
+// --------------------------------------------------------
+// Console entry point for the device-free "-test" checks,
+// for building without Windows or D3D (see CMakeLists.txt).
+// The reflection cache checks on real shaders need a device,
+// so they stay in WinMain.
+// --------------------------------------------------------
+int main()
+{
+	bool passed = RunEngineTests();
+	printf("\n%s\n", passed ? "All tests passed" : "TESTS FAILED");
+	return passed ? 0 : 1;
+}
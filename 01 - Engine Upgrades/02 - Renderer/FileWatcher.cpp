@@ -0,0 +1,319 @@
+#include "FileWatcher.h"
+
+#include <algorithm>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/inotify.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <errno.h>
+#include <codecvt>
+#include <locale>
+#endif
+
+
+#ifdef _WIN32
+// --------------------------------------------------------
+// A directory handle and its outstanding change request
+// --------------------------------------------------------
+struct FileWatcher::WatchedDirectory
+{
+	std::wstring Path;
+	bool Recursive;
+	HANDLE Directory;
+	OVERLAPPED Overlapped;
+	DWORD Buffer[4096]; // DWORD-aligned, as required by ReadDirectoryChangesW
+};
+
+// The kinds of changes we care about
+static const DWORD WatchFilter = FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE;
+#else
+// --------------------------------------------------------
+// An inotify watch descriptor for a single directory, as
+// inotify does not watch subdirectories on its own
+// --------------------------------------------------------
+struct FileWatcher::WatchedDirectory
+{
+	std::wstring Path;
+	bool Recursive;
+	int WatchDescriptor;
+};
+
+// Helpers for converting paths, as inotify uses narrow strings
+static std::string ToNarrow(const std::wstring& str)
+{
+	std::wstring_convert<std::codecvt_utf8<wchar_t>> converter;
+	return converter.to_bytes(str);
+}
+
+static std::wstring ToWide(const std::string& str)
+{
+	std::wstring_convert<std::codecvt_utf8<wchar_t>> converter;
+	return converter.from_bytes(str);
+}
+#endif
+
+
+// --------------------------------------------------------
+// Helper for making paths consistent: forward slashes and
+// a trailing slash on directories
+// --------------------------------------------------------
+static std::wstring NormalizeDirectory(std::wstring path)
+{
+	std::replace(path.begin(), path.end(), '\\', '/');
+	if (path.empty() || path.back() != '/')
+		path += L"/";
+	return path;
+}
+
+
+// --------------------------------------------------------
+// Constructor - nothing is watched until WatchDirectory()
+// --------------------------------------------------------
+FileWatcher::FileWatcher() :
+	settleTime(0.1f)
+{
+#ifndef _WIN32
+	inotifyHandle = inotify_init1(IN_NONBLOCK);
+#endif
+}
+
+// --------------------------------------------------------
+// Destructor - Releases all OS handles
+// --------------------------------------------------------
+FileWatcher::~FileWatcher()
+{
+	for (auto d : directories)
+	{
+#ifdef _WIN32
+		CancelIo(d->Directory);
+		CloseHandle(d->Directory);
+		CloseHandle(d->Overlapped.hEvent);
+#else
+		inotify_rm_watch(inotifyHandle, d->WatchDescriptor);
+#endif
+		delete d;
+	}
+
+#ifndef _WIN32
+	if (inotifyHandle >= 0)
+		close(inotifyHandle);
+#endif
+}
+
+
+// --------------------------------------------------------
+// Begins watching a directory for changes
+//
+// path - The directory to watch
+// recursive - Should subdirectories be watched, too?
+//
+// Returns true if the directory is being watched
+// --------------------------------------------------------
+bool FileWatcher::WatchDirectory(std::wstring path, bool recursive)
+{
+	path = NormalizeDirectory(path);
+
+#ifdef _WIN32
+	HANDLE dirHandle = CreateFileW(
+		path.c_str(),
+		FILE_LIST_DIRECTORY,
+		FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		0,
+		OPEN_EXISTING,
+		FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED,
+		0);
+	if (dirHandle == INVALID_HANDLE_VALUE)
+		return false;
+
+	WatchedDirectory* dir = new WatchedDirectory();
+	dir->Path = path;
+	dir->Recursive = recursive;
+	dir->Directory = dirHandle;
+	dir->Overlapped = {};
+	dir->Overlapped.hEvent = CreateEvent(0, TRUE, FALSE, 0);
+
+	// Start the first (asynchronous) request for changes
+	if (!ReadDirectoryChangesW(dirHandle, dir->Buffer, sizeof(dir->Buffer), recursive, WatchFilter, 0, &dir->Overlapped, 0))
+	{
+		CloseHandle(dir->Overlapped.hEvent);
+		CloseHandle(dirHandle);
+		delete dir;
+		return false;
+	}
+
+	directories.push_back(dir);
+	return true;
+#else
+	if (inotifyHandle < 0)
+		return false;
+
+	return AddInotifyWatch(path, recursive);
+#endif
+}
+
+
+// --------------------------------------------------------
+// Returns any files that changed and have since settled.
+// Each file is only reported once per batch of changes.
+// --------------------------------------------------------
+std::vector<std::wstring> FileWatcher::GetChangedFiles()
+{
+	PollDirectories();
+
+	std::vector<std::wstring> changed;
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	for (auto it = pendingChanges.begin(); it != pendingChanges.end();)
+	{
+		std::chrono::duration<float> sinceChange = now - it->second;
+		if (sinceChange.count() >= settleTime)
+		{
+			changed.push_back(it->first);
+			it = pendingChanges.erase(it);
+		}
+		else
+		{
+			it++;
+		}
+	}
+
+	return changed;
+}
+
+
+// --------------------------------------------------------
+// How long (in seconds) a file must go without changing
+// before it is reported
+// --------------------------------------------------------
+void FileWatcher::SetSettleTime(float seconds) { settleTime = seconds; }
+float FileWatcher::GetSettleTime() { return settleTime; }
+
+
+// --------------------------------------------------------
+// Checks the OS for new changes without waiting
+// --------------------------------------------------------
+void FileWatcher::PollDirectories()
+{
+#ifdef _WIN32
+	for (auto d : directories)
+	{
+		// Has the outstanding request finished?
+		DWORD bytes = 0;
+		if (!GetOverlappedResult(d->Directory, &d->Overlapped, &bytes, FALSE))
+			continue;
+
+		// Zero bytes means the buffer overflowed and the changes were lost
+		if (bytes > 0)
+		{
+			FILE_NOTIFY_INFORMATION* info = (FILE_NOTIFY_INFORMATION*)d->Buffer;
+			while (true)
+			{
+				if (info->Action == FILE_ACTION_ADDED ||
+					info->Action == FILE_ACTION_MODIFIED ||
+					info->Action == FILE_ACTION_RENAMED_NEW_NAME)
+				{
+					std::wstring name(info->FileName, info->FileNameLength / sizeof(WCHAR));
+					AddChange(d->Path + name);
+				}
+
+				if (info->NextEntryOffset == 0)
+					break;
+
+				info = (FILE_NOTIFY_INFORMATION*)((unsigned char*)info + info->NextEntryOffset);
+			}
+		}
+
+		// Ask for the next set of changes
+		ResetEvent(d->Overlapped.hEvent);
+		ReadDirectoryChangesW(d->Directory, d->Buffer, sizeof(d->Buffer), d->Recursive, WatchFilter, 0, &d->Overlapped, 0);
+	}
+#else
+	if (inotifyHandle < 0)
+		return;
+
+	// Read as many events as are waiting
+	alignas(inotify_event) char buffer[4096];
+	while (true)
+	{
+		ssize_t length = read(inotifyHandle, buffer, sizeof(buffer));
+		if (length <= 0)
+			break; // EAGAIN - nothing left to read
+
+		for (char* ptr = buffer; ptr < buffer + length;)
+		{
+			inotify_event* ev = (inotify_event*)ptr;
+			ptr += sizeof(inotify_event) + ev->len;
+
+			// Which directory is this from?
+			auto dir = std::find_if(directories.begin(), directories.end(),
+				[ev](WatchedDirectory* d) { return d->WatchDescriptor == ev->wd; });
+			if (dir == directories.end() || ev->len == 0)
+				continue;
+
+			std::wstring path = (*dir)->Path + ToWide(ev->name);
+			if (ev->mask & IN_ISDIR)
+			{
+				// Start watching new subdirectories
+				if ((*dir)->Recursive && (ev->mask & (IN_CREATE | IN_MOVED_TO)))
+					AddInotifyWatch(path, true);
+			}
+			else
+			{
+				AddChange(path);
+			}
+		}
+	}
+#endif
+}
+
+
+// --------------------------------------------------------
+// Records a change, resetting its settle timer
+// --------------------------------------------------------
+void FileWatcher::AddChange(std::wstring path)
+{
+	std::replace(path.begin(), path.end(), '\\', '/');
+	pendingChanges[path] = std::chrono::steady_clock::now();
+}
+
+
+#ifndef _WIN32
+// --------------------------------------------------------
+// Adds an inotify watch for a directory and, if requested,
+// all of its subdirectories
+// --------------------------------------------------------
+bool FileWatcher::AddInotifyWatch(std::wstring path, bool recursive)
+{
+	path = NormalizeDirectory(path);
+	std::string narrowPath = ToNarrow(path);
+
+	int wd = inotify_add_watch(inotifyHandle, narrowPath.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+	if (wd < 0)
+		return false;
+
+	WatchedDirectory* dir = new WatchedDirectory();
+	dir->Path = path;
+	dir->Recursive = recursive;
+	dir->WatchDescriptor = wd;
+	directories.push_back(dir);
+
+	if (!recursive)
+		return true;
+
+	// Watch each subdirectory, too
+	DIR* d = opendir(narrowPath.c_str());
+	if (!d)
+		return true;
+
+	while (dirent* entry = readdir(d))
+	{
+		std::string name = entry->d_name;
+		if (entry->d_type == DT_DIR && name != "." && name != "..")
+			AddInotifyWatch(path + ToWide(name), true);
+	}
+	closedir(d);
+	return true;
+}
+#endif
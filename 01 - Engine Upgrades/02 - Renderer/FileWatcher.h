@@ -0,0 +1,47 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <unordered_map>
+
+// --------------------------------------------------------
+// Watches directories for files that are created or
+// modified, using ReadDirectoryChangesW on Windows and
+// inotify on Linux.  Changes are polled (never blocking)
+// and only reported once a file has stopped changing for
+// a short time, since most tools write files in pieces.
+// --------------------------------------------------------
+class FileWatcher
+{
+public:
+	FileWatcher();
+	~FileWatcher();
+
+	// Remove these functions, as the watcher owns OS handles
+	FileWatcher(FileWatcher const&) = delete;
+	void operator=(FileWatcher const&) = delete;
+
+	bool WatchDirectory(std::wstring path, bool recursive);
+	std::vector<std::wstring> GetChangedFiles();
+
+	void SetSettleTime(float seconds);
+	float GetSettleTime();
+
+private:
+	// Platform-specific details for each watched directory
+	struct WatchedDirectory;
+	std::vector<WatchedDirectory*> directories;
+
+	// Changed files (with '/' separators) and when they last changed
+	std::unordered_map<std::wstring, std::chrono::steady_clock::time_point> pendingChanges;
+	float settleTime;
+
+#ifndef _WIN32
+	int inotifyHandle;
+	bool AddInotifyWatch(std::wstring path, bool recursive);
+#endif
+
+	void PollDirectories();
+	void AddChange(std::wstring path);
+};
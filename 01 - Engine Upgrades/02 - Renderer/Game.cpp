@@ -47,7 +47,9 @@ Game::Game(HINSTANCE hInstance)
 		true),				// Show extra stats (fps) in title bar?
 	lightCount(0),
 	showUIDemoWindow(false),
-	useOptimizedRendering(false)
+	useOptimizedRendering(false),
+	limitTextureMemory(false),
+	textureBudgetMB(64)
 {
 	// Seed random
 	srand((unsigned int)time(0));
@@ -129,6 +131,9 @@ void Game::LoadAssetsAndCreateEntities()
 	Assets& assets = Assets::GetInstance();
 	assets.Initialize(L"../../../../Assets/", L"./", device, context, true, true);
 
+	// Reload shaders, materials and textures when their files change
+	assets.EnableHotReload();
+
 	// Load a scene json file
 	scene = Scene::Load(FixPath(L"../../../../Assets/Scenes/twoRows.scene"), device, context);
 	scene->GetCurrentCamera()->UpdateProjectionMatrix(this->windowWidth / (float)this->windowHeight);
@@ -216,6 +221,9 @@ void Game::Update(float deltaTime, float totalTime)
 	UINewFrame(deltaTime);
 	BuildUI();
 
+	// Pick up any assets that changed on disk
+	Assets::GetInstance().ReloadChangedAssets();
+
 	// Update the camera
 	scene->GetCurrentCamera()->Update(deltaTime);
 
@@ -239,6 +247,9 @@ void Game::Draw(float deltaTime, float totalTime)
 	else
 		renderer->RenderSimple(scene, lightCount);
 
+	// Now that we know which textures were used, enforce the texture budget
+	Assets::GetInstance().UpdateTextureResidency();
+
 	// Finalize the frame
 	renderer->FrameEnd(vsync || !deviceSupportsTearing || isFullscreen);
 }
@@ -410,6 +421,48 @@ void Game::BuildUI()
 		{
 			ImGui::Checkbox("Optimize Rendering", &useOptimizedRendering);
 
+			bool useHandles = renderer->GetUseVariableHandles();
+			if (ImGui::Checkbox("Use Shader Variable Handles", &useHandles))
+				renderer->SetUseVariableHandles(useHandles);
+			ImGui::Text("Per-Entity Shader Data: %.3f us", renderer->GetPerEntityDataMicroseconds());
+
+			ImGui::Spacing();
+			ImGui::Checkbox("Skip Redundant CBuffer Uploads", &ISimpleShader::SkipRedundantUploads);
+			ImGui::Text("CBuffer Uploads Issued:  %u", ISimpleShader::BufferUploadsIssued);
+			ImGui::Text("CBuffer Uploads Skipped: %u", ISimpleShader::BufferUploadsSkipped);
+
+			// Finalize the tree node
+			ImGui::TreePop();
+		}
+
+		// --- Texture Memory ---
+		if (ImGui::TreeNode("Texture Memory"))
+		{
+			TextureResidency& residency = Assets::GetInstance().GetTextureResidency();
+			const float mb = 1024.0f * 1024.0f;
+
+			ImGui::Spacing();
+			ImGui::Text("Streamed Textures: %u", residency.GetTextureCount());
+			ImGui::Text("Resident:        %.2f MB", residency.GetResidentBytes() / mb);
+			ImGui::Text("Requested:       %.2f MB", residency.GetRequestedBytes() / mb);
+			ImGui::Text("Full Resolution: %.2f MB", residency.GetFullResolutionBytes() / mb);
+			ImGui::Text("Mips Dropped / Restored: %u / %u", residency.GetMipsDroppedLastUpdate(), residency.GetMipsRestoredLastUpdate());
+			ImGui::Spacing();
+
+			// Budget controls
+			bool budgetChanged = ImGui::Checkbox("Limit Texture Memory", &limitTextureMemory);
+			if (limitTextureMemory)
+				budgetChanged |= ImGui::SliderInt("Budget (MB)", &textureBudgetMB, 1, 512);
+
+			if (budgetChanged)
+				residency.SetBudget(limitTextureMemory ? (size_t)textureBudgetMB * 1024 * 1024 : (size_t)-1);
+
+			float fullDetailDistance = residency.GetFullDetailDistance();
+			if (ImGui::DragFloat("Full Detail Distance", &fullDetailDistance, 0.1f, 0.1f, 100.0f))
+				residency.SetFullDetailDistance(fullDetailDistance);
+
+			ImGui::Spacing();
+
 			// Finalize the tree node
 			ImGui::TreePop();
 		}
@@ -53,5 +53,7 @@ private:
 	bool useOptimizedRendering;
 	bool showUIDemoWindow;
 	int lightCount;
+	bool limitTextureMemory;
+	int textureBudgetMB;
 };
 
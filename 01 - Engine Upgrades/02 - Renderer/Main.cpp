@@ -1,6 +1,27 @@
 
 #include <Windows.h>
+#include <stdio.h>
+#include <string.h>
 #include "Game.h"
+#include "EngineTests.h"
+#include "Renderer.h"
+#include "SimpleShader.h"
+#include "Helpers.h"
+
+// --------------------------------------------------------
+// Creates a device (hardware if possible, otherwise WARP)
+// for the headless tests and benchmarks, which need to
+// load shaders but never open a window
+// --------------------------------------------------------
+static HRESULT CreateWindowlessDevice(
+	Microsoft::WRL::ComPtr<ID3D11Device>& device,
+	Microsoft::WRL::ComPtr<ID3D11DeviceContext>& context)
+{
+	HRESULT hr = D3D11CreateDevice(0, D3D_DRIVER_TYPE_HARDWARE, 0, 0, 0, 0, D3D11_SDK_VERSION, device.GetAddressOf(), 0, context.GetAddressOf());
+	if (FAILED(hr))
+		hr = D3D11CreateDevice(0, D3D_DRIVER_TYPE_WARP, 0, 0, 0, 0, D3D11_SDK_VERSION, device.ReleaseAndGetAddressOf(), 0, context.ReleaseAndGetAddressOf());
+	return hr;
+}
 
 // --------------------------------------------------------
 // Entry point for a graphical (non-console) Windows application
@@ -18,6 +39,83 @@ int WINAPI WinMain(
 	_CrtSetDbgFlag(_CRTDBG_ALLOC_MEM_DF | _CRTDBG_LEAK_CHECK_DF);
 #endif
 
+	// "-test" runs the engine's self tests (texture residency and the
+	// shader reflection cache) without opening a window and returns
+	// non-zero if any of them fail
+	if (strstr(lpCmdLine, "-test"))
+	{
+		// Print to the console we were launched from, or a new one
+		if (!AttachConsole(ATTACH_PARENT_PROCESS))
+			AllocConsole();
+		FILE* stream;
+		freopen_s(&stream, "CONOUT$", "w", stdout);
+
+		// The checks that need no device (also built without
+		// Windows from EngineTestsMain.cpp)
+		bool enginePassed = RunEngineTests();
+
+		// Loading real shaders needs a device, but nothing is drawn
+		printf("\nShader reflection cache files (VertexShader.cso):\n");
+		ShaderReflectionCacheTestResults cacheFiles = {};
+		Microsoft::WRL::ComPtr<ID3D11Device> device;
+		Microsoft::WRL::ComPtr<ID3D11DeviceContext> context;
+		if (SUCCEEDED(CreateWindowlessDevice(device, context)))
+		{
+			cacheFiles = ISimpleShader::TestReflectionCache(
+				device, context, FixPath(L"VertexShader.cso").c_str(), FixPath(L"PixelShader.cso").c_str());
+			printf("  %u checks, %u failed\n", cacheFiles.Checks, cacheFiles.Failures);
+		}
+		else
+		{
+			printf("  FAILED: Unable to create a device\n");
+		}
+
+		bool passed = enginePassed && cacheFiles.Passed;
+		printf("\n%s\n", passed ? "All tests passed" : "TESTS FAILED");
+		return passed ? 0 : 1;
+	}
+
+	// "-benchmark" times setting per-entity shader data by name and
+	// by pre-resolved handle on a device with no window, and fails if
+	// the two disagree or stale handles survive a shader reload
+	if (strstr(lpCmdLine, "-benchmark"))
+	{
+		// Print to the console we were launched from, or a new one
+		if (!AttachConsole(ATTACH_PARENT_PROCESS))
+			AllocConsole();
+		FILE* stream;
+		freopen_s(&stream, "CONOUT$", "w", stdout);
+
+		// A device is needed for the shader, but nothing is drawn
+		Microsoft::WRL::ComPtr<ID3D11Device> device;
+		Microsoft::WRL::ComPtr<ID3D11DeviceContext> context;
+		if (FAILED(CreateWindowlessDevice(device, context)))
+		{
+			printf("Unable to create a device\n");
+			return 1;
+		}
+
+		printf("\nPer-entity shader data, microseconds per entity (by name vs. by handle):\n");
+		bool passed = true;
+		unsigned int entityCounts[] = { 100, 1000, 10000 };
+		for (unsigned int entities : entityCounts)
+		{
+			ShaderHandleBenchmarkResults results = Renderer::BenchmarkVariableHandles(
+				device, context, FixPath(L"VertexShader.cso"), entities, 100);
+			printf("  %5u entities: %.3f vs. %.3f (%.1fx faster)%s%s\n",
+				results.Entities,
+				results.NameMicrosecondsPerEntity,
+				results.HandleMicrosecondsPerEntity,
+				results.HandleMicrosecondsPerEntity > 0.0 ? results.NameMicrosecondsPerEntity / results.HandleMicrosecondsPerEntity : 0.0,
+				results.DataMatches ? "" : " - DATA DIFFERS",
+				results.StaleHandlesRejected ? "" : " - STALE HANDLE ACCEPTED");
+			passed &= results.Passed;
+		}
+
+		printf("\n%s\n", passed ? "Benchmark passed" : "BENCHMARK FAILED");
+		return passed ? 0 : 1;
+	}
+
 	// Create the Game object using
 	// the app handle we got from WinMain
 	Game dxGame(hInstance);
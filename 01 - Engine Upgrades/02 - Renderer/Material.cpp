@@ -49,6 +49,11 @@ Microsoft::WRL::ComPtr<ID3D11SamplerState> Material::GetSampler(std::string name
 	return it->second;
 }
 
+const std::unordered_map<std::string, Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>>& Material::GetTextureSRVs()
+{
+	return textureSRVs;
+}
+
 // Setters
 void Material::SetPixelShader(std::shared_ptr<SimplePixelShader> ps) { this->ps = ps; }
 void Material::SetVertexShader(std::shared_ptr<SimpleVertexShader> vs) { this->vs = vs; }
@@ -77,6 +82,34 @@ void Material::RemoveSampler(std::string name)
 	samplers.erase(name);
 }
 
+void Material::ClearTextureSRVs()
+{
+	textureSRVs.clear();
+}
+
+void Material::ClearSamplers()
+{
+	samplers.clear();
+}
+
+// Swaps every use of one texture for another, which
+// allows textures to be recreated (like when their mips
+// are streamed) without rebuilding the material.
+// Returns true if the old texture was found
+bool Material::ReplaceTextureSRV(Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> oldSRV, Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> newSRV)
+{
+	bool found = false;
+	for (auto& t : textureSRVs)
+	{
+		if (t.second == oldSRV)
+		{
+			t.second = newSRV;
+			found = true;
+		}
+	}
+	return found;
+}
+
 
 void Material::PrepareMaterial(Transform* transform, std::shared_ptr<Camera> camera)
 {
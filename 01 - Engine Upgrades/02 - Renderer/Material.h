@@ -27,6 +27,7 @@ public:
 	DirectX::XMFLOAT3 GetColorTint();
 	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> GetTextureSRV(std::string name);
 	Microsoft::WRL::ComPtr<ID3D11SamplerState> GetSampler(std::string name);
+	const std::unordered_map<std::string, Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>>& GetTextureSRVs();
 
 	void SetPixelShader(std::shared_ptr<SimplePixelShader> ps);
 	void SetVertexShader(std::shared_ptr<SimpleVertexShader> ps);
@@ -39,6 +40,10 @@ public:
 
 	void RemoveTextureSRV(std::string name);
 	void RemoveSampler(std::string name);
+	void ClearTextureSRVs();
+	void ClearSamplers();
+
+	bool ReplaceTextureSRV(Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> oldSRV, Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> newSRV);
 
 	void PrepareMaterial(Transform* transform, std::shared_ptr<Camera> camera);
 	void SetPerMaterialDataAndResources(bool copyToGPUNow);
@@ -1,8 +1,11 @@
 #include "Renderer.h"
+#include "Assets.h"
 
 #include "../../Common/ImGui/imgui.h"
 #include "../../Common/ImGui/imgui_impl_dx11.h"
 
+#include <chrono>
+
 Renderer::Renderer(
 	Microsoft::WRL::ComPtr<ID3D11Device> device, 
 	Microsoft::WRL::ComPtr<ID3D11DeviceContext> context, 
@@ -20,7 +23,9 @@ Renderer::Renderer(
 	backBufferRTV(backBufferRTV),
 	depthBufferDSV(depthBufferDSV),
 	vsPerFrameData{},
-	psPerFrameData{}
+	psPerFrameData{},
+	useVariableHandles(true),
+	perEntityDataMicroseconds(0.0f)
 {
 	// Create per-frame constant buffers for the renderer
 	D3D11_BUFFER_DESC perFrame = {};
@@ -65,6 +70,9 @@ void Renderer::FrameStart()
 
 	// Clear the depth buffer (resets per-pixel occlusion information)
 	context->ClearDepthStencilView(depthBufferDSV.Get(), D3D11_CLEAR_DEPTH, 1.0f, 0);
+
+	// Start counting constant buffer uploads for this frame
+	ISimpleShader::ResetUploadCounters();
 }
 
 void Renderer::FrameEnd(bool vsync)
@@ -85,24 +93,66 @@ void Renderer::FrameEnd(bool vsync)
 
 void Renderer::RenderSimple(std::shared_ptr<Scene> scene, unsigned int activeLightCount)
 {
+	// Handles for the per-frame pixel shader data, which are only
+	// looked up again when the pixel shader changes or is reloaded
+	std::shared_ptr<SimplePixelShader> handlePS = 0;
+	ShaderVarHandle lightsHandle;
+	ShaderVarHandle lightCountHandle;
+	ShaderVarHandle cameraPositionHandle;
+
+	// Track the time spent setting per-entity shader data
+	std::chrono::high_resolution_clock::duration dataTime(0);
+	unsigned int entityCount = 0;
+
 	// Draw entities
 	for (auto& ge : scene->GetEntities())
 	{
+		std::chrono::high_resolution_clock::time_point dataStart = std::chrono::high_resolution_clock::now();
+
 		// Set the "per frame" data
 		// Note that this should literally be set once PER FRAME, before
 		// the draw loop, but we're currently setting it per entity since 
 		// we are just using whichever shader the current entity has.  
 		// Inefficient!!!
 		std::shared_ptr<SimplePixelShader> ps = ge->GetMaterial()->GetPixelShader();
-		ps->SetData("lights", (void*)(&scene->GetLights()[0]), sizeof(Light) * (unsigned int)scene->GetLights().size());
-		ps->SetInt("lightCount", activeLightCount);
-		ps->SetFloat3("cameraPosition", scene->GetCurrentCamera()->GetTransform()->GetPosition());
-		ps->CopyBufferData("perFrame");
+		if (useVariableHandles)
+		{
+			if (handlePS != ps || !ps->IsHandleCurrent(lightsHandle))
+			{
+				handlePS = ps;
+				lightsHandle = ps->GetVariableHandle("lights");
+				lightCountHandle = ps->GetVariableHandle("lightCount");
+				cameraPositionHandle = ps->GetVariableHandle("cameraPosition");
+			}
+
+			ps->SetData(lightsHandle, (void*)(&scene->GetLights()[0]), sizeof(Light) * (unsigned int)scene->GetLights().size());
+			ps->SetInt(lightCountHandle, activeLightCount);
+			ps->SetFloat3(cameraPositionHandle, scene->GetCurrentCamera()->GetTransform()->GetPosition());
+			if (lightsHandle.IsValid())
+				ps->CopyBufferData(lightsHandle.ConstantBufferIndex);
+		}
+		else
+		{
+			ps->SetData("lights", (void*)(&scene->GetLights()[0]), sizeof(Light) * (unsigned int)scene->GetLights().size());
+			ps->SetInt("lightCount", activeLightCount);
+			ps->SetFloat3("cameraPosition", scene->GetCurrentCamera()->GetTransform()->GetPosition());
+			ps->CopyBufferData("perFrame");
+		}
+
+		dataTime += std::chrono::high_resolution_clock::now() - dataStart;
+		entityCount++;
+
+		// Let the asset manager know which textures we need, and how detailed
+		RequestTextures(ge, scene->GetCurrentCamera());
 
 		// Draw the entity
 		ge->Draw(context, scene->GetCurrentCamera());
 	}
 
+	// Record the average cost per entity
+	perEntityDataMicroseconds = entityCount == 0 ? 0.0f :
+		std::chrono::duration<float, std::micro>(dataTime).count() / entityCount;
+
 	// Draw the sky
 	scene->GetSky()->Draw(scene->GetCurrentCamera());
 }
@@ -147,6 +197,16 @@ void Renderer::RenderOptimized(std::shared_ptr<Scene> scene, unsigned int active
 	std::shared_ptr<SimplePixelShader> currentPS = 0;
 	std::shared_ptr<Material> currentMaterial = 0;
 	std::shared_ptr<Mesh> currentMesh = 0;
+
+	// Handles for per-object data, looked up when the vertex shader changes or is reloaded
+	std::shared_ptr<SimpleVertexShader> handleVS = 0;
+	ShaderVarHandle worldHandle;
+	ShaderVarHandle worldInvTransHandle;
+
+	// Track the time spent setting per-entity shader data
+	std::chrono::high_resolution_clock::duration dataTime(0);
+	unsigned int entityCount = 0;
+
 	for (auto& ge : toDraw)
 	{
 		// Track the current material and swap as necessary
@@ -198,13 +258,38 @@ void Renderer::RenderOptimized(std::shared_ptr<Scene> scene, unsigned int active
 		}
 
 
+		// Let the asset manager know which textures we need, and how detailed
+		RequestTextures(ge, scene->GetCurrentCamera());
+
 		// Handle per-object data last (only VS at the moment)
 		if (currentVS != 0)
 		{
+			std::chrono::high_resolution_clock::time_point dataStart = std::chrono::high_resolution_clock::now();
+
 			Transform* trans = ge->GetTransform();
-			currentVS->SetMatrix4x4("world", trans->GetWorldMatrix());
-			currentVS->SetMatrix4x4("worldInverseTranspose", trans->GetWorldInverseTransposeMatrix());
-			currentVS->CopyBufferData("perObject");
+			if (useVariableHandles)
+			{
+				if (handleVS != currentVS || !currentVS->IsHandleCurrent(worldHandle))
+				{
+					handleVS = currentVS;
+					worldHandle = currentVS->GetVariableHandle("world");
+					worldInvTransHandle = currentVS->GetVariableHandle("worldInverseTranspose");
+				}
+
+				currentVS->SetMatrix4x4(worldHandle, trans->GetWorldMatrix());
+				currentVS->SetMatrix4x4(worldInvTransHandle, trans->GetWorldInverseTransposeMatrix());
+				if (worldHandle.IsValid())
+					currentVS->CopyBufferData(worldHandle.ConstantBufferIndex);
+			}
+			else
+			{
+				currentVS->SetMatrix4x4("world", trans->GetWorldMatrix());
+				currentVS->SetMatrix4x4("worldInverseTranspose", trans->GetWorldInverseTransposeMatrix());
+				currentVS->CopyBufferData("perObject");
+			}
+
+			dataTime += std::chrono::high_resolution_clock::now() - dataStart;
+			entityCount++;
 		}
 
 		// Draw the entity
@@ -214,8 +299,131 @@ void Renderer::RenderOptimized(std::shared_ptr<Scene> scene, unsigned int active
 		}
 	}
 
+	// Record the average cost per entity
+	perEntityDataMicroseconds = entityCount == 0 ? 0.0f :
+		std::chrono::duration<float, std::micro>(dataTime).count() / entityCount;
+
 	// Draw the sky
 	scene->GetSky()->Draw(scene->GetCurrentCamera());
 }
 
 
+// --------------------------------------------------------
+// Should per-entity shader data be set with pre-resolved
+// handles (fast) or by name (a string lookup per call)?
+// --------------------------------------------------------
+void Renderer::SetUseVariableHandles(bool useHandles) { useVariableHandles = useHandles; }
+bool Renderer::GetUseVariableHandles() { return useVariableHandles; }
+
+// --------------------------------------------------------
+// Average CPU time spent setting and copying per-entity
+// shader data during the last render, in microseconds
+// --------------------------------------------------------
+float Renderer::GetPerEntityDataMicroseconds() { return perEntityDataMicroseconds; }
+
+
+// --------------------------------------------------------
+// Times the per-entity work of RenderOptimized() - setting
+// the world matrices and copying the buffer - by name and
+// by handle, without a window or a scene.  Also checks that
+// both paths write the same data and that reloading the
+// shader leaves old handles stale until they're re-resolved.
+//
+// vertexShaderFile - Compiled vertex shader with the usual
+//                    "world" and "worldInverseTranspose"
+// entities - Number of entities per "frame"
+// frames - Number of times to repeat all entities
+// --------------------------------------------------------
+ShaderHandleBenchmarkResults Renderer::BenchmarkVariableHandles(
+	Microsoft::WRL::ComPtr<ID3D11Device> device,
+	Microsoft::WRL::ComPtr<ID3D11DeviceContext> context,
+	std::wstring vertexShaderFile,
+	unsigned int entities,
+	unsigned int frames)
+{
+	ShaderHandleBenchmarkResults results = {};
+	results.Entities = entities;
+	results.Frames = frames;
+
+	SimpleVertexShader vs(device, context, vertexShaderFile.c_str());
+	if (!vs.IsShaderValid() || entities == 0 || frames == 0)
+		return results;
+
+	// A different world matrix for each entity
+	std::vector<DirectX::XMFLOAT4X4> worlds(entities);
+	for (unsigned int i = 0; i < entities; i++)
+		DirectX::XMStoreFloat4x4(&worlds[i], DirectX::XMMatrixTranslation((float)i, 1.0f, 2.0f));
+
+	// By name
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	for (unsigned int f = 0; f < frames; f++)
+	{
+		for (unsigned int i = 0; i < entities; i++)
+		{
+			vs.SetMatrix4x4("world", worlds[i]);
+			vs.SetMatrix4x4("worldInverseTranspose", worlds[i]);
+			vs.CopyBufferData("perObject");
+		}
+	}
+	std::chrono::duration<double, std::micro> nameTime = std::chrono::high_resolution_clock::now() - start;
+
+	// By handle, resolved once up front as the renderer does
+	start = std::chrono::high_resolution_clock::now();
+	ShaderVarHandle worldHandle = vs.GetVariableHandle("world");
+	ShaderVarHandle worldInvTransHandle = vs.GetVariableHandle("worldInverseTranspose");
+	for (unsigned int f = 0; f < frames; f++)
+	{
+		for (unsigned int i = 0; i < entities; i++)
+		{
+			vs.SetMatrix4x4(worldHandle, worlds[i]);
+			vs.SetMatrix4x4(worldInvTransHandle, worlds[i]);
+			if (worldHandle.IsValid())
+				vs.CopyBufferData(worldHandle.ConstantBufferIndex);
+		}
+	}
+	std::chrono::duration<double, std::micro> handleTime = std::chrono::high_resolution_clock::now() - start;
+
+	results.NameMicrosecondsPerEntity = nameTime.count() / ((double)entities * frames);
+	results.HandleMicrosecondsPerEntity = handleTime.count() / ((double)entities * frames);
+
+	// Both paths should leave identical bytes in the buffer
+	const SimpleConstantBuffer* cb = vs.GetBufferInfo("perObject");
+	if (cb && worldHandle.IsValid() && worldInvTransHandle.IsValid())
+	{
+		vs.SetMatrix4x4("world", worlds[0]);
+		vs.SetMatrix4x4("worldInverseTranspose", worlds[entities - 1]);
+		std::vector<unsigned char> byName(cb->LocalDataBuffer, cb->LocalDataBuffer + cb->Size);
+
+		memset(cb->LocalDataBuffer, 0, cb->Size);
+		vs.SetMatrix4x4(worldHandle, worlds[0]);
+		vs.SetMatrix4x4(worldInvTransHandle, worlds[entities - 1]);
+		results.DataMatches = memcmp(byName.data(), cb->LocalDataBuffer, cb->Size) == 0;
+	}
+
+	// After a reload, old handles must be refused and new ones accepted
+	if (vs.ReloadShaderFile(vertexShaderFile.c_str()))
+	{
+		bool staleRefused = !vs.IsHandleCurrent(worldHandle) && !vs.SetMatrix4x4(worldHandle, worlds[0]);
+		worldHandle = vs.GetVariableHandle("world");
+		results.StaleHandlesRejected = staleRefused && vs.IsHandleCurrent(worldHandle) && vs.SetMatrix4x4(worldHandle, worlds[0]);
+	}
+
+	results.Passed = results.DataMatches && results.StaleHandlesRejected;
+	return results;
+}
+
+
+// --------------------------------------------------------
+// Requests the textures of an entity's material at a level
+// of detail based on the entity's distance to the camera,
+// so the asset manager knows which mips to keep resident
+// --------------------------------------------------------
+void Renderer::RequestTextures(std::shared_ptr<GameEntity> entity, std::shared_ptr<Camera> camera)
+{
+	DirectX::XMFLOAT3 entityPos = entity->GetTransform()->GetPosition();
+	DirectX::XMFLOAT3 cameraPos = camera->GetTransform()->GetPosition();
+	float distance = DirectX::XMVectorGetX(DirectX::XMVector3Length(
+		DirectX::XMVectorSubtract(DirectX::XMLoadFloat3(&entityPos), DirectX::XMLoadFloat3(&cameraPos))));
+
+	Assets::GetInstance().RequestMaterialTextures(entity->GetMaterial(), distance);
+}
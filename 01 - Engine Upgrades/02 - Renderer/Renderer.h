@@ -4,6 +4,7 @@
 #include <wrl/client.h>
 #include <DirectXMath.h>
 #include <memory>
+#include <string>
 
 #include "Lights.h"
 #include "Scene.h"
@@ -23,6 +24,18 @@ struct PSPerFrameData
 	DirectX::XMFLOAT3 CameraPosition;
 };
 
+// Results of timing per-entity shader data by name vs. by handle
+struct ShaderHandleBenchmarkResults
+{
+	unsigned int Entities;
+	unsigned int Frames;
+	double NameMicrosecondsPerEntity;
+	double HandleMicrosecondsPerEntity;
+	bool DataMatches;			// Both paths write the same bytes
+	bool StaleHandlesRejected;	// Reloading invalidates old handles
+	bool Passed;
+};
+
 class Renderer
 {
 public:
@@ -49,6 +62,17 @@ public:
 	void RenderSimple(std::shared_ptr<Scene> scene, unsigned int activeLightCount);
 	void RenderOptimized(std::shared_ptr<Scene> scene, unsigned int activeLightCount);
 
+	// Shader variable handles vs. string lookups
+	void SetUseVariableHandles(bool useHandles);
+	bool GetUseVariableHandles();
+	float GetPerEntityDataMicroseconds();
+	static ShaderHandleBenchmarkResults BenchmarkVariableHandles(
+		Microsoft::WRL::ComPtr<ID3D11Device> device,
+		Microsoft::WRL::ComPtr<ID3D11DeviceContext> context,
+		std::wstring vertexShaderFile,
+		unsigned int entities,
+		unsigned int frames);
+
 private:
 
 	// The renderer needs access to all the core D3D stuff
@@ -69,5 +93,12 @@ private:
 	Microsoft::WRL::ComPtr<ID3D11Buffer> vsPerFrameConstantBuffer;
 	PSPerFrameData psPerFrameData;
 	VSPerFrameData vsPerFrameData;
+
+	// Per-entity shader data options and timing
+	bool useVariableHandles;
+	float perEntityDataMicroseconds;
+
+	// Helpers
+	void RequestTextures(std::shared_ptr<GameEntity> entity, std::shared_ptr<Camera> camera);
 };
 
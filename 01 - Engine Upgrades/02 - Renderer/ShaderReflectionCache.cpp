@@ -0,0 +1,372 @@
+#include "ShaderReflectionCache.h"
+
+#include <cstdio>
+
+// Helpers for writing values to a byte array
+static void WriteU32(std::vector<unsigned char>& bytes, uint32_t value)
+{
+	for (int i = 0; i < 4; i++)
+		bytes.push_back((unsigned char)(value >> (i * 8)));
+}
+
+static void WriteU64(std::vector<unsigned char>& bytes, uint64_t value)
+{
+	for (int i = 0; i < 8; i++)
+		bytes.push_back((unsigned char)(value >> (i * 8)));
+}
+
+static void WriteString(std::vector<unsigned char>& bytes, const std::string& str)
+{
+	WriteU32(bytes, (uint32_t)str.size());
+	bytes.insert(bytes.end(), str.begin(), str.end());
+}
+
+
+// --------------------------------------------------------
+// Helper for reading values from a byte array, which
+// fails (and stays failed) if it runs out of data
+// --------------------------------------------------------
+struct CacheReader
+{
+	const unsigned char* Bytes;
+	size_t Size;
+	size_t Position;
+	bool Failed;
+
+	bool Has(size_t count)
+	{
+		if (Failed || count > Size - Position)
+			Failed = true;
+		return !Failed;
+	}
+
+	uint32_t ReadU32()
+	{
+		if (!Has(4)) return 0;
+		uint32_t value = 0;
+		for (int i = 0; i < 4; i++)
+			value |= (uint32_t)Bytes[Position++] << (i * 8);
+		return value;
+	}
+
+	uint64_t ReadU64()
+	{
+		if (!Has(8)) return 0;
+		uint64_t value = 0;
+		for (int i = 0; i < 8; i++)
+			value |= (uint64_t)Bytes[Position++] << (i * 8);
+		return value;
+	}
+
+	std::string ReadString()
+	{
+		uint32_t length = ReadU32();
+		if (!Has(length)) return std::string();
+		std::string str((const char*)Bytes + Position, length);
+		Position += length;
+		return str;
+	}
+
+	// Reads an element count, rejecting counts that could not
+	// possibly fit in the remaining data (at least 4 bytes each)
+	uint32_t ReadCount()
+	{
+		uint32_t count = ReadU32();
+		if (!Failed && count > (Size - Position) / 4)
+			Failed = true;
+		return Failed ? 0 : count;
+	}
+};
+
+
+// --------------------------------------------------------
+// Hashes shader bytecode (FNV-1a, 64-bit) so a cache can
+// be matched to the exact shader it was built from
+// --------------------------------------------------------
+uint64_t ShaderReflectionCache::HashBytecode(const void* bytecode, size_t size)
+{
+	const unsigned char* bytes = (const unsigned char*)bytecode;
+	uint64_t hash = 14695981039346656037ull;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+
+// --------------------------------------------------------
+// Converts reflection data into the cache's binary format
+// --------------------------------------------------------
+std::vector<unsigned char> ShaderReflectionCache::Serialize(const ShaderReflectionData& data)
+{
+	std::vector<unsigned char> bytes;
+	WriteU32(bytes, Magic);
+	WriteU32(bytes, Version);
+	WriteU64(bytes, data.BytecodeHash);
+
+	WriteU32(bytes, (uint32_t)data.ConstantBuffers.size());
+	for (auto& cb : data.ConstantBuffers)
+	{
+		WriteString(bytes, cb.Name);
+		WriteU32(bytes, cb.Type);
+		WriteU32(bytes, cb.Size);
+		WriteU32(bytes, cb.BindIndex);
+		WriteU32(bytes, (uint32_t)cb.Variables.size());
+		for (auto& v : cb.Variables)
+		{
+			WriteString(bytes, v.Name);
+			WriteU32(bytes, v.ByteOffset);
+			WriteU32(bytes, v.Size);
+		}
+	}
+
+	WriteU32(bytes, (uint32_t)data.ShaderResourceViews.size());
+	for (auto& srv : data.ShaderResourceViews)
+	{
+		WriteString(bytes, srv.Name);
+		WriteU32(bytes, srv.BindIndex);
+	}
+
+	WriteU32(bytes, (uint32_t)data.Samplers.size());
+	for (auto& s : data.Samplers)
+	{
+		WriteString(bytes, s.Name);
+		WriteU32(bytes, s.BindIndex);
+	}
+
+	WriteU32(bytes, (uint32_t)data.InputElements.size());
+	for (auto& e : data.InputElements)
+	{
+		WriteString(bytes, e.SemanticName);
+		WriteU32(bytes, e.SemanticIndex);
+		WriteU32(bytes, e.Mask);
+		WriteU32(bytes, e.ComponentType);
+	}
+
+	for (int i = 0; i < 3; i++)
+		WriteU32(bytes, data.ThreadGroupSize[i]);
+
+	WriteU32(bytes, (uint32_t)data.UnorderedAccessViews.size());
+	for (auto& uav : data.UnorderedAccessViews)
+	{
+		WriteString(bytes, uav.Name);
+		WriteU32(bytes, uav.BindIndex);
+	}
+
+	WriteU32(bytes, (uint32_t)data.OutputElements.size());
+	for (auto& e : data.OutputElements)
+	{
+		WriteString(bytes, e.SemanticName);
+		WriteU32(bytes, e.SemanticIndex);
+		WriteU32(bytes, e.Stream);
+		WriteU32(bytes, e.Mask);
+	}
+
+	// Checksum of everything above
+	WriteU64(bytes, HashBytecode(bytes.data(), bytes.size()));
+	return bytes;
+}
+
+
+// --------------------------------------------------------
+// Parses the cache's binary format
+//
+// bytes - The contents of a cache file
+// size - The number of bytes
+// data - Filled in with the results (only if successful)
+//
+// Returns true if the data is a complete, valid cache
+// --------------------------------------------------------
+bool ShaderReflectionCache::Deserialize(const unsigned char* bytes, size_t size, ShaderReflectionData* data)
+{
+	if (!bytes || !data || size < 8)
+		return false;
+
+	// Reject anything that doesn't match its checksum up front
+	size -= 8;
+	CacheReader checksumReader = { bytes, size + 8, size, false };
+	if (checksumReader.ReadU64() != HashBytecode(bytes, size))
+		return false;
+
+	CacheReader reader = { bytes, size, 0, false };
+	if (reader.ReadU32() != Magic || reader.ReadU32() != Version)
+		return false;
+
+	ShaderReflectionData result;
+	result.BytecodeHash = reader.ReadU64();
+
+	uint32_t cbCount = reader.ReadCount();
+	for (uint32_t b = 0; b < cbCount && !reader.Failed; b++)
+	{
+		CachedConstantBuffer cb;
+		cb.Name = reader.ReadString();
+		cb.Type = reader.ReadU32();
+		cb.Size = reader.ReadU32();
+		cb.BindIndex = reader.ReadU32();
+
+		uint32_t varCount = reader.ReadCount();
+		for (uint32_t v = 0; v < varCount && !reader.Failed; v++)
+		{
+			CachedShaderVariable var;
+			var.Name = reader.ReadString();
+			var.ByteOffset = reader.ReadU32();
+			var.Size = reader.ReadU32();
+
+			// Variables must fit within their buffer
+			if ((uint64_t)var.ByteOffset + var.Size > cb.Size)
+				return false;
+
+			cb.Variables.push_back(var);
+		}
+		result.ConstantBuffers.push_back(cb);
+	}
+
+	uint32_t srvCount = reader.ReadCount();
+	for (uint32_t r = 0; r < srvCount && !reader.Failed; r++)
+	{
+		CachedResource srv;
+		srv.Name = reader.ReadString();
+		srv.BindIndex = reader.ReadU32();
+		result.ShaderResourceViews.push_back(srv);
+	}
+
+	uint32_t samplerCount = reader.ReadCount();
+	for (uint32_t s = 0; s < samplerCount && !reader.Failed; s++)
+	{
+		CachedResource samp;
+		samp.Name = reader.ReadString();
+		samp.BindIndex = reader.ReadU32();
+		result.Samplers.push_back(samp);
+	}
+
+	uint32_t elementCount = reader.ReadCount();
+	for (uint32_t e = 0; e < elementCount && !reader.Failed; e++)
+	{
+		CachedInputElement element;
+		element.SemanticName = reader.ReadString();
+		element.SemanticIndex = reader.ReadU32();
+		element.Mask = reader.ReadU32();
+		element.ComponentType = reader.ReadU32();
+		result.InputElements.push_back(element);
+	}
+
+	for (int i = 0; i < 3; i++)
+		result.ThreadGroupSize[i] = reader.ReadU32();
+
+	uint32_t uavCount = reader.ReadCount();
+	for (uint32_t u = 0; u < uavCount && !reader.Failed; u++)
+	{
+		CachedResource uav;
+		uav.Name = reader.ReadString();
+		uav.BindIndex = reader.ReadU32();
+		result.UnorderedAccessViews.push_back(uav);
+	}
+
+	uint32_t outputCount = reader.ReadCount();
+	for (uint32_t o = 0; o < outputCount && !reader.Failed; o++)
+	{
+		CachedOutputElement element;
+		element.SemanticName = reader.ReadString();
+		element.SemanticIndex = reader.ReadU32();
+		element.Stream = reader.ReadU32();
+		element.Mask = reader.ReadU32();
+		result.OutputElements.push_back(element);
+	}
+
+	// Must have read everything, and nothing more
+	if (reader.Failed || reader.Position != size)
+		return false;
+
+	*data = result;
+	return true;
+}
+
+
+// --------------------------------------------------------
+// Determines if two sets of reflection data are identical,
+// which is easiest to do by comparing their serialized forms
+// --------------------------------------------------------
+bool ShaderReflectionCache::Equal(const ShaderReflectionData& a, const ShaderReflectionData& b)
+{
+	return Serialize(a) == Serialize(b);
+}
+
+
+// --------------------------------------------------------
+// Runs the format through a round trip, then makes sure
+// that every truncation of a valid cache and every single
+// corrupted byte is rejected rather than parsed.  Prints
+// any check that fails.
+// --------------------------------------------------------
+ShaderReflectionCacheTestResults ShaderReflectionCache::Test()
+{
+	ShaderReflectionCacheTestResults results = {};
+	auto check = [&](bool condition, const char* description)
+	{
+		results.Checks++;
+		if (!condition)
+		{
+			results.Failures++;
+			printf("  FAILED: %s\n", description);
+		}
+	};
+
+	// Something resembling a real shader, with a bit of everything
+	ShaderReflectionData data;
+	data.BytecodeHash = HashBytecode("shader", 6);
+	data.ConstantBuffers.push_back({ "perFrame", 0, 128, 0, { { "view", 0, 64 }, { "projection", 64, 64 } } });
+	data.ConstantBuffers.push_back({ "perObject", 0, 64, 2, { { "world", 0, 64 } } });
+	data.ShaderResourceViews.push_back({ "Albedo", 0 });
+	data.ShaderResourceViews.push_back({ "NormalMap", 1 });
+	data.Samplers.push_back({ "BasicSampler", 0 });
+	data.InputElements.push_back({ "POSITION", 0, 7, 3 });
+	data.InputElements.push_back({ "TEXCOORD", 0, 3, 3 });
+	data.ThreadGroupSize[0] = 8;
+	data.ThreadGroupSize[1] = 8;
+	data.ThreadGroupSize[2] = 1;
+	data.UnorderedAccessViews.push_back({ "Output", 0 });
+	data.OutputElements.push_back({ "SV_POSITION", 0, 0, 15 });
+
+	// Round trip
+	std::vector<unsigned char> bytes = Serialize(data);
+	ShaderReflectionData loaded;
+	check(Deserialize(bytes.data(), bytes.size(), &loaded), "a valid cache is accepted");
+	check(Equal(data, loaded), "a round trip preserves everything");
+
+	// Every possible truncation
+	bool truncationsRejected = true;
+	for (size_t size = 0; size < bytes.size(); size++)
+	{
+		ShaderReflectionData truncated;
+		truncationsRejected &= !Deserialize(bytes.data(), size, &truncated);
+	}
+	check(truncationsRejected, "every truncated cache is rejected");
+
+	// Trailing garbage
+	std::vector<unsigned char> longer = bytes;
+	longer.push_back(0);
+	ShaderReflectionData extended;
+	check(!Deserialize(longer.data(), longer.size(), &extended), "a cache with extra bytes is rejected");
+
+	// Every single corrupted byte, including the hashes
+	bool corruptionRejected = true;
+	for (size_t i = 0; i < bytes.size(); i++)
+	{
+		std::vector<unsigned char> corrupt = bytes;
+		corrupt[i] ^= 0x5A;
+		ShaderReflectionData result;
+		corruptionRejected &= !Deserialize(corrupt.data(), corrupt.size(), &result);
+	}
+	check(corruptionRejected, "every corrupted byte is rejected");
+
+	// A failed parse leaves the output alone
+	ShaderReflectionData untouched;
+	untouched.BytecodeHash = 42;
+	Deserialize(bytes.data(), bytes.size() / 2, &untouched);
+	check(untouched.BytecodeHash == 42 && untouched.ConstantBuffers.empty(), "a rejected cache leaves the output unchanged");
+
+	results.Passed = results.Failures == 0;
+	return results;
+}
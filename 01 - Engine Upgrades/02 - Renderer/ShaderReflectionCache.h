@@ -0,0 +1,98 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// --------------------------------------------------------
+// Plain versions of the shader reflection results that
+// SimpleShader needs.  These have no dependencies on
+// Direct3D, so they can be saved to and loaded from disk
+// (and parsed) on any platform.
+// --------------------------------------------------------
+struct CachedShaderVariable
+{
+	std::string Name;
+	uint32_t ByteOffset = 0;
+	uint32_t Size = 0;
+};
+
+struct CachedConstantBuffer
+{
+	std::string Name;
+	uint32_t Type = 0;		// D3D_CBUFFER_TYPE
+	uint32_t Size = 0;
+	uint32_t BindIndex = 0;
+	std::vector<CachedShaderVariable> Variables;
+};
+
+struct CachedResource
+{
+	std::string Name;
+	uint32_t BindIndex = 0;
+};
+
+struct CachedInputElement
+{
+	std::string SemanticName;
+	uint32_t SemanticIndex = 0;
+	uint32_t Mask = 0;
+	uint32_t ComponentType = 0;	// D3D_REGISTER_COMPONENT_TYPE
+};
+
+struct CachedOutputElement
+{
+	std::string SemanticName;
+	uint32_t SemanticIndex = 0;
+	uint32_t Stream = 0;
+	uint32_t Mask = 0;
+};
+
+struct ShaderReflectionData
+{
+	uint64_t BytecodeHash = 0;
+	std::vector<CachedConstantBuffer> ConstantBuffers;
+	std::vector<CachedResource> ShaderResourceViews;	// In raw index order
+	std::vector<CachedResource> Samplers;				// In raw index order
+	std::vector<CachedInputElement> InputElements;
+
+	// Compute shaders only
+	uint32_t ThreadGroupSize[3] = { 0, 0, 0 };
+	std::vector<CachedResource> UnorderedAccessViews;
+
+	// Geometry shaders use these to set up stream output
+	std::vector<CachedOutputElement> OutputElements;
+};
+
+// Results of the cache format's self test
+struct ShaderReflectionCacheTestResults
+{
+	unsigned int Checks;
+	unsigned int Failures;
+	bool Passed;
+};
+
+// --------------------------------------------------------
+// Reads and writes the compact binary format of a shader
+// reflection cache.  All values are stored little endian
+// and every read is bounds checked.  The file ends with a
+// checksum of everything before it, so a truncated or
+// corrupt cache is simply rejected.
+// --------------------------------------------------------
+class ShaderReflectionCache
+{
+public:
+	static uint64_t HashBytecode(const void* bytecode, size_t size);
+
+	static std::vector<unsigned char> Serialize(const ShaderReflectionData& data);
+	static bool Deserialize(const unsigned char* bytes, size_t size, ShaderReflectionData* data);
+	static bool Equal(const ShaderReflectionData& a, const ShaderReflectionData& b);
+
+	// Checks round trips, truncation and corruption on made up data
+	static ShaderReflectionCacheTestResults Test();
+
+	// Identifies the file format, and should change any time the format does
+	static const uint32_t Magic = 0x43525353; // "SSRC"
+	static const uint32_t Version = 2;
+};
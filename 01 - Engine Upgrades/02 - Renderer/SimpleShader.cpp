@@ -1,5 +1,9 @@
 #include "SimpleShader.h"
 
+#include <fstream>
+#include <iterator>
+#include <cstdio>
+
 // Default error reporting state
 bool ISimpleShader::ReportErrors = false;
 bool ISimpleShader::ReportWarnings = false;
@@ -11,6 +15,18 @@ bool ISimpleShader::ReportWarnings = false;
 // ISimpleShader::ReportErrors = true;
 // ISimpleShader::ReportWarnings = true;
 
+// Constant buffer uploads are skipped when the data
+// hasn't changed since the last upload.  The counters
+// track uploads across all shaders and can be reset
+// each frame with ISimpleShader::ResetUploadCounters()
+bool ISimpleShader::SkipRedundantUploads = true;
+unsigned int ISimpleShader::BufferUploadsIssued = 0;
+unsigned int ISimpleShader::BufferUploadsSkipped = 0;
+
+// Reflection results are cached in a ".refl" file next
+// to each compiled shader, so later loads can skip it
+bool ISimpleShader::UseReflectionCache = true;
+
 
 ///////////////////////////////////////////////////////////////////////////////
 // ------ BASE SIMPLE SHADER --------------------------------------------------
@@ -29,6 +45,8 @@ ISimpleShader::ISimpleShader(Microsoft::WRL::ComPtr<ID3D11Device> device, Micros
 	this->constantBufferCount = 0;
 	this->constantBuffers = 0;
 	this->shaderValid = false;
+	this->generation = 0;
+	this->reflectionFromCache = false;
 }
 
 // --------------------------------------------------------
@@ -54,6 +72,7 @@ void ISimpleShader::CleanUp()
 	if (constantBuffers)
 	{
 		delete[] constantBuffers;
+		constantBuffers = 0;
 		constantBufferCount = 0;
 	}
 
@@ -63,6 +82,9 @@ void ISimpleShader::CleanUp()
 	for (unsigned int i = 0; i < samplerStates.size(); i++)
 		delete samplerStates[i];
 
+	shaderResourceViews.clear();
+	samplerStates.clear();
+
 	// Clean up tables
 	varTable.clear();
 	cbTable.clear();
@@ -80,8 +102,11 @@ void ISimpleShader::CleanUp()
 // --------------------------------------------------------
 bool ISimpleShader::LoadShaderFile(LPCWSTR shaderFile)
 {
+	// Any handles resolved before this point are now stale
+	generation++;
+
 	// Load the shader to a blob and ensure it worked
-	HRESULT hr = D3DReadFileToBlob(shaderFile, shaderBlob.GetAddressOf());
+	HRESULT hr = D3DReadFileToBlob(shaderFile, shaderBlob.ReleaseAndGetAddressOf());
 	if (hr != S_OK)
 	{
 		if (ReportErrors)
@@ -94,6 +119,16 @@ bool ISimpleShader::LoadShaderFile(LPCWSTR shaderFile)
 		return false;
 	}
 
+	// Get the reflection data for this shader, either from
+	// the cache next to the shader file or by reflecting it
+	reflectionFromCache = UseReflectionCache && LoadReflectionCache(shaderFile);
+	if (!reflectionFromCache)
+	{
+		ReflectShader();
+		if (UseReflectionCache)
+			SaveReflectionCache(shaderFile);
+	}
+
 	// Create the shader - Calls an overloaded version of this abstract
 	// method in the appropriate child class
 	shaderValid = CreateShader(shaderBlob);
@@ -109,26 +144,126 @@ bool ISimpleShader::LoadShaderFile(LPCWSTR shaderFile)
 		return false;
 	}
 
+	// Create resource arrays
+	constantBufferCount = (unsigned int)reflection.ConstantBuffers.size();
+	constantBuffers = new SimpleConstantBuffer[constantBufferCount];
+	
+	// Handle bound resources (like shaders and samplers)
+	for (auto& r : reflection.ShaderResourceViews)
+	{
+		// Create the SRV wrapper
+		SimpleSRV* srv = new SimpleSRV();
+		srv->BindIndex = r.BindIndex;							// Shader bind point
+		srv->Index = (unsigned int)shaderResourceViews.size();	// Raw index
+
+		textureTable.insert(std::pair<std::string, SimpleSRV*>(r.Name, srv));
+		shaderResourceViews.push_back(srv);
+	}
+
+	for (auto& r : reflection.Samplers)
+	{
+		// Create the sampler wrapper
+		SimpleSampler* samp = new SimpleSampler();
+		samp->BindIndex = r.BindIndex;						// Shader bind point
+		samp->Index = (unsigned int)samplerStates.size();	// Raw index
+
+		samplerTable.insert(std::pair<std::string, SimpleSampler*>(r.Name, samp));
+		samplerStates.push_back(samp);
+	}
+
+	// Loop through all constant buffers
+	for (unsigned int b = 0; b < constantBufferCount; b++)
+	{
+		// Get this buffer's description
+		CachedConstantBuffer& bufferDesc = reflection.ConstantBuffers[b];
+
+		// Save the type, which we reference when setting these buffers
+		constantBuffers[b].Type = (D3D_CBUFFER_TYPE)bufferDesc.Type;
+		
+		// Set up the buffer and put its pointer in the table
+		constantBuffers[b].BindIndex = bufferDesc.BindIndex;
+		constantBuffers[b].Name = bufferDesc.Name;
+		cbTable.insert(std::pair<std::string, SimpleConstantBuffer*>(bufferDesc.Name, &constantBuffers[b]));
+
+		// Create this constant buffer
+		D3D11_BUFFER_DESC newBuffDesc = {};
+		newBuffDesc.Usage = D3D11_USAGE_DEFAULT;
+		newBuffDesc.ByteWidth = ((bufferDesc.Size + 15) / 16) * 16; // Quick and dirty 16-byte alignment using integer division
+		newBuffDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+		newBuffDesc.CPUAccessFlags = 0;
+		newBuffDesc.MiscFlags = 0;
+		newBuffDesc.StructureByteStride = 0;
+		device->CreateBuffer(&newBuffDesc, 0, constantBuffers[b].ConstantBuffer.GetAddressOf());
+
+		// Set up the data buffer for this constant buffer
+		constantBuffers[b].Size = bufferDesc.Size;
+		constantBuffers[b].LocalDataBuffer = new unsigned char[bufferDesc.Size];
+		ZeroMemory(constantBuffers[b].LocalDataBuffer, bufferDesc.Size);
+
+		// Loop through all variables in this buffer
+		for (auto& varDesc : bufferDesc.Variables)
+		{
+			// Create the variable struct
+			SimpleShaderVariable varStruct = {};
+			varStruct.ConstantBufferIndex = b;
+			varStruct.ByteOffset = varDesc.ByteOffset;
+			varStruct.Size = varDesc.Size;
+			
+			// Add this variable to the table and the constant buffer
+			varTable.insert(std::pair<std::string, SimpleShaderVariable>(varDesc.Name, varStruct));
+			constantBuffers[b].Variables.push_back(varStruct);
+		}
+	}
+
+	// All set
+	return true;
+}
+
+// --------------------------------------------------------
+// Reloads the shader from the specified file, rebuilding
+// all of the tables and buffers.  This object stays the
+// same, so anything holding onto it (like materials) will
+// use the new shader the next time it is set.  Any data
+// previously set in the constant buffers is lost.
+//
+// shaderFile - A "wide string" specifying the compiled shader to load
+// 
+// Returns true if shader is reloaded properly, false otherwise
+// --------------------------------------------------------
+bool ISimpleShader::ReloadShaderFile(LPCWSTR shaderFile)
+{
+	shaderValid = false;
+	return LoadShaderFile(shaderFile);
+}
+
+// --------------------------------------------------------
+// Uses shader reflection to fill in the reflection data
+// (buffers, variables, resources and vertex inputs) for
+// the currently loaded shader blob
+// --------------------------------------------------------
+void ISimpleShader::ReflectShader()
+{
+	reflection = ShaderReflectionData();
+	reflection.BytecodeHash = ShaderReflectionCache::HashBytecode(
+		shaderBlob->GetBufferPointer(),
+		shaderBlob->GetBufferSize());
+
 	// Set up shader reflection to get information about
 	// this shader and its variables,  buffers, etc.
 	Microsoft::WRL::ComPtr<ID3D11ShaderReflection> refl;
-	D3DReflect(
+	if (FAILED(D3DReflect(
 		shaderBlob->GetBufferPointer(),
 		shaderBlob->GetBufferSize(),
 		IID_ID3D11ShaderReflection,
-		(void**)refl.GetAddressOf());
+		(void**)refl.GetAddressOf())))
+		return;
 	
 	// Get the description of the shader
 	D3D11_SHADER_DESC shaderDesc;
 	refl->GetDesc(&shaderDesc);
 
-	// Create resource arrays
-	constantBufferCount = shaderDesc.ConstantBuffers;
-	constantBuffers = new SimpleConstantBuffer[constantBufferCount];
-	
 	// Handle bound resources (like shaders and samplers)
-	unsigned int resourceCount = shaderDesc.BoundResources;
-	for (unsigned int r = 0; r < resourceCount; r++)
+	for (unsigned int r = 0; r < shaderDesc.BoundResources; r++)
 	{
 		// Get this resource's description
 		D3D11_SHADER_INPUT_BIND_DESC resourceDesc;
@@ -139,33 +274,26 @@ bool ISimpleShader::LoadShaderFile(LPCWSTR shaderFile)
 		{
 		case D3D_SIT_STRUCTURED: // Treat structured buffers as texture resources
 		case D3D_SIT_TEXTURE: // A texture resource
-		{
-			// Create the SRV wrapper
-			SimpleSRV* srv = new SimpleSRV();
-			srv->BindIndex = resourceDesc.BindPoint;				// Shader bind point
-			srv->Index = (unsigned int)shaderResourceViews.size();	// Raw index
-
-			textureTable.insert(std::pair<std::string, SimpleSRV*>(resourceDesc.Name, srv));
-			shaderResourceViews.push_back(srv);
-		}
+			reflection.ShaderResourceViews.push_back({ resourceDesc.Name, resourceDesc.BindPoint });
 			break;
 
 		case D3D_SIT_SAMPLER: // A sampler resource
-		{
-			// Create the sampler wrapper
-			SimpleSampler* samp = new SimpleSampler();
-			samp->BindIndex = resourceDesc.BindPoint;			// Shader bind point
-			samp->Index = (unsigned int)samplerStates.size();	// Raw index
+			reflection.Samplers.push_back({ resourceDesc.Name, resourceDesc.BindPoint });
+			break;
 
-			samplerTable.insert(std::pair<std::string, SimpleSampler*>(resourceDesc.Name, samp));
-			samplerStates.push_back(samp);
-		}
+		case D3D_SIT_UAV_APPEND_STRUCTURED: // Any kind of UAV (compute shaders)
+		case D3D_SIT_UAV_CONSUME_STRUCTURED:
+		case D3D_SIT_UAV_RWBYTEADDRESS:
+		case D3D_SIT_UAV_RWSTRUCTURED:
+		case D3D_SIT_UAV_RWSTRUCTURED_WITH_COUNTER:
+		case D3D_SIT_UAV_RWTYPED:
+			reflection.UnorderedAccessViews.push_back({ resourceDesc.Name, resourceDesc.BindPoint });
 			break;
 		}
 	}
 
 	// Loop through all constant buffers
-	for (unsigned int b = 0; b < constantBufferCount; b++)
+	for (unsigned int b = 0; b < shaderDesc.ConstantBuffers; b++)
 	{
 		// Get this buffer
 		ID3D11ShaderReflectionConstantBuffer* cb =
@@ -175,64 +303,221 @@ bool ISimpleShader::LoadShaderFile(LPCWSTR shaderFile)
 		D3D11_SHADER_BUFFER_DESC bufferDesc;
 		cb->GetDesc(&bufferDesc);
 
-		// Save the type, which we reference when setting these buffers
-		constantBuffers[b].Type = bufferDesc.Type;
-		
 		// Get the description of the resource binding, so
 		// we know exactly how it's bound in the shader
 		D3D11_SHADER_INPUT_BIND_DESC bindDesc;
 		refl->GetResourceBindingDescByName(bufferDesc.Name, &bindDesc);
-		
-		// Set up the buffer and put its pointer in the table
-		constantBuffers[b].BindIndex = bindDesc.BindPoint;
-		constantBuffers[b].Name = bufferDesc.Name;
-		cbTable.insert(std::pair<std::string, SimpleConstantBuffer*>(bufferDesc.Name, &constantBuffers[b]));
 
-		// Create this constant buffer
-		D3D11_BUFFER_DESC newBuffDesc = {};
-		newBuffDesc.Usage = D3D11_USAGE_DEFAULT;
-		newBuffDesc.ByteWidth = ((bufferDesc.Size + 15) / 16) * 16; // Quick and dirty 16-byte alignment using integer division
-		newBuffDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
-		newBuffDesc.CPUAccessFlags = 0;
-		newBuffDesc.MiscFlags = 0;
-		newBuffDesc.StructureByteStride = 0;
-		device->CreateBuffer(&newBuffDesc, 0, constantBuffers[b].ConstantBuffer.GetAddressOf());
-
-		// Set up the data buffer for this constant buffer
-		constantBuffers[b].Size = bufferDesc.Size;
-		constantBuffers[b].LocalDataBuffer = new unsigned char[bufferDesc.Size];
-		ZeroMemory(constantBuffers[b].LocalDataBuffer, bufferDesc.Size);
+		CachedConstantBuffer cachedCB;
+		cachedCB.Name = bufferDesc.Name;
+		cachedCB.Type = bufferDesc.Type;
+		cachedCB.Size = bufferDesc.Size;
+		cachedCB.BindIndex = bindDesc.BindPoint;
 
 		// Loop through all variables in this buffer
 		for (unsigned int v = 0; v < bufferDesc.Variables; v++)
 		{
-			// Get this variable
-			ID3D11ShaderReflectionVariable* var =
-				cb->GetVariableByIndex(v);
-			
-			// Get the description of the variable and its type
+			// Get the description of the variable
 			D3D11_SHADER_VARIABLE_DESC varDesc;
-			var->GetDesc(&varDesc);
+			cb->GetVariableByIndex(v)->GetDesc(&varDesc);
+			cachedCB.Variables.push_back({ varDesc.Name, varDesc.StartOffset, varDesc.Size });
+		}
 
-			// Create the variable struct
-			SimpleShaderVariable varStruct = {};
-			varStruct.ConstantBufferIndex = b;
-			varStruct.ByteOffset = varDesc.StartOffset;
-			varStruct.Size = varDesc.Size;
-			
-			// Get a string version
-			std::string varName(varDesc.Name);
+		reflection.ConstantBuffers.push_back(cachedCB);
+	}
 
-			// Add this variable to the table and the constant buffer
-			varTable.insert(std::pair<std::string, SimpleShaderVariable>(varName, varStruct));
-			constantBuffers[b].Variables.push_back(varStruct);
-		}
+	// Save the inputs, which vertex shaders use to build input layouts
+	for (unsigned int i = 0; i < shaderDesc.InputParameters; i++)
+	{
+		D3D11_SIGNATURE_PARAMETER_DESC paramDesc;
+		refl->GetInputParameterDesc(i, &paramDesc);
+
+		CachedInputElement element;
+		element.SemanticName = paramDesc.SemanticName;
+		element.SemanticIndex = paramDesc.SemanticIndex;
+		element.Mask = paramDesc.Mask;
+		element.ComponentType = paramDesc.ComponentType;
+		reflection.InputElements.push_back(element);
 	}
 
-	// All set
+	// Save the outputs, which geometry shaders use for stream output
+	for (unsigned int i = 0; i < shaderDesc.OutputParameters; i++)
+	{
+		D3D11_SIGNATURE_PARAMETER_DESC paramDesc;
+		refl->GetOutputParameterDesc(i, &paramDesc);
+
+		CachedOutputElement element;
+		element.SemanticName = paramDesc.SemanticName;
+		element.SemanticIndex = paramDesc.SemanticIndex;
+		element.Stream = paramDesc.Stream;
+		element.Mask = paramDesc.Mask;
+		reflection.OutputElements.push_back(element);
+	}
+
+	// Thread group size, which is only non-zero for compute shaders
+	refl->GetThreadGroupSize(
+		&reflection.ThreadGroupSize[0],
+		&reflection.ThreadGroupSize[1],
+		&reflection.ThreadGroupSize[2]);
+}
+
+// --------------------------------------------------------
+// Attempts to load the reflection data from the cache file
+// next to the shader.  The cache is only used if it was
+// built from the exact same shader bytecode.
+//
+// shaderFile - The compiled shader the cache belongs to
+//
+// Returns true if valid reflection data was loaded
+// --------------------------------------------------------
+bool ISimpleShader::LoadReflectionCache(LPCWSTR shaderFile)
+{
+	std::ifstream file(std::wstring(shaderFile) + L".refl", std::ios::binary);
+	if (!file.is_open())
+		return false;
+
+	std::vector<unsigned char> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	file.close();
+
+	ShaderReflectionData cached;
+	if (!ShaderReflectionCache::Deserialize(bytes.data(), bytes.size(), &cached))
+		return false;
+
+	// Is this cache for this version of the shader?
+	uint64_t hash = ShaderReflectionCache::HashBytecode(
+		shaderBlob->GetBufferPointer(),
+		shaderBlob->GetBufferSize());
+	if (cached.BytecodeHash != hash)
+		return false;
+
+	reflection = cached;
 	return true;
 }
 
+// --------------------------------------------------------
+// Saves the current reflection data to a cache file next
+// to the shader, so later loads can skip reflection
+//
+// shaderFile - The compiled shader the cache belongs to
+// --------------------------------------------------------
+void ISimpleShader::SaveReflectionCache(LPCWSTR shaderFile)
+{
+	std::vector<unsigned char> bytes = ShaderReflectionCache::Serialize(reflection);
+
+	std::ofstream file(std::wstring(shaderFile) + L".refl", std::ios::binary | std::ios::trunc);
+	if (!file.is_open())
+	{
+		if (ReportWarnings)
+		{
+			LogWarning("SimpleShader::SaveReflectionCache() - Unable to write reflection cache for '");
+			LogW(shaderFile);
+			LogWarning("'.\n");
+		}
+		return;
+	}
+
+	file.write((const char*)bytes.data(), bytes.size());
+}
+
+// --------------------------------------------------------
+// Loads a real shader with its cache file missing, intact,
+// truncated, corrupted, built for different bytecode (a
+// stale hash) and built from a different shader entirely,
+// checking that only the intact cache is used and that
+// every other case falls back to reflection with the same
+// results.  Prints any check that fails.
+//
+// vertexShaderFile - The shader whose cache is tested
+// pixelShaderFile - Any other shader, for the stale cache
+// --------------------------------------------------------
+ShaderReflectionCacheTestResults ISimpleShader::TestReflectionCache(
+	Microsoft::WRL::ComPtr<ID3D11Device> device,
+	Microsoft::WRL::ComPtr<ID3D11DeviceContext> context,
+	LPCWSTR vertexShaderFile,
+	LPCWSTR pixelShaderFile)
+{
+	ShaderReflectionCacheTestResults results = {};
+	auto check = [&](bool condition, const char* description)
+	{
+		results.Checks++;
+		if (!condition)
+		{
+			results.Failures++;
+			printf("  FAILED: %s\n", description);
+		}
+	};
+
+	bool useCache = UseReflectionCache;
+	UseReflectionCache = true;
+
+	std::wstring cachePath = std::wstring(vertexShaderFile) + L".refl";
+	auto writeCache = [&](const std::vector<unsigned char>& bytes)
+	{
+		std::ofstream file(cachePath, std::ios::binary | std::ios::trunc);
+		file.write((const char*)bytes.data(), bytes.size());
+	};
+	auto readCache = [&]()
+	{
+		std::ifstream file(cachePath, std::ios::binary);
+		return std::vector<unsigned char>((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	};
+
+	// No cache: reflect and write one
+	DeleteFileW(cachePath.c_str());
+	SimpleVertexShader reflected(device, context, vertexShaderFile);
+	check(reflected.IsShaderValid(), "the shader loads without a cache");
+	check(!reflected.WasReflectionCached(), "a missing cache is reflected");
+	std::vector<unsigned char> validCache = readCache();
+	check(!validCache.empty(), "reflecting writes a cache");
+
+	// Loads the shader again, expecting reflection (not the cache)
+	// and the same results as the original reflection
+	auto checkFallback = [&](const char* loadDescription, const char* resultDescription)
+	{
+		SimpleVertexShader vs(device, context, vertexShaderFile);
+		check(vs.IsShaderValid() && !vs.WasReflectionCached(), loadDescription);
+		check(ShaderReflectionCache::Equal(vs.GetReflectionData(), reflected.GetReflectionData()), resultDescription);
+	};
+
+	// Round trip through the file
+	{
+		SimpleVertexShader vs(device, context, vertexShaderFile);
+		check(vs.IsShaderValid() && vs.WasReflectionCached(), "an intact cache is used");
+		check(ShaderReflectionCache::Equal(vs.GetReflectionData(), reflected.GetReflectionData()), "the cache matches reflection");
+	}
+
+	// Truncated
+	writeCache(std::vector<unsigned char>(validCache.begin(), validCache.begin() + validCache.size() / 2));
+	checkFallback("a truncated cache falls back to reflection", "reflection after a truncated cache is correct");
+
+	// Corrupt, somewhere in the middle
+	std::vector<unsigned char> corrupt = validCache;
+	corrupt[corrupt.size() / 2] ^= 0xFF;
+	writeCache(corrupt);
+	checkFallback("a corrupt cache falls back to reflection", "reflection after a corrupt cache is correct");
+
+	// Otherwise valid, but for different bytecode
+	ShaderReflectionData mismatched = reflected.GetReflectionData();
+	mismatched.BytecodeHash ^= 1;
+	writeCache(ShaderReflectionCache::Serialize(mismatched));
+	checkFallback("a cache with a mismatched hash falls back to reflection", "reflection after a mismatched hash is correct");
+
+	// Stale: a complete cache left over from some other shader
+	SimplePixelShader other(device, context, pixelShaderFile);
+	writeCache(ShaderReflectionCache::Serialize(other.GetReflectionData()));
+	checkFallback("a stale cache from another shader falls back to reflection", "reflection after a stale cache is correct");
+
+	// The last fallback should have rewritten a good cache
+	{
+		SimpleVertexShader vs(device, context, vertexShaderFile);
+		check(vs.WasReflectionCached(), "falling back rewrites the cache");
+	}
+
+	UseReflectionCache = useCache;
+	results.Passed = results.Failures == 0;
+	return results;
+}
+
 // --------------------------------------------------------
 // Helper for looking up a variable by name and also
 // verifying that it is the requested size
@@ -349,9 +634,7 @@ void ISimpleShader::CopyAllBufferData()
 	for (unsigned int i = 0; i < constantBufferCount; i++)
 	{
 		// Copy the entire local data buffer
-		deviceContext->UpdateSubresource(
-			constantBuffers[i].ConstantBuffer.Get(), 0, 0,
-			constantBuffers[i].LocalDataBuffer, 0, 0);
+		UploadBuffer(&constantBuffers[i]);
 	}
 }
 
@@ -380,9 +663,7 @@ void ISimpleShader::CopyBufferData(unsigned int index)
 	if (!cb) return;
 
 	// Copy the data and get out
-	deviceContext->UpdateSubresource(
-		cb->ConstantBuffer.Get(), 0, 0, 
-		cb->LocalDataBuffer, 0, 0);
+	UploadBuffer(cb);
 }
 
 // --------------------------------------------------------
@@ -402,9 +683,84 @@ void ISimpleShader::CopyBufferData(std::string bufferName)
 	if (!cb) return;
 
 	// Copy the data and get out
+	UploadBuffer(cb);
+}
+
+
+// --------------------------------------------------------
+// Resets the upload counters, usually once per frame
+// --------------------------------------------------------
+void ISimpleShader::ResetUploadCounters()
+{
+	BufferUploadsIssued = 0;
+	BufferUploadsSkipped = 0;
+}
+
+// --------------------------------------------------------
+// Helper for writing into a local data buffer, which only
+// marks the buffer as dirty if the data actually changes
+// --------------------------------------------------------
+void ISimpleShader::WriteBufferData(SimpleConstantBuffer* cb, unsigned int byteOffset, const void* data, unsigned int size)
+{
+	unsigned char* dest = cb->LocalDataBuffer + byteOffset;
+	if (memcmp(dest, data, size) == 0)
+		return;
+
+	memcpy(dest, data, size);
+	cb->Dirty = true;
+}
+
+// --------------------------------------------------------
+// Helper for copying a local data buffer to the GPU.  The
+// copy is skipped if nothing was written since the last
+// upload, or if the data was changed back to exactly what
+// was last uploaded (checked with a hash of the data).
+// --------------------------------------------------------
+void ISimpleShader::UploadBuffer(SimpleConstantBuffer* cb)
+{
+	if (SkipRedundantUploads && cb->Uploaded)
+	{
+		if (!cb->Dirty)
+		{
+			BufferUploadsSkipped++;
+			return;
+		}
+
+		size_t hash = HashBufferData(cb->LocalDataBuffer, cb->Size);
+		if (hash == cb->UploadedHash)
+		{
+			cb->Dirty = false;
+			BufferUploadsSkipped++;
+			return;
+		}
+		cb->UploadedHash = hash;
+	}
+	else
+	{
+		cb->UploadedHash = HashBufferData(cb->LocalDataBuffer, cb->Size);
+	}
+
 	deviceContext->UpdateSubresource(
-		cb->ConstantBuffer.Get(), 0, 0, 
+		cb->ConstantBuffer.Get(), 0, 0,
 		cb->LocalDataBuffer, 0, 0);
+
+	cb->Dirty = false;
+	cb->Uploaded = true;
+	BufferUploadsIssued++;
+}
+
+// --------------------------------------------------------
+// Simple FNV-1a hash of a local data buffer
+// --------------------------------------------------------
+size_t ISimpleShader::HashBufferData(const unsigned char* data, unsigned int size)
+{
+	unsigned long long hash = 14695981039346656037ull;
+	for (unsigned int i = 0; i < size; i++)
+	{
+		hash ^= data[i];
+		hash *= 1099511628211ull;
+	}
+	return (size_t)hash;
 }
 
 
@@ -446,10 +802,7 @@ bool ISimpleShader::SetData(std::string name, const void* data, unsigned int siz
 	}
 
 	// Set the data in the local data buffer
-	memcpy(
-		constantBuffers[var->ConstantBufferIndex].LocalDataBuffer + var->ByteOffset,
-		data,
-		size);
+	WriteBufferData(&constantBuffers[var->ConstantBufferIndex], var->ByteOffset, data, size);
 
 	// Success
 	return true;
@@ -535,6 +888,76 @@ bool ISimpleShader::SetMatrix4x4(std::string name, const DirectX::XMFLOAT4X4 dat
 	return this->SetData(name, &data, sizeof(float) * 16);
 }
 
+// --------------------------------------------------------
+// Looks up a variable once so that it can be set later
+// without any string hashing or table lookups
+//
+// name - The name of the shader variable
+//
+// Returns a handle, which is invalid if the variable
+// doesn't exist (setting an invalid handle does nothing).
+// Either way, the handle is tied to the shader's current
+// generation and should be looked up again once
+// IsHandleCurrent() returns false.
+// --------------------------------------------------------
+ShaderVarHandle ISimpleShader::GetVariableHandle(std::string name)
+{
+	ShaderVarHandle handle;
+	handle.Generation = generation;
+	SimpleShaderVariable* var = FindVariable(name, -1);
+	if (var == 0)
+	{
+		if (ReportWarnings)
+		{
+			LogWarning("SimpleShader::GetVariableHandle() - Shader variable '");
+			Log(name);
+			LogWarning("' not found. Ensure the name is spelled correctly and that it exists in a constant buffer in the shader.\n");
+		}
+		return handle;
+	}
+
+	handle.ByteOffset = var->ByteOffset;
+	handle.Size = var->Size;
+	handle.ConstantBufferIndex = var->ConstantBufferIndex;
+	return handle;
+}
+
+// --------------------------------------------------------
+// Sets a variable by handle with arbitrary data of the
+// specified size.  This is just a bounds check and a copy.
+//
+// handle - A handle from GetVariableHandle()
+// data - The data to set in the buffer
+// size - The size of the data (this must be less than or equal to the variable's size)
+//
+// Returns true if data is copied, false if the handle is
+// invalid or was resolved before the shader was reloaded
+// --------------------------------------------------------
+bool ISimpleShader::SetData(const ShaderVarHandle& handle, const void* data, unsigned int size)
+{
+	// Verify the handle is from this version of the shader and fits its buffers
+	if (handle.Generation != generation ||
+		size > handle.Size || 
+		handle.ConstantBufferIndex >= constantBufferCount ||
+		handle.ByteOffset + size > constantBuffers[handle.ConstantBufferIndex].Size)
+		return false;
+
+	// Set the data in the local data buffer
+	WriteBufferData(&constantBuffers[handle.ConstantBufferIndex], handle.ByteOffset, data, size);
+
+	return true;
+}
+
+// --------------------------------------------------------
+// Type-specific helpers for setting data by handle
+// --------------------------------------------------------
+bool ISimpleShader::SetInt(const ShaderVarHandle& handle, int data) { return SetData(handle, &data, sizeof(int)); }
+bool ISimpleShader::SetFloat(const ShaderVarHandle& handle, float data) { return SetData(handle, &data, sizeof(float)); }
+bool ISimpleShader::SetFloat2(const ShaderVarHandle& handle, const DirectX::XMFLOAT2 data) { return SetData(handle, &data, sizeof(float) * 2); }
+bool ISimpleShader::SetFloat3(const ShaderVarHandle& handle, const DirectX::XMFLOAT3 data) { return SetData(handle, &data, sizeof(float) * 3); }
+bool ISimpleShader::SetFloat4(const ShaderVarHandle& handle, const DirectX::XMFLOAT4 data) { return SetData(handle, &data, sizeof(float) * 4); }
+bool ISimpleShader::SetMatrix4x4(const ShaderVarHandle& handle, const DirectX::XMFLOAT4X4 data) { return SetData(handle, &data, sizeof(float) * 16); }
+
 // --------------------------------------------------------
 // Determines if the shader contains the specified
 // variable within one of its constant buffers
@@ -697,6 +1120,7 @@ SimpleVertexShader::SimpleVertexShader(Microsoft::WRL::ComPtr<ID3D11Device> devi
 	// Ensure we set to zero to successfully trigger
 	// the Input Layout creation during LoadShaderFile()
 	this->perInstanceCompatible = false;
+	this->customInputLayout = false;
 
 	// Load the actual compiled shader file
 	this->LoadShaderFile(shaderFile);
@@ -716,6 +1140,7 @@ SimpleVertexShader::SimpleVertexShader(Microsoft::WRL::ComPtr<ID3D11Device> devi
 
 	// Unable to determine from an input layout, require user to tell us
 	this->perInstanceCompatible = perInstanceCompatible;
+	this->customInputLayout = inputLayout != 0;
 
 	// Load the actual compiled shader file
 	this->LoadShaderFile(shaderFile);
@@ -755,7 +1180,7 @@ bool SimpleVertexShader::CreateShader(Microsoft::WRL::ComPtr<ID3DBlob> shaderBlo
 		shaderBlob->GetBufferPointer(),
 		shaderBlob->GetBufferSize(),
 		0,
-		shader.GetAddressOf());
+		shader.ReleaseAndGetAddressOf());
 
 	// Did the creation work?
 	if (result != S_OK)
@@ -763,36 +1188,24 @@ bool SimpleVertexShader::CreateShader(Microsoft::WRL::ComPtr<ID3DBlob> shaderBlo
 
 	// Do we already have an input layout?
 	// (This would come from one of the constructor overloads)
-	if (inputLayout)
+	if (customInputLayout)
 		return true;
 
+	// Reflected layouts are rebuilt in case the shader is being reloaded
+	perInstanceCompatible = false;
+
 	// Vertex shader was created successfully, so we now use the
-	// shader code to re-reflect and create an input layout that 
+	// reflected inputs to create an input layout that 
 	// matches what the vertex shader expects.  Code adapted from:
 	// https://takinginitiative.wordpress.com/2011/12/11/directx-1011-basic-shader-reflection-automatic-input-layout-creation/
 
-	// Reflect shader info
-	Microsoft::WRL::ComPtr<ID3D11ShaderReflection> refl;
-	D3DReflect(
-		shaderBlob->GetBufferPointer(),
-		shaderBlob->GetBufferSize(),
-		IID_ID3D11ShaderReflection,
-		(void**)refl.GetAddressOf());
-	
-	// Get shader info
-	D3D11_SHADER_DESC shaderDesc;
-	refl->GetDesc(&shaderDesc);
-
-	// Read input layout description from shader info
+	// Read input layout description from the reflection data
 	std::vector<D3D11_INPUT_ELEMENT_DESC> inputLayoutDesc;
-	for (unsigned int i = 0; i< shaderDesc.InputParameters; i++)
+	for (auto& paramDesc : reflection.InputElements)
 	{
-		D3D11_SIGNATURE_PARAMETER_DESC paramDesc;
-		refl->GetInputParameterDesc(i, &paramDesc);
-
 		// Check the semantic name for "_PER_INSTANCE"
 		std::string perInstanceStr = "_PER_INSTANCE";
-		std::string sem = paramDesc.SemanticName;
+		const std::string& sem = paramDesc.SemanticName;
 		int lenDiff = (int)sem.size() - (int)perInstanceStr.size();
 		bool isPerInstance = 
 			lenDiff >= 0 &&
@@ -800,7 +1213,7 @@ bool SimpleVertexShader::CreateShader(Microsoft::WRL::ComPtr<ID3DBlob> shaderBlo
 
 		// Fill out input element desc
 		D3D11_INPUT_ELEMENT_DESC elementDesc = {};
-		elementDesc.SemanticName = paramDesc.SemanticName;
+		elementDesc.SemanticName = paramDesc.SemanticName.c_str();
 		elementDesc.SemanticIndex = paramDesc.SemanticIndex;
 		elementDesc.InputSlot = 0;
 		elementDesc.AlignedByteOffset = D3D11_APPEND_ALIGNED_ELEMENT;
@@ -853,7 +1266,7 @@ bool SimpleVertexShader::CreateShader(Microsoft::WRL::ComPtr<ID3DBlob> shaderBlo
 		(unsigned int)inputLayoutDesc.size(), 
 		shaderBlob->GetBufferPointer(), 
 		shaderBlob->GetBufferSize(),
-		inputLayout.GetAddressOf());
+		inputLayout.ReleaseAndGetAddressOf());
 
 	// All done, clean up
 	return true;
@@ -996,7 +1409,7 @@ bool SimplePixelShader::CreateShader(Microsoft::WRL::ComPtr<ID3DBlob> shaderBlob
 		shaderBlob->GetBufferPointer(),
 		shaderBlob->GetBufferSize(),
 		0,
-		shader.GetAddressOf());
+		shader.ReleaseAndGetAddressOf());
 
 	// Check the result
 	return (result == S_OK);
@@ -1140,7 +1553,7 @@ bool SimpleDomainShader::CreateShader(Microsoft::WRL::ComPtr<ID3DBlob> shaderBlo
 		shaderBlob->GetBufferPointer(),
 		shaderBlob->GetBufferSize(),
 		0,
-		shader.GetAddressOf());
+		shader.ReleaseAndGetAddressOf());
 
 	// Check the result
 	return (result == S_OK);
@@ -1283,7 +1696,7 @@ bool SimpleHullShader::CreateShader(Microsoft::WRL::ComPtr<ID3DBlob> shaderBlob)
 		shaderBlob->GetBufferPointer(),
 		shaderBlob->GetBufferSize(),
 		0,
-		shader.GetAddressOf());
+		shader.ReleaseAndGetAddressOf());
 
 	// Check the result
 	return (result == S_OK);
@@ -1435,7 +1848,7 @@ bool SimpleGeometryShader::CreateShader(Microsoft::WRL::ComPtr<ID3DBlob> shaderB
 		shaderBlob->GetBufferPointer(),
 		shaderBlob->GetBufferSize(),
 		0,
-		shader.GetAddressOf());
+		shader.ReleaseAndGetAddressOf());
 
 	// Check the result
 	return (result == S_OK);
@@ -1455,31 +1868,16 @@ bool SimpleGeometryShader::CreateShaderWithStreamOut(Microsoft::WRL::ComPtr<ID3D
 	// called more than once on the same object
 	this->CleanUp();
 
-	// Reflect shader info
-	Microsoft::WRL::ComPtr<ID3D11ShaderReflection> refl;
-	D3DReflect(
-		shaderBlob->GetBufferPointer(),
-		shaderBlob->GetBufferSize(),
-		IID_ID3D11ShaderReflection,
-		(void**)refl.GetAddressOf());
-
-	// Get shader info
-	D3D11_SHADER_DESC shaderDesc;
-	refl->GetDesc(&shaderDesc);
-
-	// Set up the output signature
+	// Set up the output signature, using the outputs
+	// found by reflection (or loaded from the cache)
 	streamOutVertexSize = 0;
 	std::vector<D3D11_SO_DECLARATION_ENTRY> soDecl;
-	for (unsigned int i = 0; i < shaderDesc.OutputParameters; i++)
+	for (auto& paramDesc : reflection.OutputElements)
 	{
-		// Get the info about this entry
-		D3D11_SIGNATURE_PARAMETER_DESC paramDesc;
-		refl->GetOutputParameterDesc(i, &paramDesc);
-		
 		// Create the SO Declaration
 		D3D11_SO_DECLARATION_ENTRY entry = {};
 		entry.SemanticIndex  = paramDesc.SemanticIndex;
-		entry.SemanticName   = paramDesc.SemanticName;
+		entry.SemanticName   = paramDesc.SemanticName.c_str();
 		entry.Stream         = paramDesc.Stream;
 		entry.StartComponent = 0; // Assume starting at 0
 		entry.OutputSlot     = 0; // Assume the first output slot
@@ -1507,7 +1905,7 @@ bool SimpleGeometryShader::CreateShaderWithStreamOut(Microsoft::WRL::ComPtr<ID3D
 		0,                              // No buffer strides
 		rast,                           // Index of the stream to rasterize (if any)
 		NULL,                           // Not using class linkage
-		shader.GetAddressOf());
+		shader.ReleaseAndGetAddressOf());
 	
 	return (result == S_OK);
 }
@@ -1724,50 +2122,21 @@ bool SimpleComputeShader::CreateShader(Microsoft::WRL::ComPtr<ID3DBlob> shaderBl
 		shaderBlob->GetBufferPointer(),
 		shaderBlob->GetBufferSize(),
 		0,
-		shader.GetAddressOf());
+		shader.ReleaseAndGetAddressOf());
 
 	// Was the shader created correctly?
 	if (result != S_OK)
 		return false;
 
-	// Set up shader reflection to get information about UAV's
-	Microsoft::WRL::ComPtr<ID3D11ShaderReflection> refl;
-	D3DReflect(
-		shaderBlob->GetBufferPointer(),
-		shaderBlob->GetBufferSize(),
-		IID_ID3D11ShaderReflection,
-		(void**)refl.GetAddressOf());
-
-	// Get the description of the shader
-	D3D11_SHADER_DESC shaderDesc;
-	refl->GetDesc(&shaderDesc);
-	
-	// Grab the thread info
-	threadsTotal = refl->GetThreadGroupSize(
-		&threadsX,
-		&threadsY,
-		&threadsZ);
-
-	// Loop and get all UAV resources
-	unsigned int resourceCount = shaderDesc.BoundResources;
-	for (unsigned int r = 0; r < resourceCount; r++)
-	{
-		// Get this resource's description
-		D3D11_SHADER_INPUT_BIND_DESC resourceDesc;
-		refl->GetResourceBindingDesc(r, &resourceDesc);
+	// Grab the thread info and UAVs, found by reflection
+	// (or loaded from the cache) before the shader was created
+	threadsX = reflection.ThreadGroupSize[0];
+	threadsY = reflection.ThreadGroupSize[1];
+	threadsZ = reflection.ThreadGroupSize[2];
+	threadsTotal = threadsX * threadsY * threadsZ;
 
-		// Check the type, looking for any kind of UAV
-		switch (resourceDesc.Type)
-		{
-		case D3D_SIT_UAV_APPEND_STRUCTURED:
-		case D3D_SIT_UAV_CONSUME_STRUCTURED:
-		case D3D_SIT_UAV_RWBYTEADDRESS:
-		case D3D_SIT_UAV_RWSTRUCTURED:
-		case D3D_SIT_UAV_RWSTRUCTURED_WITH_COUNTER:
-		case D3D_SIT_UAV_RWTYPED:
-			uavTable.insert(std::pair<std::string, unsigned int>(resourceDesc.Name, resourceDesc.BindPoint));
-		}
-	}
+	for (auto& uav : reflection.UnorderedAccessViews)
+		uavTable.insert(std::pair<std::string, unsigned int>(uav.Name, uav.BindIndex));
 
 	// All set
 	return true;
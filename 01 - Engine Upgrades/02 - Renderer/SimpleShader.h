@@ -11,6 +11,8 @@
 #include <vector>
 #include <string>
 
+#include "ShaderReflectionCache.h"
+
 
 // --------------------------------------------------------
 // Used by simple shaders to store information about
@@ -23,6 +25,23 @@ struct SimpleShaderVariable
 	unsigned int ConstantBufferIndex;
 };
 
+// --------------------------------------------------------
+// A pre-resolved reference to a shader variable, used to
+// set data without looking the variable up by name each
+// time.  Get one with GetVariableHandle() after loading.
+// Handles record the shader's generation, which changes
+// whenever the shader is (re)loaded; stale handles are
+// ignored and should be looked up again.
+// --------------------------------------------------------
+struct ShaderVarHandle
+{
+	unsigned int ByteOffset = 0;
+	unsigned int Size = 0;
+	unsigned int ConstantBufferIndex = 0;
+	unsigned int Generation = 0;
+	bool IsValid() const { return Size > 0; }
+};
+
 // --------------------------------------------------------
 // Contains information about a specific
 // constant buffer in a shader, as well as
@@ -37,6 +56,11 @@ struct SimpleConstantBuffer
 	Microsoft::WRL::ComPtr<ID3D11Buffer> ConstantBuffer = 0;
 	unsigned char* LocalDataBuffer = 0;
 	std::vector<SimpleShaderVariable> Variables;
+
+	// Used to skip uploads when the data hasn't changed
+	bool Dirty = true;
+	bool Uploaded = false;
+	size_t UploadedHash = 0;
 };
 
 // --------------------------------------------------------
@@ -68,6 +92,7 @@ public:
 
 	// Simple helpers
 	bool IsShaderValid() { return shaderValid; }
+	bool ReloadShaderFile(LPCWSTR shaderFile);
 
 	// Activating the shader and copying data
 	void SetShader();
@@ -89,6 +114,19 @@ public:
 	bool SetMatrix4x4(std::string name, const float data[16]);
 	bool SetMatrix4x4(std::string name, const DirectX::XMFLOAT4X4 data);
 
+	// Sets data using pre-resolved handles (faster than by name)
+	ShaderVarHandle GetVariableHandle(std::string name);
+	unsigned int GetGeneration() { return generation; }
+	bool IsHandleCurrent(const ShaderVarHandle& handle) { return handle.Generation == generation; }
+	bool SetData(const ShaderVarHandle& handle, const void* data, unsigned int size);
+
+	bool SetInt(const ShaderVarHandle& handle, int data);
+	bool SetFloat(const ShaderVarHandle& handle, float data);
+	bool SetFloat2(const ShaderVarHandle& handle, const DirectX::XMFLOAT2 data);
+	bool SetFloat3(const ShaderVarHandle& handle, const DirectX::XMFLOAT3 data);
+	bool SetFloat4(const ShaderVarHandle& handle, const DirectX::XMFLOAT4 data);
+	bool SetMatrix4x4(const ShaderVarHandle& handle, const DirectX::XMFLOAT4X4 data);
+
 	// Setting shader resources
 	virtual bool SetShaderResourceView(std::string name, Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> srv) = 0;
 	virtual bool SetSamplerState(std::string name, Microsoft::WRL::ComPtr<ID3D11SamplerState> samplerState) = 0;
@@ -117,14 +155,31 @@ public:
 	
 	// Misc getters
 	Microsoft::WRL::ComPtr<ID3DBlob> GetShaderBlob() { return shaderBlob; }
+	bool WasReflectionCached() { return reflectionFromCache; }
+	const ShaderReflectionData& GetReflectionData() { return reflection; }
 
 	// Error reporting
 	static bool ReportErrors;
 	static bool ReportWarnings;
 
+	// Constant buffer upload tracking (across all shaders)
+	static bool SkipRedundantUploads;
+	static unsigned int BufferUploadsIssued;
+	static unsigned int BufferUploadsSkipped;
+	static void ResetUploadCounters();
+
+	// Reflection caching (see ShaderReflectionCache)
+	static bool UseReflectionCache;
+	static ShaderReflectionCacheTestResults TestReflectionCache(
+		Microsoft::WRL::ComPtr<ID3D11Device> device,
+		Microsoft::WRL::ComPtr<ID3D11DeviceContext> context,
+		LPCWSTR vertexShaderFile,
+		LPCWSTR pixelShaderFile);
+
 protected:
 	
 	bool shaderValid;
+	unsigned int generation; // Incremented each time the shader is loaded
 	Microsoft::WRL::ComPtr<ID3DBlob> shaderBlob;
 	Microsoft::WRL::ComPtr<ID3D11Device> device;
 	Microsoft::WRL::ComPtr<ID3D11DeviceContext> deviceContext;
@@ -141,9 +196,18 @@ protected:
 	std::unordered_map<std::string, SimpleSRV*> textureTable;
 	std::unordered_map<std::string, SimpleSampler*> samplerTable;
 
+	// Reflection results, possibly loaded from a cache file
+	ShaderReflectionData reflection;
+	bool reflectionFromCache;
+
 	// Initialization method
 	bool LoadShaderFile(LPCWSTR shaderFile);
 
+	// Reflection helpers
+	void ReflectShader();
+	bool LoadReflectionCache(LPCWSTR shaderFile);
+	void SaveReflectionCache(LPCWSTR shaderFile);
+
 	// Pure virtual functions for dealing with shader types
 	virtual bool CreateShader(Microsoft::WRL::ComPtr<ID3DBlob> shaderBlob) = 0;
 	virtual void SetShaderAndCBs() = 0;
@@ -154,6 +218,11 @@ protected:
 	SimpleShaderVariable* FindVariable(std::string name, int size);
 	SimpleConstantBuffer* FindConstantBuffer(std::string name);
 
+	// Helpers for tracking changes to constant buffer data
+	void WriteBufferData(SimpleConstantBuffer* cb, unsigned int byteOffset, const void* data, unsigned int size);
+	void UploadBuffer(SimpleConstantBuffer* cb);
+	static size_t HashBufferData(const unsigned char* data, unsigned int size);
+
 	// Error logging
 	void Log(std::string message, WORD color);
 	void LogW(std::wstring message, WORD color);
@@ -183,6 +252,7 @@ public:
 
 protected:
 	bool perInstanceCompatible;
+	bool customInputLayout;
 	 Microsoft::WRL::ComPtr<ID3D11InputLayout> inputLayout;
 	 Microsoft::WRL::ComPtr<ID3D11VertexShader> shader;
 	bool CreateShader(Microsoft::WRL::ComPtr<ID3DBlob> shaderBlob);
@@ -0,0 +1,478 @@
+#include "TextureResidency.h"
+
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include <cstdio>
+
+
+// --------------------------------------------------------
+// Sets up a residency tracker with no streamer and an
+// effectively unlimited budget
+// --------------------------------------------------------
+TextureResidency::TextureResidency() :
+	streamer(0),
+	currentFrame(1),
+	budget((size_t)-1),
+	residentBytes(0),
+	requestedBytes(0),
+	fullDetailDistance(10.0f),
+	minimumResidentDimension(64),
+	maxStreamInsPerFrame(4),
+	mipsDropped(0),
+	mipsRestored(0)
+{
+}
+
+// --------------------------------------------------------
+// Sets the object responsible for actually adding and
+// removing mips.  With no streamer, only the bookkeeping
+// is performed.
+// --------------------------------------------------------
+void TextureResidency::SetStreamer(ITextureStreamer* streamer)
+{
+	this->streamer = streamer;
+}
+
+
+// --------------------------------------------------------
+// Begins tracking a texture, which is assumed to be fully
+// resident (all mips) when it is registered.  Note that the
+// minimum resident dimension is applied at registration.
+//
+// Returns the ID used to refer to this texture later
+// --------------------------------------------------------
+unsigned int TextureResidency::RegisterTexture(
+	unsigned int width,
+	unsigned int height,
+	unsigned int mipLevels,
+	unsigned int arraySize,
+	unsigned int bitsPerPixel,
+	bool blockCompressed)
+{
+	ResidentTexture tex = {};
+	tex.MipBytes = CalculateMipBytes(width, height, mipLevels, arraySize, bitsPerPixel, blockCompressed);
+	tex.ResidentTopMip = 0;
+	tex.LastUsedFrame = currentFrame;
+
+	// Find the first mip that is small enough to never be dropped
+	tex.LowestTopMip = 0;
+	while (tex.LowestTopMip + 1 < mipLevels &&
+		std::max(width >> tex.LowestTopMip, height >> tex.LowestTopMip) > minimumResidentDimension)
+	{
+		tex.LowestTopMip++;
+	}
+	tex.RequestedTopMip = tex.LowestTopMip;
+
+	residentBytes += BytesFromMip(tex, 0);
+	textures.push_back(tex);
+	return (unsigned int)textures.size() - 1;
+}
+
+
+// --------------------------------------------------------
+// Replaces the details of an existing texture, such as when
+// it has been reloaded from disk and may have a different
+// size or format.  As with registration, the texture is
+// assumed to be fully resident.
+// --------------------------------------------------------
+void TextureResidency::UpdateTexture(
+	unsigned int textureID,
+	unsigned int width,
+	unsigned int height,
+	unsigned int mipLevels,
+	unsigned int arraySize,
+	unsigned int bitsPerPixel,
+	bool blockCompressed)
+{
+	if (textureID >= textures.size())
+		return;
+
+	ResidentTexture& tex = textures[textureID];
+	residentBytes -= BytesFromMip(tex, tex.ResidentTopMip);
+
+	tex.MipBytes = CalculateMipBytes(width, height, mipLevels, arraySize, bitsPerPixel, blockCompressed);
+	tex.ResidentTopMip = 0;
+	tex.LastUsedFrame = currentFrame;
+
+	tex.LowestTopMip = 0;
+	while (tex.LowestTopMip + 1 < mipLevels &&
+		std::max(width >> tex.LowestTopMip, height >> tex.LowestTopMip) > minimumResidentDimension)
+	{
+		tex.LowestTopMip++;
+	}
+	tex.RequestedTopMip = tex.LowestTopMip;
+
+	residentBytes += BytesFromMip(tex, 0);
+}
+
+
+// --------------------------------------------------------
+// Marks the texture as used this frame and asks for the
+// given mip to be resident.  Multiple requests in the same
+// frame keep the most detailed one.
+// --------------------------------------------------------
+void TextureResidency::RequestMip(unsigned int textureID, unsigned int topMip)
+{
+	if (textureID >= textures.size())
+		return;
+
+	ResidentTexture& tex = textures[textureID];
+	tex.RequestedTopMip = std::min(tex.RequestedTopMip, std::min(topMip, tex.LowestTopMip));
+	tex.LastUsedFrame = currentFrame;
+}
+
+
+// --------------------------------------------------------
+// Converts a view distance into the most detailed mip that
+// is needed.  Each doubling of the distance past the full
+// detail distance drops one mip.
+// --------------------------------------------------------
+unsigned int TextureResidency::MipForDistance(float distance)
+{
+	if (distance <= fullDetailDistance || fullDetailDistance <= 0.0f)
+		return 0;
+
+	return (unsigned int)std::min(31.0f, std::floor(std::log2(distance / fullDetailDistance)));
+}
+
+
+// --------------------------------------------------------
+// Enforces the budget and streams in requested mips.  This
+// should be called once per frame, after all requests for
+// that frame have been made.  The order of operations:
+//  1. Over budget? Drop unneeded mips from LRU textures
+//  2. Still over? Degrade in-use textures, one mip at a time
+//  3. Restore requested detail to recently used textures
+//     while the budget allows it
+// --------------------------------------------------------
+void TextureResidency::Update()
+{
+	mipsDropped = 0;
+	mipsRestored = 0;
+
+	// Sort from least to most recently used
+	std::vector<unsigned int> order(textures.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b)
+		{
+			return textures[a].LastUsedFrame < textures[b].LastUsedFrame;
+		});
+
+	// Pass 1: Drop anything more detailed than necessary
+	for (unsigned int i = 0; i < order.size() && residentBytes > budget; i++)
+	{
+		ResidentTexture& tex = textures[order[i]];
+		unsigned int target = tex.LastUsedFrame == currentFrame ? tex.RequestedTopMip : tex.LowestTopMip;
+		if (target > tex.ResidentTopMip)
+			ChangeTopMip(order[i], target);
+	}
+
+	// Pass 2: Take mips from textures that are in use
+	bool droppedAny = true;
+	while (residentBytes > budget && droppedAny)
+	{
+		droppedAny = false;
+		for (unsigned int i = 0; i < order.size() && residentBytes > budget; i++)
+		{
+			ResidentTexture& tex = textures[order[i]];
+			if (tex.ResidentTopMip < tex.LowestTopMip && ChangeTopMip(order[i], tex.ResidentTopMip + 1))
+				droppedAny = true;
+		}
+	}
+
+	// Pass 3: Stream in detail for the most recently used textures
+	unsigned int streamIns = 0;
+	for (int i = (int)order.size() - 1; i >= 0 && streamIns < maxStreamInsPerFrame; i--)
+	{
+		ResidentTexture& tex = textures[order[i]];
+		if (tex.LastUsedFrame != currentFrame || tex.RequestedTopMip >= tex.ResidentTopMip)
+			continue;
+
+		// Restore as many of the requested mips as will fit
+		size_t currentBytes = BytesFromMip(tex, tex.ResidentTopMip);
+		unsigned int target = tex.ResidentTopMip;
+		while (target > tex.RequestedTopMip &&
+			residentBytes - currentBytes + BytesFromMip(tex, target - 1) <= budget)
+		{
+			target--;
+		}
+
+		if (target < tex.ResidentTopMip && ChangeTopMip(order[i], target))
+			streamIns++;
+	}
+
+	// Record what was asked for and reset requests for the next frame
+	requestedBytes = 0;
+	for (auto& tex : textures)
+	{
+		if (tex.LastUsedFrame == currentFrame)
+			requestedBytes += BytesFromMip(tex, tex.RequestedTopMip);
+
+		tex.RequestedTopMip = tex.LowestTopMip;
+	}
+
+	currentFrame++;
+}
+
+
+// --------------------------------------------------------
+// Settings
+// --------------------------------------------------------
+void TextureResidency::SetBudget(size_t bytes) { budget = bytes; }
+void TextureResidency::SetFullDetailDistance(float distance) { fullDetailDistance = distance; }
+void TextureResidency::SetMinimumResidentDimension(unsigned int dimension) { minimumResidentDimension = dimension; }
+void TextureResidency::SetMaxStreamInsPerFrame(unsigned int count) { maxStreamInsPerFrame = count; }
+size_t TextureResidency::GetBudget() { return budget; }
+float TextureResidency::GetFullDetailDistance() { return fullDetailDistance; }
+
+
+// --------------------------------------------------------
+// Stats
+// --------------------------------------------------------
+size_t TextureResidency::GetResidentBytes() { return residentBytes; }
+size_t TextureResidency::GetRequestedBytes() { return requestedBytes; }
+unsigned int TextureResidency::GetTextureCount() { return (unsigned int)textures.size(); }
+unsigned int TextureResidency::GetMipsDroppedLastUpdate() { return mipsDropped; }
+unsigned int TextureResidency::GetMipsRestoredLastUpdate() { return mipsRestored; }
+
+size_t TextureResidency::GetFullResolutionBytes()
+{
+	size_t total = 0;
+	for (auto& tex : textures)
+		total += BytesFromMip(tex, 0);
+	return total;
+}
+
+const ResidentTexture* TextureResidency::GetTexture(unsigned int textureID)
+{
+	if (textureID >= textures.size())
+		return 0;
+
+	return &textures[textureID];
+}
+
+
+// --------------------------------------------------------
+// Calculates the size of each mip level of a texture,
+// including all array slices.  Block compressed formats
+// store 4x4 pixel blocks, so their mips never go below
+// a single block.
+// --------------------------------------------------------
+std::vector<size_t> TextureResidency::CalculateMipBytes(
+	unsigned int width,
+	unsigned int height,
+	unsigned int mipLevels,
+	unsigned int arraySize,
+	unsigned int bitsPerPixel,
+	bool blockCompressed)
+{
+	std::vector<size_t> mipBytes;
+	for (unsigned int m = 0; m < mipLevels; m++)
+	{
+		size_t w = std::max(1u, width >> m);
+		size_t h = std::max(1u, height >> m);
+
+		size_t bytes = 0;
+		if (blockCompressed)
+			bytes = std::max((size_t)1, (w + 3) / 4) * std::max((size_t)1, (h + 3) / 4) * bitsPerPixel * 2; // 16 pixels per block, 8 bits per byte
+		else
+			bytes = (w * h * bitsPerPixel + 7) / 8;
+
+		mipBytes.push_back(bytes * arraySize);
+	}
+	return mipBytes;
+}
+
+
+// --------------------------------------------------------
+// Total size of a texture when the given mip is the most
+// detailed one in memory
+// --------------------------------------------------------
+size_t TextureResidency::BytesFromMip(const ResidentTexture& tex, unsigned int topMip)
+{
+	size_t total = 0;
+	for (size_t m = topMip; m < tex.MipBytes.size(); m++)
+		total += tex.MipBytes[m];
+	return total;
+}
+
+
+// --------------------------------------------------------
+// Asks the streamer to change a texture's top mip and
+// updates the bookkeeping if it succeeds
+// --------------------------------------------------------
+bool TextureResidency::ChangeTopMip(unsigned int textureID, unsigned int topMip)
+{
+	ResidentTexture& tex = textures[textureID];
+	if (topMip == tex.ResidentTopMip)
+		return false;
+
+	if (streamer && !streamer->SetResidentTopMip(textureID, topMip))
+		return false;
+
+	// Track what changed
+	if (topMip > tex.ResidentTopMip)
+		mipsDropped += topMip - tex.ResidentTopMip;
+	else
+		mipsRestored += tex.ResidentTopMip - topMip;
+
+	residentBytes -= BytesFromMip(tex, tex.ResidentTopMip);
+	residentBytes += BytesFromMip(tex, topMip);
+	tex.ResidentTopMip = topMip;
+	return true;
+}
+
+
+// --------------------------------------------------------
+// Stand-in for the asset manager used by the self test.
+// Tracks the top mip of each texture on its own, so the
+// policy's bookkeeping can be checked against it, and can
+// delay restores by a number of requests to mimic files
+// being read on another thread.
+// --------------------------------------------------------
+class FakeTextureStreamer : public ITextureStreamer
+{
+public:
+	std::vector<unsigned int> TopMips;
+	std::vector<unsigned int> PendingRequests;
+	unsigned int RestoreLatency = 0;
+	bool Refuse = false;
+	unsigned int Calls = 0;
+
+	bool SetResidentTopMip(unsigned int textureID, unsigned int topMip)
+	{
+		Calls++;
+		if (Refuse || textureID >= TopMips.size())
+			return false;
+
+		// Restores wait until they have been asked for enough times
+		if (topMip < TopMips[textureID] && PendingRequests[textureID]++ < RestoreLatency)
+			return false;
+
+		PendingRequests[textureID] = 0;
+		TopMips[textureID] = topMip;
+		return true;
+	}
+};
+
+
+// --------------------------------------------------------
+// Drives the policy through budget changes, requests and
+// a slow (asynchronous) streamer, checking after each
+// frame that it stays under budget, never drops below a
+// texture's lowest top mip and agrees with the streamer
+// about what is actually resident.
+// --------------------------------------------------------
+TextureResidencyTestResults TextureResidency::Test()
+{
+	TextureResidencyTestResults results = {};
+	auto check = [&](bool condition, const char* description)
+	{
+		results.Checks++;
+		if (!condition)
+		{
+			results.Failures++;
+			printf("  FAILED: %s\n", description);
+		}
+	};
+
+	// Four 256x256 RGBA8 textures with full mip chains
+	const unsigned int textureCount = 4;
+	FakeTextureStreamer streamer;
+	TextureResidency residency;
+	residency.SetStreamer(&streamer);
+	residency.SetMinimumResidentDimension(64);
+	residency.SetMaxStreamInsPerFrame(1);
+	for (unsigned int i = 0; i < textureCount; i++)
+	{
+		residency.RegisterTexture(256, 256, 9, 1, 32, false);
+		streamer.TopMips.push_back(0);
+		streamer.PendingRequests.push_back(0);
+	}
+
+	size_t fullBytes = residency.GetFullResolutionBytes();
+	size_t textureBytes = fullBytes / textureCount;
+	check(residency.GetResidentBytes() == fullBytes, "textures start fully resident");
+	check(residency.GetTexture(0)->LowestTopMip == 2, "lowest top mip stops at the minimum dimension");
+
+	auto agrees = [&]()
+	{
+		size_t bytes = 0;
+		for (unsigned int i = 0; i < textureCount; i++)
+		{
+			const ResidentTexture* tex = residency.GetTexture(i);
+			if (tex->ResidentTopMip != streamer.TopMips[i] || tex->ResidentTopMip > tex->LowestTopMip)
+				return false;
+			bytes += residency.BytesFromMip(*tex, tex->ResidentTopMip);
+		}
+		return bytes == residency.GetResidentBytes();
+	};
+
+	// Over budget with only texture 3 in use: unused textures lose detail first
+	residency.SetBudget(textureBytes * 2);
+	residency.RequestMip(3, 0);
+	residency.Update();
+	check(residency.GetResidentBytes() <= residency.GetBudget(), "budget is enforced");
+	check(residency.GetTexture(3)->ResidentTopMip == 0, "the texture in use keeps its detail");
+	check(residency.GetTexture(0)->ResidentTopMip == 2, "unused textures drop to their lowest top mip");
+	check(agrees(), "bookkeeping matches the streamer after dropping");
+
+	// A budget that cannot be met still never drops below the lowest top mip
+	residency.SetBudget(0);
+	residency.RequestMip(3, 0);
+	residency.Update();
+	bool allAtLowest = true;
+	for (unsigned int i = 0; i < textureCount; i++)
+		allAtLowest &= residency.GetTexture(i)->ResidentTopMip == residency.GetTexture(i)->LowestTopMip;
+	check(allAtLowest, "an impossible budget stops at the lowest top mips");
+	check(agrees(), "bookkeeping matches the streamer at the lowest top mips");
+
+	// Restores that take a few frames are only counted once they finish
+	residency.SetBudget((size_t)-1);
+	streamer.RestoreLatency = 2;
+	for (unsigned int frame = 0; frame < 2; frame++)
+	{
+		residency.RequestMip(1, 0);
+		residency.Update();
+		check(residency.GetTexture(1)->ResidentTopMip == 2, "a pending restore leaves the texture as it was");
+		check(residency.GetMipsRestoredLastUpdate() == 0, "a pending restore is not counted");
+	}
+	residency.RequestMip(1, 0);
+	residency.Update();
+	check(residency.GetTexture(1)->ResidentTopMip == 0, "a finished restore is picked up on a later frame");
+	check(agrees(), "bookkeeping matches the streamer after a slow restore");
+
+	// Restores are limited per frame and go to the requested mip only
+	streamer.RestoreLatency = 0;
+	residency.RequestMip(2, 1);
+	residency.RequestMip(3, 1);
+	residency.Update();
+	check(residency.GetMipsRestoredLastUpdate() == 1, "only one texture is restored per frame");
+	residency.RequestMip(2, 1);
+	residency.RequestMip(3, 1);
+	residency.Update();
+	check(residency.GetTexture(2)->ResidentTopMip == 1 && residency.GetTexture(3)->ResidentTopMip == 1, "textures are restored to the requested mip");
+	check(agrees(), "bookkeeping matches the streamer after limited restores");
+
+	// Textures that are no longer requested are not restored, even if
+	// their data was on the way
+	streamer.RestoreLatency = 1;
+	residency.RequestMip(0, 0);
+	residency.Update();
+	residency.Update();
+	check(residency.GetTexture(0)->ResidentTopMip == 2, "unrequested textures are not restored");
+
+	// A streamer that refuses changes leaves the bookkeeping alone
+	streamer.Refuse = true;
+	size_t bytesBefore = residency.GetResidentBytes();
+	residency.SetBudget(0);
+	residency.Update();
+	check(residency.GetResidentBytes() == bytesBefore, "refused changes are not recorded");
+	check(residency.GetMipsDroppedLastUpdate() == 0, "refused drops are not counted");
+	streamer.Refuse = false;
+	check(agrees(), "bookkeeping matches the streamer after refused changes");
+
+	results.Passed = results.Failures == 0;
+	return results;
+}
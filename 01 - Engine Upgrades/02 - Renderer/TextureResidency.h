@@ -0,0 +1,131 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+
+// --------------------------------------------------------
+// Interface for whatever actually owns the texture memory.
+// The residency policy below never touches the graphics
+// API directly; it asks a streamer to change the most
+// detailed mip that is resident for a given texture.
+// This allows the policy to run against a fake streamer
+// with no device at all.
+// --------------------------------------------------------
+class ITextureStreamer
+{
+public:
+	virtual ~ITextureStreamer() {}
+
+	// Should make mips [topMip, mipCount) resident for the given
+	// texture and release everything more detailed than topMip.
+	// Returns false if the change could not be made.  Restoring
+	// mips may finish asynchronously: return false until the data
+	// is ready, as the policy repeats the request on later frames
+	// for as long as the texture still wants that detail.
+	virtual bool SetResidentTopMip(unsigned int textureID, unsigned int topMip) = 0;
+};
+
+// --------------------------------------------------------
+// Results of the residency policy's self test
+// --------------------------------------------------------
+struct TextureResidencyTestResults
+{
+	unsigned int Checks;
+	unsigned int Failures;
+	bool Passed;
+};
+
+// --------------------------------------------------------
+// Residency details for a single texture
+// --------------------------------------------------------
+struct ResidentTexture
+{
+	std::vector<size_t> MipBytes;		// Size of each mip level (all slices)
+	unsigned int ResidentTopMip;		// Most detailed mip currently in memory
+	unsigned int RequestedTopMip;		// Most detailed mip requested this frame
+	unsigned int LowestTopMip;			// Never drop more mips than this
+	unsigned long long LastUsedFrame;	// For least-recently-used ordering
+};
+
+// --------------------------------------------------------
+// Tracks the memory used by textures and keeps it under
+// a budget by dropping the top (most detailed) mips of
+// the least recently used textures.  Dropped mips are
+// streamed back in when textures are requested at a
+// higher level of detail and the budget allows it.
+// --------------------------------------------------------
+class TextureResidency
+{
+public:
+	TextureResidency();
+
+	void SetStreamer(ITextureStreamer* streamer);
+
+	unsigned int RegisterTexture(
+		unsigned int width,
+		unsigned int height,
+		unsigned int mipLevels,
+		unsigned int arraySize,
+		unsigned int bitsPerPixel,
+		bool blockCompressed);
+
+	void UpdateTexture(
+		unsigned int textureID,
+		unsigned int width,
+		unsigned int height,
+		unsigned int mipLevels,
+		unsigned int arraySize,
+		unsigned int bitsPerPixel,
+		bool blockCompressed);
+
+	void RequestMip(unsigned int textureID, unsigned int topMip);
+	unsigned int MipForDistance(float distance);
+	void Update();
+
+	// Settings
+	void SetBudget(size_t bytes);
+	void SetFullDetailDistance(float distance);
+	void SetMinimumResidentDimension(unsigned int dimension);
+	void SetMaxStreamInsPerFrame(unsigned int count);
+	size_t GetBudget();
+	float GetFullDetailDistance();
+
+	// Stats
+	size_t GetResidentBytes();
+	size_t GetRequestedBytes();
+	size_t GetFullResolutionBytes();
+	unsigned int GetTextureCount();
+	unsigned int GetMipsDroppedLastUpdate();
+	unsigned int GetMipsRestoredLastUpdate();
+	const ResidentTexture* GetTexture(unsigned int textureID);
+
+	// Helper for determining the size of a texture's mips
+	static std::vector<size_t> CalculateMipBytes(
+		unsigned int width,
+		unsigned int height,
+		unsigned int mipLevels,
+		unsigned int arraySize,
+		unsigned int bitsPerPixel,
+		bool blockCompressed);
+
+	// Runs the policy against a fake streamer (no device) and
+	// prints any check that fails
+	static TextureResidencyTestResults Test();
+
+private:
+	ITextureStreamer* streamer;
+	std::vector<ResidentTexture> textures;
+
+	unsigned long long currentFrame;
+	size_t budget;
+	size_t residentBytes;
+	size_t requestedBytes;
+	float fullDetailDistance;
+	unsigned int minimumResidentDimension;
+	unsigned int maxStreamInsPerFrame;
+	unsigned int mipsDropped;
+	unsigned int mipsRestored;
+
+	size_t BytesFromMip(const ResidentTexture& tex, unsigned int topMip);
+	bool ChangeTopMip(unsigned int textureID, unsigned int topMip);
+};
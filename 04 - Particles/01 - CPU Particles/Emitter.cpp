@@ -2,6 +2,10 @@
 
 using namespace DirectX;
 
+// Each new emitter gets the next seed, so a scene built
+// in the same order always gets the same particles
+static unsigned int nextRandomSeed = 1;
+
 Emitter::Emitter(
 	int maxParticles,
 	int particlesPerSecond,
@@ -21,7 +25,8 @@ Emitter::Emitter(
 	bool isSpriteSheet,
 	unsigned int spriteSheetWidth,
 	unsigned int spriteSheetHeight
-)
+) :
+	particles(maxParticles)
 {
 	// Save params
 	this->material = material;
@@ -53,10 +58,9 @@ Emitter::Emitter(
 	livingParticleCount = 0;
 	firstAliveIndex = 0;
 	firstDeadIndex = 0;
+	updateParams = {};
 
-	// Make the particle array
-	particles = new Particle[maxParticles];
-	ZeroMemory(particles, sizeof(Particle) * maxParticles);
+	SetRandomSeed(nextRandomSeed++);
 
 	// Set up UVs
 	DefaultUVs[0] = XMFLOAT2(0, 0);
@@ -64,16 +68,6 @@ Emitter::Emitter(
 	DefaultUVs[2] = XMFLOAT2(1, 1);
 	DefaultUVs[3] = XMFLOAT2(0, 1);
 
-	// Create UV's here, as those will usually stay the same
-	localParticleVertices = new ParticleVertex[4 * maxParticles];
-	for (int i = 0; i < maxParticles * 4; i += 4)
-	{
-		localParticleVertices[i + 0].UV = DefaultUVs[0];
-		localParticleVertices[i + 1].UV = DefaultUVs[1];
-		localParticleVertices[i + 2].UV = DefaultUVs[2];
-		localParticleVertices[i + 3].UV = DefaultUVs[3];
-	}
-
 
 	// Create buffers for drawing particles
 
@@ -109,257 +103,498 @@ Emitter::Emitter(
 	device->CreateBuffer(&ibDesc, &indexData, indexBuffer.GetAddressOf());
 
 	delete[] indices;
+
+	// DYNAMIC structured buffer of one record per particle, for
+	// expanding the quads in the vertex shader instead
+	D3D11_BUFFER_DESC recordDesc = {};
+	recordDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+	recordDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+	recordDesc.Usage = D3D11_USAGE_DYNAMIC;
+	recordDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+	recordDesc.StructureByteStride = sizeof(ParticleRecord);
+	recordDesc.ByteWidth = sizeof(ParticleRecord) * maxParticles;
+	device->CreateBuffer(&recordDesc, 0, recordBuffer.GetAddressOf());
+
+	D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	srvDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+	srvDesc.Format = DXGI_FORMAT_UNKNOWN;
+	srvDesc.Buffer.FirstElement = 0;
+	srvDesc.Buffer.NumElements = maxParticles;
+	device->CreateShaderResourceView(recordBuffer.Get(), &srvDesc, recordSRV.GetAddressOf());
 }
 
 
 Emitter::~Emitter()
 {
-	delete[] particles;
-	delete[] localParticleVertices;
 }
 
 Transform* Emitter::GetTransform() { return &transform; }
 std::shared_ptr<Material> Emitter::GetMaterial() { return material; }
 void Emitter::SetMaterial(std::shared_ptr<Material> material) { this->material = material; }
+int Emitter::GetLivingParticleCount() { return livingParticleCount; }
+unsigned int Emitter::GetRandomSeed() { return randomSeed; }
 
-void Emitter::Update(float dt)
+// --------------------------------------------------------
+// Restarts this emitter's random sequence from the given seed
+// --------------------------------------------------------
+void Emitter::SetRandomSeed(unsigned int seed)
 {
-	// Update all particles - Check cyclic buffer first
-	if (firstAliveIndex < firstDeadIndex)
-	{
-		// First alive is BEFORE first dead, so the "living" particles are contiguous
-		// 
-		// 0 -------- FIRST ALIVE ----------- FIRST DEAD -------- MAX
-		// |    dead    |            alive       |         dead    |
-
-		// First alive is before first dead, so no wrapping
-		for (int i = firstAliveIndex; i < firstDeadIndex; i++)
-			UpdateSingleParticle(dt, i);
-	}
-	else
+	randomSeed = seed;
+	random.Seed(seed);
+}
+
+// --------------------------------------------------------
+// Kills every particle and restarts the random sequence, so
+// the same frame times from here replay exactly the same
+// particles as the last time this seed was used
+// --------------------------------------------------------
+void Emitter::Restart(unsigned int seed)
+{
+	timeSinceEmit = 0;
+	livingParticleCount = 0;
+	firstAliveIndex = 0;
+	firstDeadIndex = 0;
+	SetRandomSeed(seed);
+}
+
+
+// --------------------------------------------------------
+// Updates every emitter using the job system, in three steps:
+//  1. Each emitter gets ready (on this thread, as it's cheap)
+//  2. Every chunk of living particles, across all emitters,
+//     is simulated as its own job
+//  3. Each emitter retires its dead particles and spawns new
+//     ones as its own job, using its own random sequence
+//
+// The chunks are based on each emitter's particle count, not
+// on the number of threads, so the results are identical no
+// matter how many threads there are or which runs what.
+// --------------------------------------------------------
+void Emitter::UpdateEmitters(const std::vector<std::shared_ptr<Emitter>>& emitters, float dt, JobSystem& jobs)
+{
+	std::vector<std::pair<Emitter*, int>> chunks;
+	for (auto& e : emitters)
 	{
-		// First alive is AFTER first dead, so the "living" particles wrap around
-		// 
-		// 0 -------- FIRST DEAD ----------- FIRST ALIVE -------- MAX
-		// |    alive    |            dead       |         alive   |
-
-		// Update first half (from firstAlive to max particles)
-		for (int i = firstAliveIndex; i < maxParticles; i++)
-			UpdateSingleParticle(dt, i);
-
-		// Update second half (from 0 to first dead)
-		for (int i = 0; i < firstDeadIndex; i++)
-			UpdateSingleParticle(dt, i);
+		e->BeginUpdate(dt);
+		for (int c = 0; c < e->GetChunkCount(); c++)
+			chunks.push_back(std::make_pair(e.get(), c));
 	}
 
+	jobs.Run((unsigned int)chunks.size(), [&](unsigned int i) { chunks[i].first->UpdateChunk(chunks[i].second); });
+	jobs.Run((unsigned int)emitters.size(), [&](unsigned int i) { emitters[i]->FinishUpdate(dt); });
+}
+
+// --------------------------------------------------------
+// How many jobs this emitter's living particles are split into
+// --------------------------------------------------------
+int Emitter::GetChunkCount()
+{
+	return (livingParticleCount + PARTICLES_PER_JOB - 1) / PARTICLES_PER_JOB;
+}
+
+// --------------------------------------------------------
+// Sets up the values every chunk of this update needs
+// --------------------------------------------------------
+void Emitter::BeginUpdate(float dt)
+{
+	updateParams.DeltaTime = dt;
+	updateParams.Lifetime = lifetime;
+	updateParams.StartColor[0] = startColor.x; updateParams.StartColor[1] = startColor.y; updateParams.StartColor[2] = startColor.z; updateParams.StartColor[3] = startColor.w;
+	updateParams.EndColor[0] = endColor.x; updateParams.EndColor[1] = endColor.y; updateParams.EndColor[2] = endColor.z; updateParams.EndColor[3] = endColor.w;
+	updateParams.StartSize = startSize;
+	updateParams.EndSize = endSize;
+	updateParams.Acceleration[0] = emitterAcceleration.x;
+	updateParams.Acceleration[1] = emitterAcceleration.y;
+	updateParams.Acceleration[2] = emitterAcceleration.z;
+
+	chunkDeaths.assign(GetChunkCount(), 0);
+}
+
+// --------------------------------------------------------
+// Simulates one chunk of living particles, which may wrap
+// around the end of the cyclic buffer
+//
+// 0 -------- FIRST DEAD ----------- FIRST ALIVE -------- MAX
+// |    alive    |            dead       |         alive   |
+// --------------------------------------------------------
+void Emitter::UpdateChunk(int chunk)
+{
+	int first = firstAliveIndex + chunk * PARTICLES_PER_JOB;
+	int count = min(PARTICLES_PER_JOB, livingParticleCount - chunk * PARTICLES_PER_JOB);
+	if (first >= maxParticles)
+		first -= maxParticles;
+
+	int firstHalfCount = min(count, maxParticles - first);
+	int died = particles.UpdateSIMD(first, firstHalfCount, updateParams);
+	died += particles.UpdateSIMD(0, count - firstHalfCount, updateParams);
+	chunkDeaths[chunk] = died;
+}
+
+// --------------------------------------------------------
+// Retires this update's dead particles and spawns new ones
+// --------------------------------------------------------
+void Emitter::FinishUpdate(float dt)
+{
+	// Every particle has the same lifetime, so the ones that
+	// died are always the oldest - retire them by moving the
+	// first alive index past them
+	int died = 0;
+	for (int d : chunkDeaths)
+		died += d;
+
+	firstAliveIndex += died;
+	if (firstAliveIndex >= maxParticles)
+		firstAliveIndex -= maxParticles;
+	livingParticleCount -= died;
+
 	// Add to the time
 	timeSinceEmit += dt;
 
 	// Enough time to emit?
+	int spawnCount = 0;
 	while (timeSinceEmit > secondsPerParticle)
 	{
-		SpawnParticle();
+		spawnCount++;
 		timeSinceEmit -= secondsPerParticle;
 	}
+	SpawnParticles(spawnCount);
 }
 
-void Emitter::UpdateSingleParticle(float dt, int index)
+// --------------------------------------------------------
+// Spawns up to count particles (as many as there's room for),
+// with every random number they need made in one batch
+// --------------------------------------------------------
+void Emitter::SpawnParticles(int count)
 {
-	// Check for valid particle age before doing anything
-	if (particles[index].Age >= lifetime)
+	// Any left to spawn?
+	count = min(count, maxParticles - livingParticleCount);
+	if (count <= 0)
 		return;
 
-	// Update and check for death
-	particles[index].Age += dt;
-	if (particles[index].Age >= lifetime)
+	spawnRandoms.resize(count * RANDOMS_PER_PARTICLE);
+	random.NextFloats(spawnRandoms.data(), count * RANDOMS_PER_PARTICLE);
+
+	for (int s = 0; s < count; s++)
 	{
-		// Recent death, so retire by moving alive count
-		firstAliveIndex++;
-		firstAliveIndex %= maxParticles;
-		livingParticleCount--;
-		return;
+		// This particle's random numbers, from [0, 1)
+		const float* r = &spawnRandoms[s * RANDOMS_PER_PARTICLE];
+
+		// Reset the first dead particle
+		int i = firstDeadIndex;
+		particles.Age[i] = 0;
+		particles.Size[i] = startSize;
+		particles.ColorR[i] = startColor.x;
+		particles.ColorG[i] = startColor.y;
+		particles.ColorB[i] = startColor.z;
+		particles.ColorA[i] = startColor.w;
+
+		particles.StartPositionX[i] = (r[0] * 2 - 1) * positionRandomRange.x;
+		particles.StartPositionY[i] = (r[1] * 2 - 1) * positionRandomRange.y;
+		particles.StartPositionZ[i] = (r[2] * 2 - 1) * positionRandomRange.z;
+
+		particles.PositionX[i] = particles.StartPositionX[i];
+		particles.PositionY[i] = particles.StartPositionY[i];
+		particles.PositionZ[i] = particles.StartPositionZ[i];
+
+		particles.StartVelocityX[i] = startVelocity.x + (r[3] * 2 - 1) * velocityRandomRange.x;
+		particles.StartVelocityY[i] = startVelocity.y + (r[4] * 2 - 1) * velocityRandomRange.y;
+		particles.StartVelocityZ[i] = startVelocity.z + (r[5] * 2 - 1) * velocityRandomRange.z;
+
+		particles.RotationStart[i] = rotationRandomRanges.x + r[6] * (rotationRandomRanges.y - rotationRandomRanges.x);
+		particles.RotationEnd[i] = rotationRandomRanges.z + r[7] * (rotationRandomRanges.w - rotationRandomRanges.z);
+		particles.Rotation[i] = particles.RotationStart[i];
+
+		// Increment and wrap
+		firstDeadIndex++;
+		firstDeadIndex %= maxParticles;
 	}
 
-	// Calculate age percentage for lerp
-	float agePercent = particles[index].Age / lifetime;
-
-	// Interpolate the color
-	XMStoreFloat4(
-		&particles[index].Color,
-		XMVectorLerp(
-			XMLoadFloat4(&startColor),
-			XMLoadFloat4(&endColor),
-			agePercent));
-
-	// Interpolate the rotation
-	float rotStart = particles[index].RotationStart;
-	float rotEnd = particles[index].RotationEnd;
-	particles[index].Rotation = rotStart + agePercent * (rotEnd - rotStart);
-
-	// Interpolate the size
-	particles[index].Size = startSize + agePercent * (endSize - startSize);
-
-	// Adjust the position
-	XMVECTOR startPos = XMLoadFloat3(&particles[index].StartPosition);
-	XMVECTOR startVel = XMLoadFloat3(&particles[index].StartVelocity);
-	XMVECTOR accel = XMLoadFloat3(&emitterAcceleration);
-	float t = particles[index].Age;
-
-	// Use constant acceleration function
-	XMStoreFloat3(
-		&particles[index].Position,
-		accel * t * t / 2.0f + startVel * t + startPos);
+	livingParticleCount += count;
 }
 
-void Emitter::SpawnParticle()
-{
-	// Any left to spawn?
-	if (livingParticleCount == maxParticles)
-		return;
-
-	// Reset the first dead particle
-	particles[firstDeadIndex].Age = 0;
-	particles[firstDeadIndex].Size = startSize;
-	particles[firstDeadIndex].Color = startColor;
-
-	particles[firstDeadIndex].StartPosition = XMFLOAT3(0,0,0);
-	particles[firstDeadIndex].StartPosition.x += (((float)rand() / RAND_MAX) * 2 - 1) * positionRandomRange.x;
-	particles[firstDeadIndex].StartPosition.y += (((float)rand() / RAND_MAX) * 2 - 1) * positionRandomRange.y;
-	particles[firstDeadIndex].StartPosition.z += (((float)rand() / RAND_MAX) * 2 - 1) * positionRandomRange.z;
-
-	particles[firstDeadIndex].Position = particles[firstDeadIndex].StartPosition;
 
-	particles[firstDeadIndex].StartVelocity = startVelocity;
-	particles[firstDeadIndex].StartVelocity.x += (((float)rand() / RAND_MAX) * 2 - 1) * velocityRandomRange.x;
-	particles[firstDeadIndex].StartVelocity.y += (((float)rand() / RAND_MAX) * 2 - 1) * velocityRandomRange.y;
-	particles[firstDeadIndex].StartVelocity.z += (((float)rand() / RAND_MAX) * 2 - 1) * velocityRandomRange.z;
-
-	float rotStartMin = rotationRandomRanges.x;
-	float rotStartMax = rotationRandomRanges.y;
-	particles[firstDeadIndex].RotationStart = ((float)rand() / RAND_MAX) * (rotStartMax - rotStartMin) + rotStartMin;
-
-	float rotEndMin = rotationRandomRanges.z;
-	float rotEndMax = rotationRandomRanges.w;
-	particles[firstDeadIndex].RotationEnd = ((float)rand() / RAND_MAX) * (rotEndMax - rotEndMin) + rotEndMin;
-
-	// Increment and wrap
-	firstDeadIndex++;
-	firstDeadIndex %= maxParticles;
-
-	livingParticleCount++;
-}
-
-void Emitter::CopyParticlesToGPU(Microsoft::WRL::ComPtr<ID3D11DeviceContext> context, std::shared_ptr<Camera> camera)
+// --------------------------------------------------------
+// Maps every emitter's vertex buffer (or record buffer, when
+// the quads are expanded on the GPU) and has the job system
+// fill them in.  Only the living particles are written.
+//
+// sortBackToFront - Write each emitter's particles farthest
+//                   first, for alpha blending, instead of in
+//                   the order they were spawned
+//
+// Returns the total bytes written to the GPU this frame
+// --------------------------------------------------------
+size_t Emitter::CopyEmittersToGPU(
+	const std::vector<std::shared_ptr<Emitter>>& emitters,
+	Microsoft::WRL::ComPtr<ID3D11DeviceContext> context,
+	std::shared_ptr<Camera> camera,
+	bool expandOnGPU,
+	bool sortBackToFront,
+	JobSystem& jobs)
 {
-	// Update local buffer (living particles only as a speed up)
+	// Sort before mapping, so the buffers are held as briefly as possible
+	if (sortBackToFront)
+		SortEmitters(emitters, camera->GetView(), jobs);
+
+	// Mapping has to happen on this thread
+	std::vector<void*> destinations;
+	size_t bytes = 0;
+	for (auto& e : emitters)
+	{
+		D3D11_MAPPED_SUBRESOURCE mapped = {};
+		context->Map(expandOnGPU ? e->recordBuffer.Get() : e->vertexBuffer.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped);
+		destinations.push_back(mapped.pData);
+
+		bytes += e->livingParticleCount * (expandOnGPU ? sizeof(ParticleRecord) : sizeof(ParticleVertex) * 4);
+	}
 
-	// Check cyclic buffer status
-	if (firstAliveIndex < firstDeadIndex)
+	if (expandOnGPU)
 	{
-		for (int i = firstAliveIndex; i < firstDeadIndex; i++)
-			CopyOneParticle(i, camera);
+		std::vector<ParticleRecord*> records;
+		for (void* d : destinations)
+			records.push_back((ParticleRecord*)d);
+		BuildEmitterRecords(emitters, records, sortBackToFront, jobs);
 	}
 	else
 	{
-		// Update first half (from firstAlive to max particles)
-		for (int i = firstAliveIndex; i < maxParticles; i++)
-			CopyOneParticle(i, camera);
-
-		// Update second half (from 0 to first dead)
-		for (int i = 0; i < firstDeadIndex; i++)
-			CopyOneParticle(i, camera);
+		std::vector<ParticleVertex*> vertices;
+		for (void* d : destinations)
+			vertices.push_back((ParticleVertex*)d);
+
+		// Get the right and up vectors out of the view matrix
+		XMFLOAT4X4 view = camera->GetView();
+		XMFLOAT3 cameraRight(view._11, view._21, view._31);
+		XMFLOAT3 cameraUp(view._12, view._22, view._32);
+		BuildEmitterQuads(emitters, vertices, cameraRight, cameraUp, sortBackToFront, jobs);
 	}
 
-	// All particles copied locally - send whole buffer to GPU
-	D3D11_MAPPED_SUBRESOURCE mapped = {};
-	context->Map(vertexBuffer.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped);
-
-	memcpy(mapped.pData, localParticleVertices, sizeof(ParticleVertex) * 4 * maxParticles);
+	for (auto& e : emitters)
+		context->Unmap(expandOnGPU ? e->recordBuffer.Get() : e->vertexBuffer.Get(), 0);
 
-	context->Unmap(vertexBuffer.Get(), 0);
+	return bytes;
 }
 
-void Emitter::CopyOneParticle(int index, std::shared_ptr<Camera> camera)
+// --------------------------------------------------------
+// Sorts each emitter's living particles back to front, one
+// job per emitter.  Particles are only sorted within their
+// own emitter, as each emitter is still drawn on its own.
+//
+// view - The camera's view matrix
+// --------------------------------------------------------
+void Emitter::SortEmitters(
+	const std::vector<std::shared_ptr<Emitter>>& emitters,
+	DirectX::XMFLOAT4X4 view,
+	JobSystem& jobs)
 {
-	int i = index * 4;
+	// Particles are relative to their emitter, so each needs its own
+	// world * view matrix (and getting the world matrix may update
+	// the transform, so that has to happen on this thread)
+	std::vector<XMFLOAT4X4> worldViews(emitters.size());
+	XMMATRIX viewMatrix = XMLoadFloat4x4(&view);
+	for (size_t e = 0; e < emitters.size(); e++)
+	{
+		XMFLOAT4X4 world = emitters[e]->transform.GetWorldMatrix();
+		XMStoreFloat4x4(&worldViews[e], XMLoadFloat4x4(&world) * viewMatrix);
+	}
 
-	localParticleVertices[i + 0].Position = CalcParticleVertexPosition(index, 0, camera);
-	localParticleVertices[i + 1].Position = CalcParticleVertexPosition(index, 1, camera);
-	localParticleVertices[i + 2].Position = CalcParticleVertexPosition(index, 2, camera);
-	localParticleVertices[i + 3].Position = CalcParticleVertexPosition(index, 3, camera);
+	jobs.Run((unsigned int)emitters.size(), [&](unsigned int i)
+		{
+			const XMFLOAT4X4& wv = worldViews[i];
+			float viewZ[4] = { wv._13, wv._23, wv._33, wv._43 };
+			emitters[i]->SortByDepth(viewZ);
+		});
+}
 
-	localParticleVertices[i + 0].Color = particles[index].Color;
-	localParticleVertices[i + 1].Color = particles[index].Color;
-	localParticleVertices[i + 2].Color = particles[index].Color;
-	localParticleVertices[i + 3].Color = particles[index].Color;
+// --------------------------------------------------------
+// Works out this emitter's back to front draw order
+//
+// viewZ - Third column of the world * view matrix
+// --------------------------------------------------------
+void Emitter::SortByDepth(const float viewZ[4])
+{
+	// One key per living particle, oldest first, which may
+	// wrap around the end of the cyclic buffer
+	unsigned int* keys = sorter.GetKeys(livingParticleCount);
+	int firstHalfCount = min(livingParticleCount, maxParticles - firstAliveIndex);
+	particles.BackToFrontKeys(firstAliveIndex, firstHalfCount, viewZ, keys);
+	particles.BackToFrontKeys(0, livingParticleCount - firstHalfCount, viewZ, keys + firstHalfCount);
+
+	sorter.Sort(livingParticleCount);
+}
 
-	// If it's a spritesheet, we need to update UV coords as the particle ages
-	if (isSpriteSheet)
+// --------------------------------------------------------
+// Builds a camera-facing quad for every living particle of
+// every emitter, one job per chunk of particles.  Each
+// emitter's quads start at the beginning of its destination,
+// oldest particle first (or back to front if sorted), so
+// they can be drawn in one call.
+//
+// sorted - Use each emitter's order from SortEmitters()
+// --------------------------------------------------------
+void Emitter::BuildEmitterQuads(
+	const std::vector<std::shared_ptr<Emitter>>& emitters,
+	const std::vector<ParticleVertex*>& destinations,
+	DirectX::XMFLOAT3 cameraRight,
+	DirectX::XMFLOAT3 cameraUp,
+	bool sorted,
+	JobSystem& jobs)
+{
+	std::vector<std::pair<int, int>> chunks;
+	for (int e = 0; e < (int)emitters.size(); e++)
 	{
-		// How old is this particle as a percentage
-		float agePercent = particles[index].Age / lifetime;
-
-		// Which overall index?
-		int ssIndex = (int)floor(agePercent * (spriteSheetWidth * spriteSheetHeight));
-
-		// Get the U/V indices (basically column & row index across the sprite sheet)
-		int uIndex = ssIndex % spriteSheetWidth;
-		int vIndex = ssIndex / spriteSheetWidth; // Integer division is important here!
+		for (int c = 0; c < emitters[e]->GetChunkCount(); c++)
+			chunks.push_back(std::make_pair(e, c));
+	}
 
-		// Convert to a top-left corner in uv space (0-1)
-		float u = uIndex / (float)spriteSheetWidth;
-		float v = vIndex / (float)spriteSheetHeight;
+	XMVECTOR right = XMLoadFloat3(&cameraRight);
+	XMVECTOR up = XMLoadFloat3(&cameraUp);
+	jobs.Run((unsigned int)chunks.size(), [&](unsigned int i)
+		{
+			int e = chunks[i].first;
+			const int* order = sorted ? emitters[e]->sorter.GetOrder() : 0;
+			emitters[e]->BuildQuads(chunks[i].second, destinations[e], right, up, order);
+		});
+}
 
-		localParticleVertices[i + 0].UV = XMFLOAT2(u, v);
-		localParticleVertices[i + 1].UV = XMFLOAT2(u + spriteSheetFrameWidth, v);
-		localParticleVertices[i + 2].UV = XMFLOAT2(u + spriteSheetFrameWidth, v + spriteSheetFrameHeight);
-		localParticleVertices[i + 3].UV = XMFLOAT2(u, v + spriteSheetFrameHeight);
+// --------------------------------------------------------
+// Builds the quads for one chunk of living particles.  The
+// destination may be mapped GPU memory, so it's only ever
+// written to, never read.
+//
+// order - Which particle goes in each slot, as an offset from
+//         the oldest, or null to go oldest first
+// --------------------------------------------------------
+void Emitter::BuildQuads(int chunk, ParticleVertex* vertices, DirectX::FXMVECTOR cameraRight, DirectX::FXMVECTOR cameraUp, const int* order)
+{
+	// Determine the offset of each corner of the quad from
+	// the default UVs: convert from [0,1] to [-1,1] and flip Y
+	XMFLOAT2 offsets[4];
+	for (int c = 0; c < 4; c++)
+		offsets[c] = XMFLOAT2(DefaultUVs[c].x * 2 - 1, DefaultUVs[c].y * -2 + 1);
+
+	int firstLiving = chunk * PARTICLES_PER_JOB;
+	int endLiving = min(firstLiving + PARTICLES_PER_JOB, livingParticleCount);
+	for (int slot = firstLiving; slot < endLiving; slot++)
+	{
+		int index = firstAliveIndex + (order ? order[slot] : slot);
+		if (index >= maxParticles)
+			index -= maxParticles;
+
+		float sinRot, cosRot;
+		XMScalarSinCos(&sinRot, &cosRot, particles.Rotation[index]);
+		float size = particles.Size[index];
+		XMVECTOR position = XMVectorSet(particles.PositionX[index], particles.PositionY[index], particles.PositionZ[index], 0);
+		XMFLOAT4 color(particles.ColorR[index], particles.ColorG[index], particles.ColorB[index], particles.ColorA[index]);
+
+		// If it's a spritesheet, we need to update UV coords as the particle ages
+		XMFLOAT2 uvs[4] = { DefaultUVs[0], DefaultUVs[1], DefaultUVs[2], DefaultUVs[3] };
+		if (isSpriteSheet)
+		{
+			// How old is this particle as a percentage
+			float agePercent = particles.Age[index] / lifetime;
+
+			// Which overall index?
+			int ssIndex = (int)floor(agePercent * (spriteSheetWidth * spriteSheetHeight));
+
+			// Get the U/V indices (basically column & row index across the sprite sheet)
+			int uIndex = ssIndex % spriteSheetWidth;
+			int vIndex = ssIndex / spriteSheetWidth; // Integer division is important here!
+
+			// Convert to a top-left corner in uv space (0-1)
+			float u = uIndex / (float)spriteSheetWidth;
+			float v = vIndex / (float)spriteSheetHeight;
+
+			uvs[0] = XMFLOAT2(u, v);
+			uvs[1] = XMFLOAT2(u + spriteSheetFrameWidth, v);
+			uvs[2] = XMFLOAT2(u + spriteSheetFrameWidth, v + spriteSheetFrameHeight);
+			uvs[3] = XMFLOAT2(u, v + spriteSheetFrameHeight);
+		}
+
+		// Rotate each corner around Z, scale it, and push the
+		// position along the camera's right and up vectors
+		ParticleVertex* quad = vertices + slot * 4;
+		for (int c = 0; c < 4; c++)
+		{
+			float x = (offsets[c].x * cosRot - offsets[c].y * sinRot) * size;
+			float y = (offsets[c].x * sinRot + offsets[c].y * cosRot) * size;
+			XMStoreFloat3(&quad[c].Position, position + cameraRight * x + cameraUp * y);
+			quad[c].UV = uvs[c];
+			quad[c].Color = color;
+		}
 	}
 }
 
 
-XMFLOAT3 Emitter::CalcParticleVertexPosition(int particleIndex, int quadCornerIndex, std::shared_ptr<Camera> camera)
+// --------------------------------------------------------
+// Builds a compact record for every living particle of every
+// emitter, one job per chunk of particles, oldest first (or
+// back to front if sorted)
+// --------------------------------------------------------
+void Emitter::BuildEmitterRecords(
+	const std::vector<std::shared_ptr<Emitter>>& emitters,
+	const std::vector<ParticleRecord*>& destinations,
+	bool sorted,
+	JobSystem& jobs)
 {
-	// Get the right and up vectors out of the view matrix
-	XMFLOAT4X4 view = camera->GetView();
-	XMVECTOR camRight = XMVectorSet(view._11, view._21, view._31, 0);
-	XMVECTOR camUp = XMVectorSet(view._12, view._22, view._32, 0);
-
-	// Determine the offset of this corner of the quad
-	// Since the UV's are already set when the emitter is created, 
-	// we can alter that data to determine the general offset of this corner
-	XMFLOAT2 offset = DefaultUVs[quadCornerIndex];
-	offset.x = offset.x * 2 - 1;	// Convert from [0,1] to [-1,1]
-	offset.y = (offset.y * -2 + 1);	// Same, but flip the Y
-
-	// Load into a vector, which we'll assume is float3 with a Z of 0
-	// Create a Z rotation matrix and apply it to the offset
-	XMVECTOR offsetVec = XMLoadFloat2(&offset);
-	XMMATRIX rotMatrix = XMMatrixRotationZ(particles[particleIndex].Rotation);
-	offsetVec = XMVector3Transform(offsetVec, rotMatrix);
-
-	// Add and scale the camera up/right vectors to the position as necessary
-	XMVECTOR posVec = XMLoadFloat3(&particles[particleIndex].Position);
-	posVec += camRight * XMVectorGetX(offsetVec) * particles[particleIndex].Size;
-	posVec += camUp * XMVectorGetY(offsetVec) * particles[particleIndex].Size;
-
-	// This position is all set
-	XMFLOAT3 pos;
-	XMStoreFloat3(&pos, posVec);
-	return pos;
+	std::vector<std::pair<int, int>> chunks;
+	for (int e = 0; e < (int)emitters.size(); e++)
+	{
+		for (int c = 0; c < emitters[e]->GetChunkCount(); c++)
+			chunks.push_back(std::make_pair(e, c));
+	}
+
+	jobs.Run((unsigned int)chunks.size(), [&](unsigned int i)
+		{
+			int e = chunks[i].first;
+			const int* order = sorted ? emitters[e]->sorter.GetOrder() : 0;
+			emitters[e]->BuildRecords(chunks[i].second, destinations[e], order);
+		});
 }
 
+// --------------------------------------------------------
+// Builds the records for one chunk of living particles.  Like
+// BuildQuads(), the destination is only ever written to.
+// --------------------------------------------------------
+void Emitter::BuildRecords(int chunk, ParticleRecord* records, const int* order)
+{
+	float invLifetime = 1.0f / lifetime;
 
+	int firstLiving = chunk * PARTICLES_PER_JOB;
+	int endLiving = min(firstLiving + PARTICLES_PER_JOB, livingParticleCount);
+	for (int slot = firstLiving; slot < endLiving; slot++)
+	{
+		int index = firstAliveIndex + (order ? order[slot] : slot);
+		if (index >= maxParticles)
+			index -= maxParticles;
+
+		ParticleRecord& record = records[slot];
+		record.Position = XMFLOAT3(particles.PositionX[index], particles.PositionY[index], particles.PositionZ[index]);
+		record.Size = particles.Size[index];
+		record.Color = XMFLOAT4(particles.ColorR[index], particles.ColorG[index], particles.ColorB[index], particles.ColorA[index]);
+		record.Rotation = particles.Rotation[index];
+		record.AgePercent = particles.Age[index] * invLifetime;
+	}
+}
 
-void Emitter::Draw(Microsoft::WRL::ComPtr<ID3D11DeviceContext> context, std::shared_ptr<Camera> camera, bool debugWireframe)
-{
-	// Copy to dynamic buffer
-	CopyParticlesToGPU(context, camera);
 
+// --------------------------------------------------------
+// Draws the particles copied by CopyEmittersToGPU()
+//
+// expandVS - Vertex shader that builds the quads from the
+//            records (if they were copied), or null to draw
+//            the quads in the vertex buffer
+// --------------------------------------------------------
+void Emitter::Draw(
+	Microsoft::WRL::ComPtr<ID3D11DeviceContext> context,
+	std::shared_ptr<Camera> camera,
+	bool debugWireframe,
+	std::shared_ptr<SimpleVertexShader> expandVS)
+{
 	// Set up buffers
-	UINT stride = sizeof(ParticleVertex);
+	UINT stride = expandVS ? 0 : sizeof(ParticleVertex);
 	UINT offset = 0;
-	context->IASetVertexBuffers(0, 1, vertexBuffer.GetAddressOf(), &stride, &offset);
+	ID3D11Buffer* nullBuffer = 0;
+	context->IASetVertexBuffers(0, 1, expandVS ? &nullBuffer : vertexBuffer.GetAddressOf(), &stride, &offset);
 	context->IASetIndexBuffer(indexBuffer.Get(), DXGI_FORMAT_R32_UINT, 0);
 
 	// Set particle-specific data and let the
@@ -367,20 +602,122 @@ void Emitter::Draw(Microsoft::WRL::ComPtr<ID3D11DeviceContext> context, std::sha
 	material->GetPixelShader()->SetInt("debugWireframe", (int)debugWireframe);
 	material->PrepareMaterial(&transform, camera);
 
-	// Draw the correct parts of the buffer
-	if (firstAliveIndex < firstDeadIndex)
+	// Swap in the expanding vertex shader, which has no vertex buffer and
+	// builds each quad from a record instead (as in the Hybrid demo)
+	if (expandVS)
 	{
-		context->DrawIndexed(livingParticleCount * 6, firstAliveIndex * 6, 0);
-	}
-	else
-	{
-		// Draw first half (0 -> dead)
-		context->DrawIndexed(firstDeadIndex * 6, 0, 0);
-
-		// Draw second half (alive -> max)
-		context->DrawIndexed((maxParticles - firstAliveIndex) * 6, firstAliveIndex * 6, 0);
+		expandVS->SetShader();
+		expandVS->SetMatrix4x4("world", transform.GetWorldMatrix());
+		expandVS->SetMatrix4x4("view", camera->GetView());
+		expandVS->SetMatrix4x4("projection", camera->GetProjection());
+		expandVS->SetInt("spriteSheetWidth", isSpriteSheet ? spriteSheetWidth : 1);
+		expandVS->SetInt("spriteSheetHeight", isSpriteSheet ? spriteSheetHeight : 1);
+		expandVS->SetFloat("spriteSheetFrameWidth", isSpriteSheet ? spriteSheetFrameWidth : 1.0f);
+		expandVS->SetFloat("spriteSheetFrameHeight", isSpriteSheet ? spriteSheetFrameHeight : 1.0f);
+		expandVS->CopyAllBufferData();
+		expandVS->SetShaderResourceView("ParticleRecords", recordSRV);
 	}
 
+	// The living particles' quads are all at the start of the buffer
+	context->DrawIndexed(livingParticleCount * 6, 0, 0);
 }
 
 
+// --------------------------------------------------------
+// Simulates a set of emitters (including a few large enough
+// to be split into many jobs) one thread at a time, then
+// twice more with every thread, and checks that every run
+// produces exactly the same particles and sorted quads each
+// frame.  The same emitters are restarted from their seeds
+// before each run, so this also checks that they replay.
+// Nothing is drawn, so this only needs a device to create
+// the emitters' buffers.
+//
+// device - Device for the emitters' buffers
+// frameCount - How many frames to simulate in each run
+// --------------------------------------------------------
+EmitterDeterminismResults Emitter::TestDeterminism(Microsoft::WRL::ComPtr<ID3D11Device> device, int frameCount)
+{
+	EmitterDeterminismResults results = {};
+	results.FrameCount = frameCount;
+	results.FirstMismatchFrame = -1;
+
+	JobSystem serialJobs(1);
+	JobSystem parallelJobs;
+	results.ThreadCount = parallelJobs.GetThreadCount();
+
+	// The same emitters every run
+	std::vector<std::shared_ptr<Emitter>> emitters;
+	emitters.push_back(std::make_shared<Emitter>(160, 30, 5.0f, 0.1f, 4.0f, XMFLOAT4(1, 0.1f, 0.1f, 0.7f), XMFLOAT4(1, 0.6f, 0.1f, 0), XMFLOAT3(-2, 2, 0), XMFLOAT3(0.2f, 0.2f, 0.2f), XMFLOAT3(2, 0, 0), XMFLOAT3(0.1f, 0.1f, 0.1f), XMFLOAT4(-2, 2, -2, 2), XMFLOAT3(0, -1, 0), device, nullptr));
+	emitters.push_back(std::make_shared<Emitter>(250, 100, 2.0f, 2.0f, 0.0f, XMFLOAT4(0.1f, 0.2f, 0.5f, 0.0f), XMFLOAT4(0.1f, 0.1f, 0.3f, 3.0f), XMFLOAT3(0, 0, 0), XMFLOAT3(0.1f, 0, 0.1f), XMFLOAT3(-2.5f, -1, 0), XMFLOAT3(1, 0, 1), XMFLOAT4(0, 0, -3, 3), XMFLOAT3(0, -2, 0), device, nullptr));
+	emitters.push_back(std::make_shared<Emitter>(5, 2, 2.0f, 2.0f, 2.0f, XMFLOAT4(1, 1, 1, 1), XMFLOAT4(1, 1, 1, 0), XMFLOAT3(0, 0, 0), XMFLOAT3(0, 0, 0), XMFLOAT3(2, -2, 0), XMFLOAT3(0, 0, 0), XMFLOAT4(-2, 2, -2, 2), XMFLOAT3(0, 0, 0), device, nullptr, true, 8, 8));
+	emitters.push_back(std::make_shared<Emitter>(100000, 40000, 2.0f, 0.5f, 0.1f, XMFLOAT4(1, 1, 1, 1), XMFLOAT4(0, 0, 1, 0), XMFLOAT3(0, 3, 0), XMFLOAT3(2, 1, 2), XMFLOAT3(0, 0, 0), XMFLOAT3(1, 1, 1), XMFLOAT4(-3, 3, -3, 3), XMFLOAT3(0, -3, 0), device, nullptr));
+	emitters.push_back(std::make_shared<Emitter>(30000, 20000, 1.0f, 1.0f, 3.0f, XMFLOAT4(1, 0, 0, 1), XMFLOAT4(1, 1, 0, 0), XMFLOAT3(1, 0, 0), XMFLOAT3(0.5f, 0.5f, 0.5f), XMFLOAT3(0, 0, 0), XMFLOAT3(0.2f, 0.2f, 0.2f), XMFLOAT4(0, 6, 0, 6), XMFLOAT3(0, 1, 0), device, nullptr, true, 4, 4));
+
+	JobSystem* runJobs[] = { &serialJobs, &parallelJobs, &parallelJobs };
+	std::vector<unsigned long long> firstRunHashes;
+	for (JobSystem* jobs : runJobs)
+	{
+		// Start over from the same seeds every run
+		for (int e = 0; e < (int)emitters.size(); e++)
+			emitters[e]->Restart(e + 1);
+
+		std::vector<std::vector<ParticleVertex>> vertices;
+		std::vector<ParticleVertex*> destinations;
+		for (auto& e : emitters)
+		{
+			vertices.push_back(std::vector<ParticleVertex>(e->maxParticles * 4));
+			destinations.push_back(vertices.back().data());
+		}
+
+		// A camera a little way back, looking down +Z
+		XMFLOAT4X4 view;
+		XMStoreFloat4x4(&view, XMMatrixLookToLH(XMVectorSet(1, 2, -10, 0), XMVectorSet(0, 0, 1, 0), XMVectorSet(0, 1, 0, 0)));
+
+		std::vector<unsigned long long> hashes;
+		for (int f = 0; f < frameCount; f++)
+		{
+			// Uneven frame times, so particles spawn in uneven groups
+			float dt = 1.0f / 60.0f + (f % 7) * 0.002f;
+			UpdateEmitters(emitters, dt, *jobs);
+			SortEmitters(emitters, view, *jobs);
+			BuildEmitterQuads(emitters, destinations, XMFLOAT3(1, 0, 0), XMFLOAT3(0, 1, 0), true, *jobs);
+
+			// FNV-1a over every living particle's quad
+			unsigned long long hash = 14695981039346656037ull;
+			for (int e = 0; e < (int)emitters.size(); e++)
+			{
+				const unsigned char* bytes = (const unsigned char*)destinations[e];
+				size_t byteCount = sizeof(ParticleVertex) * 4 * emitters[e]->livingParticleCount;
+				for (size_t b = 0; b < byteCount; b++)
+					hash = (hash ^ bytes[b]) * 1099511628211ull;
+				hash = (hash ^ (unsigned int)emitters[e]->livingParticleCount) * 1099511628211ull;
+			}
+			hashes.push_back(hash);
+		}
+
+		results.EmitterCount = (int)emitters.size();
+		results.ParticleCount = 0;
+		for (auto& e : emitters)
+			results.ParticleCount += e->livingParticleCount;
+
+		// Compare against the single threaded run
+		if (firstRunHashes.empty())
+		{
+			firstRunHashes = hashes;
+			continue;
+		}
+
+		for (int f = 0; f < frameCount; f++)
+		{
+			if (hashes[f] != firstRunHashes[f])
+			{
+				if (results.FirstMismatchFrame < 0 || f < results.FirstMismatchFrame)
+					results.FirstMismatchFrame = f;
+				break;
+			}
+		}
+	}
+
+	return results;
+}
@@ -4,30 +4,55 @@
 #include <DirectXMath.h>
 #include <wrl/client.h>
 #include <memory>
+#include <vector>
 
 #include "Camera.h"
 #include "Material.h"
 #include "Transform.h"
 #include "SimpleShader.h"
+#include "ParticleData.h"
+#include "ParticleSort.h"
+#include "JobSystem.h"
+#include "RandomStream.h"
 
-struct Particle
+// Most particles a single update or copy job handles - larger
+// emitters are split into several jobs across the ring buffer
+#define PARTICLES_PER_JOB 4096
+
+// Random numbers each new particle needs: a start position,
+// a start velocity and start and end rotations
+#define RANDOMS_PER_PARTICLE 8
+
+struct ParticleVertex
 {
+	DirectX::XMFLOAT3 Position;
+	DirectX::XMFLOAT2 UV;
 	DirectX::XMFLOAT4 Color;
-	DirectX::XMFLOAT3 StartPosition;
+};
+
+// One living particle, for the vertex shader to expand into
+// a quad - 40 bytes instead of four 36 byte vertices
+// Note: This must match ParticleRecord in ParticleExpandVS.hlsl
+struct ParticleRecord
+{
 	DirectX::XMFLOAT3 Position;
-	DirectX::XMFLOAT3 StartVelocity;
 	float Size;
-	float Age;
-	float RotationStart;
-	float RotationEnd;
+	DirectX::XMFLOAT4 Color;
 	float Rotation;
+	float AgePercent;
 };
 
-struct ParticleVertex
+// --------------------------------------------------------
+// Results of simulating the same emitters with different
+// numbers of threads and comparing every frame
+// --------------------------------------------------------
+struct EmitterDeterminismResults
 {
-	DirectX::XMFLOAT3 Position;
-	DirectX::XMFLOAT2 UV;
-	DirectX::XMFLOAT4 Color;
+	int FrameCount;
+	int EmitterCount;
+	int ParticleCount;			// Living particles after the last frame
+	unsigned int ThreadCount;	// Threads used by the parallel runs
+	int FirstMismatchFrame;		// First frame that differed between runs, or -1
 };
 
 class Emitter
@@ -55,22 +80,66 @@ public:
 	);
 	~Emitter();
 
-	void Update(float dt);
 	void Draw(
 		Microsoft::WRL::ComPtr<ID3D11DeviceContext> context, 
 		std::shared_ptr<Camera> camera,
-		bool debugWireframe);
+		bool debugWireframe,
+		std::shared_ptr<SimpleVertexShader> expandVS = 0);
 
 	Transform* GetTransform();
 	std::shared_ptr<Material> GetMaterial();
 	void SetMaterial(std::shared_ptr<Material> material);
 
+	int GetLivingParticleCount();
+	unsigned int GetRandomSeed();
+	void SetRandomSeed(unsigned int seed);
+	void Restart(unsigned int seed);
+
+	// Updating and copying many emitters at once, in parallel
+	static void UpdateEmitters(
+		const std::vector<std::shared_ptr<Emitter>>& emitters,
+		float dt,
+		JobSystem& jobs);
+	static size_t CopyEmittersToGPU(
+		const std::vector<std::shared_ptr<Emitter>>& emitters,
+		Microsoft::WRL::ComPtr<ID3D11DeviceContext> context,
+		std::shared_ptr<Camera> camera,
+		bool expandOnGPU,
+		bool sortBackToFront,
+		JobSystem& jobs);
+	static void SortEmitters(
+		const std::vector<std::shared_ptr<Emitter>>& emitters,
+		DirectX::XMFLOAT4X4 view,
+		JobSystem& jobs);
+	static void BuildEmitterQuads(
+		const std::vector<std::shared_ptr<Emitter>>& emitters,
+		const std::vector<ParticleVertex*>& destinations,
+		DirectX::XMFLOAT3 cameraRight,
+		DirectX::XMFLOAT3 cameraUp,
+		bool sorted,
+		JobSystem& jobs);
+	static void BuildEmitterRecords(
+		const std::vector<std::shared_ptr<Emitter>>& emitters,
+		const std::vector<ParticleRecord*>& destinations,
+		bool sorted,
+		JobSystem& jobs);
+
+	static EmitterDeterminismResults TestDeterminism(
+		Microsoft::WRL::ComPtr<ID3D11Device> device,
+		int frameCount);
+
 private:
 	// Emission properties
 	int particlesPerSecond;
 	float secondsPerParticle;
 	float timeSinceEmit;
 
+	// Each emitter has its own random sequence, so the particles
+	// it spawns don't depend on which thread updated it
+	unsigned int randomSeed;
+	RandomStream random;
+	std::vector<float> spawnRandoms;
+
 	bool isSpriteSheet;
 	int spriteSheetWidth;
 	int spriteSheetHeight;
@@ -94,28 +163,39 @@ private:
 	float startSize;
 	float endSize;
 
-	// Particle array
-	Particle* particles;
+	// Particle arrays
+	ParticleData particles;
 	int maxParticles;
 	int firstDeadIndex;
 	int firstAliveIndex;
 
+	// Per-update state shared by this emitter's jobs
+	ParticleUpdateParams updateParams;
+	std::vector<int> chunkDeaths;
+
+	// Back to front draw order, from the last SortEmitters()
+	ParticleSorter sorter;
+
 	// Rendering
-	ParticleVertex* localParticleVertices;
 	Microsoft::WRL::ComPtr<ID3D11Buffer> vertexBuffer;
 	Microsoft::WRL::ComPtr<ID3D11Buffer> indexBuffer;
+	Microsoft::WRL::ComPtr<ID3D11Buffer> recordBuffer;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> recordSRV;
 
 	// Material & transform
 	Transform transform;
 	std::shared_ptr<Material> material;
 
 	// Update Methods
-	void UpdateSingleParticle(float dt, int index);
-	void SpawnParticle();
+	int GetChunkCount();
+	void BeginUpdate(float dt);
+	void UpdateChunk(int chunk);
+	void FinishUpdate(float dt);
+	void SpawnParticles(int count);
 
 	// Copy methods
-	void CopyParticlesToGPU(Microsoft::WRL::ComPtr<ID3D11DeviceContext> context, std::shared_ptr<Camera> camera);
-	void CopyOneParticle(int index, std::shared_ptr<Camera> camera);
-	DirectX::XMFLOAT3 CalcParticleVertexPosition(int particleIndex, int quadCornerIndex, std::shared_ptr<Camera> camera);
+	void SortByDepth(const float viewZ[4]);
+	void BuildQuads(int chunk, ParticleVertex* vertices, DirectX::FXMVECTOR cameraRight, DirectX::FXMVECTOR cameraUp, const int* order);
+	void BuildRecords(int chunk, ParticleRecord* records, const int* order);
 };
 
@@ -37,7 +37,10 @@ Game::Game(HINSTANCE hInstance)
 		false,				// Sync the framerate to the monitor refresh? (lock framerate)
 		true),				// Show extra stats (fps) in title bar?
 	ambientColor(0, 0, 0), // Ambient is zero'd out since it's not physically-based
-	lightCount(3)
+	lightCount(3),
+	expandParticlesOnGPU(false),
+	particleUploadBytes(0),
+	alphaBlendParticles(false)
 {
 
 #if defined(DEBUG) || defined(_DEBUG)
@@ -242,6 +245,12 @@ void Game::LoadAssetsAndCreateEntities()
 	blend.RenderTarget[0].RenderTargetWriteMask = D3D11_COLOR_WRITE_ENABLE_ALL;
 	device->CreateBlendState(&blend, particleBlendState.GetAddressOf());
 
+	// Blend for particles (regular alpha blending) - only
+	// looks right when particles are drawn back to front
+	blend.RenderTarget[0].DestBlend = D3D11_BLEND_INV_SRC_ALPHA;
+	blend.RenderTarget[0].DestBlendAlpha = D3D11_BLEND_INV_SRC_ALPHA;
+	device->CreateBlendState(&blend, particleAlphaBlendState.GetAddressOf());
+
 	// Debug rasterizer state for particles
 	D3D11_RASTERIZER_DESC rd = {};
 	rd.CullMode = D3D11_CULL_BACK;
@@ -253,6 +262,7 @@ void Game::LoadAssetsAndCreateEntities()
 	// Grab loaded particle resources
 	std::shared_ptr<SimpleVertexShader> particleVS = assets.GetVertexShader(L"ParticleVS");
 	std::shared_ptr<SimplePixelShader> particlePS = assets.GetPixelShader(L"ParticlePS");
+	particleExpandVS = assets.GetVertexShader(L"ParticleExpandVS");
 
 	// Create particle materials
 	std::shared_ptr<Material> fireParticle = std::make_shared<Material>(particlePS, particleVS, XMFLOAT3(1, 1, 1));
@@ -438,11 +448,26 @@ void Game::Update(float deltaTime, float totalTime)
 	static bool firstFrame = true; // Only ever initialized once due to static
 	if (firstFrame) { deltaTime = 0.0f; firstFrame = false; }
 
-	// Update all emitters
+	// Update all emitters, spread across every core
+	Emitter::UpdateEmitters(emitters, deltaTime, jobs);
+
+	// Swap between building quads on the CPU and in the vertex shader
+	if (input.KeyPress('G'))
+		expandParticlesOnGPU = !expandParticlesOnGPU;
+
+	// Swap between additive and (sorted) alpha blending
+	if (input.KeyPress('B'))
+		alphaBlendParticles = !alphaBlendParticles;
+
+	// Report last frame's particle uploads along with the other stats
+	int particleCount = 0;
 	for (auto& e : emitters)
-	{
-		e->Update(deltaTime);
-	}
+		particleCount += e->GetLivingParticleCount();
+	titleBarText =
+		L"DirectX Game    Particles: " + std::to_wstring(particleCount) +
+		L"    Upload: " + std::to_wstring(particleUploadBytes) + L" bytes/frame" +
+		(expandParticlesOnGPU ? L" (GPU quads)" : L" (CPU quads)") +
+		(alphaBlendParticles ? L"    Alpha blended, sorted" : L"    Additive");
 
 	// Handle light count changes, clamped appropriately
 	if (input.KeyDown('R')) lightCount = 3;
@@ -524,13 +549,20 @@ void Game::DrawParticles()
 	{
 
 		// Particle states
-		context->OMSetBlendState(particleBlendState.Get(), 0, 0xffffffff);	// Additive blending
+		context->OMSetBlendState(
+			alphaBlendParticles ? particleAlphaBlendState.Get() : particleBlendState.Get(),
+			0, 0xffffffff);
 		context->OMSetDepthStencilState(particleDepthState.Get(), 0);		// No depth WRITING
 
+		// Copy every emitter's particles once, for both passes below,
+		// sorted back to front if they're being alpha blended
+		particleUploadBytes = Emitter::CopyEmittersToGPU(emitters, context, camera, expandParticlesOnGPU, alphaBlendParticles, jobs);
+		std::shared_ptr<SimpleVertexShader> expandVS = expandParticlesOnGPU ? particleExpandVS : 0;
+
 		// Draw all of the emitters
 		for (auto& e : emitters)
 		{
-			e->Draw(context, camera, false);
+			e->Draw(context, camera, false, expandVS);
 		}
 
 		// Should we also draw them in wireframe?
@@ -539,7 +571,7 @@ void Game::DrawParticles()
 			context->RSSetState(particleDebugRasterState.Get());
 			for (auto& e : emitters)
 			{
-				e->Draw(context, camera, true);
+				e->Draw(context, camera, true, expandVS);
 			}
 		}
 
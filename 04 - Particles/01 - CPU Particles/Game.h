@@ -60,8 +60,20 @@ private:
 	// Particles
 	Microsoft::WRL::ComPtr<ID3D11DepthStencilState> particleDepthState;
 	Microsoft::WRL::ComPtr<ID3D11BlendState> particleBlendState;
+	Microsoft::WRL::ComPtr<ID3D11BlendState> particleAlphaBlendState;
 	Microsoft::WRL::ComPtr<ID3D11RasterizerState> particleDebugRasterState;
 	std::vector<std::shared_ptr<Emitter>> emitters;
+	JobSystem jobs;
 	void DrawParticles();
+
+	// Expanding particle quads in the vertex shader (toggled with G)
+	// and how many bytes of particle data were uploaded last frame
+	bool expandParticlesOnGPU;
+	std::shared_ptr<SimpleVertexShader> particleExpandVS;
+	size_t particleUploadBytes;
+
+	// Alpha blending particles instead of adding them, which
+	// sorts them back to front every frame (toggled with B)
+	bool alphaBlendParticles;
 };
 
@@ -0,0 +1,123 @@
+#include "JobSystem.h"
+
+#include <algorithm>
+
+
+// --------------------------------------------------------
+// Constructor - starts the worker threads
+//
+// threadCount - Total threads working on each batch, including
+//               the one calling Run(). Zero uses one per core.
+// --------------------------------------------------------
+JobSystem::JobSystem(unsigned int threadCount) :
+	job(0),
+	jobCount(0),
+	nextJob(0),
+	batch(0),
+	busyWorkers(0),
+	quit(false)
+{
+	if (threadCount == 0)
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+	for (unsigned int i = 1; i < threadCount; i++)
+		workers.emplace_back(&JobSystem::WorkerLoop, this);
+}
+
+// --------------------------------------------------------
+// Destructor - wakes every worker so they can exit
+// --------------------------------------------------------
+JobSystem::~JobSystem()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	wake.notify_all();
+
+	for (auto& w : workers)
+		w.join();
+}
+
+unsigned int JobSystem::GetThreadCount() const { return (unsigned int)workers.size() + 1; }
+
+
+// --------------------------------------------------------
+// Runs job(0) through job(jobCount - 1) across all threads
+// and returns once every one of them has finished
+// --------------------------------------------------------
+void JobSystem::Run(unsigned int jobCount, const std::function<void(unsigned int)>& job)
+{
+	if (jobCount == 0)
+		return;
+
+	// Not worth waking anyone for a single job
+	if (jobCount == 1 || workers.empty())
+	{
+		for (unsigned int i = 0; i < jobCount; i++)
+			job(i);
+		return;
+	}
+
+	// Publish the batch and wake the workers, once any worker that
+	// woke too late for the last batch has noticed it's over
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		done.wait(lock, [&] { return busyWorkers == 0; });
+		this->job = &job;
+		this->jobCount = jobCount;
+		nextJob = 0;
+		batch++;
+	}
+	wake.notify_all();
+
+	// Help out, then wait for any worker still finishing a job.
+	// Workers that wake up late find nothing left and leave.
+	RunJobs();
+
+	std::unique_lock<std::mutex> lock(mutex);
+	done.wait(lock, [&] { return busyWorkers == 0; });
+	this->job = 0;
+	this->jobCount = 0;
+}
+
+
+// --------------------------------------------------------
+// Takes jobs from the current batch until there are none left
+// --------------------------------------------------------
+void JobSystem::RunJobs()
+{
+	for (unsigned int i = nextJob++; i < jobCount; i = nextJob++)
+		(*job)(i);
+}
+
+
+// --------------------------------------------------------
+// Each worker sleeps until a new batch (or shutdown)
+// --------------------------------------------------------
+void JobSystem::WorkerLoop()
+{
+	unsigned int lastBatch = 0;
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [&] { return quit || batch != lastBatch; });
+			if (quit)
+				return;
+
+			// Counted as busy until it leaves the batch, so
+			// Run() can't start another one underneath it
+			lastBatch = batch;
+			busyWorkers++;
+		}
+
+		RunJobs();
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			busyWorkers--;
+		}
+		done.notify_one();
+	}
+}
@@ -1,6 +1,11 @@
 
 #include <Windows.h>
+#include <stdio.h>
+#include <string.h>
 #include "Game.h"
+#include "ParticleData.h"
+#include "ParticleSort.h"
+#include "RandomStream.h"
 
 // --------------------------------------------------------
 // Entry point for a graphical (non-console) Windows application
@@ -18,6 +23,73 @@ int WINAPI WinMain(
 	_CrtSetDbgFlag( _CRTDBG_ALLOC_MEM_DF | _CRTDBG_LEAK_CHECK_DF );
 #endif
 
+	// "-benchmark" times the scalar and SIMD particle updates against
+	// each other, the radix sort against std::stable_sort, and batched
+	// random numbers against std::mt19937, and prints the results,
+	// without opening a window
+	if (strstr(lpCmdLine, "-benchmark"))
+	{
+		// Print to the console we were launched from, or a new one
+		if (!AttachConsole(ATTACH_PARENT_PROCESS))
+			AllocConsole();
+		FILE* stream;
+		freopen_s(&stream, "CONOUT$", "w", stdout);
+
+		ParticleBenchmarkResults results = ParticleData::Benchmark(1000000, 100);
+		printf("\nParticle update: %d particles, %d frames\n", results.ParticleCount, results.FrameCount);
+		printf("  Scalar: %.3f ns/particle\n", results.ScalarNsPerParticle);
+		printf("  SIMD:   %.3f ns/particle (%.2fx)\n", results.SIMDNsPerParticle, results.ScalarNsPerParticle / results.SIMDNsPerParticle);
+		printf("  Largest difference: %g\n", results.MaxDifference);
+
+		// Back to front sorting, from 100k to 1M particles
+		int sortCounts[] = { 100000, 250000, 500000, 1000000 };
+		printf("\nBack to front sort (radix vs std::stable_sort):\n");
+		for (int count : sortCounts)
+		{
+			ParticleSortBenchmarkResults sortResults = ParticleSorter::Benchmark(count, 20);
+			printf("  %7d particles: %.3f vs %.3f ns/particle (%.2fx)%s\n",
+				sortResults.ParticleCount,
+				sortResults.RadixNsPerParticle,
+				sortResults.StdSortNsPerParticle,
+				sortResults.StdSortNsPerParticle / sortResults.RadixNsPerParticle,
+				sortResults.OrdersMatch ? "" : " MISMATCH");
+		}
+
+		RandomBenchmarkResults randomResults = RandomStream::Benchmark(10000000);
+		printf("\nRandom floats: %d numbers\n", randomResults.Count);
+		printf("  RandomStream batch: %.3f ns/number\n", randomResults.StreamNsPerNumber);
+		printf("  std::mt19937:       %.3f ns/number (%.2fx)\n", randomResults.MersenneNsPerNumber, randomResults.MersenneNsPerNumber / randomResults.StreamNsPerNumber);
+		return 0;
+	}
+
+	// "-determinism" runs the emitters with one thread and with every
+	// thread, and checks they match - no window, but it needs a device
+	if (strstr(lpCmdLine, "-determinism"))
+	{
+		if (!AttachConsole(ATTACH_PARENT_PROCESS))
+			AllocConsole();
+		FILE* stream;
+		freopen_s(&stream, "CONOUT$", "w", stdout);
+
+		// Any device will do, as nothing is drawn
+		Microsoft::WRL::ComPtr<ID3D11Device> device;
+		HRESULT hr = D3D11CreateDevice(0, D3D_DRIVER_TYPE_HARDWARE, 0, 0, 0, 0, D3D11_SDK_VERSION, device.GetAddressOf(), 0, 0);
+		if (FAILED(hr))
+			hr = D3D11CreateDevice(0, D3D_DRIVER_TYPE_WARP, 0, 0, 0, 0, D3D11_SDK_VERSION, device.GetAddressOf(), 0, 0);
+		if (FAILED(hr))
+		{
+			printf("\nUnable to create a device\n");
+			return hr;
+		}
+
+		EmitterDeterminismResults results = Emitter::TestDeterminism(device, 600);
+		printf("\nEmitter determinism: %d emitters, %d frames, %d particles at the end\n", results.EmitterCount, results.FrameCount, results.ParticleCount);
+		printf("  1 thread vs %u threads: %s", results.ThreadCount, results.FirstMismatchFrame < 0 ? "identical\n" : "MISMATCH");
+		if (results.FirstMismatchFrame >= 0)
+			printf(" (first at frame %d)\n", results.FirstMismatchFrame);
+		return results.FirstMismatchFrame < 0 ? 0 : 1;
+	}
+
 	// Create the Game object using
 	// the app handle we got from WinMain
 	Game dxGame(hInstance);
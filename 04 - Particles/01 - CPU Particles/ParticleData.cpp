@@ -0,0 +1,291 @@
+#include "ParticleData.h"
+
+#include <xmmintrin.h>
+#include <emmintrin.h>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+
+// Total number of per-particle arrays
+#define PARTICLE_STREAM_COUNT 18
+
+// Number of bits set in each 4-bit SSE movemask
+static const int MaskBitCounts[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+
+
+// --------------------------------------------------------
+// Constructor - allocates every array as one aligned block,
+// with all particles zeroed
+// --------------------------------------------------------
+ParticleData::ParticleData(int capacity) :
+	capacity(capacity)
+{
+	// Pad each array to a multiple of four floats so they all stay aligned
+	size_t stride = ((size_t)capacity + 3) & ~(size_t)3;
+	memory = (float*)_mm_malloc(sizeof(float) * stride * PARTICLE_STREAM_COUNT, 16);
+	memset(memory, 0, sizeof(float) * stride * PARTICLE_STREAM_COUNT);
+
+	float** streams[PARTICLE_STREAM_COUNT] =
+	{
+		&Age,
+		&StartPositionX, &StartPositionY, &StartPositionZ,
+		&StartVelocityX, &StartVelocityY, &StartVelocityZ,
+		&RotationStart, &RotationEnd,
+		&PositionX, &PositionY, &PositionZ,
+		&ColorR, &ColorG, &ColorB, &ColorA,
+		&Size, &Rotation
+	};
+	for (int i = 0; i < PARTICLE_STREAM_COUNT; i++)
+		*streams[i] = memory + stride * i;
+}
+
+ParticleData::~ParticleData()
+{
+	_mm_free(memory);
+}
+
+int ParticleData::GetCapacity() const { return capacity; }
+
+
+// --------------------------------------------------------
+// Ages a span of particles and works out their color, size,
+// rotation and position one particle at a time.  This is
+// the reference for UpdateSIMD() and handles its leftovers.
+//
+// first - Index of the first particle to update
+// count - How many particles to update
+// params - Values shared by all of the particles
+//
+// Returns how many of the particles died
+// --------------------------------------------------------
+int ParticleData::UpdateScalar(int first, int count, const ParticleUpdateParams& params)
+{
+	float invLifetime = 1.0f / params.Lifetime;
+	float halfAccelX = params.Acceleration[0] * 0.5f;
+	float halfAccelY = params.Acceleration[1] * 0.5f;
+	float halfAccelZ = params.Acceleration[2] * 0.5f;
+
+	int died = 0;
+	for (int i = first; i < first + count; i++)
+	{
+		float t = Age[i] + params.DeltaTime;
+		Age[i] = t;
+		died += t >= params.Lifetime;
+
+		// Everything else is a lerp based on age
+		float agePercent = t * invLifetime;
+		ColorR[i] = params.StartColor[0] + agePercent * (params.EndColor[0] - params.StartColor[0]);
+		ColorG[i] = params.StartColor[1] + agePercent * (params.EndColor[1] - params.StartColor[1]);
+		ColorB[i] = params.StartColor[2] + agePercent * (params.EndColor[2] - params.StartColor[2]);
+		ColorA[i] = params.StartColor[3] + agePercent * (params.EndColor[3] - params.StartColor[3]);
+		Size[i] = params.StartSize + agePercent * (params.EndSize - params.StartSize);
+		Rotation[i] = RotationStart[i] + agePercent * (RotationEnd[i] - RotationStart[i]);
+
+		// Constant acceleration: a * t^2 / 2 + v * t + p
+		PositionX[i] = (halfAccelX * t + StartVelocityX[i]) * t + StartPositionX[i];
+		PositionY[i] = (halfAccelY * t + StartVelocityY[i]) * t + StartPositionY[i];
+		PositionZ[i] = (halfAccelZ * t + StartVelocityZ[i]) * t + StartPositionZ[i];
+	}
+
+	return died;
+}
+
+
+// --------------------------------------------------------
+// Same as UpdateScalar(), but four particles at a time with
+// SSE.  Particles before the first aligned group of four,
+// and any after the last, are handed to UpdateScalar().
+//
+// first - Index of the first particle to update
+// count - How many particles to update
+// params - Values shared by all of the particles
+//
+// Returns how many of the particles died
+// --------------------------------------------------------
+int ParticleData::UpdateSIMD(int first, int count, const ParticleUpdateParams& params)
+{
+	int end = first + count;
+	int alignedFirst = std::min((first + 3) & ~3, end);
+	int alignedEnd = std::max(end & ~3, alignedFirst);
+
+	// Leftovers at either end
+	int died = UpdateScalar(first, alignedFirst - first, params);
+	died += UpdateScalar(alignedEnd, end - alignedEnd, params);
+
+	// Shared values, in every lane
+	__m128 dt = _mm_set1_ps(params.DeltaTime);
+	__m128 lifetime = _mm_set1_ps(params.Lifetime);
+	__m128 invLifetime = _mm_set1_ps(1.0f / params.Lifetime);
+	__m128 startR = _mm_set1_ps(params.StartColor[0]);
+	__m128 startG = _mm_set1_ps(params.StartColor[1]);
+	__m128 startB = _mm_set1_ps(params.StartColor[2]);
+	__m128 startA = _mm_set1_ps(params.StartColor[3]);
+	__m128 deltaR = _mm_set1_ps(params.EndColor[0] - params.StartColor[0]);
+	__m128 deltaG = _mm_set1_ps(params.EndColor[1] - params.StartColor[1]);
+	__m128 deltaB = _mm_set1_ps(params.EndColor[2] - params.StartColor[2]);
+	__m128 deltaA = _mm_set1_ps(params.EndColor[3] - params.StartColor[3]);
+	__m128 startSize = _mm_set1_ps(params.StartSize);
+	__m128 deltaSize = _mm_set1_ps(params.EndSize - params.StartSize);
+	__m128 halfAccelX = _mm_set1_ps(params.Acceleration[0] * 0.5f);
+	__m128 halfAccelY = _mm_set1_ps(params.Acceleration[1] * 0.5f);
+	__m128 halfAccelZ = _mm_set1_ps(params.Acceleration[2] * 0.5f);
+
+	for (int i = alignedFirst; i < alignedEnd; i += 4)
+	{
+		__m128 t = _mm_add_ps(_mm_load_ps(Age + i), dt);
+		_mm_store_ps(Age + i, t);
+		died += MaskBitCounts[_mm_movemask_ps(_mm_cmpge_ps(t, lifetime))];
+
+		// Everything else is a lerp based on age
+		__m128 agePercent = _mm_mul_ps(t, invLifetime);
+		_mm_store_ps(ColorR + i, _mm_add_ps(startR, _mm_mul_ps(agePercent, deltaR)));
+		_mm_store_ps(ColorG + i, _mm_add_ps(startG, _mm_mul_ps(agePercent, deltaG)));
+		_mm_store_ps(ColorB + i, _mm_add_ps(startB, _mm_mul_ps(agePercent, deltaB)));
+		_mm_store_ps(ColorA + i, _mm_add_ps(startA, _mm_mul_ps(agePercent, deltaA)));
+		_mm_store_ps(Size + i, _mm_add_ps(startSize, _mm_mul_ps(agePercent, deltaSize)));
+
+		__m128 rotStart = _mm_load_ps(RotationStart + i);
+		__m128 rotEnd = _mm_load_ps(RotationEnd + i);
+		_mm_store_ps(Rotation + i, _mm_add_ps(rotStart, _mm_mul_ps(agePercent, _mm_sub_ps(rotEnd, rotStart))));
+
+		// Constant acceleration: a * t^2 / 2 + v * t + p
+		__m128 x = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(halfAccelX, t), _mm_load_ps(StartVelocityX + i)), t);
+		__m128 y = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(halfAccelY, t), _mm_load_ps(StartVelocityY + i)), t);
+		__m128 z = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(halfAccelZ, t), _mm_load_ps(StartVelocityZ + i)), t);
+		_mm_store_ps(PositionX + i, _mm_add_ps(x, _mm_load_ps(StartPositionX + i)));
+		_mm_store_ps(PositionY + i, _mm_add_ps(y, _mm_load_ps(StartPositionY + i)));
+		_mm_store_ps(PositionZ + i, _mm_add_ps(z, _mm_load_ps(StartPositionZ + i)));
+	}
+
+	return died;
+}
+
+
+// --------------------------------------------------------
+// Turns a view space depth into a sort key where farther
+// particles get smaller keys.  Flipping every bit of a
+// negative float, or just the sign bit of a positive one,
+// gives a uint that sorts like the float.  Flipping all of
+// that again reverses the order, which leaves a positive
+// float with everything but its sign bit flipped, and a
+// negative one unchanged.
+// --------------------------------------------------------
+static inline unsigned int DepthToBackToFrontKey(float depth)
+{
+	unsigned int bits;
+	memcpy(&bits, &depth, sizeof(bits));
+	return bits ^ ((bits & 0x80000000) ? 0 : 0x7FFFFFFF);
+}
+
+// --------------------------------------------------------
+// Makes a sort key for a span of particles so that sorting
+// the keys in ascending order draws them back to front.
+// Works four particles at a time with SSE, like UpdateSIMD().
+//
+// first - Index of the first particle
+// count - How many particles
+// viewZ - Third column of the world * view matrix, so that
+//         depth = x * [0] + y * [1] + z * [2] + [3]
+// keys - Where to write each particle's key (need not be aligned)
+// --------------------------------------------------------
+void ParticleData::BackToFrontKeys(int first, int count, const float viewZ[4], unsigned int* keys) const
+{
+	int end = first + count;
+	int alignedFirst = std::min((first + 3) & ~3, end);
+	int alignedEnd = std::max(end & ~3, alignedFirst);
+
+	// Leftovers at either end, one at a time
+	for (int i = first; i < alignedFirst; i++)
+		keys[i - first] = DepthToBackToFrontKey(PositionX[i] * viewZ[0] + PositionY[i] * viewZ[1] + PositionZ[i] * viewZ[2] + viewZ[3]);
+	for (int i = alignedEnd; i < end; i++)
+		keys[i - first] = DepthToBackToFrontKey(PositionX[i] * viewZ[0] + PositionY[i] * viewZ[1] + PositionZ[i] * viewZ[2] + viewZ[3]);
+
+	__m128 zx = _mm_set1_ps(viewZ[0]);
+	__m128 zy = _mm_set1_ps(viewZ[1]);
+	__m128 zz = _mm_set1_ps(viewZ[2]);
+	__m128 zw = _mm_set1_ps(viewZ[3]);
+	__m128i magnitudeBits = _mm_set1_epi32(0x7FFFFFFF);
+
+	for (int i = alignedFirst; i < alignedEnd; i += 4)
+	{
+		// Same order of operations as the leftovers above
+		__m128 depth = _mm_add_ps(_mm_add_ps(_mm_add_ps(
+			_mm_mul_ps(_mm_load_ps(PositionX + i), zx),
+			_mm_mul_ps(_mm_load_ps(PositionY + i), zy)),
+			_mm_mul_ps(_mm_load_ps(PositionZ + i), zz)),
+			zw);
+
+		// All ones for negative depths, so they're left alone
+		__m128i bits = _mm_castps_si128(depth);
+		__m128i negative = _mm_srai_epi32(bits, 31);
+		__m128i key = _mm_xor_si128(bits, _mm_andnot_si128(negative, magnitudeBits));
+		_mm_storeu_si128((__m128i*)(keys + i - first), key);
+	}
+}
+
+
+// --------------------------------------------------------
+// Times the scalar and SIMD updates on two identical sets
+// of particles and checks that they end up the same.  Ages
+// start spread across the lifetime and the lifetime is long
+// enough that nothing dies, so both do the same work.
+//
+// particleCount - How many particles to update
+// frameCount - How many updates to time for each version
+// --------------------------------------------------------
+ParticleBenchmarkResults ParticleData::Benchmark(int particleCount, int frameCount)
+{
+	ParticleUpdateParams params = {};
+	params.DeltaTime = 1.0f / 60.0f;
+	params.Lifetime = 1000.0f;
+	params.StartColor[0] = 1.0f; params.StartColor[1] = 0.1f; params.StartColor[2] = 0.1f; params.StartColor[3] = 0.7f;
+	params.EndColor[0] = 1.0f; params.EndColor[1] = 0.6f; params.EndColor[2] = 0.1f; params.EndColor[3] = 0.0f;
+	params.StartSize = 0.1f;
+	params.EndSize = 4.0f;
+	params.Acceleration[1] = -1.0f;
+
+	ParticleData scalar(particleCount);
+	ParticleData simd(particleCount);
+	srand(0);
+	for (int i = 0; i < particleCount; i++)
+	{
+		float* scalarValues[] = { scalar.Age, scalar.StartPositionX, scalar.StartPositionY, scalar.StartPositionZ, scalar.StartVelocityX, scalar.StartVelocityY, scalar.StartVelocityZ, scalar.RotationStart, scalar.RotationEnd };
+		float* simdValues[] = { simd.Age, simd.StartPositionX, simd.StartPositionY, simd.StartPositionZ, simd.StartVelocityX, simd.StartVelocityY, simd.StartVelocityZ, simd.RotationStart, simd.RotationEnd };
+		for (int s = 0; s < 9; s++)
+		{
+			float value = (float)rand() / RAND_MAX * 2 - 1;
+			scalarValues[s][i] = value;
+			simdValues[s][i] = value;
+		}
+		scalar.Age[i] = simd.Age[i] = (float)rand() / RAND_MAX * 10.0f;
+	}
+
+	// Time each version over the same number of frames
+	auto start = std::chrono::high_resolution_clock::now();
+	for (int f = 0; f < frameCount; f++)
+		scalar.UpdateScalar(0, particleCount, params);
+	auto middle = std::chrono::high_resolution_clock::now();
+	for (int f = 0; f < frameCount; f++)
+		simd.UpdateSIMD(0, particleCount, params);
+	auto end = std::chrono::high_resolution_clock::now();
+
+	double totalParticles = (double)particleCount * frameCount;
+	ParticleBenchmarkResults results = {};
+	results.ParticleCount = particleCount;
+	results.FrameCount = frameCount;
+	results.ScalarNsPerParticle = std::chrono::duration<double, std::nano>(middle - start).count() / totalParticles;
+	results.SIMDNsPerParticle = std::chrono::duration<double, std::nano>(end - middle).count() / totalParticles;
+
+	// Compare every output
+	float* scalarResults[] = { scalar.Age, scalar.PositionX, scalar.PositionY, scalar.PositionZ, scalar.ColorR, scalar.ColorG, scalar.ColorB, scalar.ColorA, scalar.Size, scalar.Rotation };
+	float* simdResults[] = { simd.Age, simd.PositionX, simd.PositionY, simd.PositionZ, simd.ColorR, simd.ColorG, simd.ColorB, simd.ColorA, simd.Size, simd.Rotation };
+	for (int s = 0; s < 10; s++)
+	{
+		for (int i = 0; i < particleCount; i++)
+			results.MaxDifference = std::max(results.MaxDifference, std::abs(scalarResults[s][i] - simdResults[s][i]));
+	}
+
+	return results;
+}
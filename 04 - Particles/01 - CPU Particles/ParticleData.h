@@ -0,0 +1,88 @@
+#pragma once
+
+// --------------------------------------------------------
+// Everything a particle update needs that's the same for
+// every particle in an emitter
+// --------------------------------------------------------
+struct ParticleUpdateParams
+{
+	float DeltaTime;
+	float Lifetime;
+	float StartColor[4];
+	float EndColor[4];
+	float StartSize;
+	float EndSize;
+	float Acceleration[3];
+};
+
+// --------------------------------------------------------
+// Results of timing the scalar and SIMD updates against
+// each other on the same particles
+// --------------------------------------------------------
+struct ParticleBenchmarkResults
+{
+	int ParticleCount;
+	int FrameCount;
+	double ScalarNsPerParticle;
+	double SIMDNsPerParticle;
+	float MaxDifference;	// Largest difference between the two results (should be ~0)
+};
+
+// --------------------------------------------------------
+// Particle storage as a structure of arrays: each value
+// has its own array, so an update can load, process and
+// store four particles at a time with SSE.  Every array
+// is 16-byte aligned and padded to a multiple of four.
+//
+// Particles live in a ring buffer owned by the emitter.
+// The update functions process one contiguous span of it
+// and return how many of those particles died, without
+// branching per particle.  As every particle in an emitter
+// has the same lifetime, particles always die in the order
+// they were spawned, so the dead ones are always at the
+// front of the ring and the emitter just advances past them.
+// --------------------------------------------------------
+class ParticleData
+{
+public:
+	ParticleData(int capacity);
+	~ParticleData();
+
+	ParticleData(const ParticleData&) = delete;
+	void operator=(const ParticleData&) = delete;
+
+	int GetCapacity() const;
+
+	int UpdateScalar(int first, int count, const ParticleUpdateParams& params);
+	int UpdateSIMD(int first, int count, const ParticleUpdateParams& params);
+
+	void BackToFrontKeys(int first, int count, const float viewZ[4], unsigned int* keys) const;
+
+	static ParticleBenchmarkResults Benchmark(int particleCount, int frameCount);
+
+	// Per-particle values
+	float* Age;
+	float* StartPositionX;
+	float* StartPositionY;
+	float* StartPositionZ;
+	float* StartVelocityX;
+	float* StartVelocityY;
+	float* StartVelocityZ;
+	float* RotationStart;
+	float* RotationEnd;
+
+	// Results of the update
+	float* PositionX;
+	float* PositionY;
+	float* PositionZ;
+	float* ColorR;
+	float* ColorG;
+	float* ColorB;
+	float* ColorA;
+	float* Size;
+	float* Rotation;
+
+private:
+	int capacity;
+	float* memory;
+};
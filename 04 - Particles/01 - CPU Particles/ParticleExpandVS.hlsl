@@ -0,0 +1,89 @@
+
+#include "ShaderStructs.hlsli"
+
+// Constant buffer for C++ data being passed in
+cbuffer externalData : register(b0)
+{
+	matrix world;
+	matrix view;
+	matrix projection;
+
+	int spriteSheetWidth;
+	int spriteSheetHeight;
+	float spriteSheetFrameWidth;
+	float spriteSheetFrameHeight;
+};
+
+// One living particle, already simulated on the CPU
+// - Must match the ParticleRecord struct in Emitter.h
+struct ParticleRecord
+{
+	float3 Position;
+	float Size;
+	float4 Color;
+	float Rotation;
+	float AgePercent;
+};
+
+// Every living particle, oldest first
+StructuredBuffer<ParticleRecord> ParticleRecords : register(t0);
+
+
+// The entry point for our vertex shader - there's no vertex
+// buffer, so each particle's quad is built from the vertex ID
+VertexToPixel_Particle main(uint id : SV_VertexID)
+{
+	// Set up output
+	VertexToPixel_Particle output;
+
+	// Get id info
+	uint particleID = id / 4; // Every group of 4 verts are ONE particle!
+	uint cornerID = id % 4; // 0,1,2,3 = the corner of the particle "quad"
+	ParticleRecord p = ParticleRecords.Load(particleID);
+
+	// Offsets for the 4 corners of a quad, matching the
+	// default UVs on the C++ side (TL, TR, BR, BL)
+	float2 offsets[4];
+	offsets[0] = float2(-1.0f, +1.0f);
+	offsets[1] = float2(+1.0f, +1.0f);
+	offsets[2] = float2(+1.0f, -1.0f);
+	offsets[3] = float2(-1.0f, -1.0f);
+
+	// Rotate this corner around Z and apply size
+	float s, c;
+	sincos(p.Rotation, s, c);
+	float2 offset = offsets[cornerID];
+	float2 rotatedOffset = float2(
+		offset.x * c - offset.y * s,
+		offset.x * s + offset.y * c) * p.Size;
+
+	// Billboarding!
+	// Offset the position based on the camera's right and up vectors
+	float3 pos = p.Position;
+	pos += float3(view._11, view._12, view._13) * rotatedOffset.x; // RIGHT
+	pos += float3(view._21, view._22, view._23) * rotatedOffset.y; // UP
+
+	// Calculate output position
+	matrix wvp = mul(projection, mul(view, world));
+	output.screenPosition = mul(wvp, float4(pos, 1.0f));
+
+	// Sprite sheet frame based on age - a regular texture is
+	// treated as a sprite sheet with exactly one frame
+	uint ssIndex = (uint)floor(p.AgePercent * (spriteSheetWidth * spriteSheetHeight));
+	uint uIndex = ssIndex % spriteSheetWidth;
+	uint vIndex = ssIndex / spriteSheetWidth; // Integer division is important here!
+	float u = uIndex / (float)spriteSheetWidth;
+	float v = vIndex / (float)spriteSheetHeight;
+
+	float2 uvs[4];
+	/* TL */ uvs[0] = float2(u, v);
+	/* TR */ uvs[1] = float2(u + spriteSheetFrameWidth, v);
+	/* BR */ uvs[2] = float2(u + spriteSheetFrameWidth, v + spriteSheetFrameHeight);
+	/* BL */ uvs[3] = float2(u, v + spriteSheetFrameHeight);
+
+	// Pass other data through
+	output.uv = uvs[cornerID];
+	output.color = p.Color;
+
+	return output;
+}
@@ -0,0 +1,170 @@
+#include "ParticleSort.h"
+#include "ParticleData.h"
+
+#include <cstring>
+#include <cstdlib>
+#include <chrono>
+#include <algorithm>
+#include <numeric>
+
+
+ParticleSorter::ParticleSorter() :
+	sortedOrder(0)
+{
+}
+
+// --------------------------------------------------------
+// Makes room for the given number of keys and returns them
+// for the caller to fill in before calling Sort()
+// --------------------------------------------------------
+unsigned int* ParticleSorter::GetKeys(int count)
+{
+	if ((int)keys.size() < count)
+	{
+		keys.resize(count);
+		tempKeys.resize(count);
+		order.resize(count);
+		tempOrder.resize(count);
+	}
+
+	return keys.data();
+}
+
+// --------------------------------------------------------
+// The result of the last Sort(): the offset (from the oldest
+// living particle) of each particle, in ascending key order
+// --------------------------------------------------------
+const int* ParticleSorter::GetOrder() const { return sortedOrder; }
+
+
+// --------------------------------------------------------
+// Sorts the first count keys from GetKeys() in ascending
+// order.  The keys themselves are scrambled afterwards.
+// --------------------------------------------------------
+void ParticleSorter::Sort(int count)
+{
+	// Count every digit of every key in one pass
+	unsigned int histograms[4][256] = {};
+	for (int i = 0; i < count; i++)
+	{
+		unsigned int key = keys[i];
+		histograms[0][key & 0xFF]++;
+		histograms[1][(key >> 8) & 0xFF]++;
+		histograms[2][(key >> 16) & 0xFF]++;
+		histograms[3][key >> 24]++;
+	}
+
+	// The first pass that runs reads the particles in ring
+	// order, so there's no order to read from yet
+	unsigned int* srcKeys = keys.data();
+	unsigned int* dstKeys = tempKeys.data();
+	const int* srcOrder = 0;
+	int* dstOrder = order.data();
+
+	for (int pass = 0; pass < 4; pass++)
+	{
+		int shift = pass * 8;
+		const unsigned int* histogram = histograms[pass];
+
+		// Nothing to do if every key has the same digit
+		if (count == 0 || histogram[(srcKeys[0] >> shift) & 0xFF] == (unsigned int)count)
+			continue;
+
+		// Where each digit's particles start
+		unsigned int offsets[256];
+		unsigned int total = 0;
+		for (int d = 0; d < 256; d++)
+		{
+			offsets[d] = total;
+			total += histogram[d];
+		}
+
+		// Scatter, keeping equal digits in the same order; the
+		// keys aren't needed again after the last pass
+		bool lastPass = pass == 3;
+		for (int i = 0; i < count; i++)
+		{
+			unsigned int key = srcKeys[i];
+			unsigned int position = offsets[(key >> shift) & 0xFF]++;
+			if (!lastPass)
+				dstKeys[position] = key;
+			dstOrder[position] = srcOrder ? srcOrder[i] : i;
+		}
+
+		std::swap(srcKeys, dstKeys);
+		srcOrder = dstOrder;
+		dstOrder = dstOrder == order.data() ? tempOrder.data() : order.data();
+	}
+
+	// Already sorted (or empty), so it's just the ring order
+	if (!srcOrder)
+	{
+		std::iota(order.begin(), order.begin() + count, 0);
+		srcOrder = order.data();
+	}
+
+	sortedOrder = srcOrder;
+}
+
+
+// --------------------------------------------------------
+// Times the radix sort against std::stable_sort, sorting
+// the same keys each frame, and checks they end up in the
+// same order.  The keys are made the way the emitters make
+// them: back to front, from random positions in front of
+// a camera at the origin.
+//
+// particleCount - How many particles to sort
+// frameCount - How many sorts to time for each version
+// --------------------------------------------------------
+ParticleSortBenchmarkResults ParticleSorter::Benchmark(int particleCount, int frameCount)
+{
+	// Random positions, like a large cloud of particles
+	ParticleData particles(particleCount);
+	srand(0);
+	for (int i = 0; i < particleCount; i++)
+	{
+		particles.PositionX[i] = (float)rand() / RAND_MAX * 20.0f - 10.0f;
+		particles.PositionY[i] = (float)rand() / RAND_MAX * 20.0f - 10.0f;
+		particles.PositionZ[i] = (float)rand() / RAND_MAX * 40.0f;
+	}
+
+	// Looking down +Z from the origin
+	const float viewZ[4] = { 0, 0, 1, 0 };
+	std::vector<unsigned int> sourceKeys(particleCount);
+	particles.BackToFrontKeys(0, particleCount, viewZ, sourceKeys.data());
+
+	// Time each version over the same number of frames,
+	// starting from the unsorted keys every time
+	ParticleSorter sorter;
+	auto start = std::chrono::high_resolution_clock::now();
+	for (int f = 0; f < frameCount; f++)
+	{
+		memcpy(sorter.GetKeys(particleCount), sourceKeys.data(), sizeof(unsigned int) * particleCount);
+		sorter.Sort(particleCount);
+	}
+	auto middle = std::chrono::high_resolution_clock::now();
+	std::vector<int> stdOrder(particleCount);
+	for (int f = 0; f < frameCount; f++)
+	{
+		std::iota(stdOrder.begin(), stdOrder.end(), 0);
+		std::stable_sort(stdOrder.begin(), stdOrder.end(),
+			[&](int a, int b) { return sourceKeys[a] < sourceKeys[b]; });
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+
+	double totalParticles = (double)particleCount * frameCount;
+	ParticleSortBenchmarkResults results = {};
+	results.ParticleCount = particleCount;
+	results.FrameCount = frameCount;
+	results.RadixNsPerParticle = std::chrono::duration<double, std::nano>(middle - start).count() / totalParticles;
+	results.StdSortNsPerParticle = std::chrono::duration<double, std::nano>(end - middle).count() / totalParticles;
+
+	// Both are stable, so they should agree exactly
+	const int* radixOrder = sorter.GetOrder();
+	results.OrdersMatch = true;
+	for (int i = 0; i < particleCount; i++)
+		results.OrdersMatch &= radixOrder[i] == stdOrder[i];
+
+	return results;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <vector>
+
+// --------------------------------------------------------
+// Results of timing the radix sort against std::stable_sort
+// on the same keys
+// --------------------------------------------------------
+struct ParticleSortBenchmarkResults
+{
+	int ParticleCount;
+	int FrameCount;
+	double RadixNsPerParticle;
+	double StdSortNsPerParticle;
+	bool OrdersMatch;	// Did both sorts produce exactly the same order?
+};
+
+// --------------------------------------------------------
+// Sorts one emitter's living particles by a 32-bit key, for
+// drawing alpha-blended particles back to front.
+//
+// The keys are filled in by the caller (see
+// ParticleData::BackToFrontKeys()), then sorted with an LSD
+// radix sort: four passes of 8 bits each, with all four
+// histograms counted in a single pass over the keys.  A pass
+// is skipped when every key has the same digit, which is
+// common for the top byte when particles are near each other.
+// The sort is stable, so equal keys keep their ring order.
+//
+// The result is the order to draw the particles in, as
+// offsets from the emitter's oldest living particle.  The
+// buffers are kept between frames, so sorting doesn't
+// allocate once they've grown to fit the emitter.
+// --------------------------------------------------------
+class ParticleSorter
+{
+public:
+	ParticleSorter();
+
+	unsigned int* GetKeys(int count);
+	void Sort(int count);
+	const int* GetOrder() const;
+
+	static ParticleSortBenchmarkResults Benchmark(int particleCount, int frameCount);
+
+private:
+	std::vector<unsigned int> keys;
+	std::vector<unsigned int> tempKeys;
+	std::vector<int> order;
+	std::vector<int> tempOrder;
+	const int* sortedOrder;
+};
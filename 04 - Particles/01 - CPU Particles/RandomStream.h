@@ -0,0 +1,52 @@
+#pragma once
+
+// --------------------------------------------------------
+// Results of timing batches of random floats against
+// std::mt19937 making the same number one at a time
+// --------------------------------------------------------
+struct RandomBenchmarkResults
+{
+	int Count;
+	double StreamNsPerNumber;
+	double MersenneNsPerNumber;
+};
+
+// --------------------------------------------------------
+// A small, fast, seedable random number generator: four
+// xoshiro128+ generators side by side, stepped together
+// with SSE2 so each step makes four numbers at once.
+//
+// The stream is the four generators' results interleaved,
+// and stays the same whether numbers are taken one at a
+// time or in batches, so the same seed always replays
+// exactly the same sequence.  There's no shared state, so
+// every emitter can own one and use it on any thread.
+//
+// Only the top 24 bits of each result become a float, as
+// the lowest bits of xoshiro128+ are its weakest.
+// --------------------------------------------------------
+class RandomStream
+{
+public:
+	RandomStream(unsigned long long seed = 1);
+
+	void Seed(unsigned long long seed);
+
+	unsigned int NextUInt();
+	float NextFloat();
+	float NextFloat(float min, float max);
+	void NextFloats(float* values, int count);
+
+	static RandomBenchmarkResults Benchmark(int count);
+
+private:
+	// Each word of state for all four generators, so a word
+	// is one SSE register - state[word][generator]
+	unsigned int state[4][4];
+
+	// Results of the last step not handed out yet
+	unsigned int results[4];
+	int nextResult;
+
+	void Step();
+};
@@ -2,6 +2,10 @@
 
 using namespace DirectX;
 
+// Each new emitter gets the next seed, so a scene built
+// in the same order always gets the same particles
+static unsigned int nextRandomSeed = 1;
+
 Emitter::Emitter(
 	Microsoft::WRL::ComPtr<ID3D11Device> device,
 	std::shared_ptr<Material> material,
@@ -55,6 +59,9 @@ Emitter::Emitter(
 	livingParticleCount = 0;
 	indexFirstAlive = 0;
 	indexFirstDead = 0;
+	updateTime = 0.0f;
+
+	SetRandomSeed(nextRandomSeed++);
 
 	this->transform.SetPosition(emitterPosition);
 
@@ -71,6 +78,31 @@ Emitter::~Emitter()
 Transform* Emitter::GetTransform() { return &transform; }
 std::shared_ptr<Material> Emitter::GetMaterial() { return material; }
 void Emitter::SetMaterial(std::shared_ptr<Material> material) { this->material = material; }
+int Emitter::GetLivingParticleCount() { return livingParticleCount; }
+unsigned int Emitter::GetRandomSeed() { return randomSeed; }
+
+// --------------------------------------------------------
+// Restarts this emitter's random sequence from the given seed
+// --------------------------------------------------------
+void Emitter::SetRandomSeed(unsigned int seed)
+{
+	randomSeed = seed;
+	random.Seed(seed);
+}
+
+// --------------------------------------------------------
+// Kills every particle and restarts the random sequence, so
+// the same frame times from here replay exactly the same
+// particles as the last time this seed was used
+// --------------------------------------------------------
+void Emitter::Restart(unsigned int seed)
+{
+	timeSinceLastEmit = 0.0f;
+	livingParticleCount = 0;
+	indexFirstAlive = 0;
+	indexFirstDead = 0;
+	SetRandomSeed(seed);
+}
 
 void Emitter::CreateParticlesAndGPUResources()
 {
@@ -132,116 +164,157 @@ void Emitter::CreateParticlesAndGPUResources()
 }
 
 
-void Emitter::Update(float dt, float currentTime)
+// --------------------------------------------------------
+// Updates every emitter using the job system, in three steps:
+//  1. Each emitter gets ready (on this thread, as it's cheap)
+//  2. Every chunk of living particles, across all emitters,
+//     is checked for deaths as its own job
+//  3. Each emitter retires its dead particles and emits new
+//     ones as its own job, using its own random sequence
+//
+// The chunks are based on each emitter's particle count, not
+// on the number of threads, so the results are identical no
+// matter how many threads there are or which runs what.
+// --------------------------------------------------------
+void Emitter::UpdateEmitters(const std::vector<std::shared_ptr<Emitter>>& emitters, float dt, float currentTime, JobSystem& jobs)
 {
-	// Anything to update?
-	if (livingParticleCount > 0)
+	std::vector<std::pair<Emitter*, int>> chunks;
+	for (auto& e : emitters)
 	{
-		// Update all particles - Check cyclic buffer first
-		if (indexFirstAlive < indexFirstDead)
-		{
-			// First alive is BEFORE first dead, so the "living" particles are contiguous
-			// 
-			// 0 -------- FIRST ALIVE ----------- FIRST DEAD -------- MAX
-			// |    dead    |            alive       |         dead    |
-
-			// First alive is before first dead, so no wrapping
-			for (int i = indexFirstAlive; i < indexFirstDead; i++)
-				UpdateSingleParticle(currentTime, i);
-		}
-		else if (indexFirstDead < indexFirstAlive)
-		{
-			// First alive is AFTER first dead, so the "living" particles wrap around
-			// 
-			// 0 -------- FIRST DEAD ----------- FIRST ALIVE -------- MAX
-			// |    alive    |            dead       |         alive   |
-
-			// Update first half (from firstAlive to max particles)
-			for (int i = indexFirstAlive; i < maxParticles; i++)
-				UpdateSingleParticle(currentTime, i);
-
-			// Update second half (from 0 to first dead)
-			for (int i = 0; i < indexFirstDead; i++)
-				UpdateSingleParticle(currentTime, i);
-		}
-		else
-		{
-			// First alive is EQUAL TO first dead, so they're either all alive or all dead
-			// - Since we know at least one is alive, they should all be
-			//
-			//            FIRST ALIVE
-			// 0 -------- FIRST DEAD -------------------------------- MAX
-			// |    alive     |                   alive                |
-			for (int i = 0; i < maxParticles; i++)
-				UpdateSingleParticle(currentTime, i);
-		}
+		e->BeginUpdate(currentTime);
+		for (int c = 0; c < e->GetChunkCount(); c++)
+			chunks.push_back(std::make_pair(e.get(), c));
 	}
 
-	// Add to the time
-	timeSinceLastEmit += dt;
+	jobs.Run((unsigned int)chunks.size(), [&](unsigned int i) { chunks[i].first->UpdateChunk(chunks[i].second); });
+	jobs.Run((unsigned int)emitters.size(), [&](unsigned int i) { emitters[i]->FinishUpdate(dt, currentTime); });
+}
 
-	// Enough time to emit?
-	while (timeSinceLastEmit > secondsPerParticle)
-	{
-		EmitParticle(currentTime);
-		timeSinceLastEmit -= secondsPerParticle;
-	}
+// --------------------------------------------------------
+// How many jobs this emitter's living particles are split into
+// --------------------------------------------------------
+int Emitter::GetChunkCount()
+{
+	return (livingParticleCount + PARTICLES_PER_JOB - 1) / PARTICLES_PER_JOB;
 }
 
+// --------------------------------------------------------
+// Sets up the values every chunk of this update needs
+// --------------------------------------------------------
+void Emitter::BeginUpdate(float currentTime)
+{
+	updateTime = currentTime;
+	chunkDeaths.assign(GetChunkCount(), 0);
+}
 
-void Emitter::UpdateSingleParticle(float currentTime, int index)
+// --------------------------------------------------------
+// Counts the dead particles in one chunk of living particles,
+// which may wrap around the end of the cyclic buffer
+//
+// 0 -------- FIRST DEAD ----------- FIRST ALIVE -------- MAX
+// |    alive    |            dead       |         alive   |
+// --------------------------------------------------------
+void Emitter::UpdateChunk(int chunk)
 {
-	float age = currentTime - particles[index].EmitTime;
+	int firstLiving = chunk * PARTICLES_PER_JOB;
+	int endLiving = min(firstLiving + PARTICLES_PER_JOB, livingParticleCount);
 
-	// Update and check for death
-	if (age >= lifetime)
+	int died = 0;
+	for (int living = firstLiving; living < endLiving; living++)
 	{
-		// Recent death, so retire by moving alive count (and wrap)
-		indexFirstAlive++;
-		indexFirstAlive %= maxParticles;
-		livingParticleCount--;
+		int index = indexFirstAlive + living;
+		if (index >= maxParticles)
+			index -= maxParticles;
+
+		float age = updateTime - particles[index].EmitTime;
+		died += age >= lifetime;
 	}
+	chunkDeaths[chunk] = died;
 }
 
-void Emitter::EmitParticle(float currentTime)
+// --------------------------------------------------------
+// Retires this update's dead particles and emits new ones
+// --------------------------------------------------------
+void Emitter::FinishUpdate(float dt, float currentTime)
 {
-	// Any left to spawn?
-	if (livingParticleCount == maxParticles)
-		return;
-
-	// Which particle is spawning?
-	int spawnedIndex = indexFirstDead;
+	// Particles are emitted in order and share a lifetime, so
+	// the ones that died are always the oldest - retire them
+	// by moving the first alive index past them
+	int died = 0;
+	for (int d : chunkDeaths)
+		died += d;
+
+	indexFirstAlive += died;
+	if (indexFirstAlive >= maxParticles)
+		indexFirstAlive -= maxParticles;
+	livingParticleCount -= died;
 
-	// Update the spawn time
-	particles[spawnedIndex].EmitTime = currentTime;
+	// Add to the time
+	timeSinceLastEmit += dt;
 
-	// Adjust the particle start position based on the random range (box shape)
-	particles[spawnedIndex].StartPosition = transform.GetPosition();
-	particles[spawnedIndex].StartPosition.x += positionRandomRange.x * RandomRange(-1.0f, 1.0f);
-	particles[spawnedIndex].StartPosition.y += positionRandomRange.y * RandomRange(-1.0f, 1.0f);
-	particles[spawnedIndex].StartPosition.z += positionRandomRange.z * RandomRange(-1.0f, 1.0f);
+	// Enough time to emit?
+	int emitCount = 0;
+	while (timeSinceLastEmit > secondsPerParticle)
+	{
+		emitCount++;
+		timeSinceLastEmit -= secondsPerParticle;
+	}
+	EmitParticles(emitCount, currentTime);
+}
 
-	// Adjust particle start velocity based on random range
-	particles[spawnedIndex].StartVelocity = startVelocity;
-	particles[spawnedIndex].StartVelocity.x += velocityRandomRange.x * RandomRange(-1.0f, 1.0f);
-	particles[spawnedIndex].StartVelocity.y += velocityRandomRange.y * RandomRange(-1.0f, 1.0f);
-	particles[spawnedIndex].StartVelocity.z += velocityRandomRange.z * RandomRange(-1.0f, 1.0f);
+// --------------------------------------------------------
+// Emits up to count particles (as many as there's room for),
+// with every random number they need made in one batch
+// --------------------------------------------------------
+void Emitter::EmitParticles(int count, float currentTime)
+{
+	// Any left to spawn?
+	count = min(count, maxParticles - livingParticleCount);
+	if (count <= 0)
+		return;
 
-	// Adjust start and end rotation values based on range
-	particles[spawnedIndex].StartRotation = RandomRange(rotationStartMinMax.x, rotationStartMinMax.y);
-	particles[spawnedIndex].EndRotation = RandomRange(rotationEndMinMax.x, rotationEndMinMax.y);
+	emitRandoms.resize(count * RANDOMS_PER_PARTICLE);
+	random.NextFloats(emitRandoms.data(), count * RANDOMS_PER_PARTICLE);
 
-	// Increment the first dead particle (since it's now alive)
-	indexFirstDead++;
-	indexFirstDead %= maxParticles; // Wrap
+	XMFLOAT3 emitterPosition = transform.GetPosition();
+	for (int e = 0; e < count; e++)
+	{
+		// This particle's random numbers, from [0, 1)
+		const float* r = &emitRandoms[e * RANDOMS_PER_PARTICLE];
+
+		// Which particle is spawning?
+		int spawnedIndex = indexFirstDead;
+
+		// Update the spawn time
+		particles[spawnedIndex].EmitTime = currentTime;
+
+		// Adjust the particle start position based on the random range (box shape)
+		particles[spawnedIndex].StartPosition = emitterPosition;
+		particles[spawnedIndex].StartPosition.x += positionRandomRange.x * (r[0] * 2 - 1);
+		particles[spawnedIndex].StartPosition.y += positionRandomRange.y * (r[1] * 2 - 1);
+		particles[spawnedIndex].StartPosition.z += positionRandomRange.z * (r[2] * 2 - 1);
+
+		// Adjust particle start velocity based on random range
+		particles[spawnedIndex].StartVelocity = startVelocity;
+		particles[spawnedIndex].StartVelocity.x += velocityRandomRange.x * (r[3] * 2 - 1);
+		particles[spawnedIndex].StartVelocity.y += velocityRandomRange.y * (r[4] * 2 - 1);
+		particles[spawnedIndex].StartVelocity.z += velocityRandomRange.z * (r[5] * 2 - 1);
+
+		// Adjust start and end rotation values based on range
+		particles[spawnedIndex].StartRotation = rotationStartMinMax.x + r[6] * (rotationStartMinMax.y - rotationStartMinMax.x);
+		particles[spawnedIndex].EndRotation = rotationEndMinMax.x + r[7] * (rotationEndMinMax.y - rotationEndMinMax.x);
+
+		// Increment the first dead particle (since it's now alive)
+		indexFirstDead++;
+		indexFirstDead %= maxParticles; // Wrap
+	}
 
-	// One more living particle
-	livingParticleCount++;
+	livingParticleCount += count;
 }
 
 void Emitter::Draw(Microsoft::WRL::ComPtr<ID3D11DeviceContext> context, std::shared_ptr<Camera> camera, float currentTime)
 {
-	CopyParticlesToGPU(context);
+	// Note: The particles must already be in the particle buffer, from CopyEmittersToGPU()
 
 	// Set up buffers - note that we're NOT using a vertex buffer!
 	// When we draw, we'll calculate the number of vertices we expect
@@ -284,41 +357,71 @@ void Emitter::Draw(Microsoft::WRL::ComPtr<ID3D11DeviceContext> context, std::sha
 	context->DrawIndexed(livingParticleCount * 6, 0, 0);
 }
 
-void Emitter::CopyParticlesToGPU(Microsoft::WRL::ComPtr<ID3D11DeviceContext> context)
+// --------------------------------------------------------
+// Maps every emitter's particle buffer and has the job system
+// copy the living particles right into them
+// --------------------------------------------------------
+void Emitter::CopyEmittersToGPU(
+	const std::vector<std::shared_ptr<Emitter>>& emitters,
+	Microsoft::WRL::ComPtr<ID3D11DeviceContext> context,
+	JobSystem& jobs)
 {
-	// Now that we have emit and updated all particles for this frame, 
-	// we can copy them to the GPU as either one big chunk or two smaller chunks
-
-	// Map the buffer
-	D3D11_MAPPED_SUBRESOURCE mapped = {};
-	context->Map(particleDataBuffer.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped);
-
-	// How are living particles arranged in the buffer?
-	if (indexFirstAlive < indexFirstDead)
+	// Mapping has to happen on this thread
+	std::vector<Particle*> destinations;
+	for (auto& e : emitters)
 	{
-		// Only copy from FirstAlive -> FirstDead
-		memcpy(
-			mapped.pData, // Destination = start of particle buffer
-			particles + indexFirstAlive, // Source = particle array, offset to first living particle
-			sizeof(Particle) * livingParticleCount); // Amount = number of particles (measured in BYTES!)
+		D3D11_MAPPED_SUBRESOURCE mapped = {};
+		context->Map(e->particleDataBuffer.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped);
+		destinations.push_back((Particle*)mapped.pData);
 	}
-	else
+
+	CopyEmitterParticles(emitters, destinations, jobs);
+
+	// Unmap now that we're done copying
+	for (auto& e : emitters)
+		context->Unmap(e->particleDataBuffer.Get(), 0);
+}
+
+// --------------------------------------------------------
+// Copies the living particles of every emitter, one job per
+// chunk of particles.  Each emitter's particles start at the
+// beginning of its destination, oldest first, so we can
+// simply draw the correct amount of living particle indices.
+// --------------------------------------------------------
+void Emitter::CopyEmitterParticles(
+	const std::vector<std::shared_ptr<Emitter>>& emitters,
+	const std::vector<Particle*>& destinations,
+	JobSystem& jobs)
+{
+	std::vector<std::pair<int, int>> chunks;
+	for (int e = 0; e < (int)emitters.size(); e++)
 	{
-		// Copy from 0 -> FirstDead 
-		memcpy(
-			mapped.pData, // Destination = start of particle buffer
-			particles, // Source = start of particle array
-			sizeof(Particle) * indexFirstDead); // Amount = particles up to first dead (measured in BYTES!)
-
-		// ALSO copy from FirstAlive -> End
-		memcpy(
-			(void*)((Particle*)mapped.pData + indexFirstDead), // Destination = particle buffer, AFTER the data we copied in previous memcpy()
-			particles + indexFirstAlive,  // Source = particle array, offset to first living particle
-			sizeof(Particle) * (maxParticles - indexFirstAlive)); // Amount = number of living particles at end of array (measured in BYTES!)
+		for (int c = 0; c < emitters[e]->GetChunkCount(); c++)
+			chunks.push_back(std::make_pair(e, c));
 	}
 
-	// Unmap now that we're done copying
-	context->Unmap(particleDataBuffer.Get(), 0);
+	jobs.Run((unsigned int)chunks.size(), [&](unsigned int i)
+		{
+			int e = chunks[i].first;
+			emitters[e]->CopyChunk(chunks[i].second, destinations[e]);
+		});
+}
+
+// --------------------------------------------------------
+// Copies one chunk of living particles (as one or two pieces,
+// if it wraps around the end of the cyclic buffer)
+// --------------------------------------------------------
+void Emitter::CopyChunk(int chunk, Particle* destination)
+{
+	int firstLiving = chunk * PARTICLES_PER_JOB;
+	int count = min(PARTICLES_PER_JOB, livingParticleCount - firstLiving);
+	int first = indexFirstAlive + firstLiving;
+	if (first >= maxParticles)
+		first -= maxParticles;
+
+	int firstHalfCount = min(count, maxParticles - first);
+	memcpy(destination + firstLiving, particles + first, sizeof(Particle) * firstHalfCount);
+	memcpy(destination + firstLiving + firstHalfCount, particles, sizeof(Particle) * (count - firstHalfCount));
 }
 
 int Emitter::GetParticlesPerSecond()
@@ -355,3 +458,102 @@ bool Emitter::IsSpriteSheet()
 	return spriteSheetHeight > 1 || spriteSheetWidth > 1;
 }
 
+
+
+// --------------------------------------------------------
+// Simulates a set of emitters (including a few large enough
+// to be split into many jobs) one thread at a time, then
+// twice more with every thread, and checks that every run
+// produces exactly the same particles each frame.  The same
+// emitters are restarted from the same seeds before each
+// run, so this also checks that a seed replays.  Nothing
+// is drawn, so this only needs a device to create the
+// emitters' buffers.
+//
+// device - Device for the emitters' buffers
+// frameCount - How many frames to simulate in each run
+// --------------------------------------------------------
+EmitterDeterminismResults Emitter::TestDeterminism(Microsoft::WRL::ComPtr<ID3D11Device> device, int frameCount)
+{
+	EmitterDeterminismResults results = {};
+	results.FrameCount = frameCount;
+	results.FirstMismatchFrame = -1;
+
+	JobSystem serialJobs(1);
+	JobSystem parallelJobs;
+	results.ThreadCount = parallelJobs.GetThreadCount();
+
+	// The same emitters every run
+	std::vector<std::shared_ptr<Emitter>> emitters;
+	emitters.push_back(std::make_shared<Emitter>(device, nullptr, 300, 100, 2.0f, 0.1f, 2.0f, false, XMFLOAT4(1, 1, 1, 1), XMFLOAT4(1, 1, 1, 0), XMFLOAT3(1, 0, 0), XMFLOAT3(0.1f, 0.1f, 0.1f), XMFLOAT2(-2, 2), XMFLOAT2(-2, 2), XMFLOAT3(0, 1, 0), XMFLOAT3(0.5f, 0.5f, 0.5f), XMFLOAT3(0, -1, 0)));
+	emitters.push_back(std::make_shared<Emitter>(device, nullptr, 45, 20, 2.0f, 3.0f, 2.0f, true, XMFLOAT4(0.2f, 0.1f, 0.1f, 0.0f), XMFLOAT4(0.2f, 0.7f, 0.1f, 1.0f), XMFLOAT3(-2, 0, 0), XMFLOAT3(0, 0, 0), XMFLOAT2(-5, 5), XMFLOAT2(-5, 5)));
+	emitters.push_back(std::make_shared<Emitter>(device, nullptr, 100000, 40000, 2.0f, 0.5f, 0.1f, false, XMFLOAT4(1, 1, 1, 1), XMFLOAT4(0, 0, 1, 0), XMFLOAT3(0, 0, 0), XMFLOAT3(1, 1, 1), XMFLOAT2(-3, 3), XMFLOAT2(-3, 3), XMFLOAT3(0, 3, 0), XMFLOAT3(2, 1, 2), XMFLOAT3(0, -3, 0)));
+	emitters.push_back(std::make_shared<Emitter>(device, nullptr, 30000, 20000, 1.0f, 1.0f, 3.0f, false, XMFLOAT4(1, 0, 0, 1), XMFLOAT4(1, 1, 0, 0), XMFLOAT3(0, 2, 0), XMFLOAT3(0.2f, 0.2f, 0.2f), XMFLOAT2(0, 6), XMFLOAT2(0, 6), XMFLOAT3(1, 0, 0), XMFLOAT3(0.5f, 0.5f, 0.5f), XMFLOAT3(0, 1, 0)));
+
+	JobSystem* runJobs[] = { &serialJobs, &parallelJobs, &parallelJobs };
+	std::vector<unsigned long long> firstRunHashes;
+	for (JobSystem* jobs : runJobs)
+	{
+		// Start over from the same seeds every run
+		for (int e = 0; e < (int)emitters.size(); e++)
+			emitters[e]->Restart(e + 1);
+
+		std::vector<std::vector<Particle>> copies;
+		std::vector<Particle*> destinations;
+		for (auto& e : emitters)
+		{
+			copies.push_back(std::vector<Particle>(e->maxParticles));
+			destinations.push_back(copies.back().data());
+		}
+
+		std::vector<unsigned long long> hashes;
+		float currentTime = 0.0f;
+		for (int f = 0; f < frameCount; f++)
+		{
+			// Uneven frame times, so particles are emitted in uneven groups
+			float dt = 1.0f / 60.0f + (f % 7) * 0.002f;
+			currentTime += dt;
+			UpdateEmitters(emitters, dt, currentTime, *jobs);
+			CopyEmitterParticles(emitters, destinations, *jobs);
+
+			// FNV-1a over every living particle (the padding is never
+			// written, so only the data before it is included)
+			unsigned long long hash = 14695981039346656037ull;
+			for (int e = 0; e < (int)emitters.size(); e++)
+			{
+				for (int p = 0; p < emitters[e]->livingParticleCount; p++)
+				{
+					const unsigned char* bytes = (const unsigned char*)&destinations[e][p];
+					for (size_t b = 0; b < offsetof(Particle, pad); b++)
+						hash = (hash ^ bytes[b]) * 1099511628211ull;
+				}
+				hash = (hash ^ (unsigned int)emitters[e]->livingParticleCount) * 1099511628211ull;
+			}
+			hashes.push_back(hash);
+		}
+
+		results.EmitterCount = (int)emitters.size();
+		results.ParticleCount = 0;
+		for (auto& e : emitters)
+			results.ParticleCount += e->livingParticleCount;
+
+		// Compare against the single threaded run
+		if (firstRunHashes.empty())
+		{
+			firstRunHashes = hashes;
+			continue;
+		}
+
+		for (int f = 0; f < frameCount; f++)
+		{
+			if (hashes[f] != firstRunHashes[f])
+			{
+				if (results.FirstMismatchFrame < 0 || f < results.FirstMismatchFrame)
+					results.FirstMismatchFrame = f;
+				break;
+			}
+		}
+	}
+
+	return results;
+}
@@ -4,15 +4,22 @@
 #include <DirectXMath.h>
 #include <d3d11.h>
 #include <memory>
+#include <vector>
 
 #include "SimpleShader.h"
 #include "Camera.h"
 #include "Material.h"
 #include "Transform.h"
+#include "JobSystem.h"
+#include "RandomStream.h"
 
+// Most particles a single update or copy job handles - larger
+// emitters are split into several jobs across the ring buffer
+#define PARTICLES_PER_JOB 4096
 
-// Helper macro for getting a float between min and max
-#define RandomRange(min, max) ((float)rand() / RAND_MAX * (max - min) + min)
+// Random numbers each new particle needs: a start position,
+// a start velocity and start and end rotations
+#define RANDOMS_PER_PARTICLE 8
 
 // We'll be mimicking this in HLSL
 // so we need to care about alignment!
@@ -28,6 +35,19 @@ struct Particle
 	DirectX::XMFLOAT3 pad;
 };
 
+// --------------------------------------------------------
+// Results of simulating the same emitters with different
+// numbers of threads and comparing every frame
+// --------------------------------------------------------
+struct EmitterDeterminismResults
+{
+	int FrameCount;
+	int EmitterCount;
+	int ParticleCount;			// Living particles after the last frame
+	unsigned int ThreadCount;	// Threads used by the parallel runs
+	int FirstMismatchFrame;		// First frame that differed between runs, or -1
+};
+
 class Emitter
 {
 public:
@@ -55,7 +75,6 @@ public:
 	);
 	~Emitter();
 
-	void Update(float dt, float currentTime);
 	void Draw(
 		Microsoft::WRL::ComPtr<ID3D11DeviceContext> context,
 		std::shared_ptr<Camera> camera,
@@ -92,12 +111,42 @@ public:
 	Transform* GetTransform();
 	std::shared_ptr<Material> GetMaterial();
 	void SetMaterial(std::shared_ptr<Material> material);
+
+	int GetLivingParticleCount();
+	unsigned int GetRandomSeed();
+	void SetRandomSeed(unsigned int seed);
+	void Restart(unsigned int seed);
+
+	// Updating and copying many emitters at once, in parallel
+	static void UpdateEmitters(
+		const std::vector<std::shared_ptr<Emitter>>& emitters,
+		float dt,
+		float currentTime,
+		JobSystem& jobs);
+	static void CopyEmittersToGPU(
+		const std::vector<std::shared_ptr<Emitter>>& emitters,
+		Microsoft::WRL::ComPtr<ID3D11DeviceContext> context,
+		JobSystem& jobs);
+	static void CopyEmitterParticles(
+		const std::vector<std::shared_ptr<Emitter>>& emitters,
+		const std::vector<Particle*>& destinations,
+		JobSystem& jobs);
+
+	static EmitterDeterminismResults TestDeterminism(
+		Microsoft::WRL::ComPtr<ID3D11Device> device,
+		int frameCount);
 private:
 	// Emission
 	int particlesPerSecond;
 	float secondsPerParticle;
 	float timeSinceLastEmit;
 
+	// Each emitter has its own random sequence, so the particles
+	// it spawns don't depend on which thread updated it
+	unsigned int randomSeed;
+	RandomStream random;
+	std::vector<float> emitRandoms;
+
 	// Array of particle data
 	Particle* particles;
 	int maxParticles;
@@ -107,6 +156,10 @@ private:
 	int indexFirstAlive;
 	int livingParticleCount;
 
+	// Per-update state shared by this emitter's jobs
+	float updateTime;
+	std::vector<int> chunkDeaths;
+
 	// Sprite sheet options
 	int spriteSheetWidth;
 	int spriteSheetHeight;
@@ -125,10 +178,13 @@ private:
 
 	// Creation and copy methods
 	void CreateParticlesAndGPUResources();
-	void CopyParticlesToGPU(Microsoft::WRL::ComPtr<ID3D11DeviceContext> context);
+	void CopyChunk(int chunk, Particle* destination);
 
 	// Simulation methods
-	void UpdateSingleParticle(float currentTime, int index);
-	void EmitParticle(float currentTime);
+	int GetChunkCount();
+	void BeginUpdate(float currentTime);
+	void UpdateChunk(int chunk);
+	void FinishUpdate(float dt, float currentTime);
+	void EmitParticles(int count, float currentTime);
 };
 
@@ -416,9 +416,8 @@ void Game::Update(float deltaTime, float totalTime)
 	// Update the camera
 	camera->Update(deltaTime);
 
-	// Update all emitters
-	for (auto& e : emitters)
-		e->Update(deltaTime, totalTime);
+	// Update all emitters, spread across every core
+	Emitter::UpdateEmitters(emitters, deltaTime, totalTime, jobs);
 
 	// Create the UI during update!
 	CreateUI(deltaTime);
@@ -628,6 +627,9 @@ void Game::DrawParticles(float totalTime)
 		context->OMSetBlendState(particleBlendState.Get(), 0, 0xffffffff);	// Additive blending
 		context->OMSetDepthStencilState(particleDepthState.Get(), 0);		// No depth WRITING
 
+		// Copy every emitter's particles once, for both passes below
+		Emitter::CopyEmittersToGPU(emitters, context, jobs);
+
 		// Draw all of the emitters
 		for (auto& e : emitters)
 		{
@@ -44,6 +44,7 @@ private:
 	Microsoft::WRL::ComPtr<ID3D11BlendState> particleBlendState;
 	Microsoft::WRL::ComPtr<ID3D11RasterizerState> particleDebugRasterState;
 	std::vector<std::shared_ptr<Emitter>> emitters;
+	JobSystem jobs;
 	void DrawParticles(float totalTime);
 
 	// Skybox
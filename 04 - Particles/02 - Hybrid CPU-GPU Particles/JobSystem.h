@@ -0,0 +1,52 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <vector>
+
+// --------------------------------------------------------
+// A small pool of worker threads that runs a batch of
+// independent jobs and waits for all of them to finish.
+//
+// The threads are created once and sleep between batches,
+// so running a batch every frame doesn't pay for creating
+// threads.  The calling thread works on the batch too.
+// Jobs are handed out in index order, but may run in any
+// order on any thread - a job must only write data that
+// no other job in the same batch touches.
+// --------------------------------------------------------
+class JobSystem
+{
+public:
+	JobSystem(unsigned int threadCount = 0);
+	~JobSystem();
+
+	JobSystem(const JobSystem&) = delete;
+	void operator=(const JobSystem&) = delete;
+
+	void Run(unsigned int jobCount, const std::function<void(unsigned int)>& job);
+
+	unsigned int GetThreadCount() const;
+
+private:
+	std::vector<std::thread> workers;
+
+	// Current batch
+	const std::function<void(unsigned int)>* job;
+	unsigned int jobCount;
+	std::atomic<unsigned int> nextJob;
+
+	// Waking workers and waiting for them
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+	unsigned int batch;
+	unsigned int busyWorkers;
+	bool quit;
+
+	void WorkerLoop();
+	void RunJobs();
+};
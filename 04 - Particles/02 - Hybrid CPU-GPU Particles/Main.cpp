@@ -3,6 +3,8 @@
 #define SIMPLE_SHADER_REPORT_WARNINGS
 
 #include <Windows.h>
+#include <stdio.h>
+#include <string.h>
 #include "Game.h"
 
 // --------------------------------------------------------
@@ -21,6 +23,35 @@ int WINAPI WinMain(
 	_CrtSetDbgFlag( _CRTDBG_ALLOC_MEM_DF | _CRTDBG_LEAK_CHECK_DF );
 #endif
 
+	// "-determinism" runs the emitters with one thread and with every
+	// thread, and checks they match - no window, but it needs a device
+	if (strstr(lpCmdLine, "-determinism"))
+	{
+		// Print to the console we were launched from, or a new one
+		if (!AttachConsole(ATTACH_PARENT_PROCESS))
+			AllocConsole();
+		FILE* stream;
+		freopen_s(&stream, "CONOUT$", "w", stdout);
+
+		// Any device will do, as nothing is drawn
+		Microsoft::WRL::ComPtr<ID3D11Device> device;
+		HRESULT hr = D3D11CreateDevice(0, D3D_DRIVER_TYPE_HARDWARE, 0, 0, 0, 0, D3D11_SDK_VERSION, device.GetAddressOf(), 0, 0);
+		if (FAILED(hr))
+			hr = D3D11CreateDevice(0, D3D_DRIVER_TYPE_WARP, 0, 0, 0, 0, D3D11_SDK_VERSION, device.GetAddressOf(), 0, 0);
+		if (FAILED(hr))
+		{
+			printf("\nUnable to create a device\n");
+			return hr;
+		}
+
+		EmitterDeterminismResults results = Emitter::TestDeterminism(device, 600);
+		printf("\nEmitter determinism: %d emitters, %d frames, %d particles at the end\n", results.EmitterCount, results.FrameCount, results.ParticleCount);
+		printf("  1 thread vs %u threads: %s", results.ThreadCount, results.FirstMismatchFrame < 0 ? "identical\n" : "MISMATCH");
+		if (results.FirstMismatchFrame >= 0)
+			printf(" (first at frame %d)\n", results.FirstMismatchFrame);
+		return results.FirstMismatchFrame < 0 ? 0 : 1;
+	}
+
 	// Create the Game object using
 	// the app handle we got from WinMain
 	Game dxGame(hInstance);
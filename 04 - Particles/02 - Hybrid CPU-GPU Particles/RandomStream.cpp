@@ -0,0 +1,173 @@
+#include "RandomStream.h"
+
+#include <emmintrin.h>
+#include <chrono>
+#include <random>
+#include <vector>
+
+// Turns the top 24 bits of a result into [0, 1) - exact, as every
+// 24 bit integer (and the power of two scale) fits in a float
+#define RESULT_TO_FLOAT (1.0f / 16777216.0f)
+
+// Rotate each lane left by a constant number of bits
+#define ROTL_EPI32(x, bits) _mm_or_si128(_mm_slli_epi32(x, bits), _mm_srli_epi32(x, 32 - bits))
+
+
+RandomStream::RandomStream(unsigned long long seed)
+{
+	Seed(seed);
+}
+
+// --------------------------------------------------------
+// Restarts the stream from a seed.  The seed is expanded into
+// all sixteen state words with splitmix64, as recommended for
+// the xoshiro generators, so nearby seeds give unrelated streams.
+// --------------------------------------------------------
+void RandomStream::Seed(unsigned long long seed)
+{
+	unsigned long long x = seed;
+	for (int g = 0; g < 4; g++)
+	{
+		for (int w = 0; w < 4; w += 2)
+		{
+			unsigned long long z = (x += 0x9E3779B97F4A7C15ull);
+			z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+			z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+			z = z ^ (z >> 31);
+			state[w][g] = (unsigned int)z;
+			state[w + 1][g] = (unsigned int)(z >> 32);
+		}
+	}
+
+	// Nothing left over from the old stream
+	nextResult = 4;
+}
+
+// --------------------------------------------------------
+// Steps all four generators once, leaving their results
+// ready to be handed out in order
+// --------------------------------------------------------
+void RandomStream::Step()
+{
+	__m128i s0 = _mm_loadu_si128((const __m128i*)state[0]);
+	__m128i s1 = _mm_loadu_si128((const __m128i*)state[1]);
+	__m128i s2 = _mm_loadu_si128((const __m128i*)state[2]);
+	__m128i s3 = _mm_loadu_si128((const __m128i*)state[3]);
+
+	_mm_storeu_si128((__m128i*)results, _mm_add_epi32(s0, s3));
+
+	__m128i t = _mm_slli_epi32(s1, 9);
+	s2 = _mm_xor_si128(s2, s0);
+	s3 = _mm_xor_si128(s3, s1);
+	s1 = _mm_xor_si128(s1, s2);
+	s0 = _mm_xor_si128(s0, s3);
+	s2 = _mm_xor_si128(s2, t);
+	s3 = ROTL_EPI32(s3, 11);
+
+	_mm_storeu_si128((__m128i*)state[0], s0);
+	_mm_storeu_si128((__m128i*)state[1], s1);
+	_mm_storeu_si128((__m128i*)state[2], s2);
+	_mm_storeu_si128((__m128i*)state[3], s3);
+
+	nextResult = 0;
+}
+
+unsigned int RandomStream::NextUInt()
+{
+	if (nextResult == 4)
+		Step();
+	return results[nextResult++];
+}
+
+// --------------------------------------------------------
+// A float in [0, 1)
+// --------------------------------------------------------
+float RandomStream::NextFloat()
+{
+	return (NextUInt() >> 8) * RESULT_TO_FLOAT;
+}
+
+// --------------------------------------------------------
+// A float in [min, max)
+// --------------------------------------------------------
+float RandomStream::NextFloat(float min, float max)
+{
+	return NextFloat() * (max - min) + min;
+}
+
+// --------------------------------------------------------
+// Fills an array with floats in [0, 1), the same ones that
+// calling NextFloat() count times would have returned.  Whole
+// steps are done in registers and written four at a time.
+//
+// values - Where to put the numbers (need not be aligned)
+// count - How many numbers to make
+// --------------------------------------------------------
+void RandomStream::NextFloats(float* values, int count)
+{
+	// Use up what's left of the last step first
+	int i = 0;
+	while (i < count && nextResult < 4)
+		values[i++] = (results[nextResult++] >> 8) * RESULT_TO_FLOAT;
+
+	if (count - i >= 4)
+	{
+		__m128i s0 = _mm_loadu_si128((const __m128i*)state[0]);
+		__m128i s1 = _mm_loadu_si128((const __m128i*)state[1]);
+		__m128i s2 = _mm_loadu_si128((const __m128i*)state[2]);
+		__m128i s3 = _mm_loadu_si128((const __m128i*)state[3]);
+		__m128 scale = _mm_set1_ps(RESULT_TO_FLOAT);
+
+		for (; i + 4 <= count; i += 4)
+		{
+			// Same as Step(), but straight to floats
+			__m128i result = _mm_add_epi32(s0, s3);
+			_mm_storeu_ps(values + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(result, 8)), scale));
+
+			__m128i t = _mm_slli_epi32(s1, 9);
+			s2 = _mm_xor_si128(s2, s0);
+			s3 = _mm_xor_si128(s3, s1);
+			s1 = _mm_xor_si128(s1, s2);
+			s0 = _mm_xor_si128(s0, s3);
+			s2 = _mm_xor_si128(s2, t);
+			s3 = ROTL_EPI32(s3, 11);
+		}
+
+		_mm_storeu_si128((__m128i*)state[0], s0);
+		_mm_storeu_si128((__m128i*)state[1], s1);
+		_mm_storeu_si128((__m128i*)state[2], s2);
+		_mm_storeu_si128((__m128i*)state[3], s3);
+	}
+
+	// Any left over start a new step, and the rest of it
+	// is saved for next time
+	while (i < count)
+		values[i++] = NextFloat();
+}
+
+
+// --------------------------------------------------------
+// Times making count floats in one batch against making
+// them one at a time with std::mt19937
+//
+// count - How many numbers to make with each
+// --------------------------------------------------------
+RandomBenchmarkResults RandomStream::Benchmark(int count)
+{
+	std::vector<float> values(count);
+
+	RandomStream stream(1);
+	auto start = std::chrono::high_resolution_clock::now();
+	stream.NextFloats(values.data(), count);
+	auto middle = std::chrono::high_resolution_clock::now();
+	std::mt19937 mersenne(1);
+	for (int i = 0; i < count; i++)
+		values[i] = (mersenne() >> 8) * RESULT_TO_FLOAT;
+	auto end = std::chrono::high_resolution_clock::now();
+
+	RandomBenchmarkResults results = {};
+	results.Count = count;
+	results.StreamNsPerNumber = std::chrono::duration<double, std::nano>(middle - start).count() / count;
+	results.MersenneNsPerNumber = std::chrono::duration<double, std::nano>(end - middle).count() / count;
+	return results;
+}
@@ -2,6 +2,9 @@
 
 using namespace DirectX;
 
+// Each new emitter gets its own seed unless one is set
+static unsigned int nextRandomSeed = 1;
+
 Emitter::Emitter(
 	Microsoft::WRL::ComPtr<ID3D11Device> device,
 	std::shared_ptr<Material> material,
@@ -9,6 +12,9 @@ Emitter::Emitter(
 	std::shared_ptr<SimpleComputeShader> updateCS,
 	std::shared_ptr<SimpleComputeShader> deadListInitCS,
 	std::shared_ptr<SimpleComputeShader> copyDrawCountCS,
+	std::shared_ptr<SimpleComputeShader> sortKeysCS,
+	std::shared_ptr<SimpleComputeShader> bitonicSortCS,
+	std::shared_ptr<SimpleComputeShader> bitonicSortLocalCS,
 	int maxParticles,
 	int particlesPerSecond,
 	float lifetime,
@@ -36,12 +42,16 @@ Emitter::Emitter(
 	updateCS(updateCS),
 	deadListInitCS(deadListInitCS),
 	copyDrawCountCS(copyDrawCountCS),
+	sortKeysCS(sortKeysCS),
+	bitonicSortCS(bitonicSortCS),
+	bitonicSortLocalCS(bitonicSortLocalCS),
 	maxParticles(maxParticles),
 	particlesPerSecond(particlesPerSecond),
 	lifetime(lifetime),
 	startSize(startSize),
 	endSize(endSize),
 	constrainYAxis(constrainYAxis),
+	sortByDepth(false),
 	startColor(startColor),
 	endColor(endColor),
 	positionRandomRange(positionRandomRange),
@@ -57,7 +67,8 @@ Emitter::Emitter(
 	spriteSheetSpeedScale(spriteSheetSpeedScale),
 	paused(paused),
 	visible(visible),
-	totalEmitterTime(0.0f)
+	totalEmitterTime(0.0f),
+	emittedCount(0)
 {
 	// Grab the context from the device
 	device->GetImmediateContext(context.GetAddressOf());
@@ -67,6 +78,7 @@ Emitter::Emitter(
 
 	// Set up emission and lifetime stats
 	timeSinceLastEmit = 0.0f;
+	SetRandomSeed(nextRandomSeed++);
 
 	this->transform.SetPosition(emitterPosition);
 
@@ -108,6 +120,19 @@ Emitter::Emitter(
 			deadCounterDesc.StructureByteStride = 0;
 			device->CreateBuffer(&deadCounterDesc, 0, deadListCounterBuffer.GetAddressOf());
 		}
+
+		// DRAW LIST COUNTER BUFFER ==================
+		{
+			// Same idea, but holds how many particles are alive for the depth sort
+			D3D11_BUFFER_DESC drawCounterDesc = {};
+			drawCounterDesc.Usage = D3D11_USAGE_DEFAULT;
+			drawCounterDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+			drawCounterDesc.ByteWidth = 16; // Has to be multiple of 16 for cbuffer
+			drawCounterDesc.CPUAccessFlags = 0;
+			drawCounterDesc.MiscFlags = 0;
+			drawCounterDesc.StructureByteStride = 0;
+			device->CreateBuffer(&drawCounterDesc, 0, drawListCounterBuffer.GetAddressOf());
+		}
 	}
 
 	// Create other emitter-specific GPU resources
@@ -134,6 +159,8 @@ void Emitter::CreateGPUResources()
 
 	particleDrawUAV.Reset();
 	particleDrawSRV.Reset();
+
+	sortListUAV.Reset();
 	
 	// INDEX BUFFER ==========================
 	{
@@ -257,6 +284,35 @@ void Emitter::CreateGPUResources()
 		device->CreateShaderResourceView(drawListBuffer.Get(), &drawSRVDesc, particleDrawSRV.GetAddressOf());
 	}
 
+	// Sort List
+	{
+		// The bitonic sort needs a power of two number of entries,
+		// and at least enough for one thread group to work on
+		sortSize = BITONIC_LOCAL_SIZE;
+		while (sortSize < maxParticles)
+			sortSize *= 2;
+
+		// Buffer - each entry is a (key, particle index) pair
+		Microsoft::WRL::ComPtr<ID3D11Buffer> sortListBuffer;
+		D3D11_BUFFER_DESC sortDesc = {};
+		sortDesc.BindFlags = D3D11_BIND_UNORDERED_ACCESS;
+		sortDesc.ByteWidth = sizeof(unsigned int) * 2 * sortSize;
+		sortDesc.CPUAccessFlags = 0;
+		sortDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+		sortDesc.StructureByteStride = sizeof(unsigned int) * 2;
+		sortDesc.Usage = D3D11_USAGE_DEFAULT;
+		device->CreateBuffer(&sortDesc, 0, sortListBuffer.GetAddressOf());
+
+		// UAV
+		D3D11_UNORDERED_ACCESS_VIEW_DESC sortUAVDesc = {};
+		sortUAVDesc.Format = DXGI_FORMAT_UNKNOWN; // Needed for RW structured buffers
+		sortUAVDesc.Buffer.FirstElement = 0;
+		sortUAVDesc.Buffer.Flags = 0;
+		sortUAVDesc.Buffer.NumElements = sortSize;
+		sortUAVDesc.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
+		device->CreateUnorderedAccessView(sortListBuffer.Get(), &sortUAVDesc, sortListUAV.GetAddressOf());
+	}
+
 	// Populate dead list
 	{
 		// Launch the dead list init shader
@@ -272,7 +328,7 @@ void Emitter::CreateGPUResources()
 }
 
 
-void Emitter::Update(float dt, float currentTime)
+void Emitter::Update(float dt, float currentTime, std::shared_ptr<Camera> camera)
 {
 	if (paused)
 		return;
@@ -303,6 +359,8 @@ void Emitter::Update(float dt, float currentTime)
 		emitCS->SetFloat3("VelRandomRange", velocityRandomRange);
 		emitCS->SetFloat2("RotStartMinMax", rotationStartMinMax);
 		emitCS->SetFloat2("RotEndMinMax", rotationEndMinMax);
+		emitCS->SetInt("RandomSeed", (int)randomSeed);
+		emitCS->SetInt("EmittedCount", (int)emittedCount);
 		emitCS->CopyAllBufferData();
 
 		emitCS->SetUnorderedAccessView("ParticlePool", particlePoolUAV);
@@ -310,6 +368,7 @@ void Emitter::Update(float dt, float currentTime)
 		context->CSSetConstantBuffers(1, 1, deadListCounterBuffer.GetAddressOf()); // Manually setting a whole cbuffer here
 		
 		emitCS->DispatchByThreads(emitCount, 1, 1);
+		emittedCount += emitCount;
 	}
 
 	// SIMULATE ========================
@@ -330,6 +389,103 @@ void Emitter::Update(float dt, float currentTime)
 
 	// Copy dead counter
 	context->CopyStructureCount(deadListCounterBuffer.Get(), 0, particleDeadUAV.Get());
+
+	// SORT ========================
+	// Done here rather than in Draw() so it happens exactly once,
+	// before ParticleCopyDrawCountCS bumps the draw list counter
+	if (sortByDepth)
+		SortDrawList(camera);
+}
+
+
+// --------------------------------------------------------
+// Reorders the living part of the draw list so the farthest
+// particle (along the camera's forward vector) is drawn first.
+//
+// Every living particle gets a key based on its view space
+// depth, then the keys are bitonic sorted on the GPU:
+//  - Each chunk of BITONIC_LOCAL_SIZE entries is sorted in
+//    shared memory with a single dispatch
+//  - Chunks are then merged, one dispatch per step that
+//    compares entries in different chunks, and one more to
+//    finish each merge in shared memory
+// The final dispatch writes the sorted indices back into the
+// draw list, so drawing works exactly the same as before.
+// --------------------------------------------------------
+void Emitter::SortDrawList(std::shared_ptr<Camera> camera)
+{
+	// The draw list is about to be read as an SRV
+	ID3D11UnorderedAccessView* none[8] = {};
+	context->CSSetUnorderedAccessViews(0, 8, none, 0);
+
+	// How many particles are alive
+	context->CopyStructureCount(drawListCounterBuffer.Get(), 0, particleDrawUAV.Get());
+
+	// KEYS ========================
+	{
+		sortKeysCS->SetShader();
+		sortKeysCS->SetMatrix4x4("View", camera->GetView());
+		sortKeysCS->SetFloat3("Acceleration", emitterAcceleration);
+		sortKeysCS->SetFloat("CurrentTime", totalEmitterTime);
+		sortKeysCS->SetInt("SortSize", sortSize);
+		sortKeysCS->CopyAllBufferData();
+
+		sortKeysCS->SetShaderResourceView("ParticlePool", particlePoolSRV);
+		sortKeysCS->SetShaderResourceView("DrawList", particleDrawSRV);
+		sortKeysCS->SetUnorderedAccessView("SortList", sortListUAV);
+		context->CSSetConstantBuffers(1, 1, drawListCounterBuffer.GetAddressOf()); // Manually setting a whole cbuffer here
+
+		sortKeysCS->DispatchByThreads(sortSize, 1, 1);
+
+		// Unbind so the draw list can be written below
+		ID3D11ShaderResourceView* noSRVs[2] = {};
+		context->CSSetShaderResources(0, 2, noSRVs);
+	}
+
+	// SORT ========================
+	{
+		int localGroups = sortSize / BITONIC_LOCAL_SIZE;
+
+		// Sort each chunk on its own
+		bitonicSortLocalCS->SetShader();
+		bitonicSortLocalCS->SetInt("FirstBlockSize", 2);
+		bitonicSortLocalCS->SetInt("LastBlockSize", BITONIC_LOCAL_SIZE);
+		bitonicSortLocalCS->SetInt("WriteDrawList", sortSize == BITONIC_LOCAL_SIZE);
+		bitonicSortLocalCS->CopyAllBufferData();
+		bitonicSortLocalCS->SetUnorderedAccessView("SortList", sortListUAV);
+		bitonicSortLocalCS->SetUnorderedAccessView("DrawList", particleDrawUAV); // Don't reset counter!!!
+		context->CSSetConstantBuffers(1, 1, drawListCounterBuffer.GetAddressOf());
+		bitonicSortLocalCS->DispatchByGroups(localGroups, 1, 1);
+
+		// Merge the sorted chunks into larger and larger blocks
+		for (int blockSize = BITONIC_LOCAL_SIZE * 2; blockSize <= sortSize; blockSize *= 2)
+		{
+			// Steps that compare entries in different chunks
+			bitonicSortCS->SetShader();
+			bitonicSortCS->SetUnorderedAccessView("SortList", sortListUAV);
+			for (int compareDistance = blockSize / 2; compareDistance >= BITONIC_LOCAL_SIZE; compareDistance /= 2)
+			{
+				bitonicSortCS->SetInt("SortSize", sortSize);
+				bitonicSortCS->SetInt("BlockSize", blockSize);
+				bitonicSortCS->SetInt("CompareDistance", compareDistance);
+				bitonicSortCS->CopyAllBufferData();
+				bitonicSortCS->DispatchByThreads(sortSize / 2, 1, 1);
+			}
+
+			// The rest of this merge happens within each chunk
+			bitonicSortLocalCS->SetShader();
+			bitonicSortLocalCS->SetInt("FirstBlockSize", blockSize);
+			bitonicSortLocalCS->SetInt("LastBlockSize", blockSize);
+			bitonicSortLocalCS->SetInt("WriteDrawList", blockSize == sortSize);
+			bitonicSortLocalCS->CopyAllBufferData();
+			bitonicSortLocalCS->SetUnorderedAccessView("SortList", sortListUAV);
+			bitonicSortLocalCS->SetUnorderedAccessView("DrawList", particleDrawUAV); // Don't reset counter!!!
+			context->CSSetConstantBuffers(1, 1, drawListCounterBuffer.GetAddressOf());
+			bitonicSortLocalCS->DispatchByGroups(localGroups, 1, 1);
+		}
+	}
+
+	context->CSSetUnorderedAccessViews(0, 8, none, 0);
 }
 
 
@@ -434,6 +590,31 @@ bool Emitter::GetPaused() { return paused; }
 void Emitter::SetPaused(bool paused) { this->paused = paused; }
 bool Emitter::GetVisible() { return visible; }
 void Emitter::SetVisible(bool visible) { this->visible = visible; }
+unsigned int Emitter::GetRandomSeed() { return randomSeed; }
+
+// --------------------------------------------------------
+// Restarts this emitter's random sequence from the given seed
+// --------------------------------------------------------
+void Emitter::SetRandomSeed(unsigned int seed)
+{
+	randomSeed = seed;
+	emittedCount = 0;
+}
+
+// --------------------------------------------------------
+// Kills every particle (by recreating the particle buffers)
+// and restarts the random sequence, so the same frame times
+// from here replay the same particles as the last time this
+// seed was used.  Which pool slot each one lands in is up to
+// the GPU, but the particles themselves will match.
+// --------------------------------------------------------
+void Emitter::Restart(unsigned int seed)
+{
+	CreateGPUResources();
+	timeSinceLastEmit = 0.0f;
+	totalEmitterTime = 0.0f;
+	SetRandomSeed(seed);
+}
 
 bool Emitter::IsSpriteSheet()
 {
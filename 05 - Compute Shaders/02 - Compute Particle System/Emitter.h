@@ -11,8 +11,9 @@
 #include "Transform.h"
 
 
-// Helper macro for getting a float between min and max
-#define RandomRange(min, max) ((float)rand() / RAND_MAX * (max - min) + min)
+// Entries sorted in shared memory by each thread group of the
+// bitonic sort - must match LOCAL_SIZE in ParticleBitonicSortLocalCS
+#define BITONIC_LOCAL_SIZE 1024
 
 // We'll be mimicking this in HLSL
 // so we need to care about alignment!
@@ -44,6 +45,9 @@ public:
 		std::shared_ptr<SimpleComputeShader> updateCS,
 		std::shared_ptr<SimpleComputeShader> deadListInitCS,
 		std::shared_ptr<SimpleComputeShader> copyDrawCountCS,
+		std::shared_ptr<SimpleComputeShader> sortKeysCS,
+		std::shared_ptr<SimpleComputeShader> bitonicSortCS,
+		std::shared_ptr<SimpleComputeShader> bitonicSortLocalCS,
 		int maxParticles,
 		int particlesPerSecond,
 		float lifetime,
@@ -67,7 +71,7 @@ public:
 	);
 	~Emitter();
 
-	void Update(float dt, float currentTime);
+	void Update(float dt, float currentTime, std::shared_ptr<Camera> camera);
 	void Draw(
 		Microsoft::WRL::ComPtr<ID3D11DeviceContext> context,
 		std::shared_ptr<Camera> camera,
@@ -83,6 +87,9 @@ public:
 	void SetPaused(bool paused);
 	bool GetVisible();
 	void SetVisible(bool visible);
+	unsigned int GetRandomSeed();
+	void SetRandomSeed(unsigned int seed);
+	void Restart(unsigned int seed);
 
 	// Emitter-level data (this is the same for all particles)
 	DirectX::XMFLOAT3 emitterAcceleration;
@@ -94,6 +101,7 @@ public:
 	float startSize;
 	float endSize;
 	bool constrainYAxis;
+	bool sortByDepth; // Back to front, needed for alpha blending
 
 	// Particle randomization ranges
 	DirectX::XMFLOAT3 positionRandomRange;
@@ -119,6 +127,11 @@ private:
 	bool visible;
 	float totalEmitterTime;
 
+	// Each particle's random numbers come from this seed and
+	// how many particles were emitted before it
+	unsigned int randomSeed;
+	unsigned int emittedCount;
+
 	// Sprite sheet options
 	int spriteSheetWidth;
 	int spriteSheetHeight;
@@ -144,11 +157,19 @@ private:
 	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> particleDrawSRV;
 	Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView> particleDrawUAV;
 
+	// Depth sorting related buffers and views
+	int sortSize;
+	Microsoft::WRL::ComPtr<ID3D11Buffer> drawListCounterBuffer;
+	Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView> sortListUAV;
+
 	// Compute shaders
 	std::shared_ptr<SimpleComputeShader> emitCS;
 	std::shared_ptr<SimpleComputeShader> updateCS;
 	std::shared_ptr<SimpleComputeShader> deadListInitCS;
 	std::shared_ptr<SimpleComputeShader> copyDrawCountCS;
+	std::shared_ptr<SimpleComputeShader> sortKeysCS;
+	std::shared_ptr<SimpleComputeShader> bitonicSortCS;
+	std::shared_ptr<SimpleComputeShader> bitonicSortLocalCS;
 	
 	// Material & transform
 	Transform transform;
@@ -156,6 +177,9 @@ private:
 
 	// Creation and copy methods
 	void CreateGPUResources();
+
+	// Sorts the draw list back to front
+	void SortDrawList(std::shared_ptr<Camera> camera);
 	
 };
 
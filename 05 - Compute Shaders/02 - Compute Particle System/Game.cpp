@@ -44,7 +44,8 @@ Game::Game(HINSTANCE hInstance)
 		true),				// Show extra stats (fps) in title bar?
 	ambientColor(0, 0, 0), // Ambient is zero'd out since it's not physically-based
 	lightCount(3),
-	useFlowEmitter(false)
+	useFlowEmitter(false),
+	alphaBlendParticles(false)
 {
 	// Seed random
 	srand((unsigned int)time(0));
@@ -243,6 +244,12 @@ void Game::LoadAssetsAndCreateEntities()
 	blend.RenderTarget[0].RenderTargetWriteMask = D3D11_COLOR_WRITE_ENABLE_ALL;
 	device->CreateBlendState(&blend, particleBlendState.GetAddressOf());
 
+	// Blend for particles (regular alpha blending) - only
+	// looks right when particles are drawn back to front
+	blend.RenderTarget[0].DestBlend = D3D11_BLEND_INV_SRC_ALPHA;
+	blend.RenderTarget[0].DestBlendAlpha = D3D11_BLEND_INV_SRC_ALPHA;
+	device->CreateBlendState(&blend, particleAlphaBlendState.GetAddressOf());
+
 	// Debug rasterizer state for particles
 	D3D11_RASTERIZER_DESC rd = {};
 	rd.CullMode = D3D11_CULL_BACK;
@@ -256,6 +263,9 @@ void Game::LoadAssetsAndCreateEntities()
 	std::shared_ptr<SimpleComputeShader> updateCS = std::make_shared<SimpleComputeShader>(device, context, FixPath(L"ParticleUpdateCS.cso").c_str());
 	std::shared_ptr<SimpleComputeShader> deadListInitCS = std::make_shared<SimpleComputeShader>(device, context, FixPath(L"ParticleDeadListInitCS.cso").c_str());
 	std::shared_ptr<SimpleComputeShader> copyDrawCountCS = std::make_shared<SimpleComputeShader>(device, context, FixPath(L"ParticleCopyDrawCountCS.cso").c_str());
+	std::shared_ptr<SimpleComputeShader> sortKeysCS = std::make_shared<SimpleComputeShader>(device, context, FixPath(L"ParticleSortKeysCS.cso").c_str());
+	std::shared_ptr<SimpleComputeShader> bitonicSortCS = std::make_shared<SimpleComputeShader>(device, context, FixPath(L"ParticleBitonicSortCS.cso").c_str());
+	std::shared_ptr<SimpleComputeShader> bitonicSortLocalCS = std::make_shared<SimpleComputeShader>(device, context, FixPath(L"ParticleBitonicSortLocalCS.cso").c_str());
 
 	std::shared_ptr<SimpleComputeShader> flowEmitCS = std::make_shared<SimpleComputeShader>(device, context, FixPath(L"ParticleFlowEmitCS.cso").c_str());
 	std::shared_ptr<SimpleComputeShader> flowUpdateCS = std::make_shared<SimpleComputeShader>(device, context, FixPath(L"ParticleFlowUpdateCS.cso").c_str());
@@ -268,6 +278,9 @@ void Game::LoadAssetsAndCreateEntities()
 		updateCS,
 		deadListInitCS,
 		copyDrawCountCS,
+		sortKeysCS,
+		bitonicSortCS,
+		bitonicSortLocalCS,
 		160,							// Max particles
 		30,								// Particles per second
 		5.0f,							// Particle lifetime
@@ -292,6 +305,9 @@ void Game::LoadAssetsAndCreateEntities()
 		updateCS,
 		deadListInitCS,
 		copyDrawCountCS,
+		sortKeysCS,
+		bitonicSortCS,
+		bitonicSortLocalCS,
 		45,								// Max particles
 		20,								// Particles per second
 		2.0f,							// Particle lifetime
@@ -316,6 +332,9 @@ void Game::LoadAssetsAndCreateEntities()
 		updateCS,
 		deadListInitCS,
 		copyDrawCountCS,
+		sortKeysCS,
+		bitonicSortCS,
+		bitonicSortLocalCS,
 		250,							// Max particles
 		100,							// Particles per second
 		2.0f,							// Particle lifetime
@@ -341,6 +360,9 @@ void Game::LoadAssetsAndCreateEntities()
 		updateCS,
 		deadListInitCS,
 		copyDrawCountCS,
+		sortKeysCS,
+		bitonicSortCS,
+		bitonicSortLocalCS,
 		5,						// Max particles
 		2,						// Particles per second
 		2.0f,					// Particle lifetime
@@ -367,6 +389,9 @@ void Game::LoadAssetsAndCreateEntities()
 		flowUpdateCS,
 		deadListInitCS,
 		copyDrawCountCS,
+		sortKeysCS,
+		bitonicSortCS,
+		bitonicSortLocalCS,
 		1000000,				// Max particles
 		100000,					// Particles per second
 		60.0f,					// Particle lifetime
@@ -471,10 +496,10 @@ void Game::Update(float deltaTime, float totalTime)
 
 	// Update all emitters
 	if (useFlowEmitter)
-		flowEmitter->Update(deltaTime, totalTime);
+		flowEmitter->Update(deltaTime, totalTime, camera);
 	else
 		for (auto& e : emitters)
-			e->Update(deltaTime, totalTime);
+			e->Update(deltaTime, totalTime, camera);
 
 	// Create the UI during update!
 	CreateUI(deltaTime);
@@ -530,6 +555,14 @@ void Game::CreateUI(float dt)
 			flowEmitter->SetPaused(!useFlowEmitter);
 		}
 
+		// Alpha blending needs every emitter sorted back to front
+		if (ImGui::Checkbox("Alpha Blending (instead of Additive)", &alphaBlendParticles))
+		{
+			flowEmitter->sortByDepth = alphaBlendParticles;
+			for (auto& e : emitters)
+				e->sortByDepth = alphaBlendParticles;
+		}
+
 		if (useFlowEmitter)
 			UIEmitter(flowEmitter, 0);
 		else
@@ -571,6 +604,11 @@ void Game::UIEmitter(std::shared_ptr<Emitter> emitter, int index)
 
 			ImGui::SliderFloat("Lifetime", &emitter->lifetime, 0.1f, 25.0f);
 
+			int seed = (int)emitter->GetRandomSeed();
+			ImGui::InputInt("Random Seed", &seed);
+			if (ImGui::Button("Restart From Seed"))
+				emitter->Restart((unsigned int)seed);
+
 			ImGui::Indent(-5.0f);
 		}
 
@@ -621,6 +659,7 @@ void Game::UIEmitter(std::shared_ptr<Emitter> emitter, int index)
 				0.01f);
 
 			ImGui::Checkbox("Constrain Rotation on Y", &emitter->constrainYAxis);
+			ImGui::Checkbox("Sort Back to Front", &emitter->sortByDepth);
 
 			if (emitter->IsSpriteSheet())
 			{
@@ -699,7 +738,9 @@ void Game::DrawParticles(float totalTime)
 	{
 
 		// Particle states
-		context->OMSetBlendState(particleBlendState.Get(), 0, 0xffffffff);	// Additive blending
+		context->OMSetBlendState(
+			alphaBlendParticles ? particleAlphaBlendState.Get() : particleBlendState.Get(),
+			0, 0xffffffff);
 		context->OMSetDepthStencilState(particleDepthState.Get(), 0);		// No depth WRITING
 
 		// Draw all of the emitters
@@ -42,10 +42,12 @@ private:
 	// Particles
 	Microsoft::WRL::ComPtr<ID3D11DepthStencilState> particleDepthState;
 	Microsoft::WRL::ComPtr<ID3D11BlendState> particleBlendState;
+	Microsoft::WRL::ComPtr<ID3D11BlendState> particleAlphaBlendState;
 	Microsoft::WRL::ComPtr<ID3D11RasterizerState> particleDebugRasterState;
 	std::vector<std::shared_ptr<Emitter>> emitters;
 	std::shared_ptr<Emitter> flowEmitter;
 	bool useFlowEmitter;
+	bool alphaBlendParticles;
 
 	void DrawParticles(float totalTime);
 
@@ -0,0 +1,37 @@
+
+cbuffer ExternalData : register(b0)
+{
+	uint SortSize;
+	uint BlockSize;
+	uint CompareDistance;
+}
+
+// Pairs of (key, particle index), sorted by key
+RWStructuredBuffer<uint2>	SortList	: register(u0);
+
+// One step of a bitonic sort across the whole list.  Only used
+// when the entries being compared are too far apart to fit in
+// one thread group - ParticleBitonicSortLocalCS handles the rest.
+[numthreads(256, 1, 1)]
+void main( uint3 id : SV_DispatchThreadID )
+{
+	// Each thread compares exactly one pair
+	if (id.x >= SortSize / 2)
+		return;
+
+	// First index of this thread's pair, and its partner
+	uint i = (id.x / CompareDistance) * CompareDistance * 2 + (id.x % CompareDistance);
+	uint j = i + CompareDistance;
+
+	// Blocks alternate between ascending and descending
+	// so that each pair of them forms a bitonic sequence
+	bool ascending = (i & BlockSize) == 0;
+
+	uint2 a = SortList[i];
+	uint2 b = SortList[j];
+	if ((a.x > b.x) == ascending)
+	{
+		SortList[i] = b;
+		SortList[j] = a;
+	}
+}
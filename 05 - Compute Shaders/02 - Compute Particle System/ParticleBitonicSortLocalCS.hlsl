@@ -0,0 +1,78 @@
+
+// How many entries each thread group sorts in shared memory
+// - Two per thread, and must match BITONIC_LOCAL_SIZE in Emitter.h
+#define LOCAL_SIZE 1024
+
+cbuffer ExternalData : register(b0)
+{
+	uint FirstBlockSize;
+	uint LastBlockSize;
+	int WriteDrawList;
+}
+
+cbuffer DrawListCounterBuffer : register(b1)
+{
+	uint DrawListCounter;
+}
+
+// Pairs of (key, particle index), sorted by key
+RWStructuredBuffer<uint2>	SortList	: register(u0);
+RWStructuredBuffer<uint>	DrawList	: register(u1);
+
+groupshared uint2 LocalList[LOCAL_SIZE];
+
+// Compares and swaps one pair in shared memory
+void CompareAndSwap(uint groupStart, uint thread, uint blockSize, uint compareDistance)
+{
+	uint i = (thread / compareDistance) * compareDistance * 2 + (thread % compareDistance);
+	uint j = i + compareDistance;
+	bool ascending = ((groupStart + i) & blockSize) == 0;
+
+	uint2 a = LocalList[i];
+	uint2 b = LocalList[j];
+	if ((a.x > b.x) == ascending)
+	{
+		LocalList[i] = b;
+		LocalList[j] = a;
+	}
+}
+
+// Every bitonic step whose pairs are within LOCAL_SIZE entries
+// of each other, run in shared memory with one dispatch.
+// - FirstBlockSize = 2, LastBlockSize = LOCAL_SIZE sorts each chunk from scratch
+// - FirstBlockSize = LastBlockSize = N finishes a merge of size N, once
+//   ParticleBitonicSortCS has done the steps that span more than one chunk
+[numthreads(LOCAL_SIZE / 2, 1, 1)]
+void main( uint3 groupID : SV_GroupID, uint3 threadID : SV_GroupThreadID )
+{
+	uint groupStart = groupID.x * LOCAL_SIZE;
+	uint t = threadID.x;
+
+	// Each thread loads two entries
+	LocalList[t] = SortList[groupStart + t];
+	LocalList[t + LOCAL_SIZE / 2] = SortList[groupStart + t + LOCAL_SIZE / 2];
+	GroupMemoryBarrierWithGroupSync();
+
+	for (uint blockSize = FirstBlockSize; blockSize <= LastBlockSize; blockSize *= 2)
+	{
+		for (uint compareDistance = min(blockSize / 2, LOCAL_SIZE / 2); compareDistance > 0; compareDistance /= 2)
+		{
+			CompareAndSwap(groupStart, t, blockSize, compareDistance);
+			GroupMemoryBarrierWithGroupSync();
+		}
+	}
+
+	// Put the results back
+	SortList[groupStart + t] = LocalList[t];
+	SortList[groupStart + t + LOCAL_SIZE / 2] = LocalList[t + LOCAL_SIZE / 2];
+
+	// On the very last step, the list is fully sorted, so
+	// overwrite the living part of the draw list in order
+	if (WriteDrawList)
+	{
+		if (groupStart + t < DrawListCounter)
+			DrawList[groupStart + t] = LocalList[t].y;
+		if (groupStart + t + LOCAL_SIZE / 2 < DrawListCounter)
+			DrawList[groupStart + t + LOCAL_SIZE / 2] = LocalList[t + LOCAL_SIZE / 2].y;
+	}
+}
@@ -17,6 +17,9 @@ cbuffer ExternalData : register(b0)
 
 	float2 RotStartMinMax;
 	float2 RotEndMinMax;
+
+	uint RandomSeed;
+	uint EmittedCount;
 }
 
 cbuffer DeadListCounterBuffer : register(b1)
@@ -49,9 +52,11 @@ void main( uint3 id : SV_DispatchThreadID )
 	emitParticle.StartVelocity = StartVelocity;
 	emitParticle.ColorTint = float3(1,1,1);
 
-	// Seed for random uses the emit index, so each
-	// unique particle has its own seed
-	uint rng = emitIndex;
+	// Seed for random uses the emitter's seed and how many
+	// particles it has emitted before this one, so every
+	// particle gets its own numbers (even when reusing a
+	// slot in the pool) and a seed always replays the same
+	uint rng = hash_pcg(RandomSeed ^ hash_pcg(EmittedCount + id.x));
 
 	// Generate random numbers
 	emitParticle.StartPosition.x += PosRandomRange.x * rand_float(rng, -1.0f, 1.0f);
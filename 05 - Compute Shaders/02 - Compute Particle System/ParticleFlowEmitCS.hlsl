@@ -17,6 +17,9 @@ cbuffer ExternalData : register(b0)
 
 	float2 RotStartMinMax;
 	float2 RotEndMinMax;
+
+	uint RandomSeed;
+	uint EmittedCount;
 }
 
 cbuffer DeadListCounterBuffer : register(b1)
@@ -48,9 +51,11 @@ void main( uint3 id : SV_DispatchThreadID )
 	emitParticle.StartPosition = StartPosition;
 	emitParticle.StartVelocity = StartVelocity;
 	
-	// Seed for random uses the emit index, so each
-	// unique particle has its own seed
-	uint rng = emitIndex;
+	// Seed for random uses the emitter's seed and how many
+	// particles it has emitted before this one, so every
+	// particle gets its own numbers (even when reusing a
+	// slot in the pool) and a seed always replays the same
+	uint rng = hash_pcg(RandomSeed ^ hash_pcg(EmittedCount + id.x));
 
 	// Create a random starting position value (to be scaled later)
 	// and use it to tint the particles based on location
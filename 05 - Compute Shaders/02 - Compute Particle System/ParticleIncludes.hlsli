@@ -31,6 +31,15 @@ uint rand_pcg(inout uint rng_state)
 	return (word >> 22u) ^ word;
 }
 
+// A single PCG step as a hash, for turning a sequence
+// number into a well mixed starting state
+uint hash_pcg(uint input)
+{
+	uint state = input * 747796405u + 2891336453u;
+	uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+	return (word >> 22u) ^ word;
+}
+
 float rand_float(inout uint rng_state)
 {
 	return rand_pcg(rng_state) * uint2float;
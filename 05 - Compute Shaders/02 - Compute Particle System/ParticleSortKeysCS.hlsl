@@ -0,0 +1,59 @@
+
+#include "ParticleIncludes.hlsli"
+
+cbuffer ExternalData : register(b0)
+{
+	matrix View;
+
+	float3 Acceleration;
+	float CurrentTime;
+
+	uint SortSize;
+}
+
+cbuffer DrawListCounterBuffer : register(b1)
+{
+	uint DrawListCounter;
+}
+
+StructuredBuffer<Particle>		ParticlePool	: register(t0);
+StructuredBuffer<uint>			DrawList		: register(t1);
+RWStructuredBuffer<uint2>		SortList		: register(u0);
+
+// Turns a float into a uint that sorts in the same order
+// - Negative floats have every bit flipped (so bigger negatives sort lower)
+// - Positive floats just have the sign bit flipped (so they sort above negatives)
+uint FloatToSortableUint(float f)
+{
+	uint bits = asuint(f);
+	uint mask = (bits & 0x80000000) ? 0xFFFFFFFF : 0x80000000;
+	return bits ^ mask;
+}
+
+[numthreads(256, 1, 1)]
+void main( uint3 id : SV_DispatchThreadID )
+{
+	// Valid sort entry?
+	if (id.x >= SortSize)
+		return;
+
+	// Entries past the living particles get the largest
+	// possible key so they end up after every real one
+	if (id.x >= DrawListCounter)
+	{
+		SortList[id.x] = uint2(0xFFFFFFFF, 0);
+		return;
+	}
+
+	// Same position as the vertex shader will calculate
+	uint particleID = DrawList.Load(id.x);
+	Particle p = ParticlePool.Load(particleID);
+	float age = CurrentTime - p.EmitTime;
+	float3 pos = Acceleration * age * age / 2.0f + p.StartVelocity * age + p.StartPosition;
+
+	// View space Z is the distance along the camera's forward vector.
+	// Flipping the key means an ascending sort puts the farthest
+	// particle first, which is the back-to-front order we draw in.
+	float viewZ = mul(View, float4(pos, 1.0f)).z;
+	SortList[id.x] = uint2(~FloatToSortableUint(viewZ), particleID);
+}
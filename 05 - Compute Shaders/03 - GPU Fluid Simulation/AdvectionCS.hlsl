@@ -9,6 +9,7 @@ cbuffer externalData : register(b0)
 	int gridSizeZ;
 	int channelCount;
 	float damper;
+	int outputType;
 }
 
 Texture3D			VelocityIn		: register(t0);
@@ -19,14 +20,24 @@ RWTexture3D<float2> AdvectionOut2	: register(u1);
 RWTexture3D<float3> AdvectionOut3	: register(u2);
 RWTexture3D<float4> AdvectionOut4	: register(u3);
 
+// Fixed point volumes (density and temperature) are only
+// ever one or four channels
+RWTexture3D<unorm float>	AdvectionOut1Unorm	: register(u4);
+RWTexture3D<unorm float4>	AdvectionOut4Unorm	: register(u5);
+RWTexture3D<snorm float>	AdvectionOut1Snorm	: register(u6);
+RWTexture3D<snorm float4>	AdvectionOut4Snorm	: register(u7);
+
 SamplerState SamplerLinearClamp		: register(s0);
 
 [numthreads(
 	FLUID_COMPUTE_THREADS_PER_AXIS, 
 	FLUID_COMPUTE_THREADS_PER_AXIS, 
 	FLUID_COMPUTE_THREADS_PER_AXIS)]
-void main( uint3 id : SV_DispatchThreadID )
+void main(uint3 groupID : SV_GroupID, uint3 groupThreadID : SV_GroupThreadID)
 {
+	// This thread's cell, in whichever brick this group covers
+	uint3 id = GetCellIndex(groupID, groupThreadID);
+
 	// Check for obstacle at this cell
 	if (ObstaclesIn[id].r > 0.0f)
 		return;
@@ -40,12 +51,28 @@ void main( uint3 id : SV_DispatchThreadID )
 	// Convert position to UVW coords ([0-1] range)
 	float3 posUVW = PixelIndexToUVW(posInGrid, gridSizeX, gridSizeY, gridSizeZ);
 
-	// Which dimension?
+	float4 result = damper * AdvectionIn.SampleLevel(SamplerLinearClamp, posUVW, 0);
+
+	// Which type and dimension?
+	if (outputType == VOLUME_UAV_UNORM)
+	{
+		if (channelCount == 1) AdvectionOut1Unorm[id] = result.r;
+		else AdvectionOut4Unorm[id] = result;
+		return;
+	}
+
+	if (outputType == VOLUME_UAV_SNORM)
+	{
+		if (channelCount == 1) AdvectionOut1Snorm[id] = result.r;
+		else AdvectionOut4Snorm[id] = result;
+		return;
+	}
+
 	switch (channelCount)
 	{
-	case 1: AdvectionOut1[id] = damper * AdvectionIn.SampleLevel(SamplerLinearClamp, posUVW, 0).r; break;
-	case 2:	AdvectionOut2[id] = damper * AdvectionIn.SampleLevel(SamplerLinearClamp, posUVW, 0).rg; break;
-	case 3:	AdvectionOut3[id] = damper * AdvectionIn.SampleLevel(SamplerLinearClamp, posUVW, 0).rgb; break;
-	case 4:	AdvectionOut4[id] = damper * AdvectionIn.SampleLevel(SamplerLinearClamp, posUVW, 0); break;
+	case 1: AdvectionOut1[id] = result.r; break;
+	case 2:	AdvectionOut2[id] = result.rg; break;
+	case 3:	AdvectionOut3[id] = result.rgb; break;
+	case 4:	AdvectionOut4[id] = result; break;
 	}
 }
\ No newline at end of file
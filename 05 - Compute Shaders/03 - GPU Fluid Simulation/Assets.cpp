@@ -18,6 +18,9 @@ Assets::~Assets()
 	for (auto& p : pixelShaders) delete p.second;
 	for (auto& v : vertexShaders) delete v.second;
 	for (auto& c : computeShaders) delete c.second;
+
+	// So GetInstance() can start over (on another device)
+	instance = 0;
 }
 
 
@@ -0,0 +1,51 @@
+
+#include "ComputeHelpers.hlsli"
+
+cbuffer externalData : register(b0)
+{
+	int gridSizeX;
+	int gridSizeY;
+	int gridSizeZ;
+	float densityThreshold;
+
+	float3 injectPosition;	// In UV coords
+	float injectRadius;		// In UV coords, zero when not injecting
+
+	float velocityThreshold;
+	float densityScale;		// Density is stored divided by this
+}
+
+Texture3D				DensityIn			: register(t0);
+Texture3D				VelocityIn			: register(t1);
+RWTexture3D<uint>		BrickActivityOut	: register(u0);
+
+groupshared uint brickActive;
+
+// One group per brick
+[numthreads(
+	FLUID_COMPUTE_THREADS_PER_AXIS,
+	FLUID_COMPUTE_THREADS_PER_AXIS,
+	FLUID_COMPUTE_THREADS_PER_AXIS)]
+void main(uint3 id : SV_DispatchThreadID, uint3 groupID : SV_GroupID, uint groupIndex : SV_GroupIndex)
+{
+	if (groupIndex == 0)
+		brickActive = 0;
+	GroupMemoryBarrierWithGroupSync();
+
+	// Is there anything worth simulating in this cell?  The inject
+	// test matches InjectSmokeCS, so cells about to get smoke count
+	if (all(id < uint3(gridSizeX, gridSizeY, gridSizeZ)))
+	{
+		float3 velocity = VelocityIn[id].xyz;
+		float3 posUVW = PixelIndexToUVW(id, gridSizeX, gridSizeY, gridSizeZ);
+
+		if (DensityIn[id].a * densityScale > densityThreshold ||
+			dot(velocity, velocity) > velocityThreshold * velocityThreshold ||
+			injectRadius - length(posUVW - injectPosition) > 0.0f)
+			InterlockedOr(brickActive, 1);
+	}
+
+	GroupMemoryBarrierWithGroupSync();
+	if (groupIndex == 0)
+		BrickActivityOut[groupID] = brickActive;
+}
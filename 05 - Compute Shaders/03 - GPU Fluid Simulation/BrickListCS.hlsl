@@ -0,0 +1,49 @@
+
+#include "ComputeHelpers.hlsli"
+
+cbuffer externalData : register(b0)
+{
+	int brickCountX;
+	int brickCountY;
+	int brickCountZ;
+	int brickDilation;
+}
+
+Texture3D<uint>				BrickActivityIn		: register(t0);
+RWTexture3D<uint>			BrickSimulated		: register(u0);
+RWStructuredBuffer<uint>	ActiveBricksOut		: register(u1);
+RWStructuredBuffer<uint>	RetiredBricksOut	: register(u2);
+
+// One thread per brick
+[numthreads(
+	FLUID_COMPUTE_THREADS_PER_AXIS,
+	FLUID_COMPUTE_THREADS_PER_AXIS,
+	FLUID_COMPUTE_THREADS_PER_AXIS)]
+void main(uint3 id : SV_DispatchThreadID)
+{
+	int3 brickCounts = int3(brickCountX, brickCountY, brickCountZ);
+	if (any(id >= (uint3)brickCounts))
+		return;
+
+	// Simulate this brick if any brick within the dilation
+	// distance is active, so the fluid has room to move into
+	int3 start = max((int3)id - brickDilation, 0);
+	int3 end = min((int3)id + brickDilation, brickCounts - 1);
+	bool active = false;
+	[loop]
+	for (int z = start.z; z <= end.z && !active; z++)
+		[loop]
+		for (int y = start.y; y <= end.y && !active; y++)
+			[loop]
+			for (int x = start.x; x <= end.x && !active; x++)
+				active = BrickActivityIn[int3(x, y, z)] != 0;
+
+	// Bricks that just stopped being simulated get retired (cleared),
+	// since their other ping-pong buffers may still hold older values
+	if (active)
+		ActiveBricksOut[ActiveBricksOut.IncrementCounter()] = PackBrick(id);
+	else if (BrickSimulated[id])
+		RetiredBricksOut[RetiredBricksOut.IncrementCounter()] = PackBrick(id);
+
+	BrickSimulated[id] = active;
+}
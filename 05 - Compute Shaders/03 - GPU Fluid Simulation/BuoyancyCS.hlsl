@@ -6,6 +6,8 @@ cbuffer externalData : register(b0)
 	float densityWeight;
 	float temperatureBuoyancy;
 	float ambientTemperature;
+	float densityScale;		// Density and temperature are stored divided by these
+	float temperatureScale;
 }
 
 Texture3D			VelocityIn		: register(t0);
@@ -18,15 +20,18 @@ RWTexture3D<float4> VelocityOut		: register(u0);
 	FLUID_COMPUTE_THREADS_PER_AXIS,
 	FLUID_COMPUTE_THREADS_PER_AXIS,
 	FLUID_COMPUTE_THREADS_PER_AXIS)]
-void main(uint3 id : SV_DispatchThreadID)
+void main(uint3 groupID : SV_GroupID, uint3 groupThreadID : SV_GroupThreadID)
 {
+	// This thread's cell, in whichever brick this group covers
+	uint3 id = GetCellIndex(groupID, groupThreadID);
+
 	// Check for obstacle at this cell
 	if (ObstaclesIn[id].r > 0.0f)
 		return;
 
 	// Grab the temperature
-	float thisTemp = TemperatureIn[id].r;
-	float density = DensityIn[id].a;
+	float thisTemp = TemperatureIn[id].r * temperatureScale;
+	float density = DensityIn[id].a * densityScale;
 
 	// From: http://web.stanford.edu/class/cs237d/smoke.pdf
 	float3 buoyancyForce = float3(0, 1, 0) *
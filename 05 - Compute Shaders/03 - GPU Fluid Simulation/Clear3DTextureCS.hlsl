@@ -5,6 +5,7 @@ cbuffer externalData : register(b0)
 {
 	float4 clearColor;
 	int channelCount;
+	int outputType;
 }
 
 RWTexture3D<float>  ClearOut1	: register(u0);
@@ -12,13 +13,35 @@ RWTexture3D<float2> ClearOut2	: register(u1);
 RWTexture3D<float3> ClearOut3	: register(u2);
 RWTexture3D<float4> ClearOut4	: register(u3);
 
+RWTexture3D<unorm float>	ClearOut1Unorm	: register(u4);
+RWTexture3D<unorm float4>	ClearOut4Unorm	: register(u5);
+RWTexture3D<snorm float>	ClearOut1Snorm	: register(u6);
+RWTexture3D<snorm float4>	ClearOut4Snorm	: register(u7);
+
 [numthreads(
 	FLUID_COMPUTE_THREADS_PER_AXIS,
 	FLUID_COMPUTE_THREADS_PER_AXIS,
 	FLUID_COMPUTE_THREADS_PER_AXIS)]
-void main(uint3 id : SV_DispatchThreadID)
+void main(uint3 groupID : SV_GroupID, uint3 groupThreadID : SV_GroupThreadID)
 {
-	// Which dimension?
+	// This thread's cell, in whichever brick this group covers
+	uint3 id = GetCellIndex(groupID, groupThreadID);
+
+	// Which type and dimension?
+	if (outputType == VOLUME_UAV_UNORM)
+	{
+		if (channelCount == 1) ClearOut1Unorm[id] = clearColor.r;
+		else ClearOut4Unorm[id] = clearColor;
+		return;
+	}
+
+	if (outputType == VOLUME_UAV_SNORM)
+	{
+		if (channelCount == 1) ClearOut1Snorm[id] = clearColor.r;
+		else ClearOut4Snorm[id] = clearColor;
+		return;
+	}
+
 	switch (channelCount)
 	{
 	case 1: ClearOut1[id] = clearColor.r; break;
@@ -3,6 +3,39 @@
 
 #define FLUID_COMPUTE_THREADS_PER_AXIS 8
 
+// Which UAV a volume is written through - fixed point
+// formats need unorm/snorm return types (match FluidField.h)
+#define VOLUME_UAV_FLOAT 0
+#define VOLUME_UAV_UNORM 1
+#define VOLUME_UAV_SNORM 2
+
+// Sparse simulation: each group is one 8x8x8 brick of the
+// grid, either the brick matching its group ID (dense) or
+// the one at the group's index in the active brick list
+cbuffer brickData : register(b1)
+{
+	int useActiveBricks;
+}
+
+StructuredBuffer<uint> ActiveBricks : register(t8);
+
+// Bricks are packed 10 bits per axis (see FluidBricks)
+uint PackBrick(uint3 brick)
+{
+	return brick.x | (brick.y << 10) | (brick.z << 20);
+}
+
+uint3 UnpackBrick(uint packed)
+{
+	return uint3(packed & 1023, (packed >> 10) & 1023, packed >> 20);
+}
+
+uint3 GetCellIndex(uint3 groupID, uint3 groupThreadID)
+{
+	uint3 brick = useActiveBricks ? UnpackBrick(ActiveBricks[groupID.x]) : groupID;
+	return brick * FLUID_COMPUTE_THREADS_PER_AXIS + groupThreadID;
+}
+
 
 float3 PixelIndexToUVW(float3 index, int gridSizeX, int gridSizeY, int gridSizeZ)
 {
@@ -19,8 +19,11 @@ RWTexture3D<float4>	VelocityOut		: register(u0);
 	FLUID_COMPUTE_THREADS_PER_AXIS,
 	FLUID_COMPUTE_THREADS_PER_AXIS,
 	FLUID_COMPUTE_THREADS_PER_AXIS)]
-void main(uint3 id : SV_DispatchThreadID)
+void main(uint3 groupID : SV_GroupID, uint3 groupThreadID : SV_GroupThreadID)
 {
+	// This thread's cell, in whichever brick this group covers
+	uint3 id = GetCellIndex(groupID, groupThreadID);
+
 	//// Check for obstacle at this cell
 	//if (ObstaclesIn[id].r > 0.0f)
 	//	return;
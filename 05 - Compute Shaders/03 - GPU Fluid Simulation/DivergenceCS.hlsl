@@ -16,8 +16,11 @@ RWTexture3D<float>	DivergenceOut	: register(u0);
 	FLUID_COMPUTE_THREADS_PER_AXIS,
 	FLUID_COMPUTE_THREADS_PER_AXIS,
 	FLUID_COMPUTE_THREADS_PER_AXIS)]
-void main(uint3 id : SV_DispatchThreadID)
+void main(uint3 groupID : SV_GroupID, uint3 groupThreadID : SV_GroupThreadID)
 {
+	// This thread's cell, in whichever brick this group covers
+	uint3 id = GetCellIndex(groupID, groupThreadID);
+
 	// Indices of surrounding pixels
 	uint3 idL = GetLeftIndex(id);
 	uint3 idR = GetRightIndex(id, gridSizeX);
@@ -0,0 +1,123 @@
+#include "FluidBricks.h"
+
+#include <cmath>
+#include <algorithm>
+
+
+FluidBricks::FluidBricks(int sizeX, int sizeY, int sizeZ) :
+	sizeX(sizeX),
+	sizeY(sizeY),
+	sizeZ(sizeZ)
+{
+	brickCountX = (sizeX + FLUID_BRICK_SIZE - 1) / FLUID_BRICK_SIZE;
+	brickCountY = (sizeY + FLUID_BRICK_SIZE - 1) / FLUID_BRICK_SIZE;
+	brickCountZ = (sizeZ + FLUID_BRICK_SIZE - 1) / FLUID_BRICK_SIZE;
+	brickActivity.resize((size_t)brickCountX * brickCountY * brickCountZ);
+	brickSimulated.resize(brickActivity.size());
+	Reset();
+}
+
+// --------------------------------------------------------
+// Treats every brick as simulated so far, so the next update
+// retires all of the inactive ones.  For when the owner has
+// been simulating densely.
+// --------------------------------------------------------
+void FluidBricks::Reset()
+{
+	std::fill(brickSimulated.begin(), brickSimulated.end(), (unsigned char)1);
+}
+
+int FluidBricks::GetBrickCountX() { return brickCountX; }
+int FluidBricks::GetBrickCountY() { return brickCountY; }
+int FluidBricks::GetBrickCountZ() { return brickCountZ; }
+int FluidBricks::GetBrickCount() { return (int)brickActivity.size(); }
+const std::vector<unsigned int>& FluidBricks::GetActiveBricks() { return activeBricks; }
+const std::vector<unsigned int>& FluidBricks::GetRetiredBricks() { return retiredBricks; }
+
+unsigned int FluidBricks::PackBrick(int x, int y, int z)
+{
+	return (unsigned int)x | ((unsigned int)y << 10) | ((unsigned int)z << 20);
+}
+
+void FluidBricks::UnpackBrick(unsigned int brick, int& x, int& y, int& z)
+{
+	x = brick & 1023;
+	y = (brick >> 10) & 1023;
+	z = brick >> 20;
+}
+
+
+// --------------------------------------------------------
+// Rebuilds the lists of bricks to simulate and bricks to
+// retire from the current density and velocity (flat arrays,
+// one value per cell)
+//
+// densityThreshold - Density (alpha) a cell must be above
+// velocityThreshold - Speed, in cells per second, a cell
+//                     must be above
+// dilation - Bricks around each active brick to simulate too
+// injectPosition - Center of the injection sphere, in UVW
+// injectRadius - Radius of the sphere, in UVW, or zero when
+//                nothing is being injected
+// --------------------------------------------------------
+void FluidBricks::Update(
+	const float* density,
+	const float* velocityX,
+	const float* velocityY,
+	const float* velocityZ,
+	float densityThreshold,
+	float velocityThreshold,
+	int dilation,
+	const float injectPosition[3],
+	float injectRadius)
+{
+	// Activity of each brick (BrickActivityCS)
+	std::fill(brickActivity.begin(), brickActivity.end(), (unsigned char)0);
+	float velocityThresholdSquared = velocityThreshold * velocityThreshold;
+	for (int z = 0; z < sizeZ; z++)
+		for (int y = 0; y < sizeY; y++)
+			for (int x = 0; x < sizeX; x++)
+			{
+				int brick = x / FLUID_BRICK_SIZE + brickCountX * (y / FLUID_BRICK_SIZE + brickCountY * (z / FLUID_BRICK_SIZE));
+				if (brickActivity[brick])
+					continue;
+
+				int index = x + sizeX * (y + sizeY * z);
+				float vx = velocityX[index];
+				float vy = velocityY[index];
+				float vz = velocityZ[index];
+
+				// Same distance as InjectSmokeCS, so a cell is active
+				// exactly when it's about to get smoke
+				float dx = (x + 0.5f) / sizeX - injectPosition[0];
+				float dy = (y + 0.5f) / sizeY - injectPosition[1];
+				float dz = (z + 0.5f) / sizeZ - injectPosition[2];
+				float injectDistance = sqrtf(dx * dx + dy * dy + dz * dz);
+
+				if (density[index] > densityThreshold ||
+					vx * vx + vy * vy + vz * vz > velocityThresholdSquared ||
+					injectRadius - injectDistance > 0.0f)
+					brickActivity[brick] = 1;
+			}
+
+	// Dilate into the lists (BrickListCS)
+	activeBricks.clear();
+	retiredBricks.clear();
+	for (int z = 0; z < brickCountZ; z++)
+		for (int y = 0; y < brickCountY; y++)
+			for (int x = 0; x < brickCountX; x++)
+			{
+				bool active = false;
+				for (int nz = std::max(z - dilation, 0); nz <= std::min(z + dilation, brickCountZ - 1) && !active; nz++)
+					for (int ny = std::max(y - dilation, 0); ny <= std::min(y + dilation, brickCountY - 1) && !active; ny++)
+						for (int nx = std::max(x - dilation, 0); nx <= std::min(x + dilation, brickCountX - 1) && !active; nx++)
+							active = brickActivity[nx + brickCountX * (ny + brickCountY * nz)] != 0;
+
+				int brick = x + brickCountX * (y + brickCountY * z);
+				if (active)
+					activeBricks.push_back(PackBrick(x, y, z));
+				else if (brickSimulated[brick])
+					retiredBricks.push_back(PackBrick(x, y, z));
+				brickSimulated[brick] = active;
+			}
+}
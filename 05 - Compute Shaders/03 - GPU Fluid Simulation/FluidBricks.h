@@ -0,0 +1,67 @@
+#pragma once
+
+#include <vector>
+
+// Cells along each side of a brick - the same as
+// FLUID_COMPUTE_THREADS_PER_AXIS, so a brick is one thread group
+#define FLUID_BRICK_SIZE 8
+
+// --------------------------------------------------------
+// Splits a fluid grid into bricks of 8x8x8 cells and keeps a
+// list of the ones worth simulating.  CPU reference for the
+// BrickActivityCS and BrickListCS shaders.
+//
+// A cell is active if its density or speed is above the
+// thresholds, or it's inside the injection sphere.  A brick
+// is active if any of its cells are, and is simulated if any
+// brick within the dilation distance (in bricks, along each
+// axis) is active, so the fluid always has room to move into.
+//
+// Bricks that stop being simulated are "retired": their
+// cells are all below the thresholds, but the other half of
+// each ping-pong pair may still hold older values that are
+// not, so the owner should clear them.
+//
+// Bricks are packed into one uint like the GPU's list: ten
+// bits each for x, y and z.
+// --------------------------------------------------------
+class FluidBricks
+{
+public:
+	FluidBricks(int sizeX, int sizeY, int sizeZ);
+
+	void Reset();
+	void Update(
+		const float* density,
+		const float* velocityX,
+		const float* velocityY,
+		const float* velocityZ,
+		float densityThreshold,
+		float velocityThreshold,
+		int dilation,
+		const float injectPosition[3],
+		float injectRadius);
+
+	int GetBrickCountX();
+	int GetBrickCountY();
+	int GetBrickCountZ();
+	int GetBrickCount();
+	const std::vector<unsigned int>& GetActiveBricks();
+	const std::vector<unsigned int>& GetRetiredBricks();
+
+	static unsigned int PackBrick(int x, int y, int z);
+	static void UnpackBrick(unsigned int brick, int& x, int& y, int& z);
+
+private:
+	int sizeX;
+	int sizeY;
+	int sizeZ;
+	int brickCountX;
+	int brickCountY;
+	int brickCountZ;
+
+	std::vector<unsigned char> brickActivity;	// Before dilation
+	std::vector<unsigned char> brickSimulated;	// After dilation, as of the last update
+	std::vector<unsigned int> activeBricks;		// In index order
+	std::vector<unsigned int> retiredBricks;	// In index order
+};
@@ -4,6 +4,8 @@
 #include "Mesh.h"
 
 #include <DirectXPackedVector.h>
+#include <cmath>
+#include <cstring>
 
 using namespace DirectX;
 
@@ -30,6 +32,18 @@ FluidField::FluidField(
 	injectSmoke(true),
 	applyVorticity(true),
 	pressureIterations(30),
+	multigridCycles(4),
+	multigridSmoothIterations(2),
+	measurePressureResidual(false),
+	sparseBricks(false),
+	brickDensityThreshold(0.001f),
+	brickVelocityThreshold(1.0f),
+	brickDilation(1),
+	activeBrickCount(0),
+	sparseLastStep(false),
+	formats(FluidFieldCPU::FloatFormats()),
+	divergenceNorm(0.0f),
+	pressureResidualNorm(0.0f),
 	raymarchSamples(128),
 	fixedTimeStep(0.016f),
 	ambientTemperature(0.0f),
@@ -47,17 +61,19 @@ FluidField::FluidField(
 	fluidColor(1.0f, 1.0f, 1.0f),
 	vorticityEpsilon(0.3f),
 	renderBuffer(FLUID_RENDER_BUFFER::FLUID_RENDER_BUFFER_DENSITY),
-	renderMode(FLUID_RENDER_MODE::FLUID_RENDER_MODE_BLEND)
+	renderMode(FLUID_RENDER_MODE::FLUID_RENDER_MODE_BLEND),
+	pressureSolver(FLUID_PRESSURE_SOLVER::FLUID_PRESSURE_SOLVER_MULTIGRID),
+	adaptiveTimeStep(false),
+	gpuSpeedReduction(true),
+	cflNumber(1.0f),
+	maxTimeStep(0.033f),
+	maxSubsteps(4),
+	restSpeed(0.05f),
+	currentTimeStep(0.016f),
+	restParameters(),
+	frameStats(),
+	voxelizer(gridSizeX, gridSizeY, gridSizeZ)
 {
-	// Check for obstacle voxelization capabilities (DX11.3 feature
-	// that allows for render target array index in the vertex shader)
-	D3D11_FEATURE_DATA_D3D11_OPTIONS3 options;
-	device->CheckFeatureSupport(
-		D3D11_FEATURE_D3D11_OPTIONS3,
-		&options,
-		sizeof(D3D11_FEATURE_DATA_D3D11_OPTIONS3));
-	obstaclesEnabled = (bool)options.VPAndRTArrayIndexFromAnyShaderFeedingRasterizer;
-
 	// Set up buffers
 	RecreateGPUResources();
 
@@ -113,20 +129,35 @@ void FluidField::RecreateGPUResources()
 	obstacleBuffer.Reset();
 	levelSetBuffers[0].Reset();
 	levelSetBuffers[1].Reset();
-
-	velocityBuffers[0] = CreateVolumeResource(gridSizeX, gridSizeY, gridSizeZ, DXGI_FORMAT_R32G32B32A32_FLOAT);
-	velocityBuffers[1] = CreateVolumeResource(gridSizeX, gridSizeY, gridSizeZ, DXGI_FORMAT_R32G32B32A32_FLOAT);
+	multigridLevels.clear();
+	residualReadback.Reset();
+	brickActivity.Reset();
+	brickSimulated.Reset();
+	activeBricks.Reset();
+	retiredBricks.Reset();
+	activeBrickCountReadback.Reset();
+	maxSpeedUAV.Reset();
+	maxSpeedReadback.Reset();
+
+	// Simulated quantities use the format policy (divergence and
+	// vorticity are only ever used within a step, so stay float)
+	for (int i = 0; i < 2; i++)
+	{
+		velocityBuffers[i] = CreateVolumeResource(gridSizeX, gridSizeY, gridSizeZ, VolumeFormat(formats.Velocity, 4));
+		pressureBuffers[i] = CreateVolumeResource(gridSizeX, gridSizeY, gridSizeZ, VolumeFormat(formats.Pressure, 1));
+		densityBuffers[i] = CreateVolumeResource(gridSizeX, gridSizeY, gridSizeZ, VolumeFormat(formats.Density, 4));
+		temperatureBuffers[i] = CreateVolumeResource(gridSizeX, gridSizeY, gridSizeZ, VolumeFormat(formats.Temperature, 1));
+		densityBuffers[i].ChannelScale.w = formats.DensityScale;
+		temperatureBuffers[i].ChannelScale.x = formats.TemperatureScale;
+	}
 	divergenceBuffer = CreateVolumeResource(gridSizeX, gridSizeY, gridSizeZ, DXGI_FORMAT_R32_FLOAT);
-	pressureBuffers[0] = CreateVolumeResource(gridSizeX, gridSizeY, gridSizeZ, DXGI_FORMAT_R32_FLOAT);
-	pressureBuffers[1] = CreateVolumeResource(gridSizeX, gridSizeY, gridSizeZ, DXGI_FORMAT_R32_FLOAT);
-	densityBuffers[0] = CreateVolumeResource(gridSizeX, gridSizeY, gridSizeZ, DXGI_FORMAT_R32G32B32A32_FLOAT);
-	densityBuffers[1] = CreateVolumeResource(gridSizeX, gridSizeY, gridSizeZ, DXGI_FORMAT_R32G32B32A32_FLOAT);
-	temperatureBuffers[0] = CreateVolumeResource(gridSizeX, gridSizeY, gridSizeZ, DXGI_FORMAT_R32_FLOAT);
-	temperatureBuffers[1] = CreateVolumeResource(gridSizeX, gridSizeY, gridSizeZ, DXGI_FORMAT_R32_FLOAT);
 	vorticityBuffer = CreateVolumeResource(gridSizeX, gridSizeY, gridSizeZ, DXGI_FORMAT_R32G32B32A32_FLOAT);
 	levelSetBuffers[0] = CreateVolumeResource(gridSizeX, gridSizeY, gridSizeZ, DXGI_FORMAT_R32_FLOAT);
 	levelSetBuffers[1] = CreateVolumeResource(gridSizeX, gridSizeY, gridSizeZ, DXGI_FORMAT_R32_FLOAT);
 
+	// Obstacles are voxelized again as they're set after this
+	voxelizer.Resize(gridSizeX, gridSizeY, gridSizeZ);
+
 	// Obstacle for testing
 	unsigned int dataSize = gridSizeX * gridSizeY * gridSizeZ;
 	unsigned char* obData = new unsigned char[dataSize];
@@ -178,40 +209,103 @@ void FluidField::RecreateGPUResources()
 	obstacleBuffer = CreateVolumeResource(gridSizeX, gridSizeY, gridSizeZ, DXGI_FORMAT_R8_UNORM, obData);
 	delete[] obData;
 
-	// Should we make voxelization resources?
-	if (obstaclesEnabled)
+	// Multigrid pyramid, halving each axis until any axis reaches
+	// the coarsest size or is odd (the same as PressureSolver)
 	{
-		// Create array of depth stencil buffers for object voxelization if necessary
-		D3D11_TEXTURE2D_DESC stencilDesc = {};
-		{	// Size
-			stencilDesc.Width = gridSizeX;
-			stencilDesc.Height = gridSizeY;
-			stencilDesc.ArraySize = gridSizeZ; // Forward-facing for now, but might change to "smallest dimension"
+		unsigned int sizeX = gridSizeX;
+		unsigned int sizeY = gridSizeY;
+		unsigned int sizeZ = gridSizeZ;
+		while (true)
+		{
+			MultigridLevel level;
+			level.SizeX = sizeX;
+			level.SizeY = sizeY;
+			level.SizeZ = sizeZ;
+			level.Residual = CreateVolumeResource(sizeX, sizeY, sizeZ, DXGI_FORMAT_R32_FLOAT);
+
+			// The full size level already has the rest
+			if (!multigridLevels.empty())
+			{
+				level.Pressure[0] = CreateVolumeResource(sizeX, sizeY, sizeZ, DXGI_FORMAT_R32_FLOAT);
+				level.Pressure[1] = CreateVolumeResource(sizeX, sizeY, sizeZ, DXGI_FORMAT_R32_FLOAT);
+				level.Divergence = CreateVolumeResource(sizeX, sizeY, sizeZ, DXGI_FORMAT_R32_FLOAT);
+				level.Obstacles = CreateVolumeResource(sizeX, sizeY, sizeZ, DXGI_FORMAT_R8_UNORM);
+			}
+			multigridLevels.push_back(level);
+
+			if (min(sizeX, min(sizeY, sizeZ)) <= MULTIGRID_COARSEST_SIZE ||
+				sizeX % 2 || sizeY % 2 || sizeZ % 2)
+				break;
+
+			sizeX /= 2;
+			sizeY /= 2;
+			sizeZ /= 2;
 		}
-		stencilDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_DEPTH_STENCIL;
-		stencilDesc.CPUAccessFlags = 0;
-		stencilDesc.Format = DXGI_FORMAT_D24_UNORM_S8_UINT;
-		stencilDesc.MipLevels = 1;
-		stencilDesc.MiscFlags = 0;
-		stencilDesc.SampleDesc.Count = 1;
-		stencilDesc.SampleDesc.Quality = 0;
-		stencilDesc.Usage = D3D11_USAGE_DEFAULT;
-		Microsoft::WRL::ComPtr<ID3D11Texture2D> stencilBuffer;
-		device->CreateTexture2D(&stencilDesc, 0, stencilBuffer.GetAddressOf());
-
-		// Create the view
-		D3D11_DEPTH_STENCIL_VIEW_DESC viewDesc = {};
-		viewDesc.ViewDimension = D3D11_DSV_DIMENSION_TEXTURE2DARRAY;
-		viewDesc.Texture2DArray.ArraySize = stencilDesc.ArraySize;
-		viewDesc.Texture2DArray.FirstArraySlice = 0;
-		viewDesc.Texture2DArray.MipSlice = 0;
-		viewDesc.Format = stencilDesc.Format;
-		device->CreateDepthStencilView(stencilBuffer.Get(), &viewDesc, voxelizationDepthStencilView.GetAddressOf());
-		
-		// Create the array of projection matrices
+	}
+
+	// Staging copy of the full size residual, for measuring it
+	{
+		D3D11_TEXTURE3D_DESC readbackDesc = {};
+		readbackDesc.Width = gridSizeX;
+		readbackDesc.Height = gridSizeY;
+		readbackDesc.Depth = gridSizeZ;
+		readbackDesc.Format = DXGI_FORMAT_R32_FLOAT;
+		readbackDesc.MipLevels = 1;
+		readbackDesc.Usage = D3D11_USAGE_STAGING;
+		readbackDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+		device->CreateTexture3D(&readbackDesc, 0, residualReadback.GetAddressOf());
+	}
 
+	// Sparse brick activity and lists, plus a staging copy of
+	// the active brick count for stats
+	{
+		brickCountX = (gridSizeX + FLUID_BRICK_SIZE - 1) / FLUID_BRICK_SIZE;
+		brickCountY = (gridSizeY + FLUID_BRICK_SIZE - 1) / FLUID_BRICK_SIZE;
+		brickCountZ = (gridSizeZ + FLUID_BRICK_SIZE - 1) / FLUID_BRICK_SIZE;
+		brickActivity = CreateVolumeResource(brickCountX, brickCountY, brickCountZ, DXGI_FORMAT_R32_UINT);
+		brickSimulated = CreateVolumeResource(brickCountX, brickCountY, brickCountZ, DXGI_FORMAT_R32_UINT);
+		activeBricks = CreateBrickList(GetBrickCount());
+		retiredBricks = CreateBrickList(GetBrickCount());
+
+		D3D11_BUFFER_DESC readbackDesc = {};
+		readbackDesc.ByteWidth = sizeof(unsigned int);
+		readbackDesc.Usage = D3D11_USAGE_STAGING;
+		readbackDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+		device->CreateBuffer(&readbackDesc, 0, activeBrickCountReadback.GetAddressOf());
+
+		activeBrickCount = 0;
+		sparseLastStep = false;
 	}
 
+	// Max speed reduction (a single uint) and its staging copy
+	{
+		D3D11_BUFFER_DESC speedDesc = {};
+		speedDesc.BindFlags = D3D11_BIND_UNORDERED_ACCESS;
+		speedDesc.ByteWidth = sizeof(unsigned int);
+		speedDesc.Usage = D3D11_USAGE_DEFAULT;
+		Microsoft::WRL::ComPtr<ID3D11Buffer> speedBuffer;
+		device->CreateBuffer(&speedDesc, 0, speedBuffer.GetAddressOf());
+
+		D3D11_UNORDERED_ACCESS_VIEW_DESC uavDesc = {};
+		uavDesc.Format = DXGI_FORMAT_R32_UINT;
+		uavDesc.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
+		uavDesc.Buffer.FirstElement = 0;
+		uavDesc.Buffer.NumElements = 1;
+		device->CreateUnorderedAccessView(speedBuffer.Get(), &uavDesc, maxSpeedUAV.GetAddressOf());
+
+		D3D11_BUFFER_DESC readbackDesc = {};
+		readbackDesc.ByteWidth = sizeof(unsigned int);
+		readbackDesc.Usage = D3D11_USAGE_STAGING;
+		readbackDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+		device->CreateBuffer(&readbackDesc, 0, maxSpeedReadback.GetAddressOf());
+
+		// New volumes are empty, but start over with measuring them
+		maxSpeedPending = false;
+		maxSpeedKnown = false;
+		maxSpeed = 0.0f;
+		calmReadings = 0;
+		atRest = false;
+	}
 
 	// Unused, but for reference...
 
@@ -235,25 +329,113 @@ void FluidField::RecreateGPUResources()
 
 void FluidField::UpdateFluid(float deltaTime)
 {
+	frameStats = {};
+
 	// Don't run if paused
 	if (pause)
 		return;
 
 	// Pile up the time
 	timeCounter += deltaTime;
-	if (timeCounter < fixedTimeStep)
+
+	if (!adaptiveTimeStep)
+	{
+		if (timeCounter < fixedTimeStep)
+			return;
+
+		// Run a single time step
+		OneTimeStep();
+
+		// Apply one time step
+		timeCounter -= fixedTimeStep;
+		frameStats.Steps = 1;
+		frameStats.TimeStep = fixedTimeStep;
+		frameStats.SimulatedTime = fixedTimeStep;
 		return;
+	}
 
-	// Run a single time step
-	OneTimeStep();
+	// Adaptive -----
+
+	// Latest max speed, and whether the field has settled: calm
+	// for long enough that the speed is from steps taken since
+	// anything changed (readings lag by a frame or few)
+	bool newReading = ReadMaxSpeed();
+	FluidStepParameters params = GetStepParameters();
+	if (injectSmoke || memcmp(&params, &restParameters, sizeof(FluidStepParameters)) != 0)
+	{
+		atRest = false;
+		calmReadings = 0;
+	}
+	else if (newReading && !atRest)
+	{
+		calmReadings = maxSpeed < restSpeed ? calmReadings + 1 : 0;
+		atRest = calmReadings >= FLUID_REST_READINGS;
+	}
+	restParameters = params;
 
-	// Apply one time step
-	timeCounter -= fixedTimeStep;
+	// Nothing to do at rest - and no time to catch up on later
+	frameStats.AtRest = atRest;
+	if (atRest)
+	{
+		timeCounter = 0.0f;
+		return;
+	}
+
+	// Longest step that keeps within the CFL number, counting
+	// the impulse waiting to be injected
+	float speed = maxSpeed;
+	if (injectSmoke)
+		speed += XMVectorGetX(XMVector3Length(XMLoadFloat3(&injectVelocityImpulse)));
+	frameStats.MaxSpeed = speed;
+
+	float stepLimit = maxTimeStep;
+	if (speed * stepLimit > cflNumber && cflNumber > 0.0f)
+		stepLimit = cflNumber / speed;
+
+	// A calm field may wait a few frames for one long step
+	if (timeCounter < stepLimit)
+		return;
+
+	// Equal steps that use up all of the time, unless that's over
+	// budget - then stay within the CFL number and drop the rest
+	// (the fluid slows down instead of blowing up)
+	int steps = (int)ceil(timeCounter / stepLimit);
+	float timeStep = timeCounter / steps;
+	if (steps > max(maxSubsteps, 1))
+	{
+		steps = max(maxSubsteps, 1);
+		timeStep = stepLimit;
+		frameStats.DroppedTime = timeCounter - steps * timeStep;
+	}
+
+	for (int i = 0; i < steps; i++)
+		OneTimeStep(timeStep);
+	timeCounter = 0.0f;
+
+	// Start measuring the new state
+	if (gpuSpeedReduction)
+		MeasureMaxSpeed();
+
+	frameStats.Steps = steps;
+	frameStats.TimeStep = timeStep;
+	frameStats.SimulatedTime = steps * timeStep;
 }
 
 
 void FluidField::OneTimeStep()
 {
+	OneTimeStep(fixedTimeStep);
+}
+
+void FluidField::OneTimeStep(float timeStep)
+{
+	currentTimeStep = timeStep;
+
+	// Find the bricks worth simulating this step
+	if (sparseBricks)
+		UpdateActiveBricks();
+	sparseLastStep = sparseBricks;
+
 	//// Add smoke to the field
 	//if (injectSmoke)
 	//	InjectSmoke();
@@ -296,17 +478,6 @@ void FluidField::RenderFluid(Camera* camera)
 	context->OMSetBlendState(blendState.Get(), 0, 0xFFFFFFFF);
 	context->RSSetState(rasterState.Get());
 
-	// Get smallest dimension and use that for scaling
-	float smallestDimension = (float)min(gridSizeX, min(gridSizeY, gridSizeZ));
-	XMFLOAT3 scale = {
-		2 * gridSizeX / smallestDimension,
-		2 * gridSizeY / smallestDimension,
-		2 * gridSizeZ / smallestDimension
-	};
-
-	// Cube location
-	XMFLOAT3 translation(0, 0, 0);
-
 	Assets& assets = Assets::GetInstance();
 	SimplePixelShader* volumePS = assets.GetPixelShader("VolumePS.cso");
 	SimpleVertexShader* volumeVS = assets.GetVertexShader("VolumeVS.cso");
@@ -315,9 +486,7 @@ void FluidField::RenderFluid(Camera* camera)
 	volumeVS->SetShader();
 
 	// Vertex shader data
-	XMMATRIX worldMat =
-		XMMatrixScaling(scale.x, scale.y, scale.z) *
-		XMMatrixTranslation(translation.x, translation.y, translation.z);
+	XMMATRIX worldMat = GetVolumeWorldMatrix();
 
 	XMFLOAT4X4 world, invWorld;
 	XMStoreFloat4x4(&world, worldMat);
@@ -332,23 +501,24 @@ void FluidField::RenderFluid(Camera* camera)
 	
 	// Assume debug mode unless we're doing the density buffer
 	int modeOverride = -1;
-	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> srv;
+	VolumeResource* volume = 0;
 	switch (renderBuffer)
 	{
 	default:
 	case FLUID_RENDER_BUFFER::FLUID_RENDER_BUFFER_DENSITY:
-		srv = densityBuffers[0].SRV;
+		volume = &densityBuffers[0];
 		modeOverride = (int)renderMode;
 		break;
 
-	case FLUID_RENDER_BUFFER::FLUID_RENDER_BUFFER_VELOCITY: srv = velocityBuffers[0].SRV; break;
-	case FLUID_RENDER_BUFFER::FLUID_RENDER_BUFFER_DIVERGENCE: srv = divergenceBuffer.SRV; break;
-	case FLUID_RENDER_BUFFER::FLUID_RENDER_BUFFER_PRESSURE: srv = pressureBuffers[0].SRV; break;
-	case FLUID_RENDER_BUFFER::FLUID_RENDER_BUFFER_TEMPERATURE: srv = temperatureBuffers[0].SRV; break;
-	case FLUID_RENDER_BUFFER::FLUID_RENDER_BUFFER_VORTICITY: srv = vorticityBuffer.SRV; break;
-	case FLUID_RENDER_BUFFER::FLUID_RENDER_BUFFER_OBSTACLES: srv = obstacleBuffer.SRV; break;
+	case FLUID_RENDER_BUFFER::FLUID_RENDER_BUFFER_VELOCITY: volume = &velocityBuffers[0]; break;
+	case FLUID_RENDER_BUFFER::FLUID_RENDER_BUFFER_DIVERGENCE: volume = &divergenceBuffer; break;
+	case FLUID_RENDER_BUFFER::FLUID_RENDER_BUFFER_PRESSURE: volume = &pressureBuffers[0]; break;
+	case FLUID_RENDER_BUFFER::FLUID_RENDER_BUFFER_TEMPERATURE: volume = &temperatureBuffers[0]; break;
+	case FLUID_RENDER_BUFFER::FLUID_RENDER_BUFFER_VORTICITY: volume = &vorticityBuffer; break;
+	case FLUID_RENDER_BUFFER::FLUID_RENDER_BUFFER_OBSTACLES: volume = &obstacleBuffer; break;
 	}
-	volumePS->SetShaderResourceView("volumeTexture", srv);
+	volumePS->SetShaderResourceView("volumeTexture", volume->SRV);
+	volumePS->SetFloat4("volumeScale", volume->ChannelScale);
 
 	// Pixel shader data
 	volumePS->SetMatrix4x4("invWorld", invWorld);
@@ -369,29 +539,74 @@ void FluidField::RenderFluid(Camera* camera)
 }
 
 
+// --------------------------------------------------------
+// Makes an entity's mesh an obstacle, or moves it if it
+// already is one.  This is cheap when the entity hasn't
+// moved, so it can be called every frame.  Nothing is
+// voxelized until UpdateObstacles().
+// --------------------------------------------------------
 void FluidField::VoxelizeObstacle(GameEntity* entity)
 {
-	// Able to use obstacles?
-	if (!obstaclesEnabled)
+	Mesh* mesh = entity->GetMesh();
+	const std::vector<XMFLOAT3>& positions = mesh->GetPositions();
+	const std::vector<unsigned int>& indices = mesh->GetIndices();
+	if (positions.empty() || indices.empty())
 		return;
 
-	// Set up stencil states and proper stencil buffer
-	
-	
-	// Turn on proper vertex shader and disable pixel shader
-
-
-	// Set entity's matrix and custom view/projection matrices
-	// - See this article for info on infinite far planes: https://ubm-twvideo01.s3.amazonaws.com/o1/vault/gdc07/slides/S3730i1.pdf
+	// Object space to world space, into the volume's unit cube
+	// and from there (-0.5 to 0.5) to cells
+	XMFLOAT4X4 world = entity->GetTransform()->GetWorldMatrix();
+	XMMATRIX gridFromWorld =
+		XMMatrixInverse(0, GetVolumeWorldMatrix()) *
+		XMMatrixTranslation(0.5f, 0.5f, 0.5f) *
+		XMMatrixScaling((float)gridSizeX, (float)gridSizeY, (float)gridSizeZ);
+
+	XMFLOAT4X4 gridFromObject;
+	XMStoreFloat4x4(&gridFromObject, XMLoadFloat4x4(&world) * gridFromWorld);
+	voxelizer.SetObstacle(
+		entity,
+		&positions[0].x,
+		sizeof(XMFLOAT3),
+		positions.size(),
+		indices.data(),
+		indices.size(),
+		&gridFromObject._11);
+}
 
-	// Draw the entity using instance rendering (one instance per "slice")
+void FluidField::RemoveObstacle(GameEntity* entity)
+{
+	voxelizer.RemoveObstacle(entity);
+}
 
+// --------------------------------------------------------
+// Voxelizes the region any obstacles have moved through
+// since the last update and uploads just those rows.  A
+// field at rest wakes up if anything changed.
+// --------------------------------------------------------
+void FluidField::UpdateObstacles()
+{
+	int regionMin[3];
+	int regionMax[3];
+	if (!voxelizer.Update(regionMin, regionMax))
+		return;
 
-	// Copy results to obstacle buffer
+	Microsoft::WRL::ComPtr<ID3D11Resource> obstacleTexture;
+	obstacleBuffer.SRV->GetResource(obstacleTexture.GetAddressOf());
 
+	D3D11_BOX box = {};
+	box.left = regionMin[0];
+	box.top = regionMin[1];
+	box.front = regionMin[2];
+	box.right = regionMax[0];
+	box.bottom = regionMax[1];
+	box.back = regionMax[2];
 
-	// Reset states
+	const std::vector<unsigned char>& obstacles = voxelizer.GetObstacles();
+	size_t first = regionMin[0] + (size_t)gridSizeX * (regionMin[1] + (size_t)gridSizeY * regionMin[2]);
+	context->UpdateSubresource(obstacleTexture.Get(), 0, &box, &obstacles[first], gridSizeX, gridSizeX * gridSizeY);
 
+	atRest = false;
+	calmReadings = 0;
 }
 
 unsigned int FluidField::GetGridSizeX() { return gridSizeX; }
@@ -410,7 +625,71 @@ void FluidField::SetGridSize(unsigned int gridSizeX, unsigned int gridSizeY, uns
 	RecreateGPUResources();
 }
 
+FluidFormatPolicy FluidField::GetFormats() { return formats; }
+void FluidField::SetFormats(const FluidFormatPolicy& formats)
+{
+	// Scales of zero would divide by zero in the shaders
+	if (formats.DensityScale <= 0.0f || formats.TemperatureScale <= 0.0f)
+		return;
+
+	// Save and recreate resources
+	this->formats = formats;
+
+	// Every kernel that writes velocity or pressure declares a
+	// float UAV, so those two only get the float formats
+	if (this->formats.Velocity != FLUID_FORMAT_FLOAT) this->formats.Velocity = FLUID_FORMAT_HALF;
+	if (this->formats.Pressure != FLUID_FORMAT_FLOAT) this->formats.Pressure = FLUID_FORMAT_HALF;
+	RecreateGPUResources();
+}
+
 DirectX::XMFLOAT3 FluidField::GetInjectPosition() {	return injectPosition; }
+unsigned int FluidField::GetMultigridLevelCount() { return (unsigned int)multigridLevels.size(); }
+float FluidField::GetDivergenceNorm() { return divergenceNorm; }
+float FluidField::GetPressureResidualNorm() { return pressureResidualNorm; }
+unsigned int FluidField::GetBrickCount() { return brickCountX * brickCountY * brickCountZ; }
+unsigned int FluidField::GetActiveBrickCount() { return sparseBricks ? activeBrickCount : GetBrickCount(); }
+FluidFrameStats FluidField::GetFrameStats() { return frameStats; }
+
+// --------------------------------------------------------
+// Memory the simulation volumes take per cell: two of each
+// ping-pong pair (in the current format policy), divergence,
+// vorticity and obstacles
+// --------------------------------------------------------
+unsigned int FluidField::GetBytesPerCell()
+{
+	return
+		2 * DXGIFormatBytes(VolumeFormat(formats.Velocity, 4)) +
+		2 * DXGIFormatBytes(VolumeFormat(formats.Density, 4)) +
+		2 * DXGIFormatBytes(VolumeFormat(formats.Pressure, 1)) +
+		2 * DXGIFormatBytes(VolumeFormat(formats.Temperature, 1)) +
+		DXGIFormatBytes(DXGI_FORMAT_R32_FLOAT) +				// Divergence
+		DXGIFormatBytes(DXGI_FORMAT_R32G32B32A32_FLOAT) +		// Vorticity
+		DXGIFormatBytes(DXGI_FORMAT_R8_UNORM);					// Obstacles
+}
+
+// --------------------------------------------------------
+// Work done by the pressure solver each step, in full size
+// grid sweeps, so the two solvers can be compared at equal
+// cost.  See PressureSolver::GetMultigridPassesPerCycle().
+// --------------------------------------------------------
+float FluidField::GetPressureSolverPasses()
+{
+	if (pressureSolver == FLUID_PRESSURE_SOLVER::FLUID_PRESSURE_SOLVER_JACOBI)
+		return (float)pressureIterations;
+
+	float fullCells = (float)gridSizeX * gridSizeY * gridSizeZ;
+	float passes = 0.0f;
+	for (size_t l = 0; l < multigridLevels.size(); l++)
+	{
+		MultigridLevel& level = multigridLevels[l];
+		float scale = level.SizeX * level.SizeY * level.SizeZ / fullCells;
+		if (l == multigridLevels.size() - 1)
+			passes += scale * MULTIGRID_COARSE_ITERATIONS;
+		else
+			passes += scale * (multigridSmoothIterations * 2 + 3);
+	}
+	return passes * multigridCycles;
+}
 
 void FluidField::SetInjectPosition(DirectX::XMFLOAT3 newPos, bool applyVelocityImpulse)
 {
@@ -430,6 +709,27 @@ void FluidField::SetInjectPosition(DirectX::XMFLOAT3 newPos, bool applyVelocityI
 
 
 
+// --------------------------------------------------------
+// Where the volume's unit cube (-0.5 to 0.5) is in the world:
+// scaled so the smallest axis spans 2 units, at the origin
+// --------------------------------------------------------
+XMMATRIX FluidField::GetVolumeWorldMatrix()
+{
+	float smallestDimension = (float)min(gridSizeX, min(gridSizeY, gridSizeZ));
+	XMFLOAT3 scale = {
+		2 * gridSizeX / smallestDimension,
+		2 * gridSizeY / smallestDimension,
+		2 * gridSizeZ / smallestDimension
+	};
+
+	// Cube location
+	XMFLOAT3 translation(0, 0, 0);
+
+	return
+		XMMatrixScaling(scale.x, scale.y, scale.z) *
+		XMMatrixTranslation(translation.x, translation.y, translation.z);
+}
+
 void FluidField::SwapBuffers(VolumeResource volumes[2])
 {
 	VolumeResource vr0 = volumes[0];
@@ -466,11 +766,276 @@ VolumeResource FluidField::CreateVolumeResource(unsigned int sizeX, unsigned int
 	// Struct to hold both resource views
 	VolumeResource vr;
 	vr.ChannelCount = DXGIFormatChannels(format);
+	vr.UAVType = DXGIFormatUAVType(format);
 	device->CreateShaderResourceView(texture.Get(), 0, vr.SRV.GetAddressOf());
 	device->CreateUnorderedAccessView(texture.Get(), 0, vr.UAV.GetAddressOf());
 	return vr;
 }
 
+// --------------------------------------------------------
+// Creates a list of up to maxBricks packed bricks (a UAV
+// with a counter to append to and an SRV to read it) and
+// the arguments for dispatching a group per brick
+// --------------------------------------------------------
+FluidField::BrickList FluidField::CreateBrickList(unsigned int maxBricks)
+{
+	BrickList list;
+
+	// List buffer
+	D3D11_BUFFER_DESC listDesc = {};
+	listDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
+	listDesc.ByteWidth = sizeof(unsigned int) * maxBricks;
+	listDesc.CPUAccessFlags = 0;
+	listDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+	listDesc.StructureByteStride = sizeof(unsigned int);
+	listDesc.Usage = D3D11_USAGE_DEFAULT;
+	Microsoft::WRL::ComPtr<ID3D11Buffer> listBuffer;
+	device->CreateBuffer(&listDesc, 0, listBuffer.GetAddressOf());
+
+	D3D11_UNORDERED_ACCESS_VIEW_DESC uavDesc = {};
+	uavDesc.Format = DXGI_FORMAT_UNKNOWN;
+	uavDesc.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
+	uavDesc.Buffer.FirstElement = 0;
+	uavDesc.Buffer.NumElements = maxBricks;
+	uavDesc.Buffer.Flags = D3D11_BUFFER_UAV_FLAG_COUNTER;
+	device->CreateUnorderedAccessView(listBuffer.Get(), &uavDesc, list.UAV.GetAddressOf());
+
+	D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	srvDesc.Format = DXGI_FORMAT_UNKNOWN;
+	srvDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+	srvDesc.Buffer.FirstElement = 0;
+	srvDesc.Buffer.NumElements = maxBricks;
+	device->CreateShaderResourceView(listBuffer.Get(), &srvDesc, list.SRV.GetAddressOf());
+
+	// Dispatch arguments - the group count is copied in from
+	// the list's counter each step
+	unsigned int args[3] = { 0, 1, 1 };
+	D3D11_SUBRESOURCE_DATA argsData = {};
+	argsData.pSysMem = args;
+
+	D3D11_BUFFER_DESC argsDesc = {};
+	argsDesc.BindFlags = D3D11_BIND_UNORDERED_ACCESS;
+	argsDesc.ByteWidth = sizeof(args);
+	argsDesc.CPUAccessFlags = 0;
+	argsDesc.MiscFlags = D3D11_RESOURCE_MISC_DRAWINDIRECT_ARGS;
+	argsDesc.StructureByteStride = 0;
+	argsDesc.Usage = D3D11_USAGE_DEFAULT;
+	device->CreateBuffer(&argsDesc, &argsData, list.DispatchArgs.GetAddressOf());
+
+	return list;
+}
+
+// --------------------------------------------------------
+// Runs a per-cell shader over the active bricks when sparse,
+// or the whole grid otherwise
+// --------------------------------------------------------
+void FluidField::DispatchCells(SimpleComputeShader* shader)
+{
+	DispatchBricks(shader, sparseBricks ? &activeBricks : 0);
+}
+
+// --------------------------------------------------------
+// Runs a per-cell shader (one that uses GetCellIndex()) over
+// a list of bricks with an indirect dispatch, or over every
+// brick of the grid when there's no list
+// --------------------------------------------------------
+void FluidField::DispatchBricks(SimpleComputeShader* shader, BrickList* bricks)
+{
+	shader->SetInt("useActiveBricks", bricks != 0);
+	shader->CopyBufferData("brickData");
+
+	if (!bricks)
+	{
+		shader->DispatchByThreads(gridSizeX, gridSizeY, gridSizeZ);
+		return;
+	}
+
+	shader->SetShaderResourceView("ActiveBricks", bricks->SRV);
+	context->DispatchIndirect(bricks->DispatchArgs.Get(), 0);
+	shader->SetShaderResourceView("ActiveBricks", 0);
+}
+
+// --------------------------------------------------------
+// Zeroes a volume, or just the bricks in the given list
+// --------------------------------------------------------
+void FluidField::ClearVolume(VolumeResource& volume, BrickList* bricks)
+{
+	Assets& assets = Assets::GetInstance();
+	SimpleComputeShader* clearCS = assets.GetComputeShader("Clear3DTextureCS.cso");
+
+	clearCS->SetShader();
+	clearCS->SetFloat4("clearColor", { 0,0,0,0 });
+	clearCS->SetInt("channelCount", volume.ChannelCount);
+	clearCS->SetInt("outputType", volume.UAVType);
+	clearCS->CopyAllBufferData();
+
+	std::string outputName = UAVName("ClearOut" + std::to_string(volume.ChannelCount), volume);
+	clearCS->SetUnorderedAccessView(outputName, volume.UAV);
+	DispatchBricks(clearCS, bricks);
+	clearCS->SetUnorderedAccessView(outputName, 0);
+}
+
+
+// --------------------------------------------------------
+// Builds this step's lists of bricks to simulate and bricks
+// to retire (FluidBricks is the CPU reference for both), then
+// clears the retired ones.  The active count is read back
+// without waiting, so it's just for stats.
+// --------------------------------------------------------
+void FluidField::UpdateActiveBricks()
+{
+	Assets& assets = Assets::GetInstance();
+	SimpleComputeShader* activityCS = assets.GetComputeShader("BrickActivityCS.cso");
+	SimpleComputeShader* listCS = assets.GetComputeShader("BrickListCS.cso");
+
+	// Coming from a dense step, every brick was simulated
+	if (!sparseLastStep)
+	{
+		const UINT simulated[4] = { 1, 1, 1, 1 };
+		context->ClearUnorderedAccessViewUint(brickSimulated.UAV.Get(), simulated);
+	}
+
+	// Activity -----
+	activityCS->SetShader();
+	activityCS->SetInt("gridSizeX", gridSizeX);
+	activityCS->SetInt("gridSizeY", gridSizeY);
+	activityCS->SetInt("gridSizeZ", gridSizeZ);
+	activityCS->SetFloat("densityThreshold", brickDensityThreshold);
+	activityCS->SetFloat("velocityThreshold", brickVelocityThreshold);
+	activityCS->SetFloat3("injectPosition", injectPosition);
+	activityCS->SetFloat("injectRadius", injectSmoke ? injectRadius : 0.0f);
+	activityCS->SetFloat("densityScale", densityBuffers[0].ChannelScale.w);
+	activityCS->CopyAllBufferData();
+
+	activityCS->SetShaderResourceView("DensityIn", densityBuffers[0].SRV);
+	activityCS->SetShaderResourceView("VelocityIn", velocityBuffers[0].SRV);
+	activityCS->SetUnorderedAccessView("BrickActivityOut", brickActivity.UAV);
+	activityCS->DispatchByGroups(brickCountX, brickCountY, brickCountZ);
+	activityCS->SetShaderResourceView("DensityIn", 0);
+	activityCS->SetShaderResourceView("VelocityIn", 0);
+	activityCS->SetUnorderedAccessView("BrickActivityOut", 0);
+
+	// Lists (dilated) -----
+	listCS->SetShader();
+	listCS->SetInt("brickCountX", brickCountX);
+	listCS->SetInt("brickCountY", brickCountY);
+	listCS->SetInt("brickCountZ", brickCountZ);
+	listCS->SetInt("brickDilation", brickDilation);
+	listCS->CopyAllBufferData();
+
+	listCS->SetShaderResourceView("BrickActivityIn", brickActivity.SRV);
+	listCS->SetUnorderedAccessView("BrickSimulated", brickSimulated.UAV);
+	listCS->SetUnorderedAccessView("ActiveBricksOut", activeBricks.UAV, 0); // Reset the counters
+	listCS->SetUnorderedAccessView("RetiredBricksOut", retiredBricks.UAV, 0);
+	listCS->DispatchByThreads(brickCountX, brickCountY, brickCountZ);
+	listCS->SetShaderResourceView("BrickActivityIn", 0);
+	listCS->SetUnorderedAccessView("BrickSimulated", 0);
+	listCS->SetUnorderedAccessView("ActiveBricksOut", 0);
+	listCS->SetUnorderedAccessView("RetiredBricksOut", 0);
+
+	// The list sizes are the group counts for the indirect dispatches
+	context->CopyStructureCount(activeBricks.DispatchArgs.Get(), 0, activeBricks.UAV.Get());
+	context->CopyStructureCount(retiredBricks.DispatchArgs.Get(), 0, retiredBricks.UAV.Get());
+
+	// Retired bricks are below the thresholds, but the other
+	// halves of their ping-pong pairs may not be
+	VolumeResource* retiredVolumes[] = {
+		&velocityBuffers[0], &velocityBuffers[1],
+		&densityBuffers[0], &densityBuffers[1],
+		&temperatureBuffers[0], &temperatureBuffers[1],
+		&vorticityBuffer };
+	for (VolumeResource* volume : retiredVolumes)
+		ClearVolume(*volume, &retiredBricks);
+
+	// Grab an earlier count if the GPU is done with it, then
+	// copy this step's
+	D3D11_MAPPED_SUBRESOURCE mapped = {};
+	if (SUCCEEDED(context->Map(activeBrickCountReadback.Get(), 0, D3D11_MAP_READ, D3D11_MAP_FLAG_DO_NOT_WAIT, &mapped)))
+	{
+		activeBrickCount = *(unsigned int*)mapped.pData;
+		context->Unmap(activeBrickCountReadback.Get(), 0);
+	}
+
+	D3D11_BOX countBox = { 0, 0, 0, sizeof(unsigned int), 1, 1 };
+	context->CopySubresourceRegion(activeBrickCountReadback.Get(), 0, 0, 0, 0, activeBricks.DispatchArgs.Get(), 0, &countBox);
+}
+
+// --------------------------------------------------------
+// Starts a GPU reduction of the largest speed of any fluid
+// cell.  The result is copied to a staging buffer for
+// ReadMaxSpeed() to pick up once it's ready.
+// --------------------------------------------------------
+void FluidField::MeasureMaxSpeed()
+{
+	// Still waiting on the last one?
+	if (maxSpeedPending)
+		return;
+
+	Assets& assets = Assets::GetInstance();
+	SimpleComputeShader* speedCS = assets.GetComputeShader("MaxSpeedCS.cso");
+
+	const UINT zero[4] = { 0, 0, 0, 0 };
+	context->ClearUnorderedAccessViewUint(maxSpeedUAV.Get(), zero);
+
+	speedCS->SetShader();
+	speedCS->SetShaderResourceView("VelocityIn", velocityBuffers[0].SRV);
+	speedCS->SetShaderResourceView("ObstaclesIn", obstacleBuffer.SRV);
+	speedCS->SetUnorderedAccessView("MaxSpeedOut", maxSpeedUAV);
+	DispatchCells(speedCS);
+	speedCS->SetShaderResourceView("VelocityIn", 0);
+	speedCS->SetShaderResourceView("ObstaclesIn", 0);
+	speedCS->SetUnorderedAccessView("MaxSpeedOut", 0);
+
+	Microsoft::WRL::ComPtr<ID3D11Resource> speedBuffer;
+	maxSpeedUAV->GetResource(speedBuffer.GetAddressOf());
+	context->CopyResource(maxSpeedReadback.Get(), speedBuffer.Get());
+	maxSpeedPending = true;
+}
+
+// --------------------------------------------------------
+// Updates maxSpeed if there's a new measurement, returning
+// whether there was.  The GPU's reduction is picked up
+// without waiting.  With no reduction to go on (it's turned
+// off, or nothing has been measured yet) velocity is read
+// back and reduced on the CPU instead, which waits.
+// --------------------------------------------------------
+bool FluidField::ReadMaxSpeed()
+{
+	if (gpuSpeedReduction && maxSpeedPending)
+	{
+		D3D11_MAPPED_SUBRESOURCE mapped = {};
+		if (SUCCEEDED(context->Map(maxSpeedReadback.Get(), 0, D3D11_MAP_READ, D3D11_MAP_FLAG_DO_NOT_WAIT, &mapped)))
+		{
+			// The reduction compares the float's bits as a uint
+			memcpy(&maxSpeed, mapped.pData, sizeof(float));
+			context->Unmap(maxSpeedReadback.Get(), 0);
+
+			maxSpeedPending = false;
+			maxSpeedKnown = true;
+			return true;
+		}
+	}
+
+	if (gpuSpeedReduction && maxSpeedKnown)
+		return false;
+
+	// CPU fallback
+	std::vector<float> planes;
+	ReadBackVolume(velocityBuffers[0], 3, planes);
+	ReadBackVolume(obstacleBuffer, 1, planes);
+
+	size_t cellCount = (size_t)gridSizeX * gridSizeY * gridSizeZ;
+	maxSpeed = FluidFieldCPU::MaxSpeed(
+		&planes[0],
+		&planes[cellCount],
+		&planes[cellCount * 2],
+		&planes[cellCount * 3],
+		cellCount);
+	maxSpeedKnown = true;
+	frameStats.SpeedFromCPU = true;
+	return true;
+}
+
 void FluidField::Advection(VolumeResource volumes[2], float damper)
 {
 	// Grab the advection shader
@@ -479,11 +1044,12 @@ void FluidField::Advection(VolumeResource volumes[2], float damper)
 
 	// Turn on and set external data
 	advectCS->SetShader();
-	advectCS->SetFloat("deltaTime", fixedTimeStep);
+	advectCS->SetFloat("deltaTime", currentTimeStep);
 	advectCS->SetInt("gridSizeX", gridSizeX);
 	advectCS->SetInt("gridSizeY", gridSizeY);
 	advectCS->SetInt("gridSizeZ", gridSizeZ);
 	advectCS->SetInt("channelCount", volumes[1].ChannelCount);
+	advectCS->SetInt("outputType", volumes[1].UAVType);
 	advectCS->SetFloat("damper", damper);
 	advectCS->CopyAllBufferData();
 
@@ -492,29 +1058,18 @@ void FluidField::Advection(VolumeResource volumes[2], float damper)
 	advectCS->SetShaderResourceView("AdvectionIn", volumes[0].SRV);
 	advectCS->SetShaderResourceView("ObstaclesIn", obstacleBuffer.SRV);
 	advectCS->SetSamplerState("SamplerLinearClamp", samplerLinearClamp);
-	switch (volumes[1].ChannelCount)
-	{
-	case 1: advectCS->SetUnorderedAccessView("AdvectionOut1", volumes[1].UAV); break;
-	case 2: advectCS->SetUnorderedAccessView("AdvectionOut2", volumes[1].UAV); break;
-	case 3: advectCS->SetUnorderedAccessView("AdvectionOut3", volumes[1].UAV); break;
-	case 4: advectCS->SetUnorderedAccessView("AdvectionOut4", volumes[1].UAV); break;
-	default: return;
-	}
+	std::string outputName = UAVName("AdvectionOut" + std::to_string(volumes[1].ChannelCount), volumes[1]);
+	if (!advectCS->SetUnorderedAccessView(outputName, volumes[1].UAV))
+		return;
 
 	// Run compute
-	advectCS->DispatchByThreads(gridSizeX, gridSizeY, gridSizeZ);
+	DispatchCells(advectCS);
 
 	// Unset resources
 	advectCS->SetShaderResourceView("VelocityIn", 0);
 	advectCS->SetShaderResourceView("AdvectionIn", 0);
 	advectCS->SetShaderResourceView("ObstaclesIn", 0);
-	switch (volumes[1].ChannelCount)
-	{
-	case 1: advectCS->SetUnorderedAccessView("AdvectionOut1", 0); break;
-	case 2: advectCS->SetUnorderedAccessView("AdvectionOut2", 0); break;
-	case 3: advectCS->SetUnorderedAccessView("AdvectionOut3", 0); break;
-	case 4: advectCS->SetUnorderedAccessView("AdvectionOut4", 0); break;
-	}
+	advectCS->SetUnorderedAccessView(outputName, 0);
 
 	// Swap buffers
 	SwapBuffers(volumes);
@@ -526,6 +1081,11 @@ void FluidField::Divergence()
 	Assets& assets = Assets::GetInstance();
 	SimpleComputeShader* divCS = assets.GetComputeShader("DivergenceCS.cso");
 
+	// Sparse steps only write the active bricks, but the
+	// pressure solve reads everything
+	if (sparseBricks)
+		ClearVolume(divergenceBuffer);
+
 	// Turn on
 	divCS->SetShader(); 
 	divCS->SetInt("gridSizeX", gridSizeX);
@@ -539,7 +1099,7 @@ void FluidField::Divergence()
 	divCS->SetUnorderedAccessView("DivergenceOut", divergenceBuffer.UAV);
 
 	// Run compute
-	divCS->DispatchByThreads(gridSizeX, gridSizeY, gridSizeZ);
+	DispatchCells(divCS);
 
 	// Unset resources
 	divCS->SetShaderResourceView("VelocityIn", 0);
@@ -549,23 +1109,33 @@ void FluidField::Divergence()
 
 void FluidField::Pressure()
 {
-	// Grab the clear and pressure shaders
+	// Grab the pressure shader
 	Assets& assets = Assets::GetInstance();
-	SimpleComputeShader* clearCS = assets.GetComputeShader("Clear3DTextureCS.cso");
 	SimpleComputeShader* pressCS = assets.GetComputeShader("PressureCS.cso");
 
 	// Clear --------
-	clearCS->SetShader();
-	clearCS->SetFloat4("clearColor", { 0,0,0,0 });
-	clearCS->SetInt("channelCount", 1);
-	clearCS->CopyAllBufferData();
-
-	clearCS->SetUnorderedAccessView("ClearOut1", pressureBuffers[0].UAV);
-	clearCS->DispatchByThreads(gridSizeX, gridSizeY, gridSizeZ);
-	clearCS->SetUnorderedAccessView("ClearOut1", 0);
+	// Sparse Jacobi iterations skip cells outside the active
+	// bricks, so clear both buffers to leave those at zero
+	ClearVolume(pressureBuffers[0]);
+	if (sparseBricks)
+		ClearVolume(pressureBuffers[1]);
+
+	// With zero pressure, the residual is just the divergence
+	if (measurePressureResidual)
+		divergenceNorm = MeasureResidualNorm();
+
+	// Multigrid -----
+	if (pressureSolver == FLUID_PRESSURE_SOLVER::FLUID_PRESSURE_SOLVER_MULTIGRID)
+	{
+		for (int i = 0; i < multigridCycles; i++)
+			MultigridVCycle(0);
 
+		if (measurePressureResidual)
+			pressureResidualNorm = MeasureResidualNorm();
+		return;
+	}
 
-	// Pressure -----
+	// Jacobi -----
 
 	// Turn on
 	pressCS->SetShader();
@@ -586,7 +1156,7 @@ void FluidField::Pressure()
 		pressCS->SetUnorderedAccessView("PressureOut", pressureBuffers[1].UAV);
 
 		// Run compute
-		pressCS->DispatchByThreads(gridSizeX, gridSizeY, gridSizeZ);
+		DispatchCells(pressCS);
 
 		// Unset output for next iteration
 		pressCS->SetUnorderedAccessView("PressureOut", 0);
@@ -600,6 +1170,583 @@ void FluidField::Pressure()
 	pressCS->SetShaderResourceView("PressureIn", 0);
 	pressCS->SetShaderResourceView("ObstaclesIn", 0);
 	pressCS->SetUnorderedAccessView("PressureOut", 0);
+
+	if (measurePressureResidual)
+		pressureResidualNorm = MeasureResidualNorm();
+}
+
+// --------------------------------------------------------
+// One multigrid V-cycle from the given level down: smooth,
+// restrict the residual to the next level, solve that level
+// for a correction (recursively), prolong the correction
+// back up and smooth again.  The coarsest level is small
+// enough that a handful of smoothing sweeps solves it.
+//
+// PressureSolver is the CPU reference for all of this.
+// --------------------------------------------------------
+void FluidField::MultigridVCycle(unsigned int level)
+{
+	if (level == multigridLevels.size() - 1)
+	{
+		MultigridSmooth(level, MULTIGRID_COARSE_ITERATIONS);
+		return;
+	}
+
+	MultigridSmooth(level, multigridSmoothIterations);
+	MultigridResidual(level);
+	MultigridRestrict(level);
+	MultigridVCycle(level + 1);
+	MultigridProlong(level);
+	MultigridSmooth(level, multigridSmoothIterations);
+}
+
+// --------------------------------------------------------
+// The pressure, right hand side and obstacles of a level,
+// which are the field's own textures for the full size level
+// --------------------------------------------------------
+void FluidField::GetMultigridVolumes(unsigned int level, VolumeResource*& pressure, VolumeResource*& divergence, VolumeResource*& obstacles)
+{
+	if (level == 0)
+	{
+		pressure = pressureBuffers;
+		divergence = &divergenceBuffer;
+		obstacles = &obstacleBuffer;
+		return;
+	}
+
+	pressure = multigridLevels[level].Pressure;
+	divergence = &multigridLevels[level].Divergence;
+	obstacles = &multigridLevels[level].Obstacles;
+}
+
+void FluidField::MultigridSmooth(unsigned int level, int iterations)
+{
+	Assets& assets = Assets::GetInstance();
+	SimpleComputeShader* smoothCS = assets.GetComputeShader("MultigridSmoothCS.cso");
+
+	VolumeResource* pressure;
+	VolumeResource* divergence;
+	VolumeResource* obstacles;
+	GetMultigridVolumes(level, pressure, divergence, obstacles);
+	MultigridLevel& mg = multigridLevels[level];
+
+	// Turn on
+	smoothCS->SetShader();
+	smoothCS->SetInt("gridSizeX", mg.SizeX);
+	smoothCS->SetInt("gridSizeY", mg.SizeY);
+	smoothCS->SetInt("gridSizeZ", mg.SizeZ);
+	smoothCS->SetFloat("smoothWeight", MULTIGRID_SMOOTH_WEIGHT);
+	smoothCS->CopyAllBufferData();
+
+	// Set resources
+	smoothCS->SetShaderResourceView("DivergenceIn", divergence->SRV);
+	smoothCS->SetShaderResourceView("ObstaclesIn", obstacles->SRV);
+
+	for (int i = 0; i < iterations; i++)
+	{
+		// Set pressures (which swap each iteration)
+		smoothCS->SetShaderResourceView("PressureIn", pressure[0].SRV);
+		smoothCS->SetUnorderedAccessView("PressureOut", pressure[1].UAV);
+
+		// Run compute
+		smoothCS->DispatchByThreads(mg.SizeX, mg.SizeY, mg.SizeZ);
+
+		// Unset output for next iteration
+		smoothCS->SetUnorderedAccessView("PressureOut", 0);
+		SwapBuffers(pressure);
+	}
+
+	// Unset resources
+	smoothCS->SetShaderResourceView("DivergenceIn", 0);
+	smoothCS->SetShaderResourceView("PressureIn", 0);
+	smoothCS->SetShaderResourceView("ObstaclesIn", 0);
+}
+
+void FluidField::MultigridResidual(unsigned int level)
+{
+	Assets& assets = Assets::GetInstance();
+	SimpleComputeShader* residualCS = assets.GetComputeShader("MultigridResidualCS.cso");
+
+	VolumeResource* pressure;
+	VolumeResource* divergence;
+	VolumeResource* obstacles;
+	GetMultigridVolumes(level, pressure, divergence, obstacles);
+	MultigridLevel& mg = multigridLevels[level];
+
+	// Turn on
+	residualCS->SetShader();
+	residualCS->SetInt("gridSizeX", mg.SizeX);
+	residualCS->SetInt("gridSizeY", mg.SizeY);
+	residualCS->SetInt("gridSizeZ", mg.SizeZ);
+	residualCS->CopyAllBufferData();
+
+	// Set resources
+	residualCS->SetShaderResourceView("DivergenceIn", divergence->SRV);
+	residualCS->SetShaderResourceView("PressureIn", pressure[0].SRV);
+	residualCS->SetShaderResourceView("ObstaclesIn", obstacles->SRV);
+	residualCS->SetUnorderedAccessView("ResidualOut", mg.Residual.UAV);
+
+	// Run compute
+	residualCS->DispatchByThreads(mg.SizeX, mg.SizeY, mg.SizeZ);
+
+	// Unset resources
+	residualCS->SetShaderResourceView("DivergenceIn", 0);
+	residualCS->SetShaderResourceView("PressureIn", 0);
+	residualCS->SetShaderResourceView("ObstaclesIn", 0);
+	residualCS->SetUnorderedAccessView("ResidualOut", 0);
+}
+
+void FluidField::MultigridRestrict(unsigned int fineLevel)
+{
+	Assets& assets = Assets::GetInstance();
+	SimpleComputeShader* restrictCS = assets.GetComputeShader("MultigridRestrictCS.cso");
+
+	VolumeResource* finePressure;
+	VolumeResource* fineDivergence;
+	VolumeResource* fineObstacles;
+	GetMultigridVolumes(fineLevel, finePressure, fineDivergence, fineObstacles);
+	MultigridLevel& fine = multigridLevels[fineLevel];
+	MultigridLevel& coarse = multigridLevels[fineLevel + 1];
+
+	// Turn on
+	restrictCS->SetShader();
+	restrictCS->SetInt("gridSizeX", fine.SizeX);
+	restrictCS->SetInt("gridSizeY", fine.SizeY);
+	restrictCS->SetInt("gridSizeZ", fine.SizeZ);
+	restrictCS->SetInt("coarseSizeX", coarse.SizeX);
+	restrictCS->SetInt("coarseSizeY", coarse.SizeY);
+	restrictCS->SetInt("coarseSizeZ", coarse.SizeZ);
+	restrictCS->CopyAllBufferData();
+
+	// Set resources - obstacles are restricted every time, so
+	// the pyramid always matches the full size obstacles
+	restrictCS->SetShaderResourceView("ResidualIn", fine.Residual.SRV);
+	restrictCS->SetShaderResourceView("ObstaclesIn", fineObstacles->SRV);
+	restrictCS->SetUnorderedAccessView("DivergenceOut", coarse.Divergence.UAV);
+	restrictCS->SetUnorderedAccessView("ObstaclesOut", coarse.Obstacles.UAV);
+	restrictCS->SetUnorderedAccessView("PressureOut", coarse.Pressure[0].UAV);
+
+	// Run compute
+	restrictCS->DispatchByThreads(coarse.SizeX, coarse.SizeY, coarse.SizeZ);
+
+	// Unset resources
+	restrictCS->SetShaderResourceView("ResidualIn", 0);
+	restrictCS->SetShaderResourceView("ObstaclesIn", 0);
+	restrictCS->SetUnorderedAccessView("DivergenceOut", 0);
+	restrictCS->SetUnorderedAccessView("ObstaclesOut", 0);
+	restrictCS->SetUnorderedAccessView("PressureOut", 0);
+}
+
+void FluidField::MultigridProlong(unsigned int fineLevel)
+{
+	Assets& assets = Assets::GetInstance();
+	SimpleComputeShader* prolongCS = assets.GetComputeShader("MultigridProlongCS.cso");
+
+	VolumeResource* finePressure;
+	VolumeResource* fineDivergence;
+	VolumeResource* fineObstacles;
+	GetMultigridVolumes(fineLevel, finePressure, fineDivergence, fineObstacles);
+	MultigridLevel& fine = multigridLevels[fineLevel];
+	MultigridLevel& coarse = multigridLevels[fineLevel + 1];
+
+	// Turn on
+	prolongCS->SetShader();
+	prolongCS->SetInt("gridSizeX", fine.SizeX);
+	prolongCS->SetInt("gridSizeY", fine.SizeY);
+	prolongCS->SetInt("gridSizeZ", fine.SizeZ);
+	prolongCS->SetInt("coarseSizeX", coarse.SizeX);
+	prolongCS->SetInt("coarseSizeY", coarse.SizeY);
+	prolongCS->SetInt("coarseSizeZ", coarse.SizeZ);
+	prolongCS->CopyAllBufferData();
+
+	// Set resources
+	prolongCS->SetShaderResourceView("CoarsePressureIn", coarse.Pressure[0].SRV);
+	prolongCS->SetShaderResourceView("PressureIn", finePressure[0].SRV);
+	prolongCS->SetUnorderedAccessView("PressureOut", finePressure[1].UAV);
+
+	// Run compute
+	prolongCS->DispatchByThreads(fine.SizeX, fine.SizeY, fine.SizeZ);
+
+	// Unset resources
+	prolongCS->SetShaderResourceView("CoarsePressureIn", 0);
+	prolongCS->SetShaderResourceView("PressureIn", 0);
+	prolongCS->SetUnorderedAccessView("PressureOut", 0);
+
+	// Swap buffers
+	SwapBuffers(finePressure);
+}
+
+// --------------------------------------------------------
+// Root mean square of the full size residual, with obstacles
+// counting as zero (matching PressureSolver::ResidualNorm()).
+// This waits for the GPU to catch up, so it's only done when
+// measurePressureResidual is on.
+// --------------------------------------------------------
+float FluidField::MeasureResidualNorm()
+{
+	MultigridResidual(0);
+
+	Microsoft::WRL::ComPtr<ID3D11Resource> residualTexture;
+	multigridLevels[0].Residual.SRV->GetResource(residualTexture.GetAddressOf());
+	context->CopyResource(residualReadback.Get(), residualTexture.Get());
+
+	D3D11_MAPPED_SUBRESOURCE mapped = {};
+	if (FAILED(context->Map(residualReadback.Get(), 0, D3D11_MAP_READ, 0, &mapped)))
+		return 0.0f;
+
+	double sum = 0.0;
+	for (unsigned int z = 0; z < gridSizeZ; z++)
+		for (unsigned int y = 0; y < gridSizeY; y++)
+		{
+			const float* row = (const float*)((const char*)mapped.pData + z * mapped.DepthPitch + y * mapped.RowPitch);
+			for (unsigned int x = 0; x < gridSizeX; x++)
+				sum += (double)row[x] * row[x];
+		}
+
+	context->Unmap(residualReadback.Get(), 0);
+	return (float)sqrt(sum / ((double)gridSizeX * gridSizeY * gridSizeZ));
+}
+
+// --------------------------------------------------------
+// Everything a time step uses besides the volumes, in the
+// form FluidFieldCPU takes
+// --------------------------------------------------------
+FluidStepParameters FluidField::GetStepParameters()
+{
+	FluidStepParameters params = {};
+	params.FixedTimeStep = fixedTimeStep;
+	params.AmbientTemperature = ambientTemperature;
+	params.InjectTemperature = injectTemperature;
+	params.InjectDensity = injectDensity;
+	params.InjectRadius = injectRadius;
+	params.InjectPosition[0] = injectPosition.x;
+	params.InjectPosition[1] = injectPosition.y;
+	params.InjectPosition[2] = injectPosition.z;
+	params.InjectVelocity[0] = injectVelocityImpulse.x;
+	params.InjectVelocity[1] = injectVelocityImpulse.y;
+	params.InjectVelocity[2] = injectVelocityImpulse.z;
+	params.FluidColor[0] = fluidColor.x;
+	params.FluidColor[1] = fluidColor.y;
+	params.FluidColor[2] = fluidColor.z;
+	params.TemperatureBuoyancy = temperatureBuoyancy;
+	params.DensityWeight = densityWeight;
+	params.VelocityDamper = velocityDamper;
+	params.DensityDamper = densityDamper;
+	params.TemperatureDamper = temperatureDamper;
+	params.VorticityEpsilon = vorticityEpsilon;
+	params.InjectSmoke = injectSmoke;
+	params.ApplyVorticity = applyVorticity;
+	params.PressureSolverType = (int)pressureSolver;
+	params.PressureIterations = pressureIterations;
+	params.MultigridCycles = multigridCycles;
+	params.MultigridSmoothIterations = multigridSmoothIterations;
+	params.SparseBricks = sparseBricks;
+	params.BrickDensityThreshold = brickDensityThreshold;
+	params.BrickVelocityThreshold = brickVelocityThreshold;
+	params.BrickDilation = brickDilation;
+	params.Formats = formats;
+	return params;
+}
+
+// --------------------------------------------------------
+// Runs one time step, saving the state before and after it
+// (and the parameters it ran with) so FluidFieldCPU can
+// check its own step against it - see TestGoldenStep().
+// This waits on the GPU for every volume, twice.
+// --------------------------------------------------------
+bool FluidField::SaveGoldenStep(const char* path)
+{
+	FluidGoldenStep golden;
+	golden.SizeX = gridSizeX;
+	golden.SizeY = gridSizeY;
+	golden.SizeZ = gridSizeZ;
+	golden.Parameters = GetStepParameters();
+
+	ReadBackState(golden.Before);
+	OneTimeStep();
+	ReadBackState(golden.After);
+
+	return FluidFieldCPU::SaveGoldenStep(path, golden);
+}
+
+// --------------------------------------------------------
+// Appends the current density, temperature and velocity to
+// a recording.  This waits on the GPU for all three volumes,
+// so recording runs well below the usual frame rate.
+// --------------------------------------------------------
+bool FluidField::RecordFrame(FluidRecorder& recorder)
+{
+	std::vector<float> planes;
+	ReadBackVolume(densityBuffers[0], 4, planes);
+	ReadBackVolume(temperatureBuffers[0], 1, planes);
+	ReadBackVolume(velocityBuffers[0], 3, planes);
+	return recorder.WriteFrame(planes.data());
+}
+
+// --------------------------------------------------------
+// Replaces the current density, temperature and velocity
+// with a frame from a FluidPlayer, which must match the grid
+// size.  Stepping afterwards carries on from the frame.
+// --------------------------------------------------------
+bool FluidField::PlayFrame(const FluidSequenceFrame& frame)
+{
+	size_t cellCount = (size_t)gridSizeX * gridSizeY * gridSizeZ;
+	if (frame.Planes.size() != cellCount * FLUID_SEQUENCE_CHANNELS)
+		return false;
+
+	UploadVolume(densityBuffers[0], 4, frame.Planes.data());
+	UploadVolume(temperatureBuffers[0], 1, frame.Planes.data() + cellCount * 4);
+	UploadVolume(velocityBuffers[0], 3, frame.Planes.data() + cellCount * 5);
+	return true;
+}
+
+// --------------------------------------------------------
+// Times the kernels whose cost is mostly memory traffic, so
+// format policies can be compared: velocity advection,
+// density advection and Jacobi pressure iterations, each
+// repeated over every cell and averaged.  This advects the
+// current fluid over and over, so it's for benchmarks rather
+// than the middle of a simulation.
+// --------------------------------------------------------
+FluidKernelTimings FluidField::TimeKernels(int repeats)
+{
+	FluidKernelTimings timings = {};
+	timings.GridSize = gridSizeX;
+	timings.BytesPerCell = GetBytesPerCell();
+	if (repeats <= 0)
+		return timings;
+
+	// Every cell, with plain Jacobi iterations
+	bool oldSparseBricks = sparseBricks;
+	bool oldMeasureResidual = measurePressureResidual;
+	int oldPressureIterations = pressureIterations;
+	FLUID_PRESSURE_SOLVER oldPressureSolver = pressureSolver;
+	sparseBricks = false;
+	measurePressureResidual = false;
+	pressureIterations = repeats;
+	pressureSolver = FLUID_PRESSURE_SOLVER::FLUID_PRESSURE_SOLVER_JACOBI;
+	currentTimeStep = fixedTimeStep;
+
+	// Timestamps between the kernels
+	D3D11_QUERY_DESC queryDesc = {};
+	queryDesc.Query = D3D11_QUERY_TIMESTAMP_DISJOINT;
+	Microsoft::WRL::ComPtr<ID3D11Query> disjoint;
+	device->CreateQuery(&queryDesc, disjoint.GetAddressOf());
+
+	queryDesc.Query = D3D11_QUERY_TIMESTAMP;
+	Microsoft::WRL::ComPtr<ID3D11Query> timestamps[4];
+	for (int i = 0; i < 4; i++)
+		device->CreateQuery(&queryDesc, timestamps[i].GetAddressOf());
+
+	context->Begin(disjoint.Get());
+	context->End(timestamps[0].Get());
+	for (int i = 0; i < repeats; i++)
+		Advection(velocityBuffers, velocityDamper);
+	context->End(timestamps[1].Get());
+	for (int i = 0; i < repeats; i++)
+		Advection(densityBuffers, densityDamper);
+	context->End(timestamps[2].Get());
+	Pressure(); // Includes clearing the pressure first
+	context->End(timestamps[3].Get());
+	context->End(disjoint.Get());
+
+	sparseBricks = oldSparseBricks;
+	measurePressureResidual = oldMeasureResidual;
+	pressureIterations = oldPressureIterations;
+	pressureSolver = oldPressureSolver;
+
+	// Wait for the results
+	D3D11_QUERY_DATA_TIMESTAMP_DISJOINT disjointData = {};
+	while (context->GetData(disjoint.Get(), &disjointData, sizeof(disjointData), 0) == S_FALSE);
+
+	UINT64 ticks[4] = {};
+	for (int i = 0; i < 4; i++)
+		while (context->GetData(timestamps[i].Get(), &ticks[i], sizeof(UINT64), 0) == S_FALSE);
+
+	// Timestamps are meaningless if the clock changed
+	if (disjointData.Disjoint || disjointData.Frequency == 0)
+		return timings;
+
+	double msPerTick = 1000.0 / disjointData.Frequency;
+	timings.VelocityAdvectionMS = (ticks[1] - ticks[0]) * msPerTick / repeats;
+	timings.DensityAdvectionMS = (ticks[2] - ticks[1]) * msPerTick / repeats;
+	timings.PressureIterationMS = (ticks[3] - ticks[2]) * msPerTick / repeats;
+
+	// Bytes each kernel moves per cell, reading or writing
+	// each texel once (velocity advection reads and samples
+	// the same texture)
+	double cellCount = (double)gridSizeX * gridSizeY * gridSizeZ;
+	double velocityBytes = DXGIFormatBytes(VolumeFormat(formats.Velocity, 4));
+	double densityBytes = DXGIFormatBytes(VolumeFormat(formats.Density, 4));
+	double pressureBytes = DXGIFormatBytes(VolumeFormat(formats.Pressure, 1));
+	double divergenceBytes = DXGIFormatBytes(DXGI_FORMAT_R32_FLOAT);
+	double obstacleBytes = DXGIFormatBytes(DXGI_FORMAT_R8_UNORM);
+
+	if (timings.VelocityAdvectionMS > 0)
+		timings.VelocityAdvectionGBPerSecond = cellCount * (2 * velocityBytes + obstacleBytes) / (timings.VelocityAdvectionMS * 1e6);
+	if (timings.DensityAdvectionMS > 0)
+		timings.DensityAdvectionGBPerSecond = cellCount * (velocityBytes + 2 * densityBytes + obstacleBytes) / (timings.DensityAdvectionMS * 1e6);
+	if (timings.PressureIterationMS > 0)
+		timings.PressureIterationGBPerSecond = cellCount * (2 * pressureBytes + divergenceBytes + obstacleBytes) / (timings.PressureIterationMS * 1e6);
+
+	return timings;
+}
+
+// --------------------------------------------------------
+// Reads back every volume a step uses, laid out like
+// FluidFieldCPU::GetState(): both halves of each ping-pong
+// pair, since obstacle cells keep stale values
+// --------------------------------------------------------
+void FluidField::ReadBackState(std::vector<float>& state)
+{
+	state.clear();
+	ReadBackVolume(velocityBuffers[0], 3, state);
+	ReadBackVolume(velocityBuffers[1], 3, state);
+	ReadBackVolume(densityBuffers[0], 4, state);
+	ReadBackVolume(densityBuffers[1], 4, state);
+	ReadBackVolume(temperatureBuffers[0], 1, state);
+	ReadBackVolume(temperatureBuffers[1], 1, state);
+	ReadBackVolume(vorticityBuffer, 3, state);
+	ReadBackVolume(pressureBuffers[0], 1, state);
+	ReadBackVolume(divergenceBuffer, 1, state);
+	ReadBackVolume(obstacleBuffer, 1, state);
+}
+
+// --------------------------------------------------------
+// Appends the first few channels of a volume to an array,
+// one plane per channel.  Values are decoded from whatever
+// format the volume is in (so R8_UNORM obstacles become 0-1)
+// and multiplied back up by the volume's channel scales.
+// --------------------------------------------------------
+void FluidField::ReadBackVolume(VolumeResource& volume, unsigned int channelCount, std::vector<float>& state)
+{
+	size_t cellCount = (size_t)gridSizeX * gridSizeY * gridSizeZ;
+	size_t start = state.size();
+	state.resize(start + cellCount * channelCount);
+
+	// Staging copy of the volume's texture
+	Microsoft::WRL::ComPtr<ID3D11Resource> resource;
+	Microsoft::WRL::ComPtr<ID3D11Texture3D> texture;
+	volume.SRV->GetResource(resource.GetAddressOf());
+	if (FAILED(resource.As(&texture)))
+		return;
+
+	D3D11_TEXTURE3D_DESC desc = {};
+	texture->GetDesc(&desc);
+	desc.BindFlags = 0;
+	desc.MiscFlags = 0;
+	desc.Usage = D3D11_USAGE_STAGING;
+	desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+
+	Microsoft::WRL::ComPtr<ID3D11Texture3D> readback;
+	if (FAILED(device->CreateTexture3D(&desc, 0, readback.GetAddressOf())))
+		return;
+	context->CopyResource(readback.Get(), texture.Get());
+
+	D3D11_MAPPED_SUBRESOURCE mapped = {};
+	if (FAILED(context->Map(readback.Get(), 0, D3D11_MAP_READ, 0, &mapped)))
+		return;
+
+	unsigned int texelChannels = DXGIFormatChannels(desc.Format);
+	const float scale[4] = { volume.ChannelScale.x, volume.ChannelScale.y, volume.ChannelScale.z, volume.ChannelScale.w };
+	for (unsigned int z = 0; z < gridSizeZ; z++)
+		for (unsigned int y = 0; y < gridSizeY; y++)
+		{
+			const char* row = (const char*)mapped.pData + z * mapped.DepthPitch + y * mapped.RowPitch;
+			for (unsigned int x = 0; x < gridSizeX; x++)
+			{
+				size_t index = x + gridSizeX * (y + gridSizeY * z);
+				for (unsigned int c = 0; c < channelCount; c++)
+				{
+					size_t element = (size_t)x * texelChannels + c;
+					float value;
+					switch (desc.Format)
+					{
+					case DXGI_FORMAT_R8_UNORM:
+					case DXGI_FORMAT_R8G8B8A8_UNORM:
+						value = ((const unsigned char*)row)[element] / 255.0f;
+						break;
+
+					case DXGI_FORMAT_R16_SNORM:
+					case DXGI_FORMAT_R16G16B16A16_SNORM:
+						value = max(((const short*)row)[element] / 32767.0f, -1.0f);
+						break;
+
+					case DXGI_FORMAT_R16_FLOAT:
+					case DXGI_FORMAT_R16G16B16A16_FLOAT:
+						value = PackedVector::XMConvertHalfToFloat(((const PackedVector::HALF*)row)[element]);
+						break;
+
+					default:
+						value = ((const float*)row)[element];
+						break;
+					}
+					state[start + c * cellCount + index] = value * scale[c];
+				}
+			}
+		}
+
+	context->Unmap(readback.Get(), 0);
+}
+
+// --------------------------------------------------------
+// The reverse of ReadBackVolume(): fills the first few
+// channels of a volume from planes of floats, dividing by
+// the volume's channel scales and encoding them in its
+// format.  Any channels after those are zeroed.
+// --------------------------------------------------------
+void FluidField::UploadVolume(VolumeResource& volume, unsigned int channelCount, const float* planes)
+{
+	size_t cellCount = (size_t)gridSizeX * gridSizeY * gridSizeZ;
+
+	Microsoft::WRL::ComPtr<ID3D11Resource> resource;
+	Microsoft::WRL::ComPtr<ID3D11Texture3D> texture;
+	volume.SRV->GetResource(resource.GetAddressOf());
+	if (FAILED(resource.As(&texture)))
+		return;
+
+	D3D11_TEXTURE3D_DESC desc = {};
+	texture->GetDesc(&desc);
+
+	unsigned int texelChannels = DXGIFormatChannels(desc.Format);
+	unsigned int texelBytes = DXGIFormatBytes(desc.Format);
+	std::vector<char> texels(cellCount * texelBytes, 0);
+
+	const float scale[4] = { volume.ChannelScale.x, volume.ChannelScale.y, volume.ChannelScale.z, volume.ChannelScale.w };
+	for (size_t index = 0; index < cellCount; index++)
+	{
+		for (unsigned int c = 0; c < channelCount && c < texelChannels; c++)
+		{
+			size_t element = index * texelChannels + c;
+			float value = planes[c * cellCount + index] / scale[c];
+			switch (desc.Format)
+			{
+			case DXGI_FORMAT_R8_UNORM:
+			case DXGI_FORMAT_R8G8B8A8_UNORM:
+				((unsigned char*)texels.data())[element] = (unsigned char)(max(0.0f, min(value, 1.0f)) * 255.0f + 0.5f);
+				break;
+
+			case DXGI_FORMAT_R16_SNORM:
+			case DXGI_FORMAT_R16G16B16A16_SNORM:
+				((short*)texels.data())[element] = (short)roundf(max(-1.0f, min(value, 1.0f)) * 32767.0f);
+				break;
+
+			case DXGI_FORMAT_R16_FLOAT:
+			case DXGI_FORMAT_R16G16B16A16_FLOAT:
+				((PackedVector::HALF*)texels.data())[element] = PackedVector::XMConvertFloatToHalf(value);
+				break;
+
+			default:
+				((float*)texels.data())[element] = value;
+				break;
+			}
+		}
+	}
+
+	context->UpdateSubresource(
+		texture.Get(), 0, 0, texels.data(),
+		texelBytes * gridSizeX,
+		texelBytes * gridSizeX * gridSizeY);
 }
 
 void FluidField::Projection()
@@ -622,7 +1769,7 @@ void FluidField::Projection()
 	projCS->SetUnorderedAccessView("VelocityOut", velocityBuffers[1].UAV);
 
 	// Run compute
-	projCS->DispatchByThreads(gridSizeX, gridSizeY, gridSizeZ);
+	DispatchCells(projCS);
 
 	// Unset resources
 	projCS->SetShaderResourceView("PressureIn", 0);
@@ -645,13 +1792,17 @@ void FluidField::InjectSmoke()
 	injCS->SetInt("gridSizeX", gridSizeX);
 	injCS->SetInt("gridSizeY", gridSizeY);
 	injCS->SetInt("gridSizeZ", gridSizeZ);
-	injCS->SetFloat("deltaTime", fixedTimeStep);
+	injCS->SetFloat("deltaTime", currentTimeStep);
 	injCS->SetFloat("injectRadius", injectRadius);
 	injCS->SetFloat3("injectPosition", injectPosition);
 	injCS->SetFloat3("injectColor", fluidColor);
 	injCS->SetFloat("injectDensity", injectDensity);
 	injCS->SetFloat("injectTemperature", injectTemperature);
 	injCS->SetFloat3("injectVelocity", injectVelocityImpulse);
+	injCS->SetFloat("densityScale", densityBuffers[0].ChannelScale.w);
+	injCS->SetFloat("temperatureScale", temperatureBuffers[0].ChannelScale.x);
+	injCS->SetInt("densityType", densityBuffers[1].UAVType);
+	injCS->SetInt("temperatureType", temperatureBuffers[1].UAVType);
 	injCS->CopyAllBufferData();
 
 	// Set resources
@@ -659,20 +1810,22 @@ void FluidField::InjectSmoke()
 	injCS->SetShaderResourceView("TemperatureIn", temperatureBuffers[0].SRV);
 	injCS->SetShaderResourceView("ObstaclesIn", obstacleBuffer.SRV);
 	injCS->SetShaderResourceView("VelocityIn", velocityBuffers[0].SRV);
-	injCS->SetUnorderedAccessView("DensityOut", densityBuffers[1].UAV);
-	injCS->SetUnorderedAccessView("TemperatureOut", temperatureBuffers[1].UAV);
+	std::string densityName = UAVName("DensityOut", densityBuffers[1]);
+	std::string temperatureName = UAVName("TemperatureOut", temperatureBuffers[1]);
+	injCS->SetUnorderedAccessView(densityName, densityBuffers[1].UAV);
+	injCS->SetUnorderedAccessView(temperatureName, temperatureBuffers[1].UAV);
 	injCS->SetUnorderedAccessView("VelocityOut", velocityBuffers[1].UAV);
 
 	// Run compute
-	injCS->DispatchByThreads(gridSizeX, gridSizeY, gridSizeZ);
+	DispatchCells(injCS);
 
 	// Unset resources
 	injCS->SetShaderResourceView("DensityIn", 0);
 	injCS->SetShaderResourceView("TemperatureIn", 0);
 	injCS->SetShaderResourceView("ObstaclesIn", 0);
 	injCS->SetShaderResourceView("VelocityIn", 0);
-	injCS->SetUnorderedAccessView("DensityOut", 0);
-	injCS->SetUnorderedAccessView("TemperatureOut", 0);
+	injCS->SetUnorderedAccessView(densityName, 0);
+	injCS->SetUnorderedAccessView(temperatureName, 0);
 	injCS->SetUnorderedAccessView("VelocityOut", 0);
 
 	// Swap buffers
@@ -692,10 +1845,12 @@ void FluidField::Buoyancy()
 
 	// Turn on and set data
 	buoyCS->SetShader();
-	buoyCS->SetFloat("deltaTime", fixedTimeStep);
+	buoyCS->SetFloat("deltaTime", currentTimeStep);
 	buoyCS->SetFloat("densityWeight", densityWeight);
 	buoyCS->SetFloat("temperatureBuoyancy", temperatureBuoyancy);
 	buoyCS->SetFloat("ambientTemperature", ambientTemperature);
+	buoyCS->SetFloat("densityScale", densityBuffers[0].ChannelScale.w);
+	buoyCS->SetFloat("temperatureScale", temperatureBuffers[0].ChannelScale.x);
 	buoyCS->CopyAllBufferData();
 
 	// Set resources
@@ -706,7 +1861,7 @@ void FluidField::Buoyancy()
 	buoyCS->SetUnorderedAccessView("VelocityOut", velocityBuffers[1].UAV);
 
 	// Run compute
-	buoyCS->DispatchByThreads(gridSizeX, gridSizeY, gridSizeZ);
+	DispatchCells(buoyCS);
 
 	// Unset resources
 	buoyCS->SetShaderResourceView("VelocityIn", 0);
@@ -738,7 +1893,7 @@ void FluidField::Vorticity()
 	vortCS->SetUnorderedAccessView("VorticityOut", vorticityBuffer.UAV);
 
 	// Run compute
-	vortCS->DispatchByThreads(gridSizeX, gridSizeY, gridSizeZ);
+	DispatchCells(vortCS);
 
 	// Unset resources
 	vortCS->SetShaderResourceView("VelocityIn", 0);
@@ -754,7 +1909,7 @@ void FluidField::Confinement()
 
 	// Turn on
 	confCS->SetShader();
-	confCS->SetFloat("deltaTime", fixedTimeStep);
+	confCS->SetFloat("deltaTime", currentTimeStep);
 	confCS->SetInt("gridSizeX", gridSizeX);
 	confCS->SetInt("gridSizeY", gridSizeY);
 	confCS->SetInt("gridSizeZ", gridSizeZ);
@@ -768,7 +1923,7 @@ void FluidField::Confinement()
 	confCS->SetUnorderedAccessView("VelocityOut", velocityBuffers[1].UAV);
 
 	// Run compute
-	confCS->DispatchByThreads(gridSizeX, gridSizeY, gridSizeZ);
+	DispatchCells(confCS);
 
 	// Unset resources
 	confCS->SetShaderResourceView("VorticityIn", 0);
@@ -781,6 +1936,64 @@ void FluidField::Confinement()
 }
 
 
+// --------------------------------------------------------
+// The texture format for a FLUID_FORMAT value with either
+// one or four channels
+// --------------------------------------------------------
+DXGI_FORMAT FluidField::VolumeFormat(int format, unsigned int channelCount)
+{
+	bool single = channelCount == 1;
+	switch (format)
+	{
+	case FLUID_FORMAT_HALF: return single ? DXGI_FORMAT_R16_FLOAT : DXGI_FORMAT_R16G16B16A16_FLOAT;
+	case FLUID_FORMAT_UNORM8: return single ? DXGI_FORMAT_R8_UNORM : DXGI_FORMAT_R8G8B8A8_UNORM;
+	case FLUID_FORMAT_SNORM16: return single ? DXGI_FORMAT_R16_SNORM : DXGI_FORMAT_R16G16B16A16_SNORM;
+	default:
+	case FLUID_FORMAT_FLOAT: return single ? DXGI_FORMAT_R32_FLOAT : DXGI_FORMAT_R32G32B32A32_FLOAT;
+	}
+}
+
+// --------------------------------------------------------
+// Which UAV variant a volume of this format is written
+// through (see VOLUME_UAV_FLOAT), and the name of that
+// variant for a UAV declared as baseName, baseNameUnorm and
+// baseNameSnorm
+// --------------------------------------------------------
+int FluidField::DXGIFormatUAVType(DXGI_FORMAT format)
+{
+	switch (format)
+	{
+	case DXGI_FORMAT_R8_UNORM:
+	case DXGI_FORMAT_R8G8_UNORM:
+	case DXGI_FORMAT_R8G8B8A8_UNORM:
+	case DXGI_FORMAT_R16_UNORM:
+	case DXGI_FORMAT_R16G16_UNORM:
+	case DXGI_FORMAT_R16G16B16A16_UNORM:
+		return VOLUME_UAV_UNORM;
+
+	case DXGI_FORMAT_R8_SNORM:
+	case DXGI_FORMAT_R8G8_SNORM:
+	case DXGI_FORMAT_R8G8B8A8_SNORM:
+	case DXGI_FORMAT_R16_SNORM:
+	case DXGI_FORMAT_R16G16_SNORM:
+	case DXGI_FORMAT_R16G16B16A16_SNORM:
+		return VOLUME_UAV_SNORM;
+
+	default:
+		return VOLUME_UAV_FLOAT;
+	}
+}
+
+std::string FluidField::UAVName(const std::string& baseName, const VolumeResource& volume)
+{
+	switch (volume.UAVType)
+	{
+	case VOLUME_UAV_UNORM: return baseName + "Unorm";
+	case VOLUME_UAV_SNORM: return baseName + "Snorm";
+	default: return baseName;
+	}
+}
+
 // From DirectXTex library
 unsigned int FluidField::DXGIFormatBits(DXGI_FORMAT format)
 {
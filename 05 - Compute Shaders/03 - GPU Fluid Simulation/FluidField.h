@@ -3,9 +3,15 @@
 #include <d3d11.h>
 #include <wrl/client.h>
 #include <DirectXMath.h>
+#include <vector>
+#include <string>
 
 #include "Camera.h"
 #include "GameEntity.h"
+#include "PressureSolver.h"
+#include "FluidFieldCPU.h"
+#include "FluidSequence.h"
+#include "ObstacleVoxelizer.h"
 
 enum class FLUID_RENDER_BUFFER
 {
@@ -24,15 +30,67 @@ enum class FLUID_RENDER_MODE
 	FLUID_RENDER_MODE_ADD
 };
 
+enum class FLUID_PRESSURE_SOLVER
+{
+	FLUID_PRESSURE_SOLVER_JACOBI,
+	FLUID_PRESSURE_SOLVER_MULTIGRID
+};
+
 enum class FLUID_SIMULATION_TYPE
 {
 	SMOKE,
 	WATER
 };
 
+// --------------------------------------------------------
+// GPU time per dispatch of the kernels that mostly just move
+// memory, and the bandwidth that works out to (counting each
+// texel read or written once)
+// --------------------------------------------------------
+struct FluidKernelTimings
+{
+	unsigned int GridSize;
+	unsigned int BytesPerCell;
+	double VelocityAdvectionMS;
+	double DensityAdvectionMS;
+	double PressureIterationMS;
+	double VelocityAdvectionGBPerSecond;
+	double DensityAdvectionGBPerSecond;
+	double PressureIterationGBPerSecond;
+};
+
+// Consecutive calm max speed readings before a field that
+// isn't being injected into is considered at rest
+#define FLUID_REST_READINGS 8
+
+// --------------------------------------------------------
+// What UpdateFluid() did with the last frame's time when
+// stepping adaptively
+// --------------------------------------------------------
+struct FluidFrameStats
+{
+	int Steps;				// Zero while piling up time for a longer step, or at rest
+	float TimeStep;			// Length of each step
+	float SimulatedTime;	// Steps * TimeStep
+	float DroppedTime;		// Frame time left unsimulated because of the substep budget
+	float MaxSpeed;			// Cells per second the steps were chosen for
+	bool SpeedFromCPU;		// No GPU reduction was back, so velocity was read back instead
+	bool AtRest;
+};
+
+// What a volume's UAV has to be declared as in a shader: the
+// return type has to match the format's components, so
+// fixed point volumes are written through unorm/snorm UAVs
+// (match these in ComputeHelpers.hlsli)
+#define VOLUME_UAV_FLOAT 0
+#define VOLUME_UAV_UNORM 1
+#define VOLUME_UAV_SNORM 2
+
 struct VolumeResource
 {
 	unsigned int ChannelCount{ 0 };
+	int UAVType{ VOLUME_UAV_FLOAT };
+	DirectX::XMFLOAT4 ChannelScale{ 1.0f, 1.0f, 1.0f, 1.0f }; // Values are stored divided by this
 	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> SRV;
 	Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView> UAV;
 
@@ -57,15 +115,39 @@ public:
 	void RecreateGPUResources();
 	void UpdateFluid(float deltaTime);
 	void OneTimeStep();
+	void OneTimeStep(float timeStep);
 	void RenderFluid(Camera* camera);
 
+	// Obstacles are voxelized on the CPU - only what's moved is redone
 	void VoxelizeObstacle(GameEntity* entity);
+	void RemoveObstacle(GameEntity* entity);
+	void UpdateObstacles();
+
+	// Golden steps for FluidFieldCPU to check against (stalls for readbacks!)
+	FluidStepParameters GetStepParameters();
+	bool SaveGoldenStep(const char* path);
+
+	// Recording (stalls for readbacks!) and playback of density, temperature and velocity
+	bool RecordFrame(FluidRecorder& recorder);
+	bool PlayFrame(const FluidSequenceFrame& frame);
+
+	// Storage formats - changing them recreates every volume (so the fluid is lost)
+	FluidFormatPolicy GetFormats();
+	void SetFormats(const FluidFormatPolicy& formats);
+	FluidKernelTimings TimeKernels(int repeats); // Waits on the GPU
 
 	// Publically accessible data
 	bool pause;
 	bool injectSmoke;
 	bool applyVorticity;
 	int pressureIterations;
+	int multigridCycles;
+	int multigridSmoothIterations;
+	bool measurePressureResidual; // Stalls for a readback each step!
+	bool sparseBricks;
+	float brickDensityThreshold;
+	float brickVelocityThreshold;
+	int brickDilation;
 	int raymarchSamples;
 	float fixedTimeStep;
 	float ambientTemperature;
@@ -82,6 +164,17 @@ public:
 	DirectX::XMFLOAT3 fluidColor;
 	FLUID_RENDER_BUFFER renderBuffer;
 	FLUID_RENDER_MODE renderMode;
+	FLUID_PRESSURE_SOLVER pressureSolver;
+
+	// Adaptive time stepping: each frame's time is split into
+	// equal steps short enough that the fastest cell moves at
+	// most cflNumber cells per step (up to maxSubsteps a frame)
+	bool adaptiveTimeStep;
+	bool gpuSpeedReduction;	// Otherwise velocity is read back (stalls!) to find the max speed
+	float cflNumber;
+	float maxTimeStep;
+	int maxSubsteps;
+	float restSpeed;		// Cells per second below which a field with no injection is at rest
 
 	unsigned int GetGridSizeX();
 	unsigned int GetGridSizeY();
@@ -90,6 +183,20 @@ public:
 	DirectX::XMFLOAT3 GetInjectPosition();
 	void SetInjectPosition(DirectX::XMFLOAT3 newPos, bool applyVelocityImpulse);
 
+	// Pressure solver stats
+	unsigned int GetMultigridLevelCount();
+	float GetPressureSolverPasses();
+	float GetDivergenceNorm();
+	float GetPressureResidualNorm();
+
+	// Sparse brick stats (the active count is a few frames old)
+	unsigned int GetBrickCount();
+	unsigned int GetActiveBrickCount();
+	unsigned int GetBytesPerCell();
+
+	// Adaptive time stepping stats
+	FluidFrameStats GetFrameStats();
+
 private:
 
 	// Private field data
@@ -98,9 +205,9 @@ private:
 	unsigned int gridSizeY;
 	unsigned int gridSizeZ;
 	float timeCounter;
-	bool obstaclesEnabled;
 	DirectX::XMFLOAT3 injectPosition;
 	DirectX::XMFLOAT3 injectVelocityImpulse;
+	FluidFormatPolicy formats;
 
 	// Volume textures for all fluids
 	VolumeResource velocityBuffers[2];
@@ -115,6 +222,69 @@ private:
 	// Obstacle textures
 	VolumeResource obstacleBuffer;
 
+	// Multigrid pyramid - level 0 is the full grid, which uses
+	// the pressure, divergence and obstacle textures above
+	struct MultigridLevel
+	{
+		unsigned int SizeX;
+		unsigned int SizeY;
+		unsigned int SizeZ;
+		VolumeResource Pressure[2];
+		VolumeResource Divergence;	// Right hand side (restricted residual)
+		VolumeResource Obstacles;
+		VolumeResource Residual;
+	};
+	std::vector<MultigridLevel> multigridLevels;
+
+	// Residual measurement
+	Microsoft::WRL::ComPtr<ID3D11Texture3D> residualReadback;
+	float divergenceNorm;
+	float pressureResidualNorm;
+
+	// Sparse simulation - per brick activity and whether each
+	// brick was simulated last step, plus lists of the bricks
+	// to simulate and to retire (clear) this step, built on
+	// the GPU and dispatched over indirectly (a group per
+	// brick along X, so up to 65535 bricks - a 320^3 grid)
+	struct BrickList
+	{
+		Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView> UAV;	// Has a counter
+		Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> SRV;
+		Microsoft::WRL::ComPtr<ID3D11Buffer> DispatchArgs;		// Brick count, 1, 1
+
+		void Reset()
+		{
+			UAV.Reset();
+			SRV.Reset();
+			DispatchArgs.Reset();
+		}
+	};
+	unsigned int brickCountX;
+	unsigned int brickCountY;
+	unsigned int brickCountZ;
+	VolumeResource brickActivity;
+	VolumeResource brickSimulated;
+	BrickList activeBricks;
+	BrickList retiredBricks;
+	Microsoft::WRL::ComPtr<ID3D11Buffer> activeBrickCountReadback;
+	unsigned int activeBrickCount;
+	bool sparseLastStep;
+
+	// Adaptive time stepping - the largest speed in the field
+	// is reduced on the GPU and copied to a staging buffer, and
+	// a new reduction only starts once that one has been read,
+	// so a result always shows up a frame or few later
+	float currentTimeStep;
+	Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView> maxSpeedUAV;
+	Microsoft::WRL::ComPtr<ID3D11Buffer> maxSpeedReadback;
+	bool maxSpeedPending;	// Copied to the readback buffer but not read yet
+	bool maxSpeedKnown;		// False until something has been measured
+	float maxSpeed;
+	int calmReadings;		// Consecutive speeds under restSpeed with nothing injected
+	bool atRest;
+	FluidStepParameters restParameters;	// Anything changing wakes the field up
+	FluidFrameStats frameStats;
+
 	// Liquid textures
 	VolumeResource levelSetBuffers[2];
 
@@ -126,13 +296,11 @@ private:
 	Microsoft::WRL::ComPtr<ID3D11DepthStencilState> depthState;
 	Microsoft::WRL::ComPtr<ID3D11RasterizerState> rasterState;
 
-	// Obstacle voxelization
-	Microsoft::WRL::ComPtr<ID3D11DepthStencilState> voxelizationDepthStencilState;
-	Microsoft::WRL::ComPtr<ID3D11DepthStencilView> voxelizationDepthStencilView; // Texture array!
-	DirectX::XMFLOAT4X4 voxelizationViewMatrix;
-	DirectX::XMFLOAT4X4* voxelizationProjectionMatrices;
+	// Obstacle voxelization (on the CPU)
+	ObstacleVoxelizer voxelizer;
 
 	// Helper methods
+	DirectX::XMMATRIX GetVolumeWorldMatrix();
 	void SwapBuffers(VolumeResource volumes[2]);
 	VolumeResource CreateVolumeResource(
 		unsigned int sizeX, 
@@ -140,11 +308,28 @@ private:
 		unsigned int sizeZ, 
 		DXGI_FORMAT format = DXGI_FORMAT_R8G8B8A8_UNORM, 
 		void* initialData = 0);
+	BrickList CreateBrickList(unsigned int maxBricks);
+	void DispatchCells(SimpleComputeShader* shader);
+	void DispatchBricks(SimpleComputeShader* shader, BrickList* bricks);
+	void ClearVolume(VolumeResource& volume, BrickList* bricks = 0);
 
 	// Fluid functions
+	void UpdateActiveBricks();
+	void MeasureMaxSpeed();
+	bool ReadMaxSpeed();
 	void Advection(VolumeResource volumes[2], float damper = 1.0f);
 	void Divergence();
 	void Pressure();
+	void MultigridVCycle(unsigned int level);
+	void MultigridSmooth(unsigned int level, int iterations);
+	void MultigridResidual(unsigned int level);
+	void MultigridRestrict(unsigned int fineLevel);
+	void MultigridProlong(unsigned int fineLevel);
+	void GetMultigridVolumes(unsigned int level, VolumeResource*& pressure, VolumeResource*& divergence, VolumeResource*& obstacles);
+	float MeasureResidualNorm();
+	void ReadBackState(std::vector<float>& state);
+	void ReadBackVolume(VolumeResource& volume, unsigned int channelCount, std::vector<float>& state);
+	void UploadVolume(VolumeResource& volume, unsigned int channelCount, const float* planes);
 	void Projection();
 	void InjectSmoke();
 	void Buoyancy();
@@ -152,8 +337,11 @@ private:
 	void Confinement();
 
 	// Format helpers
+	DXGI_FORMAT VolumeFormat(int format, unsigned int channelCount);
 	unsigned int DXGIFormatBits(DXGI_FORMAT format);
 	unsigned int DXGIFormatBytes(DXGI_FORMAT format);
 	unsigned int DXGIFormatChannels(DXGI_FORMAT format);
+	int DXGIFormatUAVType(DXGI_FORMAT format);
+	std::string UAVName(const std::string& baseName, const VolumeResource& volume);
 };
 
@@ -0,0 +1,1450 @@
+#include "FluidFieldCPU.h"
+
+#include <emmintrin.h>
+#include <cmath>
+#include <cstring>
+#include <chrono>
+#include <fstream>
+#include <algorithm>
+
+// FLUID_PRESSURE_SOLVER values, without including FluidField.h (and D3D)
+#define PRESSURE_SOLVER_JACOBI 0
+#define PRESSURE_SOLVER_MULTIGRID 1
+
+// Golden step files start with "FGLD" and a version
+#define GOLDEN_MAGIC 0x444C4746
+#define GOLDEN_VERSION 3
+
+// Names for the lane types inside a kernel - kernels that
+// test or select per lane also want typename L::Mask
+#define KERNEL_LANES(lanes) typedef decltype(lanes) L; typedef typename L::Float Float
+
+
+// --------------------------------------------------------
+// Four floats in an SSE register, with just the arithmetic
+// operators the kernels need.  Plain floats convert to all
+// four lanes, so kernels can mix them in like scalars.
+// Passed by reference, as 32 bit builds can't pass aligned
+// structs by value.
+// --------------------------------------------------------
+struct Float4
+{
+	__m128 v;
+	Float4() {}
+	Float4(__m128 v) : v(v) {}
+	Float4(float f) : v(_mm_set1_ps(f)) {}
+};
+
+inline Float4 operator+(const Float4& a, const Float4& b) { return _mm_add_ps(a.v, b.v); }
+inline Float4 operator-(const Float4& a, const Float4& b) { return _mm_sub_ps(a.v, b.v); }
+inline Float4 operator*(const Float4& a, const Float4& b) { return _mm_mul_ps(a.v, b.v); }
+inline Float4 operator/(const Float4& a, const Float4& b) { return _mm_div_ps(a.v, b.v); }
+
+// --------------------------------------------------------
+// One cell at a time - the scalar path, and the cells at
+// either end of each row on the SSE path
+// --------------------------------------------------------
+struct ScalarLanes
+{
+	typedef float Float;
+	typedef bool Mask;
+
+	static Float Load(const float* p) { return *p; }
+	static void Store(float* p, Float v) { *p = v; }
+	static void StoreInts(Float v, int* p) { *p = (int)v; }
+	static Float CellX(int x) { return (float)x; }
+
+	static Mask Obstacle(const unsigned char* p) { return *p != 0; }
+	static Mask All(bool b) { return b; }
+	static Mask Or(Mask a, Mask b) { return a || b; }
+	static Mask Greater(Float a, Float b) { return a > b; }
+	static Mask NotEqual(Float a, Float b) { return a != b; }
+	static Float Select(Mask m, Float a, Float b) { return m ? a : b; }
+
+	// Same results (even for NaNs) as the SSE instructions
+	static Float Min(Float a, Float b) { return a < b ? a : b; }
+	static Float Max(Float a, Float b) { return a > b ? a : b; }
+	static Float Sqrt(Float v) { return sqrtf(v); }
+	static Float Floor(Float v) { return floorf(v); }
+};
+
+// --------------------------------------------------------
+// Four neighboring cells along a row at a time.  Masks have
+// every bit set in the lanes where they're true.
+// --------------------------------------------------------
+struct SSELanes
+{
+	typedef Float4 Float;
+	typedef Float4 Mask;
+
+	static Float Load(const float* p) { return _mm_loadu_ps(p); }
+	static void Store(float* p, const Float& v) { _mm_storeu_ps(p, v.v); }
+	static void StoreInts(const Float& v, int* p) { _mm_storeu_si128((__m128i*)p, _mm_cvttps_epi32(v.v)); }
+	static Float CellX(int x) { return _mm_add_ps(_mm_set1_ps((float)x), _mm_set_ps(3, 2, 1, 0)); }
+
+	static Mask Obstacle(const unsigned char* p)
+	{
+		// Widen four bytes to four ints
+		int bytes;
+		memcpy(&bytes, p, sizeof(int));
+		__m128i zero = _mm_setzero_si128();
+		__m128i wide = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero), zero);
+		return _mm_castsi128_ps(_mm_cmpgt_epi32(wide, zero));
+	}
+	static Mask All(bool b) { return _mm_castsi128_ps(_mm_set1_epi32(b ? -1 : 0)); }
+	static Mask Or(const Mask& a, const Mask& b) { return _mm_or_ps(a.v, b.v); }
+	static Mask Greater(const Float& a, const Float& b) { return _mm_cmpgt_ps(a.v, b.v); }
+	static Mask NotEqual(const Float& a, const Float& b) { return _mm_cmpneq_ps(a.v, b.v); }
+	static Float Select(const Mask& m, const Float& a, const Float& b) { return _mm_or_ps(_mm_and_ps(m.v, a.v), _mm_andnot_ps(m.v, b.v)); }
+
+	static Float Min(const Float& a, const Float& b) { return _mm_min_ps(a.v, b.v); }
+	static Float Max(const Float& a, const Float& b) { return _mm_max_ps(a.v, b.v); }
+	static Float Sqrt(const Float& v) { return _mm_sqrt_ps(v.v); }
+	static Float Floor(const Float& v)
+	{
+		// Truncate, then step down wherever that rounded up
+		// (only good for values that fit in an int)
+		__m128 truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(v.v));
+		return _mm_sub_ps(truncated, _mm_and_ps(_mm_cmpgt_ps(truncated, v.v), _mm_set1_ps(1.0f)));
+	}
+};
+
+// --------------------------------------------------------
+// A cell and its six neighbors, clamped to the grid just like
+// the Get*Index() helpers in ComputeHelpers.hlsli.  For a run
+// of SSE lanes, these are the first lane's indices - the rest
+// follow along the row, and none of them are at an edge.
+// --------------------------------------------------------
+struct CellIndices
+{
+	int X, Y, Z;
+	int Here, Left, Right, Down, Up, Back, Forward;
+
+	// Neighbor clamped to the cell itself (the edge of the grid)
+	bool EdgeLeft, EdgeRight, EdgeDown, EdgeUp, EdgeBack, EdgeForward;
+
+	CellIndices(int x, int y, int z, int sizeX, int sizeY, int sizeZ) : X(x), Y(y), Z(z)
+	{
+		Here = x + sizeX * (y + sizeY * z);
+		EdgeLeft = x == 0;
+		EdgeRight = x == sizeX - 1;
+		EdgeDown = y == 0;
+		EdgeUp = y == sizeY - 1;
+		EdgeBack = z == 0;
+		EdgeForward = z == sizeZ - 1;
+		Left = EdgeLeft ? Here : Here - 1;
+		Right = EdgeRight ? Here : Here + 1;
+		Down = EdgeDown ? Here : Here - sizeX;
+		Up = EdgeUp ? Here : Here + sizeX;
+		Back = EdgeBack ? Here : Here - sizeX * sizeY;
+		Forward = EdgeForward ? Here : Here + sizeX * sizeY;
+	}
+};
+
+template<typename Float>
+inline Float Lerp(const Float& a, const Float& b, const Float& t) { return a + (b - a) * t; }
+
+// --------------------------------------------------------
+// Splits texel coordinates into the two texels on either side,
+// clamped to the grid, and how far it is between them
+// --------------------------------------------------------
+template<typename L>
+void SplitTexel(const typename L::Float& texel, int size, int* first, int* second, typename L::Float& fraction)
+{
+	typedef typename L::Float Float;
+
+	// Anything past the outer texel centers samples just that
+	// texel, so clamping there changes nothing but keeps the
+	// floor in range of the grid (and of an int)
+	Float t = L::Min(L::Max(texel, -1.0f), (float)(size - 1));
+	Float whole = L::Floor(t);
+	fraction = t - whole;
+	L::StoreInts(L::Max(whole, 0.0f), first);
+	L::StoreInts(L::Min(whole + 1.0f, (float)(size - 1)), second);
+}
+
+// --------------------------------------------------------
+// Trilinear filtering with clamped addressing, like sampling
+// with SamplerLinearClamp
+//
+// channels - The volume to sample, one array per channel
+// tx, ty, tz - Texel coordinates, where texel centers are
+//              whole numbers (UVW times size, minus a half)
+// values - One result per channel
+// --------------------------------------------------------
+template<typename L>
+void SampleLinearClamp(
+	const float* const* channels,
+	unsigned int channelCount,
+	int sizeX, int sizeY, int sizeZ,
+	const typename L::Float& tx, const typename L::Float& ty, const typename L::Float& tz,
+	typename L::Float* values)
+{
+	typedef typename L::Float Float;
+	const int lanes = sizeof(Float) / sizeof(float);
+
+	int x0[4], x1[4], y0[4], y1[4], z0[4], z1[4];
+	Float fx, fy, fz;
+	SplitTexel<L>(tx, sizeX, x0, x1, fx);
+	SplitTexel<L>(ty, sizeY, y0, y1, fy);
+	SplitTexel<L>(tz, sizeZ, z0, z1, fz);
+
+	for (unsigned int c = 0; c < channelCount; c++)
+	{
+		// Gather the eight texels around each lane's position
+		float corners[8][4];
+		for (int i = 0; i < lanes; i++)
+		{
+			const float* channel = channels[c];
+			int row00 = sizeX * (y0[i] + sizeY * z0[i]);
+			int row10 = sizeX * (y1[i] + sizeY * z0[i]);
+			int row01 = sizeX * (y0[i] + sizeY * z1[i]);
+			int row11 = sizeX * (y1[i] + sizeY * z1[i]);
+			corners[0][i] = channel[x0[i] + row00];
+			corners[1][i] = channel[x1[i] + row00];
+			corners[2][i] = channel[x0[i] + row10];
+			corners[3][i] = channel[x1[i] + row10];
+			corners[4][i] = channel[x0[i] + row01];
+			corners[5][i] = channel[x1[i] + row01];
+			corners[6][i] = channel[x0[i] + row11];
+			corners[7][i] = channel[x1[i] + row11];
+		}
+
+		values[c] = Lerp(
+			Lerp(Lerp(L::Load(corners[0]), L::Load(corners[1]), fx), Lerp(L::Load(corners[2]), L::Load(corners[3]), fx), fy),
+			Lerp(Lerp(L::Load(corners[4]), L::Load(corners[5]), fx), Lerp(L::Load(corners[6]), L::Load(corners[7]), fx), fy),
+			fz);
+	}
+}
+
+
+// --------------------------------------------------------
+// Creates an empty (all zero) fluid, like a new FluidField
+//
+// threadCount - Threads to spread Z slices across.  Zero
+//               uses one per core.
+// --------------------------------------------------------
+FluidFieldCPU::FluidFieldCPU(int sizeX, int sizeY, int sizeZ, unsigned int threadCount) :
+	parameters(DefaultParameters()),
+	useSIMD(true),
+	sizeX(sizeX),
+	sizeY(sizeY),
+	sizeZ(sizeZ),
+	jobs(threadCount),
+	multigrid(sizeX, sizeY, sizeZ),
+	bricks(sizeX, sizeY, sizeZ),
+	sparseLastStep(false)
+{
+	CreateVolume(velocityBuffers[0], 3);
+	CreateVolume(velocityBuffers[1], 3);
+	CreateVolume(divergenceBuffer, 1);
+	CreateVolume(pressureBuffers[0], 1);
+	CreateVolume(pressureBuffers[1], 1);
+	CreateVolume(densityBuffers[0], 4);
+	CreateVolume(densityBuffers[1], 4);
+	CreateVolume(temperatureBuffers[0], 1);
+	CreateVolume(temperatureBuffers[1], 1);
+	CreateVolume(vorticityBuffer, 3);
+	obstacles.resize((size_t)sizeX * sizeY * sizeZ);
+}
+
+// --------------------------------------------------------
+// The same defaults as FluidField
+// --------------------------------------------------------
+FluidStepParameters FluidFieldCPU::DefaultParameters()
+{
+	FluidStepParameters params = {};
+	params.FixedTimeStep = 0.016f;
+	params.AmbientTemperature = 0.0f;
+	params.InjectTemperature = 0.5f;
+	params.InjectDensity = 0.05f;
+	params.InjectRadius = 0.15f;
+	params.InjectPosition[0] = 0.5f;
+	params.InjectPosition[1] = 0.2f;
+	params.InjectPosition[2] = 0.5f;
+	params.FluidColor[0] = 1.0f;
+	params.FluidColor[1] = 1.0f;
+	params.FluidColor[2] = 1.0f;
+	params.TemperatureBuoyancy = 0.5f;
+	params.DensityWeight = 0.1f;
+	params.VelocityDamper = 1.0f;
+	params.DensityDamper = 1.0f;
+	params.TemperatureDamper = 1.0f;
+	params.VorticityEpsilon = 0.3f;
+	params.InjectSmoke = 1;
+	params.ApplyVorticity = 1;
+	params.PressureSolverType = PRESSURE_SOLVER_MULTIGRID;
+	params.PressureIterations = 30;
+	params.MultigridCycles = 4;
+	params.MultigridSmoothIterations = 2;
+	params.SparseBricks = 0;
+	params.BrickDensityThreshold = 0.001f;
+	params.BrickVelocityThreshold = 1.0f;
+	params.BrickDilation = 1;
+	params.Formats = FloatFormats();
+	return params;
+}
+
+// --------------------------------------------------------
+// Every volume as 32-bit float, which FluidField defaults to
+// --------------------------------------------------------
+FluidFormatPolicy FluidFieldCPU::FloatFormats()
+{
+	FluidFormatPolicy formats = {};
+	formats.Velocity = FLUID_FORMAT_FLOAT;
+	formats.Pressure = FLUID_FORMAT_FLOAT;
+	formats.Density = FLUID_FORMAT_FLOAT;
+	formats.Temperature = FLUID_FORMAT_FLOAT;
+	formats.DensityScale = 1.0f;
+	formats.TemperatureScale = 1.0f;
+	return formats;
+}
+
+// --------------------------------------------------------
+// Half float velocity and pressure, 8-bit density and 16-bit
+// fixed point temperature.  Injection keeps density within
+// 0-1, and temperature stays well within +/-16 with the
+// default parameters.
+// --------------------------------------------------------
+FluidFormatPolicy FluidFieldCPU::ReducedFormats()
+{
+	FluidFormatPolicy formats = {};
+	formats.Velocity = FLUID_FORMAT_HALF;
+	formats.Pressure = FLUID_FORMAT_HALF;
+	formats.Density = FLUID_FORMAT_UNORM8;
+	formats.Temperature = FLUID_FORMAT_SNORM16;
+	formats.DensityScale = 1.0f;
+	formats.TemperatureScale = 16.0f;
+	return formats;
+}
+
+int FluidFieldCPU::GetSizeX() { return sizeX; }
+int FluidFieldCPU::GetSizeY() { return sizeY; }
+int FluidFieldCPU::GetSizeZ() { return sizeZ; }
+unsigned int FluidFieldCPU::GetThreadCount() { return jobs.GetThreadCount(); }
+int FluidFieldCPU::GetBrickCount() { return bricks.GetBrickCount(); }
+int FluidFieldCPU::GetActiveBrickCount() { return (int)bricks.GetActiveBricks().size(); }
+
+// --------------------------------------------------------
+// Memory every volume (and the obstacles) takes per cell,
+// stored in its format
+// --------------------------------------------------------
+size_t FluidFieldCPU::GetBytesPerCell()
+{
+	ApplyFormats();
+	Volume* volumes[] = {
+		&velocityBuffers[0], &velocityBuffers[1], &divergenceBuffer,
+		&pressureBuffers[0], &pressureBuffers[1],
+		&densityBuffers[0], &densityBuffers[1],
+		&temperatureBuffers[0], &temperatureBuffers[1], &vorticityBuffer };
+
+	size_t bytes = sizeof(unsigned char);
+	for (Volume* volume : volumes)
+	{
+		switch (volume->Format)
+		{
+		case FLUID_FORMAT_HALF: bytes += 2 * volume->ChannelCount; break;
+		case FLUID_FORMAT_UNORM8: bytes += 1 * volume->ChannelCount; break;
+		case FLUID_FORMAT_SNORM16: bytes += 2 * volume->ChannelCount; break;
+		default: bytes += 4 * volume->ChannelCount; break;
+		}
+	}
+	return bytes;
+}
+
+
+// --------------------------------------------------------
+// The same kernels, in the same order, as FluidField
+// --------------------------------------------------------
+void FluidFieldCPU::OneTimeStep()
+{
+	ApplyFormats();
+
+	if (parameters.SparseBricks)
+		UpdateBricks();
+	sparseLastStep = parameters.SparseBricks != 0;
+
+	Advection(velocityBuffers, parameters.VelocityDamper);
+	Advection(densityBuffers, parameters.DensityDamper);
+	Advection(temperatureBuffers, parameters.TemperatureDamper);
+
+	if (parameters.InjectSmoke)
+		InjectSmoke();
+
+	Buoyancy();
+
+	if (parameters.ApplyVorticity)
+	{
+		Vorticity();
+		Confinement();
+	}
+
+	Divergence();
+	Pressure();
+	Projection();
+}
+
+// --------------------------------------------------------
+// Replaces the obstacles
+//
+// obstacles - One byte per cell, non-zero for obstacles
+// --------------------------------------------------------
+void FluidFieldCPU::SetObstacles(const unsigned char* obstacles)
+{
+	memcpy(this->obstacles.data(), obstacles, this->obstacles.size());
+	multigrid = PressureSolver(sizeX, sizeY, sizeZ, obstacles);
+}
+
+// --------------------------------------------------------
+// Copies every volume into one array, a plane per channel,
+// in this order (the same as a golden step file):
+//
+//   velocity[0] xyz, velocity[1] xyz,
+//   density[0] rgba, density[1] rgba,
+//   temperature[0], temperature[1],
+//   vorticity xyz, pressure, divergence,
+//   obstacles (0 or 1)
+// --------------------------------------------------------
+void FluidFieldCPU::GetState(std::vector<float>& state)
+{
+	size_t cellCount = obstacles.size();
+	state.resize(cellCount * FLUID_STATE_PLANES);
+	float* plane = state.data();
+
+	Volume* volumes[] = {
+		&velocityBuffers[0], &velocityBuffers[1],
+		&densityBuffers[0], &densityBuffers[1],
+		&temperatureBuffers[0], &temperatureBuffers[1],
+		&vorticityBuffer, &pressureBuffers[0], &divergenceBuffer };
+	for (Volume* volume : volumes)
+		for (unsigned int c = 0; c < volume->ChannelCount; c++, plane += cellCount)
+			memcpy(plane, volume->Channels[c].data(), sizeof(float) * cellCount);
+
+	for (size_t i = 0; i < cellCount; i++)
+		plane[i] = obstacles[i] ? 1.0f : 0.0f;
+}
+
+// --------------------------------------------------------
+// Replaces every volume with ones laid out like GetState().
+// Arrays of the wrong size are ignored.
+// --------------------------------------------------------
+void FluidFieldCPU::SetState(const std::vector<float>& state)
+{
+	size_t cellCount = obstacles.size();
+	if (state.size() != cellCount * FLUID_STATE_PLANES)
+		return;
+	const float* plane = state.data();
+
+	Volume* volumes[] = {
+		&velocityBuffers[0], &velocityBuffers[1],
+		&densityBuffers[0], &densityBuffers[1],
+		&temperatureBuffers[0], &temperatureBuffers[1],
+		&vorticityBuffer, &pressureBuffers[0], &divergenceBuffer };
+	for (Volume* volume : volumes)
+		for (unsigned int c = 0; c < volume->ChannelCount; c++, plane += cellCount)
+			memcpy(volume->Channels[c].data(), plane, sizeof(float) * cellCount);
+
+	// Any non-zero value is an obstacle, just like the shaders
+	std::vector<unsigned char> newObstacles(cellCount);
+	for (size_t i = 0; i < cellCount; i++)
+		newObstacles[i] = plane[i] > 0.0f;
+	SetObstacles(newObstacles.data());
+}
+
+
+void FluidFieldCPU::CreateVolume(Volume& volume, unsigned int channelCount)
+{
+	volume.ChannelCount = channelCount;
+	volume.Format = FLUID_FORMAT_FLOAT;
+	for (unsigned int c = 0; c < channelCount; c++)
+	{
+		volume.Channels[c].assign((size_t)sizeX * sizeY * sizeZ, 0.0f);
+		volume.Scale[c] = 1.0f;
+	}
+}
+
+// --------------------------------------------------------
+// Makes the output half of a ping-pong pair current.  Every
+// kernel writes its output half and then swaps, so this is
+// where the output gets rounded to the volume's format.
+// --------------------------------------------------------
+void FluidFieldCPU::SwapBuffers(Volume volumes[2])
+{
+	RoundToFormat(volumes[1]);
+	std::swap(volumes[0], volumes[1]);
+}
+
+// --------------------------------------------------------
+// Sets each volume's format and scale from parameters.Formats.
+// Divergence and vorticity are always float.
+// --------------------------------------------------------
+void FluidFieldCPU::ApplyFormats()
+{
+	const FluidFormatPolicy& formats = parameters.Formats;
+	for (int i = 0; i < 2; i++)
+	{
+		velocityBuffers[i].Format = formats.Velocity;
+		pressureBuffers[i].Format = formats.Pressure;
+		densityBuffers[i].Format = formats.Density;
+		densityBuffers[i].Scale[3] = formats.DensityScale;
+		temperatureBuffers[i].Format = formats.Temperature;
+		temperatureBuffers[i].Scale[0] = formats.TemperatureScale;
+	}
+}
+
+// --------------------------------------------------------
+// Rounds to the nearest 16-bit float (ties to even), like a
+// store to a 16-bit float texture.  Too large becomes
+// infinity, too small becomes a denormal or zero.
+// --------------------------------------------------------
+static float RoundToHalf(float value)
+{
+	unsigned int bits;
+	memcpy(&bits, &value, sizeof(bits));
+	unsigned int sign = bits & 0x80000000;
+	float magnitude = fabsf(value);
+
+	if (magnitude != magnitude)
+		return value;
+	if (magnitude >= 65520.0f)
+		return sign ? -INFINITY : INFINITY;
+
+	// Half denormals are multiples of 2^-24 (exact in float, so
+	// the division and rint, which rounds ties to even, are too)
+	if (magnitude < 6.103515625e-05f)
+		return copysignf(rintf(magnitude / 5.9604644775390625e-08f) * 5.9604644775390625e-08f, value);
+
+	// Otherwise drop 13 of float's 23 mantissa bits, rounding
+	// ties to even
+	bits += 0x0FFF + ((bits >> 13) & 1);
+	bits &= ~0x1FFFu;
+	float rounded;
+	memcpy(&rounded, &bits, sizeof(rounded));
+	return rounded;
+}
+
+// --------------------------------------------------------
+// Rounds every value in a volume to the nearest one its
+// format can hold (divided by its scale), clamping fixed
+// point formats to their range
+// --------------------------------------------------------
+void FluidFieldCPU::RoundToFormat(Volume& volume)
+{
+	if (volume.Format == FLUID_FORMAT_FLOAT)
+		return;
+
+	size_t sliceSize = (size_t)sizeX * sizeY;
+	jobs.Run(sizeZ, [&](unsigned int z)
+	{
+		for (unsigned int c = 0; c < volume.ChannelCount; c++)
+		{
+			float scale = volume.Scale[c];
+			float* values = volume.Channels[c].data() + z * sliceSize;
+			for (size_t i = 0; i < sliceSize; i++)
+			{
+				float value = values[i] / scale;
+				switch (volume.Format)
+				{
+				case FLUID_FORMAT_HALF: value = RoundToHalf(value); break;
+				case FLUID_FORMAT_UNORM8: value = floorf(std::min(std::max(value, 0.0f), 1.0f) * 255.0f + 0.5f) / 255.0f; break;
+				case FLUID_FORMAT_SNORM16: value = floorf(std::min(std::max(value, -1.0f), 1.0f) * 32767.0f + 0.5f) / 32767.0f; break;
+				}
+				values[i] = value * scale;
+			}
+		}
+	});
+}
+
+// --------------------------------------------------------
+// Runs a kernel over every cell, like a dispatch.  Z slices
+// are handed out to the job system's threads, and along each
+// row the kernel is called with SSELanes for four cells at a
+// time, wherever none of them has a clamped X neighbor, and
+// with ScalarLanes for the rest.
+//
+// cells - Generic lambda taking (lanes, const CellIndices&)
+// --------------------------------------------------------
+template<typename Cells>
+void FluidFieldCPU::ForEachCell(const Cells& cells)
+{
+	// Sparse: just the active bricks, a brick per job
+	if (parameters.SparseBricks)
+	{
+		const std::vector<unsigned int>& activeBricks = bricks.GetActiveBricks();
+		jobs.Run((unsigned int)activeBricks.size(), [&](unsigned int b)
+		{
+			int bx, by, bz;
+			FluidBricks::UnpackBrick(activeBricks[b], bx, by, bz);
+
+			int xStart = bx * FLUID_BRICK_SIZE;
+			int xEnd = std::min(xStart + FLUID_BRICK_SIZE, sizeX);
+			int yEnd = std::min((by + 1) * FLUID_BRICK_SIZE, sizeY);
+			int zEnd = std::min((bz + 1) * FLUID_BRICK_SIZE, sizeZ);
+			for (int z = bz * FLUID_BRICK_SIZE; z < zEnd; z++)
+				for (int y = by * FLUID_BRICK_SIZE; y < yEnd; y++)
+					ForEachCellInRow(cells, xStart, xEnd, y, z);
+		});
+		return;
+	}
+
+	jobs.Run(sizeZ, [&](unsigned int z)
+	{
+		for (int y = 0; y < sizeY; y++)
+			ForEachCellInRow(cells, 0, sizeX, y, (int)z);
+	});
+}
+
+// --------------------------------------------------------
+// Runs a kernel over cells xStart to xEnd (exclusive) of one
+// row, four at a time where possible
+// --------------------------------------------------------
+template<typename Cells>
+void FluidFieldCPU::ForEachCellInRow(const Cells& cells, int xStart, int xEnd, int y, int z)
+{
+	int x = xStart;
+
+	// The first cell's left neighbor is always clamped
+	if (x == 0)
+	{
+		cells(ScalarLanes(), CellIndices(0, y, z, sizeX, sizeY, sizeZ));
+		x++;
+	}
+
+	// As is the last cell's right neighbor
+	if (useSIMD)
+	{
+		for (; x + 4 <= xEnd && x + 4 < sizeX; x += 4)
+			cells(SSELanes(), CellIndices(x, y, z, sizeX, sizeY, sizeZ));
+	}
+
+	for (; x < xEnd; x++)
+		cells(ScalarLanes(), CellIndices(x, y, z, sizeX, sizeY, sizeZ));
+}
+
+
+// --------------------------------------------------------
+// BrickActivityCS and BrickListCS: finds the bricks to
+// simulate this step, then clears the ones that just stopped
+// being simulated (the same clears FluidField dispatches
+// over its retired brick list)
+// --------------------------------------------------------
+void FluidFieldCPU::UpdateBricks()
+{
+	// Coming from a dense step, every brick was simulated
+	if (!sparseLastStep)
+		bricks.Reset();
+
+	bricks.Update(
+		densityBuffers[0].Channels[3].data(),
+		velocityBuffers[0].Channels[0].data(),
+		velocityBuffers[0].Channels[1].data(),
+		velocityBuffers[0].Channels[2].data(),
+		parameters.BrickDensityThreshold,
+		parameters.BrickVelocityThreshold,
+		parameters.BrickDilation,
+		parameters.InjectPosition,
+		parameters.InjectSmoke ? parameters.InjectRadius : 0.0f);
+
+	Volume* volumes[] = {
+		&velocityBuffers[0], &velocityBuffers[1],
+		&densityBuffers[0], &densityBuffers[1],
+		&temperatureBuffers[0], &temperatureBuffers[1],
+		&vorticityBuffer };
+
+	const std::vector<unsigned int>& retiredBricks = bricks.GetRetiredBricks();
+	jobs.Run((unsigned int)retiredBricks.size(), [&](unsigned int b)
+	{
+		int bx, by, bz;
+		FluidBricks::UnpackBrick(retiredBricks[b], bx, by, bz);
+
+		int xStart = bx * FLUID_BRICK_SIZE;
+		int xCount = std::min(xStart + FLUID_BRICK_SIZE, sizeX) - xStart;
+		int yEnd = std::min((by + 1) * FLUID_BRICK_SIZE, sizeY);
+		int zEnd = std::min((bz + 1) * FLUID_BRICK_SIZE, sizeZ);
+		for (Volume* volume : volumes)
+			for (unsigned int c = 0; c < volume->ChannelCount; c++)
+				for (int z = bz * FLUID_BRICK_SIZE; z < zEnd; z++)
+					for (int y = by * FLUID_BRICK_SIZE; y < yEnd; y++)
+						std::fill_n(volume->Channels[c].data() + xStart + sizeX * (y + sizeY * z), xCount, 0.0f);
+	});
+}
+
+
+// --------------------------------------------------------
+// AdvectionCS: moves a quantity along the velocity by
+// sampling it from where each cell's fluid came from
+// --------------------------------------------------------
+void FluidFieldCPU::Advection(Volume volumes[2], float damper)
+{
+	const float* channelsIn[4] = {};
+	float* channelsOut[4] = {};
+	unsigned int channelCount = volumes[1].ChannelCount;
+	for (unsigned int c = 0; c < channelCount; c++)
+	{
+		channelsIn[c] = volumes[0].Channels[c].data();
+		channelsOut[c] = volumes[1].Channels[c].data();
+	}
+
+	const float* velX = velocityBuffers[0].Channels[0].data();
+	const float* velY = velocityBuffers[0].Channels[1].data();
+	const float* velZ = velocityBuffers[0].Channels[2].data();
+	float deltaTime = parameters.FixedTimeStep;
+
+	ForEachCell([&](auto lanes, const CellIndices& c)
+	{
+		KERNEL_LANES(lanes);
+		typedef typename L::Mask Mask;
+		int i = c.Here;
+
+		// Move backwards based on velocity
+		Float posX = L::CellX(c.X) - deltaTime * L::Load(velX + i);
+		Float posY = (float)c.Y - deltaTime * L::Load(velY + i);
+		Float posZ = (float)c.Z - deltaTime * L::Load(velZ + i);
+
+		// To UVW coords (PixelIndexToUVW), then to the texel coords the
+		// sampler finds from those
+		Float texelX = (posX + 0.5f) / (float)sizeX * (float)sizeX - 0.5f;
+		Float texelY = (posY + 0.5f) / (float)sizeY * (float)sizeY - 0.5f;
+		Float texelZ = (posZ + 0.5f) / (float)sizeZ * (float)sizeZ - 0.5f;
+
+		Float values[4];
+		SampleLinearClamp<L>(channelsIn, channelCount, sizeX, sizeY, sizeZ, texelX, texelY, texelZ, values);
+
+		// Obstacle cells are skipped, so keep what was there
+		Mask obstacle = L::Obstacle(&obstacles[i]);
+		for (unsigned int ch = 0; ch < channelCount; ch++)
+			L::Store(channelsOut[ch] + i, L::Select(obstacle, L::Load(channelsOut[ch] + i), damper * values[ch]));
+	});
+
+	SwapBuffers(volumes);
+}
+
+// --------------------------------------------------------
+// DivergenceCS: central differences of the velocity, with
+// walls and obstacles counting as no velocity.  Cleared
+// first when sparse, since the pressure solve reads all of it.
+// --------------------------------------------------------
+void FluidFieldCPU::Divergence()
+{
+	if (parameters.SparseBricks)
+		std::fill(divergenceBuffer.Channels[0].begin(), divergenceBuffer.Channels[0].end(), 0.0f);
+
+	const float* velX = velocityBuffers[0].Channels[0].data();
+	const float* velY = velocityBuffers[0].Channels[1].data();
+	const float* velZ = velocityBuffers[0].Channels[2].data();
+	float* divergence = divergenceBuffer.Channels[0].data();
+	const unsigned char* obs = obstacles.data();
+
+	ForEachCell([&](auto lanes, const CellIndices& c)
+	{
+		KERNEL_LANES(lanes);
+
+		Float velL = L::Select(L::Or(L::Obstacle(obs + c.Left), L::All(c.EdgeLeft)), 0.0f, L::Load(velX + c.Left));
+		Float velR = L::Select(L::Or(L::Obstacle(obs + c.Right), L::All(c.EdgeRight)), 0.0f, L::Load(velX + c.Right));
+		Float velD = L::Select(L::Or(L::Obstacle(obs + c.Down), L::All(c.EdgeDown)), 0.0f, L::Load(velY + c.Down));
+		Float velU = L::Select(L::Or(L::Obstacle(obs + c.Up), L::All(c.EdgeUp)), 0.0f, L::Load(velY + c.Up));
+		Float velB = L::Select(L::Or(L::Obstacle(obs + c.Back), L::All(c.EdgeBack)), 0.0f, L::Load(velZ + c.Back));
+		Float velF = L::Select(L::Or(L::Obstacle(obs + c.Forward), L::All(c.EdgeForward)), 0.0f, L::Load(velZ + c.Forward));
+
+		L::Store(divergence + c.Here, 0.5f * ((velR - velL) + (velU - velD) + (velF - velB)));
+	});
+}
+
+// --------------------------------------------------------
+// Clears the pressure, then runs PressureCS iterations or
+// multigrid V-cycles (which PressureSolver already does on
+// the CPU, one thread at a time).  Sparse Jacobi iterations
+// leave cells outside the active bricks alone, so both
+// buffers are cleared, making those cells zero pressure.
+// --------------------------------------------------------
+void FluidFieldCPU::Pressure()
+{
+	std::fill(pressureBuffers[0].Channels[0].begin(), pressureBuffers[0].Channels[0].end(), 0.0f);
+	if (parameters.SparseBricks)
+		std::fill(pressureBuffers[1].Channels[0].begin(), pressureBuffers[1].Channels[0].end(), 0.0f);
+
+	// Multigrid -----
+	if (parameters.PressureSolverType == PRESSURE_SOLVER_MULTIGRID)
+	{
+		multigrid.Multigrid(
+			divergenceBuffer.Channels[0].data(),
+			pressureBuffers[0].Channels[0].data(),
+			parameters.MultigridCycles,
+			parameters.MultigridSmoothIterations);
+
+		// Only the final pressure is rounded - the GPU's V-cycles
+		// round each of their writes too
+		RoundToFormat(pressureBuffers[0]);
+		return;
+	}
+
+	// Jacobi -----
+	const float* divergence = divergenceBuffer.Channels[0].data();
+	const unsigned char* obs = obstacles.data();
+	for (int iteration = 0; iteration < parameters.PressureIterations; iteration++)
+	{
+		const float* pressureIn = pressureBuffers[0].Channels[0].data();
+		float* pressureOut = pressureBuffers[1].Channels[0].data();
+
+		ForEachCell([&](auto lanes, const CellIndices& c)
+		{
+			KERNEL_LANES(lanes);
+
+			// Clamped neighbors are this cell, so only obstacles need checking
+			Float pressureHere = L::Load(pressureIn + c.Here);
+			Float pL = L::Select(L::Obstacle(obs + c.Left), pressureHere, L::Load(pressureIn + c.Left));
+			Float pR = L::Select(L::Obstacle(obs + c.Right), pressureHere, L::Load(pressureIn + c.Right));
+			Float pD = L::Select(L::Obstacle(obs + c.Down), pressureHere, L::Load(pressureIn + c.Down));
+			Float pU = L::Select(L::Obstacle(obs + c.Up), pressureHere, L::Load(pressureIn + c.Up));
+			Float pB = L::Select(L::Obstacle(obs + c.Back), pressureHere, L::Load(pressureIn + c.Back));
+			Float pF = L::Select(L::Obstacle(obs + c.Forward), pressureHere, L::Load(pressureIn + c.Forward));
+
+			L::Store(pressureOut + c.Here, (pL + pR + pD + pU + pB + pF - L::Load(divergence + c.Here)) / 6.0f);
+		});
+
+		SwapBuffers(pressureBuffers);
+	}
+}
+
+// --------------------------------------------------------
+// ProjectionCS: subtracts the pressure gradient, which
+// leaves the velocity without divergence
+// --------------------------------------------------------
+void FluidFieldCPU::Projection()
+{
+	const float* pressure = pressureBuffers[0].Channels[0].data();
+	const float* velX = velocityBuffers[0].Channels[0].data();
+	const float* velY = velocityBuffers[0].Channels[1].data();
+	const float* velZ = velocityBuffers[0].Channels[2].data();
+	float* outX = velocityBuffers[1].Channels[0].data();
+	float* outY = velocityBuffers[1].Channels[1].data();
+	float* outZ = velocityBuffers[1].Channels[2].data();
+	const unsigned char* obs = obstacles.data();
+
+	ForEachCell([&](auto lanes, const CellIndices& c)
+	{
+		KERNEL_LANES(lanes);
+		typedef typename L::Mask Mask;
+
+		// Walls and obstacles use this cell's pressure, and flip
+		// the velocity on that axis
+		Mask wallL = L::Or(L::Obstacle(obs + c.Left), L::All(c.EdgeLeft));
+		Mask wallR = L::Or(L::Obstacle(obs + c.Right), L::All(c.EdgeRight));
+		Mask wallD = L::Or(L::Obstacle(obs + c.Down), L::All(c.EdgeDown));
+		Mask wallU = L::Or(L::Obstacle(obs + c.Up), L::All(c.EdgeUp));
+		Mask wallB = L::Or(L::Obstacle(obs + c.Back), L::All(c.EdgeBack));
+		Mask wallF = L::Or(L::Obstacle(obs + c.Forward), L::All(c.EdgeForward));
+
+		Float pressureHere = L::Load(pressure + c.Here);
+		Float pL = L::Select(wallL, pressureHere, L::Load(pressure + c.Left));
+		Float pR = L::Select(wallR, pressureHere, L::Load(pressure + c.Right));
+		Float pD = L::Select(wallD, pressureHere, L::Load(pressure + c.Down));
+		Float pU = L::Select(wallU, pressureHere, L::Load(pressure + c.Up));
+		Float pB = L::Select(wallB, pressureHere, L::Load(pressure + c.Back));
+		Float pF = L::Select(wallF, pressureHere, L::Load(pressure + c.Forward));
+
+		Float maskX = L::Select(L::Or(wallL, wallR), -1.0f, 1.0f);
+		Float maskY = L::Select(L::Or(wallD, wallU), -1.0f, 1.0f);
+		Float maskZ = L::Select(L::Or(wallB, wallF), -1.0f, 1.0f);
+
+		Float newX = (L::Load(velX + c.Here) - 0.5f * (pR - pL)) * maskX;
+		Float newY = (L::Load(velY + c.Here) - 0.5f * (pU - pD)) * maskY;
+		Float newZ = (L::Load(velZ + c.Here) - 0.5f * (pF - pB)) * maskZ;
+
+		// Obstacles have no velocity
+		Mask obstacle = L::Obstacle(obs + c.Here);
+		L::Store(outX + c.Here, L::Select(obstacle, 0.0f, newX));
+		L::Store(outY + c.Here, L::Select(obstacle, 0.0f, newY));
+		L::Store(outZ + c.Here, L::Select(obstacle, 0.0f, newZ));
+	});
+
+	SwapBuffers(velocityBuffers);
+}
+
+// --------------------------------------------------------
+// InjectSmokeCS: adds density, temperature and any velocity
+// impulse within a sphere around the inject position
+// --------------------------------------------------------
+void FluidFieldCPU::InjectSmoke()
+{
+	const float* densityIn[4];
+	float* densityOut[4];
+	for (int ch = 0; ch < 4; ch++)
+	{
+		densityIn[ch] = densityBuffers[0].Channels[ch].data();
+		densityOut[ch] = densityBuffers[1].Channels[ch].data();
+	}
+	const float* velocityIn[3];
+	float* velocityOut[3];
+	for (int ch = 0; ch < 3; ch++)
+	{
+		velocityIn[ch] = velocityBuffers[0].Channels[ch].data();
+		velocityOut[ch] = velocityBuffers[1].Channels[ch].data();
+	}
+	const float* temperatureIn = temperatureBuffers[0].Channels[0].data();
+	float* temperatureOut = temperatureBuffers[1].Channels[0].data();
+	const FluidStepParameters& p = parameters;
+
+	ForEachCell([&](auto lanes, const CellIndices& c)
+	{
+		KERNEL_LANES(lanes);
+		typedef typename L::Mask Mask;
+		int i = c.Here;
+
+		// How much to inject based on distance?
+		Float dx = (L::CellX(c.X) + 0.5f) / (float)sizeX - p.InjectPosition[0];
+		Float dy = ((float)c.Y + 0.5f) / (float)sizeY - p.InjectPosition[1];
+		Float dz = ((float)c.Z + 0.5f) / (float)sizeZ - p.InjectPosition[2];
+		Float dist = L::Sqrt(dx * dx + dy * dy + dz * dz);
+		Float falloff = p.InjectRadius == 0.0f ? Float(0.0f) : L::Max(0.0f, p.InjectRadius - dist) / p.InjectRadius;
+		Mask inside = L::Greater(falloff, 0.0f);
+
+		// Color is a replacement, density is an add, and obstacle
+		// cells are skipped, so keep what was there
+		Mask obstacle = L::Obstacle(&obstacles[i]);
+		for (int ch = 0; ch < 3; ch++)
+		{
+			Float color = L::Select(inside, p.FluidColor[ch], L::Load(densityIn[ch] + i));
+			L::Store(densityOut[ch] + i, L::Select(obstacle, L::Load(densityOut[ch] + i), color));
+
+			Float velocity = L::Load(velocityIn[ch] + i) + L::Select(inside, p.InjectVelocity[ch], 0.0f);
+			L::Store(velocityOut[ch] + i, L::Select(obstacle, L::Load(velocityOut[ch] + i), velocity));
+		}
+
+		Float density = L::Min(L::Max(L::Load(densityIn[3] + i) + p.InjectDensity * falloff, 0.0f), 1.0f);
+		L::Store(densityOut[3] + i, L::Select(obstacle, L::Load(densityOut[3] + i), density));
+
+		Float temperature = L::Load(temperatureIn + i) + p.InjectTemperature * falloff;
+		L::Store(temperatureOut + i, L::Select(obstacle, L::Load(temperatureOut + i), temperature));
+	});
+
+	SwapBuffers(densityBuffers);
+	SwapBuffers(temperatureBuffers);
+	SwapBuffers(velocityBuffers);
+
+	// Reset injection velocity impulse now that its been applied
+	parameters.InjectVelocity[0] = 0.0f;
+	parameters.InjectVelocity[1] = 0.0f;
+	parameters.InjectVelocity[2] = 0.0f;
+}
+
+// --------------------------------------------------------
+// BuoyancyCS: heat rises and density sinks
+// --------------------------------------------------------
+void FluidFieldCPU::Buoyancy()
+{
+	const float* velocityIn[3];
+	float* velocityOut[3];
+	for (int ch = 0; ch < 3; ch++)
+	{
+		velocityIn[ch] = velocityBuffers[0].Channels[ch].data();
+		velocityOut[ch] = velocityBuffers[1].Channels[ch].data();
+	}
+	const float* density = densityBuffers[0].Channels[3].data();
+	const float* temperature = temperatureBuffers[0].Channels[0].data();
+	const FluidStepParameters& p = parameters;
+
+	ForEachCell([&](auto lanes, const CellIndices& c)
+	{
+		KERNEL_LANES(lanes);
+		typedef typename L::Mask Mask;
+		int i = c.Here;
+
+		Float force =
+			-p.DensityWeight * L::Load(density + i) +
+			p.TemperatureBuoyancy * (L::Load(temperature + i) - p.AmbientTemperature);
+
+		// The force is float3(0, 1, 0) * force in the shader
+		Mask obstacle = L::Obstacle(&obstacles[i]);
+		float direction[3] = { 0.0f, 1.0f, 0.0f };
+		for (int ch = 0; ch < 3; ch++)
+		{
+			Float velocity = L::Load(velocityIn[ch] + i) + direction[ch] * force;
+			L::Store(velocityOut[ch] + i, L::Select(obstacle, L::Load(velocityOut[ch] + i), velocity));
+		}
+	});
+
+	SwapBuffers(velocityBuffers);
+}
+
+// --------------------------------------------------------
+// VorticityCS: the curl of the velocity
+// --------------------------------------------------------
+void FluidFieldCPU::Vorticity()
+{
+	const float* velX = velocityBuffers[0].Channels[0].data();
+	const float* velY = velocityBuffers[0].Channels[1].data();
+	const float* velZ = velocityBuffers[0].Channels[2].data();
+	float* vortX = vorticityBuffer.Channels[0].data();
+	float* vortY = vorticityBuffer.Channels[1].data();
+	float* vortZ = vorticityBuffer.Channels[2].data();
+
+	ForEachCell([&](auto lanes, const CellIndices& c)
+	{
+		KERNEL_LANES(lanes);
+		typedef typename L::Mask Mask;
+		int i = c.Here;
+
+		Float vort[3] = {
+			0.5f * ((L::Load(velZ + c.Up) - L::Load(velZ + c.Down)) - (L::Load(velY + c.Forward) - L::Load(velY + c.Back))),
+			0.5f * ((L::Load(velX + c.Forward) - L::Load(velX + c.Back)) - (L::Load(velZ + c.Right) - L::Load(velZ + c.Left))),
+			0.5f * ((L::Load(velY + c.Right) - L::Load(velY + c.Left)) - (L::Load(velX + c.Up) - L::Load(velX + c.Down))) };
+
+		// Obstacle cells are skipped, so keep what was there
+		Mask obstacle = L::Obstacle(&obstacles[i]);
+		L::Store(vortX + i, L::Select(obstacle, L::Load(vortX + i), vort[0]));
+		L::Store(vortY + i, L::Select(obstacle, L::Load(vortY + i), vort[1]));
+		L::Store(vortZ + i, L::Select(obstacle, L::Load(vortZ + i), vort[2]));
+	});
+}
+
+// --------------------------------------------------------
+// ConfinementCS: pushes velocity around the vorticity, back
+// towards where it's strongest.  Doesn't skip obstacles.
+// --------------------------------------------------------
+void FluidFieldCPU::Confinement()
+{
+	const float* vortX = vorticityBuffer.Channels[0].data();
+	const float* vortY = vorticityBuffer.Channels[1].data();
+	const float* vortZ = vorticityBuffer.Channels[2].data();
+	const float* velocityIn[3];
+	float* velocityOut[3];
+	for (int ch = 0; ch < 3; ch++)
+	{
+		velocityIn[ch] = velocityBuffers[0].Channels[ch].data();
+		velocityOut[ch] = velocityBuffers[1].Channels[ch].data();
+	}
+	float epsilon = parameters.VorticityEpsilon;
+
+	ForEachCell([&](auto lanes, const CellIndices& c)
+	{
+		KERNEL_LANES(lanes);
+		typedef typename L::Mask Mask;
+		int i = c.Here;
+
+		auto vortLength = [&](int n)
+		{
+			Float x = L::Load(vortX + n);
+			Float y = L::Load(vortY + n);
+			Float z = L::Load(vortZ + n);
+			return L::Sqrt(x * x + y * y + z * z);
+		};
+
+		Float gradX = 0.5f * (vortLength(c.Right) - vortLength(c.Left));
+		Float gradY = 0.5f * (vortLength(c.Up) - vortLength(c.Down));
+		Float gradZ = 0.5f * (vortLength(c.Forward) - vortLength(c.Back));
+
+		// Only where the gradient can be normalized
+		Float lengthSquared = gradX * gradX + gradY * gradY + gradZ * gradZ;
+		Mask confine = L::NotEqual(lengthSquared, 0.0f);
+		Float length = L::Sqrt(lengthSquared);
+		Float nX = gradX / length;
+		Float nY = gradY / length;
+		Float nZ = gradZ / length;
+
+		Float hereX = L::Load(vortX + i);
+		Float hereY = L::Load(vortY + i);
+		Float hereZ = L::Load(vortZ + i);
+		Float force[3] = {
+			(nY * hereZ - nZ * hereY) * epsilon,
+			(nZ * hereX - nX * hereZ) * epsilon,
+			(nX * hereY - nY * hereX) * epsilon };
+
+		for (int ch = 0; ch < 3; ch++)
+			L::Store(velocityOut[ch] + i, L::Load(velocityIn[ch] + i) + L::Select(confine, force[ch], 0.0f));
+	});
+
+	SwapBuffers(velocityBuffers);
+}
+
+
+// --------------------------------------------------------
+// Golden step files are a small header (magic, version,
+// size and parameters), then the state before the step and
+// the state after it, each laid out like GetState()
+// --------------------------------------------------------
+struct GoldenHeader
+{
+	unsigned int Magic;
+	unsigned int Version;
+	unsigned int SizeX;
+	unsigned int SizeY;
+	unsigned int SizeZ;
+	FluidStepParameters Parameters;
+};
+
+bool FluidFieldCPU::SaveGoldenStep(const char* path, const FluidGoldenStep& golden)
+{
+	size_t stateSize = (size_t)golden.SizeX * golden.SizeY * golden.SizeZ * FLUID_STATE_PLANES;
+	if (golden.Before.size() != stateSize || golden.After.size() != stateSize)
+		return false;
+
+	std::ofstream file(path, std::ios::binary);
+	if (!file)
+		return false;
+
+	GoldenHeader header = {};
+	header.Magic = GOLDEN_MAGIC;
+	header.Version = GOLDEN_VERSION;
+	header.SizeX = golden.SizeX;
+	header.SizeY = golden.SizeY;
+	header.SizeZ = golden.SizeZ;
+	header.Parameters = golden.Parameters;
+	file.write((const char*)&header, sizeof(header));
+	file.write((const char*)golden.Before.data(), sizeof(float) * stateSize);
+	file.write((const char*)golden.After.data(), sizeof(float) * stateSize);
+	return (bool)file;
+}
+
+bool FluidFieldCPU::LoadGoldenStep(const char* path, FluidGoldenStep& golden)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file)
+		return false;
+
+	GoldenHeader header = {};
+	file.read((char*)&header, sizeof(header));
+	if (!file || header.Magic != GOLDEN_MAGIC || header.Version != GOLDEN_VERSION ||
+		header.SizeX == 0 || header.SizeY == 0 || header.SizeZ == 0)
+		return false;
+
+	golden.SizeX = header.SizeX;
+	golden.SizeY = header.SizeY;
+	golden.SizeZ = header.SizeZ;
+	golden.Parameters = header.Parameters;
+
+	size_t stateSize = (size_t)golden.SizeX * golden.SizeY * golden.SizeZ * FLUID_STATE_PLANES;
+	golden.Before.resize(stateSize);
+	golden.After.resize(stateSize);
+	file.read((char*)golden.Before.data(), sizeof(float) * stateSize);
+	file.read((char*)golden.After.data(), sizeof(float) * stateSize);
+	return (bool)file;
+}
+
+// --------------------------------------------------------
+// Compares part of two states (count values from first on),
+// relative to the reference's RMS
+// --------------------------------------------------------
+static FluidVolumeError CompareVolume(
+	const char* name,
+	const std::vector<float>& values,
+	const std::vector<float>& reference,
+	size_t first,
+	size_t count,
+	float tolerance)
+{
+	double errorSum = 0.0;
+	double valueSum = 0.0;
+	float maxError = 0.0f;
+	for (size_t i = first; i < first + count; i++)
+	{
+		float error = fabsf(values[i] - reference[i]);
+		maxError = std::max(maxError, error);
+		errorSum += (double)error * error;
+		valueSum += (double)reference[i] * reference[i];
+	}
+
+	FluidVolumeError error = {};
+	error.Name = name;
+	error.MaxError = maxError;
+	error.RMSError = (float)sqrt(errorSum / count);
+	error.RMSValue = (float)sqrt(valueSum / count);
+	error.Passed = error.RMSError <= tolerance * std::max(error.RMSValue, 1e-6f);
+	return error;
+}
+
+// --------------------------------------------------------
+// Runs the step from a golden file on the CPU and compares
+// the results to what the GPU got.  A volume passes if its
+// RMS error is within the tolerance, relative to the RMS of
+// the GPU's values (the sampler's coarse filter weights keep
+// them from matching exactly).
+//
+// path - File saved by FluidField::SaveGoldenStep()
+// tolerance - Largest RMS error allowed, as a fraction of
+//             the volume's RMS
+// --------------------------------------------------------
+FluidGoldenResults FluidFieldCPU::TestGoldenStep(const char* path, float tolerance)
+{
+	FluidGoldenResults results = {};
+	FluidGoldenStep golden;
+	if (!LoadGoldenStep(path, golden))
+		return results;
+
+	results.Loaded = true;
+	results.SizeX = golden.SizeX;
+	results.SizeY = golden.SizeY;
+	results.SizeZ = golden.SizeZ;
+
+	FluidFieldCPU field(golden.SizeX, golden.SizeY, golden.SizeZ);
+	field.parameters = golden.Parameters;
+	field.SetState(golden.Before);
+	field.OneTimeStep();
+
+	std::vector<float> after;
+	field.GetState(after);
+
+	// Current buffer of each volume (see GetState() for the order)
+	struct { const char* Name; int FirstPlane; int PlaneCount; } volumes[FLUID_GOLDEN_VOLUMES] = {
+		{ "Velocity", 0, 3 },
+		{ "Density", 6, 4 },
+		{ "Temperature", 14, 1 },
+		{ "Vorticity", 16, 3 },
+		{ "Pressure", 19, 1 },
+		{ "Divergence", 20, 1 } };
+
+	size_t cellCount = (size_t)golden.SizeX * golden.SizeY * golden.SizeZ;
+	results.Passed = true;
+	for (int v = 0; v < FLUID_GOLDEN_VOLUMES; v++)
+	{
+		results.Volumes[v] = CompareVolume(volumes[v].Name, after, golden.After,
+			volumes[v].FirstPlane * cellCount, volumes[v].PlaneCount * cellCount, tolerance);
+		results.Passed &= results.Volumes[v].Passed;
+	}
+
+	return results;
+}
+
+// --------------------------------------------------------
+// Times the same steps of a smoke plume around a sphere with
+// scalar code, SSE and SSE across every core, and checks
+// they all end in exactly the same state.  Uses the Jacobi
+// pressure solver, so every kernel runs on the SSE path.
+//
+// gridSize - Cells along each axis
+// steps - Steps to time for each
+// --------------------------------------------------------
+FluidBenchmarkResults FluidFieldCPU::Benchmark(int gridSize, int steps)
+{
+	// Sphere in the middle of the grid, so obstacles get tested too
+	size_t cellCount = (size_t)gridSize * gridSize * gridSize;
+	std::vector<unsigned char> sphere(cellCount);
+	float center = gridSize * 0.5f;
+	float radius = gridSize * 0.15f;
+	for (int z = 0; z < gridSize; z++)
+		for (int y = 0; y < gridSize; y++)
+			for (int x = 0; x < gridSize; x++)
+			{
+				float dx = x + 0.5f - center;
+				float dy = y + 0.5f - center;
+				float dz = z + 0.5f - center;
+				sphere[x + gridSize * (y + gridSize * z)] = dx * dx + dy * dy + dz * dz <= radius * radius;
+			}
+
+	// Runs the steps, returning the cells per second
+	auto run = [&](FluidFieldCPU& field, std::vector<float>& state)
+	{
+		field.SetObstacles(sphere.data());
+		field.parameters.PressureSolverType = PRESSURE_SOLVER_JACOBI;
+
+		auto start = std::chrono::high_resolution_clock::now();
+		for (int s = 0; s < steps; s++)
+		{
+			// A sideways push every step, so the plume isn't symmetric
+			field.parameters.InjectVelocity[0] = gridSize * 0.1f;
+			field.parameters.InjectVelocity[2] = gridSize * 0.05f;
+			field.OneTimeStep();
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+
+		field.GetState(state);
+		return cellCount * steps / std::chrono::duration<double>(end - start).count();
+	};
+
+	FluidBenchmarkResults results = {};
+	results.GridSize = gridSize;
+	results.Steps = steps;
+
+	std::vector<float> scalarState;
+	std::vector<float> state;
+	{
+		FluidFieldCPU field(gridSize, gridSize, gridSize, 1);
+		field.useSIMD = false;
+		results.ScalarCellsPerSecond = run(field, scalarState);
+	}
+	{
+		FluidFieldCPU field(gridSize, gridSize, gridSize, 1);
+		results.SIMDCellsPerSecond = run(field, state);
+		results.Matches = state == scalarState;
+	}
+	{
+		FluidFieldCPU field(gridSize, gridSize, gridSize);
+		results.ThreadCount = field.GetThreadCount();
+		results.ThreadedCellsPerSecond = run(field, state);
+		results.Matches &= state == scalarState;
+	}
+
+	return results;
+}
+
+// --------------------------------------------------------
+// Times a smoke plume rising from the default inject sphere
+// simulated densely and over active bricks, and compares the
+// memory each would need and the density each ends up with.
+// Uses the Jacobi pressure solver, which runs sparse too
+// (multigrid always covers the whole grid).
+//
+// gridSize - Cells along each axis
+// steps - Steps to time for each
+// --------------------------------------------------------
+FluidSparseBenchmarkResults FluidFieldCPU::BenchmarkSparse(int gridSize, int steps)
+{
+	size_t cellCount = (size_t)gridSize * gridSize * gridSize;
+	const double megabyte = 1024.0 * 1024.0;
+
+	FluidSparseBenchmarkResults results = {};
+	results.GridSize = gridSize;
+	results.Steps = steps;
+
+	// Runs the steps, returning the grid cells per second
+	auto run = [&](bool sparse, std::vector<float>& state)
+	{
+		FluidFieldCPU field(gridSize, gridSize, gridSize);
+		field.parameters.PressureSolverType = PRESSURE_SOLVER_JACOBI;
+		field.parameters.SparseBricks = sparse;
+
+		double seconds = 0.0;
+		size_t activeSum = 0;
+		size_t peakActive = 0;
+		for (int s = 0; s < steps; s++)
+		{
+			auto start = std::chrono::high_resolution_clock::now();
+			field.OneTimeStep();
+			auto end = std::chrono::high_resolution_clock::now();
+			seconds += std::chrono::duration<double>(end - start).count();
+
+			size_t active = sparse ? field.GetActiveBrickCount() : field.GetBrickCount();
+			activeSum += active;
+			peakActive = std::max(peakActive, active);
+		}
+
+		// A pool of bricks also needs the index of each brick's slot
+		size_t brickBytes = field.GetBytesPerCell() * FLUID_BRICK_SIZE * FLUID_BRICK_SIZE * FLUID_BRICK_SIZE;
+		if (sparse)
+		{
+			results.ActiveBrickFraction = (float)activeSum / steps / field.GetBrickCount();
+			results.PeakActiveBrickFraction = (float)peakActive / field.GetBrickCount();
+			results.SparseMegabytes = (peakActive * brickBytes + field.GetBrickCount() * sizeof(unsigned int)) / megabyte;
+		}
+		else
+		{
+			results.DenseMegabytes = field.GetBytesPerCell() * cellCount / megabyte;
+		}
+
+		field.GetState(state);
+		return cellCount * steps / seconds;
+	};
+
+	std::vector<float> denseState;
+	std::vector<float> sparseState;
+	results.DenseCellsPerSecond = run(false, denseState);
+	results.SparseCellsPerSecond = run(true, sparseState);
+
+	// Density (alpha) of the current buffer - see GetState()
+	double errorSum = 0.0;
+	double valueSum = 0.0;
+	for (size_t i = 9 * cellCount; i < 10 * cellCount; i++)
+	{
+		double error = (double)sparseState[i] - denseState[i];
+		errorSum += error * error;
+		valueSum += (double)denseState[i] * denseState[i];
+	}
+	results.DensityError = valueSum > 0.0 ? (float)sqrt(errorSum / valueSum) : 0.0f;
+
+	return results;
+}
+
+// --------------------------------------------------------
+// Develops a smoke plume in float, then runs a few more
+// steps from there with every volume stored as float and
+// again with the given formats, and compares the volumes
+// that have a format.  The plume is chaotic (vorticity
+// confinement feeds any difference), so longer runs would
+// measure that more than the formats.
+//
+// A volume passes if its RMS error is within the tolerance,
+// relative to the RMS of the float run's values.  Uses the
+// Jacobi pressure solver, so every iteration gets rounded.
+//
+// gridSize - Cells along each axis
+// warmUpSteps - Float steps to develop the plume
+// steps - Steps to compare
+// formats - Formats to compare against float
+// tolerance - Largest RMS error allowed, as a fraction of
+//             the volume's RMS
+// --------------------------------------------------------
+FluidFormatResults FluidFieldCPU::TestFormats(int gridSize, int warmUpSteps, int steps, const FluidFormatPolicy& formats, float tolerance)
+{
+	FluidFormatResults results = {};
+	results.GridSize = gridSize;
+	results.Steps = steps;
+
+	std::vector<float> start;
+	{
+		FluidFieldCPU field(gridSize, gridSize, gridSize);
+		field.parameters.PressureSolverType = PRESSURE_SOLVER_JACOBI;
+		for (int s = 0; s < warmUpSteps; s++)
+			field.OneTimeStep();
+		field.GetState(start);
+	}
+
+	// Runs the steps from the developed plume, returning the bytes per cell
+	auto run = [&](const FluidFormatPolicy& runFormats, std::vector<float>& state)
+	{
+		FluidFieldCPU field(gridSize, gridSize, gridSize);
+		field.parameters.PressureSolverType = PRESSURE_SOLVER_JACOBI;
+		field.parameters.Formats = runFormats;
+		field.SetState(start);
+		for (int s = 0; s < steps; s++)
+			field.OneTimeStep();
+
+		field.GetState(state);
+		return field.GetBytesPerCell();
+	};
+
+	std::vector<float> floatState;
+	std::vector<float> state;
+	results.FloatBytesPerCell = run(FloatFormats(), floatState);
+	results.BytesPerCell = run(formats, state);
+
+	// Current buffer of each volume (see GetState() for the order)
+	struct { const char* Name; int FirstPlane; int PlaneCount; } volumes[FLUID_FORMAT_VOLUMES] = {
+		{ "Velocity", 0, 3 },
+		{ "Pressure", 19, 1 },
+		{ "Density", 6, 4 },
+		{ "Temperature", 14, 1 } };
+
+	size_t cellCount = (size_t)gridSize * gridSize * gridSize;
+	results.Passed = true;
+	for (int v = 0; v < FLUID_FORMAT_VOLUMES; v++)
+	{
+		results.Volumes[v] = CompareVolume(volumes[v].Name, state, floatState,
+			volumes[v].FirstPlane * cellCount, volumes[v].PlaneCount * cellCount, tolerance);
+		results.Passed &= results.Volumes[v].Passed;
+	}
+
+	return results;
+}
+
+// --------------------------------------------------------
+// Largest speed of any cell outside the obstacles, from
+// planes laid out like GetState()'s.  CPU version of the
+// MaxSpeedCS reduction, which FluidField falls back on when
+// it has no GPU result to use.
+// --------------------------------------------------------
+float FluidFieldCPU::MaxSpeed(const float* velocityX, const float* velocityY, const float* velocityZ, const float* obstacles, size_t cellCount)
+{
+	float maxSpeedSquared = 0.0f;
+	for (size_t i = 0; i < cellCount; i++)
+	{
+		if (obstacles[i] > 0.0f)
+			continue;
+
+		float speedSquared =
+			velocityX[i] * velocityX[i] +
+			velocityY[i] * velocityY[i] +
+			velocityZ[i] * velocityZ[i];
+		maxSpeedSquared = std::max(maxSpeedSquared, speedSquared);
+	}
+	return sqrtf(maxSpeedSquared);
+}
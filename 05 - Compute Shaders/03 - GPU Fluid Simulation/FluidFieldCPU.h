@@ -0,0 +1,270 @@
+#pragma once
+
+#include <vector>
+
+#include "JobSystem.h"
+#include "FluidBricks.h"
+#include "PressureSolver.h"
+
+// Planes (single channels) in a fluid's state - see GetState()
+#define FLUID_STATE_PLANES 22
+
+// Volumes compared against a golden step
+#define FLUID_GOLDEN_VOLUMES 6
+
+// Volumes with a format policy - see TestFormats()
+#define FLUID_FORMAT_VOLUMES 4
+
+// Ways a volume can be stored (see FluidFormatPolicy)
+#define FLUID_FORMAT_FLOAT 0	// 32-bit float
+#define FLUID_FORMAT_HALF 1		// 16-bit float
+#define FLUID_FORMAT_UNORM8 2	// 8-bit fixed point, 0 to 1
+#define FLUID_FORMAT_SNORM16 3	// 16-bit fixed point, -1 to 1
+
+// --------------------------------------------------------
+// How each simulated quantity is stored.  Volumes hold their
+// values divided by the scale, so fixed point formats cover
+// zero to the scale (or minus the scale to the scale).  The
+// density scale only applies to density (alpha), not color.
+// --------------------------------------------------------
+struct FluidFormatPolicy
+{
+	int Velocity;		// A FLUID_FORMAT value
+	int Pressure;
+	int Density;
+	int Temperature;
+	float DensityScale;
+	float TemperatureScale;
+};
+
+// --------------------------------------------------------
+// Everything FluidField::OneTimeStep() uses besides the
+// volumes themselves.  Plain data, so it can be saved
+// straight into a golden step file.
+// --------------------------------------------------------
+struct FluidStepParameters
+{
+	float FixedTimeStep;
+	float AmbientTemperature;
+	float InjectTemperature;
+	float InjectDensity;
+	float InjectRadius;
+	float InjectPosition[3];
+	float InjectVelocity[3];	// The impulse waiting to be applied this step
+	float FluidColor[3];
+	float TemperatureBuoyancy;
+	float DensityWeight;
+	float VelocityDamper;
+	float DensityDamper;
+	float TemperatureDamper;
+	float VorticityEpsilon;
+	int InjectSmoke;
+	int ApplyVorticity;
+	int PressureSolverType;		// A FLUID_PRESSURE_SOLVER value
+	int PressureIterations;
+	int MultigridCycles;
+	int MultigridSmoothIterations;
+	int SparseBricks;			// Only simulate active bricks (see FluidBricks)
+	float BrickDensityThreshold;
+	float BrickVelocityThreshold;
+	int BrickDilation;
+	FluidFormatPolicy Formats;
+};
+
+// --------------------------------------------------------
+// One step of the GPU simulation: the state before it, the
+// parameters it ran with and the state after it
+// --------------------------------------------------------
+struct FluidGoldenStep
+{
+	unsigned int SizeX;
+	unsigned int SizeY;
+	unsigned int SizeZ;
+	FluidStepParameters Parameters;
+	std::vector<float> Before;
+	std::vector<float> After;
+};
+
+// --------------------------------------------------------
+// How far one volume of the CPU step is from the GPU's
+// --------------------------------------------------------
+struct FluidVolumeError
+{
+	const char* Name;
+	float MaxError;		// Largest absolute difference of any channel
+	float RMSError;		// RMS of the differences
+	float RMSValue;		// RMS of the GPU's values, for scale
+	bool Passed;
+};
+
+struct FluidGoldenResults
+{
+	bool Loaded;
+	unsigned int SizeX;
+	unsigned int SizeY;
+	unsigned int SizeZ;
+	FluidVolumeError Volumes[FLUID_GOLDEN_VOLUMES];
+	bool Passed;
+};
+
+// --------------------------------------------------------
+// Cells simulated per second by the same steps run with
+// scalar code on one thread, with SSE on one thread and
+// with SSE on every core
+// --------------------------------------------------------
+struct FluidBenchmarkResults
+{
+	int GridSize;
+	int Steps;
+	unsigned int ThreadCount;
+	double ScalarCellsPerSecond;
+	double SIMDCellsPerSecond;
+	double ThreadedCellsPerSecond;
+	bool Matches;	// All three ended in exactly the same state
+};
+
+// --------------------------------------------------------
+// How far the same steps (from the same state) end up from
+// each other with every volume stored as float and with a
+// format policy, and how much memory each takes
+// --------------------------------------------------------
+struct FluidFormatResults
+{
+	int GridSize;
+	int Steps;
+	FluidVolumeError Volumes[FLUID_FORMAT_VOLUMES];	// Compared to the float run
+	size_t FloatBytesPerCell;
+	size_t BytesPerCell;
+	bool Passed;
+};
+
+// --------------------------------------------------------
+// The same steps simulated over every cell and over only the
+// active bricks.  Throughput is in grid cells per second
+// either way, so the sparse figure shows the speedup.
+// --------------------------------------------------------
+struct FluidSparseBenchmarkResults
+{
+	int GridSize;
+	int Steps;
+	float ActiveBrickFraction;		// Average over the steps
+	float PeakActiveBrickFraction;
+	double DenseCellsPerSecond;
+	double SparseCellsPerSecond;
+	double DenseMegabytes;			// Every volume, allocated densely
+	double SparseMegabytes;			// The same volumes as a pool of the most bricks ever active
+	float DensityError;				// RMS density difference from the dense run, relative to its RMS
+};
+
+// --------------------------------------------------------
+// CPU reference for FluidField's simulation step, over flat
+// arrays indexed x + sizeX * (y + sizeY * z), with one array
+// per channel.  Every kernel OneTimeStep() dispatches is
+// reproduced here, down to the cells each one skips: cells
+// inside obstacles keep whatever their output buffer held
+// before, so both halves of each ping-pong pair are kept.
+//
+// With parameters.SparseBricks set, each kernel only runs
+// over the bricks FluidBricks finds active at the start of
+// the step, just like FluidField's indirect dispatches.
+//
+// Rows are done four cells at a time with SSE (cells at
+// either end of a row, whose neighbors are clamped, are done
+// one at a time) and Z slices are spread across threads.
+// Each kernel is written once for any number of lanes, so
+// the scalar and SSE paths do exactly the same arithmetic
+// and end in exactly the same state.
+//
+// Volumes with a reduced precision format (see
+// parameters.Formats) are rounded to it as each kernel
+// finishes writing them, like a texture store would.
+//
+// The one difference from the GPU is in advection, where the
+// sampler only has 8 bits of precision for its filter weights
+// and this does the trilinear filtering in full precision.
+// Golden comparisons allow for that.
+//
+// This only depends on the standard library (and SSE2), so
+// it builds anywhere, not just alongside D3D.
+// --------------------------------------------------------
+class FluidFieldCPU
+{
+public:
+	FluidFieldCPU(int sizeX, int sizeY, int sizeZ, unsigned int threadCount = 0);
+
+	void OneTimeStep();
+
+	void SetObstacles(const unsigned char* obstacles);
+	void GetState(std::vector<float>& state);
+	void SetState(const std::vector<float>& state);
+
+	int GetSizeX();
+	int GetSizeY();
+	int GetSizeZ();
+	unsigned int GetThreadCount();
+	int GetBrickCount();
+	int GetActiveBrickCount();
+	size_t GetBytesPerCell();
+
+	// Publically accessible data
+	FluidStepParameters parameters;
+	bool useSIMD;
+
+	static FluidStepParameters DefaultParameters();
+	static FluidFormatPolicy FloatFormats();
+	static FluidFormatPolicy ReducedFormats();
+	static bool SaveGoldenStep(const char* path, const FluidGoldenStep& golden);
+	static bool LoadGoldenStep(const char* path, FluidGoldenStep& golden);
+	static FluidGoldenResults TestGoldenStep(const char* path, float tolerance = 0.01f);
+	static FluidBenchmarkResults Benchmark(int gridSize, int steps);
+	static FluidSparseBenchmarkResults BenchmarkSparse(int gridSize, int steps);
+	static FluidFormatResults TestFormats(int gridSize, int warmUpSteps, int steps, const FluidFormatPolicy& formats, float tolerance = 0.02f);
+	static float MaxSpeed(const float* velocityX, const float* velocityY, const float* velocityZ, const float* obstacles, size_t cellCount);
+
+private:
+	int sizeX;
+	int sizeY;
+	int sizeZ;
+	JobSystem jobs;
+
+	// One array per channel, like a VolumeResource, and the
+	// format the GPU would store it in
+	struct Volume
+	{
+		unsigned int ChannelCount;
+		std::vector<float> Channels[4];
+		int Format;
+		float Scale[4];
+	};
+
+	// Same buffers as FluidField
+	Volume velocityBuffers[2];	// No w - it's never read
+	Volume divergenceBuffer;
+	Volume pressureBuffers[2];
+	Volume densityBuffers[2];
+	Volume temperatureBuffers[2];
+	Volume vorticityBuffer;		// No w here either
+	std::vector<unsigned char> obstacles;
+	PressureSolver multigrid;
+	FluidBricks bricks;
+	bool sparseLastStep;
+
+	// Helper methods
+	void CreateVolume(Volume& volume, unsigned int channelCount);
+	void SwapBuffers(Volume volumes[2]);
+	void ApplyFormats();
+	void RoundToFormat(Volume& volume);
+	template<typename Cells> void ForEachCell(const Cells& cells);
+	template<typename Cells> void ForEachCellInRow(const Cells& cells, int xStart, int xEnd, int y, int z);
+
+	// Fluid functions
+	void UpdateBricks();
+	void Advection(Volume volumes[2], float damper);
+	void Divergence();
+	void Pressure();
+	void Projection();
+	void InjectSmoke();
+	void Buoyancy();
+	void Vorticity();
+	void Confinement();
+};
@@ -0,0 +1,785 @@
+#include "FluidSequence.h"
+#include "FluidBricks.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+
+// Sequence files start with "FSEQ" and a version
+#define SEQUENCE_MAGIC 0x51455346
+#define SEQUENCE_VERSION 1
+
+#define BRICK_CELLS (FLUID_BRICK_SIZE * FLUID_BRICK_SIZE * FLUID_BRICK_SIZE)
+
+// LZ matches are at least this long and at most this far back
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 16
+
+struct SequenceHeader
+{
+	unsigned int Magic;
+	unsigned int Version;
+	unsigned int SizeX;
+	unsigned int SizeY;
+	unsigned int SizeZ;
+	unsigned int FrameCount;
+	unsigned long long IndexOffset;	// Where the frame offsets are
+};
+
+struct SequenceFrameHeader
+{
+	unsigned int PayloadSize;		// Before compression
+	unsigned int CompressedSize;
+};
+
+
+// --------------------------------------------------------
+// Bytes in a frame's payload: a bit per brick saying whether
+// it's stored, then each stored brick's range (min and max)
+// per channel, then each stored brick's quantized values per
+// channel
+// --------------------------------------------------------
+static size_t PayloadSize(size_t brickCount, size_t storedBricks)
+{
+	return (brickCount + 7) / 8 +
+		storedBricks * FLUID_SEQUENCE_CHANNELS * 2 * sizeof(float) +
+		storedBricks * FLUID_SEQUENCE_CHANNELS * BRICK_CELLS;
+}
+
+// --------------------------------------------------------
+// Calls cell(brickIndex, gridIndex) for each cell of a brick
+// that's inside the grid, in brick index order
+// --------------------------------------------------------
+template<typename Cell>
+static void ForEachBrickCell(
+	unsigned int brickX, unsigned int brickY, unsigned int brickZ,
+	unsigned int sizeX, unsigned int sizeY, unsigned int sizeZ,
+	const Cell& cell)
+{
+	for (unsigned int z = 0; z < FLUID_BRICK_SIZE; z++)
+		for (unsigned int y = 0; y < FLUID_BRICK_SIZE; y++)
+			for (unsigned int x = 0; x < FLUID_BRICK_SIZE; x++)
+			{
+				unsigned int gridX = brickX * FLUID_BRICK_SIZE + x;
+				unsigned int gridY = brickY * FLUID_BRICK_SIZE + y;
+				unsigned int gridZ = brickZ * FLUID_BRICK_SIZE + z;
+				if (gridX < sizeX && gridY < sizeY && gridZ < sizeZ)
+					cell(x + FLUID_BRICK_SIZE * (y + FLUID_BRICK_SIZE * z), gridX + (size_t)sizeX * (gridY + (size_t)sizeY * gridZ));
+			}
+}
+
+// --------------------------------------------------------
+// Appends a length that didn't fit in its token's nibble
+// --------------------------------------------------------
+static void WriteLZLength(std::vector<unsigned char>& out, size_t length)
+{
+	while (length >= 255)
+	{
+		out.push_back(255);
+		length -= 255;
+	}
+	out.push_back((unsigned char)length);
+}
+
+// --------------------------------------------------------
+// Appends one LZ sequence: a token (literal count in the top
+// nibble, match length minus LZ_MIN_MATCH in the bottom, 15
+// meaning more follows), the literals, then the match's
+// offset.  The last sequence is just literals.
+// --------------------------------------------------------
+static void WriteLZSequence(std::vector<unsigned char>& out, const unsigned char* literals, size_t literalCount, size_t offset, size_t matchLength)
+{
+	size_t matchCode = offset ? matchLength - LZ_MIN_MATCH : 0;
+	out.push_back((unsigned char)((std::min(literalCount, (size_t)15) << 4) | std::min(matchCode, (size_t)15)));
+	if (literalCount >= 15)
+		WriteLZLength(out, literalCount - 15);
+	out.insert(out.end(), literals, literals + literalCount);
+
+	if (offset == 0)
+		return;
+
+	out.push_back((unsigned char)(offset & 255));
+	out.push_back((unsigned char)(offset >> 8));
+	if (matchCode >= 15)
+		WriteLZLength(out, matchCode - 15);
+}
+
+// --------------------------------------------------------
+// Greedy LZ77 compression with a hash of the next four bytes
+// to find matches (an LZ4-style block format)
+// --------------------------------------------------------
+static void CompressLZ(const std::vector<unsigned char>& in, std::vector<unsigned char>& out, std::vector<int>& hashTable)
+{
+	out.clear();
+	hashTable.assign((size_t)1 << LZ_HASH_BITS, -1);
+
+	const unsigned char* data = in.data();
+	size_t size = in.size();
+	size_t anchor = 0;
+	size_t i = 0;
+	while (i + LZ_MIN_MATCH <= size)
+	{
+		unsigned int next;
+		memcpy(&next, data + i, sizeof(next));
+		unsigned int hash = (next * 2654435761u) >> (32 - LZ_HASH_BITS);
+		int candidate = hashTable[hash];
+		hashTable[hash] = (int)i;
+
+		if (candidate < 0 || i - candidate > LZ_MAX_OFFSET || memcmp(data + candidate, data + i, LZ_MIN_MATCH) != 0)
+		{
+			i++;
+			continue;
+		}
+
+		size_t length = LZ_MIN_MATCH;
+		while (i + length < size && data[candidate + length] == data[i + length])
+			length++;
+
+		WriteLZSequence(out, data + anchor, i - anchor, i - candidate, length);
+		i += length;
+		anchor = i;
+	}
+
+	WriteLZSequence(out, data + anchor, size - anchor, 0, 0);
+}
+
+// --------------------------------------------------------
+// Reads a length that didn't fit in its token's nibble
+// --------------------------------------------------------
+static bool ReadLZLength(const unsigned char*& in, const unsigned char* end, size_t& length)
+{
+	unsigned char byte;
+	do
+	{
+		if (in >= end)
+			return false;
+		byte = *in++;
+		length += byte;
+	} while (byte == 255);
+	return true;
+}
+
+// --------------------------------------------------------
+// Undoes CompressLZ(), failing on anything that doesn't
+// decompress to exactly outSize bytes
+// --------------------------------------------------------
+static bool DecompressLZ(const unsigned char* in, size_t size, unsigned char* out, size_t outSize)
+{
+	const unsigned char* end = in + size;
+	unsigned char* next = out;
+	unsigned char* outEnd = out + outSize;
+	while (in < end)
+	{
+		unsigned char token = *in++;
+
+		// Literals
+		size_t literalCount = token >> 4;
+		if (literalCount == 15 && !ReadLZLength(in, end, literalCount))
+			return false;
+		if (literalCount > (size_t)(end - in) || literalCount > (size_t)(outEnd - next))
+			return false;
+		memcpy(next, in, literalCount);
+		next += literalCount;
+		in += literalCount;
+
+		// The last sequence has no match
+		if (in == end)
+			break;
+
+		// Match, which may overlap what it's writing
+		if (end - in < 2)
+			return false;
+		size_t offset = in[0] | (in[1] << 8);
+		in += 2;
+
+		size_t length = token & 15;
+		if (length == 15 && !ReadLZLength(in, end, length))
+			return false;
+		length += LZ_MIN_MATCH;
+		if (offset == 0 || offset > (size_t)(next - out) || length > (size_t)(outEnd - next))
+			return false;
+
+		const unsigned char* match = next - offset;
+		for (size_t i = 0; i < length; i++)
+			next[i] = match[i];
+		next += length;
+	}
+
+	return next == outEnd;
+}
+
+// --------------------------------------------------------
+// Turns a frame's payload back into planes.  Bricks that
+// weren't stored are zero.
+// --------------------------------------------------------
+static bool DecodePayload(const std::vector<unsigned char>& payload, unsigned int sizeX, unsigned int sizeY, unsigned int sizeZ, float* planes)
+{
+	unsigned int brickCountX = (sizeX + FLUID_BRICK_SIZE - 1) / FLUID_BRICK_SIZE;
+	unsigned int brickCountY = (sizeY + FLUID_BRICK_SIZE - 1) / FLUID_BRICK_SIZE;
+	unsigned int brickCountZ = (sizeZ + FLUID_BRICK_SIZE - 1) / FLUID_BRICK_SIZE;
+	size_t brickCount = (size_t)brickCountX * brickCountY * brickCountZ;
+	size_t cellCount = (size_t)sizeX * sizeY * sizeZ;
+	size_t maskBytes = (brickCount + 7) / 8;
+	if (payload.size() < maskBytes)
+		return false;
+
+	size_t storedBricks = 0;
+	for (size_t b = 0; b < brickCount; b++)
+		storedBricks += (payload[b / 8] >> (b % 8)) & 1;
+	if (payload.size() != PayloadSize(brickCount, storedBricks))
+		return false;
+
+	std::fill(planes, planes + cellCount * FLUID_SEQUENCE_CHANNELS, 0.0f);
+
+	const unsigned char* ranges = payload.data() + maskBytes;
+	const unsigned char* values = ranges + storedBricks * FLUID_SEQUENCE_CHANNELS * 2 * sizeof(float);
+	size_t stored = 0;
+	for (unsigned int bz = 0; bz < brickCountZ; bz++)
+		for (unsigned int by = 0; by < brickCountY; by++)
+			for (unsigned int bx = 0; bx < brickCountX; bx++)
+			{
+				size_t b = bx + brickCountX * (by + (size_t)brickCountY * bz);
+				if (!((payload[b / 8] >> (b % 8)) & 1))
+					continue;
+
+				for (int c = 0; c < FLUID_SEQUENCE_CHANNELS; c++)
+				{
+					size_t block = stored * FLUID_SEQUENCE_CHANNELS + c;
+					float range[2];
+					memcpy(range, ranges + block * sizeof(range), sizeof(range));
+					float step = (range[1] - range[0]) / 255.0f;
+
+					// Undo the row deltas as we go
+					const unsigned char* deltas = values + block * BRICK_CELLS;
+					float* plane = planes + c * cellCount;
+					unsigned char quantized = 0;
+					ForEachBrickCell(bx, by, bz, sizeX, sizeY, sizeZ, [&](unsigned int brickIndex, size_t gridIndex)
+					{
+						quantized += deltas[brickIndex];
+						plane[gridIndex] = range[0] + quantized * step;
+					});
+				}
+				stored++;
+			}
+
+	return true;
+}
+
+
+FluidRecorder::FluidRecorder() :
+	sizeX(0),
+	sizeY(0),
+	sizeZ(0),
+	zeroThreshold(0.0f),
+	bytesWritten(0),
+	bricksSkipped(0),
+	bricksTotal(0)
+{
+}
+
+FluidRecorder::~FluidRecorder()
+{
+	Close();
+}
+
+bool FluidRecorder::IsOpen() { return file.is_open(); }
+unsigned int FluidRecorder::GetFrameCount() { return (unsigned int)frameOffsets.size(); }
+unsigned long long FluidRecorder::GetBytesWritten() { return bytesWritten; }
+float FluidRecorder::GetSkippedBrickFraction() { return bricksTotal ? (float)bricksSkipped / bricksTotal : 0.0f; }
+
+// --------------------------------------------------------
+// Starts a new sequence, replacing any file at the path
+//
+// zeroThreshold - Bricks with every value (of every channel)
+//                 within this of zero aren't stored
+// --------------------------------------------------------
+bool FluidRecorder::Open(const char* path, unsigned int sizeX, unsigned int sizeY, unsigned int sizeZ, float zeroThreshold)
+{
+	Close();
+	if (sizeX == 0 || sizeY == 0 || sizeZ == 0)
+		return false;
+
+	file.open(path, std::ios::binary | std::ios::trunc);
+	if (!file)
+	{
+		file.clear();
+		return false;
+	}
+
+	this->sizeX = sizeX;
+	this->sizeY = sizeY;
+	this->sizeZ = sizeZ;
+	this->zeroThreshold = zeroThreshold;
+	frameOffsets.clear();
+	bricksSkipped = 0;
+	bricksTotal = 0;
+
+	// Filled in properly by Close()
+	SequenceHeader header = {};
+	file.write((const char*)&header, sizeof(header));
+	bytesWritten = sizeof(header);
+	return (bool)file;
+}
+
+// --------------------------------------------------------
+// Compresses and appends a frame
+//
+// planes - FLUID_SEQUENCE_CHANNELS planes, one after another
+// --------------------------------------------------------
+bool FluidRecorder::WriteFrame(const float* planes)
+{
+	if (!file.is_open())
+		return false;
+
+	unsigned int brickCountX = (sizeX + FLUID_BRICK_SIZE - 1) / FLUID_BRICK_SIZE;
+	unsigned int brickCountY = (sizeY + FLUID_BRICK_SIZE - 1) / FLUID_BRICK_SIZE;
+	unsigned int brickCountZ = (sizeZ + FLUID_BRICK_SIZE - 1) / FLUID_BRICK_SIZE;
+	size_t brickCount = (size_t)brickCountX * brickCountY * brickCountZ;
+	size_t cellCount = (size_t)sizeX * sizeY * sizeZ;
+	size_t maskBytes = (brickCount + 7) / 8;
+
+	// Find the bricks with anything in them
+	payload.assign(maskBytes, 0);
+	size_t storedBricks = 0;
+	for (unsigned int bz = 0; bz < brickCountZ; bz++)
+		for (unsigned int by = 0; by < brickCountY; by++)
+			for (unsigned int bx = 0; bx < brickCountX; bx++)
+			{
+				bool empty = true;
+				for (int c = 0; c < FLUID_SEQUENCE_CHANNELS && empty; c++)
+				{
+					const float* plane = planes + c * cellCount;
+					ForEachBrickCell(bx, by, bz, sizeX, sizeY, sizeZ, [&](unsigned int, size_t gridIndex)
+					{
+						empty &= fabsf(plane[gridIndex]) <= zeroThreshold;
+					});
+				}
+
+				if (empty)
+					continue;
+
+				size_t b = bx + brickCountX * (by + (size_t)brickCountY * bz);
+				payload[b / 8] |= (unsigned char)(1 << (b % 8));
+				storedBricks++;
+			}
+
+	bricksTotal += brickCount;
+	bricksSkipped += brickCount - storedBricks;
+
+	// Quantize each stored brick against its own range, one
+	// channel at a time, storing the change from the cell before
+	payload.resize(PayloadSize(brickCount, storedBricks), 0);
+	unsigned char* ranges = payload.data() + maskBytes;
+	unsigned char* values = ranges + storedBricks * FLUID_SEQUENCE_CHANNELS * 2 * sizeof(float);
+	size_t stored = 0;
+	for (unsigned int bz = 0; bz < brickCountZ; bz++)
+		for (unsigned int by = 0; by < brickCountY; by++)
+			for (unsigned int bx = 0; bx < brickCountX; bx++)
+			{
+				size_t b = bx + brickCountX * (by + (size_t)brickCountY * bz);
+				if (!((payload[b / 8] >> (b % 8)) & 1))
+					continue;
+
+				for (int c = 0; c < FLUID_SEQUENCE_CHANNELS; c++)
+				{
+					const float* plane = planes + c * cellCount;
+					float range[2] = { plane[0], plane[0] };
+					bool first = true;
+					ForEachBrickCell(bx, by, bz, sizeX, sizeY, sizeZ, [&](unsigned int, size_t gridIndex)
+					{
+						range[0] = first ? plane[gridIndex] : std::min(range[0], plane[gridIndex]);
+						range[1] = first ? plane[gridIndex] : std::max(range[1], plane[gridIndex]);
+						first = false;
+					});
+
+					size_t block = stored * FLUID_SEQUENCE_CHANNELS + c;
+					memcpy(ranges + block * sizeof(range), range, sizeof(range));
+
+					float scale = range[1] > range[0] ? 255.0f / (range[1] - range[0]) : 0.0f;
+					unsigned char* deltas = values + block * BRICK_CELLS;
+					unsigned char previous = 0;
+					ForEachBrickCell(bx, by, bz, sizeX, sizeY, sizeZ, [&](unsigned int brickIndex, size_t gridIndex)
+					{
+						unsigned char quantized = (unsigned char)std::min(255, (int)((plane[gridIndex] - range[0]) * scale + 0.5f));
+						deltas[brickIndex] = (unsigned char)(quantized - previous);
+						previous = quantized;
+					});
+				}
+				stored++;
+			}
+
+	CompressLZ(payload, compressed, hashTable);
+
+	SequenceFrameHeader frameHeader = {};
+	frameHeader.PayloadSize = (unsigned int)payload.size();
+	frameHeader.CompressedSize = (unsigned int)compressed.size();
+	frameOffsets.push_back(bytesWritten);
+	file.write((const char*)&frameHeader, sizeof(frameHeader));
+	file.write((const char*)compressed.data(), compressed.size());
+	bytesWritten += sizeof(frameHeader) + compressed.size();
+	return (bool)file;
+}
+
+// --------------------------------------------------------
+// Writes the frame index and header, finishing the file
+// --------------------------------------------------------
+bool FluidRecorder::Close()
+{
+	if (!file.is_open())
+		return false;
+
+	SequenceHeader header = {};
+	header.Magic = SEQUENCE_MAGIC;
+	header.Version = SEQUENCE_VERSION;
+	header.SizeX = sizeX;
+	header.SizeY = sizeY;
+	header.SizeZ = sizeZ;
+	header.FrameCount = (unsigned int)frameOffsets.size();
+	header.IndexOffset = bytesWritten;
+
+	file.write((const char*)frameOffsets.data(), sizeof(unsigned long long) * frameOffsets.size());
+	bytesWritten += sizeof(unsigned long long) * frameOffsets.size();
+	file.seekp(0);
+	file.write((const char*)&header, sizeof(header));
+
+	bool written = (bool)file;
+	file.close();
+	file.clear();
+	return written;
+}
+
+
+FluidPlayer::FluidPlayer(unsigned int ringSize) :
+	open(false),
+	loop(false),
+	sizeX(0),
+	sizeY(0),
+	sizeZ(0),
+	ring(std::max(ringSize, 1u)),
+	readSlot(0),
+	filledSlots(0),
+	finished(false),
+	quit(false)
+{
+}
+
+FluidPlayer::~FluidPlayer()
+{
+	Close();
+}
+
+bool FluidPlayer::IsOpen() { return open; }
+unsigned int FluidPlayer::GetSizeX() { return sizeX; }
+unsigned int FluidPlayer::GetSizeY() { return sizeY; }
+unsigned int FluidPlayer::GetSizeZ() { return sizeZ; }
+unsigned int FluidPlayer::GetFrameCount() { return (unsigned int)frameOffsets.size(); }
+
+// --------------------------------------------------------
+// Whether every frame has been handed out (never, if looping)
+// --------------------------------------------------------
+bool FluidPlayer::IsFinished()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return finished && filledSlots == 0;
+}
+
+// --------------------------------------------------------
+// Opens a sequence and starts decoding it from the first
+// frame, optionally wrapping back around at the end
+// --------------------------------------------------------
+bool FluidPlayer::Open(const char* path, bool loop)
+{
+	Close();
+
+	file.open(path, std::ios::binary);
+	SequenceHeader header = {};
+	file.read((char*)&header, sizeof(header));
+	if (!file || header.Magic != SEQUENCE_MAGIC || header.Version != SEQUENCE_VERSION ||
+		header.SizeX == 0 || header.SizeY == 0 || header.SizeZ == 0 || header.FrameCount == 0)
+	{
+		file.close();
+		file.clear();
+		return false;
+	}
+
+	frameOffsets.resize(header.FrameCount);
+	file.seekg(header.IndexOffset);
+	file.read((char*)frameOffsets.data(), sizeof(unsigned long long) * frameOffsets.size());
+	if (!file)
+	{
+		frameOffsets.clear();
+		file.close();
+		file.clear();
+		return false;
+	}
+
+	sizeX = header.SizeX;
+	sizeY = header.SizeY;
+	sizeZ = header.SizeZ;
+	this->loop = loop;
+	readSlot = 0;
+	filledSlots = 0;
+	finished = false;
+	quit = false;
+	open = true;
+	decoder = std::thread(&FluidPlayer::DecodeLoop, this);
+	return true;
+}
+
+void FluidPlayer::Close()
+{
+	if (!open)
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	slotFree.notify_all();
+	decoder.join();
+
+	file.close();
+	file.clear();
+	frameOffsets.clear();
+	open = false;
+}
+
+// --------------------------------------------------------
+// Takes the next decoded frame, if there is one.  Without
+// waiting, this returns false when the decoder is behind -
+// the caller can keep showing the frame it has.
+// --------------------------------------------------------
+bool FluidPlayer::NextFrame(FluidSequenceFrame& frame, bool wait)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	if (!open)
+		return false;
+
+	if (wait)
+		frameReady.wait(lock, [&] { return filledSlots > 0 || finished; });
+	if (filledSlots == 0)
+		return false;
+
+	std::swap(frame, ring[readSlot]);
+	readSlot = (readSlot + 1) % ring.size();
+	filledSlots--;
+
+	lock.unlock();
+	slotFree.notify_one();
+	return true;
+}
+
+// --------------------------------------------------------
+// Decoder thread - fills free ring slots in frame order
+// until the end of the sequence (or forever, if looping)
+// --------------------------------------------------------
+void FluidPlayer::DecodeLoop()
+{
+	std::vector<unsigned char> compressed;
+	std::vector<unsigned char> payload;
+	unsigned int frameIndex = 0;
+	while (true)
+	{
+		// The slot after the filled ones is the decoder's until
+		// it's counted as filled
+		unsigned int slot;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			slotFree.wait(lock, [&] { return quit || filledSlots < ring.size(); });
+			if (quit)
+				return;
+			slot = (readSlot + filledSlots) % ring.size();
+		}
+
+		bool decoded = ReadFrame(frameIndex, ring[slot], compressed, payload);
+
+		bool done = false;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (decoded)
+			{
+				filledSlots++;
+				frameIndex++;
+			}
+
+			if (frameIndex == frameOffsets.size() && loop)
+				frameIndex = 0;
+
+			done = !decoded || frameIndex == frameOffsets.size();
+			finished = done;
+		}
+		frameReady.notify_all();
+
+		if (done)
+			return;
+	}
+}
+
+// --------------------------------------------------------
+// Reads and decodes one frame (decoder thread only)
+// --------------------------------------------------------
+bool FluidPlayer::ReadFrame(unsigned int index, FluidSequenceFrame& frame, std::vector<unsigned char>& compressed, std::vector<unsigned char>& payload)
+{
+	size_t brickCount =
+		(size_t)((sizeX + FLUID_BRICK_SIZE - 1) / FLUID_BRICK_SIZE) *
+		((sizeY + FLUID_BRICK_SIZE - 1) / FLUID_BRICK_SIZE) *
+		((sizeZ + FLUID_BRICK_SIZE - 1) / FLUID_BRICK_SIZE);
+	size_t largestPayload = PayloadSize(brickCount, brickCount);
+
+	SequenceFrameHeader frameHeader = {};
+	file.seekg(frameOffsets[index]);
+	file.read((char*)&frameHeader, sizeof(frameHeader));
+	if (!file || frameHeader.PayloadSize > largestPayload ||
+		frameHeader.CompressedSize > largestPayload + largestPayload / 255 + 16)
+		return false;
+
+	compressed.resize(frameHeader.CompressedSize);
+	file.read((char*)compressed.data(), compressed.size());
+	if (!file)
+		return false;
+
+	payload.resize(frameHeader.PayloadSize);
+	if (!DecompressLZ(compressed.data(), compressed.size(), payload.data(), payload.size()))
+		return false;
+
+	frame.Index = index;
+	frame.Planes.resize((size_t)sizeX * sizeY * sizeZ * FLUID_SEQUENCE_CHANNELS);
+	return DecodePayload(payload, sizeX, sizeY, sizeZ, frame.Planes.data());
+}
+
+// --------------------------------------------------------
+// Records a CPU simulated smoke plume, plays it back and
+// compares every frame against the same steps simulated
+// again, then times playback on its own.  The file at path
+// is deleted afterwards.
+//
+// tolerance - Largest RMS error allowed, as a fraction of
+//             the volume's RMS
+// --------------------------------------------------------
+FluidSequenceTestResults FluidPlayer::TestRoundTrip(const char* path, int gridSize, int frames, float tolerance)
+{
+	FluidSequenceTestResults results = {};
+	results.GridSize = gridSize;
+	results.Frames = frames;
+
+	size_t cellCount = (size_t)gridSize * gridSize * gridSize;
+	const double megabyte = 1024.0 * 1024.0;
+	results.RawMegabytes = cellCount * FLUID_SEQUENCE_CHANNELS * sizeof(float) * frames / megabyte;
+
+	// Where each recorded channel is in the state (see
+	// FluidFieldCPU::GetState()) - the current buffers
+	const size_t statePlanes[FLUID_SEQUENCE_CHANNELS] = { 6, 7, 8, 9, 14, 0, 1, 2 };
+	auto gather = [&](const std::vector<float>& state, std::vector<float>& planes)
+	{
+		planes.resize(cellCount * FLUID_SEQUENCE_CHANNELS);
+		for (int c = 0; c < FLUID_SEQUENCE_CHANNELS; c++)
+			std::copy(
+				state.begin() + statePlanes[c] * cellCount,
+				state.begin() + (statePlanes[c] + 1) * cellCount,
+				planes.begin() + c * cellCount);
+	};
+
+	// Record -----
+	{
+		FluidRecorder recorder;
+		if (!recorder.Open(path, gridSize, gridSize, gridSize))
+			return results;
+
+		FluidFieldCPU field(gridSize, gridSize, gridSize);
+		std::vector<float> state;
+		std::vector<float> planes;
+		double seconds = 0.0;
+		for (int f = 0; f < frames; f++)
+		{
+			field.OneTimeStep();
+			field.GetState(state);
+			gather(state, planes);
+
+			auto start = std::chrono::high_resolution_clock::now();
+			recorder.WriteFrame(planes.data());
+			auto end = std::chrono::high_resolution_clock::now();
+			seconds += std::chrono::duration<double>(end - start).count();
+		}
+
+		results.RecordFramesPerSecond = frames / seconds;
+		results.SkippedBrickFraction = recorder.GetSkippedBrickFraction();
+		if (!recorder.Close())
+			return results;
+		results.FileMegabytes = recorder.GetBytesWritten() / megabyte;
+	}
+
+	// Play back against the same steps -----
+	const char* names[FLUID_SEQUENCE_VOLUMES] = { "Density", "Temperature", "Velocity" };
+	const int firstChannels[FLUID_SEQUENCE_VOLUMES + 1] = { 0, 4, 5, FLUID_SEQUENCE_CHANNELS };
+	double errorSums[FLUID_SEQUENCE_VOLUMES] = {};
+	double valueSums[FLUID_SEQUENCE_VOLUMES] = {};
+	float maxErrors[FLUID_SEQUENCE_VOLUMES] = {};
+	{
+		FluidPlayer player;
+		if (!player.Open(path, false))
+			return results;
+
+		FluidFieldCPU field(gridSize, gridSize, gridSize);
+		FluidSequenceFrame frame;
+		std::vector<float> state;
+		std::vector<float> planes;
+		int played = 0;
+		bool inOrder = true;
+		while (player.NextFrame(frame, true))
+		{
+			field.OneTimeStep();
+			field.GetState(state);
+			gather(state, planes);
+
+			for (int v = 0; v < FLUID_SEQUENCE_VOLUMES; v++)
+				for (size_t i = firstChannels[v] * cellCount; i < firstChannels[v + 1] * cellCount; i++)
+				{
+					float error = fabsf(frame.Planes[i] - planes[i]);
+					maxErrors[v] = std::max(maxErrors[v], error);
+					errorSums[v] += (double)error * error;
+					valueSums[v] += (double)planes[i] * planes[i];
+				}
+
+			inOrder &= frame.Index == (unsigned int)played;
+			played++;
+		}
+		results.PlayedAll = inOrder && played == frames;
+	}
+
+	results.Passed = results.PlayedAll;
+	for (int v = 0; v < FLUID_SEQUENCE_VOLUMES; v++)
+	{
+		double count = (double)(firstChannels[v + 1] - firstChannels[v]) * cellCount * frames;
+		FluidVolumeError& error = results.Volumes[v];
+		error.Name = names[v];
+		error.MaxError = maxErrors[v];
+		error.RMSError = (float)sqrt(errorSums[v] / count);
+		error.RMSValue = (float)sqrt(valueSums[v] / count);
+		error.Passed = error.RMSError <= tolerance * error.RMSValue;
+		results.Passed &= error.Passed;
+	}
+
+	// Playback on its own -----
+	{
+		FluidPlayer player;
+		if (player.Open(path, false))
+		{
+			FluidSequenceFrame frame;
+			int played = 0;
+			auto start = std::chrono::high_resolution_clock::now();
+			while (player.NextFrame(frame, true))
+				played++;
+			auto end = std::chrono::high_resolution_clock::now();
+
+			double seconds = std::chrono::duration<double>(end - start).count();
+			results.PlaybackFramesPerSecond = played / seconds;
+			results.PlaybackMegabytesPerSecond = played * cellCount * FLUID_SEQUENCE_CHANNELS * sizeof(float) / megabyte / seconds;
+		}
+	}
+
+	std::remove(path);
+	return results;
+}
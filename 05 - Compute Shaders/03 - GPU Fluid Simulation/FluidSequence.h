@@ -0,0 +1,149 @@
+#pragma once
+
+#include <vector>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "FluidFieldCPU.h"
+
+// Planes in a recorded frame: density RGBA, temperature,
+// then velocity XYZ - the order FluidField reads them back in
+#define FLUID_SEQUENCE_CHANNELS 8
+
+// Volumes compared by FluidPlayer::TestRoundTrip()
+#define FLUID_SEQUENCE_VOLUMES 3
+
+// --------------------------------------------------------
+// One frame of a sequence, as FLUID_SEQUENCE_CHANNELS planes
+// of SizeX * SizeY * SizeZ floats, indexed like FluidFieldCPU
+// --------------------------------------------------------
+struct FluidSequenceFrame
+{
+	unsigned int Index{ 0 };
+	std::vector<float> Planes;
+};
+
+// --------------------------------------------------------
+// How well a recorded plume survives the round trip, and how
+// fast it records and plays back
+// --------------------------------------------------------
+struct FluidSequenceTestResults
+{
+	int GridSize;
+	int Frames;
+	bool PlayedAll;			// Every frame came back, in order
+	FluidVolumeError Volumes[FLUID_SEQUENCE_VOLUMES];	// Compared to the simulated frames
+	float SkippedBrickFraction;
+	double RawMegabytes;		// The same frames as floats
+	double FileMegabytes;
+	double RecordFramesPerSecond;
+	double PlaybackFramesPerSecond;
+	double PlaybackMegabytesPerSecond;	// Of decoded floats
+	bool Passed;
+};
+
+// --------------------------------------------------------
+// Writes fluid frames to a compressed sequence file for
+// FluidPlayer to play back instead of simulating.
+//
+// Each frame is split into 8x8x8 bricks (like FluidBricks).
+// Bricks where every value is within zeroThreshold of zero
+// are skipped, so empty space costs a bit per brick.  The
+// rest are quantized to 8 bits per value against each
+// channel's range within the brick, delta coded along rows
+// and the whole frame is LZ compressed.
+//
+// Frames are independent (no deltas between frames), and an
+// index at the end of the file lets the player seek.
+// --------------------------------------------------------
+class FluidRecorder
+{
+public:
+	FluidRecorder();
+	~FluidRecorder();
+
+	FluidRecorder(const FluidRecorder&) = delete;
+	void operator=(const FluidRecorder&) = delete;
+
+	bool Open(const char* path, unsigned int sizeX, unsigned int sizeY, unsigned int sizeZ, float zeroThreshold = 0.001f);
+	bool WriteFrame(const float* planes);
+	bool Close();
+
+	bool IsOpen();
+	unsigned int GetFrameCount();
+	unsigned long long GetBytesWritten();
+	float GetSkippedBrickFraction();
+
+private:
+	std::ofstream file;
+	unsigned int sizeX;
+	unsigned int sizeY;
+	unsigned int sizeZ;
+	float zeroThreshold;
+	std::vector<unsigned long long> frameOffsets;
+	unsigned long long bytesWritten;
+	unsigned long long bricksSkipped;
+	unsigned long long bricksTotal;
+
+	// Reused between frames
+	std::vector<unsigned char> payload;
+	std::vector<unsigned char> compressed;
+	std::vector<int> hashTable;
+};
+
+// --------------------------------------------------------
+// Plays back a FluidRecorder sequence, decompressing frames
+// on a background thread into a small ring of decoded frames
+// so the caller only has to copy each one to the GPU.
+//
+// NextFrame() swaps the oldest decoded frame out of the ring
+// (the frame passed in takes its slot, so no memory is
+// allocated once the ring has filled).
+// --------------------------------------------------------
+class FluidPlayer
+{
+public:
+	FluidPlayer(unsigned int ringSize = 4);
+	~FluidPlayer();
+
+	FluidPlayer(const FluidPlayer&) = delete;
+	void operator=(const FluidPlayer&) = delete;
+
+	bool Open(const char* path, bool loop);
+	void Close();
+	bool NextFrame(FluidSequenceFrame& frame, bool wait = false);
+
+	bool IsOpen();
+	bool IsFinished();
+	unsigned int GetSizeX();
+	unsigned int GetSizeY();
+	unsigned int GetSizeZ();
+	unsigned int GetFrameCount();
+
+	static FluidSequenceTestResults TestRoundTrip(const char* path, int gridSize, int frames, float tolerance = 0.02f);
+
+private:
+	std::ifstream file;
+	bool open;
+	bool loop;
+	unsigned int sizeX;
+	unsigned int sizeY;
+	unsigned int sizeZ;
+	std::vector<unsigned long long> frameOffsets;
+
+	// Ring of decoded frames, filled by the decoder thread
+	std::vector<FluidSequenceFrame> ring;
+	unsigned int readSlot;
+	unsigned int filledSlots;
+	bool finished;			// Decoded the last frame (or hit a bad one) without looping
+	bool quit;
+	std::mutex mutex;
+	std::condition_variable slotFree;
+	std::condition_variable frameReady;
+	std::thread decoder;
+
+	void DecodeLoop();
+	bool ReadFrame(unsigned int index, FluidSequenceFrame& frame, std::vector<unsigned char>& compressed, std::vector<unsigned char>& payload);
+};
@@ -0,0 +1,140 @@
+#include "FluidTests.h"
+#include "PressureSolver.h"
+#include "FluidFieldCPU.h"
+#include "FluidSequence.h"
+#include "ObstacleVoxelizer.h"
+
+#include <cstdio>
+
+// --------------------------------------------------------
+// Runs every CPU check, printing as it goes (see the header
+// for what the return value means)
+// --------------------------------------------------------
+int RunFluidCPUTests(const char* goldenPath)
+{
+	bool multigridBetter = true;
+	int gridSizes[] = { 32, 64, 128 };
+	printf("\nPressure solver residual RMS (Jacobi vs multigrid at equal work):\n");
+	for (int gridSize : gridSizes)
+	{
+		PressureConvergenceResults results = PressureSolver::TestConvergence(gridSize, 30, 2);
+		printf("  %3d^3: divergence %.3e, Jacobi (%d iterations) %.3e, multigrid (%d cycles, %.1f sweeps) %.3e (%.1fx lower)\n",
+			results.GridSize,
+			results.DivergenceNorm,
+			results.JacobiIterations,
+			results.JacobiResidualNorm,
+			results.MultigridCycles,
+			results.MultigridPasses,
+			results.MultigridResidualNorm,
+			results.JacobiResidualNorm / results.MultigridResidualNorm);
+		multigridBetter &= results.MultigridResidualNorm < results.JacobiResidualNorm;
+	}
+
+	bool cpuPathsMatch = true;
+	printf("\nCPU fluid step, million cells per second (scalar, SSE, SSE on every core):\n");
+	for (int gridSize : gridSizes)
+	{
+		FluidBenchmarkResults results = FluidFieldCPU::Benchmark(gridSize, 4);
+		printf("  %3d^3: %.1f, %.1f, %.1f (%u threads)%s\n",
+			results.GridSize,
+			results.ScalarCellsPerSecond / 1000000.0,
+			results.SIMDCellsPerSecond / 1000000.0,
+			results.ThreadedCellsPerSecond / 1000000.0,
+			results.ThreadCount,
+			results.Matches ? "" : " - RESULTS DIFFER");
+		cpuPathsMatch &= results.Matches;
+	}
+
+	printf("\nCPU fluid step over active bricks vs every cell (million grid cells per second, memory):\n");
+	int sparseGridSizes[] = { 64, 128 };
+	for (int gridSize : sparseGridSizes)
+	{
+		FluidSparseBenchmarkResults results = FluidFieldCPU::BenchmarkSparse(gridSize, 20);
+		printf("  %3d^3: dense %.2f, sparse %.2f (%.1fx) with %.1f%% of bricks active (peak %.1f%%), %.1f MB dense vs %.1f MB of bricks, density error %.3f%%\n",
+			results.GridSize,
+			results.DenseCellsPerSecond / 1000000.0,
+			results.SparseCellsPerSecond / 1000000.0,
+			results.SparseCellsPerSecond / results.DenseCellsPerSecond,
+			100.0f * results.ActiveBrickFraction,
+			100.0f * results.PeakActiveBrickFraction,
+			results.DenseMegabytes,
+			results.SparseMegabytes,
+			100.0f * results.DensityError);
+	}
+
+	// Reduced precision storage against float, on the CPU
+	FluidFormatResults formatResults = FluidFieldCPU::TestFormats(64, 30, 4, FluidFieldCPU::ReducedFormats());
+	printf("\nReduced precision storage vs float (%d^3, %d steps from the same state, %zu vs %zu bytes per cell):\n",
+		formatResults.GridSize,
+		formatResults.Steps,
+		formatResults.BytesPerCell,
+		formatResults.FloatBytesPerCell);
+	for (FluidVolumeError& error : formatResults.Volumes)
+	{
+		printf("  %-11s max %.3e, RMS %.3e (%.3f%% of RMS value) %s\n",
+			error.Name,
+			error.MaxError,
+			error.RMSError,
+			error.RMSValue > 0 ? 100.0f * error.RMSError / error.RMSValue : 0.0f,
+			error.Passed ? "" : "FAILED");
+	}
+
+	// Recording a plume and streaming it back
+	FluidSequenceTestResults sequence = FluidPlayer::TestRoundTrip("FluidSequenceTest.bin", 64, 60);
+	printf("\nRecorded sequence (%d^3, %d frames): %.1f MB as floats, %.1f MB on disk (%.1f%% of bricks skipped) %s\n",
+		sequence.GridSize,
+		sequence.Frames,
+		sequence.RawMegabytes,
+		sequence.FileMegabytes,
+		100.0f * sequence.SkippedBrickFraction,
+		sequence.PlayedAll ? "" : "- FRAMES MISSING");
+	printf("  Record %.1f frames/s, play back %.1f frames/s (%.1f MB/s decoded)\n",
+		sequence.RecordFramesPerSecond,
+		sequence.PlaybackFramesPerSecond,
+		sequence.PlaybackMegabytesPerSecond);
+	for (FluidVolumeError& error : sequence.Volumes)
+	{
+		printf("  %-11s max %.3e, RMS %.3e (%.3f%% of RMS value) %s\n",
+			error.Name,
+			error.MaxError,
+			error.RMSError,
+			error.RMSValue > 0 ? 100.0f * error.RMSError / error.RMSValue : 0.0f,
+			error.Passed ? "" : "FAILED");
+	}
+
+	// Voxelizing analytic shapes, and moving one a dirty region at a time
+	VoxelizerTestResults voxelizer = ObstacleVoxelizer::Test(64);
+	printf("\nObstacle voxelization (%d^3, %d triangle sphere):\n", voxelizer.GridSize, voxelizer.SphereTriangles);
+	printf("  Sphere: %d cells wrong, %.3f times its volume filled\n", voxelizer.SphereMismatches, voxelizer.SphereVolumeRatio);
+	printf("  Box: %d cells wrong\n", voxelizer.CubeMismatches);
+	printf("  Moving: %d cells differ from voxelizing from scratch\n", voxelizer.MovingMismatches);
+	printf("  %.3f ms to voxelize everything (%.2f M triangles/s), %.3f ms per dirty region update %s\n",
+		voxelizer.FullMilliseconds,
+		voxelizer.TrianglesPerSecond / 1000000.0,
+		voxelizer.UpdateMilliseconds,
+		voxelizer.Passed ? "" : "FAILED");
+
+	// Saved from the "Save Golden Step" button while paused
+	FluidGoldenResults golden = FluidFieldCPU::TestGoldenStep(goldenPath);
+	if (golden.Loaded)
+	{
+		printf("\nCPU step vs GPU golden step (%ux%ux%u):\n", golden.SizeX, golden.SizeY, golden.SizeZ);
+		for (FluidVolumeError& error : golden.Volumes)
+		{
+			printf("  %-11s max %.3e, RMS %.3e (%.3f%% of RMS value) %s\n",
+				error.Name,
+				error.MaxError,
+				error.RMSError,
+				error.RMSValue > 0 ? 100.0f * error.RMSError / error.RMSValue : 0.0f,
+				error.Passed ? "" : "FAILED");
+		}
+	}
+	else
+	{
+		printf("\nNo %s to compare the CPU step against - save one with \"Save Golden Step\" while paused\n", goldenPath);
+	}
+
+	if (!multigridBetter || !cpuPathsMatch || !formatResults.Passed || !sequence.Passed || !voxelizer.Passed || (golden.Loaded && !golden.Passed))
+		return 1;
+	return golden.Loaded ? 0 : 2;
+}
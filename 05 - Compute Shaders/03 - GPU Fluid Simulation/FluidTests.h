@@ -0,0 +1,16 @@
+#pragma once
+
+// --------------------------------------------------------
+// The CPU side of "-benchmark": pressure solver convergence,
+// the CPU fluid step (scalar, SIMD, threaded and sparse),
+// reduced precision storage against float, recording and
+// playing back a sequence, voxelizing obstacles, and the CPU
+// step against a saved GPU step.  Nothing here needs Windows
+// or D3D, so it runs from WinMain and from the portable
+// FluidTestsMain.cpp.
+//
+// Prints its results and returns 0 if everything passed, 1
+// if anything failed, or 2 if everything passed but there
+// was no saved GPU step at goldenPath to check against.
+// --------------------------------------------------------
+int RunFluidCPUTests(const char* goldenPath);
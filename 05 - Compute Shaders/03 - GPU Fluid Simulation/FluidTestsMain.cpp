@@ -0,0 +1,17 @@
+#include <cstdio>
+#include "FluidTests.h"
+
+// --------------------------------------------------------
+// Console entry point for the CPU checks alone, for building
+// without Windows or D3D (see CMakeLists.txt).  The GPU
+// kernel timings stay in WinMain's "-benchmark".
+//
+// Usage: FluidTests [golden step path]
+// A missing golden step only fails (with 2) if one was asked for
+// --------------------------------------------------------
+int main(int argc, char* argv[])
+{
+	const char* goldenPath = argc > 1 ? argv[1] : "FluidGolden.bin";
+	int result = RunFluidCPUTests(goldenPath);
+	return (result == 2 && argc <= 1) ? 0 : result;
+}
@@ -40,7 +40,10 @@ Game::Game(HINSTANCE hInstance)
 		720,			   // Height of the window's client area
 		true),			   // Show extra stats (fps) in title bar?
 	renderer(0),
-	sky(0)
+	sky(0),
+	logFluidSteps(false),
+	loopFluidPlayback(true),
+	fluidObstacleEntity(-1)
 {
 	camera = 0;
 
@@ -398,8 +401,47 @@ void Game::Update(float deltaTime, float totalTime)
 	// Get the input instance once
 	Input& input = Input::GetInstance();
 
-	// Update the fluid field (which runs the compute shaders)
-	fluid->UpdateFluid(deltaTime);
+	// Voxelize the obstacle entity (wherever it's moved to
+	// since last frame) into the fluid, and nothing else
+	for (int i = 0; i < entities.size(); i++)
+	{
+		if (i == fluidObstacleEntity)
+			fluid->VoxelizeObstacle(entities[i]);
+		else
+			fluid->RemoveObstacle(entities[i]);
+	}
+	fluid->UpdateObstacles();
+
+	// Show the next recorded frame instead of simulating while
+	// playing back (keeping the last one if it isn't decoded yet)
+	if (fluidPlayer.IsOpen())
+	{
+		if (fluidPlayer.NextFrame(fluidFrame))
+			fluid->PlayFrame(fluidFrame);
+		if (fluidPlayer.IsFinished())
+			fluidPlayer.Close();
+	}
+	else
+	{
+		// Update the fluid field (which runs the compute shaders)
+		fluid->UpdateFluid(deltaTime);
+		if (fluidRecorder.IsOpen() && fluid->GetFrameStats().Steps > 0)
+			fluid->RecordFrame(fluidRecorder);
+	}
+
+	if (logFluidSteps && fluid->adaptiveTimeStep && !fluidPlayer.IsOpen())
+	{
+		FluidFrameStats stats = fluid->GetFrameStats();
+		printf("Fluid: %d steps of %.2f ms (%.2f ms of %.2f ms simulated, %.2f ms dropped), max speed %.2f cells/s%s%s\n",
+			stats.Steps,
+			stats.TimeStep * 1000.0f,
+			stats.SimulatedTime * 1000.0f,
+			deltaTime * 1000.0f,
+			stats.DroppedTime * 1000.0f,
+			stats.MaxSpeed,
+			stats.SpeedFromCPU ? " (CPU)" : "",
+			stats.AtRest ? " - at rest" : "");
+	}
 
 	// Update the camera
 	camera->Update(deltaTime);
@@ -614,9 +656,98 @@ void Game::CreateUI(float dt)
 			{
 				ImGui::SameLine();
 				if (ImGui::Button("One Time Step")) fluid->OneTimeStep();
+				ImGui::SameLine();
+				if (ImGui::Button("Save Golden Step")) fluid->SaveGoldenStep("FluidGolden.bin");
 			}
 			ImGui::SliderFloat("Time Step", &fluid->fixedTimeStep, 0.0f, 1.0f);
-			ImGui::SliderInt("Pressure Solver Iterations", &fluid->pressureIterations, 1, 200);
+			ImGui::Spacing();
+
+			// Adaptive time stepping (CFL limited substeps, nothing at rest)
+			ImGui::Checkbox("Adaptive Time Step", &fluid->adaptiveTimeStep);
+			if (fluid->adaptiveTimeStep)
+			{
+				ImGui::Checkbox("GPU Max Speed Reduction", &fluid->gpuSpeedReduction);
+				ImGui::SliderFloat("CFL Number (Cells)", &fluid->cflNumber, 0.1f, 5.0f);
+				ImGui::SliderFloat("Max Time Step", &fluid->maxTimeStep, 0.001f, 0.1f, "%.3f");
+				ImGui::SliderInt("Max Substeps", &fluid->maxSubsteps, 1, 16);
+				ImGui::SliderFloat("Rest Speed", &fluid->restSpeed, 0.0f, 1.0f);
+				ImGui::Checkbox("Log Steps to Console", &logFluidSteps);
+
+				FluidFrameStats stats = fluid->GetFrameStats();
+				if (stats.AtRest)
+					ImGui::Text("At rest");
+				else
+					ImGui::Text("Steps: %d x %.2f ms (%.2f ms dropped)", stats.Steps, stats.TimeStep * 1000.0f, stats.DroppedTime * 1000.0f);
+				ImGui::Text("Max Speed: %.2f cells/s%s", stats.MaxSpeed, stats.SpeedFromCPU ? " (CPU)" : "");
+			}
+			ImGui::Spacing();
+
+			// Pressure
+			ImGui::Text("Pressure Solver");
+			const char* solverTypes[] = { "Jacobi", "Multigrid" };
+			int selectedSolver = (int)fluid->pressureSolver;
+			if (ImGui::Combo("Solver", &selectedSolver, solverTypes, IM_ARRAYSIZE(solverTypes)))
+			{
+				fluid->pressureSolver = (FLUID_PRESSURE_SOLVER)selectedSolver;
+			}
+
+			if (fluid->pressureSolver == FLUID_PRESSURE_SOLVER::FLUID_PRESSURE_SOLVER_JACOBI)
+			{
+				ImGui::SliderInt("Pressure Solver Iterations", &fluid->pressureIterations, 1, 200);
+			}
+			else
+			{
+				ImGui::SliderInt("V-Cycles", &fluid->multigridCycles, 1, 20);
+				ImGui::SliderInt("Smoothing Iterations", &fluid->multigridSmoothIterations, 1, 8);
+				ImGui::Text("Grid Levels: %u", fluid->GetMultigridLevelCount());
+			}
+			ImGui::Text("Work: %.1f full grid sweeps per step", fluid->GetPressureSolverPasses());
+
+			// Residual (how much divergence is left after solving)
+			ImGui::Checkbox("Measure Residual (Stalls GPU)", &fluid->measurePressureResidual);
+			if (fluid->measurePressureResidual)
+			{
+				float divergence = fluid->GetDivergenceNorm();
+				float residual = fluid->GetPressureResidualNorm();
+				ImGui::Text("Divergence RMS: %.3e", divergence);
+				ImGui::Text("Residual RMS:   %.3e (%.3f%%)", residual, divergence > 0 ? 100.0f * residual / divergence : 0.0f);
+			}
+			ImGui::Spacing();
+
+			// Sparse bricks (only simulate 8x8x8 bricks with something in them)
+			ImGui::Text("Sparse Bricks");
+			ImGui::Checkbox("Only Simulate Active Bricks", &fluid->sparseBricks);
+			if (fluid->sparseBricks)
+			{
+				ImGui::SliderFloat("Density Threshold", &fluid->brickDensityThreshold, 0.0f, 0.05f, "%.4f");
+				ImGui::SliderFloat("Velocity Threshold", &fluid->brickVelocityThreshold, 0.0f, 10.0f);
+				ImGui::SliderInt("Dilation (Bricks)", &fluid->brickDilation, 0, 3);
+
+				// Memory a pool of just the active bricks would need, versus the dense volumes
+				unsigned int bricks = fluid->GetBrickCount();
+				unsigned int activeBricks = fluid->GetActiveBrickCount();
+				float brickMB = fluid->GetBytesPerCell() * FLUID_BRICK_SIZE * FLUID_BRICK_SIZE * FLUID_BRICK_SIZE / (1024.0f * 1024.0f);
+				ImGui::Text("Active: %u / %u bricks (%.1f%% of the work)", activeBricks, bricks, 100.0f * activeBricks / bricks);
+				ImGui::Text("Memory: %.1f MB dense, %.1f MB as a brick pool", brickMB * bricks, brickMB * activeBricks);
+			}
+			ImGui::Spacing();
+
+			// Storage formats (applying recreates the volumes, so the fluid starts over)
+			ImGui::Text("Storage Formats");
+			const char* formatNames[] = { "Float (32-bit)", "Half (16-bit)", "UNORM (8-bit)", "SNORM (16-bit)" };
+			static FluidFormatPolicy formats = fluid->GetFormats();
+			ImGui::Combo("Velocity Format", &formats.Velocity, formatNames, 2); // Float or half only
+			ImGui::Combo("Pressure Format", &formats.Pressure, formatNames, 2);
+			ImGui::Combo("Density Format", &formats.Density, formatNames, IM_ARRAYSIZE(formatNames));
+			ImGui::SliderFloat("Density Scale", &formats.DensityScale, 0.1f, 16.0f);
+			ImGui::Combo("Temperature Format", &formats.Temperature, formatNames, IM_ARRAYSIZE(formatNames));
+			ImGui::SliderFloat("Temperature Scale", &formats.TemperatureScale, 0.1f, 64.0f);
+			if (ImGui::Button("Apply (Resets Fluid)")) fluid->SetFormats(formats);
+			ImGui::SameLine();
+			if (ImGui::Button("Float")) formats = FluidFieldCPU::FloatFormats();
+			ImGui::SameLine();
+			if (ImGui::Button("Reduced")) formats = FluidFieldCPU::ReducedFormats();
+			ImGui::Text("Memory: %u bytes per cell", fluid->GetBytesPerCell());
 			ImGui::Spacing();
 
 			// Vorticity
@@ -634,6 +765,58 @@ void Game::CreateUI(float dt)
 			ImGui::TreePop();
 		}
 
+		ImGui::Spacing();
+		if (ImGui::TreeNode("Obstacles"))
+		{
+			// Move the entity into the volume (-1 to 1 on each axis)
+			// with the entity controls below
+			ImGui::SliderInt("Obstacle Entity", &fluidObstacleEntity, -1, (int)entities.size() - 1, fluidObstacleEntity < 0 ? "None" : "%d");
+			ImGui::TreePop();
+		}
+
+		ImGui::Spacing();
+		if (ImGui::TreeNode("Recording & Playback"))
+		{
+			const char* sequencePath = "FluidSequence.bin";
+
+			// Recording (stalls for readbacks every step)
+			if (fluidRecorder.IsOpen())
+			{
+				if (ImGui::Button("Stop Recording")) fluidRecorder.Close();
+				ImGui::Text("Recorded: %u frames, %.1f MB (%.1f%% of bricks skipped)",
+					fluidRecorder.GetFrameCount(),
+					fluidRecorder.GetBytesWritten() / (1024.0f * 1024.0f),
+					100.0f * fluidRecorder.GetSkippedBrickFraction());
+			}
+			else if (!fluidPlayer.IsOpen() && ImGui::Button("Start Recording"))
+			{
+				fluidRecorder.Open(sequencePath, fluid->GetGridSizeX(), fluid->GetGridSizeY(), fluid->GetGridSizeZ());
+			}
+			ImGui::Spacing();
+
+			// Playback (replaces the simulation until it ends or is stopped)
+			if (fluidPlayer.IsOpen())
+			{
+				if (ImGui::Button("Stop Playback")) fluidPlayer.Close();
+				ImGui::Text("Playing frame %u of %u", fluidFrame.Index + 1, fluidPlayer.GetFrameCount());
+			}
+			else if (!fluidRecorder.IsOpen())
+			{
+				ImGui::Checkbox("Loop", &loopFluidPlayback);
+				ImGui::SameLine();
+				if (ImGui::Button("Play Recording") && fluidPlayer.Open(sequencePath, loopFluidPlayback))
+				{
+					// Match the recording's grid
+					if (fluidPlayer.GetSizeX() != fluid->GetGridSizeX() ||
+						fluidPlayer.GetSizeY() != fluid->GetGridSizeY() ||
+						fluidPlayer.GetSizeZ() != fluid->GetGridSizeZ())
+						fluid->SetGridSize(fluidPlayer.GetSizeX(), fluidPlayer.GetSizeY(), fluidPlayer.GetSizeZ());
+				}
+			}
+
+			ImGui::TreePop();
+		}
+
 		ImGui::Spacing();
 		if (ImGui::TreeNode("Rendering"))
 		{
@@ -38,6 +38,14 @@ private:
 	Camera* camera;
 
 	std::shared_ptr<FluidField> fluid;
+	bool logFluidSteps;
+
+	// Recording and playback of the fluid
+	FluidRecorder fluidRecorder;
+	FluidPlayer fluidPlayer;
+	FluidSequenceFrame fluidFrame;
+	bool loopFluidPlayback;
+	int fluidObstacleEntity;	// Index into entities, or -1 for none
 
 	// Smart renderer
 	Renderer* renderer;
@@ -15,6 +15,11 @@ cbuffer externalData : register(b0)
 
 	float3 injectVelocity;
 	float injectTemperature;
+
+	float densityScale;		// Density and temperature are stored divided by these
+	float temperatureScale;
+	int densityType;		// VOLUME_UAV values for the outputs
+	int temperatureType;
 }
 
 Texture3D			DensityIn		: register(t0);
@@ -25,12 +30,20 @@ RWTexture3D<float4> DensityOut		: register(u0);
 RWTexture3D<float>	TemperatureOut	: register(u1);
 RWTexture3D<float4> VelocityOut		: register(u2);
 
+RWTexture3D<unorm float4>	DensityOutUnorm			: register(u3);
+RWTexture3D<snorm float4>	DensityOutSnorm			: register(u4);
+RWTexture3D<unorm float>	TemperatureOutUnorm		: register(u5);
+RWTexture3D<snorm float>	TemperatureOutSnorm		: register(u6);
+
 [numthreads(
 	FLUID_COMPUTE_THREADS_PER_AXIS,
 	FLUID_COMPUTE_THREADS_PER_AXIS,
 	FLUID_COMPUTE_THREADS_PER_AXIS)]
-void main(uint3 id : SV_DispatchThreadID)
+void main(uint3 groupID : SV_GroupID, uint3 groupThreadID : SV_GroupThreadID)
 {
+	// This thread's cell, in whichever brick this group covers
+	uint3 id = GetCellIndex(groupID, groupThreadID);
+
 	// If this cell is an obstacle, don't inject
 	if (ObstaclesIn[id].r > 0.0f)
 		return;
@@ -44,14 +57,23 @@ void main(uint3 id : SV_DispatchThreadID)
 	float injFalloff = injectRadius == 0.0f ? 0.0f : max(0, injectRadius - dist) / injectRadius;
 
 	// Grab the old values
-	float4 oldColorAndDensity = DensityIn[id];
+	float4 oldColorAndDensity = DensityIn[id] * float4(1, 1, 1, densityScale);
 
 	// Calculate new values - color is a replacement, density is an add
 	float3 newColor = injFalloff > 0 ? injectColor : oldColorAndDensity.rgb;
 	float newDensity = saturate(oldColorAndDensity.a + injectDensity * injFalloff);
 
-	// Spit out the updates
-	DensityOut[id] = float4(newColor, newDensity);
-	TemperatureOut[id] = TemperatureIn[id].r + injectTemperature * injFalloff;
+	// Spit out the updates, through whichever UAVs match the formats
+	float4 density = float4(newColor, newDensity / densityScale);
+	float temperature = TemperatureIn[id].r + injectTemperature * injFalloff / temperatureScale;
+
+	if (densityType == VOLUME_UAV_UNORM) DensityOutUnorm[id] = density;
+	else if (densityType == VOLUME_UAV_SNORM) DensityOutSnorm[id] = density;
+	else DensityOut[id] = density;
+
+	if (temperatureType == VOLUME_UAV_UNORM) TemperatureOutUnorm[id] = temperature;
+	else if (temperatureType == VOLUME_UAV_SNORM) TemperatureOutSnorm[id] = temperature;
+	else TemperatureOut[id] = temperature;
+
 	VelocityOut[id] = VelocityIn[id] + float4(injFalloff > 0 ? injectVelocity : 0, 0);
 }
\ No newline at end of file
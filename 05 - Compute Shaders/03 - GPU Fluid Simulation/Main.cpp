@@ -3,7 +3,13 @@
 #define SIMPLE_SHADER_REPORT_WARNINGS
 
 #include <Windows.h>
+#include <stdio.h>
+#include <string.h>
 #include "Game.h"
+#include "Assets.h"
+#include "FluidField.h"
+#include "FluidFieldCPU.h"
+#include "FluidTests.h"
 
 // --------------------------------------------------------
 // Entry point for a graphical (non-console) Windows application
@@ -21,6 +27,131 @@ int WINAPI WinMain(
 	_CrtSetDbgFlag( _CRTDBG_ALLOC_MEM_DF | _CRTDBG_LEAK_CHECK_DF );
 #endif
 
+	// "-benchmark" runs the CPU checks (RunFluidCPUTests(): pressure
+	// solver convergence, the CPU fluid step densely and over active
+	// bricks, reduced precision storage against float, sequences,
+	// obstacle voxelization and the CPU step against a saved GPU
+	// step), then times how much faster the GPU's bandwidth bound
+	// kernels get with reduced precision and runs them once more
+	// under the debug layer, without opening a window.
+	// Returns 1 if anything failed, or 2 if everything else passed
+	// but there was no saved GPU step to check against.
+	if (strstr(lpCmdLine, "-benchmark"))
+	{
+		// Print to the console we were launched from, or a new one
+		if (!AttachConsole(ATTACH_PARENT_PROCESS))
+			AllocConsole();
+		FILE* stream;
+		freopen_s(&stream, "CONOUT$", "w", stdout);
+
+		// Everything that runs on the CPU (also built without
+		// Windows from FluidTestsMain.cpp)
+		int cpuResult = RunFluidCPUTests("FluidGolden.bin");
+
+		// And on the GPU, where the formats actually save bandwidth
+		FluidFormatPolicy formatPolicies[] = { FluidFieldCPU::FloatFormats(), FluidFieldCPU::ReducedFormats() };
+		const char* formatPolicyNames[] = { "float", "reduced" };
+		Microsoft::WRL::ComPtr<ID3D11Device> device;
+		Microsoft::WRL::ComPtr<ID3D11DeviceContext> context;
+		if (SUCCEEDED(D3D11CreateDevice(0, D3D_DRIVER_TYPE_HARDWARE, 0, 0, 0, 0, D3D11_SDK_VERSION, device.GetAddressOf(), 0, context.GetAddressOf())))
+		{
+			Assets& assets = Assets::GetInstance();
+			assets.Initialize("..\\..\\..\\..\\Assets\\", device, context);
+			assets.LoadAllAssets();
+
+			printf("\nGPU kernel time per dispatch (ms) and bandwidth (GB/s): velocity advection, density advection, Jacobi iteration:\n");
+			int gpuGridSizes[] = { 64, 128, 256 };
+			for (int gridSize : gpuGridSizes)
+			{
+				for (int p = 0; p < 2; p++)
+				{
+					FluidField field(device, context, gridSize, gridSize, gridSize);
+					field.SetFormats(formatPolicies[p]);
+					FluidKernelTimings timings = field.TimeKernels(20);
+					printf("  %3d^3 %-7s (%2u bytes per cell): %.3f (%.1f), %.3f (%.1f), %.3f (%.1f)\n",
+						timings.GridSize,
+						formatPolicyNames[p],
+						timings.BytesPerCell,
+						timings.VelocityAdvectionMS,
+						timings.VelocityAdvectionGBPerSecond,
+						timings.DensityAdvectionMS,
+						timings.DensityAdvectionGBPerSecond,
+						timings.PressureIterationMS,
+						timings.PressureIterationGBPerSecond);
+				}
+			}
+
+			delete& Assets::GetInstance();
+		}
+		else
+		{
+			printf("\nNo D3D11 device to time the GPU kernels on\n");
+		}
+
+		// The reduced formats once more under the debug layer, which
+		// reports any UAV whose type doesn't match its volume's format
+		bool debugLayerClean = true;
+		Microsoft::WRL::ComPtr<ID3D11Device> debugDevice;
+		Microsoft::WRL::ComPtr<ID3D11DeviceContext> debugContext;
+		Microsoft::WRL::ComPtr<ID3D11InfoQueue> infoQueue;
+		if (SUCCEEDED(D3D11CreateDevice(0, D3D_DRIVER_TYPE_HARDWARE, 0, D3D11_CREATE_DEVICE_DEBUG, 0, 0, D3D11_SDK_VERSION, debugDevice.GetAddressOf(), 0, debugContext.GetAddressOf())) &&
+			SUCCEEDED(debugDevice.As(&infoQueue)))
+		{
+			Assets& assets = Assets::GetInstance();
+			assets.Initialize("..\\..\\..\\..\\Assets\\", debugDevice, debugContext);
+			assets.LoadAllAssets();
+			infoQueue->ClearStoredMessages();
+
+			printf("\nReduced formats under the D3D11 debug layer (64^3, 8 steps, dense and sparse):\n");
+			{
+				FluidField field(debugDevice, debugContext, 64, 64, 64);
+				field.SetFormats(formatPolicies[1]);
+				for (int i = 0; i < 4; i++)
+					field.OneTimeStep();
+				field.sparseBricks = !field.sparseBricks;
+				for (int i = 0; i < 4; i++)
+					field.OneTimeStep();
+				field.TimeKernels(1);
+			}
+
+			unsigned int errors = 0;
+			UINT64 messageCount = infoQueue->GetNumStoredMessages();
+			for (UINT64 m = 0; m < messageCount; m++)
+			{
+				SIZE_T size = 0;
+				infoQueue->GetMessage(m, 0, &size);
+				std::vector<char> bytes(size);
+				D3D11_MESSAGE* message = (D3D11_MESSAGE*)bytes.data();
+				if (FAILED(infoQueue->GetMessage(m, message, &size)))
+					continue;
+
+				if (message->Severity != D3D11_MESSAGE_SEVERITY_ERROR &&
+					message->Severity != D3D11_MESSAGE_SEVERITY_CORRUPTION)
+					continue;
+
+				// Just the first few, they tend to repeat every dispatch
+				if (errors < 8)
+					printf("  %.*s\n", (int)message->DescriptionByteLength, message->pDescription);
+				errors++;
+			}
+
+			debugLayerClean = errors == 0;
+			printf("  %u errors %s\n",
+				errors,
+				debugLayerClean ? "" : "FAILED");
+
+			delete& Assets::GetInstance();
+		}
+		else
+		{
+			printf("\nNo D3D11 debug layer to check the reduced formats with (install the Graphics Tools)\n");
+		}
+
+		if (!debugLayerClean)
+			return 1;
+		return cpuResult;
+	}
+
 	// Create the Game object using
 	// the app handle we got from WinMain
 	Game dxGame(hInstance);
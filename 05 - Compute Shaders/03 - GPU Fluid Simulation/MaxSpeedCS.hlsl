@@ -0,0 +1,32 @@
+
+#include "ComputeHelpers.hlsli"
+
+Texture3D			VelocityIn		: register(t0);
+Texture3D			ObstaclesIn		: register(t1);
+RWBuffer<uint>		MaxSpeedOut		: register(u0);	// Cleared to zero before the dispatch
+
+groupshared uint groupMaxSpeed;
+
+// Speeds are never negative, so their bits sort the same
+// way as the floats themselves and can be compared as uints
+[numthreads(
+	FLUID_COMPUTE_THREADS_PER_AXIS,
+	FLUID_COMPUTE_THREADS_PER_AXIS,
+	FLUID_COMPUTE_THREADS_PER_AXIS)]
+void main(uint3 groupID : SV_GroupID, uint3 groupThreadID : SV_GroupThreadID, uint groupIndex : SV_GroupIndex)
+{
+	if (groupIndex == 0)
+		groupMaxSpeed = 0;
+	GroupMemoryBarrierWithGroupSync();
+
+	// This thread's cell, in whichever brick this group covers.
+	// Obstacle cells keep stale velocities, so they don't count.
+	uint3 id = GetCellIndex(groupID, groupThreadID);
+	if (ObstaclesIn[id].r == 0.0f)
+		InterlockedMax(groupMaxSpeed, asuint(length(VelocityIn[id].xyz)));
+
+	// One global atomic per group
+	GroupMemoryBarrierWithGroupSync();
+	if (groupIndex == 0)
+		InterlockedMax(MaxSpeedOut[0], groupMaxSpeed);
+}
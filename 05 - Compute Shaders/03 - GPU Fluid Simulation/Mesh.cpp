@@ -318,6 +318,12 @@ void Mesh::CreateBuffers(Vertex* vertArray, int numVerts, unsigned int* indexArr
 
 	// Save the indices
 	this->numIndices = numIndices;
+
+	// Keep the positions and indices around for the CPU
+	positions.resize(numVerts);
+	for (int i = 0; i < numVerts; i++)
+		positions[i] = vertArray[i].Position;
+	this->indices.assign(indexArray, indexArray + numIndices);
 }
 
 
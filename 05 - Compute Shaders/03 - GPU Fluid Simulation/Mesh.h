@@ -2,6 +2,7 @@
 
 #include <d3d11.h>
 #include <wrl/client.h>
+#include <vector>
 
 #include "Vertex.h"
 
@@ -17,12 +18,18 @@ public:
 	Microsoft::WRL::ComPtr<ID3D11Buffer> GetIndexBuffer() { return ib; }
 	int GetIndexCount() { return numIndices; }
 
+	// CPU copies of the geometry (for voxelizing)
+	const std::vector<DirectX::XMFLOAT3>& GetPositions() { return positions; }
+	const std::vector<unsigned int>& GetIndices() { return indices; }
+
 	void SetBuffersAndDraw(Microsoft::WRL::ComPtr<ID3D11DeviceContext> context);
 
 private:
 	Microsoft::WRL::ComPtr<ID3D11Buffer> vb;
 	Microsoft::WRL::ComPtr<ID3D11Buffer> ib;
 	int numIndices;
+	std::vector<DirectX::XMFLOAT3> positions;
+	std::vector<unsigned int> indices;
 
 	void LoadManually(const char* objFile, Microsoft::WRL::ComPtr<ID3D11Device> device);
 	void LoadAssImp(const char* objFile, Microsoft::WRL::ComPtr<ID3D11Device> device);
@@ -0,0 +1,53 @@
+
+#include "ComputeHelpers.hlsli"
+
+cbuffer externalData : register(b0)
+{
+	int gridSizeX;		// Fine level
+	int gridSizeY;
+	int gridSizeZ;
+	int coarseSizeX;	// Coarse level (half the size)
+	int coarseSizeY;
+	int coarseSizeZ;
+}
+
+Texture3D			CoarsePressureIn	: register(t0);
+Texture3D			PressureIn			: register(t1);
+RWTexture3D<float>	PressureOut			: register(u0);
+
+// Adds the coarse level's correction to the fine level's
+// pressure, trilinearly interpolated between coarse cell
+// centers, one thread per fine cell
+[numthreads(
+	FLUID_COMPUTE_THREADS_PER_AXIS,
+	FLUID_COMPUTE_THREADS_PER_AXIS,
+	FLUID_COMPUTE_THREADS_PER_AXIS)]
+void main(uint3 id : SV_DispatchThreadID)
+{
+	// Coarse levels can be smaller than a thread group
+	if (any(id >= uint3(gridSizeX, gridSizeY, gridSizeZ)))
+		return;
+
+	// Fine cell center in coarse cell coordinates.  Loads are
+	// used rather than the sampler, so the edges clamp exactly
+	// like the CPU reference.
+	float3 coarsePos = id * 0.5f - 0.25f;
+	int3 base = (int3)floor(coarsePos);
+	float3 t = coarsePos - base;
+	int3 coarseSize = int3(coarseSizeX, coarseSizeY, coarseSizeZ);
+
+	float corners[8];
+	for (int i = 0; i < 8; i++)
+	{
+		int3 corner = clamp(base + int3(i & 1, (i >> 1) & 1, i >> 2), 0, coarseSize - 1);
+		corners[i] = CoarsePressureIn[corner].r;
+	}
+
+	float c00 = lerp(corners[0], corners[1], t.x);
+	float c10 = lerp(corners[2], corners[3], t.x);
+	float c01 = lerp(corners[4], corners[5], t.x);
+	float c11 = lerp(corners[6], corners[7], t.x);
+	float correction = lerp(lerp(c00, c10, t.y), lerp(c01, c11, t.y), t.z);
+
+	PressureOut[id] = PressureIn[id].r + correction;
+}
@@ -0,0 +1,61 @@
+
+#include "ComputeHelpers.hlsli"
+
+cbuffer externalData : register(b0)
+{
+	int gridSizeX;
+	int gridSizeY;
+	int gridSizeZ;
+}
+
+Texture3D			DivergenceIn	: register(t0);
+Texture3D			PressureIn		: register(t1);
+Texture3D			ObstaclesIn		: register(t2);
+RWTexture3D<float>	ResidualOut		: register(u0);
+
+// How far each cell is from satisfying the pressure equation
+[numthreads(
+	FLUID_COMPUTE_THREADS_PER_AXIS,
+	FLUID_COMPUTE_THREADS_PER_AXIS,
+	FLUID_COMPUTE_THREADS_PER_AXIS)]
+void main(uint3 id : SV_DispatchThreadID)
+{
+	// Coarse levels can be smaller than a thread group
+	if (any(id >= uint3(gridSizeX, gridSizeY, gridSizeZ)))
+		return;
+
+	// Obstacles aren't part of the equation
+	if (ObstaclesIn[id].r > 0.0f)
+	{
+		ResidualOut[id] = 0.0f;
+		return;
+	}
+
+	float div = DivergenceIn[id].r;
+	float pressureHere = PressureIn[id].r;
+
+	// Indices of surrounding pixels
+	uint3 idL = GetLeftIndex(id);
+	uint3 idR = GetRightIndex(id, gridSizeX);
+	uint3 idD = GetDownIndex(id);
+	uint3 idU = GetUpIndex(id, gridSizeY);
+	uint3 idB = GetBackIndex(id);
+	uint3 idF = GetForwardIndex(id, gridSizeZ);
+
+	// Pressure of surrounding pixels, using this cell's
+	// pressure for obstacles (and past the edges)
+	float pL = PressureIn[idL].r;
+	float pR = PressureIn[idR].r;
+	float pD = PressureIn[idD].r;
+	float pU = PressureIn[idU].r;
+	float pB = PressureIn[idB].r;
+	float pF = PressureIn[idF].r;
+	if (ObstaclesIn[idL].r > 0.0f) pL = pressureHere;
+	if (ObstaclesIn[idR].r > 0.0f) pR = pressureHere;
+	if (ObstaclesIn[idD].r > 0.0f) pD = pressureHere;
+	if (ObstaclesIn[idU].r > 0.0f) pU = pressureHere;
+	if (ObstaclesIn[idB].r > 0.0f) pB = pressureHere;
+	if (ObstaclesIn[idF].r > 0.0f) pF = pressureHere;
+
+	ResidualOut[id] = div - (pL + pR + pD + pU + pB + pF - 6.0f * pressureHere);
+}
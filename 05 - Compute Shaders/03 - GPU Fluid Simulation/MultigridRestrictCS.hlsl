@@ -0,0 +1,63 @@
+
+#include "ComputeHelpers.hlsli"
+
+cbuffer externalData : register(b0)
+{
+	int gridSizeX;		// Fine level
+	int gridSizeY;
+	int gridSizeZ;
+	int coarseSizeX;	// Coarse level (half the size)
+	int coarseSizeY;
+	int coarseSizeZ;
+}
+
+Texture3D					ResidualIn		: register(t0);
+Texture3D					ObstaclesIn		: register(t1);
+RWTexture3D<float>			DivergenceOut	: register(u0);
+RWTexture3D<unorm float>	ObstaclesOut	: register(u1);
+RWTexture3D<float>			PressureOut		: register(u2);
+
+// Moves the fine level's residual down to the coarse level as
+// its right hand side, one thread per coarse cell
+[numthreads(
+	FLUID_COMPUTE_THREADS_PER_AXIS,
+	FLUID_COMPUTE_THREADS_PER_AXIS,
+	FLUID_COMPUTE_THREADS_PER_AXIS)]
+void main(uint3 id : SV_DispatchThreadID)
+{
+	// Coarse levels can be smaller than a thread group
+	if (any(id >= uint3(coarseSizeX, coarseSizeY, coarseSizeZ)))
+		return;
+
+	// Average the residual of the fluid cells in the 2x2x2
+	// block of fine cells under this one
+	uint3 fineSize = uint3(gridSizeX, gridSizeY, gridSizeZ);
+	float sum = 0.0f;
+	int fluidCells = 0;
+	int fineCells = 0;
+	for (uint z = 0; z < 2; z++)
+		for (uint y = 0; y < 2; y++)
+			for (uint x = 0; x < 2; x++)
+			{
+				uint3 fineId = id * 2 + uint3(x, y, z);
+				if (any(fineId >= fineSize))
+					continue;
+
+				fineCells++;
+				if (ObstaclesIn[fineId].r > 0.0f)
+					continue;
+
+				sum += ResidualIn[fineId].r;
+				fluidCells++;
+			}
+
+	// At least half fluid stays fluid, which keeps the coarse
+	// walls close to the fine ones.  The residual is scaled by
+	// four as coarse cells are twice as far apart.
+	bool fluid = fluidCells * 2 >= fineCells;
+	DivergenceOut[id] = fluid ? 4.0f * sum / fluidCells : 0.0f;
+	ObstaclesOut[id] = fluid ? 0.0f : 1.0f;
+
+	// The coarse level solves for a correction, starting at zero
+	PressureOut[id] = 0.0f;
+}
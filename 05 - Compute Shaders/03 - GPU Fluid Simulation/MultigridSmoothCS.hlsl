@@ -0,0 +1,62 @@
+
+#include "ComputeHelpers.hlsli"
+
+cbuffer externalData : register(b0)
+{
+	int gridSizeX;
+	int gridSizeY;
+	int gridSizeZ;
+	float smoothWeight;
+}
+
+Texture3D			DivergenceIn	: register(t0);
+Texture3D			PressureIn		: register(t1);
+Texture3D			ObstaclesIn		: register(t2);
+RWTexture3D<float>	PressureOut		: register(u0);
+
+// Damped Jacobi iteration for one level of the multigrid
+// pyramid - the same as PressureCS when the weight is one
+[numthreads(
+	FLUID_COMPUTE_THREADS_PER_AXIS,
+	FLUID_COMPUTE_THREADS_PER_AXIS,
+	FLUID_COMPUTE_THREADS_PER_AXIS)]
+void main(uint3 id : SV_DispatchThreadID)
+{
+	// Coarse levels can be smaller than a thread group
+	if (any(id >= uint3(gridSizeX, gridSizeY, gridSizeZ)))
+		return;
+
+	float div = DivergenceIn[id].r;
+	float pressureHere = PressureIn[id].r;
+
+	// Indices of surrounding pixels
+	uint3 idL = GetLeftIndex(id);
+	uint3 idR = GetRightIndex(id, gridSizeX);
+	uint3 idD = GetDownIndex(id);
+	uint3 idU = GetUpIndex(id, gridSizeY);
+	uint3 idB = GetBackIndex(id);
+	uint3 idF = GetForwardIndex(id, gridSizeZ);
+
+	// Pressure of surrounding pixels (clamping at the
+	// edges gives this cell's pressure, as in PressureCS)
+	float pL = PressureIn[idL].r;
+	float pR = PressureIn[idR].r;
+	float pD = PressureIn[idD].r;
+	float pU = PressureIn[idU].r;
+	float pB = PressureIn[idB].r;
+	float pF = PressureIn[idF].r;
+
+	// Use this cell's pressure for any surrounding
+	// cells that contain an obstacle
+	if (ObstaclesIn[idL].r > 0.0f) pL = pressureHere;
+	if (ObstaclesIn[idR].r > 0.0f) pR = pressureHere;
+	if (ObstaclesIn[idD].r > 0.0f) pD = pressureHere;
+	if (ObstaclesIn[idU].r > 0.0f) pU = pressureHere;
+	if (ObstaclesIn[idB].r > 0.0f) pB = pressureHere;
+	if (ObstaclesIn[idF].r > 0.0f) pF = pressureHere;
+
+	// Move part of the way to the Jacobi result, which damps
+	// the high frequency error that coarser levels can't see
+	float jacobi = (pL + pR + pD + pU + pB + pF - div) / 6.0f;
+	PressureOut[id] = pressureHere + smoothWeight * (jacobi - pressureHere);
+}
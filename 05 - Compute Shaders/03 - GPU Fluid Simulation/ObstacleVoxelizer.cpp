@@ -0,0 +1,690 @@
+#include "ObstacleVoxelizer.h"
+
+#include <cmath>
+#include <climits>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+
+// Triangles handed to each job
+#define VOXELIZER_TRIANGLES_PER_JOB 256
+
+
+// --------------------------------------------------------
+// Triangle against unit cell overlap with the separating
+// axis theorem, set up once per triangle (Schwarz and Seidel,
+// "Fast Parallel Surface and Solid Voxelization on GPUs").
+// The cell range looped over covers the box axes, leaving
+// the triangle's plane and the nine edge cross products -
+// which are the edges' normals in the YZ, ZX and XY planes.
+// The YZ tests only depend on the row, so they're done once
+// per row.  Touching counts as overlapping.
+// --------------------------------------------------------
+struct TriangleCellTest
+{
+	float Normal[3];
+	float PlaneOffsets[2];		// Plane distance of the cell's nearest and farthest corners (less the cell's position)
+	float EdgeNormals[3][3][2];	// Per projection (YZ, ZX, XY), per edge
+	float EdgeOffsets[3][3];
+
+	TriangleCellTest(const float* v0, const float* v1, const float* v2)
+	{
+		const float* v[3] = { v0, v1, v2 };
+		float edges[3][3];
+		for (int e = 0; e < 3; e++)
+			for (int a = 0; a < 3; a++)
+				edges[e][a] = v[(e + 1) % 3][a] - v[e][a];
+
+		Normal[0] = edges[0][1] * edges[1][2] - edges[0][2] * edges[1][1];
+		Normal[1] = edges[0][2] * edges[1][0] - edges[0][0] * edges[1][2];
+		Normal[2] = edges[0][0] * edges[1][1] - edges[0][1] * edges[1][0];
+
+		float nearCorner = 0.0f;
+		float farCorner = 0.0f;
+		for (int a = 0; a < 3; a++)
+		{
+			float corner = Normal[a] > 0.0f ? 1.0f : 0.0f;
+			nearCorner += Normal[a] * (corner - v0[a]);
+			farCorner += Normal[a] * (1.0f - corner - v0[a]);
+		}
+		PlaneOffsets[0] = nearCorner;
+		PlaneOffsets[1] = farCorner;
+
+		// Each projection's edge normals point into the triangle
+		// (as it's wound seen from the side its normal faces)
+		for (int projection = 0; projection < 3; projection++)
+		{
+			int a = (projection + 1) % 3;
+			int b = (projection + 2) % 3;
+			float facing = Normal[projection] >= 0.0f ? 1.0f : -1.0f;
+			for (int e = 0; e < 3; e++)
+			{
+				float* normal = EdgeNormals[projection][e];
+				normal[0] = -edges[e][b] * facing;
+				normal[1] = edges[e][a] * facing;
+				EdgeOffsets[projection][e] =
+					-(normal[0] * v[e][a] + normal[1] * v[e][b]) +
+					std::max(0.0f, normal[0]) + std::max(0.0f, normal[1]);
+			}
+		}
+	}
+
+	bool ProjectionOverlaps(int projection, float a, float b) const
+	{
+		for (int e = 0; e < 3; e++)
+		{
+			const float* normal = EdgeNormals[projection][e];
+			if (normal[0] * a + normal[1] * b + EdgeOffsets[projection][e] < 0.0f)
+				return false;
+		}
+		return true;
+	}
+
+	// The row's YZ test must already have passed
+	bool Overlaps(float x, float y, float z) const
+	{
+		float plane = Normal[0] * x + Normal[1] * y + Normal[2] * z;
+		return
+			(plane + PlaneOffsets[0]) * (plane + PlaneOffsets[1]) <= 0.0f &&
+			ProjectionOverlaps(1, z, x) &&
+			ProjectionOverlaps(2, x, y);
+	}
+};
+
+// --------------------------------------------------------
+// Which side of the edge from p to q a point (y, z) is on.
+// Computed from the same end of the edge whichever way it's
+// given, so two triangles sharing it agree exactly.
+// --------------------------------------------------------
+static float EdgeFunction(const float p[2], const float q[2], float y, float z)
+{
+	bool swapped = p[0] > q[0] || (p[0] == q[0] && p[1] > q[1]);
+	const float* a = swapped ? q : p;
+	const float* b = swapped ? p : q;
+	float e = (b[0] - a[0]) * (z - a[1]) - (b[1] - a[1]) * (y - a[0]);
+	return swapped ? -e : e;
+}
+
+// --------------------------------------------------------
+// Fill rule for points exactly on an edge: of the two
+// directions an edge can be walked, exactly one owns it
+// --------------------------------------------------------
+static bool OwnsEdge(const float p[2], const float q[2])
+{
+	return q[1] > p[1] || (q[1] == p[1] && q[0] < p[0]);
+}
+
+
+ObstacleVoxelizer::ObstacleVoxelizer(int sizeX, int sizeY, int sizeZ, unsigned int threadCount) :
+	jobs(threadCount)
+{
+	Resize(sizeX, sizeY, sizeZ);
+}
+
+const std::vector<unsigned char>& ObstacleVoxelizer::GetObstacles() { return grid; }
+int ObstacleVoxelizer::GetSizeX() { return sizeX; }
+int ObstacleVoxelizer::GetSizeY() { return sizeY; }
+int ObstacleVoxelizer::GetSizeZ() { return sizeZ; }
+size_t ObstacleVoxelizer::GetObstacleCount() { return obstacles.size(); }
+
+// --------------------------------------------------------
+// Changes the grid size, which empties it and forgets every
+// obstacle (their grid space positions no longer apply)
+// --------------------------------------------------------
+void ObstacleVoxelizer::Resize(int sizeX, int sizeY, int sizeZ)
+{
+	this->sizeX = sizeX;
+	this->sizeY = sizeY;
+	this->sizeZ = sizeZ;
+	wordsPerRow = (sizeX + 31) / 32;
+
+	size_t rowCount = (size_t)sizeY * sizeZ;
+	std::vector<std::atomic<unsigned int>>(rowCount * wordsPerRow).swap(surface);
+	std::vector<std::atomic<short>>(rowCount * sizeX).swap(crossings);
+	grid.assign(rowCount * sizeX, 0);
+
+	obstacles.clear();
+	for (int a = 0; a < 3; a++)
+	{
+		dirtyMin[a] = INT_MAX;
+		dirtyMax[a] = INT_MIN;
+	}
+}
+
+// --------------------------------------------------------
+// Adds an obstacle, or moves it if the key has been seen
+// before.  Nothing is voxelized until Update().  An obstacle
+// given the same transform (and vertex and index counts) as
+// last time is left alone, so this can be called every frame.
+//
+// positionStride - Bytes from one position to the next
+// gridFromObject - Row major matrix taking row vectors from
+//                  object space to grid space (like a
+//                  DirectX::XMFLOAT4X4)
+// --------------------------------------------------------
+void ObstacleVoxelizer::SetObstacle(
+	const void* key,
+	const float* positions,
+	size_t positionStride,
+	size_t vertexCount,
+	const unsigned int* indices,
+	size_t indexCount,
+	const float gridFromObject[16])
+{
+	Obstacle* obstacle = 0;
+	for (Obstacle& o : obstacles)
+		if (o.Key == key)
+			obstacle = &o;
+
+	if (obstacle)
+	{
+		if (memcmp(obstacle->GridFromObject, gridFromObject, sizeof(obstacle->GridFromObject)) == 0 &&
+			obstacle->Positions.size() == vertexCount * 3 &&
+			obstacle->Indices.size() == indexCount)
+			return;
+
+		// Where it was
+		MarkDirty(obstacle->BoundsMin, obstacle->BoundsMax);
+	}
+	else
+	{
+		obstacles.push_back(Obstacle());
+		obstacle = &obstacles.back();
+		obstacle->Key = key;
+	}
+
+	memcpy(obstacle->GridFromObject, gridFromObject, sizeof(obstacle->GridFromObject));
+	obstacle->Indices.assign(indices, indices + indexCount);
+
+	// Into grid space, finding the bounds as we go
+	const float* m = gridFromObject;
+	float lo[3] = { INFINITY, INFINITY, INFINITY };
+	float hi[3] = { -INFINITY, -INFINITY, -INFINITY };
+	obstacle->Positions.resize(vertexCount * 3);
+	for (size_t i = 0; i < vertexCount; i++)
+	{
+		const float* p = (const float*)((const char*)positions + i * positionStride);
+		for (int a = 0; a < 3; a++)
+		{
+			float value = p[0] * m[a] + p[1] * m[4 + a] + p[2] * m[8 + a] + m[12 + a];
+			obstacle->Positions[i * 3 + a] = value;
+			lo[a] = std::min(lo[a], value);
+			hi[a] = std::max(hi[a], value);
+		}
+	}
+
+	// Cells the triangles can touch, with a cell to spare
+	const int sizes[3] = { sizeX, sizeY, sizeZ };
+	for (int a = 0; a < 3; a++)
+	{
+		bool valid = lo[a] <= hi[a];
+		obstacle->BoundsMin[a] = valid ? (int)std::max(0.0f, std::min(floorf(lo[a]) - 1.0f, (float)sizes[a])) : 0;
+		obstacle->BoundsMax[a] = valid ? (int)std::max(0.0f, std::min(floorf(hi[a]) + 2.0f, (float)sizes[a])) : 0;
+	}
+
+	// Where it is now
+	MarkDirty(obstacle->BoundsMin, obstacle->BoundsMax);
+}
+
+void ObstacleVoxelizer::RemoveObstacle(const void* key)
+{
+	for (size_t i = 0; i < obstacles.size(); i++)
+	{
+		if (obstacles[i].Key != key)
+			continue;
+
+		MarkDirty(obstacles[i].BoundsMin, obstacles[i].BoundsMax);
+		obstacles.erase(obstacles.begin() + i);
+		return;
+	}
+}
+
+void ObstacleVoxelizer::MarkDirty(const int boundsMin[3], const int boundsMax[3])
+{
+	for (int a = 0; a < 3; a++)
+		if (boundsMin[a] >= boundsMax[a])
+			return;
+
+	for (int a = 0; a < 3; a++)
+	{
+		dirtyMin[a] = std::min(dirtyMin[a], boundsMin[a]);
+		dirtyMax[a] = std::max(dirtyMax[a], boundsMax[a]);
+	}
+}
+
+// --------------------------------------------------------
+// Voxelizes everything that's changed since the last update
+// again.  Returns false if nothing had, otherwise the region
+// of the grid that was rewritten (min inclusive, max
+// exclusive - always whole rows along X).
+// --------------------------------------------------------
+bool ObstacleVoxelizer::Update(int regionMin[3], int regionMax[3])
+{
+	for (int a = 0; a < 3; a++)
+		if (dirtyMin[a] >= dirtyMax[a])
+			return false;
+
+	regionMin[0] = 0;
+	regionMax[0] = sizeX;
+	for (int a = 1; a < 3; a++)
+	{
+		regionMin[a] = dirtyMin[a];
+		regionMax[a] = dirtyMax[a];
+	}
+	for (int a = 0; a < 3; a++)
+	{
+		dirtyMin[a] = INT_MAX;
+		dirtyMax[a] = INT_MIN;
+	}
+
+	// Start the region's rows over
+	unsigned int sliceCount = regionMax[2] - regionMin[2];
+	jobs.Run(sliceCount, [&](unsigned int slice)
+	{
+		int z = regionMin[2] + slice;
+		for (int y = regionMin[1]; y < regionMax[1]; y++)
+		{
+			size_t row = y + (size_t)sizeY * z;
+			for (int w = 0; w < wordsPerRow; w++)
+				surface[row * wordsPerRow + w].store(0, std::memory_order_relaxed);
+			for (int x = 0; x < sizeX; x++)
+				crossings[row * sizeX + x].store(0, std::memory_order_relaxed);
+		}
+	});
+
+	// Every triangle of every obstacle that reaches the region,
+	// in batches
+	struct Batch
+	{
+		const Obstacle* Source;
+		size_t FirstIndex;
+	};
+	std::vector<Batch> batches;
+	for (const Obstacle& o : obstacles)
+	{
+		if (o.BoundsMin[1] >= regionMax[1] || o.BoundsMax[1] <= regionMin[1] ||
+			o.BoundsMin[2] >= regionMax[2] || o.BoundsMax[2] <= regionMin[2])
+			continue;
+
+		for (size_t i = 0; i + 2 < o.Indices.size(); i += VOXELIZER_TRIANGLES_PER_JOB * 3)
+			batches.push_back({ &o, i });
+	}
+
+	jobs.Run((unsigned int)batches.size(), [&](unsigned int b)
+	{
+		const Obstacle& o = *batches[b].Source;
+		size_t vertexCount = o.Positions.size() / 3;
+		size_t end = std::min(o.Indices.size(), batches[b].FirstIndex + VOXELIZER_TRIANGLES_PER_JOB * 3);
+		for (size_t i = batches[b].FirstIndex; i + 2 < end; i += 3)
+		{
+			unsigned int i0 = o.Indices[i];
+			unsigned int i1 = o.Indices[i + 1];
+			unsigned int i2 = o.Indices[i + 2];
+			if (i0 >= vertexCount || i1 >= vertexCount || i2 >= vertexCount)
+				continue;
+
+			VoxelizeTriangle(&o.Positions[i0 * 3], &o.Positions[i1 * 3], &o.Positions[i2 * 3], regionMin, regionMax);
+		}
+	});
+
+	// Sum the crossings along each row and combine with the surface
+	jobs.Run(sliceCount, [&](unsigned int slice)
+	{
+		int z = regionMin[2] + slice;
+		for (int y = regionMin[1]; y < regionMax[1]; y++)
+		{
+			size_t row = y + (size_t)sizeY * z;
+			int winding = 0;
+			for (int x = 0; x < sizeX; x++)
+			{
+				winding += crossings[row * sizeX + x].load(std::memory_order_relaxed);
+				unsigned int bits = surface[row * wordsPerRow + x / 32].load(std::memory_order_relaxed);
+				bool onSurface = ((bits >> (x % 32)) & 1) != 0;
+				grid[row * sizeX + x] = onSurface || winding != 0 ? 255 : 0;
+			}
+		}
+	});
+
+	return true;
+}
+
+// --------------------------------------------------------
+// Marks the cells (within the region) a triangle overlaps,
+// and adds its crossings to the rows of cell centers it
+// covers when seen along X
+// --------------------------------------------------------
+void ObstacleVoxelizer::VoxelizeTriangle(const float* v0, const float* v1, const float* v2, const int regionMin[3], const int regionMax[3])
+{
+	const int sizes[3] = { sizeX, sizeY, sizeZ };
+	float lo[3];
+	float hi[3];
+	for (int a = 0; a < 3; a++)
+	{
+		lo[a] = std::min(v0[a], std::min(v1[a], v2[a]));
+		hi[a] = std::max(v0[a], std::max(v1[a], v2[a]));
+		if (!(lo[a] <= hi[a]))
+			return;
+
+		// Keep conversions to int in range
+		lo[a] = std::max(lo[a], -2.0f);
+		hi[a] = std::min(hi[a], sizes[a] + 2.0f);
+		if (lo[a] > hi[a])
+			return;
+	}
+
+	// Surface -----
+	int cellMin[3];
+	int cellMax[3];
+	for (int a = 0; a < 3; a++)
+	{
+		cellMin[a] = std::max(regionMin[a], (int)ceilf(lo[a]) - 1);
+		cellMax[a] = std::min(regionMax[a], (int)floorf(hi[a]) + 1);
+	}
+
+	TriangleCellTest cellTest(v0, v1, v2);
+	for (int z = cellMin[2]; z < cellMax[2]; z++)
+		for (int y = cellMin[1]; y < cellMax[1]; y++)
+		{
+			if (!cellTest.ProjectionOverlaps(0, (float)y, (float)z))
+				continue;
+
+			// Gather the row's bits and write each word once
+			size_t row = y + (size_t)sizeY * z;
+			unsigned int bits = 0;
+			for (int x = cellMin[0]; x < cellMax[0]; x++)
+			{
+				if (cellTest.Overlaps((float)x, (float)y, (float)z))
+					bits |= 1u << (x % 32);
+
+				if ((x % 32 == 31 || x == cellMax[0] - 1) && bits)
+				{
+					surface[row * wordsPerRow + x / 32].fetch_or(bits, std::memory_order_relaxed);
+					bits = 0;
+				}
+			}
+		}
+
+	// Crossings -----
+
+	// X of the normal - also twice the area seen along X
+	float normal[3] = {
+		(v1[1] - v0[1]) * (v2[2] - v0[2]) - (v1[2] - v0[2]) * (v2[1] - v0[1]),
+		(v1[2] - v0[2]) * (v2[0] - v0[0]) - (v1[0] - v0[0]) * (v2[2] - v0[2]),
+		(v1[0] - v0[0]) * (v2[1] - v0[1]) - (v1[1] - v0[1]) * (v2[0] - v0[0]) };
+	if (normal[0] == 0.0f)
+		return;
+
+	// Facing -X means the ray is going in.  Corners are put in
+	// the order that winds positively along X for edge tests.
+	short crossing = normal[0] < 0.0f ? 1 : -1;
+	const float* second = normal[0] > 0.0f ? v1 : v2;
+	const float* third = normal[0] > 0.0f ? v2 : v1;
+	const float corners[3][2] = {
+		{ v0[1], v0[2] },
+		{ second[1], second[2] },
+		{ third[1], third[2] } };
+
+	int rowMinY = std::max(regionMin[1], (int)ceilf(lo[1] - 0.5f));
+	int rowMaxY = std::min(regionMax[1] - 1, (int)floorf(hi[1] - 0.5f));
+	int rowMinZ = std::max(regionMin[2], (int)ceilf(lo[2] - 0.5f));
+	int rowMaxZ = std::min(regionMax[2] - 1, (int)floorf(hi[2] - 0.5f));
+	for (int z = rowMinZ; z <= rowMaxZ; z++)
+		for (int y = rowMinY; y <= rowMaxY; y++)
+		{
+			float centerY = y + 0.5f;
+			float centerZ = z + 0.5f;
+
+			bool inside = true;
+			for (int e = 0; e < 3 && inside; e++)
+			{
+				const float* p = corners[e];
+				const float* q = corners[(e + 1) % 3];
+				float side = EdgeFunction(p, q, centerY, centerZ);
+				inside = side > 0.0f || (side == 0.0f && OwnsEdge(p, q));
+			}
+			if (!inside)
+				continue;
+
+			// Where the row crosses the triangle's plane, and the
+			// first cell whose center is past that
+			float x = v0[0] - (normal[1] * (centerY - v0[1]) + normal[2] * (centerZ - v0[2])) / normal[0];
+			x = std::max(-2.0f, std::min(x, sizeX + 2.0f));
+			int firstCell = std::max(0, (int)floorf(x - 0.5f) + 1);
+			if (firstCell >= sizeX)
+				continue;
+
+			crossings[(y + (size_t)sizeY * z) * sizeX + firstCell].fetch_add(crossing, std::memory_order_relaxed);
+		}
+}
+
+
+// --------------------------------------------------------
+// A unit sphere (or cube from 0 to 1) with every triangle
+// wound the same way, facing out
+// --------------------------------------------------------
+static void OrientOutward(std::vector<float>& positions, std::vector<unsigned int>& indices, const float inside[3])
+{
+	for (size_t i = 0; i + 2 < indices.size(); i += 3)
+	{
+		const float* a = &positions[indices[i] * 3];
+		const float* b = &positions[indices[i + 1] * 3];
+		const float* c = &positions[indices[i + 2] * 3];
+		float u[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+		float v[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+		float n[3] = { u[1] * v[2] - u[2] * v[1], u[2] * v[0] - u[0] * v[2], u[0] * v[1] - u[1] * v[0] };
+		float out = n[0] * (a[0] - inside[0]) + n[1] * (a[1] - inside[1]) + n[2] * (a[2] - inside[2]);
+		if (out < 0.0f)
+			std::swap(indices[i + 1], indices[i + 2]);
+	}
+}
+
+static void CreateSphere(int stacks, int slices, std::vector<float>& positions, std::vector<unsigned int>& indices)
+{
+	const float pi = 3.14159265f;
+	positions = { 0.0f, 1.0f, 0.0f };
+	for (int s = 1; s < stacks; s++)
+	{
+		float phi = pi * s / stacks;
+		for (int i = 0; i < slices; i++)
+		{
+			float theta = 2.0f * pi * i / slices;
+			positions.push_back(sinf(phi) * cosf(theta));
+			positions.push_back(cosf(phi));
+			positions.push_back(sinf(phi) * sinf(theta));
+		}
+	}
+	positions.insert(positions.end(), { 0.0f, -1.0f, 0.0f });
+
+	unsigned int bottom = (unsigned int)positions.size() / 3 - 1;
+	auto ring = [&](int s, int i) { return (unsigned int)(1 + (s - 1) * slices + (i % slices)); };
+	indices.clear();
+	for (int i = 0; i < slices; i++)
+	{
+		indices.insert(indices.end(), { 0, ring(1, i), ring(1, i + 1) });
+		for (int s = 1; s < stacks - 1; s++)
+		{
+			indices.insert(indices.end(), { ring(s, i), ring(s + 1, i), ring(s + 1, i + 1) });
+			indices.insert(indices.end(), { ring(s, i), ring(s + 1, i + 1), ring(s, i + 1) });
+		}
+		indices.insert(indices.end(), { ring(stacks - 1, i), bottom, ring(stacks - 1, i + 1) });
+	}
+
+	const float center[3] = { 0.0f, 0.0f, 0.0f };
+	OrientOutward(positions, indices, center);
+}
+
+static void CreateCube(std::vector<float>& positions, std::vector<unsigned int>& indices)
+{
+	// Corner i is at (i & 1, (i >> 1) & 1, (i >> 2) & 1)
+	positions.clear();
+	for (int i = 0; i < 8; i++)
+		positions.insert(positions.end(), { (float)(i & 1), (float)((i >> 1) & 1), (float)((i >> 2) & 1) });
+
+	const unsigned int faces[6][4] = {
+		{ 0, 2, 6, 4 }, { 1, 3, 7, 5 },		// -X, +X
+		{ 0, 1, 5, 4 }, { 2, 3, 7, 6 },		// -Y, +Y
+		{ 0, 1, 3, 2 }, { 4, 5, 7, 6 } };	// -Z, +Z
+	indices.clear();
+	for (const unsigned int* f : faces)
+		indices.insert(indices.end(), { f[0], f[1], f[2], f[0], f[2], f[3] });
+
+	const float center[3] = { 0.5f, 0.5f, 0.5f };
+	OrientOutward(positions, indices, center);
+}
+
+// Scale, then rotation around Y, then translation
+static void MakeTransform(float scale, float angle, float x, float y, float z, float m[16])
+{
+	float c = cosf(angle) * scale;
+	float s = sinf(angle) * scale;
+	const float transform[16] = {
+		c, 0.0f, -s, 0.0f,
+		0.0f, scale, 0.0f, 0.0f,
+		s, 0.0f, c, 0.0f,
+		x, y, z, 1.0f };
+	memcpy(m, transform, sizeof(transform));
+}
+
+// --------------------------------------------------------
+// Voxelizes analytic shapes and checks the results:
+//  - A sphere: every cell whose center is inside the sphere
+//    (less how far its facets cut in) must be filled, and
+//    every cell that can't touch it must be empty
+//  - An axis aligned box whose faces aren't on cell edges:
+//    exactly the cells overlapping it must be filled
+//  - A sphere moving (and turning) through the box, updated
+//    a dirty region at a time, must match voxelizing it all
+//    from scratch after every move
+// --------------------------------------------------------
+VoxelizerTestResults ObstacleVoxelizer::Test(int gridSize, int moveSteps)
+{
+	VoxelizerTestResults results = {};
+	results.GridSize = gridSize;
+	size_t cellCount = (size_t)gridSize * gridSize * gridSize;
+	int region[2][3];
+
+	const int stacks = 32;
+	const int slices = 64;
+	std::vector<float> spherePositions;
+	std::vector<unsigned int> sphereIndices;
+	CreateSphere(stacks, slices, spherePositions, sphereIndices);
+	results.SphereTriangles = (int)sphereIndices.size() / 3;
+
+	std::vector<float> cubePositions;
+	std::vector<unsigned int> cubeIndices;
+	CreateCube(cubePositions, cubeIndices);
+
+	ObstacleVoxelizer voxelizer(gridSize, gridSize, gridSize);
+	auto cellAt = [&](size_t index, int& x, int& y, int& z)
+	{
+		x = (int)(index % gridSize);
+		y = (int)((index / gridSize) % gridSize);
+		z = (int)(index / ((size_t)gridSize * gridSize));
+	};
+
+	// Sphere -----
+	{
+		const float pi = 3.14159265f;
+		float radius = gridSize * 0.3f;
+		float center[3] = { gridSize * 0.5f + 0.37f, gridSize * 0.5f + 0.21f, gridSize * 0.5f + 0.13f };
+		float insideRadius = radius * cosf(pi / stacks) * cosf(pi / slices);
+		float transform[16];
+		MakeTransform(radius, 0.0f, center[0], center[1], center[2], transform);
+
+		voxelizer.SetObstacle(&spherePositions, spherePositions.data(), sizeof(float) * 3, spherePositions.size() / 3, sphereIndices.data(), sphereIndices.size(), transform);
+		voxelizer.Update(region[0], region[1]);
+
+		size_t filled = 0;
+		for (size_t i = 0; i < cellCount; i++)
+		{
+			int x, y, z;
+			cellAt(i, x, y, z);
+			float dx = x + 0.5f - center[0];
+			float dy = y + 0.5f - center[1];
+			float dz = z + 0.5f - center[2];
+			float distance = sqrtf(dx * dx + dy * dy + dz * dz);
+
+			bool solid = voxelizer.grid[i] != 0;
+			filled += solid;
+			if ((distance < insideRadius && !solid) || (distance - 0.87f > radius && solid))
+				results.SphereMismatches++;
+		}
+		results.SphereVolumeRatio = filled / (4.0f / 3.0f * pi * radius * radius * radius);
+		voxelizer.RemoveObstacle(&spherePositions);
+		voxelizer.Update(region[0], region[1]);
+	}
+
+	// Box -----
+	float boxMin = floorf(gridSize * 0.2f) + 0.25f;
+	float boxMax = floorf(gridSize * 0.7f) + 0.75f;
+	float boxTransform[16];
+	MakeTransform(boxMax - boxMin, 0.0f, boxMin, boxMin, boxMin, boxTransform);
+	{
+		voxelizer.SetObstacle(&cubePositions, cubePositions.data(), sizeof(float) * 3, cubePositions.size() / 3, cubeIndices.data(), cubeIndices.size(), boxTransform);
+		voxelizer.Update(region[0], region[1]);
+
+		for (size_t i = 0; i < cellCount; i++)
+		{
+			int cell[3];
+			cellAt(i, cell[0], cell[1], cell[2]);
+			bool expected = true;
+			for (int a = 0; a < 3; a++)
+				expected &= cell[a] + 1 > boxMin && cell[a] < boxMax;
+
+			if (expected != (voxelizer.grid[i] != 0))
+				results.CubeMismatches++;
+		}
+		voxelizer.Resize(gridSize, gridSize, gridSize);
+	}
+
+	// Moving sphere -----
+	{
+		float radius = gridSize * 0.15f;
+		float sphereTransform[16];
+		auto moveSphere = [&](int step)
+		{
+			MakeTransform(radius, step * 0.1f, gridSize * 0.3f + step * 0.7f, gridSize * 0.5f + 0.21f, gridSize * 0.5f + 0.13f, sphereTransform);
+		};
+
+		// Everything at once, into an empty grid
+		moveSphere(0);
+		voxelizer.SetObstacle(&cubePositions, cubePositions.data(), sizeof(float) * 3, cubePositions.size() / 3, cubeIndices.data(), cubeIndices.size(), boxTransform);
+		voxelizer.SetObstacle(&spherePositions, spherePositions.data(), sizeof(float) * 3, spherePositions.size() / 3, sphereIndices.data(), sphereIndices.size(), sphereTransform);
+
+		auto start = std::chrono::high_resolution_clock::now();
+		voxelizer.Update(region[0], region[1]);
+		auto end = std::chrono::high_resolution_clock::now();
+		double seconds = std::chrono::duration<double>(end - start).count();
+		results.FullMilliseconds = seconds * 1000.0;
+		results.TrianglesPerSecond = (results.SphereTriangles + cubeIndices.size() / 3) / seconds;
+
+		// Then a step at a time
+		ObstacleVoxelizer reference(gridSize, gridSize, gridSize);
+		double updateSeconds = 0.0;
+		for (int step = 1; step <= moveSteps; step++)
+		{
+			moveSphere(step);
+			voxelizer.SetObstacle(&spherePositions, spherePositions.data(), sizeof(float) * 3, spherePositions.size() / 3, sphereIndices.data(), sphereIndices.size(), sphereTransform);
+
+			start = std::chrono::high_resolution_clock::now();
+			voxelizer.Update(region[0], region[1]);
+			end = std::chrono::high_resolution_clock::now();
+			updateSeconds += std::chrono::duration<double>(end - start).count();
+
+			reference.Resize(gridSize, gridSize, gridSize);
+			reference.SetObstacle(&cubePositions, cubePositions.data(), sizeof(float) * 3, cubePositions.size() / 3, cubeIndices.data(), cubeIndices.size(), boxTransform);
+			reference.SetObstacle(&spherePositions, spherePositions.data(), sizeof(float) * 3, spherePositions.size() / 3, sphereIndices.data(), sphereIndices.size(), sphereTransform);
+			reference.Update(region[0], region[1]);
+
+			for (size_t i = 0; i < cellCount; i++)
+				results.MovingMismatches += voxelizer.grid[i] != reference.grid[i];
+		}
+		results.UpdateMilliseconds = moveSteps > 0 ? updateSeconds * 1000.0 / moveSteps : 0.0;
+	}
+
+	results.Passed =
+		results.SphereMismatches == 0 &&
+		results.CubeMismatches == 0 &&
+		results.MovingMismatches == 0;
+	return results;
+}
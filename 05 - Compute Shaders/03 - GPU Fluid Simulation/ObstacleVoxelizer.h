@@ -0,0 +1,111 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+
+#include "JobSystem.h"
+
+// --------------------------------------------------------
+// How closely voxelized analytic shapes match the shapes
+// themselves, and how long voxelizing takes
+// --------------------------------------------------------
+struct VoxelizerTestResults
+{
+	int GridSize;
+	int SphereTriangles;
+	int SphereMismatches;		// Cells clearly inside the sphere left empty, or clearly outside it filled
+	float SphereVolumeRatio;	// Filled cells over the sphere's volume (over 1, since the surface is conservative)
+	int CubeMismatches;			// Against exactly the cells an axis aligned box overlaps
+	int MovingMismatches;		// Dirty region updates as a sphere moves against voxelizing from scratch
+	double FullMilliseconds;	// Sphere and cube into an empty grid
+	double UpdateMilliseconds;	// Average dirty region update as the sphere moves
+	double TrianglesPerSecond;	// Of the full voxelization
+	bool Passed;
+};
+
+// --------------------------------------------------------
+// Voxelizes triangle meshes into an obstacle grid on the CPU,
+// over flat arrays indexed x + sizeX * (y + sizeY * z) like
+// FluidFieldCPU.  Cell (x, y, z) covers x to x + 1 (and so
+// on) in grid space.
+//
+// A cell is an obstacle if any triangle overlaps it (a
+// triangle-box separating axis test, so thin surfaces are
+// never missed) or if its center is inside a closed mesh.
+// Inside is found by casting a ray along +X through each row
+// of cell centers: every triangle adds its crossing (+1 going
+// in, -1 coming out) to the first cell past it, and a prefix
+// sum along the row gives each cell's winding number.  Shared
+// edges use a fill rule, so each crossing counts exactly once.
+//
+// Triangles are spread across threads, and both the surface
+// bits and the crossings are written with atomics.
+//
+// Obstacles are keyed by their owner (any pointer) and only
+// the region an obstacle moved out of and into is voxelized
+// again, along whole rows since the winding sums run along X.
+// --------------------------------------------------------
+class ObstacleVoxelizer
+{
+public:
+	ObstacleVoxelizer(int sizeX, int sizeY, int sizeZ, unsigned int threadCount = 0);
+
+	ObstacleVoxelizer(const ObstacleVoxelizer&) = delete;
+	void operator=(const ObstacleVoxelizer&) = delete;
+
+	void Resize(int sizeX, int sizeY, int sizeZ);
+	void SetObstacle(
+		const void* key,
+		const float* positions,
+		size_t positionStride,
+		size_t vertexCount,
+		const unsigned int* indices,
+		size_t indexCount,
+		const float gridFromObject[16]);
+	void RemoveObstacle(const void* key);
+	bool Update(int regionMin[3], int regionMax[3]);
+
+	const std::vector<unsigned char>& GetObstacles();
+	int GetSizeX();
+	int GetSizeY();
+	int GetSizeZ();
+	size_t GetObstacleCount();
+
+	static VoxelizerTestResults Test(int gridSize, int moveSteps = 20);
+
+private:
+	int sizeX;
+	int sizeY;
+	int sizeZ;
+	JobSystem jobs;
+
+	// An obstacle's triangles in grid space and the cells they
+	// can touch: min inclusive, max exclusive (clipped to the grid)
+	struct Obstacle
+	{
+		const void* Key;
+		float GridFromObject[16];
+		std::vector<float> Positions;
+		std::vector<unsigned int> Indices;
+		int BoundsMin[3];
+		int BoundsMax[3];
+	};
+	std::vector<Obstacle> obstacles;
+
+	// Cells to voxelize again on the next update (empty when
+	// min > max along any axis)
+	int dirtyMin[3];
+	int dirtyMax[3];
+
+	// Surface bits (rows padded to whole words, so a row can
+	// be cleared without touching its neighbors), crossings
+	// per cell and the resulting obstacles: 0 or 255 per cell
+	int wordsPerRow;
+	std::vector<std::atomic<unsigned int>> surface;
+	std::vector<std::atomic<short>> crossings;
+	std::vector<unsigned char> grid;
+
+	// Helper methods
+	void MarkDirty(const int boundsMin[3], const int boundsMax[3]);
+	void VoxelizeTriangle(const float* v0, const float* v1, const float* v2, const int regionMin[3], const int regionMax[3]);
+};
@@ -0,0 +1,405 @@
+#include "PressureSolver.h"
+
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <algorithm>
+
+// Clamps a neighbor index to the grid, so neighbors outside
+// the grid are the cell itself (just like ComputeHelpers.hlsli)
+#define CLAMP_INDEX(i, size) ((i) < 0 ? 0 : ((i) >= (size) ? (size) - 1 : (i)))
+
+
+// --------------------------------------------------------
+// Creates the grid pyramid for the given size, halving each
+// axis until any axis reaches the coarsest size (or is odd)
+//
+// obstacles - One byte per cell, non-zero for obstacles, or
+//             null for a grid with no obstacles
+// --------------------------------------------------------
+PressureSolver::PressureSolver(int sizeX, int sizeY, int sizeZ, const unsigned char* obstacles)
+{
+	while (true)
+	{
+		Level level;
+		level.SizeX = sizeX;
+		level.SizeY = sizeY;
+		level.SizeZ = sizeZ;
+
+		size_t cellCount = (size_t)sizeX * sizeY * sizeZ;
+		level.Pressure.resize(cellCount);
+		level.PressureTemp.resize(cellCount);
+		level.Divergence.resize(cellCount);
+		level.Residual.resize(cellCount);
+		level.Obstacles.resize(cellCount);
+		levels.push_back(level);
+
+		// Odd sizes would leave half-covered coarse cells along
+		// the edges, which the coarse equation doesn't describe
+		if (std::min(sizeX, std::min(sizeY, sizeZ)) <= MULTIGRID_COARSEST_SIZE ||
+			sizeX % 2 || sizeY % 2 || sizeZ % 2)
+			break;
+
+		sizeX /= 2;
+		sizeY /= 2;
+		sizeZ /= 2;
+	}
+
+	// Coarser obstacles are made by Restrict(), like the GPU
+	if (obstacles)
+		memcpy(levels[0].Obstacles.data(), obstacles, levels[0].Obstacles.size());
+}
+
+int PressureSolver::GetLevelCount() { return (int)levels.size(); }
+
+
+// --------------------------------------------------------
+// Runs the given number of PressureCS iterations
+// --------------------------------------------------------
+void PressureSolver::Jacobi(const float* divergence, float* pressure, int iterations)
+{
+	Level& level = levels[0];
+	memcpy(level.Divergence.data(), divergence, sizeof(float) * level.Divergence.size());
+	memcpy(level.Pressure.data(), pressure, sizeof(float) * level.Pressure.size());
+
+	Smooth(level, iterations, 1.0f);
+
+	memcpy(pressure, level.Pressure.data(), sizeof(float) * level.Pressure.size());
+}
+
+// --------------------------------------------------------
+// Runs the given number of multigrid V-cycles, starting from
+// the pressures already in the array
+// --------------------------------------------------------
+void PressureSolver::Multigrid(const float* divergence, float* pressure, int cycles, int smoothIterations)
+{
+	Level& level = levels[0];
+	memcpy(level.Divergence.data(), divergence, sizeof(float) * level.Divergence.size());
+	memcpy(level.Pressure.data(), pressure, sizeof(float) * level.Pressure.size());
+
+	for (int c = 0; c < cycles; c++)
+		VCycle(0, smoothIterations);
+
+	memcpy(pressure, level.Pressure.data(), sizeof(float) * level.Pressure.size());
+}
+
+// --------------------------------------------------------
+// Root mean square of the residual (how far each cell is
+// from satisfying the pressure equation), with obstacles
+// counting as zero like FluidField's GPU measurement
+// --------------------------------------------------------
+float PressureSolver::ResidualNorm(const float* divergence, const float* pressure)
+{
+	Level& level = levels[0];
+	memcpy(level.Divergence.data(), divergence, sizeof(float) * level.Divergence.size());
+	memcpy(level.Pressure.data(), pressure, sizeof(float) * level.Pressure.size());
+	Residual(level);
+
+	double sum = 0.0;
+	for (float residual : level.Residual)
+		sum += (double)residual * residual;
+
+	return (float)sqrt(sum / level.Residual.size());
+}
+
+// --------------------------------------------------------
+// The cost of one V-cycle, in full size grid sweeps.  Each
+// level above the coarsest smooths twice, then computes the
+// residual, restricts it and prolongs the correction (one
+// sweep of that level's cells each); the coarsest level only
+// smooths.  Compare this to Jacobi iterations for equal work.
+// --------------------------------------------------------
+float PressureSolver::GetMultigridPassesPerCycle(int smoothIterations)
+{
+	float fullCells = (float)levels[0].Pressure.size();
+	float passes = 0.0f;
+	for (size_t l = 0; l < levels.size(); l++)
+	{
+		float scale = levels[l].Pressure.size() / fullCells;
+		if (l == levels.size() - 1)
+			passes += scale * MULTIGRID_COARSE_ITERATIONS;
+		else
+			passes += scale * (smoothIterations * 2 + 3);
+	}
+	return passes;
+}
+
+
+// --------------------------------------------------------
+// Damped Jacobi iterations on a level, matching PressureCS
+// when the weight is one
+// --------------------------------------------------------
+void PressureSolver::Smooth(Level& level, int iterations, float weight)
+{
+	int sizeX = level.SizeX;
+	int sizeY = level.SizeY;
+	int sizeZ = level.SizeZ;
+
+	for (int i = 0; i < iterations; i++)
+	{
+		const float* pressureIn = level.Pressure.data();
+		float* pressureOut = level.PressureTemp.data();
+
+		for (int z = 0; z < sizeZ; z++)
+			for (int y = 0; y < sizeY; y++)
+				for (int x = 0; x < sizeX; x++)
+				{
+					int index = x + sizeX * (y + sizeY * z);
+					int iL = CLAMP_INDEX(x - 1, sizeX) + sizeX * (y + sizeY * z);
+					int iR = CLAMP_INDEX(x + 1, sizeX) + sizeX * (y + sizeY * z);
+					int iD = x + sizeX * (CLAMP_INDEX(y - 1, sizeY) + sizeY * z);
+					int iU = x + sizeX * (CLAMP_INDEX(y + 1, sizeY) + sizeY * z);
+					int iB = x + sizeX * (y + sizeY * CLAMP_INDEX(z - 1, sizeZ));
+					int iF = x + sizeX * (y + sizeY * CLAMP_INDEX(z + 1, sizeZ));
+
+					float pressureHere = pressureIn[index];
+					float pL = level.Obstacles[iL] ? pressureHere : pressureIn[iL];
+					float pR = level.Obstacles[iR] ? pressureHere : pressureIn[iR];
+					float pD = level.Obstacles[iD] ? pressureHere : pressureIn[iD];
+					float pU = level.Obstacles[iU] ? pressureHere : pressureIn[iU];
+					float pB = level.Obstacles[iB] ? pressureHere : pressureIn[iB];
+					float pF = level.Obstacles[iF] ? pressureHere : pressureIn[iF];
+
+					// Same as PressureCS when the weight is one
+					float jacobi = (pL + pR + pD + pU + pB + pF - level.Divergence[index]) / 6.0f;
+					pressureOut[index] = pressureHere + weight * (jacobi - pressureHere);
+				}
+
+		level.Pressure.swap(level.PressureTemp);
+	}
+}
+
+// --------------------------------------------------------
+// How far each cell is from satisfying the pressure equation
+// (zero for obstacles, which aren't part of it)
+// --------------------------------------------------------
+void PressureSolver::Residual(Level& level)
+{
+	int sizeX = level.SizeX;
+	int sizeY = level.SizeY;
+	int sizeZ = level.SizeZ;
+	const float* pressure = level.Pressure.data();
+
+	for (int z = 0; z < sizeZ; z++)
+		for (int y = 0; y < sizeY; y++)
+			for (int x = 0; x < sizeX; x++)
+			{
+				int index = x + sizeX * (y + sizeY * z);
+				if (level.Obstacles[index])
+				{
+					level.Residual[index] = 0.0f;
+					continue;
+				}
+
+				int iL = CLAMP_INDEX(x - 1, sizeX) + sizeX * (y + sizeY * z);
+				int iR = CLAMP_INDEX(x + 1, sizeX) + sizeX * (y + sizeY * z);
+				int iD = x + sizeX * (CLAMP_INDEX(y - 1, sizeY) + sizeY * z);
+				int iU = x + sizeX * (CLAMP_INDEX(y + 1, sizeY) + sizeY * z);
+				int iB = x + sizeX * (y + sizeY * CLAMP_INDEX(z - 1, sizeZ));
+				int iF = x + sizeX * (y + sizeY * CLAMP_INDEX(z + 1, sizeZ));
+
+				float pressureHere = pressure[index];
+				float pL = level.Obstacles[iL] ? pressureHere : pressure[iL];
+				float pR = level.Obstacles[iR] ? pressureHere : pressure[iR];
+				float pD = level.Obstacles[iD] ? pressureHere : pressure[iD];
+				float pU = level.Obstacles[iU] ? pressureHere : pressure[iU];
+				float pB = level.Obstacles[iB] ? pressureHere : pressure[iB];
+				float pF = level.Obstacles[iF] ? pressureHere : pressure[iF];
+
+				level.Residual[index] = level.Divergence[index] - (pL + pR + pD + pU + pB + pF - 6.0f * pressureHere);
+			}
+}
+
+// --------------------------------------------------------
+// Averages each 2x2x2 block of the fine level's residual
+// (skipping obstacles) into the coarse level's right hand
+// side, scaled by four as the coarse cells are twice as far
+// apart.  A coarse cell is an obstacle if most of the fine
+// cells under it are, and its pressure starts at zero.
+// --------------------------------------------------------
+void PressureSolver::Restrict(const Level& fine, Level& coarse)
+{
+	for (int z = 0; z < coarse.SizeZ; z++)
+		for (int y = 0; y < coarse.SizeY; y++)
+			for (int x = 0; x < coarse.SizeX; x++)
+			{
+				float sum = 0.0f;
+				int fluidCells = 0;
+				int fineCells = 0;
+				for (int cz = z * 2; cz < std::min(z * 2 + 2, fine.SizeZ); cz++)
+					for (int cy = y * 2; cy < std::min(y * 2 + 2, fine.SizeY); cy++)
+						for (int cx = x * 2; cx < std::min(x * 2 + 2, fine.SizeX); cx++)
+						{
+							int fineIndex = cx + fine.SizeX * (cy + fine.SizeY * cz);
+							fineCells++;
+							if (fine.Obstacles[fineIndex])
+								continue;
+
+							sum += fine.Residual[fineIndex];
+							fluidCells++;
+						}
+
+				// At least half fluid stays fluid, which keeps the coarse
+				// walls close to the fine ones
+				bool fluid = fluidCells * 2 >= fineCells;
+				int index = x + coarse.SizeX * (y + coarse.SizeY * z);
+				coarse.Divergence[index] = fluid ? 4.0f * sum / fluidCells : 0.0f;
+				coarse.Obstacles[index] = fluid ? 0 : 255;
+				coarse.Pressure[index] = 0.0f;
+			}
+}
+
+// --------------------------------------------------------
+// Adds the coarse level's pressure (the correction) to the
+// fine level's, trilinearly interpolated between coarse
+// cell centers
+// --------------------------------------------------------
+void PressureSolver::Prolong(const Level& coarse, Level& fine)
+{
+	for (int z = 0; z < fine.SizeZ; z++)
+		for (int y = 0; y < fine.SizeY; y++)
+			for (int x = 0; x < fine.SizeX; x++)
+			{
+				// Fine cell center in coarse cell coordinates
+				float cx = x * 0.5f - 0.25f;
+				float cy = y * 0.5f - 0.25f;
+				float cz = z * 0.5f - 0.25f;
+				int x0 = (int)floorf(cx);
+				int y0 = (int)floorf(cy);
+				int z0 = (int)floorf(cz);
+				float tx = cx - x0;
+				float ty = cy - y0;
+				float tz = cz - z0;
+
+				int xs[2] = { CLAMP_INDEX(x0, coarse.SizeX), CLAMP_INDEX(x0 + 1, coarse.SizeX) };
+				int ys[2] = { CLAMP_INDEX(y0, coarse.SizeY), CLAMP_INDEX(y0 + 1, coarse.SizeY) };
+				int zs[2] = { CLAMP_INDEX(z0, coarse.SizeZ), CLAMP_INDEX(z0 + 1, coarse.SizeZ) };
+
+				float corners[2][2][2];
+				for (int k = 0; k < 2; k++)
+					for (int j = 0; j < 2; j++)
+						for (int i = 0; i < 2; i++)
+							corners[k][j][i] = coarse.Pressure[xs[i] + coarse.SizeX * (ys[j] + coarse.SizeY * zs[k])];
+
+				float c00 = corners[0][0][0] + tx * (corners[0][0][1] - corners[0][0][0]);
+				float c10 = corners[0][1][0] + tx * (corners[0][1][1] - corners[0][1][0]);
+				float c01 = corners[1][0][0] + tx * (corners[1][0][1] - corners[1][0][0]);
+				float c11 = corners[1][1][0] + tx * (corners[1][1][1] - corners[1][1][0]);
+				float c0 = c00 + ty * (c10 - c00);
+				float c1 = c01 + ty * (c11 - c01);
+
+				fine.Pressure[x + fine.SizeX * (y + fine.SizeY * z)] += c0 + tz * (c1 - c0);
+			}
+}
+
+// --------------------------------------------------------
+// Smooth, restrict the residual, solve the coarser level
+// (recursively), prolong its correction, then smooth again
+// --------------------------------------------------------
+void PressureSolver::VCycle(int level, int smoothIterations)
+{
+	if (level == (int)levels.size() - 1)
+	{
+		Smooth(levels[level], MULTIGRID_COARSE_ITERATIONS, MULTIGRID_SMOOTH_WEIGHT);
+		return;
+	}
+
+	Smooth(levels[level], smoothIterations, MULTIGRID_SMOOTH_WEIGHT);
+	Residual(levels[level]);
+	Restrict(levels[level], levels[level + 1]);
+	VCycle(level + 1, smoothIterations);
+	Prolong(levels[level + 1], levels[level]);
+	Smooth(levels[level], smoothIterations, MULTIGRID_SMOOTH_WEIGHT);
+}
+
+
+// --------------------------------------------------------
+// Solves the pressure for a random velocity field around a
+// spherical obstacle, with both solvers doing about the same
+// amount of work, starting from zero pressure like
+// FluidField does each step
+//
+// gridSize - Cells along each axis
+// jacobiIterations - Iterations for Jacobi; multigrid gets as
+//                    many V-cycles as fit in the same work
+// smoothIterations - Multigrid smoothing sweeps (before and
+//                    after each coarser solve)
+// --------------------------------------------------------
+PressureConvergenceResults PressureSolver::TestConvergence(int gridSize, int jacobiIterations, int smoothIterations)
+{
+	int n = gridSize;
+	size_t cellCount = (size_t)n * n * n;
+
+	// Sphere in the middle
+	std::vector<unsigned char> obstacles(cellCount);
+	float center = n * 0.5f;
+	for (int z = 0; z < n; z++)
+		for (int y = 0; y < n; y++)
+			for (int x = 0; x < n; x++)
+			{
+				float dx = x - center, dy = y - center, dz = z - center;
+				if (dx * dx + dy * dy + dz * dz < (n * 0.15f) * (n * 0.15f))
+					obstacles[x + n * (y + n * z)] = 255;
+			}
+
+	// Smooth-ish random velocities: a few random swirls plus noise
+	std::mt19937 random(1);
+	std::uniform_real_distribution<float> noise(-1.0f, 1.0f);
+	std::vector<float> velocity(cellCount * 3);
+	for (int z = 0; z < n; z++)
+		for (int y = 0; y < n; y++)
+			for (int x = 0; x < n; x++)
+			{
+				float* v = &velocity[(x + n * (y + n * z)) * 3];
+				float u = (float)x / n, w = (float)y / n, s = (float)z / n;
+				v[0] = sinf(6.0f * w + 2.0f * s) + 0.3f * noise(random);
+				v[1] = cosf(5.0f * u - 3.0f * s) + 0.3f * noise(random);
+				v[2] = sinf(4.0f * u + 7.0f * w) + 0.3f * noise(random);
+			}
+
+	// Divergence, the same way DivergenceCS computes it
+	std::vector<float> divergence(cellCount);
+	for (int z = 0; z < n; z++)
+		for (int y = 0; y < n; y++)
+			for (int x = 0; x < n; x++)
+			{
+				int neighbors[6] = {
+					CLAMP_INDEX(x - 1, n) + n * (y + n * z),
+					CLAMP_INDEX(x + 1, n) + n * (y + n * z),
+					x + n * (CLAMP_INDEX(y - 1, n) + n * z),
+					x + n * (CLAMP_INDEX(y + 1, n) + n * z),
+					x + n * (y + n * CLAMP_INDEX(z - 1, n)),
+					x + n * (y + n * CLAMP_INDEX(z + 1, n)) };
+				int index = x + n * (y + n * z);
+
+				float vel[6];
+				for (int i = 0; i < 6; i++)
+				{
+					// Walls and the edges of the grid don't move
+					bool wall = obstacles[neighbors[i]] || neighbors[i] == index;
+					vel[i] = wall ? 0.0f : velocity[neighbors[i] * 3 + i / 2];
+				}
+				divergence[index] = 0.5f * ((vel[1] - vel[0]) + (vel[3] - vel[2]) + (vel[5] - vel[4]));
+			}
+
+	PressureSolver solver(n, n, n, obstacles.data());
+	PressureConvergenceResults results = {};
+	results.GridSize = n;
+	results.JacobiIterations = jacobiIterations;
+
+	float passesPerCycle = solver.GetMultigridPassesPerCycle(smoothIterations);
+	results.MultigridCycles = std::max(1, (int)(jacobiIterations / passesPerCycle + 0.5f));
+	results.MultigridPasses = results.MultigridCycles * passesPerCycle;
+
+	std::vector<float> pressure(cellCount, 0.0f);
+	results.DivergenceNorm = solver.ResidualNorm(divergence.data(), pressure.data());
+
+	solver.Jacobi(divergence.data(), pressure.data(), jacobiIterations);
+	results.JacobiResidualNorm = solver.ResidualNorm(divergence.data(), pressure.data());
+
+	std::fill(pressure.begin(), pressure.end(), 0.0f);
+	solver.Multigrid(divergence.data(), pressure.data(), results.MultigridCycles, smoothIterations);
+	results.MultigridResidualNorm = solver.ResidualNorm(divergence.data(), pressure.data());
+
+	return results;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <vector>
+
+// Shared with the multigrid compute shaders, so both solvers do
+// exactly the same work - keep them in sync
+#define MULTIGRID_SMOOTH_WEIGHT (6.0f / 7.0f)	// Damped Jacobi weight for smoothing
+#define MULTIGRID_COARSEST_SIZE 4				// Stop coarsening at this many cells on an axis
+#define MULTIGRID_COARSE_ITERATIONS 16			// Smoothing sweeps that "solve" the coarsest level
+
+// --------------------------------------------------------
+// Results of solving the same pressure problem with Jacobi
+// iterations and with multigrid V-cycles for about the same
+// amount of work
+// --------------------------------------------------------
+struct PressureConvergenceResults
+{
+	int GridSize;
+	int JacobiIterations;
+	int MultigridCycles;
+	float MultigridPasses;			// Work for those cycles, in full grid sweeps
+	float DivergenceNorm;			// RMS of the divergence (the residual before solving)
+	float JacobiResidualNorm;		// RMS residual after the Jacobi iterations
+	float MultigridResidualNorm;	// RMS residual after the V-cycles
+};
+
+// --------------------------------------------------------
+// CPU reference for FluidField's pressure solvers, over flat
+// arrays indexed x + sizeX * (y + sizeY * z).
+//
+// Solves the same discrete Poisson problem as PressureCS:
+// the sum of the six neighbors' pressures minus six times
+// this cell's equals the divergence, with any neighbor that
+// is outside the grid or an obstacle using this cell's
+// pressure instead (so nothing flows through walls).
+//
+// Jacobi() matches PressureCS.  Multigrid() matches the
+// Multigrid*CS shaders: damped Jacobi smoothing, residuals
+// restricted to a pyramid of half-sized grids, a few sweeps
+// on the coarsest grid, then corrections prolonged back up
+// with trilinear interpolation.
+// --------------------------------------------------------
+class PressureSolver
+{
+public:
+	PressureSolver(int sizeX, int sizeY, int sizeZ, const unsigned char* obstacles = 0);
+
+	void Jacobi(const float* divergence, float* pressure, int iterations);
+	void Multigrid(const float* divergence, float* pressure, int cycles, int smoothIterations);
+	float ResidualNorm(const float* divergence, const float* pressure);
+
+	int GetLevelCount();
+	float GetMultigridPassesPerCycle(int smoothIterations);
+
+	static PressureConvergenceResults TestConvergence(int gridSize, int jacobiIterations, int smoothIterations);
+
+private:
+	// One grid of the multigrid pyramid (level 0 is full size)
+	struct Level
+	{
+		int SizeX;
+		int SizeY;
+		int SizeZ;
+		std::vector<float> Pressure;
+		std::vector<float> PressureTemp;	// Jacobi ping-pongs between these
+		std::vector<float> Divergence;		// Right hand side (restricted residual below level 0)
+		std::vector<float> Residual;
+		std::vector<unsigned char> Obstacles;
+	};
+	std::vector<Level> levels;
+
+	void Smooth(Level& level, int iterations, float weight);
+	void Residual(Level& level);
+	void Restrict(const Level& fine, Level& coarse);
+	void Prolong(const Level& coarse, Level& fine);
+	void VCycle(int level, int smoothIterations);
+};
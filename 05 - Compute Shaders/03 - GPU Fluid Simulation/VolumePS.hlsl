@@ -14,6 +14,7 @@ cbuffer externalData : register(b0)
 	float3 cameraPosition;
 	int renderMode;
 	int raymarchSamples;
+	float4 volumeScale;		// The volume's values are stored divided by this
 }
 
 struct VertexToPixel
@@ -95,7 +96,7 @@ float4 main(VertexToPixel input) : SV_TARGET
 	{
 		// Get the current position in UVW space and sample the texture
 		float3 uvw = currentPos + float3(0.5f, 0.5f, 0.5f);
-		float4 color = volumeTexture.SampleLevel(SamplerLinearClamp, uvw, 0);
+		float4 color = volumeTexture.SampleLevel(SamplerLinearClamp, uvw, 0) * volumeScale;
 
 		// Which rendering mode?
 		if (renderMode == RENDER_MODE_DEBUG)
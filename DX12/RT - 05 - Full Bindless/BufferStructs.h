@@ -32,6 +32,8 @@ struct RaytracingSceneData
 	DirectX::XMFLOAT3 skyUpColor;
 	DirectX::XMFLOAT3 skyDownColor;
 	unsigned int accumulationFrameCount;
+	unsigned int lightCount;
+	int lightSampling;
 };
 
 struct RaytracingMaterial
@@ -0,0 +1,846 @@
+#include "CPUBVH.h"
+
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+#include <emmintrin.h>
+
+using namespace DirectX;
+
+// Centroid bins tested along each axis for a split
+#define SAH_BIN_COUNT 16
+
+// Cost of stepping through a node, relative to testing a
+// triangle (both are a handful of SSE operations per packet)
+#define SAH_TRAVERSAL_COST 1.0f
+
+// Leaves are split even when the SAH says not to once they
+// would hold more than this many items
+#define MESH_MAX_LEAF_SIZE 8
+#define SCENE_MAX_LEAF_SIZE 2
+
+// Bounds and centroid of something being built over
+struct BuildItem
+{
+	float Min[3];
+	float Max[3];
+	float Center[3];
+};
+
+// Bounds and item count of a centroid bin
+struct BuildBin
+{
+	float Min[3];
+	float Max[3];
+	unsigned int Count;
+};
+
+// Half the surface area of a box, which is all the SAH needs
+static float HalfArea(const float min[3], const float max[3])
+{
+	float x = max[0] - min[0];
+	float y = max[1] - min[1];
+	float z = max[2] - min[2];
+	return x * y + y * z + z * x;
+}
+
+static void ResetBounds(float min[3], float max[3])
+{
+	for (int a = 0; a < 3; a++)
+	{
+		min[a] = FLT_MAX;
+		max[a] = -FLT_MAX;
+	}
+}
+
+static void GrowBounds(float min[3], float max[3], const float otherMin[3], const float otherMax[3])
+{
+	for (int a = 0; a < 3; a++)
+	{
+		min[a] = std::min(min[a], otherMin[a]);
+		max[a] = std::max(max[a], otherMax[a]);
+	}
+}
+
+
+// --------------------------------------------------------
+// Builds the node for a run of items and then, recursively,
+// everything below it, picking each split with the binned
+// SAH.  Nodes are laid out depth first, so a node's first
+// child is always the very next node.
+//
+// items - Bounds of everything being built over
+// order - Item indices, reordered so each leaf's items
+//         are contiguous
+// first & count - The run of the order in this node
+// maxLeafSize - Largest leaf the SAH may choose
+// depth - Depth of this node (the root is 1)
+// maxDepth - Deepest node so far
+// --------------------------------------------------------
+static void BuildNode(
+	std::vector<CPUBVHNode>& nodes,
+	const std::vector<BuildItem>& items,
+	std::vector<unsigned int>& order,
+	unsigned int first,
+	unsigned int count,
+	unsigned int maxLeafSize,
+	unsigned int depth,
+	unsigned int& maxDepth)
+{
+	maxDepth = std::max(maxDepth, depth);
+
+	// Bounds of the items and of their centroids
+	float boundsMin[3], boundsMax[3];
+	float centerMin[3], centerMax[3];
+	ResetBounds(boundsMin, boundsMax);
+	ResetBounds(centerMin, centerMax);
+	for (unsigned int i = first; i < first + count; i++)
+	{
+		const BuildItem& item = items[order[i]];
+		GrowBounds(boundsMin, boundsMax, item.Min, item.Max);
+		GrowBounds(centerMin, centerMax, item.Center, item.Center);
+	}
+
+	unsigned int index = (unsigned int)nodes.size();
+	CPUBVHNode node = {};
+	node.BoundsMin = XMFLOAT3(boundsMin[0], boundsMin[1], boundsMin[2]);
+	node.BoundsMax = XMFLOAT3(boundsMax[0], boundsMax[1], boundsMax[2]);
+	node.Child = (int)first;
+	node.Count = (int)count;
+	nodes.push_back(node);
+
+	// Too deep to split any further?
+	if (count == 1 || depth >= CPU_BVH_MAX_DEPTH)
+		return;
+
+	// Find the cheapest split between bins along any axis
+	float bestCost = FLT_MAX;
+	int bestAxis = -1;
+	int bestSplit = 0;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float extent = centerMax[axis] - centerMin[axis];
+		if (extent <= 0.0f)
+			continue;
+
+		BuildBin bins[SAH_BIN_COUNT];
+		for (int b = 0; b < SAH_BIN_COUNT; b++)
+		{
+			ResetBounds(bins[b].Min, bins[b].Max);
+			bins[b].Count = 0;
+		}
+
+		float scale = SAH_BIN_COUNT / extent;
+		for (unsigned int i = first; i < first + count; i++)
+		{
+			const BuildItem& item = items[order[i]];
+			int b = std::min((int)((item.Center[axis] - centerMin[axis]) * scale), SAH_BIN_COUNT - 1);
+			GrowBounds(bins[b].Min, bins[b].Max, item.Min, item.Max);
+			bins[b].Count++;
+		}
+
+		// Sweep from the right, saving the area and count of
+		// everything past each split, then from the left
+		float rightArea[SAH_BIN_COUNT];
+		unsigned int rightCount[SAH_BIN_COUNT];
+		float sweepMin[3], sweepMax[3];
+		unsigned int sweepCount = 0;
+		ResetBounds(sweepMin, sweepMax);
+		for (int b = SAH_BIN_COUNT - 1; b > 0; b--)
+		{
+			GrowBounds(sweepMin, sweepMax, bins[b].Min, bins[b].Max);
+			sweepCount += bins[b].Count;
+			rightArea[b] = sweepCount > 0 ? HalfArea(sweepMin, sweepMax) : 0.0f;
+			rightCount[b] = sweepCount;
+		}
+
+		sweepCount = 0;
+		ResetBounds(sweepMin, sweepMax);
+		for (int b = 0; b < SAH_BIN_COUNT - 1; b++)
+		{
+			GrowBounds(sweepMin, sweepMax, bins[b].Min, bins[b].Max);
+			sweepCount += bins[b].Count;
+			if (sweepCount == 0 || rightCount[b + 1] == 0)
+				continue;
+
+			float cost = HalfArea(sweepMin, sweepMax) * sweepCount + rightArea[b + 1] * rightCount[b + 1];
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = b;
+			}
+		}
+	}
+
+	// Compare against just testing everything here
+	unsigned int half = 0;
+	float area = HalfArea(boundsMin, boundsMax);
+	if (bestAxis >= 0)
+	{
+		float splitCost = SAH_TRAVERSAL_COST + (area > 0.0f ? bestCost / area : (float)count);
+		if (splitCost >= (float)count && count <= maxLeafSize)
+			return;
+
+		float scale = SAH_BIN_COUNT / (centerMax[bestAxis] - centerMin[bestAxis]);
+		unsigned int* middle = std::partition(
+			&order[first],
+			&order[first] + count,
+			[&](unsigned int i)
+			{
+				int b = std::min((int)((items[i].Center[bestAxis] - centerMin[bestAxis]) * scale), SAH_BIN_COUNT - 1);
+				return b <= bestSplit;
+			});
+		half = (unsigned int)(middle - &order[first]);
+	}
+	else
+	{
+		// Every centroid is in the same place, so only split
+		// (anywhere) if there are too many to leave together
+		if (count <= maxLeafSize)
+			return;
+
+		bestAxis = 0;
+		half = count / 2;
+	}
+
+	// First child goes right after this node, the second
+	// after everything below the first
+	nodes[index].Count = -1 - bestAxis;
+	BuildNode(nodes, items, order, first, half, maxLeafSize, depth + 1, maxDepth);
+	nodes[index].Child = (int)nodes.size();
+	BuildNode(nodes, items, order, first + half, count - half, maxLeafSize, depth + 1, maxDepth);
+}
+
+
+// === SIMD ray packet kernels ===
+
+// A ray packet loaded into SSE registers, along with what
+// the box test needs: the reciprocal of each direction and
+// the origin scaled by it
+struct PacketSIMD
+{
+	__m128 OriginX, OriginY, OriginZ;
+	__m128 DirectionX, DirectionY, DirectionZ;
+	__m128 InverseX, InverseY, InverseZ;
+	__m128 ScaledOriginX, ScaledOriginY, ScaledOriginZ;
+	__m128 TMin;
+	__m128 Active;
+	bool Negative[3];	// Direction signs of the first active ray, for picking which child to visit first
+};
+
+static bool LoadPacket(const CPURayPacket& packet, PacketSIMD& simd)
+{
+	alignas(16) float inverse[3][CPU_RAY_PACKET_SIZE];
+	alignas(16) int active[CPU_RAY_PACKET_SIZE];
+	const float* directions[3] = { packet.DirectionX, packet.DirectionY, packet.DirectionZ };
+	for (int i = 0; i < CPU_RAY_PACKET_SIZE; i++)
+	{
+		// Keep zero components finite, so the slab test never sees 0 * infinity
+		for (int a = 0; a < 3; a++)
+		{
+			float d = directions[a][i];
+			inverse[a][i] = 1.0f / (std::abs(d) > 1e-20f ? d : std::copysign(1e-20f, d));
+		}
+		active[i] = packet.Active[i] ? -1 : 0;
+	}
+
+	simd.OriginX = _mm_load_ps(packet.OriginX);
+	simd.OriginY = _mm_load_ps(packet.OriginY);
+	simd.OriginZ = _mm_load_ps(packet.OriginZ);
+	simd.DirectionX = _mm_load_ps(packet.DirectionX);
+	simd.DirectionY = _mm_load_ps(packet.DirectionY);
+	simd.DirectionZ = _mm_load_ps(packet.DirectionZ);
+	simd.InverseX = _mm_load_ps(inverse[0]);
+	simd.InverseY = _mm_load_ps(inverse[1]);
+	simd.InverseZ = _mm_load_ps(inverse[2]);
+	simd.ScaledOriginX = _mm_mul_ps(simd.OriginX, simd.InverseX);
+	simd.ScaledOriginY = _mm_mul_ps(simd.OriginY, simd.InverseY);
+	simd.ScaledOriginZ = _mm_mul_ps(simd.OriginZ, simd.InverseZ);
+	simd.TMin = _mm_load_ps(packet.TMin);
+	simd.Active = _mm_castsi128_ps(_mm_load_si128((const __m128i*)active));
+
+	int mask = _mm_movemask_ps(simd.Active);
+	if (mask == 0)
+		return false;
+
+	int lane = 0;
+	while (!(mask & (1 << lane)))
+		lane++;
+	for (int a = 0; a < 3; a++)
+		simd.Negative[a] = directions[a][lane] < 0.0f;
+	return true;
+}
+
+// Slab test of a node's bounds against every ray in the
+// packet, returning a mask of the (active) rays that enter
+// the bounds between their TMin and tMax
+static inline __m128 IntersectBox(const CPUBVHNode& node, const PacketSIMD& r, __m128 active, __m128 tMax)
+{
+	__m128 x1 = _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(node.BoundsMin.x), r.InverseX), r.ScaledOriginX);
+	__m128 x2 = _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(node.BoundsMax.x), r.InverseX), r.ScaledOriginX);
+	__m128 y1 = _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(node.BoundsMin.y), r.InverseY), r.ScaledOriginY);
+	__m128 y2 = _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(node.BoundsMax.y), r.InverseY), r.ScaledOriginY);
+	__m128 z1 = _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(node.BoundsMin.z), r.InverseZ), r.ScaledOriginZ);
+	__m128 z2 = _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(node.BoundsMax.z), r.InverseZ), r.ScaledOriginZ);
+
+	__m128 tNear = _mm_max_ps(
+		_mm_max_ps(_mm_min_ps(x1, x2), _mm_min_ps(y1, y2)),
+		_mm_max_ps(_mm_min_ps(z1, z2), r.TMin));
+	__m128 tFar = _mm_min_ps(
+		_mm_min_ps(_mm_max_ps(x1, x2), _mm_max_ps(y1, y2)),
+		_mm_min_ps(_mm_max_ps(z1, z2), tMax));
+
+	return _mm_and_ps(_mm_cmple_ps(tNear, tFar), active);
+}
+
+// Moller-Trumbore test of one triangle against every ray in
+// the packet, returning a mask of the (active) rays that hit
+// it between their TMin and tMax, along with where
+static inline __m128 IntersectTriangle(
+	const CPUBVHTriangle& tri,
+	const PacketSIMD& r,
+	__m128 active,
+	__m128 tMax,
+	__m128& t,
+	__m128& u,
+	__m128& v,
+	__m128& det)
+{
+	__m128 e1x = _mm_set1_ps(tri.Edge1.x), e1y = _mm_set1_ps(tri.Edge1.y), e1z = _mm_set1_ps(tri.Edge1.z);
+	__m128 e2x = _mm_set1_ps(tri.Edge2.x), e2y = _mm_set1_ps(tri.Edge2.y), e2z = _mm_set1_ps(tri.Edge2.z);
+
+	// P = D x E2
+	__m128 px = _mm_sub_ps(_mm_mul_ps(r.DirectionY, e2z), _mm_mul_ps(r.DirectionZ, e2y));
+	__m128 py = _mm_sub_ps(_mm_mul_ps(r.DirectionZ, e2x), _mm_mul_ps(r.DirectionX, e2z));
+	__m128 pz = _mm_sub_ps(_mm_mul_ps(r.DirectionX, e2y), _mm_mul_ps(r.DirectionY, e2x));
+	det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+	__m128 inverseDet = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+	// T = O - V0
+	__m128 tx = _mm_sub_ps(r.OriginX, _mm_set1_ps(tri.Vertex0.x));
+	__m128 ty = _mm_sub_ps(r.OriginY, _mm_set1_ps(tri.Vertex0.y));
+	__m128 tz = _mm_sub_ps(r.OriginZ, _mm_set1_ps(tri.Vertex0.z));
+	u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)), inverseDet);
+
+	// Q = T x E1
+	__m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+	__m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+	__m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+	v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(r.DirectionX, qx), _mm_mul_ps(r.DirectionY, qy)), _mm_mul_ps(r.DirectionZ, qz)), inverseDet);
+	t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inverseDet);
+
+	// Comparisons with NaN are false, so degenerate triangles
+	// (a determinant of zero) never hit
+	__m128 zero = _mm_setzero_ps();
+	__m128 hit = _mm_and_ps(active, _mm_cmpge_ps(u, zero));
+	hit = _mm_and_ps(hit, _mm_cmpge_ps(v, zero));
+	hit = _mm_and_ps(hit, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f)));
+	hit = _mm_and_ps(hit, _mm_cmpgt_ps(t, r.TMin));
+	hit = _mm_and_ps(hit, _mm_cmplt_ps(t, tMax));
+	return _mm_and_ps(hit, _mm_cmpneq_ps(det, zero));
+}
+
+static inline __m128 Select(__m128 mask, __m128 a, __m128 b)
+{
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+// Closest hits of a packet, kept in registers while tracing
+struct HitsSIMD
+{
+	__m128 T, U, V, Instance, Primitive, FrontFace;
+
+	void Load(const CPURayHits& hits)
+	{
+		T = _mm_load_ps(hits.T);
+		U = _mm_load_ps(hits.U);
+		V = _mm_load_ps(hits.V);
+		Instance = _mm_castsi128_ps(_mm_load_si128((const __m128i*)hits.Instance));
+		Primitive = _mm_castsi128_ps(_mm_load_si128((const __m128i*)hits.Primitive));
+		FrontFace = _mm_castsi128_ps(_mm_load_si128((const __m128i*)hits.FrontFace));
+	}
+
+	void Store(CPURayHits& hits) const
+	{
+		_mm_store_ps(hits.T, T);
+		_mm_store_ps(hits.U, U);
+		_mm_store_ps(hits.V, V);
+		_mm_store_si128((__m128i*)hits.Instance, _mm_castps_si128(Instance));
+		_mm_store_si128((__m128i*)hits.Primitive, _mm_castps_si128(Primitive));
+		_mm_store_si128((__m128i*)hits.FrontFace, _mm_castps_si128(FrontFace));
+	}
+
+	void Update(__m128 hit, __m128 t, __m128 u, __m128 v, __m128 det, int instance, unsigned int primitive)
+	{
+		T = Select(hit, t, T);
+		U = Select(hit, u, U);
+		V = Select(hit, v, V);
+		Instance = Select(hit, _mm_castsi128_ps(_mm_set1_epi32(instance)), Instance);
+		Primitive = Select(hit, _mm_castsi128_ps(_mm_set1_epi32((int)primitive)), Primitive);
+
+		// Triangles are clockwise from the side their E1 x E2 normal faces
+		__m128 front = _mm_and_ps(_mm_cmpgt_ps(det, _mm_setzero_ps()), _mm_castsi128_ps(_mm_set1_epi32(1)));
+		FrontFace = Select(hit, front, FrontFace);
+	}
+};
+
+
+// --------------------------------------------------------
+// Constructor - the tree is empty until Build()
+// --------------------------------------------------------
+CPUMeshBVH::CPUMeshBVH() :
+	depth(0)
+{
+}
+
+
+// --------------------------------------------------------
+// Builds the tree over a mesh's triangles
+//
+// positions - The first vertex's position (three floats)
+// positionStride - Bytes from one position to the next
+// vertexCount - How many vertices there are
+// indices - Three per triangle
+// indexCount - How many indices there are
+// --------------------------------------------------------
+void CPUMeshBVH::Build(
+	const float* positions,
+	size_t positionStride,
+	size_t vertexCount,
+	const unsigned int* indices,
+	size_t indexCount)
+{
+	nodes.clear();
+	triangles.clear();
+	depth = 0;
+
+	// Bounds of each triangle (leaving out any that reference
+	// vertices that don't exist)
+	std::vector<BuildItem> items;
+	std::vector<CPUBVHTriangle> unordered;
+	items.reserve(indexCount / 3);
+	unordered.reserve(indexCount / 3);
+	for (size_t i = 0; i + 2 < indexCount; i += 3)
+	{
+		if (indices[i] >= vertexCount || indices[i + 1] >= vertexCount || indices[i + 2] >= vertexCount)
+			continue;
+
+		const float* v[3];
+		for (int c = 0; c < 3; c++)
+			v[c] = (const float*)((const char*)positions + positionStride * indices[i + c]);
+
+		BuildItem item = {};
+		ResetBounds(item.Min, item.Max);
+		for (int c = 0; c < 3; c++)
+			GrowBounds(item.Min, item.Max, v[c], v[c]);
+		for (int a = 0; a < 3; a++)
+			item.Center[a] = (item.Min[a] + item.Max[a]) * 0.5f;
+		items.push_back(item);
+
+		CPUBVHTriangle tri = {};
+		tri.Vertex0 = XMFLOAT3(v[0][0], v[0][1], v[0][2]);
+		tri.Edge1 = XMFLOAT3(v[1][0] - v[0][0], v[1][1] - v[0][1], v[1][2] - v[0][2]);
+		tri.Edge2 = XMFLOAT3(v[2][0] - v[0][0], v[2][1] - v[0][1], v[2][2] - v[0][2]);
+		tri.Primitive = (unsigned int)(i / 3);
+		unordered.push_back(tri);
+	}
+
+	if (items.empty())
+		return;
+
+	std::vector<unsigned int> order(items.size());
+	for (size_t i = 0; i < order.size(); i++)
+		order[i] = (unsigned int)i;
+
+	nodes.reserve(items.size() * 2 / MESH_MAX_LEAF_SIZE + 1);
+	BuildNode(nodes, items, order, 0, (unsigned int)items.size(), MESH_MAX_LEAF_SIZE, 1, depth);
+
+	// Store the triangles in leaf order, so each leaf's
+	// triangles are next to each other in memory
+	triangles.resize(order.size());
+	for (size_t i = 0; i < order.size(); i++)
+		triangles[i] = unordered[order[i]];
+}
+
+
+// --------------------------------------------------------
+// Getters for the results of the most recent Build()
+// --------------------------------------------------------
+const std::vector<CPUBVHNode>& CPUMeshBVH::GetNodes() const { return nodes; }
+const std::vector<CPUBVHTriangle>& CPUMeshBVH::GetTriangles() const { return triangles; }
+unsigned int CPUMeshBVH::GetDepth() const { return depth; }
+
+
+// --------------------------------------------------------
+// Finds the closest triangle each active ray in the packet
+// hits, if it's closer than the hit it already has
+//
+// packet - Rays in this mesh's space
+// hits - Closest hits so far, updated in place
+// instance - Recorded with any hits found
+// --------------------------------------------------------
+void CPUMeshBVH::Intersect(const CPURayPacket& packet, CPURayHits& hits, int instance) const
+{
+	PacketSIMD r;
+	if (nodes.empty() || !LoadPacket(packet, r))
+		return;
+
+	HitsSIMD closest;
+	closest.Load(hits);
+
+	int stack[CPU_BVH_MAX_DEPTH + 1];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize > 0)
+	{
+		int index = stack[--stackSize];
+		const CPUBVHNode& node = nodes[index];
+		if (!_mm_movemask_ps(IntersectBox(node, r, r.Active, closest.T)))
+			continue;
+
+		if (node.Count >= 0)
+		{
+			for (int i = node.Child; i < node.Child + node.Count; i++)
+			{
+				__m128 t, u, v, det;
+				__m128 hit = IntersectTriangle(triangles[i], r, r.Active, closest.T, t, u, v, det);
+				if (_mm_movemask_ps(hit))
+					closest.Update(hit, t, u, v, det, instance, triangles[i].Primitive);
+			}
+			continue;
+		}
+
+		// Visit the child nearer the packet's rays first
+		if (r.Negative[-1 - node.Count])
+		{
+			stack[stackSize++] = index + 1;
+			stack[stackSize++] = node.Child;
+		}
+		else
+		{
+			stack[stackSize++] = node.Child;
+			stack[stackSize++] = index + 1;
+		}
+	}
+
+	closest.Store(hits);
+}
+
+
+// --------------------------------------------------------
+// Checks whether each active ray in the packet hits any
+// triangle before tMax, stopping as soon as all of them do
+//
+// packet - Rays in this mesh's space
+// tMax - How far along each ray to look
+//
+// Returns a bit mask of the rays that hit something
+// --------------------------------------------------------
+int CPUMeshBVH::Occluded(const CPURayPacket& packet, const float tMax[CPU_RAY_PACKET_SIZE]) const
+{
+	PacketSIMD r;
+	if (nodes.empty() || !LoadPacket(packet, r))
+		return 0;
+
+	__m128 t = _mm_loadu_ps(tMax);
+	__m128 active = r.Active;
+
+	int stack[CPU_BVH_MAX_DEPTH + 1];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize > 0)
+	{
+		int index = stack[--stackSize];
+		const CPUBVHNode& node = nodes[index];
+		if (!_mm_movemask_ps(IntersectBox(node, r, active, t)))
+			continue;
+
+		if (node.Count >= 0)
+		{
+			for (int i = node.Child; i < node.Child + node.Count; i++)
+			{
+				__m128 hitT, u, v, det;
+				__m128 hit = IntersectTriangle(triangles[i], r, active, t, hitT, u, v, det);
+				active = _mm_andnot_ps(hit, active);
+			}
+
+			// Everything's blocked?
+			if (!_mm_movemask_ps(active))
+				break;
+			continue;
+		}
+
+		if (r.Negative[-1 - node.Count])
+		{
+			stack[stackSize++] = index + 1;
+			stack[stackSize++] = node.Child;
+		}
+		else
+		{
+			stack[stackSize++] = node.Child;
+			stack[stackSize++] = index + 1;
+		}
+	}
+
+	return _mm_movemask_ps(_mm_andnot_ps(active, r.Active));
+}
+
+
+// --------------------------------------------------------
+// Constructor - the tree is empty until Build()
+// --------------------------------------------------------
+CPUSceneBVH::CPUSceneBVH()
+{
+}
+
+
+// --------------------------------------------------------
+// Rebuilds the tree over a set of instances.  This only
+// looks at each mesh's root bounds, so it's cheap enough to
+// do whenever anything moves.
+//
+// instances - The meshes and where they are (the inverse
+//             world matrices are filled in here)
+// --------------------------------------------------------
+void CPUSceneBVH::Build(const std::vector<CPUBVHInstance>& instances)
+{
+	this->instances = instances;
+	nodes.clear();
+	order.clear();
+
+	// World space bounds of each instance's mesh, leaving out
+	// instances with nothing to hit
+	std::vector<BuildItem> items(instances.size());
+	for (size_t i = 0; i < instances.size(); i++)
+	{
+		CPUBVHInstance& instance = this->instances[i];
+		XMMATRIX world = XMLoadFloat4x4(&instance.World);
+		XMStoreFloat4x4(&instance.InverseWorld, XMMatrixInverse(0, world));
+
+		if (!instance.Mesh || instance.Mesh->GetNodes().empty())
+			continue;
+
+		const CPUBVHNode& root = instance.Mesh->GetNodes()[0];
+		BuildItem& item = items[i];
+		ResetBounds(item.Min, item.Max);
+		for (int corner = 0; corner < 8; corner++)
+		{
+			XMFLOAT3 local(
+				corner & 1 ? root.BoundsMax.x : root.BoundsMin.x,
+				corner & 2 ? root.BoundsMax.y : root.BoundsMin.y,
+				corner & 4 ? root.BoundsMax.z : root.BoundsMin.z);
+
+			XMFLOAT3 position;
+			XMStoreFloat3(&position, XMVector3TransformCoord(XMLoadFloat3(&local), world));
+			float p[3] = { position.x, position.y, position.z };
+			GrowBounds(item.Min, item.Max, p, p);
+		}
+		for (int a = 0; a < 3; a++)
+			item.Center[a] = (item.Min[a] + item.Max[a]) * 0.5f;
+
+		order.push_back((unsigned int)i);
+	}
+
+	if (order.empty())
+		return;
+
+	unsigned int depth = 0;
+	BuildNode(nodes, items, order, 0, (unsigned int)order.size(), SCENE_MAX_LEAF_SIZE, 1, depth);
+}
+
+
+// --------------------------------------------------------
+// Getters for the results of the most recent Build()
+// --------------------------------------------------------
+const std::vector<CPUBVHNode>& CPUSceneBVH::GetNodes() const { return nodes; }
+const std::vector<CPUBVHInstance>& CPUSceneBVH::GetInstances() const { return instances; }
+
+
+// --------------------------------------------------------
+// Finds the closest hit of each active ray in the packet,
+// if it's closer than the hit it already has
+//
+// packet - Rays in world space
+// hits - Closest hits so far, updated in place (Instance
+//        is an index into the instances passed to Build())
+// --------------------------------------------------------
+void CPUSceneBVH::Intersect(const CPURayPacket& packet, CPURayHits& hits) const
+{
+	PacketSIMD r;
+	if (nodes.empty() || !LoadPacket(packet, r))
+		return;
+
+	CPURayPacket objectPacket;
+	int stack[CPU_BVH_MAX_DEPTH + 1];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize > 0)
+	{
+		int index = stack[--stackSize];
+		const CPUBVHNode& node = nodes[index];
+		if (!_mm_movemask_ps(IntersectBox(node, r, r.Active, _mm_load_ps(hits.T))))
+			continue;
+
+		if (node.Count >= 0)
+		{
+			for (int i = node.Child; i < node.Child + node.Count; i++)
+			{
+				const CPUBVHInstance& instance = instances[order[i]];
+				TransformPacket(instance, packet, objectPacket);
+				instance.Mesh->Intersect(objectPacket, hits, (int)order[i]);
+			}
+			continue;
+		}
+
+		if (r.Negative[-1 - node.Count])
+		{
+			stack[stackSize++] = index + 1;
+			stack[stackSize++] = node.Child;
+		}
+		else
+		{
+			stack[stackSize++] = node.Child;
+			stack[stackSize++] = index + 1;
+		}
+	}
+}
+
+
+// --------------------------------------------------------
+// Checks whether each active ray in the packet hits
+// anything before tMax, for shadow rays
+//
+// packet - Rays in world space
+// tMax - How far along each ray to look
+//
+// Returns a bit mask of the rays that hit something
+// --------------------------------------------------------
+int CPUSceneBVH::Occluded(const CPURayPacket& packet, const float tMax[CPU_RAY_PACKET_SIZE]) const
+{
+	PacketSIMD r;
+	if (nodes.empty() || !LoadPacket(packet, r))
+		return 0;
+
+	int activeMask = _mm_movemask_ps(r.Active);
+	int occluded = 0;
+	__m128 t = _mm_loadu_ps(tMax);
+
+	CPURayPacket objectPacket;
+	int stack[CPU_BVH_MAX_DEPTH + 1];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize > 0)
+	{
+		// Only rays that are still unblocked need to go on
+		__m128 active = _mm_castsi128_ps(_mm_set_epi32(
+			(activeMask & ~occluded) & 8 ? -1 : 0,
+			(activeMask & ~occluded) & 4 ? -1 : 0,
+			(activeMask & ~occluded) & 2 ? -1 : 0,
+			(activeMask & ~occluded) & 1 ? -1 : 0));
+
+		int index = stack[--stackSize];
+		const CPUBVHNode& node = nodes[index];
+		if (!_mm_movemask_ps(IntersectBox(node, r, active, t)))
+			continue;
+
+		if (node.Count >= 0)
+		{
+			for (int i = node.Child; i < node.Child + node.Count && occluded != activeMask; i++)
+			{
+				const CPUBVHInstance& instance = instances[order[i]];
+				TransformPacket(instance, packet, objectPacket);
+				for (int lane = 0; lane < CPU_RAY_PACKET_SIZE; lane++)
+					objectPacket.Active[lane] &= !(occluded & (1 << lane));
+
+				occluded |= instance.Mesh->Occluded(objectPacket, tMax);
+			}
+
+			if (occluded == activeMask)
+				break;
+			continue;
+		}
+
+		if (r.Negative[-1 - node.Count])
+		{
+			stack[stackSize++] = index + 1;
+			stack[stackSize++] = node.Child;
+		}
+		else
+		{
+			stack[stackSize++] = node.Child;
+			stack[stackSize++] = index + 1;
+		}
+	}
+
+	return occluded;
+}
+
+
+// --------------------------------------------------------
+// Finds the closest hits by testing every triangle of every
+// instance, to check the trees against
+// --------------------------------------------------------
+void CPUSceneBVH::IntersectBruteForce(const CPURayPacket& packet, CPURayHits& hits) const
+{
+	HitsSIMD closest;
+	closest.Load(hits);
+
+	CPURayPacket objectPacket;
+	for (size_t i = 0; i < instances.size(); i++)
+	{
+		PacketSIMD r;
+		TransformPacket(instances[i], packet, objectPacket);
+		if (!instances[i].Mesh || !LoadPacket(objectPacket, r))
+			continue;
+
+		for (const CPUBVHTriangle& tri : instances[i].Mesh->GetTriangles())
+		{
+			__m128 t, u, v, det;
+			__m128 hit = IntersectTriangle(tri, r, r.Active, closest.T, t, u, v, det);
+			if (_mm_movemask_ps(hit))
+				closest.Update(hit, t, u, v, det, (int)i, tri.Primitive);
+		}
+	}
+
+	closest.Store(hits);
+}
+
+
+// --------------------------------------------------------
+// Moves a packet of world space rays into an instance's
+// object space.  Directions aren't normalized afterwards,
+// so a distance along a ray is the same in both spaces.
+// --------------------------------------------------------
+void CPUSceneBVH::TransformPacket(const CPUBVHInstance& instance, const CPURayPacket& packet, CPURayPacket& objectPacket) const
+{
+	const XMFLOAT4X4& m = instance.InverseWorld;
+	__m128 ox = _mm_load_ps(packet.OriginX);
+	__m128 oy = _mm_load_ps(packet.OriginY);
+	__m128 oz = _mm_load_ps(packet.OriginZ);
+	__m128 dx = _mm_load_ps(packet.DirectionX);
+	__m128 dy = _mm_load_ps(packet.DirectionY);
+	__m128 dz = _mm_load_ps(packet.DirectionZ);
+
+	// Row vectors times the matrix, like XMVector3Transform()
+	for (int c = 0; c < 3; c++)
+	{
+		__m128 origin = _mm_add_ps(
+			_mm_add_ps(_mm_mul_ps(ox, _mm_set1_ps(m.m[0][c])), _mm_mul_ps(oy, _mm_set1_ps(m.m[1][c]))),
+			_mm_add_ps(_mm_mul_ps(oz, _mm_set1_ps(m.m[2][c])), _mm_set1_ps(m.m[3][c])));
+		__m128 direction = _mm_add_ps(
+			_mm_add_ps(_mm_mul_ps(dx, _mm_set1_ps(m.m[0][c])), _mm_mul_ps(dy, _mm_set1_ps(m.m[1][c]))),
+			_mm_mul_ps(dz, _mm_set1_ps(m.m[2][c])));
+
+		float* origins[3] = { objectPacket.OriginX, objectPacket.OriginY, objectPacket.OriginZ };
+		float* directions[3] = { objectPacket.DirectionX, objectPacket.DirectionY, objectPacket.DirectionZ };
+		_mm_store_ps(origins[c], origin);
+		_mm_store_ps(directions[c], direction);
+	}
+
+	for (int lane = 0; lane < CPU_RAY_PACKET_SIZE; lane++)
+	{
+		objectPacket.TMin[lane] = packet.TMin[lane];
+		objectPacket.Active[lane] = packet.Active[lane];
+	}
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <DirectXMath.h>
+#include <vector>
+
+// Rays traced together by the SIMD kernels (one per SSE lane)
+#define CPU_RAY_PACKET_SIZE 4
+
+// Deepest tree the traversal stack can hold - the builders
+// stop splitting (making bigger leaves) before reaching it
+#define CPU_BVH_MAX_DEPTH 64
+
+// --------------------------------------------------------
+// A single node of a CPU BVH, laid out depth first like
+// the light BVH's nodes
+// --------------------------------------------------------
+struct CPUBVHNode
+{
+	DirectX::XMFLOAT3	BoundsMin;
+	int					Child;		// Second child of an interior node (the first is always
+									// the very next node), or the first item of a leaf
+	DirectX::XMFLOAT3	BoundsMax;
+	int					Count;		// Items in a leaf, or -1 - split axis for an interior node
+};
+
+// --------------------------------------------------------
+// A triangle of a CPU mesh BVH, stored the way the ray
+// intersection test wants it
+// --------------------------------------------------------
+struct CPUBVHTriangle
+{
+	DirectX::XMFLOAT3	Vertex0;
+	DirectX::XMFLOAT3	Edge1;		// Vertex1 - Vertex0
+	DirectX::XMFLOAT3	Edge2;		// Vertex2 - Vertex0
+	unsigned int		Primitive;	// Index of the triangle in the mesh's index buffer
+};
+
+// --------------------------------------------------------
+// A packet of rays, stored a component at a time so each
+// SSE lane holds one ray.  Lanes that aren't active are
+// skipped entirely.
+// --------------------------------------------------------
+struct alignas(16) CPURayPacket
+{
+	float OriginX[CPU_RAY_PACKET_SIZE];
+	float OriginY[CPU_RAY_PACKET_SIZE];
+	float OriginZ[CPU_RAY_PACKET_SIZE];
+	float DirectionX[CPU_RAY_PACKET_SIZE];
+	float DirectionY[CPU_RAY_PACKET_SIZE];
+	float DirectionZ[CPU_RAY_PACKET_SIZE];
+	float TMin[CPU_RAY_PACKET_SIZE];
+	int Active[CPU_RAY_PACKET_SIZE];
+};
+
+// --------------------------------------------------------
+// Closest hits of a ray packet.  T starts out as each ray's
+// TMax and shrinks as closer hits are found.  U and V match
+// DXR's barycentrics (the weights of the second and third
+// vertices) and Instance stays -1 for rays that miss.
+// --------------------------------------------------------
+struct alignas(16) CPURayHits
+{
+	float T[CPU_RAY_PACKET_SIZE];
+	float U[CPU_RAY_PACKET_SIZE];
+	float V[CPU_RAY_PACKET_SIZE];
+	int Instance[CPU_RAY_PACKET_SIZE];
+	int Primitive[CPU_RAY_PACKET_SIZE];
+	int FrontFace[CPU_RAY_PACKET_SIZE];	// Clockwise from the ray, like HIT_KIND_TRIANGLE_FRONT_FACE
+};
+
+// --------------------------------------------------------
+// Bounding volume hierarchy over the triangles of a single
+// mesh - the CPU's version of a bottom level acceleration
+// structure.
+//
+// Built top down with the surface area heuristic: at each
+// node the triangles' centroids are sorted into bins along
+// each axis, and the split between bins with the lowest
+// expected cost of tracing a ray through both children is
+// taken.  A node becomes a leaf when no split is cheaper
+// than testing all of its triangles.
+// --------------------------------------------------------
+class CPUMeshBVH
+{
+public:
+	CPUMeshBVH();
+
+	void Build(
+		const float* positions,
+		size_t positionStride,
+		size_t vertexCount,
+		const unsigned int* indices,
+		size_t indexCount);
+
+	const std::vector<CPUBVHNode>& GetNodes() const;
+	const std::vector<CPUBVHTriangle>& GetTriangles() const;
+	unsigned int GetDepth() const;
+
+	void Intersect(const CPURayPacket& packet, CPURayHits& hits, int instance) const;
+	int Occluded(const CPURayPacket& packet, const float tMax[CPU_RAY_PACKET_SIZE]) const;
+
+private:
+	std::vector<CPUBVHNode> nodes;
+	std::vector<CPUBVHTriangle> triangles;
+	unsigned int depth;
+};
+
+// --------------------------------------------------------
+// A placed copy of a mesh BVH.  World is a DirectXMath
+// (row vector) world matrix, like Transform's.
+// --------------------------------------------------------
+struct CPUBVHInstance
+{
+	const CPUMeshBVH*		Mesh;
+	DirectX::XMFLOAT4X4		World;
+	DirectX::XMFLOAT4X4		InverseWorld;
+};
+
+// --------------------------------------------------------
+// Bounding volume hierarchy over mesh instances - the CPU's
+// version of a top level acceleration structure.  Built
+// with the same binned SAH over the instances' world space
+// bounds.  Rays that reach an instance are moved into its
+// object space (without normalizing their directions, so
+// distances along them stay the same) and traced through
+// its mesh BVH.
+// --------------------------------------------------------
+class CPUSceneBVH
+{
+public:
+	CPUSceneBVH();
+
+	void Build(const std::vector<CPUBVHInstance>& instances);
+
+	const std::vector<CPUBVHNode>& GetNodes() const;
+	const std::vector<CPUBVHInstance>& GetInstances() const;
+
+	void Intersect(const CPURayPacket& packet, CPURayHits& hits) const;
+	int Occluded(const CPURayPacket& packet, const float tMax[CPU_RAY_PACKET_SIZE]) const;
+
+	void IntersectBruteForce(const CPURayPacket& packet, CPURayHits& hits) const;
+
+private:
+	std::vector<CPUBVHInstance> instances;
+	std::vector<CPUBVHNode> nodes;
+
+	// Instance indices, in leaf order
+	std::vector<unsigned int> order;
+
+	void TransformPacket(const CPUBVHInstance& instance, const CPURayPacket& packet, CPURayPacket& objectPacket) const;
+};
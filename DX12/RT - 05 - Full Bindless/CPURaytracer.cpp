@@ -0,0 +1,895 @@
+#include "CPURaytracer.h"
+
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <string>
+
+using namespace DirectX;
+
+// These should match Raytracing.hlsl
+#define PI			3.141592654f
+#define RAY_T_MIN	0.0001f
+#define RAY_T_MAX	1000.0f
+
+// Pixels along each side of the square each job renders
+// (must be even, so 2x2 packets never straddle two jobs)
+#define TILE_SIZE 16
+
+
+// === Helpers, named after their HLSL counterparts ===
+
+static XMFLOAT3 Add(XMFLOAT3 a, XMFLOAT3 b) { return XMFLOAT3(a.x + b.x, a.y + b.y, a.z + b.z); }
+static XMFLOAT3 Sub(XMFLOAT3 a, XMFLOAT3 b) { return XMFLOAT3(a.x - b.x, a.y - b.y, a.z - b.z); }
+static XMFLOAT3 Mul(XMFLOAT3 a, XMFLOAT3 b) { return XMFLOAT3(a.x * b.x, a.y * b.y, a.z * b.z); }
+static XMFLOAT3 Scale(XMFLOAT3 a, float s) { return XMFLOAT3(a.x * s, a.y * s, a.z * s); }
+static float Dot(XMFLOAT3 a, XMFLOAT3 b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+static float Saturate(float x) { return std::min(std::max(x, 0.0f), 1.0f); }
+
+static XMFLOAT3 Normalize(XMFLOAT3 a)
+{
+	float length = std::sqrt(Dot(a, a));
+	return length > 0.0f ? Scale(a, 1.0f / length) : a;
+}
+
+static XMFLOAT3 Lerp(XMFLOAT3 a, XMFLOAT3 b, float t)
+{
+	return Add(a, Scale(Sub(b, a), t));
+}
+
+static XMFLOAT3 Reflect(XMFLOAT3 incident, XMFLOAT3 normal)
+{
+	return Sub(incident, Scale(normal, 2.0f * Dot(normal, incident)));
+}
+
+// Row vector times the upper 3x3 of a matrix, like
+// mul(normal, (float3x3)ObjectToWorld4x3())
+static XMFLOAT3 TransformNormal(XMFLOAT3 n, const XMFLOAT4X4& m)
+{
+	return XMFLOAT3(
+		n.x * m._11 + n.y * m._21 + n.z * m._31,
+		n.x * m._12 + n.y * m._22 + n.z * m._32,
+		n.x * m._13 + n.y * m._23 + n.z * m._33);
+}
+
+// Must match rand() in Raytracing.hlsl
+static float Rand(float x, float y)
+{
+	float s = std::sin(x * 12.9898f + y * 78.233f) * 43758.5453f;
+	return s - std::floor(s);
+}
+
+// Must match rand2() in Raytracing.hlsl
+static void Rand2(float x, float y, float& randX, float& randY)
+{
+	randX = Rand(x, y);
+	randY = std::sqrt(1.0f - randX * randX);
+}
+
+// Must match RandomCosineWeightedHemisphere() in Raytracing.hlsl
+static XMFLOAT3 RandomCosineWeightedHemisphere(float u0, float u1, XMFLOAT3 unitNormal)
+{
+	float a = u0 * 2 - 1;
+	float b = std::sqrt(1 - a * a);
+	float phi = 2.0f * PI * u1;
+
+	return XMFLOAT3(
+		unitNormal.x + b * std::cos(phi),
+		unitNormal.y + b * std::sin(phi),
+		unitNormal.z + a);
+}
+
+// Must match FresnelSchlick() in Raytracing.hlsl
+static float FresnelSchlick(float NdotV, float indexOfRefraction)
+{
+	float r0 = (1.0f - indexOfRefraction) / (1.0f + indexOfRefraction);
+	r0 *= r0;
+	return r0 + (1.0f - r0) * std::pow(1 - NdotV, 5.0f);
+}
+
+// Must match FresnelView() in Raytracing.hlsl
+static float FresnelView(XMFLOAT3 n, XMFLOAT3 v, float f0)
+{
+	float NdotV = Saturate(Dot(n, v));
+	return f0 + (1 - f0) * std::pow(1 - NdotV, 5.0f);
+}
+
+// Must match TryRefract() in Raytracing.hlsl
+static bool TryRefract(XMFLOAT3 incident, XMFLOAT3 normal, float ior, XMFLOAT3& refr)
+{
+	float NdotI = Dot(normal, incident);
+	float k = 1.0f - ior * ior * (1.0f - NdotI * NdotI);
+	if (k < 0.0f)
+	{
+		refr = XMFLOAT3(0, 0, 0);
+		return false;
+	}
+
+	refr = Sub(Scale(incident, ior), Scale(normal, ior * NdotI + std::sqrt(k)));
+	return true;
+}
+
+static void ResetHits(CPURayHits& hits)
+{
+	for (int lane = 0; lane < CPU_RAY_PACKET_SIZE; lane++)
+	{
+		hits.T[lane] = RAY_T_MAX;
+		hits.U[lane] = 0.0f;
+		hits.V[lane] = 0.0f;
+		hits.Instance[lane] = -1;
+		hits.Primitive[lane] = -1;
+		hits.FrontFace[lane] = 0;
+	}
+}
+
+static unsigned int CountLanes(int mask)
+{
+	unsigned int count = 0;
+	for (int lane = 0; lane < CPU_RAY_PACKET_SIZE; lane++)
+		count += (mask >> lane) & 1;
+	return count;
+}
+
+static void BuildMeshBVH(Mesh* mesh, CPUMeshBVH& bvh)
+{
+	const std::vector<Vertex>& vertices = mesh->GetVertices();
+	const std::vector<unsigned int>& indices = mesh->GetIndices();
+	if (vertices.empty() || indices.empty())
+	{
+		bvh.Build(0, 0, 0, 0, 0);
+		return;
+	}
+
+	bvh.Build(&vertices[0].Position.x, sizeof(Vertex), vertices.size(), &indices[0], indices.size());
+}
+
+
+// --------------------------------------------------------
+// Constructor - there's nothing to render until SetScene()
+//
+// threadCount - Threads to trace with, or 0 for one per core
+// --------------------------------------------------------
+CPURaytracer::CPURaytracer(unsigned int threadCount) :
+	jobs(threadCount)
+{
+}
+
+
+// --------------------------------------------------------
+// Sets up the scene BVH for a set of entities, building
+// BVHs for any of their meshes that don't have one yet.
+// Call this again whenever entities move or change.
+//
+// entities - A scene's entities (like Scene::GetEntities())
+// lights - That scene's lights
+// --------------------------------------------------------
+void CPURaytracer::SetScene(const std::vector<std::shared_ptr<GameEntity>>& entities, const std::vector<Light>& lights)
+{
+	// New meshes, built a mesh per job
+	std::vector<MeshBVH*> newMeshes;
+	for (const std::shared_ptr<GameEntity>& entity : entities)
+	{
+		std::shared_ptr<Mesh> mesh = entity->GetMesh();
+		if (!mesh || meshBVHs.count(mesh.get()))
+			continue;
+
+		std::unique_ptr<MeshBVH> meshBVH = std::make_unique<MeshBVH>();
+		meshBVH->SourceMesh = mesh;
+		newMeshes.push_back(meshBVH.get());
+		meshBVHs[mesh.get()] = std::move(meshBVH);
+	}
+	jobs.Run((unsigned int)newMeshes.size(), [&](unsigned int i) { BuildMeshBVH(newMeshes[i]->SourceMesh.get(), newMeshes[i]->BVH); });
+
+	// An instance per entity, along with what its hit shader
+	// would find in the material cbuffer
+	std::vector<CPUBVHInstance> instances;
+	instanceShading.clear();
+	for (const std::shared_ptr<GameEntity>& entity : entities)
+	{
+		std::shared_ptr<Mesh> mesh = entity->GetMesh();
+		if (!mesh)
+			continue;
+
+		CPUBVHInstance instance = {};
+		instance.Mesh = &meshBVHs[mesh.get()]->BVH;
+		instance.World = entity->GetTransform()->GetWorldMatrix();
+		instances.push_back(instance);
+
+		std::shared_ptr<Material> material = entity->GetMaterial();
+		InstanceShading shading = {};
+		shading.SourceMesh = mesh.get();
+		shading.World = instance.World;
+		shading.Color = material->GetColorTint();
+		shading.Roughness = material->GetRoughness();
+		shading.Metal = material->GetMetal();
+		shading.EmissiveIntensity = material->GetEmissiveIntensity();
+		shading.Type = material->GetType();
+		instanceShading.push_back(shading);
+	}
+	sceneBVH.Build(instances);
+
+	this->lights = lights;
+	lightBVH.Build(lights.empty() ? 0 : &lights[0], (unsigned int)lights.size());
+}
+
+
+// --------------------------------------------------------
+// Getters
+// --------------------------------------------------------
+const CPUSceneBVH& CPURaytracer::GetSceneBVH() const { return sceneBVH; }
+unsigned int CPURaytracer::GetThreadCount() const { return jobs.GetThreadCount(); }
+
+
+// --------------------------------------------------------
+// Renders the scene, like a single DispatchRays() of
+// Raytracing.hlsl, in square tiles spread across threads
+//
+// settings - The camera and raytracing options
+// colors - Filled with the average linear color of each
+//          pixel's rays, top row first (no gamma correction)
+// --------------------------------------------------------
+CPURaytracerStats CPURaytracer::Render(const CPURaytracerSettings& settings, std::vector<XMFLOAT3>& colors)
+{
+	CPURaytracerStats stats = {};
+	stats.ThreadCount = jobs.GetThreadCount();
+	colors.assign((size_t)settings.Width * settings.Height, XMFLOAT3(0, 0, 0));
+	if (colors.empty())
+		return stats;
+
+	unsigned int tilesX = (settings.Width + TILE_SIZE - 1) / TILE_SIZE;
+	unsigned int tilesY = (settings.Height + TILE_SIZE - 1) / TILE_SIZE;
+	std::atomic<unsigned long long> rays(0);
+
+	auto start = std::chrono::high_resolution_clock::now();
+	jobs.Run(tilesX * tilesY, [&](unsigned int tile)
+	{
+		unsigned int tileX = (tile % tilesX) * TILE_SIZE;
+		unsigned int tileY = (tile / tilesX) * TILE_SIZE;
+		unsigned int endX = std::min(tileX + TILE_SIZE, settings.Width);
+		unsigned int endY = std::min(tileY + TILE_SIZE, settings.Height);
+
+		unsigned long long tileRays = 0;
+		for (unsigned int y = tileY; y < endY; y += 2)
+			for (unsigned int x = tileX; x < endX; x += 2)
+				TracePixels(settings, x, y, colors, tileRays);
+		rays += tileRays;
+	});
+	auto end = std::chrono::high_resolution_clock::now();
+
+	stats.Milliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+	stats.Rays = rays;
+	stats.MraysPerSecond = stats.Milliseconds > 0.0 ? stats.Rays / (stats.Milliseconds * 1000.0) : 0.0;
+	return stats;
+}
+
+
+// --------------------------------------------------------
+// Times building every BVH and tracing the current scene,
+// and checks the BVHs against testing every triangle
+//
+// settings - The camera and raytracing options
+// validationRays - Random rays through the scene's bounds
+//                  to check (each against every triangle)
+// --------------------------------------------------------
+CPURaytracerBenchmark CPURaytracer::Benchmark(const CPURaytracerSettings& settings, unsigned int validationRays)
+{
+	CPURaytracerBenchmark results = {};
+	results.Width = settings.Width;
+	results.Height = settings.Height;
+	results.ThreadCount = jobs.GetThreadCount();
+	results.Instances = (unsigned int)instanceShading.size();
+
+	// Every mesh BVH from scratch, then the scene BVH
+	std::vector<MeshBVH*> allMeshes;
+	for (auto& pair : meshBVHs)
+		allMeshes.push_back(pair.second.get());
+
+	std::vector<CPUBVHInstance> instances = sceneBVH.GetInstances();
+	auto start = std::chrono::high_resolution_clock::now();
+	jobs.Run((unsigned int)allMeshes.size(), [&](unsigned int i) { BuildMeshBVH(allMeshes[i]->SourceMesh.get(), allMeshes[i]->BVH); });
+	auto sceneStart = std::chrono::high_resolution_clock::now();
+	sceneBVH.Build(instances);
+	auto end = std::chrono::high_resolution_clock::now();
+	results.BuildMilliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+	results.SceneBuildMilliseconds = std::chrono::duration<double, std::milli>(end - sceneStart).count();
+
+	results.Meshes = (unsigned int)allMeshes.size();
+	for (MeshBVH* mesh : allMeshes)
+	{
+		results.Triangles += (unsigned int)mesh->BVH.GetTriangles().size();
+		results.MaxDepth = std::max(results.MaxDepth, mesh->BVH.GetDepth());
+	}
+
+	unsigned int blocksX = (settings.Width + 1) / 2;
+	unsigned int blocksY = (settings.Height + 1) / 2;
+	double cameraRays = (double)settings.Width * settings.Height;
+	if (cameraRays > 0.0 && !sceneBVH.GetNodes().empty())
+	{
+		// Camera rays, 2x2 pixels at a time
+		std::vector<CPURayHits> blockHits((size_t)blocksX * blocksY);
+		start = std::chrono::high_resolution_clock::now();
+		jobs.Run(blocksY, [&](unsigned int blockY)
+		{
+			CPURayPacket packet;
+			for (unsigned int blockX = 0; blockX < blocksX; blockX++)
+			{
+				CPURayHits& hits = blockHits[(size_t)blockY * blocksX + blockX];
+				MakeCameraPacket(settings, blockX * 2, blockY * 2, 0.0f, 0xF, packet);
+				ResetHits(hits);
+				sceneBVH.Intersect(packet, hits);
+			}
+		});
+		end = std::chrono::high_resolution_clock::now();
+		results.PacketMraysPerSecond = cameraRays / (std::chrono::duration<double>(end - start).count() * 1000000.0);
+
+		// The same rays, one at a time
+		start = std::chrono::high_resolution_clock::now();
+		jobs.Run(blocksY, [&](unsigned int blockY)
+		{
+			CPURayPacket packet;
+			CPURayHits hits;
+			for (unsigned int blockX = 0; blockX < blocksX; blockX++)
+			{
+				for (int lane = 0; lane < CPU_RAY_PACKET_SIZE; lane++)
+				{
+					MakeCameraPacket(settings, blockX * 2, blockY * 2, 0.0f, 1 << lane, packet);
+					if (!packet.Active[lane])
+						continue;
+
+					ResetHits(hits);
+					sceneBVH.Intersect(packet, hits);
+				}
+			}
+		});
+		end = std::chrono::high_resolution_clock::now();
+		results.SingleMraysPerSecond = cameraRays / (std::chrono::duration<double>(end - start).count() * 1000000.0);
+
+		// Shadow rays from each hit toward the top of the scene
+		const CPUBVHNode& root = sceneBVH.GetNodes()[0];
+		XMFLOAT3 target(
+			(root.BoundsMin.x + root.BoundsMax.x) * 0.5f,
+			root.BoundsMax.y,
+			(root.BoundsMin.z + root.BoundsMax.z) * 0.5f);
+
+		std::atomic<unsigned long long> shadowRays(0);
+		start = std::chrono::high_resolution_clock::now();
+		jobs.Run(blocksY, [&](unsigned int blockY)
+		{
+			CPURayPacket packet;
+			CPURayPacket shadowPacket;
+			alignas(16) float tMax[CPU_RAY_PACKET_SIZE];
+			unsigned long long rowRays = 0;
+			for (unsigned int blockX = 0; blockX < blocksX; blockX++)
+			{
+				const CPURayHits& hits = blockHits[(size_t)blockY * blocksX + blockX];
+				MakeCameraPacket(settings, blockX * 2, blockY * 2, 0.0f, 0xF, packet);
+				for (int lane = 0; lane < CPU_RAY_PACKET_SIZE; lane++)
+				{
+					XMFLOAT3 origin(
+						packet.OriginX[lane] + packet.DirectionX[lane] * hits.T[lane],
+						packet.OriginY[lane] + packet.DirectionY[lane] * hits.T[lane],
+						packet.OriginZ[lane] + packet.DirectionZ[lane] * hits.T[lane]);
+					XMFLOAT3 toTarget = Sub(target, origin);
+					tMax[lane] = std::sqrt(Dot(toTarget, toTarget));
+					toTarget = Normalize(toTarget);
+
+					shadowPacket.OriginX[lane] = origin.x;
+					shadowPacket.OriginY[lane] = origin.y;
+					shadowPacket.OriginZ[lane] = origin.z;
+					shadowPacket.DirectionX[lane] = toTarget.x;
+					shadowPacket.DirectionY[lane] = toTarget.y;
+					shadowPacket.DirectionZ[lane] = toTarget.z;
+					shadowPacket.TMin[lane] = RAY_T_MIN;
+					shadowPacket.Active[lane] = packet.Active[lane] && hits.Instance[lane] >= 0 && tMax[lane] > 0.0f;
+					rowRays += shadowPacket.Active[lane] ? 1 : 0;
+				}
+				sceneBVH.Occluded(shadowPacket, tMax);
+			}
+			shadowRays += rowRays;
+		});
+		end = std::chrono::high_resolution_clock::now();
+		results.ShadowMraysPerSecond = shadowRays / (std::chrono::duration<double>(end - start).count() * 1000000.0);
+
+		// A whole frame
+		std::vector<XMFLOAT3> colors;
+		results.PathMraysPerSecond = Render(settings, colors).MraysPerSecond;
+	}
+
+	// Random rays from inside the scene's bounds, in random
+	// directions, against every triangle of every instance
+	if (!sceneBVH.GetNodes().empty())
+	{
+		const CPUBVHNode& root = sceneBVH.GetNodes()[0];
+		unsigned int state = 12345;
+		auto random = [&]()
+		{
+			state = state * 1664525u + 1013904223u;
+			return (state >> 8) * (1.0f / 16777216.0f);
+		};
+
+		CPURayPacket packet;
+		CPURayHits hits;
+		CPURayHits expected;
+		for (unsigned int r = 0; r < validationRays; r += CPU_RAY_PACKET_SIZE)
+		{
+			for (int lane = 0; lane < CPU_RAY_PACKET_SIZE; lane++)
+			{
+				packet.OriginX[lane] = root.BoundsMin.x + (root.BoundsMax.x - root.BoundsMin.x) * random();
+				packet.OriginY[lane] = root.BoundsMin.y + (root.BoundsMax.y - root.BoundsMin.y) * random();
+				packet.OriginZ[lane] = root.BoundsMin.z + (root.BoundsMax.z - root.BoundsMin.z) * random();
+
+				float z = random() * 2.0f - 1.0f;
+				float phi = random() * 2.0f * PI;
+				float radius = std::sqrt(1.0f - z * z);
+				packet.DirectionX[lane] = radius * std::cos(phi);
+				packet.DirectionY[lane] = radius * std::sin(phi);
+				packet.DirectionZ[lane] = z;
+				packet.TMin[lane] = RAY_T_MIN;
+				packet.Active[lane] = 1;
+			}
+
+			ResetHits(hits);
+			ResetHits(expected);
+			sceneBVH.Intersect(packet, hits);
+			sceneBVH.IntersectBruteForce(packet, expected);
+
+			// Ties between triangles may pick either one, but the
+			// distance has to match
+			for (int lane = 0; lane < CPU_RAY_PACKET_SIZE; lane++)
+			{
+				bool hit = hits.Instance[lane] >= 0;
+				bool expectedHit = expected.Instance[lane] >= 0;
+				if (hit != expectedHit || (hit && std::abs(hits.T[lane] - expected.T[lane]) > 0.0001f * std::max(1.0f, expected.T[lane])))
+					results.Mismatches++;
+			}
+			results.ValidationRays += CPU_RAY_PACKET_SIZE;
+		}
+	}
+
+	results.Passed = results.Mismatches == 0;
+	return results;
+}
+
+
+// --------------------------------------------------------
+// Traces every ray for a 2x2 block of pixels, following
+// RayGen() and the hit shaders in Raytracing.hlsl.  Each
+// pixel's rays go in its own lane, so each packet starts
+// out coherent and only drifts apart as the paths bounce.
+//
+// x & y - Top left pixel of the block
+// colors - Where the block's pixels go
+// rays - Incremented by the number of rays traced
+// --------------------------------------------------------
+void CPURaytracer::TracePixels(const CPURaytracerSettings& settings, unsigned int x, unsigned int y, std::vector<XMFLOAT3>& colors, unsigned long long& rays) const
+{
+	XMFLOAT3 totals[CPU_RAY_PACKET_SIZE] = {};
+	int raysPerPixel = std::max(settings.RaysPerPixel, 1);
+
+	CPURayPacket packet;
+	CPURayPacket shadowPacket;
+	CPURayHits hits;
+	alignas(16) float shadowTMax[CPU_RAY_PACKET_SIZE];
+	for (int r = 0; r < raysPerPixel; r++)
+	{
+		// Every pixel's ray is offset the same way, along both axes
+		float offset = Rand((float)r / raysPerPixel, (float)r / raysPerPixel);
+		MakeCameraPacket(settings, x, y, offset, 0xF, packet);
+
+		PathState paths[CPU_RAY_PACKET_SIZE];
+		int alive = 0;
+		for (int lane = 0; lane < CPU_RAY_PACKET_SIZE; lane++)
+		{
+			PathState& path = paths[lane];
+			path.Throughput = XMFLOAT3(1, 1, 1);
+			path.Direct = XMFLOAT3(0, 0, 0);
+			path.Color = XMFLOAT3(0, 0, 0);
+			path.Origin = XMFLOAT3(packet.OriginX[lane], packet.OriginY[lane], packet.OriginZ[lane]);
+			path.Direction = XMFLOAT3(packet.DirectionX[lane], packet.DirectionY[lane], packet.DirectionZ[lane]);
+			path.Depth = 0;
+			path.Alive = packet.Active[lane] != 0;
+			alive |= path.Alive ? 1 << lane : 0;
+		}
+
+		// One bounce of every path at a time
+		while (alive)
+		{
+			for (int lane = 0; lane < CPU_RAY_PACKET_SIZE; lane++)
+			{
+				const PathState& path = paths[lane];
+				packet.OriginX[lane] = path.Origin.x;
+				packet.OriginY[lane] = path.Origin.y;
+				packet.OriginZ[lane] = path.Origin.z;
+				packet.DirectionX[lane] = path.Direction.x;
+				packet.DirectionY[lane] = path.Direction.y;
+				packet.DirectionZ[lane] = path.Direction.z;
+				packet.TMin[lane] = RAY_T_MIN;
+				packet.Active[lane] = path.Alive;
+			}
+
+			ResetHits(hits);
+			sceneBVH.Intersect(packet, hits);
+			rays += CountLanes(alive);
+
+			// Shade each hit, collecting the shadow rays the
+			// direct lighting needs into a packet of their own
+			XMFLOAT3 directLight[CPU_RAY_PACKET_SIZE];
+			int shadowed = 0;
+			for (int lane = 0; lane < CPU_RAY_PACKET_SIZE; lane++)
+			{
+				shadowPacket.Active[lane] = 0;
+				if (!paths[lane].Alive)
+					continue;
+
+				XMFLOAT3 toLight;
+				if (Shade(settings, hits, lane, x + (lane & 1), y + (lane >> 1), r, paths[lane], directLight[lane], toLight, shadowTMax[lane]))
+				{
+					// The path has moved on to the hit, which is where the shadow ray starts
+					shadowPacket.OriginX[lane] = paths[lane].Origin.x;
+					shadowPacket.OriginY[lane] = paths[lane].Origin.y;
+					shadowPacket.OriginZ[lane] = paths[lane].Origin.z;
+					shadowPacket.DirectionX[lane] = toLight.x;
+					shadowPacket.DirectionY[lane] = toLight.y;
+					shadowPacket.DirectionZ[lane] = toLight.z;
+					shadowPacket.TMin[lane] = RAY_T_MIN;
+					shadowPacket.Active[lane] = 1;
+					shadowed |= 1 << lane;
+				}
+				else
+				{
+					shadowTMax[lane] = 0.0f;
+				}
+
+				if (!paths[lane].Alive)
+					alive &= ~(1 << lane);
+			}
+
+			if (shadowed)
+			{
+				int blocked = sceneBVH.Occluded(shadowPacket, shadowTMax);
+				rays += CountLanes(shadowed);
+				for (int lane = 0; lane < CPU_RAY_PACKET_SIZE; lane++)
+				{
+					if ((shadowed & ~blocked) & (1 << lane))
+						paths[lane].Direct = Add(paths[lane].Direct, directLight[lane]);
+				}
+			}
+		}
+
+		for (int lane = 0; lane < CPU_RAY_PACKET_SIZE; lane++)
+			totals[lane] = Add(totals[lane], paths[lane].Color);
+	}
+
+	for (int lane = 0; lane < CPU_RAY_PACKET_SIZE; lane++)
+	{
+		unsigned int px = x + (lane & 1);
+		unsigned int py = y + (lane >> 1);
+		if (px < settings.Width && py < settings.Height)
+			colors[(size_t)py * settings.Width + px] = Scale(totals[lane], 1.0f / raysPerPixel);
+	}
+}
+
+
+// --------------------------------------------------------
+// Does what the shaders in Raytracing.hlsl do with one
+// lane's trace: ends the path on a miss, an emissive hit or
+// at the maximum depth, or picks its next bounce
+//
+// hits - Closest hits of the packet the path was traced in
+// lane - The path's lane
+// x & y - The path's pixel (DispatchRaysIndex())
+// rayPerPixelIndex - Which of the pixel's rays this is
+// path - Ended (Alive cleared and Color set) or moved on
+//        to its next bounce
+// directLight, toLight & lightDistance - Filled in if this
+//        returns true, for the caller to add to the path
+//        if a shadow ray along toLight isn't blocked
+// --------------------------------------------------------
+bool CPURaytracer::Shade(
+	const CPURaytracerSettings& settings,
+	const CPURayHits& hits,
+	int lane,
+	unsigned int x,
+	unsigned int y,
+	int rayPerPixelIndex,
+	PathState& path,
+	XMFLOAT3& directLight,
+	XMFLOAT3& toLight,
+	float& lightDistance) const
+{
+	// Miss() - with the sky gradient, as the sky box is only on the GPU
+	if (hits.Instance[lane] < 0)
+	{
+		float interpolation = Normalize(path.Direction).y * 0.5f + 0.5f;
+		XMFLOAT3 sky = Lerp(settings.SkyDownColor, settings.SkyUpColor, interpolation);
+		path.Color = Add(Mul(path.Throughput, sky), path.Direct);
+		path.Alive = false;
+		return false;
+	}
+
+	const InstanceShading& instance = instanceShading[hits.Instance[lane]];
+	float t = hits.T[lane];
+
+	// ClosestHitEmissive()
+	if (instance.Type == MaterialType::Emissive)
+	{
+		path.Color = Add(Mul(Scale(instance.Color, instance.EmissiveIntensity), path.Throughput), path.Direct);
+		path.Alive = false;
+		return false;
+	}
+
+	// Out of bounces without finding a light
+	if ((int)path.Depth == settings.MaxRecursionDepth)
+	{
+		path.Color = path.Direct;
+		path.Alive = false;
+		return false;
+	}
+
+	// Interpolated world space normal, like GetHitDetails()
+	const std::vector<Vertex>& vertices = instance.SourceMesh->GetVertices();
+	const std::vector<unsigned int>& indices = instance.SourceMesh->GetIndices();
+	unsigned int first = (unsigned int)hits.Primitive[lane] * 3;
+	float weights[3] = { 1.0f - hits.U[lane] - hits.V[lane], hits.U[lane], hits.V[lane] };
+	XMFLOAT3 normal(0, 0, 0);
+	for (int i = 0; i < 3; i++)
+		normal = Add(normal, Scale(vertices[indices[first + i]].Normal, weights[i]));
+	normal = Normalize(TransformNormal(normal, instance.World));
+
+	XMFLOAT3 hitPosition = Add(path.Origin, Scale(path.Direction, t));
+
+	// Random numbers seeded from the pixel, the bounce, the
+	// ray and the hit distance, in the shaders' order
+	float uvX = (float)x / settings.Width * (path.Depth + 1) + rayPerPixelIndex;
+	float uvY = (float)y / settings.Height * (path.Depth + 1) + rayPerPixelIndex;
+	uvX = uvX + t + settings.AccumulationFrameCount;
+	uvY = uvY + t + settings.AccumulationFrameCount;
+	float rngX, rngY;
+	Rand2(uvX, uvY, rngX, rngY);
+
+	// ClosestHitTransparent()
+	if (instance.Type == MaterialType::Transparent)
+	{
+		path.Throughput = Mul(path.Throughput, instance.Color);
+
+		float ior = 1.5f;
+		if (hits.FrontFace[lane])
+			ior = 1.0f / ior;
+		else
+			normal = Scale(normal, -1.0f);
+
+		float NdotV = -Dot(path.Direction, normal);
+		bool reflectFresnel = FresnelSchlick(NdotV, ior) > Rand(rngX, rngY);
+
+		XMFLOAT3 dir;
+		if (reflectFresnel || !TryRefract(path.Direction, normal, ior, dir))
+			dir = Reflect(path.Direction, normal);
+
+		XMFLOAT3 randomBounce = RandomCosineWeightedHemisphere(Rand(rngX, rngY), Rand(rngY, rngX), normal);
+		path.Direction = Normalize(Lerp(dir, randomBounce, Saturate(instance.Roughness * instance.Roughness)));
+		path.Origin = hitPosition;
+		path.Depth++;
+		return false;
+	}
+
+	// ClosestHit() - textured materials use their tint
+	float roughness = Saturate(instance.Roughness * instance.Roughness);
+	XMFLOAT3 surfaceColor = instance.Color;
+	float metal = instance.Metal;
+	float randChance = Rand(uvX, uvY);
+
+	// Direct lighting from one point light, using the throughput
+	// that reached this surface
+	bool needsShadowRay = false;
+	XMFLOAT3 contribution;
+	if (settings.LightSampling != LIGHT_SAMPLING_NONE &&
+		SampleDirectLight(settings, hitPosition, normal, Rand(uvX + rngX, uvY + rngY), contribution, toLight, lightDistance))
+	{
+		directLight = Mul(Mul(path.Throughput, surfaceColor), Scale(contribution, 1 - metal));
+		needsShadowRay = true;
+	}
+
+	// Interpolate between perfect reflection and random bounce based on roughness,
+	// then between that and a fully random bounce based on fresnel
+	XMFLOAT3 refl = Reflect(path.Direction, normal);
+	XMFLOAT3 randomBounce = Normalize(RandomCosineWeightedHemisphere(Rand(rngX, rngY), Rand(rngY, rngX), normal));
+	XMFLOAT3 dir = Normalize(Lerp(refl, randomBounce, roughness));
+
+	float fres = FresnelView(Scale(path.Direction, -1.0f), normal, 0.04f + (1.0f - 0.04f) * metal);
+	bool specular = fres > randChance;
+	dir = Normalize(specular ? dir : randomBounce);
+
+	XMFLOAT3 roughnessBounceColor = Lerp(XMFLOAT3(1, 1, 1), surfaceColor, roughness);
+	XMFLOAT3 diffuseColor = specular ? roughnessBounceColor : surfaceColor;
+	path.Throughput = Mul(path.Throughput, Lerp(diffuseColor, surfaceColor, metal));
+
+	path.Origin = hitPosition;
+	path.Direction = dir;
+	path.Depth++;
+	return needsShadowRay;
+}
+
+
+// --------------------------------------------------------
+// Picks a light for next event estimation like
+// SampleDirectLight() in Raytracing.hlsl, leaving the
+// shadow ray to the caller
+//
+// position & normal - The surface being lit
+// u - Random number between 0 and 1
+// contribution - The light's diffuse lighting divided by
+//                the chance of picking it
+// toLight & lightDistance - Direction and distance of the
+//                light, for the shadow ray
+//
+// Returns false if no light was picked or it has no effect
+// --------------------------------------------------------
+bool CPURaytracer::SampleDirectLight(
+	const CPURaytracerSettings& settings,
+	XMFLOAT3 position,
+	XMFLOAT3 normal,
+	float u,
+	XMFLOAT3& contribution,
+	XMFLOAT3& toLight,
+	float& lightDistance) const
+{
+	if (lights.empty())
+		return false;
+
+	// Pick a light
+	int lightIndex;
+	float pdf;
+	if (settings.LightSampling == LIGHT_SAMPLING_BVH)
+	{
+		lightIndex = lightBVH.SampleLight(position, normal, u, pdf);
+	}
+	else
+	{
+		unsigned int lightCount = (unsigned int)lights.size();
+		lightIndex = (int)std::min((unsigned int)(u * lightCount), lightCount - 1);
+		pdf = 1.0f / lightCount;
+	}
+
+	if (lightIndex < 0 || pdf <= 0.0f)
+		return false;
+
+	const Light& light = lights[lightIndex];
+	if (light.Type != LIGHT_TYPE_POINT)
+		return false;
+
+	// LightContribution(), in color rather than luminance
+	// like LightBVH::GetLightContribution()
+	XMFLOAT3 offset = Sub(light.Position, position);
+	float distSq = Dot(offset, offset);
+	if (distSq >= light.Range * light.Range || distSq <= 0.0f)
+		return false;
+
+	float dist = std::sqrt(distSq);
+	float NdotL = Saturate(Dot(normal, offset) / dist);
+	float ratio = distSq / (light.Range * light.Range);
+	float window = 1.0f - ratio * ratio;
+	window *= window;
+
+	float scale = light.Intensity * window * NdotL / std::max(distSq, LIGHT_MIN_DISTANCE * LIGHT_MIN_DISTANCE);
+	contribution = Scale(light.Color, scale / (PI * pdf));
+	if (contribution.x == 0.0f && contribution.y == 0.0f && contribution.z == 0.0f)
+		return false;
+
+	toLight = Scale(offset, 1.0f / dist);
+	lightDistance = dist;
+	return true;
+}
+
+
+// --------------------------------------------------------
+// Makes the camera rays for a 2x2 block of pixels, like
+// CalcRayFromCamera() in Raytracing.hlsl
+//
+// x & y - Top left pixel of the block
+// offset - Added to each pixel's coordinates
+// laneMask - Which of the block's pixels to make active
+//            (pixels off the image never are)
+// --------------------------------------------------------
+void CPURaytracer::MakeCameraPacket(const CPURaytracerSettings& settings, unsigned int x, unsigned int y, float offset, int laneMask, CPURayPacket& packet) const
+{
+	XMMATRIX inverseViewProjection = XMLoadFloat4x4(&settings.InverseViewProjection);
+	for (int lane = 0; lane < CPU_RAY_PACKET_SIZE; lane++)
+	{
+		unsigned int px = x + (lane & 1);
+		unsigned int py = y + (lane >> 1);
+
+		// Offset to the middle of the pixel and unproject
+		float screenX = (px + offset + 0.5f) / settings.Width * 2.0f - 1.0f;
+		float screenY = -((py + offset + 0.5f) / settings.Height * 2.0f - 1.0f);
+		XMVECTOR world = XMVector4Transform(XMVectorSet(screenX, screenY, 0, 1), inverseViewProjection);
+		XMFLOAT3 worldPos;
+		XMStoreFloat3(&worldPos, XMVectorDivide(world, XMVectorSplatW(world)));
+
+		XMFLOAT3 direction = Normalize(Sub(worldPos, settings.CameraPosition));
+		packet.OriginX[lane] = settings.CameraPosition.x;
+		packet.OriginY[lane] = settings.CameraPosition.y;
+		packet.OriginZ[lane] = settings.CameraPosition.z;
+		packet.DirectionX[lane] = direction.x;
+		packet.DirectionY[lane] = direction.y;
+		packet.DirectionZ[lane] = direction.z;
+		packet.TMin[lane] = RAY_T_MIN;
+		packet.Active[lane] = (laneMask & (1 << lane)) && px < settings.Width && py < settings.Height;
+	}
+}
+
+
+// --------------------------------------------------------
+// Saves linear colors as a portable float map: a short text
+// header (a negative scale meaning little endian floats),
+// then RGB floats a row at a time from the bottom up
+// --------------------------------------------------------
+bool CPURaytracer::SaveImage(const char* path, const std::vector<XMFLOAT3>& colors, unsigned int width, unsigned int height)
+{
+	if (colors.size() != (size_t)width * height)
+		return false;
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file.is_open())
+		return false;
+
+	std::string header = "PF\n" + std::to_string(width) + " " + std::to_string(height) + "\n-1.0\n";
+	file.write(header.c_str(), header.size());
+	for (unsigned int y = height; y-- > 0;)
+		file.write((const char*)&colors[(size_t)y * width], sizeof(XMFLOAT3) * width);
+
+	return file.good();
+}
+
+
+// --------------------------------------------------------
+// Loads an image saved by SaveImage()
+// --------------------------------------------------------
+bool CPURaytracer::LoadImage(const char* path, std::vector<XMFLOAT3>& colors, unsigned int& width, unsigned int& height)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file.is_open())
+		return false;
+
+	std::string type;
+	float scale = 0.0f;
+	file >> type >> width >> height >> scale;
+	if (!file || type != "PF" || scale >= 0.0f)
+		return false;
+
+	// A single whitespace character ends the header
+	file.get();
+
+	colors.resize((size_t)width * height);
+	for (unsigned int y = height; y-- > 0;)
+		file.read((char*)&colors[(size_t)y * width], sizeof(XMFLOAT3) * width);
+
+	return (bool)file;
+}
+
+
+// --------------------------------------------------------
+// Compares two images, returning the RMS difference of
+// their colors relative to the RMS of the reference's, or
+// FLT_MAX if they aren't the same size
+// --------------------------------------------------------
+float CPURaytracer::CompareImages(const std::vector<XMFLOAT3>& colors, const std::vector<XMFLOAT3>& reference)
+{
+	if (colors.size() != reference.size())
+		return FLT_MAX;
+
+	double difference = 0.0;
+	double total = 0.0;
+	for (size_t i = 0; i < colors.size(); i++)
+	{
+		XMFLOAT3 d = Sub(colors[i], reference[i]);
+		difference += Dot(d, d);
+		total += Dot(reference[i], reference[i]);
+	}
+
+	if (total <= 0.0)
+		return difference > 0.0 ? FLT_MAX : 0.0f;
+	return (float)std::sqrt(difference / total);
+}
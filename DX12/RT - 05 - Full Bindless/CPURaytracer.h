@@ -0,0 +1,171 @@
+#pragma once
+
+#include "CPUBVH.h"
+#include "GameEntity.h"
+#include "Lights.h"
+#include "LightBVH.h"
+#include "JobSystem.h"
+
+#include <DirectXMath.h>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+
+// --------------------------------------------------------
+// What to render, matching the SceneData cbuffer that
+// Raytracing.hlsl gets from RaytracingHelper::Raytrace()
+// --------------------------------------------------------
+struct CPURaytracerSettings
+{
+	unsigned int Width;
+	unsigned int Height;
+	DirectX::XMFLOAT4X4 InverseViewProjection;	// DirectXMath (row vector) matrix
+	DirectX::XMFLOAT3 CameraPosition;
+	int RaysPerPixel;
+	int MaxRecursionDepth;
+	DirectX::XMFLOAT3 SkyUpColor;
+	DirectX::XMFLOAT3 SkyDownColor;
+	unsigned int AccumulationFrameCount;
+	int LightSampling;
+};
+
+// --------------------------------------------------------
+// How long a render took and how many rays it traced
+// --------------------------------------------------------
+struct CPURaytracerStats
+{
+	double Milliseconds;
+	unsigned long long Rays;	// Every ray, including bounces and shadow rays
+	double MraysPerSecond;
+	unsigned int ThreadCount;
+};
+
+// --------------------------------------------------------
+// Build times and tracing speed for the current scene, and
+// whether the trees find the same closest hits as testing
+// every triangle
+// --------------------------------------------------------
+struct CPURaytracerBenchmark
+{
+	unsigned int Width;
+	unsigned int Height;
+	unsigned int Meshes;
+	unsigned int Triangles;			// Of every mesh, once each
+	unsigned int Instances;
+	unsigned int MaxDepth;			// Of any mesh BVH
+	double BuildMilliseconds;		// Every mesh BVH from scratch, then the scene BVH
+	double SceneBuildMilliseconds;	// Just the scene BVH
+
+	double PacketMraysPerSecond;	// Camera rays, 2x2 pixels per packet
+	double SingleMraysPerSecond;	// The same rays, one per packet
+	double ShadowMraysPerSecond;	// From each camera ray's hit toward the top of the scene
+	double PathMraysPerSecond;		// A whole frame, with bounces and shadow rays
+	unsigned int ThreadCount;
+
+	unsigned int ValidationRays;
+	unsigned int Mismatches;
+	bool Passed;
+};
+
+// --------------------------------------------------------
+// Renders the DXR scenes without DXR: the same meshes and
+// entities, traced through CPU BVHs (a binned SAH tree per
+// mesh and another over the entities, see CPUBVH.h) with
+// the packet kernels, and shaded by following Raytracing.hlsl
+// step for step - the same camera rays, random numbers
+// (seeded with the accumulation frame count), bounces and
+// next event estimation through the same light BVH.
+//
+// A few things only exist on the GPU, so they differ:
+//  - Textured materials use their color tint instead
+//  - Misses use the sky gradient (skyUpColor/skyDownColor)
+//    rather than the sky box
+// Floating point differences (especially in the sin() based
+// random numbers) mean images match on average rather than
+// bit for bit, so compare them with CompareImages().
+//
+// Mesh BVHs are built the first time a mesh is seen and
+// kept for as long as the raytracer lives.
+// --------------------------------------------------------
+class CPURaytracer
+{
+public:
+	CPURaytracer(unsigned int threadCount = 0);
+
+	CPURaytracer(const CPURaytracer&) = delete;
+	void operator=(const CPURaytracer&) = delete;
+
+	void SetScene(const std::vector<std::shared_ptr<GameEntity>>& entities, const std::vector<Light>& lights);
+	CPURaytracerStats Render(const CPURaytracerSettings& settings, std::vector<DirectX::XMFLOAT3>& colors);
+	CPURaytracerBenchmark Benchmark(const CPURaytracerSettings& settings, unsigned int validationRays = 4096);
+
+	const CPUSceneBVH& GetSceneBVH() const;
+	unsigned int GetThreadCount() const;
+
+	static bool SaveImage(const char* path, const std::vector<DirectX::XMFLOAT3>& colors, unsigned int width, unsigned int height);
+	static bool LoadImage(const char* path, std::vector<DirectX::XMFLOAT3>& colors, unsigned int& width, unsigned int& height);
+	static float CompareImages(const std::vector<DirectX::XMFLOAT3>& colors, const std::vector<DirectX::XMFLOAT3>& reference);
+
+private:
+	JobSystem jobs;
+
+	// A mesh (kept alive here) and its BVH
+	struct MeshBVH
+	{
+		std::shared_ptr<Mesh> SourceMesh;
+		CPUMeshBVH BVH;
+	};
+	std::unordered_map<const Mesh*, std::unique_ptr<MeshBVH>> meshBVHs;
+
+	// What the hit shaders need to know about each instance
+	// of the scene BVH
+	struct InstanceShading
+	{
+		Mesh* SourceMesh;
+		DirectX::XMFLOAT4X4 World;
+		DirectX::XMFLOAT3 Color;
+		float Roughness;
+		float Metal;
+		float EmissiveIntensity;
+		MaterialType Type;
+	};
+	std::vector<InstanceShading> instanceShading;
+	CPUSceneBVH sceneBVH;
+
+	std::vector<Light> lights;
+	LightBVH lightBVH;
+
+	// One path per lane, through each bounce
+	struct PathState
+	{
+		DirectX::XMFLOAT3 Throughput;	// What the shaders carry as payload.color
+		DirectX::XMFLOAT3 Direct;		// Direct lighting added on the way back up
+		DirectX::XMFLOAT3 Color;		// Final color once the path ends
+		DirectX::XMFLOAT3 Origin;
+		DirectX::XMFLOAT3 Direction;
+		unsigned int Depth;
+		bool Alive;
+	};
+
+	void TracePixels(const CPURaytracerSettings& settings, unsigned int x, unsigned int y, std::vector<DirectX::XMFLOAT3>& colors, unsigned long long& rays) const;
+	bool Shade(
+		const CPURaytracerSettings& settings,
+		const CPURayHits& hits,
+		int lane,
+		unsigned int x,
+		unsigned int y,
+		int rayPerPixelIndex,
+		PathState& path,
+		DirectX::XMFLOAT3& directLight,
+		DirectX::XMFLOAT3& toLight,
+		float& lightDistance) const;
+	bool SampleDirectLight(
+		const CPURaytracerSettings& settings,
+		DirectX::XMFLOAT3 position,
+		DirectX::XMFLOAT3 normal,
+		float u,
+		DirectX::XMFLOAT3& contribution,
+		DirectX::XMFLOAT3& toLight,
+		float& lightDistance) const;
+	void MakeCameraPacket(const CPURaytracerSettings& settings, unsigned int x, unsigned int y, float offset, int laneMask, CPURayPacket& packet) const;
+};
@@ -13,6 +13,7 @@
 
 #include <stdlib.h>     // For seeding random and rand()
 #include <time.h>       // For grabbing time (to seed random)
+#include <float.h>      // For FLT_MAX
 
 // Needed for a helper function to read compiled shader files from the hard drive
 #pragma comment(lib, "d3dcompiler.lib")
@@ -24,6 +25,10 @@ using namespace DirectX;
 // Helper macro for getting a float between min and max
 #define RandomRange(min, max) (float)rand() / RAND_MAX * (max - min) + min
 
+// Relative RMS difference allowed between a CPU render and
+// its reference image before "-cpureference" fails
+#define CPU_REFERENCE_TOLERANCE 0.05f
+
 // --------------------------------------------------------
 // Constructor
 //
@@ -47,7 +52,21 @@ Game::Game(HINSTANCE hInstance)
 	updateTime(0.0f),
 	skyUpColor(0.3f, 0.5f, 0.95f),
 	skyDownColor(1,1,1),
-	skyboxHandle{}
+	skyboxHandle{},
+	refitTLAS(true),
+	lightSampling(LIGHT_SAMPLING_BVH),
+	lightSamplingMeasured(false),
+	lightSamplingVariance{},
+	cpuRaysPerPixel(4),
+	cpuResolutionDivisor(2),
+	cpuRendered(false),
+	cpuStats{},
+	cpuBenchmarked(false),
+	cpuBenchmark{},
+	cpuReferencePassed(true),
+	cpuReferenceDifference(0.0f),
+	lightVarianceTest(false),
+	lightVariancePassed(true)
 {
 
 #if defined(DEBUG) || defined(_DEBUG)
@@ -98,8 +117,10 @@ void Game::Init()
 		commandList, 
 		FixPath(L"Raytracing.cso"));
 
-	// Seed random
-	srand((unsigned int)time(0));
+	// Seed random - the same way every time for a CPU reference
+	// or variance test, since the scenes' materials, placement
+	// and lights are random
+	srand(cpuReferencePath.empty() && !lightVarianceTest ? (unsigned int)time(0) : 0);
 
 	// Helper methods for loading shaders, creating some basic
 	// geometry to draw and some simple camera matrices.
@@ -108,6 +129,18 @@ void Game::Init()
 	CreateBasicGeometry();
 	GenerateLights();
 
+	// Build every mesh's BLAS in one batch, then see what compaction saved
+	RaytracingHelper::GetInstance().BuildBottomLevelAccelerationStructures();
+	BLASMemoryStats blasMemory = RaytracingHelper::GetInstance().GetBLASMemoryStats();
+	printf("BLAS memory for %u meshes: %.2f MB before compaction, %.2f MB after (%.2f MB in %u pool blocks, %.2f MB scratch, %.2f MB build buffer)\n",
+		blasMemory.BLASCount,
+		blasMemory.UncompactedBytes / (1024.0 * 1024.0),
+		blasMemory.CompactedBytes / (1024.0 * 1024.0),
+		blasMemory.PoolBytes / (1024.0 * 1024.0),
+		blasMemory.PoolBlocks,
+		blasMemory.ScratchBytes / (1024.0 * 1024.0),
+		blasMemory.BuildBufferBytes / (1024.0 * 1024.0));
+
 	camera = std::make_shared<Camera>(
 		XMFLOAT3(0.0f, 0.0f, -8.0f),	// Position
 		5.0f,							// Move speed
@@ -129,6 +162,46 @@ void Game::Init()
 	ImGui_ImplWin32_Init(hWnd);
 	ImGui_ImplDX12_Init(device.Get(), this->numBackBuffers, DXGI_FORMAT_R8G8B8A8_UNORM, DX12Helper::GetInstance().GetCBVSRVDescriptorHeap().Get(), cpuHandle, gpuHandle);
 	ImGui::StyleColorsDark();
+
+	// Check the light BVH against uniform sampling in the first
+	// scene with point lights, which needs the BVH built now
+	// rather than in Update()
+	if (lightVarianceTest)
+	{
+		unsigned int lightScene = 0;
+		while (lightScene + 1 < scenes.size() && scenes[lightScene]->LightCount() == 0)
+			lightScene++;
+
+		const std::vector<Light>& sceneLights = scenes[lightScene]->GetLights();
+		lightBVH.Build(sceneLights.empty() ? 0 : &sceneLights[0], (unsigned int)sceneLights.size());
+		MeasureLightSamplingVariance();
+
+		lightVariancePassed =
+			lightSamplingMeasured &&
+			lightSamplingVariance.MissedContribution <= 0 &&
+			lightSamplingVariance.BVH < lightSamplingVariance.Uniform;
+
+		printf("Light sampling variance in \"%s\" over %u lights: %g uniform, %g light BVH, %g missed contribution, %g max pdf error %s\n",
+			scenes[lightScene]->GetName().c_str(),
+			(unsigned int)sceneLights.size(),
+			lightSamplingVariance.Uniform,
+			lightSamplingVariance.BVH,
+			lightSamplingVariance.MissedContribution,
+			lightSamplingVariance.MaxPdfError,
+			lightVariancePassed ? "" : "FAILED");
+	}
+
+	// Render the first scene on the CPU and check it against
+	// the reference image, or save it as the reference
+	if (!cpuReferencePath.empty())
+	{
+		cpuResolutionDivisor = 1;
+		RenderOnCPU();
+		BenchmarkCPU();
+	}
+
+	if (!cpuReferencePath.empty() || lightVarianceTest)
+		Quit();
 }
 
 
@@ -442,6 +515,10 @@ void Game::Update(float deltaTime, float totalTime)
 	if (camera->Update(deltaTime))
 		accumulationFrameCount = 0;
 
+	// Rebuild the light BVH, as lights may have moved
+	const std::vector<Light>& sceneLights = scenes[currentScene]->GetLights();
+	lightBVH.Build(sceneLights.empty() ? 0 : &sceneLights[0], (unsigned int)sceneLights.size());
+
 	BuildUI();
 }
 
@@ -463,11 +540,12 @@ void Game::Draw(float deltaTime, float totalTime)
 
 	// Raytracing here!
 	{
-		// Update raytracing accel structure
+		// Update raytracing accel structure and lights
 		RaytracingHelper::GetInstance().CreateTopLevelAccelerationStructureForScene(scenes[currentScene]->GetEntities());
+		RaytracingHelper::GetInstance().UpdateLights(scenes[currentScene]->GetLights(), lightBVH.GetNodes());
 
 		// Perform raytrace - specifically NOT executing the command list yet, as we're doing ImGui after
-		RaytracingHelper::GetInstance().Raytrace(camera, backBuffers[currentSwapBuffer], raysPerPixel, maxRecursionDepth, skyUpColor, skyDownColor, skyboxHandle, accumulationFrameCount, false);
+		RaytracingHelper::GetInstance().Raytrace(camera, backBuffers[currentSwapBuffer], raysPerPixel, maxRecursionDepth, skyUpColor, skyDownColor, skyboxHandle, accumulationFrameCount, lightSampling, false);
 	}
 
 	// ImGui
@@ -546,6 +624,169 @@ void Game::UINewFrame(float deltaTime)
 	input.SetMouseCapture(io.WantCaptureMouse);
 }
 
+// --------------------------------------------------------
+// Compares uniform light selection against the light BVH
+// at random surface points within the lights' bounds, using
+// the CPU version of the traversal.  The BVH should have a
+// much lower variance, miss nothing and report pdfs that
+// match the exact probabilities.
+// --------------------------------------------------------
+void Game::MeasureLightSamplingVariance()
+{
+	const std::vector<LightBVHNode>& nodes = lightBVH.GetNodes();
+	if (nodes.empty())
+	{
+		lightSamplingMeasured = false;
+		return;
+	}
+
+	// Random points in the root's bounds, facing random directions
+	const unsigned int pointCount = 1024;
+	std::vector<XMFLOAT3> positions(pointCount);
+	std::vector<XMFLOAT3> normals(pointCount);
+	for (unsigned int i = 0; i < pointCount; i++)
+	{
+		positions[i] = XMFLOAT3(
+			RandomRange(nodes[0].BoundsMin.x, nodes[0].BoundsMax.x),
+			RandomRange(nodes[0].BoundsMin.y, nodes[0].BoundsMax.y),
+			RandomRange(nodes[0].BoundsMin.z, nodes[0].BoundsMax.z));
+
+		float z = RandomRange(-1.0f, 1.0f);
+		float phi = RandomRange(0.0f, XM_2PI);
+		float r = sqrt(1.0f - z * z);
+		normals[i] = XMFLOAT3(r * cos(phi), r * sin(phi), z);
+	}
+
+	lightSamplingVariance = lightBVH.MeasureVariance(&positions[0], &normals[0], pointCount, 64);
+	lightSamplingMeasured = true;
+}
+
+
+// --------------------------------------------------------
+// The camera and raytracing options the GPU is using, for a
+// CPU render at a fraction of the window's resolution
+// --------------------------------------------------------
+CPURaytracerSettings Game::GetCPURaytracerSettings()
+{
+	CPURaytracerSettings settings = {};
+	settings.Width = (unsigned int)max((int)windowWidth / cpuResolutionDivisor, 1);
+	settings.Height = (unsigned int)max((int)windowHeight / cpuResolutionDivisor, 1);
+	settings.CameraPosition = camera->GetTransform()->GetPosition();
+	settings.RaysPerPixel = cpuRaysPerPixel;
+	settings.MaxRecursionDepth = maxRecursionDepth;
+	settings.SkyUpColor = skyUpColor;
+	settings.SkyDownColor = skyDownColor;
+	settings.AccumulationFrameCount = accumulationFrameCount;
+	settings.LightSampling = lightSampling;
+
+	// Same as RaytracingHelper::Raytrace()
+	XMFLOAT4X4 view = camera->GetView();
+	XMFLOAT4X4 proj = camera->GetProjection();
+	XMMATRIX vp = XMMatrixMultiply(XMLoadFloat4x4(&view), XMLoadFloat4x4(&proj));
+	XMStoreFloat4x4(&settings.InverseViewProjection, XMMatrixInverse(0, vp));
+
+	return settings;
+}
+
+
+// --------------------------------------------------------
+// Renders the current scene on the CPU and saves it.  With
+// "-cpureference" the render is compared against that
+// image instead, or saved as it if it doesn't exist yet.
+// --------------------------------------------------------
+void Game::RenderOnCPU()
+{
+	cpuRaytracer.SetScene(scenes[currentScene]->GetEntities(), scenes[currentScene]->GetLights());
+
+	CPURaytracerSettings settings = GetCPURaytracerSettings();
+	std::vector<XMFLOAT3> colors;
+	cpuStats = cpuRaytracer.Render(settings, colors);
+	cpuRendered = true;
+	printf("CPU render: %ux%u, %d rays per pixel, %.1f ms, %.2f Mrays/s (%u threads)\n",
+		settings.Width,
+		settings.Height,
+		settings.RaysPerPixel,
+		cpuStats.Milliseconds,
+		cpuStats.MraysPerSecond,
+		cpuStats.ThreadCount);
+
+	if (cpuReferencePath.empty())
+	{
+		CPURaytracer::SaveImage("CPURender.pfm", colors, settings.Width, settings.Height);
+		return;
+	}
+
+	std::vector<XMFLOAT3> reference;
+	unsigned int referenceWidth = 0;
+	unsigned int referenceHeight = 0;
+	if (CPURaytracer::LoadImage(cpuReferencePath.c_str(), reference, referenceWidth, referenceHeight))
+	{
+		cpuReferenceDifference = referenceWidth == settings.Width && referenceHeight == settings.Height ?
+			CPURaytracer::CompareImages(colors, reference) :
+			FLT_MAX;
+		cpuReferencePassed = cpuReferenceDifference <= CPU_REFERENCE_TOLERANCE;
+		printf("Difference from %s: %g (relative RMS) %s\n",
+			cpuReferencePath.c_str(),
+			cpuReferenceDifference,
+			cpuReferencePassed ? "" : "FAILED");
+	}
+	else
+	{
+		cpuReferencePassed = CPURaytracer::SaveImage(cpuReferencePath.c_str(), colors, settings.Width, settings.Height);
+		printf(cpuReferencePassed ? "Saved %s as the reference\n" : "Couldn't save %s\n", cpuReferencePath.c_str());
+	}
+}
+
+
+// --------------------------------------------------------
+// Times building the CPU BVHs and tracing the current scene
+// through them, and checks them against testing every
+// triangle
+// --------------------------------------------------------
+void Game::BenchmarkCPU()
+{
+	cpuRaytracer.SetScene(scenes[currentScene]->GetEntities(), scenes[currentScene]->GetLights());
+	cpuBenchmark = cpuRaytracer.Benchmark(GetCPURaytracerSettings(), 1024);
+	cpuBenchmarked = true;
+
+	printf("CPU BVHs: %u meshes (%u triangles, max depth %u) built in %.2f ms, %u instances in %.3f ms\n",
+		cpuBenchmark.Meshes,
+		cpuBenchmark.Triangles,
+		cpuBenchmark.MaxDepth,
+		cpuBenchmark.BuildMilliseconds,
+		cpuBenchmark.Instances,
+		cpuBenchmark.SceneBuildMilliseconds);
+	printf("  Mrays/s at %ux%u (%u threads): packets %.2f, single rays %.2f, shadow %.2f, paths %.2f\n",
+		cpuBenchmark.Width,
+		cpuBenchmark.Height,
+		cpuBenchmark.ThreadCount,
+		cpuBenchmark.PacketMraysPerSecond,
+		cpuBenchmark.SingleMraysPerSecond,
+		cpuBenchmark.ShadowMraysPerSecond,
+		cpuBenchmark.PathMraysPerSecond);
+	printf("  %u of %u random rays differ from testing every triangle %s\n",
+		cpuBenchmark.Mismatches,
+		cpuBenchmark.ValidationRays,
+		cpuBenchmark.Passed ? "" : "FAILED");
+}
+
+
+// --------------------------------------------------------
+// Where "-cpureference" keeps its image, and whether the
+// render matched it (and the BVHs were right)
+// --------------------------------------------------------
+void Game::SetCPUReferencePath(const char* path) { cpuReferencePath = path; }
+bool Game::CPUReferencePassed() { return cpuReferencePassed && (!cpuBenchmarked || cpuBenchmark.Passed); }
+
+
+// --------------------------------------------------------
+// Whether "-lightvariance" is measuring light sampling, and
+// whether the light BVH missed nothing and beat uniform
+// --------------------------------------------------------
+void Game::SetLightVarianceTest(bool test) { lightVarianceTest = test; }
+bool Game::LightVariancePassed() { return lightVariancePassed; }
+
+
 // --------------------------------------------------------
 // Builds the ImGui interface
 // --------------------------------------------------------
@@ -595,6 +836,99 @@ void Game::BuildUI()
 
 		ImGui::Spacing();
 
+		// Point lights
+		if (ImGui::CollapsingHeader("Light Sampling"))
+		{
+			ImGui::Text("Point lights: %u (%u BVH nodes)", scenes[currentScene]->LightCount(), (unsigned int)lightBVH.GetNodes().size());
+
+			bool changed = false;
+			changed |= ImGui::RadioButton("None", &lightSampling, LIGHT_SAMPLING_NONE);
+			ImGui::SameLine();
+			changed |= ImGui::RadioButton("Uniform", &lightSampling, LIGHT_SAMPLING_UNIFORM);
+			ImGui::SameLine();
+			changed |= ImGui::RadioButton("Light BVH", &lightSampling, LIGHT_SAMPLING_BVH);
+			if (changed)
+				accumulationFrameCount = 0;
+
+			if (ImGui::Button("Measure Variance"))
+				MeasureLightSamplingVariance();
+
+			if (lightSamplingMeasured)
+			{
+				ImGui::Text("Variance (uniform): %g", lightSamplingVariance.Uniform);
+				ImGui::Text("Variance (light BVH): %g", lightSamplingVariance.BVH);
+				if (lightSamplingVariance.BVH > 0)
+					ImGui::Text("Reduction: %.2fx", lightSamplingVariance.Uniform / lightSamplingVariance.BVH);
+				ImGui::Text("Missed contribution: %g", lightSamplingVariance.MissedContribution);
+				ImGui::Text("Max pdf error: %g", lightSamplingVariance.MaxPdfError);
+			}
+		}
+
+		ImGui::Spacing();
+
+		// What the TLAS build is doing each frame
+		if (ImGui::CollapsingHeader("Acceleration Structures"))
+		{
+			if (ImGui::Checkbox("Refit TLAS", &refitTLAS))
+				RaytracingHelper::GetInstance().SetTLASRefitEnabled(refitTLAS);
+
+			TLASBuildStats tlasStats = RaytracingHelper::GetInstance().GetTLASBuildStats();
+			ImGui::Text("This frame: %s", !tlasStats.Built ? "Unchanged" : tlasStats.Rebuilt ? "Rebuilt" : "Refit");
+			ImGui::Text("Instance descs written: %u of %u", tlasStats.DirtyInstances, tlasStats.Instances);
+			ImGui::Text("Refits since rebuild: %u", tlasStats.RefitsSinceRebuild);
+			ImGui::Text("CPU time: %.3f ms", tlasStats.CPUMilliseconds);
+			ImGui::Text("GPU rebuild: %.3f ms", tlasStats.RebuildGPUMilliseconds);
+			ImGui::Text("GPU refit: %.3f ms", tlasStats.RefitGPUMilliseconds);
+			ImGui::Text("Total: %llu rebuilds, %llu refits", tlasStats.TotalRebuilds, tlasStats.TotalRefits);
+
+			BLASMemoryStats blasMemory = RaytracingHelper::GetInstance().GetBLASMemoryStats();
+			ImGui::Spacing();
+			ImGui::Text("BLAS count: %u", blasMemory.BLASCount);
+			ImGui::Text("Before compaction: %.2f MB", blasMemory.UncompactedBytes / (1024.0 * 1024.0));
+			ImGui::Text("After compaction: %.2f MB", blasMemory.CompactedBytes / (1024.0 * 1024.0));
+			if (blasMemory.CompactedBytes > 0)
+				ImGui::Text("Saved: %.1f%%", 100.0 * (1.0 - (double)blasMemory.CompactedBytes / blasMemory.UncompactedBytes));
+			ImGui::Text("Pool: %.2f MB in %u blocks", blasMemory.PoolBytes / (1024.0 * 1024.0), blasMemory.PoolBlocks);
+			ImGui::Text("Shared scratch: %.2f MB", blasMemory.ScratchBytes / (1024.0 * 1024.0));
+			ImGui::Text("Build buffer: %.2f MB", blasMemory.BuildBufferBytes / (1024.0 * 1024.0));
+		}
+
+		ImGui::Spacing();
+
+		// The same scene, traced without the GPU
+		if (ImGui::CollapsingHeader("CPU Raytracer"))
+		{
+			if (!RaytracingHelper::GetInstance().IsAvailable())
+				ImGui::TextWrapped("DXR isn't available on this device - CPU renders are the only way to see the scene");
+
+			ImGui::SliderInt("CPU Rays Per Pixel", &cpuRaysPerPixel, 1, 64);
+			ImGui::SliderInt("Resolution Divisor", &cpuResolutionDivisor, 1, 8);
+			if (ImGui::Button("Render on CPU"))
+				RenderOnCPU();
+			ImGui::SameLine();
+			if (ImGui::Button("Benchmark"))
+				BenchmarkCPU();
+
+			if (cpuRendered)
+			{
+				ImGui::Text("Saved CPURender.pfm: %.1f ms", cpuStats.Milliseconds);
+				ImGui::Text("%.2f Mrays/s (%u threads)", cpuStats.MraysPerSecond, cpuStats.ThreadCount);
+			}
+
+			if (cpuBenchmarked)
+			{
+				ImGui::Text("BVH build: %.2f ms (%u triangles)", cpuBenchmark.BuildMilliseconds, cpuBenchmark.Triangles);
+				ImGui::Text("Scene BVH: %.3f ms (%u instances)", cpuBenchmark.SceneBuildMilliseconds, cpuBenchmark.Instances);
+				ImGui::Text("Packets: %.2f Mrays/s", cpuBenchmark.PacketMraysPerSecond);
+				ImGui::Text("Single rays: %.2f Mrays/s", cpuBenchmark.SingleMraysPerSecond);
+				ImGui::Text("Shadow rays: %.2f Mrays/s", cpuBenchmark.ShadowMraysPerSecond);
+				ImGui::Text("Paths: %.2f Mrays/s", cpuBenchmark.PathMraysPerSecond);
+				ImGui::Text("Mismatches: %u of %u rays", cpuBenchmark.Mismatches, cpuBenchmark.ValidationRays);
+			}
+		}
+
+		ImGui::Spacing();
+
 		// Entities
 		if (ImGui::CollapsingHeader("Entities"))
 		{
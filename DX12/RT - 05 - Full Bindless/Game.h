@@ -7,11 +7,14 @@
 #include "Camera.h"
 #include "Lights.h"
 #include "Scene.h"
+#include "LightBVH.h"
+#include "CPURaytracer.h"
 
 #include <DirectXMath.h>
 #include <wrl/client.h> // Used for ComPtr - a smart pointer for COM objects
 #include <vector>
 #include <memory>
+#include <string>
 
 class Game 
 	: public DXCore
@@ -30,6 +33,15 @@ public:
 
 	void UINewFrame(float deltaTime);
 	void BuildUI();
+	void MeasureLightSamplingVariance();
+
+	// Rendering and benchmarking without DXR
+	void RenderOnCPU();
+	void BenchmarkCPU();
+	void SetCPUReferencePath(const char* path);
+	bool CPUReferencePassed();
+	void SetLightVarianceTest(bool test);
+	bool LightVariancePassed();
 
 private:
 
@@ -37,6 +49,7 @@ private:
 	void CreateRootSigAndPipelineState();
 	void CreateBasicGeometry();
 	void GenerateLights();
+	CPURaytracerSettings GetCPURaytracerSettings();
 	
 	// Overall pipeline and rendering requirements
 	Microsoft::WRL::ComPtr<ID3D12RootSignature> rootSignature;
@@ -61,5 +74,36 @@ private:
 	unsigned int accumulationFrameCount = 0;
 
 	D3D12_GPU_DESCRIPTOR_HANDLE skyboxHandle;
+
+	// Refit the TLAS when only transforms change, rather
+	// than rebuilding it every frame
+	bool refitTLAS;
+
+	// Direct lighting from each scene's point lights
+	LightBVH lightBVH;
+	int lightSampling;
+	bool lightSamplingMeasured;
+	LightSamplingVariance lightSamplingVariance;
+
+	// The same scene traced on the CPU
+	CPURaytracer cpuRaytracer;
+	int cpuRaysPerPixel;
+	int cpuResolutionDivisor;
+	bool cpuRendered;
+	CPURaytracerStats cpuStats;
+	bool cpuBenchmarked;
+	CPURaytracerBenchmark cpuBenchmark;
+
+	// Set by "-cpureference" to render the first scene on the
+	// CPU right after Init() and compare with (or save) an image
+	std::string cpuReferencePath;
+	bool cpuReferencePassed;
+	float cpuReferenceDifference;
+
+	// Set by "-lightvariance" to measure light sampling in the
+	// first scene with point lights right after Init(), and
+	// whether the BVH missed no lights and beat uniform sampling
+	bool lightVarianceTest;
+	bool lightVariancePassed;
 };
 
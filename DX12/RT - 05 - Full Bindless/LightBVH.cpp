@@ -0,0 +1,362 @@
+#include "LightBVH.h"
+
+#include <cmath>
+#include <algorithm>
+
+using namespace DirectX;
+
+// Largest float below 1, so a rescaled random number
+// never quite reaches the end of its range
+#define ONE_MINUS_EPSILON 0.99999994f
+
+// Gets a single component of a float3 by index
+static float GetAxis(const XMFLOAT3& v, int axis)
+{
+	return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+
+// --------------------------------------------------------
+// Constructor - the tree is empty until Build()
+// --------------------------------------------------------
+LightBVH::LightBVH()
+{
+}
+
+
+// --------------------------------------------------------
+// Rebuilds the whole tree from scratch, which is quick
+// enough to do every frame for a few thousand lights
+//
+// lights - The point lights to build over (anything else
+//          is left out, but keeps its index)
+// lightCount - How many lights are in the array
+// --------------------------------------------------------
+void LightBVH::Build(const Light* lights, unsigned int lightCount)
+{
+	this->lights.assign(lights, lights + lightCount);
+	nodes.clear();
+	order.clear();
+
+	for (unsigned int i = 0; i < lightCount; i++)
+	{
+		if (lights[i].Type == LIGHT_TYPE_POINT)
+			order.push_back(i);
+	}
+
+	if (order.empty())
+		return;
+
+	// A tree with one light per leaf always has 2n - 1 nodes
+	nodes.reserve(order.size() * 2 - 1);
+	BuildNode(0, (unsigned int)order.size());
+}
+
+
+// --------------------------------------------------------
+// Getters for the results of the most recent Build()
+// --------------------------------------------------------
+const std::vector<LightBVHNode>& LightBVH::GetNodes() const { return nodes; }
+unsigned int LightBVH::GetLightCount() const { return (unsigned int)lights.size(); }
+
+
+// --------------------------------------------------------
+// Picks a single light by walking down the tree, choosing
+// between the two children of each node in proportion to
+// their importance.  The random number is rescaled at each
+// step so one number is enough for the whole walk.
+//
+// position & normal - The surface being lit
+// u - Random number between 0 and 1
+// pdf - Probability of picking the returned light
+//
+// Returns the index of the light, or -1 if no light can
+// reach the surface (in which case the pdf is 0)
+// --------------------------------------------------------
+int LightBVH::SampleLight(XMFLOAT3 position, XMFLOAT3 normal, float u, float& pdf) const
+{
+	pdf = 0.0f;
+	if (nodes.empty())
+		return -1;
+
+	int index = 0;
+	float probability = 1.0f;
+	while (nodes[index].Child >= 0)
+	{
+		int left = index + 1;
+		int right = nodes[index].Child;
+		float importanceLeft = GetNodeImportance(nodes[left], position, normal);
+		float importanceRight = GetNodeImportance(nodes[right], position, normal);
+		float total = importanceLeft + importanceRight;
+		if (total <= 0.0f)
+			return -1;
+
+		float chanceLeft = importanceLeft / total;
+		if (u < chanceLeft)
+		{
+			index = left;
+			u /= chanceLeft;
+			probability *= chanceLeft;
+		}
+		else
+		{
+			index = right;
+			u = (u - chanceLeft) / (1.0f - chanceLeft);
+			probability *= 1.0f - chanceLeft;
+		}
+		u = std::min(u, ONE_MINUS_EPSILON);
+	}
+
+	pdf = probability;
+	return -1 - nodes[index].Child;
+}
+
+
+// --------------------------------------------------------
+// Finds the exact chance of SampleLight() picking each
+// light, by visiting every node that could be chosen
+//
+// position & normal - The surface being lit
+// probabilities - Filled with one probability per light
+// --------------------------------------------------------
+void LightBVH::GetLightProbabilities(XMFLOAT3 position, XMFLOAT3 normal, std::vector<float>& probabilities) const
+{
+	probabilities.assign(lights.size(), 0.0f);
+	if (nodes.empty())
+		return;
+
+	// Nodes left to visit, each with the chance of reaching it
+	std::vector<std::pair<int, float>> stack;
+	stack.push_back({ 0, 1.0f });
+	while (!stack.empty())
+	{
+		int index = stack.back().first;
+		float probability = stack.back().second;
+		stack.pop_back();
+
+		if (nodes[index].Child < 0)
+		{
+			probabilities[-1 - nodes[index].Child] = probability;
+			continue;
+		}
+
+		int left = index + 1;
+		int right = nodes[index].Child;
+		float importanceLeft = GetNodeImportance(nodes[left], position, normal);
+		float importanceRight = GetNodeImportance(nodes[right], position, normal);
+		float total = importanceLeft + importanceRight;
+		if (total <= 0.0f)
+			continue;
+
+		float chanceLeft = importanceLeft / total;
+		if (chanceLeft > 0.0f) stack.push_back({ left, probability * chanceLeft });
+		if (chanceLeft < 1.0f) stack.push_back({ right, probability * (1.0f - chanceLeft) });
+	}
+}
+
+
+// --------------------------------------------------------
+// Compares the variance of one-sample direct lighting when
+// picking lights uniformly and when picking them with the
+// BVH.  Shadows are ignored, so the results only depend on
+// the lights and the surface points.  Each point also runs
+// a set of stratified traversals to check that the pdf the
+// traversal reports matches the exact probability.
+//
+// positions & normals - The surface points to test
+// pointCount - How many points are in the arrays
+// samplesPerPoint - Traversals to check at each point
+// --------------------------------------------------------
+LightSamplingVariance LightBVH::MeasureVariance(
+	const XMFLOAT3* positions,
+	const XMFLOAT3* normals,
+	unsigned int pointCount,
+	unsigned int samplesPerPoint) const
+{
+	LightSamplingVariance results = {};
+	if (lights.empty())
+		return results;
+
+	std::vector<float> probabilities;
+	for (unsigned int p = 0; p < pointCount; p++)
+	{
+		GetLightProbabilities(positions[p], normals[p], probabilities);
+
+		// For a single sample with probability p(i), the variance is
+		// the sum of f(i)^2 / p(i) minus the square of the expected value
+		double expected = 0.0;
+		double uniformSum = 0.0;
+		double bvhSum = 0.0;
+		double lightCount = (double)lights.size();
+		for (size_t i = 0; i < lights.size(); i++)
+		{
+			if (lights[i].Type != LIGHT_TYPE_POINT)
+				continue;
+
+			double f = GetLightContribution(lights[i], positions[p], normals[p]);
+			expected += f;
+			uniformSum += f * f * lightCount;
+
+			if (probabilities[i] > 0.0f)
+				bvhSum += f * f / probabilities[i];
+			else
+				results.MissedContribution += f;
+		}
+		results.Uniform += uniformSum - expected * expected;
+		results.BVH += bvhSum - expected * expected;
+
+		// Check the traversal against the exact probabilities
+		for (unsigned int s = 0; s < samplesPerPoint; s++)
+		{
+			float pdf = 0.0f;
+			int light = SampleLight(positions[p], normals[p], (s + 0.5f) / samplesPerPoint, pdf);
+			double exact = light >= 0 ? probabilities[light] : 0.0;
+			results.MaxPdfError = std::max(results.MaxPdfError, std::abs(pdf - exact));
+		}
+	}
+
+	return results;
+}
+
+
+// --------------------------------------------------------
+// Gets the overall brightness of a light, which is what
+// the tree uses to weigh lights against each other
+// --------------------------------------------------------
+float LightBVH::GetLightPower(const Light& light)
+{
+	float luminance =
+		light.Color.x * 0.2126f +
+		light.Color.y * 0.7152f +
+		light.Color.z * 0.0722f;
+	return light.Intensity * luminance;
+}
+
+
+// --------------------------------------------------------
+// Gets how much a light brightens a diffuse surface, as a
+// single luminance value and ignoring shadows.  Point lights
+// fall off with the inverse square of their distance, with
+// a window so they smoothly reach zero at their range.
+// - Must match LightContribution() in Raytracing.hlsl
+// --------------------------------------------------------
+float LightBVH::GetLightContribution(const Light& light, XMFLOAT3 position, XMFLOAT3 normal)
+{
+	float dx = light.Position.x - position.x;
+	float dy = light.Position.y - position.y;
+	float dz = light.Position.z - position.z;
+	float distSq = dx * dx + dy * dy + dz * dz;
+	if (distSq >= light.Range * light.Range)
+		return 0.0f;
+
+	float dist = std::sqrt(distSq);
+	float NdotL = dist > 0.0f ? (normal.x * dx + normal.y * dy + normal.z * dz) / dist : 0.0f;
+	if (NdotL <= 0.0f)
+		return 0.0f;
+
+	float ratio = distSq / (light.Range * light.Range);
+	float window = 1.0f - ratio * ratio;
+	window *= window;
+
+	return GetLightPower(light) * window * NdotL / std::max(distSq, LIGHT_MIN_DISTANCE * LIGHT_MIN_DISTANCE);
+}
+
+
+// --------------------------------------------------------
+// Estimates how much a node's lights brighten a surface.
+// This only has to be roughly right, but it must never be
+// zero for a node holding a light that reaches the surface.
+//
+// Nodes are zero when the surface is further from their
+// bounds than their largest range, or when a sphere around
+// their bounds is entirely behind the surface.  Otherwise
+// it's their power over their squared distance, scaled by
+// how much the sphere faces the surface.
+// - Must match NodeImportance() in Raytracing.hlsl
+// --------------------------------------------------------
+float LightBVH::GetNodeImportance(const LightBVHNode& node, XMFLOAT3 position, XMFLOAT3 normal)
+{
+	// Closest point of the bounds
+	float cx = std::min(std::max(position.x, node.BoundsMin.x), node.BoundsMax.x) - position.x;
+	float cy = std::min(std::max(position.y, node.BoundsMin.y), node.BoundsMax.y) - position.y;
+	float cz = std::min(std::max(position.z, node.BoundsMin.z), node.BoundsMax.z) - position.z;
+	if (cx * cx + cy * cy + cz * cz >= node.Range * node.Range)
+		return 0.0f;
+
+	// Sphere around the bounds
+	float hx = (node.BoundsMax.x - node.BoundsMin.x) * 0.5f;
+	float hy = (node.BoundsMax.y - node.BoundsMin.y) * 0.5f;
+	float hz = (node.BoundsMax.z - node.BoundsMin.z) * 0.5f;
+	float radius = std::sqrt(hx * hx + hy * hy + hz * hz);
+
+	float dx = node.BoundsMin.x + hx - position.x;
+	float dy = node.BoundsMin.y + hy - position.y;
+	float dz = node.BoundsMin.z + hz - position.z;
+	float distSq = dx * dx + dy * dy + dz * dz;
+
+	// Entirely behind the surface?
+	float along = normal.x * dx + normal.y * dy + normal.z * dz;
+	if (along + radius <= 0.0f)
+		return 0.0f;
+
+	float dist = std::sqrt(distSq);
+	float facing = dist > radius ? std::min((along + radius) / dist, 1.0f) : 1.0f;
+
+	return node.Power * facing / std::max(distSq, std::max(radius * radius, LIGHT_MIN_DISTANCE * LIGHT_MIN_DISTANCE));
+}
+
+
+// --------------------------------------------------------
+// Builds the node for a run of lights and then, recursively,
+// everything below it.  Lights are split in half along the
+// longest axis of their bounds, so the tree stays balanced.
+//
+// first - Index into the light order of the first light
+// count - How many lights are in this node
+// --------------------------------------------------------
+void LightBVH::BuildNode(unsigned int first, unsigned int count)
+{
+	LightBVHNode node = {};
+	node.BoundsMin = lights[order[first]].Position;
+	node.BoundsMax = lights[order[first]].Position;
+	for (unsigned int i = first; i < first + count; i++)
+	{
+		const Light& light = lights[order[i]];
+		node.BoundsMin.x = std::min(node.BoundsMin.x, light.Position.x);
+		node.BoundsMin.y = std::min(node.BoundsMin.y, light.Position.y);
+		node.BoundsMin.z = std::min(node.BoundsMin.z, light.Position.z);
+		node.BoundsMax.x = std::max(node.BoundsMax.x, light.Position.x);
+		node.BoundsMax.y = std::max(node.BoundsMax.y, light.Position.y);
+		node.BoundsMax.z = std::max(node.BoundsMax.z, light.Position.z);
+		node.Power += GetLightPower(light);
+		node.Range = std::max(node.Range, light.Range);
+	}
+
+	unsigned int index = (unsigned int)nodes.size();
+	if (count == 1)
+	{
+		node.Child = -1 - (int)order[first];
+		nodes.push_back(node);
+		return;
+	}
+	nodes.push_back(node);
+
+	// Longest axis of the bounds
+	float sizeX = node.BoundsMax.x - node.BoundsMin.x;
+	float sizeY = node.BoundsMax.y - node.BoundsMin.y;
+	float sizeZ = node.BoundsMax.z - node.BoundsMin.z;
+	int axis = sizeX >= sizeY && sizeX >= sizeZ ? 0 : (sizeY >= sizeZ ? 1 : 2);
+
+	unsigned int half = count / 2;
+	std::nth_element(
+		order.begin() + first,
+		order.begin() + first + half,
+		order.begin() + first + count,
+		[&](unsigned int a, unsigned int b) { return GetAxis(lights[a].Position, axis) < GetAxis(lights[b].Position, axis); });
+
+	// First child goes right after this node, the second
+	// after everything below the first
+	BuildNode(first, half);
+	nodes[index].Child = (int)nodes.size();
+	BuildNode(first + half, count - half);
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "Lights.h"
+
+#include <DirectXMath.h>
+#include <vector>
+
+// How the closest hit shader picks a light for direct lighting
+// - These should match the definitions in Raytracing.hlsl
+#define LIGHT_SAMPLING_NONE		0
+#define LIGHT_SAMPLING_UNIFORM	1
+#define LIGHT_SAMPLING_BVH		2
+
+// Lights closer than this are treated as being this far away,
+// so the 1/d^2 falloff can't blow up - must match the shader
+#define LIGHT_MIN_DISTANCE 0.1f
+
+// --------------------------------------------------------
+// A single node of the light BVH
+// Note: This must match the LightBVHNode struct in
+//       Raytracing.hlsl and be a multiple of 16 bytes!
+// --------------------------------------------------------
+struct LightBVHNode
+{
+	DirectX::XMFLOAT3	BoundsMin;	// Bounds of the positions of every light below this node
+	float				Power;		// Total power of those lights (16 bytes)
+
+	DirectX::XMFLOAT3	BoundsMax;
+	float				Range;		// Largest range of those lights (32 bytes)
+
+	int					Child;		// Second child of an interior node (the first is always
+									// the very next node), or -1 - light index for a leaf
+	DirectX::XMFLOAT3	Padding;	// 48 bytes
+};
+
+// --------------------------------------------------------
+// Results of comparing uniform light selection against the
+// BVH at a set of surface points.  Variances are exact (not
+// estimated) for a single light sample per point, summed
+// over all of the points.
+// --------------------------------------------------------
+struct LightSamplingVariance
+{
+	double Uniform;				// Picking every light with equal probability
+	double BVH;					// Picking lights by traversing the BVH
+	double MissedContribution;	// Lighting from lights the BVH can never pick (should be 0)
+	double MaxPdfError;			// Largest difference between a traversal's pdf and the exact probability
+};
+
+// --------------------------------------------------------
+// Bounding volume hierarchy over point lights, used to pick
+// a single light for next event estimation with a chance
+// roughly proportional to how much it lights a surface.
+//
+// Each interior node has exactly two children and each leaf
+// holds a single light.  Picking a light walks down from the
+// root, choosing a child at each node based on its power,
+// its distance from the surface and whether it's in front of
+// the surface.  Nodes the surface is out of range of, or
+// that are entirely behind the surface, are never chosen.
+//
+// The nodes are uploaded as-is, and the CPU traversal here
+// must match SampleLightBVH() in Raytracing.hlsl.
+// --------------------------------------------------------
+class LightBVH
+{
+public:
+	LightBVH();
+
+	void Build(const Light* lights, unsigned int lightCount);
+
+	const std::vector<LightBVHNode>& GetNodes() const;
+	unsigned int GetLightCount() const;
+
+	int SampleLight(DirectX::XMFLOAT3 position, DirectX::XMFLOAT3 normal, float u, float& pdf) const;
+	void GetLightProbabilities(DirectX::XMFLOAT3 position, DirectX::XMFLOAT3 normal, std::vector<float>& probabilities) const;
+
+	LightSamplingVariance MeasureVariance(
+		const DirectX::XMFLOAT3* positions,
+		const DirectX::XMFLOAT3* normals,
+		unsigned int pointCount,
+		unsigned int samplesPerPoint) const;
+
+	static float GetLightPower(const Light& light);
+	static float GetLightContribution(const Light& light, DirectX::XMFLOAT3 position, DirectX::XMFLOAT3 normal);
+	static float GetNodeImportance(const LightBVHNode& node, DirectX::XMFLOAT3 position, DirectX::XMFLOAT3 normal);
+
+private:
+	std::vector<Light> lights;
+	std::vector<LightBVHNode> nodes;
+
+	// Light indices, reordered as the tree is built
+	std::vector<unsigned int> order;
+
+	void BuildNode(unsigned int first, unsigned int count);
+};
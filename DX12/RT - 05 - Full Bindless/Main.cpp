@@ -1,5 +1,8 @@
 
 #include <Windows.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
 #include "Game.h"
 
 // --------------------------------------------------------
@@ -22,6 +25,35 @@ int WINAPI WinMain(
 	// the app handle we got from WinMain
 	Game dxGame(hInstance);
 
+	// "-cpureference [file.pfm]" renders the first scene on the
+	// CPU as soon as it's loaded, compares it against the given
+	// image (saving it there if there isn't one yet), prints
+	// the CPU raytracer's benchmarks and quits
+	//
+	// "-lightvariance" measures light sampling variance in the first
+	// scene with point lights, prints it and quits, failing if the light BVH can miss
+	// a light or doesn't beat uniform sampling
+	const char* cpuReference = strstr(lpCmdLine, "-cpureference");
+	bool lightVariance = strstr(lpCmdLine, "-lightvariance") != 0;
+	if (cpuReference || lightVariance)
+	{
+		// Print to the console we were launched from, or a new one
+		if (!AttachConsole(ATTACH_PARENT_PROCESS))
+			AllocConsole();
+		FILE* stream;
+		freopen_s(&stream, "CONOUT$", "w", stdout);
+	}
+	dxGame.SetLightVarianceTest(lightVariance);
+
+	if (cpuReference)
+	{
+		// The path is the next word, if there is one
+		cpuReference += strlen("-cpureference");
+		cpuReference += strspn(cpuReference, " \t");
+		std::string path(cpuReference, strcspn(cpuReference, " \t"));
+		dxGame.SetCPUReferencePath(path.empty() || path[0] == '-' ? "CPUReference.pfm" : path.c_str());
+	}
+
 	// Result variable for function calls below
 	HRESULT hr = S_OK;
 
@@ -37,5 +69,8 @@ int WINAPI WinMain(
 
 	// Begin the message and game loop, and then return
 	// whatever we get back once the game loop is over
-	return dxGame.Run();
+	hr = dxGame.Run();
+	if (cpuReference || lightVariance)
+		return (!cpuReference || dxGame.CPUReferencePassed()) && dxGame.LightVariancePassed() ? 0 : 1;
+	return hr;
 }
@@ -190,6 +190,10 @@ void Mesh::CreateBuffers(Vertex* vertArray, int numVerts, unsigned int* indexArr
 	// Calculate the tangents before copying to buffer
 	CalculateTangents(vertArray, numVerts, indexArray, numIndices);
 
+	// Keep the final geometry around for the CPU raytracer
+	vertices.assign(vertArray, vertArray + numVerts);
+	indices.assign(indexArray, indexArray + numIndices);
+
 	// Create the two buffers
 	vertexBuffer = DX12Helper::GetInstance().CreateStaticBuffer(sizeof(Vertex), numVerts, vertArray);
 	indexBuffer = DX12Helper::GetInstance().CreateStaticBuffer(sizeof(unsigned int), numIndices, indexArray);
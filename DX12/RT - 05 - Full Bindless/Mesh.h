@@ -2,6 +2,7 @@
 
 #include <d3d12.h>
 #include <wrl/client.h>
+#include <vector>
 
 #include "Vertex.h"
 
@@ -9,8 +10,7 @@ struct MeshRaytracingData
 {
 	D3D12_GPU_DESCRIPTOR_HANDLE IndexbufferSRV { };
 	D3D12_GPU_DESCRIPTOR_HANDLE VertexBufferSRV { };
-	Microsoft::WRL::ComPtr<ID3D12Resource> BLAS;
-	unsigned int HitGroupIndex = 0;
+	unsigned int HitGroupIndex = 0; // Also finds the mesh's BLAS - see RaytracingHelper::GetBLAS()
 };
 
 class Mesh
@@ -27,11 +27,18 @@ public:
 	int GetVertexCount() { return numVertices; }
 	MeshRaytracingData GetRaytracingData() { return raytracingData; }
 
+	// CPU copies of the geometry, for the CPU raytracer
+	const std::vector<Vertex>& GetVertices() { return vertices; }
+	const std::vector<unsigned int>& GetIndices() { return indices; }
+
 private:
 	int numIndices; 
 	int numVertices;
 
 	MeshRaytracingData raytracingData;
+
+	std::vector<Vertex> vertices;
+	std::vector<unsigned int> indices;
 	
 	D3D12_VERTEX_BUFFER_VIEW vbView;
 	Microsoft::WRL::ComPtr<ID3D12Resource> vertexBuffer;
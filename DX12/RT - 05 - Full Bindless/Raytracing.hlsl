@@ -4,6 +4,13 @@
 #define PI 3.141592654f
 #define TEST(x) payload.color = x; return;
 
+// Must match LightBVH.h
+#define LIGHT_TYPE_POINT		1
+#define LIGHT_SAMPLING_NONE		0
+#define LIGHT_SAMPLING_UNIFORM	1
+#define LIGHT_SAMPLING_BVH		2
+#define LIGHT_MIN_DISTANCE		0.1f
+
 
 // === Structs ===
 
@@ -30,6 +37,35 @@ struct RayPayload
 // Note: We'll be using the built-in BuiltInTriangleIntersectionAttributes struct
 // for triangle attributes, so no need to define our own.  It contains a single float2.
 
+// Must match the Light struct in Lights.h
+struct Light
+{
+	int		Type;
+	float3	Direction;	// 16 bytes
+
+	float	Range;
+	float3	Position;	// 32 bytes
+
+	float	Intensity;
+	float3	Color;		// 48 bytes
+
+	float	SpotFalloff;
+	float3	Padding;	// 64 bytes
+};
+
+// Must match the LightBVHNode struct in LightBVH.h
+struct LightBVHNode
+{
+	float3	BoundsMin;
+	float	Power;		// 16 bytes
+
+	float3	BoundsMax;
+	float	Range;		// 32 bytes
+
+	int		Child;		// Second child, or -1 - light index for leaves
+	float3	Padding;	// 48 bytes
+};
+
 
 
 // === Constant buffers ===
@@ -43,6 +79,8 @@ cbuffer SceneData : register(b0)
 	float3 skyUpColor;
 	float3 skyDownColor;
 	uint accumulationFrameCount;
+	uint lightCount;
+	int lightSampling;
 };
 
 
@@ -86,6 +124,10 @@ ByteAddressBuffer VertexBuffer				: register(t2);
 Texture2D AllTextures[] : register(t0, space1);
 TextureCube Skybox		: register(t0, space2);
 
+// Point lights and the BVH built over them
+StructuredBuffer<Light> Lights				: register(t3);
+StructuredBuffer<LightBVHNode> LightNodes	: register(t4);
+
 // Samplers
 SamplerState BasicSampler : register(s0);
 
@@ -225,6 +267,144 @@ float3 rand3(float2 uv)
 
 
 
+// === Direct lighting ===
+
+// How much a point light brightens a diffuse surface (ignoring shadows), using
+// inverse square falloff windowed to reach zero at the light's range
+// - Must match LightBVH::GetLightContribution() on the CPU
+float3 LightContribution(Light light, float3 position, float3 normal)
+{
+	float3 toLight = light.Position - position;
+	float distSq = dot(toLight, toLight);
+	if (distSq >= light.Range * light.Range)
+		return float3(0, 0, 0);
+
+	float NdotL = saturate(dot(normal, toLight * rsqrt(distSq)));
+	float ratio = distSq / (light.Range * light.Range);
+	float window = 1.0f - ratio * ratio;
+	window *= window;
+
+	return light.Color * light.Intensity * window * NdotL / max(distSq, LIGHT_MIN_DISTANCE * LIGHT_MIN_DISTANCE);
+}
+
+// Rough estimate of how much a BVH node's lights brighten a surface - zero
+// if the surface is out of range of the bounds or a sphere around the bounds
+// is entirely behind the surface
+// - Must match LightBVH::GetNodeImportance() on the CPU
+float NodeImportance(LightBVHNode node, float3 position, float3 normal)
+{
+	// Closest point of the bounds
+	float3 closest = clamp(position, node.BoundsMin, node.BoundsMax) - position;
+	if (dot(closest, closest) >= node.Range * node.Range)
+		return 0.0f;
+
+	// Sphere around the bounds
+	float3 halfSize = (node.BoundsMax - node.BoundsMin) * 0.5f;
+	float radius = length(halfSize);
+	float3 toCenter = node.BoundsMin + halfSize - position;
+	float distSq = dot(toCenter, toCenter);
+
+	// Entirely behind the surface?
+	float along = dot(normal, toCenter);
+	if (along + radius <= 0.0f)
+		return 0.0f;
+
+	float dist = sqrt(distSq);
+	float facing = dist > radius ? min((along + radius) / dist, 1.0f) : 1.0f;
+
+	return node.Power * facing / max(distSq, max(radius * radius, LIGHT_MIN_DISTANCE * LIGHT_MIN_DISTANCE));
+}
+
+// Walks down the light BVH, choosing a child at each node based on
+// importance and rescaling the random number as it goes
+// - Must match LightBVH::SampleLight() on the CPU
+int SampleLightBVH(float3 position, float3 normal, float u, out float pdf)
+{
+	pdf = 0.0f;
+
+	int index = 0;
+	float probability = 1.0f;
+	while (LightNodes[index].Child >= 0)
+	{
+		int left = index + 1;
+		int right = LightNodes[index].Child;
+		float importanceLeft = NodeImportance(LightNodes[left], position, normal);
+		float importanceRight = NodeImportance(LightNodes[right], position, normal);
+		float total = importanceLeft + importanceRight;
+		if (total <= 0.0f)
+			return -1;
+
+		float chanceLeft = importanceLeft / total;
+		if (u < chanceLeft)
+		{
+			index = left;
+			u /= chanceLeft;
+			probability *= chanceLeft;
+		}
+		else
+		{
+			index = right;
+			u = (u - chanceLeft) / (1.0f - chanceLeft);
+			probability *= 1.0f - chanceLeft;
+		}
+		u = min(u, 0.99999994f);
+	}
+
+	pdf = probability;
+	return -1 - LightNodes[index].Child;
+}
+
+// Picks a single light, traces a shadow ray to it and returns its diffuse
+// lighting divided by the chance of picking it (next event estimation)
+float3 SampleDirectLight(float3 position, float3 normal, float u)
+{
+	if (lightCount == 0)
+		return float3(0, 0, 0);
+
+	// Pick a light
+	int lightIndex;
+	float pdf;
+	if (lightSampling == LIGHT_SAMPLING_BVH)
+	{
+		lightIndex = SampleLightBVH(position, normal, u, pdf);
+	}
+	else
+	{
+		lightIndex = min((uint)(u * lightCount), lightCount - 1);
+		pdf = 1.0f / lightCount;
+	}
+
+	if (lightIndex < 0 || pdf <= 0.0f)
+		return float3(0, 0, 0);
+
+	Light light = Lights[lightIndex];
+	if (light.Type != LIGHT_TYPE_POINT)
+		return float3(0, 0, 0);
+
+	float3 contribution = LightContribution(light, position, normal);
+	if (all(contribution == 0))
+		return float3(0, 0, 0);
+
+	// Shadow ray - any hit at all means the light is blocked
+	float3 toLight = light.Position - position;
+	RayDesc ray;
+	ray.Origin = position;
+	ray.Direction = normalize(toLight);
+	ray.TMin = 0.0001f;
+	ray.TMax = length(toLight);
+
+	RayQuery<RAY_FLAG_ACCEPT_FIRST_HIT_AND_END_SEARCH | RAY_FLAG_FORCE_OPAQUE | RAY_FLAG_SKIP_PROCEDURAL_PRIMITIVES> query;
+	query.TraceRayInline(SceneTLAS, RAY_FLAG_NONE, 0xFF, ray);
+	query.Proceed();
+	if (query.CommittedStatus() != COMMITTED_NOTHING)
+		return float3(0, 0, 0);
+
+	// Lambert diffuse BRDF is albedo / PI
+	return contribution / (PI * pdf);
+}
+
+
+
 // Fresnel approximation
 float FresnelSchlick(float NdotV, float indexOfRefraction)
 {
@@ -405,6 +585,13 @@ void ClosestHit(inout RayPayload payload, BuiltInTriangleIntersectionAttributes
 	float2 rng = rand2(uv);
 	float randChance = rand(uv);
 
+	// Direct lighting from one point light, using the throughput that
+	// reached this surface (before it's tinted for the bounce below)
+	float3 hitPosition = WorldRayOrigin() + WorldRayDirection() * RayTCurrent();
+	float3 directLight = float3(0, 0, 0);
+	if (lightSampling != LIGHT_SAMPLING_NONE)
+		directLight = payload.color * surfaceColor * (1 - metal) * SampleDirectLight(hitPosition, normal_WS, rand(uv + rng));
+
 	// Interpolate between perfect reflection and random bounce based on roughness
 	float3 refl = reflect(WorldRayDirection(), normal_WS);
 	float3 randomBounce = normalize(RandomCosineWeightedHemisphere(rand(rng), rand(rng.yx), normal_WS));
@@ -428,7 +615,7 @@ void ClosestHit(inout RayPayload payload, BuiltInTriangleIntersectionAttributes
 
 	// Create the new recursive ray
 	RayDesc ray;
-	ray.Origin = WorldRayOrigin() + WorldRayDirection() * RayTCurrent();
+	ray.Origin = hitPosition;
 	ray.Direction = dir;
 	ray.TMin = 0.0001f;
 	ray.TMax = 1000.0f;
@@ -441,6 +628,9 @@ void ClosestHit(inout RayPayload payload, BuiltInTriangleIntersectionAttributes
 		0xFF, 0, 0, 0, // Mask and offsets
 		ray,
 		payload);
+
+	// Whatever the bounce found, plus this surface's direct lighting
+	payload.color += directLight;
 }
 
 
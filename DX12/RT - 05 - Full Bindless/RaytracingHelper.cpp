@@ -4,6 +4,7 @@
 
 #include <d3dcompiler.h>
 #include <DirectXMath.h>
+#include <chrono>
 
 using namespace DirectX;
 
@@ -22,6 +23,11 @@ RaytracingHelper* RaytracingHelper::instance;
 // Makes use of integer division to ensure we are aligned to the proper multiple of "alignment"
 #define ALIGN(value, alignment) (((value + alignment - 1) / alignment) * alignment)
 
+// What a frame did to the TLAS, for reading its timestamps back
+#define TLAS_TIMING_NONE	0
+#define TLAS_TIMING_REFIT	1
+#define TLAS_TIMING_REBUILD	2
+
 // --------------------------------------------------------
 // Clean up any non-smart pointer objects
 // --------------------------------------------------------
@@ -70,6 +76,9 @@ void RaytracingHelper::Initialize(
 	CreateRaytracingPipelineState(raytracingShaderLibraryFile);
 	CreateShaderTable();
 	CreateRaytracingOutputUAV(screenWidth, screenHeight);
+	CreateLightBuffers(256, 511);
+	CreateTLASTimestamps();
+	CreateCompactionBuffers(64);
 
 	// Other init
 	helperInitialized = true;
@@ -94,6 +103,7 @@ void RaytracingHelper::CreateRaytracingRootSignatures()
 		// 2: The CBV to hold scene data
 		// 3: The "bindless" table of the entire heap
 		// 4: Skybox
+		// (The lights and light BVH are root SRVs, so they need no ranges)
 		D3D12_DESCRIPTOR_RANGE outputUAVRange = {};
 		outputUAVRange.BaseShaderRegister = 0;
 		outputUAVRange.NumDescriptors = 2;
@@ -124,7 +134,7 @@ void RaytracingHelper::CreateRaytracingRootSignatures()
 
 		// Set up the root parameters for the global signature
 		// These need to match the shader(s) we'll be using
-		D3D12_ROOT_PARAMETER rootParams[5] = {};
+		D3D12_ROOT_PARAMETER rootParams[7] = {};
 		{
 			// First param is the UAV range for the output texture
 			rootParams[0].ParameterType = D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE;
@@ -155,6 +165,18 @@ void RaytracingHelper::CreateRaytracingRootSignatures()
 			rootParams[4].ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL;
 			rootParams[4].DescriptorTable.NumDescriptorRanges = 1;
 			rootParams[4].DescriptorTable.pDescriptorRanges = &skyboxRange;
+
+			// Sixth is an SRV for the lights
+			rootParams[5].ParameterType = D3D12_ROOT_PARAMETER_TYPE_SRV;
+			rootParams[5].ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL;
+			rootParams[5].Descriptor.ShaderRegister = 3;
+			rootParams[5].Descriptor.RegisterSpace = 0;
+
+			// Seventh is an SRV for the light BVH nodes
+			rootParams[6].ParameterType = D3D12_ROOT_PARAMETER_TYPE_SRV;
+			rootParams[6].ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL;
+			rootParams[6].Descriptor.ShaderRegister = 4;
+			rootParams[6].Descriptor.RegisterSpace = 0;
 		}
 
 		// Create a single static sampler (available to all shaders at the same slot)
@@ -611,6 +633,204 @@ void RaytracingHelper::CreateRaytracingOutputUAV(unsigned int width, unsigned in
 }
 
 
+// --------------------------------------------------------
+// Creates the upload buffers for the lights and light BVH,
+// one of each for every frame that might be in flight
+// --------------------------------------------------------
+void RaytracingHelper::CreateLightBuffers(unsigned int lightCapacity, unsigned int nodeCapacity)
+{
+	lightBufferCapacity = lightCapacity;
+	lightNodeBufferCapacity = nodeCapacity;
+
+	for (unsigned int i = 0; i < NUM_LIGHT_BUFFERS; i++)
+	{
+		lightBuffers[i] = DX12Helper::GetInstance().CreateBuffer(
+			sizeof(Light) * (UINT64)lightCapacity,
+			D3D12_HEAP_TYPE_UPLOAD,
+			D3D12_RESOURCE_STATE_GENERIC_READ);
+
+		lightNodeBuffers[i] = DX12Helper::GetInstance().CreateBuffer(
+			sizeof(LightBVHNode) * (UINT64)nodeCapacity,
+			D3D12_HEAP_TYPE_UPLOAD,
+			D3D12_RESOURCE_STATE_GENERIC_READ);
+	}
+}
+
+
+// --------------------------------------------------------
+// Creates a pair of timestamp queries for each frame that
+// might be in flight, and somewhere to read them back to
+// --------------------------------------------------------
+void RaytracingHelper::CreateTLASTimestamps()
+{
+	D3D12_QUERY_HEAP_DESC queryHeapDesc = {};
+	queryHeapDesc.Type = D3D12_QUERY_HEAP_TYPE_TIMESTAMP;
+	queryHeapDesc.Count = NUM_TLAS_TIMING_FRAMES * 2;
+	dxrDevice->CreateQueryHeap(&queryHeapDesc, IID_PPV_ARGS(tlasTimestampHeap.GetAddressOf()));
+
+	tlasTimestampReadback = DX12Helper::GetInstance().CreateBuffer(
+		sizeof(UINT64) * NUM_TLAS_TIMING_FRAMES * 2,
+		D3D12_HEAP_TYPE_READBACK,
+		D3D12_RESOURCE_STATE_COPY_DEST);
+
+	commandQueue->GetTimestampFrequency(&timestampFrequency);
+}
+
+
+// --------------------------------------------------------
+// Creates the buffers a batch of BLASes' compacted sizes are
+// written to and read back from, with room for the given
+// number of BLASes
+// --------------------------------------------------------
+void RaytracingHelper::CreateCompactionBuffers(unsigned int capacity)
+{
+	blasCompactedSizeCapacity = capacity;
+
+	blasCompactedSizeBuffer = DX12Helper::GetInstance().CreateBuffer(
+		sizeof(D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_COMPACTED_SIZE_DESC) * capacity,
+		D3D12_HEAP_TYPE_DEFAULT,
+		D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
+		D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
+
+	blasCompactedSizeReadback = DX12Helper::GetInstance().CreateBuffer(
+		sizeof(D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_COMPACTED_SIZE_DESC) * capacity,
+		D3D12_HEAP_TYPE_READBACK,
+		D3D12_RESOURCE_STATE_COPY_DEST);
+}
+
+
+// --------------------------------------------------------
+// Makes sure the shared scratch buffer holds at least the
+// given number of bytes.  The GPU might still be using the
+// old one, so wait for it before replacing it.
+// --------------------------------------------------------
+void RaytracingHelper::ReserveScratchBuffer(UINT64 size)
+{
+	if (size <= scratchBufferSizeInBytes)
+		return;
+
+	DX12Helper::GetInstance().WaitForGPU();
+
+	scratchBuffer.Reset();
+	scratchBufferSizeInBytes = size;
+	blasMemoryStats.ScratchBytes = size;
+
+	scratchBuffer = DX12Helper::GetInstance().CreateBuffer(
+		scratchBufferSizeInBytes,
+		D3D12_HEAP_TYPE_DEFAULT,
+		D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
+		D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS,
+		max(D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT, D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT));
+}
+
+
+// --------------------------------------------------------
+// Finds room for an acceleration structure in the pool,
+// adding a block if none of them have enough left.  Nothing
+// is ever freed, as meshes last as long as the program.
+// --------------------------------------------------------
+D3D12_GPU_VIRTUAL_ADDRESS RaytracingHelper::AllocateFromAccelerationStructurePool(UINT64 size)
+{
+	size = ALIGN(size, D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT);
+
+	for (AccelerationStructurePoolBlock& block : accelerationStructurePool)
+	{
+		if (block.Size - block.Used < size)
+			continue;
+
+		D3D12_GPU_VIRTUAL_ADDRESS address = block.Buffer->GetGPUVirtualAddress() + block.Used;
+		block.Used += size;
+		return address;
+	}
+
+	// A new block, big enough for this structure even if it's
+	// larger than a regular block
+	AccelerationStructurePoolBlock block = {};
+	block.Size = max(ACCELERATION_STRUCTURE_POOL_BLOCK_SIZE, size);
+	block.Used = size;
+	block.Buffer = DX12Helper::GetInstance().CreateBuffer(
+		block.Size,
+		D3D12_HEAP_TYPE_DEFAULT,
+		D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE,
+		D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS,
+		max(D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT, D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT));
+	accelerationStructurePool.push_back(block);
+
+	blasMemoryStats.PoolBytes += block.Size;
+	blasMemoryStats.PoolBlocks++;
+	return block.Buffer->GetGPUVirtualAddress();
+}
+
+
+// --------------------------------------------------------
+// Moves on to the next frame's timestamps, reading back the
+// ones the frame before last wrote there (that frame has
+// finished, just like with the light buffers)
+// --------------------------------------------------------
+void RaytracingHelper::ReadTLASTimestamps()
+{
+	tlasTimingIndex = (tlasTimingIndex + 1) % NUM_TLAS_TIMING_FRAMES;
+	if (tlasTimingType[tlasTimingIndex] == TLAS_TIMING_NONE || timestampFrequency == 0)
+		return;
+
+	D3D12_RANGE readRange = {};
+	readRange.Begin = sizeof(UINT64) * tlasTimingIndex * 2;
+	readRange.End = readRange.Begin + sizeof(UINT64) * 2;
+	D3D12_RANGE writeRange = {};
+
+	UINT64* timestamps = 0;
+	tlasTimestampReadback->Map(0, &readRange, (void**)&timestamps);
+	double milliseconds = (timestamps[tlasTimingIndex * 2 + 1] - timestamps[tlasTimingIndex * 2]) * 1000.0 / timestampFrequency;
+	tlasTimestampReadback->Unmap(0, &writeRange);
+
+	if (tlasTimingType[tlasTimingIndex] == TLAS_TIMING_REBUILD)
+		tlasBuildStats.RebuildGPUMilliseconds = milliseconds;
+	else
+		tlasBuildStats.RefitGPUMilliseconds = milliseconds;
+
+	tlasTimingType[tlasTimingIndex] = TLAS_TIMING_NONE;
+}
+
+
+// --------------------------------------------------------
+// Did Initialize() find DXR support and finish setting up?
+// If not, nothing here does any work (the CPU raytracer can
+// still render the scenes).
+// --------------------------------------------------------
+bool RaytracingHelper::IsAvailable()
+{
+	return dxrAvailable && helperInitialized;
+}
+
+
+// --------------------------------------------------------
+// Turns TLAS refitting on or off - when off, the TLAS is
+// rebuilt from scratch every frame
+// --------------------------------------------------------
+void RaytracingHelper::SetTLASRefitEnabled(bool enabled)
+{
+	tlasRefitEnabled = enabled;
+}
+
+
+// --------------------------------------------------------
+// Gets what happened to the TLAS last frame
+// --------------------------------------------------------
+TLASBuildStats RaytracingHelper::GetTLASBuildStats()
+{
+	return tlasBuildStats;
+}
+
+
+// --------------------------------------------------------
+// Gets the memory used by every BLAS created so far
+// --------------------------------------------------------
+BLASMemoryStats RaytracingHelper::GetBLASMemoryStats()
+{
+	return blasMemoryStats;
+}
+
+
 // --------------------------------------------------------
 // If the window size changes, so too should the output texture
 // --------------------------------------------------------
@@ -633,71 +853,60 @@ void RaytracingHelper::ResizeOutputUAV(unsigned int screenWidth, unsigned int sc
 
 
 // --------------------------------------------------------
-// Creates a BLAS for a particular mesh and returns the
+// Sets up raytracing for a particular mesh and returns the
 // data associated with it.  Presumably this data will be
 // stored along with the associated mesh.
+//
+// The mesh's BLAS isn't built yet, just queued up for the
+// next BuildBottomLevelAccelerationStructures(), so creating
+// lots of meshes doesn't wait on the GPU for each one.
 // --------------------------------------------------------
 MeshRaytracingData RaytracingHelper::CreateBottomLevelAccelerationStructureForMesh(Mesh* mesh)
 {
 	MeshRaytracingData raytracingData = {};
+	if (!dxrAvailable || !helperInitialized)
+		return raytracingData;
 
 	// Describe the geometry data we intend to store in this BLAS
-	D3D12_RAYTRACING_GEOMETRY_DESC geometryDesc = {};
-	geometryDesc.Type = D3D12_RAYTRACING_GEOMETRY_TYPE_TRIANGLES;
-	geometryDesc.Triangles.VertexBuffer.StartAddress = mesh->GetVBResource()->GetGPUVirtualAddress();
-	geometryDesc.Triangles.VertexBuffer.StrideInBytes = mesh->GetVBView().StrideInBytes;
-	geometryDesc.Triangles.VertexCount = static_cast<UINT>(mesh->GetVertexCount());
-	geometryDesc.Triangles.VertexFormat = DXGI_FORMAT_R32G32B32_FLOAT;
-	geometryDesc.Triangles.IndexBuffer = mesh->GetIBResource()->GetGPUVirtualAddress();
-	geometryDesc.Triangles.IndexFormat = mesh->GetIBView().Format;
-	geometryDesc.Triangles.IndexCount = static_cast<UINT>(mesh->GetIndexCount());
-	geometryDesc.Triangles.Transform3x4 = 0;
-	geometryDesc.Flags = D3D12_RAYTRACING_GEOMETRY_FLAG_OPAQUE; // Performance boost when dealing with opaque geometry
+	PendingBLAS pending = {};
+	pending.VertexBuffer = mesh->GetVBResource();
+	pending.IndexBuffer = mesh->GetIBResource();
+	pending.Geometry.Type = D3D12_RAYTRACING_GEOMETRY_TYPE_TRIANGLES;
+	pending.Geometry.Triangles.VertexBuffer.StartAddress = pending.VertexBuffer->GetGPUVirtualAddress();
+	pending.Geometry.Triangles.VertexBuffer.StrideInBytes = mesh->GetVBView().StrideInBytes;
+	pending.Geometry.Triangles.VertexCount = static_cast<UINT>(mesh->GetVertexCount());
+	pending.Geometry.Triangles.VertexFormat = DXGI_FORMAT_R32G32B32_FLOAT;
+	pending.Geometry.Triangles.IndexBuffer = pending.IndexBuffer->GetGPUVirtualAddress();
+	pending.Geometry.Triangles.IndexFormat = mesh->GetIBView().Format;
+	pending.Geometry.Triangles.IndexCount = static_cast<UINT>(mesh->GetIndexCount());
+	pending.Geometry.Triangles.Transform3x4 = 0;
+	pending.Geometry.Flags = D3D12_RAYTRACING_GEOMETRY_FLAG_OPAQUE; // Performance boost when dealing with opaque geometry
 
 	// Describe our overall input so we can get sizing info
 	D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS accelStructInputs = {};
 	accelStructInputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
 	accelStructInputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
-	accelStructInputs.pGeometryDescs = &geometryDesc;
+	accelStructInputs.pGeometryDescs = &pending.Geometry;
 	accelStructInputs.NumDescs = 1;
-	accelStructInputs.Flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE;
+	accelStructInputs.Flags =
+		D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE |
+		D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_COMPACTION;
 
 	D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO accelStructPrebuildInfo = {};
 	dxrDevice->GetRaytracingAccelerationStructurePrebuildInfo(&accelStructInputs, &accelStructPrebuildInfo);
 
-	// Handle alignment requirements ourselves
-	accelStructPrebuildInfo.ScratchDataSizeInBytes = ALIGN(accelStructPrebuildInfo.ScratchDataSizeInBytes, D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT);
-	accelStructPrebuildInfo.ResultDataMaxSizeInBytes = ALIGN(accelStructPrebuildInfo.ResultDataMaxSizeInBytes, D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT);
-
-	// Create a scratch buffer so the device has a place to temporarily store data
-	Microsoft::WRL::ComPtr<ID3D12Resource> blasScratchBuffer = DX12Helper::GetInstance().CreateBuffer(
-		accelStructPrebuildInfo.ScratchDataSizeInBytes,
-		D3D12_HEAP_TYPE_DEFAULT,
-		D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
-		D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS,
-		max(D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT, D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT));
-
-	// Create the final buffer for the BLAS
-	raytracingData.BLAS = DX12Helper::GetInstance().CreateBuffer(
-		accelStructPrebuildInfo.ResultDataMaxSizeInBytes,
-		D3D12_HEAP_TYPE_DEFAULT,
-		D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE,
-		D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS,
-		max(D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT, D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT));
+	// Handle alignment requirements ourselves, since builds
+	// share buffers with each other
+	pending.ScratchSizeInBytes = ALIGN(accelStructPrebuildInfo.ScratchDataSizeInBytes, D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT);
+	pending.BuildSizeInBytes = ALIGN(accelStructPrebuildInfo.ResultDataMaxSizeInBytes, D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT);
 
-	// Describe the final BLAS and set up the build
-	D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC buildDesc = {};
-	buildDesc.Inputs = accelStructInputs;
-	buildDesc.ScratchAccelerationStructureData = blasScratchBuffer->GetGPUVirtualAddress();
-	buildDesc.DestAccelerationStructureData = raytracingData.BLAS->GetGPUVirtualAddress();
-	dxrCommandList->BuildRaytracingAccelerationStructure(&buildDesc, 0, 0);
-
-	// Set up a barrier to wait until the BLAS is actually built to proceed
-	D3D12_RESOURCE_BARRIER blasBarrier = {};
-	blasBarrier.Type = D3D12_RESOURCE_BARRIER_TYPE_UAV;
-	blasBarrier.UAV.pResource = raytracingData.BLAS.Get();
-	blasBarrier.Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
-	dxrCommandList->ResourceBarrier(1, &blasBarrier);
+	// Use the BLAS count as the hit group index for this mesh,
+	// which is also where its BLAS's address will end up
+	raytracingData.HitGroupIndex = blasCount;
+	pending.HitGroupIndex = blasCount;
+	pendingBLASes.push_back(pending);
+	blasAddresses.push_back(0);
+	blasCount++;
 
 	// Create two SRVs for the index and vertex buffers
 	// Note: These must come one after the other in the descriptor heap, and index must come first
@@ -728,18 +937,6 @@ MeshRaytracingData RaytracingHelper::CreateBottomLevelAccelerationStructureForMe
 	vertexSRVDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
 	dxrDevice->CreateShaderResourceView(mesh->GetVBResource().Get(), &vertexSRVDesc, vb_cpu);
 
-	// All done - execute, wait and reset command list
-	dxrCommandList->Close();
-	ID3D12CommandList* lists[] = { dxrCommandList.Get() };
-	commandQueue->ExecuteCommandLists(1, lists);
-
-	DX12Helper::GetInstance().WaitForGPU();
-	dxrCommandList->Reset(DX12Helper::GetInstance().GetDefaultAllocator().Get(), 0);
-
-	// Use the BLAS count as the hit group index for this mesh
-	raytracingData.HitGroupIndex = blasCount;
-	blasCount++;
-
 	// Put this mesh's buffer SRVs in the appropriate shader table entry
 	unsigned char* tablePointer = 0;
 	shaderTable->Map(0, 0, (void**)&tablePointer);
@@ -764,16 +961,189 @@ MeshRaytracingData RaytracingHelper::CreateBottomLevelAccelerationStructureForMe
 }
 
 
+// --------------------------------------------------------
+// Builds and compacts every BLAS queued up since the last
+// call, waiting on the GPU just twice for the whole batch:
+//  - Every build is recorded, each into its own part of the
+//    build and scratch buffers, followed by a request for all
+//    of their compacted sizes, then it's executed and waited on
+//  - Once the sizes are read back, every compacting copy into
+//    the pool is recorded, executed and waited on, after which
+//    the build buffer is free for the next batch
+// --------------------------------------------------------
+void RaytracingHelper::BuildBottomLevelAccelerationStructures()
+{
+	if (!dxrAvailable || !helperInitialized || pendingBLASes.empty())
+		return;
+
+	// Where each build goes and where it does its work
+	unsigned int count = (unsigned int)pendingBLASes.size();
+	std::vector<UINT64> buildOffsets(count);
+	std::vector<UINT64> scratchOffsets(count);
+	UINT64 buildBytes = 0;
+	UINT64 scratchBytes = 0;
+	for (unsigned int i = 0; i < count; i++)
+	{
+		buildOffsets[i] = buildBytes;
+		scratchOffsets[i] = scratchBytes;
+		buildBytes += pendingBLASes[i].BuildSizeInBytes;
+		scratchBytes += pendingBLASes[i].ScratchSizeInBytes;
+	}
+
+	// Make sure everything is big enough - the last batch was
+	// waited on, so none of these are still in use
+	ReserveScratchBuffer(scratchBytes);
+	if (buildBytes > blasBuildBufferSizeInBytes)
+	{
+		blasBuildBuffer.Reset();
+		blasBuildBufferSizeInBytes = buildBytes;
+		blasMemoryStats.BuildBufferBytes = blasBuildBufferSizeInBytes;
+
+		blasBuildBuffer = DX12Helper::GetInstance().CreateBuffer(
+			blasBuildBufferSizeInBytes,
+			D3D12_HEAP_TYPE_DEFAULT,
+			D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE,
+			D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS,
+			max(D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT, D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT));
+	}
+	if (count > blasCompactedSizeCapacity)
+		CreateCompactionBuffers(max(blasCompactedSizeCapacity * 2, count));
+
+	// Record every build - they don't share any memory, so
+	// the GPU is free to overlap them
+	std::vector<D3D12_GPU_VIRTUAL_ADDRESS> uncompactedBLASes(count);
+	for (unsigned int i = 0; i < count; i++)
+	{
+		D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS accelStructInputs = {};
+		accelStructInputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
+		accelStructInputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
+		accelStructInputs.pGeometryDescs = &pendingBLASes[i].Geometry;
+		accelStructInputs.NumDescs = 1;
+		accelStructInputs.Flags =
+			D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE |
+			D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_COMPACTION;
+
+		uncompactedBLASes[i] = blasBuildBuffer->GetGPUVirtualAddress() + buildOffsets[i];
+
+		D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC buildDesc = {};
+		buildDesc.Inputs = accelStructInputs;
+		buildDesc.ScratchAccelerationStructureData = scratchBuffer->GetGPUVirtualAddress() + scratchOffsets[i];
+		buildDesc.DestAccelerationStructureData = uncompactedBLASes[i];
+		dxrCommandList->BuildRaytracingAccelerationStructure(&buildDesc, 0, 0);
+	}
+
+	// Set up a barrier to wait until every BLAS is actually built to proceed
+	D3D12_RESOURCE_BARRIER blasBarrier = {};
+	blasBarrier.Type = D3D12_RESOURCE_BARRIER_TYPE_UAV;
+	blasBarrier.UAV.pResource = blasBuildBuffer.Get();
+	blasBarrier.Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
+	dxrCommandList->ResourceBarrier(1, &blasBarrier);
+
+	// Ask how big they'll all be once compacted (one size after
+	// another in the buffer), and copy that to the readback buffer
+	D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_DESC postbuildInfoDesc = {};
+	postbuildInfoDesc.InfoType = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_COMPACTED_SIZE;
+	postbuildInfoDesc.DestBuffer = blasCompactedSizeBuffer->GetGPUVirtualAddress();
+	dxrCommandList->EmitRaytracingAccelerationStructurePostbuildInfo(&postbuildInfoDesc, count, &uncompactedBLASes[0]);
+
+	UINT64 sizeBytes = sizeof(D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_COMPACTED_SIZE_DESC) * count;
+	D3D12_RESOURCE_BARRIER sizeBarrier = {};
+	sizeBarrier.Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
+	sizeBarrier.Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
+	sizeBarrier.Transition.pResource = blasCompactedSizeBuffer.Get();
+	sizeBarrier.Transition.StateBefore = D3D12_RESOURCE_STATE_UNORDERED_ACCESS;
+	sizeBarrier.Transition.StateAfter = D3D12_RESOURCE_STATE_COPY_SOURCE;
+	sizeBarrier.Transition.Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES;
+	dxrCommandList->ResourceBarrier(1, &sizeBarrier);
+	dxrCommandList->CopyBufferRegion(blasCompactedSizeReadback.Get(), 0, blasCompactedSizeBuffer.Get(), 0, sizeBytes);
+
+	sizeBarrier.Transition.StateBefore = D3D12_RESOURCE_STATE_COPY_SOURCE;
+	sizeBarrier.Transition.StateAfter = D3D12_RESOURCE_STATE_UNORDERED_ACCESS;
+	dxrCommandList->ResourceBarrier(1, &sizeBarrier);
+
+	// Execute, wait and reset command list so the compacted sizes are ready
+	dxrCommandList->Close();
+	ID3D12CommandList* lists[] = { dxrCommandList.Get() };
+	commandQueue->ExecuteCommandLists(1, lists);
+
+	DX12Helper::GetInstance().WaitForGPU();
+	dxrCommandList->Reset(DX12Helper::GetInstance().GetDefaultAllocator().Get(), 0);
+
+	// Read back all of the compacted sizes
+	std::vector<D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_COMPACTED_SIZE_DESC> compactedSizes(count);
+	D3D12_RANGE readRange = { 0, (SIZE_T)sizeBytes };
+	D3D12_RANGE writeRange = {};
+	void* mappedSizes = 0;
+	blasCompactedSizeReadback->Map(0, &readRange, &mappedSizes);
+	memcpy(&compactedSizes[0], mappedSizes, (size_t)sizeBytes);
+	blasCompactedSizeReadback->Unmap(0, &writeRange);
+
+	// Make room for each one in the pool and copy (compact) it there
+	for (unsigned int i = 0; i < count; i++)
+	{
+		UINT64 compactedSizeInBytes = ALIGN(compactedSizes[i].CompactedSizeInBytes, D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT);
+		D3D12_GPU_VIRTUAL_ADDRESS compactedBLAS = AllocateFromAccelerationStructurePool(compactedSizeInBytes);
+		blasAddresses[pendingBLASes[i].HitGroupIndex] = compactedBLAS;
+
+		dxrCommandList->CopyRaytracingAccelerationStructure(
+			compactedBLAS,
+			uncompactedBLASes[i],
+			D3D12_RAYTRACING_ACCELERATION_STRUCTURE_COPY_MODE_COMPACT);
+
+		blasMemoryStats.BLASCount++;
+		blasMemoryStats.UncompactedBytes += pendingBLASes[i].BuildSizeInBytes;
+		blasMemoryStats.CompactedBytes += compactedSizeInBytes;
+	}
+
+	blasBarrier.UAV.pResource = 0; // Any UAV, as the BLASes are just parts of pool blocks
+	dxrCommandList->ResourceBarrier(1, &blasBarrier);
+
+	// Wait until the copies are done, since the build buffer
+	// gets reused for the next batch
+	dxrCommandList->Close();
+	commandQueue->ExecuteCommandLists(1, lists);
+
+	DX12Helper::GetInstance().WaitForGPU();
+	dxrCommandList->Reset(DX12Helper::GetInstance().GetDefaultAllocator().Get(), 0);
+
+	pendingBLASes.clear();
+}
+
+
+// --------------------------------------------------------
+// Gets the compacted BLAS for the mesh with the given hit
+// group index, or 0 if it hasn't been built yet
+// --------------------------------------------------------
+D3D12_GPU_VIRTUAL_ADDRESS RaytracingHelper::GetBLAS(unsigned int hitGroupIndex)
+{
+	return hitGroupIndex < blasAddresses.size() ? blasAddresses[hitGroupIndex] : 0;
+}
+
+
 // --------------------------------------------------------
 // Creates the top level accel structure for a vector of
 // game entities (a "scene"), using the meshes and transforms
 // of each entity for the BLAS instances.
+//
+// The TLAS is only rebuilt from scratch when the instances
+// change (a different scene, or an entity's mesh changing).
+// When just their transforms or hit groups have changed, the
+// TLAS is refit in place, and when nothing has changed it's
+// left alone.  Each build reads its instance descs from the
+// next of a ring of upload buffers, so frames still in flight
+// keep the descs they were built with.
 // --------------------------------------------------------
 void RaytracingHelper::CreateTopLevelAccelerationStructureForScene(std::vector<std::shared_ptr<GameEntity>> scene)
 {
-	if (scene.size() == 0)
+	if (!dxrAvailable || !helperInitialized || scene.size() == 0)
 		return;
 
+	// Any meshes created since the last batch need their BLASes first
+	BuildBottomLevelAccelerationStructures();
+
+	auto cpuStart = std::chrono::high_resolution_clock::now();
+	ReadTLASTimestamps();
+
 	// Create vector of instance descriptions
 	std::vector<D3D12_RAYTRACING_INSTANCE_DESC> instanceDescs;
 
@@ -809,7 +1179,7 @@ void RaytracingHelper::CreateTopLevelAccelerationStructureForScene(std::vector<s
 		id.InstanceID = instanceIDs[meshBlasIndex];
 		id.InstanceMask = 0xFF;
 		memcpy(&id.Transform, &transform, sizeof(float) * 3 * 4); // Copy first [3][4] elements
-		id.AccelerationStructure = mesh->GetRaytracingData().BLAS->GetGPUVirtualAddress();
+		id.AccelerationStructure = GetBLAS(meshBlasIndex);
 		id.Flags = D3D12_RAYTRACING_INSTANCE_FLAG_NONE;
 		instanceDescs.push_back(id);
 
@@ -844,79 +1214,165 @@ void RaytracingHelper::CreateTopLevelAccelerationStructureForScene(std::vector<s
 		instanceIDs[meshBlasIndex]++;
 	}
 
-	// Is our current description buffer too small?
-	if (sizeof(D3D12_RAYTRACING_INSTANCE_DESC) * instanceDescs.size() > tlasInstanceDataSizeInBytes)
+	// Different instances (or too many refits) need a full rebuild
+	bool rebuild =
+		!tlasRefitEnabled ||
+		tlasRefitCount >= MAX_TLAS_REFITS ||
+		instanceDescs.size() != tlasInstanceDescs.size();
+	for (size_t i = 0; !rebuild && i < instanceDescs.size(); i++)
+		rebuild = instanceDescs[i].AccelerationStructure != tlasInstanceDescs[i].AccelerationStructure;
+
+	// How many instances changed since the last build
+	unsigned int dirtyInstances = 0;
+	for (size_t i = 0; i < instanceDescs.size(); i++)
 	{
-		// Create a new buffer to hold instance descriptions, since they
-		// need to actually be on the GPU
-		tlasInstanceDescBuffer.Reset();
-		tlasInstanceDataSizeInBytes = sizeof(D3D12_RAYTRACING_INSTANCE_DESC) * instanceDescs.size();
+		if (i >= tlasInstanceDescs.size() || memcmp(&instanceDescs[i], &tlasInstanceDescs[i], sizeof(D3D12_RAYTRACING_INSTANCE_DESC)) != 0)
+			dirtyInstances++;
+	}
 
-		tlasInstanceDescBuffer = DX12Helper::GetInstance().CreateBuffer(
-			tlasInstanceDataSizeInBytes,
-			D3D12_HEAP_TYPE_UPLOAD,
-			D3D12_RESOURCE_STATE_GENERIC_READ);
+	if (rebuild || dirtyInstances > 0)
+	{
+		// Are our description buffers too small?  The GPU might still
+		// be reading the old ones, so wait for it before replacing them.
+		if (sizeof(D3D12_RAYTRACING_INSTANCE_DESC) * instanceDescs.size() > tlasInstanceDataSizeInBytes)
+		{
+			DX12Helper::GetInstance().WaitForGPU();
+			tlasInstanceDataSizeInBytes = sizeof(D3D12_RAYTRACING_INSTANCE_DESC) * instanceDescs.size();
+
+			for (unsigned int b = 0; b < NUM_TLAS_INSTANCE_BUFFERS; b++)
+			{
+				tlasInstanceDescBuffers[b] = DX12Helper::GetInstance().CreateBuffer(
+					tlasInstanceDataSizeInBytes,
+					D3D12_HEAP_TYPE_UPLOAD,
+					D3D12_RESOURCE_STATE_GENERIC_READ);
+				tlasInstanceDescBufferContents[b].clear();
+			}
+		}
+
+		// On to the next buffer, which the GPU is done with since
+		// the frame that last built from it has finished
+		tlasInstanceBufferIndex = (tlasInstanceBufferIndex + 1) % NUM_TLAS_INSTANCE_BUFFERS;
+		std::vector<D3D12_RAYTRACING_INSTANCE_DESC>& contents = tlasInstanceDescBufferContents[tlasInstanceBufferIndex];
+
+		// Copy the descriptions that differ from what this
+		// buffer held (every one, if the count changed)
+		bool writeAll = instanceDescs.size() != contents.size();
+		unsigned char* mapped = 0;
+		tlasInstanceDescBuffers[tlasInstanceBufferIndex]->Map(0, 0, (void**)&mapped);
+		for (size_t i = 0; i < instanceDescs.size(); i++)
+		{
+			if (!writeAll && memcmp(&instanceDescs[i], &contents[i], sizeof(D3D12_RAYTRACING_INSTANCE_DESC)) == 0)
+				continue;
+
+			memcpy(mapped + sizeof(D3D12_RAYTRACING_INSTANCE_DESC) * i, &instanceDescs[i], sizeof(D3D12_RAYTRACING_INSTANCE_DESC));
+		}
+		tlasInstanceDescBuffers[tlasInstanceBufferIndex]->Unmap(0, 0);
+		contents = instanceDescs;
+		tlasInstanceDescs = instanceDescs;
+
+		BuildTopLevelAccelerationStructure((unsigned int)instanceDescs.size(), rebuild);
 	}
 
-	// TODO: Probably make a small ring buffer (exactly 3) of these buffers
-	//       to coincide with our frame sync stuff!
-	// 
-	// Copy the descriptions into the buffer
-	unsigned char* mapped = 0;
-	tlasInstanceDescBuffer->Map(0, 0, (void**)&mapped);
-	memcpy(mapped, &instanceDescs[0], sizeof(D3D12_RAYTRACING_INSTANCE_DESC) * instanceDescs.size());
-	tlasInstanceDescBuffer->Unmap(0, 0);
+	tlasBuildStats.Built = rebuild || dirtyInstances > 0;
+	tlasBuildStats.Rebuilt = rebuild;
+	tlasBuildStats.Instances = (unsigned int)instanceDescs.size();
+	tlasBuildStats.DirtyInstances = dirtyInstances;
+	tlasBuildStats.RefitsSinceRebuild = tlasRefitCount;
 
+	// Finalize the entity data cbuffer stuff and copy descriptors to shader table
+	unsigned char* tablePointer = 0;
+	shaderTable->Map(0, 0, (void**)&tablePointer);
+	tablePointer += shaderTableRecordSize * 2; // Get past raygen and miss shaders
+	for(int i = 0; i < entityData.size(); i++)
+	{
+		// Need to get to the first descriptor in this hit group's record
+		unsigned char* hitGroupPointer = tablePointer + shaderTableRecordSize * NUM_HIT_GROUPS * i;
+		hitGroupPointer += D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES; // Get past identifier
+
+		// Copy the data to the CB ring buffer and grab associated CBV to place in shader table
+		D3D12_GPU_DESCRIPTOR_HANDLE cbv = DX12Helper::GetInstance().FillNextConstantBufferAndGetGPUDescriptorHandle(&entityData[i], sizeof(RaytracingEntityData));
+		memcpy(hitGroupPointer, &cbv, sizeof(D3D12_GPU_DESCRIPTOR_HANDLE)); // Normal
+
+		hitGroupPointer += shaderTableRecordSize;
+		memcpy(hitGroupPointer, &cbv, sizeof(D3D12_GPU_DESCRIPTOR_HANDLE)); // Transparent
+
+		hitGroupPointer += shaderTableRecordSize;
+		memcpy(hitGroupPointer, &cbv, sizeof(D3D12_GPU_DESCRIPTOR_HANDLE)); // Emissive
+	}
+	shaderTable->Unmap(0, 0);
+
+	auto cpuEnd = std::chrono::high_resolution_clock::now();
+	tlasBuildStats.CPUMilliseconds = std::chrono::duration<double, std::milli>(cpuEnd - cpuStart).count();
+}
+
+
+// --------------------------------------------------------
+// Records a build of the TLAS from the current instance desc
+// buffer, either from scratch or as an in place update of the
+// last build, between a pair of timestamps
+// --------------------------------------------------------
+void RaytracingHelper::BuildTopLevelAccelerationStructure(unsigned int instanceCount, bool rebuild)
+{
 	// Describe our overall input so we can get sizing info
 	D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS accelStructInputs = {};
 	accelStructInputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL;
 	accelStructInputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
-	accelStructInputs.InstanceDescs = tlasInstanceDescBuffer->GetGPUVirtualAddress();
-	accelStructInputs.NumDescs = (unsigned int)instanceDescs.size();
-	accelStructInputs.Flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE;
+	accelStructInputs.InstanceDescs = tlasInstanceDescBuffers[tlasInstanceBufferIndex]->GetGPUVirtualAddress();
+	accelStructInputs.NumDescs = instanceCount;
+	accelStructInputs.Flags =
+		D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE |
+		D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE;
 
-	D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO accelStructPrebuildInfo = {};
-	dxrDevice->GetRaytracingAccelerationStructurePrebuildInfo(&accelStructInputs, &accelStructPrebuildInfo);
+	if (rebuild)
+	{
+		D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO accelStructPrebuildInfo = {};
+		dxrDevice->GetRaytracingAccelerationStructurePrebuildInfo(&accelStructInputs, &accelStructPrebuildInfo);
 
-	// Handle alignment requirements ourselves
-	accelStructPrebuildInfo.ScratchDataSizeInBytes = ALIGN(accelStructPrebuildInfo.ScratchDataSizeInBytes, D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT);
-	accelStructPrebuildInfo.ResultDataMaxSizeInBytes = ALIGN(accelStructPrebuildInfo.ResultDataMaxSizeInBytes, D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT);
+		// Handle alignment requirements ourselves, and leave
+		// enough scratch space for refits too
+		accelStructPrebuildInfo.ScratchDataSizeInBytes = ALIGN(
+			max(accelStructPrebuildInfo.ScratchDataSizeInBytes, accelStructPrebuildInfo.UpdateScratchDataSizeInBytes),
+			D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT);
+		accelStructPrebuildInfo.ResultDataMaxSizeInBytes = ALIGN(accelStructPrebuildInfo.ResultDataMaxSizeInBytes, D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT);
 
-	// Is our current scratch size too small?
-	if (accelStructPrebuildInfo.ScratchDataSizeInBytes > tlasScratchSizeInBytes)
-	{
-		// Create a new scratch buffer
-		tlasScratchBuffer.Reset();
-		tlasScratchSizeInBytes = accelStructPrebuildInfo.ScratchDataSizeInBytes;
+		// Make sure the shared scratch buffer is big enough
+		ReserveScratchBuffer(accelStructPrebuildInfo.ScratchDataSizeInBytes);
 
-		tlasScratchBuffer = DX12Helper::GetInstance().CreateBuffer(
-			tlasScratchSizeInBytes,
-			D3D12_HEAP_TYPE_DEFAULT,
-			D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
-			D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS,
-			max(D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT, D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT));
-	}
+		// Is our current tlas too small?
+		if (accelStructPrebuildInfo.ResultDataMaxSizeInBytes > tlasBufferSizeInBytes)
+		{
+			// Create a new tlas buffer
+			topLevelAccelerationStructure.Reset();
+			tlasBufferSizeInBytes = accelStructPrebuildInfo.ResultDataMaxSizeInBytes;
+
+			topLevelAccelerationStructure = DX12Helper::GetInstance().CreateBuffer(
+				accelStructPrebuildInfo.ResultDataMaxSizeInBytes,
+				D3D12_HEAP_TYPE_DEFAULT,
+				D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE,
+				D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS,
+				max(D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT, D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT));
+		}
 
-	// Is our current tlas too small?
-	if (accelStructPrebuildInfo.ResultDataMaxSizeInBytes > tlasBufferSizeInBytes)
+		tlasRefitCount = 0;
+		tlasBuildStats.TotalRebuilds++;
+	}
+	else
 	{
-		// Create a new tlas buffer
-		topLevelAccelerationStructure.Reset();
-		tlasBufferSizeInBytes = accelStructPrebuildInfo.ResultDataMaxSizeInBytes;
-
-		topLevelAccelerationStructure = DX12Helper::GetInstance().CreateBuffer(
-			accelStructPrebuildInfo.ResultDataMaxSizeInBytes,
-			D3D12_HEAP_TYPE_DEFAULT,
-			D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE,
-			D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS,
-			max(D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT, D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT));
+		// Update the last build in place
+		accelStructInputs.Flags |= D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PERFORM_UPDATE;
+		tlasRefitCount++;
+		tlasBuildStats.TotalRefits++;
 	}
 
 	// Describe the final TLAS and set up the build
 	D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC buildDesc = {};
 	buildDesc.Inputs = accelStructInputs;
-	buildDesc.ScratchAccelerationStructureData = tlasScratchBuffer->GetGPUVirtualAddress();
+	buildDesc.ScratchAccelerationStructureData = scratchBuffer->GetGPUVirtualAddress();
 	buildDesc.DestAccelerationStructureData = topLevelAccelerationStructure->GetGPUVirtualAddress();
+	if (!rebuild)
+		buildDesc.SourceAccelerationStructureData = buildDesc.DestAccelerationStructureData;
+
+	dxrCommandList->EndQuery(tlasTimestampHeap.Get(), D3D12_QUERY_TYPE_TIMESTAMP, tlasTimingIndex * 2);
 	dxrCommandList->BuildRaytracingAccelerationStructure(&buildDesc, 0, 0);
 
 	// Set up a barrier to wait until the TLAS is actually built to proceed
@@ -928,27 +1384,62 @@ void RaytracingHelper::CreateTopLevelAccelerationStructureForScene(std::vector<s
 	tlasBarrier.Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
 	dxrCommandList->ResourceBarrier(1, &tlasBarrier);
 
-	// Finalize the entity data cbuffer stuff and copy descriptors to shader table
-	unsigned char* tablePointer = 0;
-	shaderTable->Map(0, 0, (void**)&tablePointer);
-	tablePointer += shaderTableRecordSize * 2; // Get past raygen and miss shaders
-	for(int i = 0; i < entityData.size(); i++)
-	{
-		// Need to get to the first descriptor in this hit group's record
-		unsigned char* hitGroupPointer = tablePointer + shaderTableRecordSize * NUM_HIT_GROUPS * i;
-		hitGroupPointer += D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES; // Get past identifier
+	// Time the build, reading the results back a few frames from now
+	dxrCommandList->EndQuery(tlasTimestampHeap.Get(), D3D12_QUERY_TYPE_TIMESTAMP, tlasTimingIndex * 2 + 1);
+	dxrCommandList->ResolveQueryData(
+		tlasTimestampHeap.Get(),
+		D3D12_QUERY_TYPE_TIMESTAMP,
+		tlasTimingIndex * 2,
+		2,
+		tlasTimestampReadback.Get(),
+		sizeof(UINT64) * tlasTimingIndex * 2);
+	tlasTimingType[tlasTimingIndex] = rebuild ? TLAS_TIMING_REBUILD : TLAS_TIMING_REFIT;
+}
 
-		// Copy the data to the CB ring buffer and grab associated CBV to place in shader table
-		D3D12_GPU_DESCRIPTOR_HANDLE cbv = DX12Helper::GetInstance().FillNextConstantBufferAndGetGPUDescriptorHandle(&entityData[i], sizeof(RaytracingEntityData));
-		memcpy(hitGroupPointer, &cbv, sizeof(D3D12_GPU_DESCRIPTOR_HANDLE)); // Normal
 
-		hitGroupPointer += shaderTableRecordSize;
-		memcpy(hitGroupPointer, &cbv, sizeof(D3D12_GPU_DESCRIPTOR_HANDLE)); // Transparent
+// --------------------------------------------------------
+// Copies this frame's lights and light BVH nodes to the
+// next set of upload buffers, growing them if necessary
+// --------------------------------------------------------
+void RaytracingHelper::UpdateLights(const std::vector<Light>& lights, const std::vector<LightBVHNode>& nodes)
+{
+	if (!dxrAvailable || !helperInitialized)
+		return;
 
-		hitGroupPointer += shaderTableRecordSize;
-		memcpy(hitGroupPointer, &cbv, sizeof(D3D12_GPU_DESCRIPTOR_HANDLE)); // Emissive
+	// Too small?  The GPU might still be reading the old
+	// buffers, so wait for it before replacing them.
+	if (lights.size() > lightBufferCapacity || nodes.size() > lightNodeBufferCapacity)
+	{
+		DX12Helper::GetInstance().WaitForGPU();
+		CreateLightBuffers(
+			max(lightBufferCapacity * 2, (unsigned int)lights.size()),
+			max(lightNodeBufferCapacity * 2, (unsigned int)nodes.size()));
 	}
-	shaderTable->Unmap(0, 0);
+
+	// On to the next set, which the GPU is done with
+	// since the frame that last used it has finished
+	lightBufferIndex = (lightBufferIndex + 1) % NUM_LIGHT_BUFFERS;
+	lightCount = (unsigned int)lights.size();
+
+	unsigned char* mapped = 0;
+	if (!lights.empty())
+	{
+		lightBuffers[lightBufferIndex]->Map(0, 0, (void**)&mapped);
+		memcpy(mapped, &lights[0], sizeof(Light) * lights.size());
+		lightBuffers[lightBufferIndex]->Unmap(0, 0);
+	}
+
+	// An empty tree (no point lights) is uploaded as a single
+	// leaf for light 0, which the shader then skips
+	LightBVHNode emptyLeaf = {};
+	emptyLeaf.Child = -1;
+
+	lightNodeBuffers[lightBufferIndex]->Map(0, 0, (void**)&mapped);
+	if (nodes.empty())
+		memcpy(mapped, &emptyLeaf, sizeof(LightBVHNode));
+	else
+		memcpy(mapped, &nodes[0], sizeof(LightBVHNode) * nodes.size());
+	lightNodeBuffers[lightBufferIndex]->Unmap(0, 0);
 }
 
 
@@ -964,6 +1455,7 @@ void RaytracingHelper::Raytrace(
 	DirectX::XMFLOAT3 skyDownColor,
 	D3D12_GPU_DESCRIPTOR_HANDLE skyboxHandle,
 	unsigned int accumulationFrameCount,
+	int lightSampling,
 	bool executeCommandList)
 {
 	if (!dxrAvailable || !helperInitialized)
@@ -995,6 +1487,8 @@ void RaytracingHelper::Raytrace(
 	sceneData.skyUpColor = skyUpColor;
 	sceneData.skyDownColor = skyDownColor;
 	sceneData.accumulationFrameCount = accumulationFrameCount;
+	sceneData.lightCount = lightCount;
+	sceneData.lightSampling = lightSampling;
 	
 	DirectX::XMFLOAT4X4 view = camera->GetView();
 	DirectX::XMFLOAT4X4 proj = camera->GetProjection();
@@ -1022,6 +1516,8 @@ void RaytracingHelper::Raytrace(
 		dxrCommandList->SetComputeRootDescriptorTable(2, cbuffer);					// Third is CBV
 		dxrCommandList->SetComputeRootDescriptorTable(3, heap[0]->GetGPUDescriptorHandleForHeapStart()); // Fourth is entire heap for bindless
 		dxrCommandList->SetComputeRootDescriptorTable(4, skyboxHandle);
+		dxrCommandList->SetComputeRootShaderResourceView(5, lightBuffers[lightBufferIndex]->GetGPUVirtualAddress());		// Lights and light BVH (root SRVs, like the accel structure)
+		dxrCommandList->SetComputeRootShaderResourceView(6, lightNodeBuffers[lightBufferIndex]->GetGPUVirtualAddress());
 
 		// Dispatch rays
 		D3D12_DISPATCH_RAYS_DESC dispatchDesc = {};
@@ -9,6 +9,46 @@
 #include "Mesh.h"
 #include "Camera.h"
 #include "GameEntity.h"
+#include "Lights.h"
+#include "LightBVH.h"
+
+// --------------------------------------------------------
+// What the last call to CreateTopLevelAccelerationStructureForScene()
+// did with the TLAS, and how long TLAS builds are taking
+// --------------------------------------------------------
+struct TLASBuildStats
+{
+	bool Built;						// Was the TLAS built or refit this frame?
+	bool Rebuilt;					// From scratch, rather than refit in place
+	unsigned int Instances;
+	unsigned int DirtyInstances;	// Instance descs written this frame
+	unsigned int RefitsSinceRebuild;
+	double CPUMilliseconds;			// Writing instance descs and recording the build
+
+	// GPU time of the most recent rebuild and refit whose
+	// timestamps are back (a few frames behind)
+	double RebuildGPUMilliseconds;
+	double RefitGPUMilliseconds;
+
+	unsigned long long TotalRebuilds;
+	unsigned long long TotalRefits;
+};
+
+// --------------------------------------------------------
+// How much memory the bottom level acceleration structures
+// (and what it takes to build them) use, with and without
+// compaction
+// --------------------------------------------------------
+struct BLASMemoryStats
+{
+	unsigned int BLASCount;
+	UINT64 UncompactedBytes;	// Every BLAS at its pre-build maximum size, as each used to be allocated
+	UINT64 CompactedBytes;		// Every BLAS after compaction
+	UINT64 PoolBytes;			// The pool blocks the compacted BLASes are sub-allocated from
+	unsigned int PoolBlocks;
+	UINT64 ScratchBytes;		// The one scratch buffer every build shares
+	UINT64 BuildBufferBytes;	// Where a batch of BLASes is built before they're compacted
+};
 
 class RaytracingHelper
 {
@@ -39,10 +79,24 @@ private:
 		screenHeight(1),
 		screenWidth(1),
 		tlasBufferSizeInBytes(0),
-		tlasScratchSizeInBytes(0),
+		scratchBufferSizeInBytes(0),
+		blasBuildBufferSizeInBytes(0),
+		blasCompactedSizeCapacity(0),
+		blasMemoryStats{},
 		tlasInstanceDataSizeInBytes(0),
 		shaderTableRecordSize(0),
-		blasCount(0)
+		blasCount(0),
+		lightBufferCapacity(0),
+		lightNodeBufferCapacity(0),
+		lightBufferIndex(0),
+		lightCount(0),
+		tlasRefitEnabled(true),
+		tlasRefitCount(0),
+		tlasBuildStats{},
+		tlasInstanceBufferIndex(0),
+		timestampFrequency(0),
+		tlasTimingIndex(0),
+		tlasTimingType{}
 	{};
 #pragma endregion
 
@@ -59,12 +113,22 @@ public:
 		std::wstring raytracingShaderLibraryFile
 	);
 	
+	bool IsAvailable();
+
+	// Refitting the TLAS (rather than rebuilding it every frame)
+	void SetTLASRefitEnabled(bool enabled);
+	TLASBuildStats GetTLASBuildStats();
+	BLASMemoryStats GetBLASMemoryStats();
+
 	// Resizing when window resizes
 	void ResizeOutputUAV(unsigned int screenWidth, unsigned int screenHeight);
 
 	// Setup process requiring data from outside the helper
 	MeshRaytracingData CreateBottomLevelAccelerationStructureForMesh(Mesh* mesh);
+	void BuildBottomLevelAccelerationStructures();
+	D3D12_GPU_VIRTUAL_ADDRESS GetBLAS(unsigned int hitGroupIndex);
 	void CreateTopLevelAccelerationStructureForScene(std::vector<std::shared_ptr<GameEntity>> scene);
+	void UpdateLights(const std::vector<Light>& lights, const std::vector<LightBVHNode>& nodes);
 
 	// Actual work
 	void Raytrace(
@@ -76,6 +140,7 @@ public:
 		DirectX::XMFLOAT3 skyDownColor,
 		D3D12_GPU_DESCRIPTOR_HANDLE skyboxHandle,
 		unsigned int accumulationFrameCount,
+		int lightSampling,
 		bool executeCommandList = true);
 
 
@@ -127,12 +192,75 @@ private:
 
 	// Accel structure requirements
 	UINT64 tlasBufferSizeInBytes;
-	UINT64 tlasScratchSizeInBytes;
 	UINT64 tlasInstanceDataSizeInBytes;
-	Microsoft::WRL::ComPtr<ID3D12Resource> tlasScratchBuffer; 
-	Microsoft::WRL::ComPtr<ID3D12Resource> tlasInstanceDescBuffer;
 	Microsoft::WRL::ComPtr<ID3D12Resource> topLevelAccelerationStructure;
 
+	// Scratch space shared by every acceleration structure build
+	Microsoft::WRL::ComPtr<ID3D12Resource> scratchBuffer;
+	UINT64 scratchBufferSizeInBytes;
+
+	// Meshes ask for a BLAS as they're created, but they're built
+	// in batches: every build goes to its own part of the build
+	// buffer, their compacted sizes are all read back at once and
+	// then they're all copied (compacted) into the pool
+	struct PendingBLAS
+	{
+		D3D12_RAYTRACING_GEOMETRY_DESC Geometry;
+		Microsoft::WRL::ComPtr<ID3D12Resource> VertexBuffer; // Kept alive until the build
+		Microsoft::WRL::ComPtr<ID3D12Resource> IndexBuffer;
+		UINT64 BuildSizeInBytes;
+		UINT64 ScratchSizeInBytes;
+		unsigned int HitGroupIndex;
+	};
+	std::vector<PendingBLAS> pendingBLASes;
+	Microsoft::WRL::ComPtr<ID3D12Resource> blasBuildBuffer;
+	UINT64 blasBuildBufferSizeInBytes;
+	Microsoft::WRL::ComPtr<ID3D12Resource> blasCompactedSizeBuffer;
+	Microsoft::WRL::ComPtr<ID3D12Resource> blasCompactedSizeReadback;
+	unsigned int blasCompactedSizeCapacity;
+
+	// Each compacted BLAS, by its mesh's hit group index
+	std::vector<D3D12_GPU_VIRTUAL_ADDRESS> blasAddresses;
+
+	// Compacted BLASes are sub-allocated from a few large
+	// buffers, rather than each getting a resource of its own
+	const UINT64 ACCELERATION_STRUCTURE_POOL_BLOCK_SIZE = 16 * 1024 * 1024;
+	struct AccelerationStructurePoolBlock
+	{
+		Microsoft::WRL::ComPtr<ID3D12Resource> Buffer;
+		UINT64 Size;
+		UINT64 Used;
+	};
+	std::vector<AccelerationStructurePoolBlock> accelerationStructurePool;
+	BLASMemoryStats blasMemoryStats;
+
+	// The TLAS is refit in place when only the instance descs'
+	// contents change (transforms, hit groups), and rebuilt when
+	// the instances themselves change or after this many refits
+	// in a row, since each refit leaves the tree a little looser
+	const unsigned int MAX_TLAS_REFITS = 60;
+	bool tlasRefitEnabled;
+	unsigned int tlasRefitCount;
+	std::vector<D3D12_RAYTRACING_INSTANCE_DESC> tlasInstanceDescs; // As of the last build
+	TLASBuildStats tlasBuildStats;
+
+	// Instance descs are uploaded to a different buffer for each
+	// frame that might still be in flight, and each buffer only
+	// gets the descs that changed since it was last written
+	static const unsigned int NUM_TLAS_INSTANCE_BUFFERS = 3;
+	Microsoft::WRL::ComPtr<ID3D12Resource> tlasInstanceDescBuffers[NUM_TLAS_INSTANCE_BUFFERS];
+	std::vector<D3D12_RAYTRACING_INSTANCE_DESC> tlasInstanceDescBufferContents[NUM_TLAS_INSTANCE_BUFFERS];
+	unsigned int tlasInstanceBufferIndex;
+
+	// Timestamps around each frame's TLAS build, read back once
+	// the frame that wrote them has finished
+	static const unsigned int NUM_TLAS_TIMING_FRAMES = 3;
+	Microsoft::WRL::ComPtr<ID3D12QueryHeap> tlasTimestampHeap;
+	Microsoft::WRL::ComPtr<ID3D12Resource> tlasTimestampReadback;
+	UINT64 timestampFrequency;
+	unsigned int tlasTimingIndex;
+	int tlasTimingType[NUM_TLAS_TIMING_FRAMES]; // 0 if nothing was built, 1 for a refit, 2 for a rebuild
+
 	// Accumulation texture
 	Microsoft::WRL::ComPtr<ID3D12Resource> accumulationTexture;
 	D3D12_CPU_DESCRIPTOR_HANDLE accumulationUAV_CPU;
@@ -143,10 +271,27 @@ private:
 	D3D12_CPU_DESCRIPTOR_HANDLE raytracingOutputUAV_CPU;
 	D3D12_GPU_DESCRIPTOR_HANDLE raytracingOutputUAV_GPU;
 
+	// Lights and the light BVH, with a set of upload buffers
+	// for each frame that might still be in flight
+	static const unsigned int NUM_LIGHT_BUFFERS = 3;
+	Microsoft::WRL::ComPtr<ID3D12Resource> lightBuffers[NUM_LIGHT_BUFFERS];
+	Microsoft::WRL::ComPtr<ID3D12Resource> lightNodeBuffers[NUM_LIGHT_BUFFERS];
+	unsigned int lightBufferCapacity;
+	unsigned int lightNodeBufferCapacity;
+	unsigned int lightBufferIndex;
+	unsigned int lightCount;
+
 	// Helper functions for each initalization step
 	void CreateRaytracingRootSignatures();
 	void CreateRaytracingPipelineState(std::wstring raytracingShaderLibraryFile);
 	void CreateShaderTable();
 	void CreateRaytracingOutputUAV(unsigned int width, unsigned int height);
+	void CreateLightBuffers(unsigned int lightCapacity, unsigned int nodeCapacity);
+	void CreateTLASTimestamps();
+	void CreateCompactionBuffers(unsigned int capacity);
+	void ReserveScratchBuffer(UINT64 size);
+	D3D12_GPU_VIRTUAL_ADDRESS AllocateFromAccelerationStructurePool(UINT64 size);
+	void BuildTopLevelAccelerationStructure(unsigned int instanceCount, bool rebuild);
+	void ReadTLASTimestamps();
 };
 
@@ -38,6 +38,14 @@ std::shared_ptr<GameEntity> Scene::GetEntity(unsigned int index)
 	return entities[index];
 }
 
+unsigned int Scene::LightCount() { return (unsigned int)lights.size(); }
+const std::vector<Light>& Scene::GetLights() { return lights; }
+
+void Scene::AddLight(Light light)
+{
+	lights.push_back(light);
+}
+
 
 
 
@@ -86,6 +94,12 @@ void Scene::UpdateScene(std::shared_ptr<Scene> scene, float deltaTime, float tot
 			entities[i]->GetTransform()->SetRotation(rot);
 		}
 	}
+	else if (scene->GetName() == "Sponza with Lights")
+	{
+		// Bob each light up and down at its own offset
+		for (size_t i = 0; i < scene->lights.size(); i++)
+			scene->lights[i].Position.y += cos(totalTime + i) * deltaTime * 2.0f;
+	}
 
 }
 
@@ -471,6 +485,19 @@ std::vector<std::shared_ptr<Scene>> Scene::CreateExampleScenes(Microsoft::WRL::C
 		white1->GetTransform()->SetScale(5);
 		white1->GetTransform()->SetPosition(0, 20, 50);
 		sponzaLightsScene->AddEntity(white1);
+
+		// And lots of point lights throughout the main hall
+		// and galleries, which are sampled with a light BVH
+		for (int i = 0; i < 512; i++)
+		{
+			Light point = {};
+			point.Type = LIGHT_TYPE_POINT;
+			point.Position = XMFLOAT3(RandomRange(-120.0f, 120.0f), RandomRange(5.0f, 60.0f), RandomRange(-20.0f, 20.0f));
+			point.Color = XMFLOAT3(RandomRange(0, 1), RandomRange(0, 1), RandomRange(0, 1));
+			point.Range = RandomRange(15.0f, 40.0f);
+			point.Intensity = RandomRange(50.0f, 200.0f);
+			sponzaLightsScene->AddLight(point);
+		}
 	}
 	exampleScenes.push_back(sponzaLightsScene);
 
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "GameEntity.h"
+#include "Lights.h"
 
 #include <wrl/client.h>
 #include <d3d12.h>
@@ -22,12 +23,17 @@ public:
 	void AddEntity(std::shared_ptr<GameEntity> entity);
 	std::shared_ptr<GameEntity> GetEntity(unsigned int index);
 
+	unsigned int LightCount();
+	const std::vector<Light>& GetLights();
+	void AddLight(Light light);
+
 	static void UpdateScene(std::shared_ptr<Scene> scene, float deltaTime, float totalTime);
 	static std::vector<std::shared_ptr<Scene>> CreateExampleScenes(Microsoft::WRL::ComPtr<ID3D12PipelineState> pipelineState);
 
 private:
 	std::string name; 
 	std::vector<std::shared_ptr<GameEntity>> entities;
+	std::vector<Light> lights;
 
 	static bool exampleScenesCreated;
 	static std::vector<std::shared_ptr<Scene>> exampleScenes;
@@ -17,6 +17,7 @@ Assets::~Assets()
 	for (auto& m : meshes) delete m.second;
 	for (auto& p : pixelShaders) delete p.second;
 	for (auto& v : vertexShaders) delete v.second;
+	for (auto& c : computeShaders) delete c.second;
 }
 
 
@@ -106,6 +107,17 @@ SimpleVertexShader* Assets::GetVertexShader(std::string name)
 	return 0;
 }
 
+SimpleComputeShader* Assets::GetComputeShader(std::string name)
+{
+	// Search and return shader if found
+	auto it = computeShaders.find(name);
+	if (it != computeShaders.end())
+		return it->second;
+
+	// Unsuccessful
+	return 0;
+}
+
 
 
 Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> Assets::GetTexture(std::string name)
@@ -209,6 +221,7 @@ void Assets::LoadUnknownShader(std::string path)
 	{
 	case D3D11_SHVER_VERTEX_SHADER: LoadVertexShader(path); break;
 	case D3D11_SHVER_PIXEL_SHADER: LoadPixelShader(path); break;
+	case D3D11_SHVER_COMPUTE_SHADER: LoadComputeShader(path); break;
 	}
 
 	// Clean up
@@ -265,6 +278,30 @@ void Assets::LoadVertexShader(std::string path, bool useAssetPath)
 	vertexShaders.insert({ filename, vs });
 }
 
+
+void Assets::LoadComputeShader(std::string path, bool useAssetPath)
+{
+	// Assuming filename and path are the same
+	std::string filename = path;
+
+	// Unless we need to check asset folder
+	if (useAssetPath)
+	{
+		// Strip out everything before and including the asset root path
+		size_t assetPathLength = rootAssetPath.size();
+		size_t assetPathPosition = path.rfind(rootAssetPath);
+		filename = path.substr(assetPathPosition + assetPathLength);
+	}
+
+	printf("Loading compute shader: ");
+	printf(filename.c_str());
+	printf("\n");
+
+	// Create the simple shader and add to dictionary
+	SimpleComputeShader* cs = new SimpleComputeShader(device, context, GetFullPathTo_Wide(ToWideString(path)).c_str());
+	computeShaders.insert({ filename, cs });
+}
+
 // --------------------------------------------------------------------------
 // Creates a solid color texture of the specified size and adds it to
 // the asset manager using the specified name
@@ -43,6 +43,7 @@ public:
 	void LoadAllAssets();
 	void LoadPixelShader(std::string path, bool useAssetPath = false);
 	void LoadVertexShader(std::string path, bool useAssetPath = false);
+	void LoadComputeShader(std::string path, bool useAssetPath = false);
 
 	void CreateSolidColorTexture(std::string textureName, int width, int height, DirectX::XMFLOAT4 color);
 	void CreateTexture(std::string textureName, int width, int height, DirectX::XMFLOAT4* pixels);
@@ -52,6 +53,7 @@ public:
 	Mesh* GetMesh(std::string name);
 	SimplePixelShader* GetPixelShader(std::string name);
 	SimpleVertexShader* GetVertexShader(std::string name);
+	SimpleComputeShader* GetComputeShader(std::string name);
 	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> GetTexture(std::string name);
 
 private:
@@ -68,6 +70,7 @@ private:
 	std::unordered_map<std::string, Mesh*> meshes;
 	std::unordered_map<std::string, SimplePixelShader*> pixelShaders;
 	std::unordered_map<std::string, SimpleVertexShader*> vertexShaders;
+	std::unordered_map<std::string, SimpleComputeShader*> computeShaders;
 	std::unordered_map<std::string, Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>> textures;
 
 	// Helpers for determining the actual path to the executable
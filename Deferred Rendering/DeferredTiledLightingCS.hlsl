@@ -0,0 +1,197 @@
+
+#include "Lighting.hlsli"
+
+// Size of each tile (one thread per pixel) and the most lights
+// a tile can hold - must match LightTiles.h
+#define LIGHT_TILE_SIZE 16
+#define MAX_LIGHTS_PER_TILE 512
+
+// Lights are tested one per thread, in rounds of this many
+#define THREADS_PER_TILE (LIGHT_TILE_SIZE * LIGHT_TILE_SIZE)
+#define HIT_MASK_WORDS (THREADS_PER_TILE / 32)
+
+cbuffer perFrame : register(b0)
+{
+	// The amount of lights THIS FRAME
+	int LightCount;
+
+	// Needed for specular (reflection) calculation
+	float3 CameraPosition;
+
+	// For rebuilding positions and tile frustums
+	matrix InvViewProj;
+	matrix View;
+	float2 ProjectionScale; // Projection matrix _11 and _22
+	float2 ScreenSize;
+	float NearClip;
+	float FarClip;
+}
+
+// G-buffer
+Texture2D GBufferAlbedo			: register(t0);
+Texture2D GBufferNormals		: register(t1);
+Texture2D GBufferDepth			: register(t2);
+Texture2D GBufferMetalRough		: register(t3);
+
+// All light data (as many lights as necessary)
+StructuredBuffer<Light> Lights	: register(t4);
+
+// Shadows - the atlas, each view within it and the first view of each light
+Texture2D ShadowAtlas							: register(t5);
+StructuredBuffer<ShadowViewData> ShadowViews	: register(t6);
+StructuredBuffer<int> LightShadowViews			: register(t7);
+SamplerComparisonState ShadowSampler			: register(s0);
+
+// Accumulated lighting for every pixel
+RWTexture2D<float4> LightBuffer	: register(u0);
+
+// Data shared by the whole tile
+groupshared uint TileMinDepth;
+groupshared uint TileMaxDepth;
+groupshared uint TileLightCount;
+groupshared uint TileLightIndices[MAX_LIGHTS_PER_TILE];
+groupshared uint TileHitMask[HIT_MASK_WORDS];
+
+
+// Tests a light against the tile's frustum - the four side planes
+// pass through the camera and the tile's edges, and the depth bounds
+// cap the front and back.  Spot lights are tested as spheres.
+// - Must match LightTiles::LightTouchesTile() on the CPU
+bool LightTouchesTile(Light light, uint2 tile, float minDepth, float maxDepth)
+{
+	if (light.Type == LIGHT_TYPE_DIRECTIONAL)
+		return true;
+
+	float3 pos = mul(View, float4(light.Position, 1)).xyz;
+	float r = light.Range;
+
+	// Depth bounds first, as they're cheapest
+	if (pos.z + r < minDepth || pos.z - r > maxDepth)
+		return false;
+
+	// Tile edges in NDC space (clamped to the screen)
+	float2 topLeft = tile * LIGHT_TILE_SIZE;
+	float2 bottomRight = min((tile + 1) * LIGHT_TILE_SIZE, ScreenSize);
+	float left = topLeft.x / ScreenSize.x * 2.0f - 1.0f;
+	float right = bottomRight.x / ScreenSize.x * 2.0f - 1.0f;
+	float top = 1.0f - topLeft.y / ScreenSize.y * 2.0f;
+	float bottom = 1.0f - bottomRight.y / ScreenSize.y * 2.0f;
+
+	// Slopes of each edge (view space x or y per unit of depth)
+	float l = left / ProjectionScale.x;
+	float rt = right / ProjectionScale.x;
+	float t = top / ProjectionScale.y;
+	float b = bottom / ProjectionScale.y;
+
+	// Signed distance to each side plane, with normals pointing into the tile
+	if ((pos.x - l * pos.z) / sqrt(1 + l * l) < -r) return false;
+	if ((rt * pos.z - pos.x) / sqrt(1 + rt * rt) < -r) return false;
+	if ((pos.y - b * pos.z) / sqrt(1 + b * b) < -r) return false;
+	if ((t * pos.z - pos.y) / sqrt(1 + t * t) < -r) return false;
+
+	return true;
+}
+
+
+// One thread group per tile, one thread per pixel
+[numthreads(LIGHT_TILE_SIZE, LIGHT_TILE_SIZE, 1)]
+void main(uint3 groupID : SV_GroupID, uint3 pixel : SV_DispatchThreadID, uint groupIndex : SV_GroupIndex)
+{
+	if (groupIndex == 0)
+	{
+		TileMinDepth = 0x7F7FFFFF; // FLT_MAX
+		TileMaxDepth = 0;
+		TileLightCount = 0;
+		for (uint m = 0; m < HIT_MASK_WORDS; m++)
+			TileHitMask[m] = 0;
+	}
+	GroupMemoryBarrierWithGroupSync();
+
+	// Find the tile's depth bounds, skipping anything off screen or
+	// with nothing in it (the sky).  Positive floats sort the same
+	// as their bits do, so the bits can go right into the atomics.
+	bool onScreen = all(pixel.xy < (uint2)ScreenSize);
+	float depth = onScreen ? GBufferDepth.Load(int3(pixel.xy, 0)).r : 1.0f;
+	bool hasSurface = depth < 1.0f;
+	if (hasSurface)
+	{
+		uint viewDepth = asuint(LinearDepth(depth, NearClip, FarClip));
+		InterlockedMin(TileMinDepth, viewDepth);
+		InterlockedMax(TileMaxDepth, viewDepth);
+	}
+	GroupMemoryBarrierWithGroupSync();
+
+	// Each thread tests one light against this tile per round, unless the
+	// tile is empty (its bounds never changed) or already full.  The hits
+	// of a round are gathered in a bit mask and each one goes into the
+	// slot after every hit with a lower index, so the list is always in
+	// index order.  A tile with more lights than fit keeps the lowest
+	// indices, every frame, exactly like LightTiles on the CPU.  The loop
+	// itself only depends on the light count, so every thread reaches
+	// every barrier.
+	float minDepth = asfloat(TileMinDepth);
+	float maxDepth = asfloat(TileMaxDepth);
+	bool tileHasSurface = minDepth <= maxDepth;
+	for (uint first = 0; first < (uint)LightCount; first += THREADS_PER_TILE)
+	{
+		// Wait for the count (and a clear mask) from the last round
+		GroupMemoryBarrierWithGroupSync();
+
+		uint i = first + groupIndex;
+		bool hit = tileHasSurface && TileLightCount < MAX_LIGHTS_PER_TILE && i < (uint)LightCount &&
+			LightTouchesTile(Lights[i], groupID.xy, minDepth, maxDepth);
+		uint word = groupIndex / 32;
+		uint bit = 1u << (groupIndex % 32);
+		if (hit)
+			InterlockedOr(TileHitMask[word], bit);
+		GroupMemoryBarrierWithGroupSync();
+
+		// Slot is the lights already listed plus this round's lower hits
+		uint slot = TileLightCount + countbits(TileHitMask[word] & (bit - 1));
+		for (uint w = 0; w < word; w++)
+			slot += countbits(TileHitMask[w]);
+		if (hit && slot < MAX_LIGHTS_PER_TILE)
+			TileLightIndices[slot] = i;
+		GroupMemoryBarrierWithGroupSync();
+
+		if (groupIndex == 0)
+		{
+			for (uint m = 0; m < HIT_MASK_WORDS; m++)
+			{
+				TileLightCount += countbits(TileHitMask[m]);
+				TileHitMask[m] = 0;
+			}
+		}
+	}
+	GroupMemoryBarrierWithGroupSync();
+
+	if (!onScreen)
+		return;
+
+	// Read the rest of the G-buffer once, then shade every light in the tile
+	float3 color = float3(0, 0, 0);
+	if (hasSurface)
+	{
+		int3 pixelIndex = int3(pixel.xy, 0);
+		float3 surfaceColor = GBufferAlbedo.Load(pixelIndex).rgb;
+		float3 normal		= normalize(GBufferNormals.Load(pixelIndex).rgb * 2 - 1);
+		float3 metalRough	= GBufferMetalRough.Load(pixelIndex).rgb;
+
+		float2 pixelUV = (pixel.xy + 0.5f) / ScreenSize;
+		float3 worldPos = WorldSpaceFromDepth(depth, pixelUV, InvViewProj);
+
+		float metal = metalRough.r;
+		float roughness = metalRough.g;
+		float3 specColor = lerp(F0_NON_METAL.rrr, surfaceColor, metal);
+
+		uint count = min(TileLightCount, MAX_LIGHTS_PER_TILE);
+		for (uint j = 0; j < count; j++)
+		{
+			uint index = TileLightIndices[j];
+			float shadow = ShadowAmount(Lights[index], LightShadowViews[index], worldPos, ShadowViews, ShadowAtlas, ShadowSampler);
+			color += LightPBR(Lights[index], normal, worldPos, CameraPosition, roughness, metal, surfaceColor, specColor) * shadow;
+		}
+	}
+
+	LightBuffer[pixel.xy] = float4(color, 1);
+}
@@ -23,6 +23,9 @@ using namespace DirectX;
 // Helper macro for getting a float between min and max
 #define RandomRange(min, max) ((float)rand() / RAND_MAX * (max - min) + min)
 
+// How many lights to create (the renderer itself has no limit)
+#define LIGHT_COUNT 2048
+
 
 // --------------------------------------------------------
 // Constructor
@@ -366,7 +369,7 @@ void Game::GenerateLights()
 	lights.push_back(dir3);
 
 	// Create the rest of the lights
-	while (lights.size() < MAX_LIGHTS)
+	while (lights.size() < LIGHT_COUNT)
 	{
 		Light point = {};
 		point.Type = LIGHT_TYPE_POINT;
@@ -568,9 +571,43 @@ void Game::CreateUI(float dt)
 			renderer->SetIBLIntensity(intensity);
 
 		int lightCount = (int)renderer->GetActiveLightCount();
-		if (ImGui::SliderInt("Light Count", &lightCount, 0, MAX_LIGHTS))
+		if (ImGui::SliderInt("Light Count", &lightCount, 0, (int)lights.size()))
 			renderer->SetActiveLightCount((unsigned int)lightCount);
 
+		ImGui::Text("Lights uploaded this frame: %u", renderer->GetLightsUploaded());
+
+		// Clustered lighting only applies to the forward path
+		if (path == RenderPath::RENDER_PATH_FORWARD)
+		{
+			bool clustered = renderer->GetClusteredLighting();
+			if (ImGui::Button(clustered ? "Clustered Lighting: On" : "Clustered Lighting: Off"))
+				renderer->SetClusteredLighting(!clustered);
+
+			if (clustered)
+			{
+				ImGui::SameLine();
+				ImGui::Text("Cluster build: %.3f ms (%u light indices)", renderer->GetClusterBuildTime(), renderer->GetClusterLightIndexCount());
+			}
+		}
+		else
+		{
+			// Tiled (compute) or per-light volume deferred lighting
+			bool tiled = renderer->GetTiledDeferredLighting();
+			if (ImGui::Button(tiled ? "Tiled Deferred Lighting: On" : "Tiled Deferred Lighting: Off"))
+				renderer->SetTiledDeferredLighting(!tiled);
+		}
+
+		// Shadows (forward and tiled deferred lighting only)
+		bool shadows = renderer->GetShadowsEnabled();
+		if (ImGui::Button(shadows ? "Shadows: On" : "Shadows: Off"))
+			renderer->SetShadowsEnabled(!shadows);
+
+		int maxShadowed = (int)renderer->GetMaxShadowedLights();
+		if (ImGui::SliderInt("Max Shadowed Lights", &maxShadowed, 0, 64))
+			renderer->SetMaxShadowedLights((unsigned int)maxShadowed);
+
+		ImGui::Text("Shadow views rendered: %u / %u", renderer->GetShadowViewsRendered(), renderer->GetShadowViewCount());
+
 		// Holds all lights
 		if (ImGui::CollapsingHeader("Lights"))
 		{
@@ -0,0 +1,580 @@
+#include "LightClusters.h"
+
+#include <cmath>
+#include <thread>
+#include <algorithm>
+
+// SSE is available on every x86/x64 target, but the
+// plain version below keeps this building elsewhere
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE__)
+#include <xmmintrin.h>
+#define LIGHT_CLUSTERS_SSE
+#endif
+
+#define CLUSTERS_PER_SLICE (CLUSTER_COUNT_X * CLUSTER_COUNT_Y)
+static_assert(CLUSTER_COUNT_X % 4 == 0, "Clusters per row must be a multiple of 4 for SIMD");
+
+// Spot lights fade with pow(cos(angle), falloff), so they're
+// treated as ending once they drop below this amount
+static const float SpotCutoff = 1.0f / 256.0f;
+
+
+// --------------------------------------------------------
+// Constructor - the grid itself is built the first time
+// Build() is called with a camera
+// --------------------------------------------------------
+LightClusters::LightClusters() :
+	sliceNear{},
+	sliceFar{},
+	gridProjX(0),
+	gridProjY(0),
+	gridNear(0),
+	gridFar(0),
+	gridFirstSlice(0),
+	firstSliceDepth(1.0f),
+	depthSliceScale(0),
+	depthSliceBias(0)
+{
+	clusterMinX.resize(CLUSTER_COUNT);
+	clusterMaxX.resize(CLUSTER_COUNT);
+	clusterMinY.resize(CLUSTER_COUNT);
+	clusterMaxY.resize(CLUSTER_COUNT);
+	clusterLights.resize(CLUSTER_COUNT);
+	clusterRanges.resize(CLUSTER_COUNT);
+
+	// Leave a core or two for the rest of the frame
+	threadCount = std::max(1u, std::min(std::thread::hardware_concurrency() / 2, 8u));
+}
+
+
+// --------------------------------------------------------
+// Assigns lights to clusters for the given camera
+//
+// camera - The camera whose frustum is being clustered
+// lights - The lights to assign
+// lightCount - How many lights are in the array
+// --------------------------------------------------------
+void LightClusters::Build(const ClusterCamera& camera, const ClusterLight* lights, unsigned int lightCount)
+{
+	// Rebuild the cluster bounds only when the projection changes
+	float projX = camera.Projection[0];
+	float projY = camera.Projection[5];
+	if (projX != gridProjX || projY != gridProjY ||
+		camera.NearClip != gridNear || camera.FarClip != gridFar ||
+		firstSliceDepth != gridFirstSlice)
+	{
+		BuildGrid(projX, projY, camera.NearClip, camera.FarClip);
+	}
+
+	// Move lights into view space and find the slices each might touch
+	const float* v = camera.View;
+	viewLights.clear();
+	for (unsigned int i = 0; i < lightCount; i++)
+	{
+		const ClusterLight& light = lights[i];
+		const float* p = light.Position;
+		const float* d = light.Direction;
+
+		ViewLight vl = {};
+		vl.Index = i;
+		vl.Type = light.Type;
+		vl.Range = light.Range;
+		vl.Position[0] = p[0] * v[0] + p[1] * v[4] + p[2] * v[8] + v[12];
+		vl.Position[1] = p[0] * v[1] + p[1] * v[5] + p[2] * v[9] + v[13];
+		vl.Position[2] = p[0] * v[2] + p[1] * v[6] + p[2] * v[10] + v[14];
+		vl.Direction[0] = d[0] * v[0] + d[1] * v[4] + d[2] * v[8];
+		vl.Direction[1] = d[0] * v[1] + d[1] * v[5] + d[2] * v[9];
+		vl.Direction[2] = d[0] * v[2] + d[1] * v[6] + d[2] * v[10];
+
+		if (light.Type == CLUSTER_LIGHT_DIRECTIONAL)
+		{
+			// Directional lights touch everything
+			vl.FirstSlice = 0;
+			vl.LastSlice = CLUSTER_COUNT_Z - 1;
+			viewLights.push_back(vl);
+			continue;
+		}
+
+		// Skip lights that can't reach any part of the frustum's depth range
+		float z = vl.Position[2];
+		if (light.Range <= 0 || z + light.Range < camera.NearClip || z - light.Range > camera.FarClip)
+			continue;
+
+		vl.FirstSlice = GetDepthSlice(z - light.Range);
+		vl.LastSlice = GetDepthSlice(z + light.Range);
+
+		// Spot lights also need their cone; a zero (or negative) falloff
+		// never fades, so those are treated exactly like point lights
+		if (light.Type == CLUSTER_LIGHT_SPOT && light.SpotFalloff > 0)
+		{
+			float len = std::sqrt(
+				vl.Direction[0] * vl.Direction[0] +
+				vl.Direction[1] * vl.Direction[1] +
+				vl.Direction[2] * vl.Direction[2]);
+			if (len <= 0)
+				continue;
+
+			vl.Direction[0] /= len;
+			vl.Direction[1] /= len;
+			vl.Direction[2] /= len;
+			vl.CosAngle = std::pow(SpotCutoff, 1.0f / light.SpotFalloff);
+			vl.SinAngle = std::sqrt(1.0f - vl.CosAngle * vl.CosAngle);
+		}
+		else if (light.Type == CLUSTER_LIGHT_SPOT)
+		{
+			vl.Type = CLUSTER_LIGHT_POINT;
+		}
+
+		viewLights.push_back(vl);
+	}
+
+	// One job per slice, handed out as threads become free, as the
+	// nearer slices tend to be much busier than the farther ones.
+	// The pool is kept between frames and only remade if the
+	// thread count changes.
+	unsigned int threads = std::max(1u, std::min(threadCount, (unsigned int)CLUSTER_COUNT_Z));
+	if (threads == 1)
+	{
+		AssignSlices(0, 1);
+	}
+	else
+	{
+		if (!jobs || jobs->GetThreadCount() != threads)
+			jobs.reset(new JobSystem(threads));
+
+		jobs->Run(CLUSTER_COUNT_Z, [this](unsigned int z) { AssignSlices(z, CLUSTER_COUNT_Z); });
+	}
+
+	// Flatten the per-cluster lists into one list of indices
+	uint32_t total = 0;
+	for (unsigned int c = 0; c < CLUSTER_COUNT; c++)
+	{
+		clusterRanges[c].Offset = total;
+		clusterRanges[c].Count = (uint32_t)clusterLights[c].size();
+		total += clusterRanges[c].Count;
+	}
+
+	lightIndices.resize(total);
+	for (unsigned int c = 0; c < CLUSTER_COUNT; c++)
+	{
+		if (!clusterLights[c].empty())
+			std::copy(clusterLights[c].begin(), clusterLights[c].end(), lightIndices.begin() + clusterRanges[c].Offset);
+	}
+}
+
+
+// --------------------------------------------------------
+// Getters for the results of the most recent Build()
+// --------------------------------------------------------
+const std::vector<ClusterRange>& LightClusters::GetClusterRanges() const { return clusterRanges; }
+const std::vector<uint32_t>& LightClusters::GetLightIndices() const { return lightIndices; }
+
+float LightClusters::GetFirstSliceDepth() const { return sliceFar[0]; }
+float LightClusters::GetDepthSliceScale() const { return depthSliceScale; }
+float LightClusters::GetDepthSliceBias() const { return depthSliceBias; }
+
+void LightClusters::SetThreadCount(unsigned int count) { threadCount = std::max(1u, count); }
+unsigned int LightClusters::GetThreadCount() const { return threadCount; }
+
+// --------------------------------------------------------
+// The view space depth at which slice 0 ends.  Without
+// this, a small near clip value wastes many slices on the
+// first few centimeters in front of the camera.
+// --------------------------------------------------------
+void LightClusters::SetFirstSliceDepth(float depth) { firstSliceDepth = depth; }
+
+
+// --------------------------------------------------------
+// Finds the depth slice for a view space depth, exactly as
+// the shader(s) do, clamped to the grid
+// --------------------------------------------------------
+unsigned int LightClusters::GetDepthSlice(float viewDepth) const
+{
+	if (viewDepth < sliceFar[0])
+		return 0;
+
+	float slice = 1.0f + std::floor(std::log(viewDepth) * depthSliceScale + depthSliceBias);
+	return (unsigned int)std::max(0.0f, std::min(slice, (float)(CLUSTER_COUNT_Z - 1)));
+}
+
+unsigned int LightClusters::GetClusterIndex(unsigned int x, unsigned int y, unsigned int z)
+{
+	return x + y * CLUSTER_COUNT_X + z * CLUSTERS_PER_SLICE;
+}
+
+
+// --------------------------------------------------------
+// Calculates the view space bounds of every cluster
+// --------------------------------------------------------
+void LightClusters::BuildGrid(float projX, float projY, float nearClip, float farClip)
+{
+	gridProjX = projX;
+	gridProjY = projY;
+	gridNear = nearClip;
+	gridFar = farClip;
+	gridFirstSlice = firstSliceDepth;
+
+	// Keep the first slice inside the frustum
+	float first = std::max(nearClip, std::min(firstSliceDepth, farClip * 0.5f));
+	depthSliceScale = (CLUSTER_COUNT_Z - 1) / std::log(farClip / first);
+	depthSliceBias = -std::log(first) * depthSliceScale;
+
+	// Depth range of each slice
+	sliceNear[0] = nearClip;
+	sliceFar[0] = first;
+	for (int z = 1; z < CLUSTER_COUNT_Z; z++)
+	{
+		sliceNear[z] = first * std::pow(farClip / first, (float)(z - 1) / (CLUSTER_COUNT_Z - 1));
+		sliceFar[z] = first * std::pow(farClip / first, (float)z / (CLUSTER_COUNT_Z - 1));
+	}
+
+	// Each tile is a range of NDC values, which spreads
+	// out further in view space as the depth increases
+	for (int z = 0; z < CLUSTER_COUNT_Z; z++)
+	{
+		for (int y = 0; y < CLUSTER_COUNT_Y; y++)
+		{
+			float ndcTop = 1.0f - 2.0f * y / CLUSTER_COUNT_Y;
+			float ndcBottom = 1.0f - 2.0f * (y + 1) / CLUSTER_COUNT_Y;
+
+			for (int x = 0; x < CLUSTER_COUNT_X; x++)
+			{
+				float ndcLeft = -1.0f + 2.0f * x / CLUSTER_COUNT_X;
+				float ndcRight = -1.0f + 2.0f * (x + 1) / CLUSTER_COUNT_X;
+
+				float l0 = ndcLeft * sliceNear[z] / projX, l1 = ndcLeft * sliceFar[z] / projX;
+				float r0 = ndcRight * sliceNear[z] / projX, r1 = ndcRight * sliceFar[z] / projX;
+				float b0 = ndcBottom * sliceNear[z] / projY, b1 = ndcBottom * sliceFar[z] / projY;
+				float t0 = ndcTop * sliceNear[z] / projY, t1 = ndcTop * sliceFar[z] / projY;
+
+				unsigned int c = GetClusterIndex(x, y, z);
+				clusterMinX[c] = std::min(l0, l1);
+				clusterMaxX[c] = std::max(r0, r1);
+				clusterMinY[c] = std::min(b0, b1);
+				clusterMaxY[c] = std::max(t0, t1);
+			}
+		}
+	}
+}
+
+
+// --------------------------------------------------------
+// Tests a spot light's cone against the bounding sphere
+// of a cluster, which is cheap and conservative
+// --------------------------------------------------------
+static bool ConeTouchesSphere(const float* conePos, const float* coneDir, float range, float cosAngle, float sinAngle, const float* center, float radius)
+{
+	float v[3] = { center[0] - conePos[0], center[1] - conePos[1], center[2] - conePos[2] };
+	float lenSq = v[0] * v[0] + v[1] * v[1] + v[2] * v[2];
+	float alongAxis = v[0] * coneDir[0] + v[1] * coneDir[1] + v[2] * coneDir[2];
+	float closest = cosAngle * std::sqrt(std::max(0.0f, lenSq - alongAxis * alongAxis)) - alongAxis * sinAngle;
+
+	bool outsideAngle = closest > radius;
+	bool beyondRange = alongAxis > radius + range;
+	bool behind = alongAxis < -radius;
+	return !(outsideAngle || beyondRange || behind);
+}
+
+
+// --------------------------------------------------------
+// Fills in the light lists of a set of depth slices.
+// Each slice is only ever touched by one thread.
+//
+// firstSlice - The first slice to process
+// sliceStep - How far to step to the next slice
+// --------------------------------------------------------
+void LightClusters::AssignSlices(unsigned int firstSlice, unsigned int sliceStep)
+{
+	for (unsigned int z = firstSlice; z < CLUSTER_COUNT_Z; z += sliceStep)
+	{
+		unsigned int base = z * CLUSTERS_PER_SLICE;
+		for (unsigned int c = 0; c < CLUSTERS_PER_SLICE; c++)
+			clusterLights[base + c].clear();
+
+		for (auto& light : viewLights)
+		{
+			if (z < light.FirstSlice || z > light.LastSlice)
+				continue;
+
+			if (light.Type == CLUSTER_LIGHT_DIRECTIONAL)
+			{
+				for (unsigned int c = 0; c < CLUSTERS_PER_SLICE; c++)
+					clusterLights[base + c].push_back(light.Index);
+				continue;
+			}
+
+			// Distance along z is the same for the whole slice, so
+			// whatever's left of the radius is what x & y can use
+			float px = light.Position[0];
+			float py = light.Position[1];
+			float pz = light.Position[2];
+			float dz = std::max(0.0f, std::max(sliceNear[z] - pz, pz - sliceFar[z]));
+			float remaining = light.Range * light.Range - dz * dz;
+			if (remaining < 0)
+				continue;
+
+			float rowRemaining = 0;
+
+			for (unsigned int c = 0; c < CLUSTERS_PER_SLICE; c += 4)
+			{
+				unsigned int i = base + c;
+
+				// Every cluster in a row shares the same y bounds, so
+				// skip the whole row if it's already out of reach
+				if (c % CLUSTER_COUNT_X == 0)
+				{
+					float dy = std::max(0.0f, std::max(clusterMinY[i] - py, py - clusterMaxY[i]));
+					rowRemaining = remaining - dy * dy;
+				}
+				if (rowRemaining < 0)
+					continue;
+
+				// Sphere vs. box for four clusters at once
+				int hits = 0;
+#ifdef LIGHT_CLUSTERS_SSE
+				__m128 cx = _mm_set1_ps(px);
+				__m128 dx = _mm_max_ps(_mm_setzero_ps(), _mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&clusterMinX[i]), cx), _mm_sub_ps(cx, _mm_loadu_ps(&clusterMaxX[i]))));
+				hits = _mm_movemask_ps(_mm_cmple_ps(_mm_mul_ps(dx, dx), _mm_set1_ps(rowRemaining)));
+#else
+				for (int b = 0; b < 4; b++)
+				{
+					float dx = std::max(0.0f, std::max(clusterMinX[i + b] - px, px - clusterMaxX[i + b]));
+					if (dx * dx <= rowRemaining)
+						hits |= 1 << b;
+				}
+#endif
+				if (hits == 0)
+					continue;
+
+				for (int b = 0; b < 4; b++)
+				{
+					if (!(hits & (1 << b)))
+						continue;
+
+					// Narrow down spot lights further using their cone
+					if (light.Type == CLUSTER_LIGHT_SPOT)
+					{
+						unsigned int k = i + b;
+						float center[3] = {
+							(clusterMinX[k] + clusterMaxX[k]) * 0.5f,
+							(clusterMinY[k] + clusterMaxY[k]) * 0.5f,
+							(sliceNear[z] + sliceFar[z]) * 0.5f };
+						float ex = clusterMaxX[k] - center[0];
+						float ey = clusterMaxY[k] - center[1];
+						float ez = sliceFar[z] - center[2];
+						float radius = std::sqrt(ex * ex + ey * ey + ez * ez);
+
+						if (!ConeTouchesSphere(light.Position, light.Direction, light.Range, light.CosAngle, light.SinAngle, center, radius))
+							continue;
+					}
+
+					clusterLights[i + b].push_back(light.Index);
+				}
+			}
+		}
+	}
+}
+
+
+// --------------------------------------------------------
+// Builds clusters for a made up camera and set of lights,
+// then checks every light against every cluster with a
+// plain sphere vs. box test, using cluster bounds worked
+// out from scratch.  Point lights must match exactly
+// (ignoring pairs that are within rounding error of just
+// touching).  Spot lights must include every cluster the
+// cone actually reaches (sampled) and nothing the light's
+// sphere misses.  Directional lights must be everywhere.
+// --------------------------------------------------------
+ClusterTestResults LightClusters::Test()
+{
+	ClusterTestResults results = {};
+
+	// Camera turned a bit and moved off the origin
+	const float nearClip = 0.1f;
+	const float farClip = 100.0f;
+	const float pi = 3.14159265f;
+	float tanHalfFov = std::tan(pi / 6.0f);
+	float aspect = 16.0f / 9.0f;
+	float angle = 0.4f;
+	float c = std::cos(angle), s = std::sin(angle);
+	float eye[3] = { 3.0f, 1.0f, -5.0f };
+
+	ClusterCamera camera = {};
+	camera.NearClip = nearClip;
+	camera.FarClip = farClip;
+	camera.Projection[0] = 1.0f / (tanHalfFov * aspect);
+	camera.Projection[5] = 1.0f / tanHalfFov;
+	camera.Projection[10] = farClip / (farClip - nearClip);
+	camera.Projection[11] = 1.0f;
+	camera.Projection[14] = -nearClip * farClip / (farClip - nearClip);
+
+	// Rotation about y (rows are the world axes in view space),
+	// then the eye position moved into view space
+	float view[16] = {
+		c, 0, s, 0,
+		0, 1, 0, 0,
+		-s, 0, c, 0,
+		0, 0, 0, 1 };
+	view[12] = -(eye[0] * view[0] + eye[1] * view[4] + eye[2] * view[8]);
+	view[13] = -(eye[0] * view[1] + eye[1] * view[5] + eye[2] * view[9]);
+	view[14] = -(eye[0] * view[2] + eye[1] * view[6] + eye[2] * view[10]);
+	for (int i = 0; i < 16; i++)
+		camera.View[i] = view[i];
+
+	// Lights scattered around (and behind) the camera, with a fixed seed
+	unsigned int seed = 12345;
+	auto random = [&](float min, float max)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		return min + (max - min) * ((seed >> 8) / 16777216.0f);
+	};
+
+	std::vector<ClusterLight> lights;
+	for (int i = 0; i < 300; i++)
+	{
+		ClusterLight light = {};
+		light.Type = i % 5 == 4 ? CLUSTER_LIGHT_SPOT : CLUSTER_LIGHT_POINT;
+		light.Position[0] = random(-40.0f, 40.0f);
+		light.Position[1] = random(-10.0f, 10.0f);
+		light.Position[2] = random(-20.0f, 110.0f);
+		light.Direction[0] = random(-1.0f, 1.0f);
+		light.Direction[1] = random(-1.0f, 1.0f);
+		light.Direction[2] = random(-1.0f, 1.0f);
+		light.Range = random(0.5f, 15.0f);
+		light.SpotFalloff = random(2.0f, 40.0f);
+		lights.push_back(light);
+	}
+	lights[7].Type = CLUSTER_LIGHT_DIRECTIONAL;
+
+	LightClusters clusters;
+	clusters.SetThreadCount(1);
+	clusters.Build(camera, lights.data(), (unsigned int)lights.size());
+	std::vector<ClusterRange> singleRanges = clusters.GetClusterRanges();
+	std::vector<uint32_t> singleIndices = clusters.GetLightIndices();
+
+	clusters.SetThreadCount(4);
+	clusters.Build(camera, lights.data(), (unsigned int)lights.size());
+	const std::vector<ClusterRange>& ranges = clusters.GetClusterRanges();
+	const std::vector<uint32_t>& indices = clusters.GetLightIndices();
+	results.ThreadsMatch = indices == singleIndices;
+	for (unsigned int i = 0; i < CLUSTER_COUNT && results.ThreadsMatch; i++)
+		results.ThreadsMatch = ranges[i].Offset == singleRanges[i].Offset && ranges[i].Count == singleRanges[i].Count;
+
+	// Which pairs the clusters came up with
+	const unsigned int lightCount = (unsigned int)lights.size();
+	std::vector<bool> assigned(CLUSTER_COUNT * lightCount, false);
+	for (unsigned int i = 0; i < CLUSTER_COUNT; i++)
+		for (uint32_t j = 0; j < ranges[i].Count; j++)
+			assigned[i * lightCount + indices[ranges[i].Offset + j]] = true;
+
+	// Slice depths, straight from the definition in the header
+	float first = std::max(nearClip, std::min(1.0f, farClip * 0.5f));
+	auto sliceDepth = [&](unsigned int z)
+	{
+		return z == 0 ? nearClip : first * std::pow(farClip / first, (float)(z - 1) / (CLUSTER_COUNT_Z - 1));
+	};
+
+	results.Clusters = CLUSTER_COUNT;
+	results.Lights = lightCount;
+	for (unsigned int z = 0; z < CLUSTER_COUNT_Z; z++)
+	{
+		float zNear = sliceDepth(z);
+		float zFar = sliceDepth(z + 1);
+		for (unsigned int y = 0; y < CLUSTER_COUNT_Y; y++)
+		{
+			for (unsigned int x = 0; x < CLUSTER_COUNT_X; x++)
+			{
+				// The cluster's box, covering the tile at both depths
+				float ndcMin[2] = { -1.0f + 2.0f * x / CLUSTER_COUNT_X, 1.0f - 2.0f * (y + 1) / CLUSTER_COUNT_Y };
+				float ndcMax[2] = { -1.0f + 2.0f * (x + 1) / CLUSTER_COUNT_X, 1.0f - 2.0f * y / CLUSTER_COUNT_Y };
+				float boxMin[3], boxMax[3];
+				for (int a = 0; a < 2; a++)
+				{
+					float scale = camera.Projection[a * 5];
+					boxMin[a] = std::min(ndcMin[a] * zNear, ndcMin[a] * zFar) / scale;
+					boxMax[a] = std::max(ndcMax[a] * zNear, ndcMax[a] * zFar) / scale;
+				}
+				boxMin[2] = zNear;
+				boxMax[2] = zFar;
+
+				unsigned int cluster = GetClusterIndex(x, y, z);
+				for (unsigned int l = 0; l < lightCount; l++)
+				{
+					const ClusterLight& light = lights[l];
+					bool isAssigned = assigned[cluster * lightCount + l];
+
+					if (light.Type == CLUSTER_LIGHT_DIRECTIONAL)
+					{
+						results.Assignments++;
+						results.Missing += isAssigned ? 0 : 1;
+						continue;
+					}
+
+					// Light position and direction in view space
+					float pos[3], dir[3];
+					for (int a = 0; a < 3; a++)
+					{
+						pos[a] = light.Position[0] * view[a] + light.Position[1] * view[4 + a] + light.Position[2] * view[8 + a] + view[12 + a];
+						dir[a] = light.Direction[0] * view[a] + light.Direction[1] * view[4 + a] + light.Direction[2] * view[8 + a];
+					}
+
+					// Squared distance from the light to the box
+					float distSq = 0;
+					for (int a = 0; a < 3; a++)
+					{
+						float d = std::max(0.0f, std::max(boxMin[a] - pos[a], pos[a] - boxMax[a]));
+						distSq += d * d;
+					}
+					float rangeSq = light.Range * light.Range;
+					bool borderline = std::abs(distSq - rangeSq) <= rangeSq * 1e-4f;
+					bool inSphere = distSq <= rangeSq;
+
+					if (light.Type == CLUSTER_LIGHT_POINT)
+					{
+						if (borderline)
+							continue;
+
+						results.Assignments += inSphere ? 1 : 0;
+						results.Missing += inSphere && !isAssigned ? 1 : 0;
+						results.Extra += !inSphere && isAssigned ? 1 : 0;
+						continue;
+					}
+
+					// Spot lights can't reach anything their sphere doesn't
+					if (!inSphere && !borderline)
+					{
+						results.Extra += isAssigned ? 1 : 0;
+						continue;
+					}
+
+					// Sample the box to see if the cone itself gets there
+					float len = std::sqrt(dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2]);
+					float cosAngle = std::pow(SpotCutoff, 1.0f / light.SpotFalloff);
+					bool inCone = false;
+					const int samples = 5;
+					for (int i = 0; i < samples * samples * samples && !inCone; i++)
+					{
+						float p[3], t[3] = { (i % samples) / (samples - 1.0f), (i / samples % samples) / (samples - 1.0f), (i / (samples * samples)) / (samples - 1.0f) };
+						float toPoint[3], toPointLenSq = 0, along = 0;
+						for (int a = 0; a < 3; a++)
+						{
+							p[a] = boxMin[a] + (boxMax[a] - boxMin[a]) * t[a];
+							toPoint[a] = p[a] - pos[a];
+							toPointLenSq += toPoint[a] * toPoint[a];
+							along += toPoint[a] * dir[a] / len;
+						}
+						float toPointLen = std::sqrt(toPointLenSq);
+						inCone = toPointLen < light.Range * 0.999f && along > toPointLen * cosAngle * 1.001f;
+					}
+
+					results.Assignments += inCone ? 1 : 0;
+					results.Missing += inCone && !isAssigned ? 1 : 0;
+				}
+			}
+		}
+	}
+
+	results.Passed = results.ThreadsMatch && results.Missing == 0 && results.Extra == 0;
+	return results;
+}
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+#include "JobSystem.h"
+
+// Size of the cluster grid - these defines should
+// match the CLUSTER_COUNT definitions in your shader(s)
+#define CLUSTER_COUNT_X 16
+#define CLUSTER_COUNT_Y 9
+#define CLUSTER_COUNT_Z 24
+#define CLUSTER_COUNT (CLUSTER_COUNT_X * CLUSTER_COUNT_Y * CLUSTER_COUNT_Z)
+
+// Light types, which must match Lights.h (but without
+// requiring DirectXMath, so this can be built anywhere)
+#define CLUSTER_LIGHT_DIRECTIONAL	0
+#define CLUSTER_LIGHT_POINT			1
+#define CLUSTER_LIGHT_SPOT			2
+
+// --------------------------------------------------------
+// The parts of a light needed to decide which clusters
+// it touches, all in world space
+// --------------------------------------------------------
+struct ClusterLight
+{
+	int Type;
+	float Position[3];
+	float Direction[3];
+	float Range;
+	float SpotFalloff;
+};
+
+// --------------------------------------------------------
+// The camera the clusters are built for.  Matrices are
+// stored like an XMFLOAT4X4 (row vectors, left handed).
+// --------------------------------------------------------
+struct ClusterCamera
+{
+	float View[16];
+	float Projection[16];
+	float NearClip;
+	float FarClip;
+};
+
+// --------------------------------------------------------
+// Where a cluster's lights live in the index list.  This
+// needs to match the uint2 read by the shader(s).
+// --------------------------------------------------------
+struct ClusterRange
+{
+	uint32_t Offset;
+	uint32_t Count;
+};
+
+// --------------------------------------------------------
+// Results of comparing the clusters against a brute force
+// sphere/box test of every light against every cluster
+// --------------------------------------------------------
+struct ClusterTestResults
+{
+	unsigned int Clusters;
+	unsigned int Lights;
+	unsigned int Assignments;	// Light/cluster pairs that should exist
+	unsigned int Missing;		// Pairs the clusters left out
+	unsigned int Extra;			// Pairs the clusters added that shouldn't be there
+	bool ThreadsMatch;			// Same results on one thread and many
+	bool Passed;
+};
+
+// --------------------------------------------------------
+// Splits the view frustum into a grid of clusters (screen
+// tiles by exponential depth slices) and works out which
+// lights touch each one.  Lights are tested with SSE
+// against four clusters at a time, and depth slices are
+// split across a persistent pool of worker threads.  The results are a light index
+// list and a per-cluster offset/count into that list.
+//
+// Cluster (x, y, z) is at index x + y * X + z * X * Y,
+// with y = 0 at the top of the screen.  Slice 0 covers
+// the near clip plane to the first slice depth, and the
+// remaining slices are spaced exponentially to the far
+// clip plane.
+// --------------------------------------------------------
+class LightClusters
+{
+public:
+	LightClusters();
+
+	void Build(const ClusterCamera& camera, const ClusterLight* lights, unsigned int lightCount);
+
+	const std::vector<ClusterRange>& GetClusterRanges() const;
+	const std::vector<uint32_t>& GetLightIndices() const;
+
+	// Values the shader needs to find a pixel's depth slice
+	float GetFirstSliceDepth() const;
+	float GetDepthSliceScale() const;
+	float GetDepthSliceBias() const;
+	unsigned int GetDepthSlice(float viewDepth) const;
+
+	void SetFirstSliceDepth(float depth);
+	void SetThreadCount(unsigned int count);
+	unsigned int GetThreadCount() const;
+
+	static unsigned int GetClusterIndex(unsigned int x, unsigned int y, unsigned int z);
+	static ClusterTestResults Test();
+
+private:
+	// A light moved into view space, along with the
+	// range of depth slices it could possibly touch
+	struct ViewLight
+	{
+		uint32_t Index;
+		int Type;
+		float Position[3];
+		float Direction[3];
+		float Range;
+		float CosAngle;
+		float SinAngle;
+		unsigned int FirstSlice;
+		unsigned int LastSlice;
+	};
+
+	// Cluster bounds (view space) in structure of arrays form for SIMD.
+	// X & Y are per cluster, while depth is the same across a slice.
+	std::vector<float> clusterMinX;
+	std::vector<float> clusterMaxX;
+	std::vector<float> clusterMinY;
+	std::vector<float> clusterMaxY;
+	float sliceNear[CLUSTER_COUNT_Z];
+	float sliceFar[CLUSTER_COUNT_Z];
+
+	// Camera values the current bounds were built from
+	float gridProjX;
+	float gridProjY;
+	float gridNear;
+	float gridFar;
+	float gridFirstSlice;
+
+	float firstSliceDepth;
+	float depthSliceScale;
+	float depthSliceBias;
+	unsigned int threadCount;
+	std::unique_ptr<JobSystem> jobs; // Created when first needed
+
+	// Per-frame results
+	std::vector<ViewLight> viewLights;
+	std::vector<std::vector<uint32_t>> clusterLights;
+	std::vector<ClusterRange> clusterRanges;
+	std::vector<uint32_t> lightIndices;
+
+	void BuildGrid(float projX, float projY, float nearClip, float farClip);
+	void AssignSlices(unsigned int firstSlice, unsigned int sliceStep);
+};
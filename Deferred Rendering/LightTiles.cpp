@@ -0,0 +1,402 @@
+#include "LightTiles.h"
+
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+
+// Same as LinearDepth() in Lighting.hlsli
+static float LinearDepth(float d, float zNear, float zFar)
+{
+	return zNear * zFar / (zFar + d * (zNear - zFar));
+}
+
+// --------------------------------------------------------
+// Constructor - sizes are set by Build()
+// --------------------------------------------------------
+LightTiles::LightTiles() :
+	tileCountX(0),
+	tileCountY(0)
+{
+}
+
+
+// --------------------------------------------------------
+// Finds the depth bounds and light list of every tile
+//
+// camera - The camera the depths were rendered with
+// screenWidth & screenHeight - Size of the depth buffer
+// depths - The G-buffer depths (0-1), one per pixel, row by row
+// lights - The lights to bin
+// lightCount - How many lights are in the array
+// --------------------------------------------------------
+void LightTiles::Build(
+	const ClusterCamera& camera,
+	unsigned int screenWidth,
+	unsigned int screenHeight,
+	const float* depths,
+	const ClusterLight* lights,
+	unsigned int lightCount)
+{
+	tileCountX = (screenWidth + LIGHT_TILE_SIZE - 1) / LIGHT_TILE_SIZE;
+	tileCountY = (screenHeight + LIGHT_TILE_SIZE - 1) / LIGHT_TILE_SIZE;
+	unsigned int tileCount = tileCountX * tileCountY;
+
+	tileMinDepths.assign(tileCount, FLT_MAX);
+	tileMaxDepths.assign(tileCount, 0.0f);
+	tileLights.resize(tileCount);
+
+	// Depth bounds, skipping pixels with nothing in them (the sky)
+	for (unsigned int y = 0; y < screenHeight; y++)
+	{
+		for (unsigned int x = 0; x < screenWidth; x++)
+		{
+			float depth = depths[x + y * screenWidth];
+			if (depth >= 1.0f)
+				continue;
+
+			unsigned int tile = x / LIGHT_TILE_SIZE + (y / LIGHT_TILE_SIZE) * tileCountX;
+			float viewDepth = LinearDepth(depth, camera.NearClip, camera.FarClip);
+			tileMinDepths[tile] = std::min(tileMinDepths[tile], viewDepth);
+			tileMaxDepths[tile] = std::max(tileMaxDepths[tile], viewDepth);
+		}
+	}
+
+	// Light lists, capped just like the shader's
+	for (unsigned int ty = 0; ty < tileCountY; ty++)
+	{
+		for (unsigned int tx = 0; tx < tileCountX; tx++)
+		{
+			unsigned int tile = tx + ty * tileCountX;
+			tileLights[tile].clear();
+
+			for (unsigned int i = 0; i < lightCount && tileLights[tile].size() < MAX_LIGHTS_PER_TILE; i++)
+			{
+				if (LightTouchesTile(camera, screenWidth, screenHeight, tx, ty, tileMinDepths[tile], tileMaxDepths[tile], lights[i]))
+					tileLights[tile].push_back(i);
+			}
+		}
+	}
+}
+
+
+// --------------------------------------------------------
+// Getters for the results of the most recent Build()
+// --------------------------------------------------------
+unsigned int LightTiles::GetTileCountX() const { return tileCountX; }
+unsigned int LightTiles::GetTileCountY() const { return tileCountY; }
+float LightTiles::GetTileMinDepth(unsigned int tile) const { return tileMinDepths[tile]; }
+float LightTiles::GetTileMaxDepth(unsigned int tile) const { return tileMaxDepths[tile]; }
+const std::vector<uint32_t>& LightTiles::GetTileLights(unsigned int tile) const { return tileLights[tile]; }
+
+
+// --------------------------------------------------------
+// Tests a light against a single tile's frustum.  The four
+// side planes pass through the camera and the tile's edges,
+// while the depth bounds cap the front and back.  Spot
+// lights are tested as spheres, which is conservative.
+//
+// Returns true if the light might touch the tile
+// --------------------------------------------------------
+bool LightTiles::LightTouchesTile(
+	const ClusterCamera& camera,
+	unsigned int screenWidth,
+	unsigned int screenHeight,
+	unsigned int tileX,
+	unsigned int tileY,
+	float minDepth,
+	float maxDepth,
+	const ClusterLight& light)
+{
+	// Empty tiles (nothing but sky) get no lights at all
+	if (minDepth > maxDepth)
+		return false;
+
+	if (light.Type == CLUSTER_LIGHT_DIRECTIONAL)
+		return true;
+
+	// Light position in view space
+	const float* v = camera.View;
+	const float* p = light.Position;
+	float x = p[0] * v[0] + p[1] * v[4] + p[2] * v[8] + v[12];
+	float y = p[0] * v[1] + p[1] * v[5] + p[2] * v[9] + v[13];
+	float z = p[0] * v[2] + p[1] * v[6] + p[2] * v[10] + v[14];
+	float r = light.Range;
+
+	// Depth bounds first, as they're cheapest
+	if (z + r < minDepth || z - r > maxDepth)
+		return false;
+
+	// Tile edges in NDC space (clamped to the screen)
+	float left = (float)(tileX * LIGHT_TILE_SIZE) / screenWidth * 2.0f - 1.0f;
+	float right = (float)std::min((tileX + 1) * LIGHT_TILE_SIZE, screenWidth) / screenWidth * 2.0f - 1.0f;
+	float top = 1.0f - (float)(tileY * LIGHT_TILE_SIZE) / screenHeight * 2.0f;
+	float bottom = 1.0f - (float)std::min((tileY + 1) * LIGHT_TILE_SIZE, screenHeight) / screenHeight * 2.0f;
+
+	// Slopes of each edge (view space x or y per unit of depth)
+	float l = left / camera.Projection[0];
+	float rt = right / camera.Projection[0];
+	float t = top / camera.Projection[5];
+	float b = bottom / camera.Projection[5];
+
+	// Signed distance to each side plane, with normals pointing into the tile
+	if ((x - l * z) / std::sqrt(1 + l * l) < -r) return false;
+	if ((rt * z - x) / std::sqrt(1 + rt * rt) < -r) return false;
+	if ((y - b * z) / std::sqrt(1 + b * b) < -r) return false;
+	if ((t * z - y) / std::sqrt(1 + t * t) < -r) return false;
+
+	return true;
+}
+
+
+// --------------------------------------------------------
+// Builds tiles for a made up G-buffer (sky across the top,
+// a wavy floor below) and compares them to brute force:
+//  - Depth bounds must match a scan of each tile's pixels
+//  - Any light within range of any pixel in a tile must be
+//    listed, as the shader would otherwise skip it there
+//  - Listed lights must be somewhere near the tile (the
+//    side plane tests are conservative, but only a little)
+//  - Lists must be in index order, and a second set of
+//    lights that overflows every tile must keep exactly the
+//    lowest indices that reach it
+// --------------------------------------------------------
+TileTestResults LightTiles::Test()
+{
+	TileTestResults results = {};
+
+	// Screen size that doesn't divide into whole tiles
+	const unsigned int width = 328;
+	const unsigned int height = 180;
+	const float nearClip = 0.1f;
+	const float farClip = 100.0f;
+	float tanHalfFov = std::tan(3.14159265f / 6.0f);
+
+	ClusterCamera camera = {};
+	camera.NearClip = nearClip;
+	camera.FarClip = farClip;
+	camera.Projection[0] = 1.0f / (tanHalfFov * width / height);
+	camera.Projection[5] = 1.0f / tanHalfFov;
+	camera.View[0] = camera.View[5] = camera.View[10] = camera.View[15] = 1.0f;
+	camera.View[12] = 0.0f;
+	camera.View[13] = -2.0f;
+	camera.View[14] = 5.0f;
+
+	// Sky across the top quarter, then a wavy floor stretching away
+	std::vector<float> depths(width * height);
+	std::vector<float> viewDepths(width * height, 0.0f);
+	for (unsigned int y = 0; y < height; y++)
+	{
+		for (unsigned int x = 0; x < width; x++)
+		{
+			unsigned int i = x + y * width;
+			if (y < height / 4)
+			{
+				depths[i] = 1.0f;
+				continue;
+			}
+
+			float t = 1.0f - (float)(y - height / 4) / (height - height / 4);
+			float z = 2.0f + 60.0f * t * t + 1.5f * std::sin(x * 0.07f);
+			viewDepths[i] = z;
+			depths[i] = farClip * (z - nearClip) / (z * (farClip - nearClip));
+		}
+	}
+
+	// View space position of a pixel on the floor
+	auto pixelPosition = [&](unsigned int x, unsigned int y, float* pos)
+	{
+		float z = viewDepths[x + y * width];
+		pos[0] = ((x + 0.5f) / width * 2.0f - 1.0f) * z / camera.Projection[0];
+		pos[1] = (1.0f - (y + 0.5f) / height * 2.0f) * z / camera.Projection[5];
+		pos[2] = z;
+	};
+
+	unsigned int seed = 777;
+	auto random = [&](float min, float max)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		return min + (max - min) * ((seed >> 8) / 16777216.0f);
+	};
+
+	// Lights near (and around) the floor, converted to world space
+	auto makeLight = [&](float range)
+	{
+		ClusterLight light = {};
+		light.Type = random(0, 1) < 0.2f ? CLUSTER_LIGHT_SPOT : CLUSTER_LIGHT_POINT;
+		float z = random(-5.0f, 70.0f);
+		light.Position[0] = random(-1.2f, 1.2f) * std::max(z, 1.0f) * tanHalfFov * width / height - camera.View[12];
+		light.Position[1] = random(-1.2f, 0.6f) * std::max(z, 1.0f) * tanHalfFov - camera.View[13];
+		light.Position[2] = z - camera.View[14];
+		light.Direction[2] = 1.0f;
+		light.Range = range;
+		light.SpotFalloff = 8.0f;
+		return light;
+	};
+
+	std::vector<ClusterLight> lights;
+	for (int i = 0; i < 400; i++)
+		lights.push_back(makeLight(random(0.5f, 6.0f)));
+	lights[11].Type = CLUSTER_LIGHT_DIRECTIONAL;
+
+	// Brute force: which lights reach a pixel in each tile
+	LightTiles tiles;
+	auto lightReachesTile = [&](unsigned int tx, unsigned int ty, const ClusterLight& light, bool* borderline)
+	{
+		*borderline = false;
+		float lightPos[3];
+		for (int a = 0; a < 3; a++)
+			lightPos[a] = light.Position[a] + camera.View[12 + a];
+
+		bool reaches = false;
+		float rangeSq = light.Range * light.Range;
+		for (unsigned int y = ty * LIGHT_TILE_SIZE; y < std::min((ty + 1) * LIGHT_TILE_SIZE, height); y++)
+		{
+			for (unsigned int x = tx * LIGHT_TILE_SIZE; x < std::min((tx + 1) * LIGHT_TILE_SIZE, width); x++)
+			{
+				if (depths[x + y * width] >= 1.0f)
+					continue;
+
+				if (light.Type == CLUSTER_LIGHT_DIRECTIONAL)
+					return true;
+
+				float pos[3];
+				pixelPosition(x, y, pos);
+				float distSq = 0;
+				for (int a = 0; a < 3; a++)
+					distSq += (pos[a] - lightPos[a]) * (pos[a] - lightPos[a]);
+
+				reaches |= distSq <= rangeSq;
+				*borderline |= std::abs(distSq - rangeSq) <= rangeSq * 1e-4f;
+			}
+		}
+		return reaches;
+	};
+
+	// Distance from a light to the nearest part of a tile's frustum,
+	// along with roughly how far apart the samples were
+	auto distanceToTile = [&](unsigned int tx, unsigned int ty, float minDepth, float maxDepth, const ClusterLight& light, float* spacing)
+	{
+		const int samples = 9;
+		float ndc[2][2] = {
+			{ (float)(tx * LIGHT_TILE_SIZE) / width * 2.0f - 1.0f, (float)std::min((tx + 1) * LIGHT_TILE_SIZE, width) / width * 2.0f - 1.0f },
+			{ 1.0f - (float)std::min((ty + 1) * LIGHT_TILE_SIZE, height) / height * 2.0f, 1.0f - (float)(ty * LIGHT_TILE_SIZE) / height * 2.0f } };
+
+		float best = FLT_MAX;
+		for (int i = 0; i < samples * samples * samples; i++)
+		{
+			float t[3] = { (i % samples) / (samples - 1.0f), (i / samples % samples) / (samples - 1.0f), (i / (samples * samples)) / (samples - 1.0f) };
+			float z = minDepth + (maxDepth - minDepth) * t[2];
+			float p[3] = {
+				(ndc[0][0] + (ndc[0][1] - ndc[0][0]) * t[0]) * z / camera.Projection[0],
+				(ndc[1][0] + (ndc[1][1] - ndc[1][0]) * t[1]) * z / camera.Projection[5],
+				z };
+
+			float distSq = 0;
+			for (int a = 0; a < 3; a++)
+			{
+				float d = p[a] - (light.Position[a] + camera.View[12 + a]);
+				distSq += d * d;
+			}
+			best = std::min(best, distSq);
+		}
+
+		// Largest gap between neighboring samples, at the far end
+		float dx = (ndc[0][1] - ndc[0][0]) * maxDepth / camera.Projection[0];
+		float dy = (ndc[1][1] - ndc[1][0]) * maxDepth / camera.Projection[5];
+		float dz = maxDepth - minDepth;
+		*spacing = std::sqrt(dx * dx + dy * dy + dz * dz) / (samples - 1);
+		return std::sqrt(best);
+	};
+
+	// First set: no tile should overflow, so lists must be complete
+	tiles.Build(camera, width, height, depths.data(), lights.data(), (unsigned int)lights.size());
+	results.Tiles = tiles.GetTileCountX() * tiles.GetTileCountY();
+	results.Lights = (unsigned int)lights.size();
+
+	for (unsigned int ty = 0; ty < tiles.GetTileCountY(); ty++)
+	{
+		for (unsigned int tx = 0; tx < tiles.GetTileCountX(); tx++)
+		{
+			unsigned int tile = tx + ty * tiles.GetTileCountX();
+			const std::vector<uint32_t>& list = tiles.GetTileLights(tile);
+
+			// Depth bounds straight from the pixels
+			float minDepth = FLT_MAX, maxDepth = 0;
+			for (unsigned int y = ty * LIGHT_TILE_SIZE; y < std::min((ty + 1) * LIGHT_TILE_SIZE, height); y++)
+			{
+				for (unsigned int x = tx * LIGHT_TILE_SIZE; x < std::min((tx + 1) * LIGHT_TILE_SIZE, width); x++)
+				{
+					if (depths[x + y * width] >= 1.0f)
+						continue;
+					float z = LinearDepth(depths[x + y * width], nearClip, farClip);
+					minDepth = std::min(minDepth, z);
+					maxDepth = std::max(maxDepth, z);
+				}
+			}
+			if (minDepth != tiles.GetTileMinDepth(tile) || maxDepth != tiles.GetTileMaxDepth(tile))
+				results.BoundsWrong++;
+
+			if (!std::is_sorted(list.begin(), list.end()) || std::adjacent_find(list.begin(), list.end()) != list.end())
+				results.OrderWrong++;
+			if (list.size() >= MAX_LIGHTS_PER_TILE)
+				results.FullTiles++;
+
+			for (uint32_t l = 0; l < lights.size(); l++)
+			{
+				bool listed = std::binary_search(list.begin(), list.end(), l);
+				bool borderline = false;
+				if (lightReachesTile(tx, ty, lights[l], &borderline) && !borderline && !listed)
+					results.Missing++;
+
+				// Conservative is fine, but not by more than a few ranges
+				if (listed && lights[l].Type != CLUSTER_LIGHT_DIRECTIONAL)
+				{
+					float spacing = 0;
+					if (distanceToTile(tx, ty, minDepth, maxDepth, lights[l], &spacing) > lights[l].Range * 3.0f + spacing)
+						results.Extra++;
+				}
+			}
+		}
+	}
+
+	// Second set: far more lights than fit, with lights that can't
+	// reach anything (behind the camera) mixed in among them
+	std::vector<ClusterLight> crowd;
+	for (int i = 0; i < MAX_LIGHTS_PER_TILE * 2; i++)
+	{
+		ClusterLight light = makeLight(500.0f);
+		if (i % 3 == 1)
+		{
+			light.Position[2] = -50.0f - camera.View[14];
+			light.Range = 1.0f;
+		}
+		crowd.push_back(light);
+	}
+	tiles.Build(camera, width, height, depths.data(), crowd.data(), (unsigned int)crowd.size());
+
+	for (unsigned int ty = 0; ty < tiles.GetTileCountY(); ty++)
+	{
+		for (unsigned int tx = 0; tx < tiles.GetTileCountX(); tx++)
+		{
+			unsigned int tile = tx + ty * tiles.GetTileCountX();
+			const std::vector<uint32_t>& list = tiles.GetTileLights(tile);
+
+			// The lowest indices that reach a pixel, up to the cap
+			std::vector<uint32_t> expected;
+			for (uint32_t l = 0; l < crowd.size() && expected.size() < MAX_LIGHTS_PER_TILE; l++)
+			{
+				bool borderline = false;
+				if (lightReachesTile(tx, ty, crowd[l], &borderline))
+					expected.push_back(l);
+			}
+
+			if (list != expected)
+				results.OrderWrong++;
+			if (list.size() >= MAX_LIGHTS_PER_TILE)
+				results.FullTiles++;
+		}
+	}
+
+	results.Passed = results.BoundsWrong == 0 && results.Missing == 0 && results.Extra == 0 && results.OrderWrong == 0;
+	return results;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "LightClusters.h"
+
+// Size of each screen tile (in pixels) and the most lights a
+// single tile can hold - these defines should match the
+// definitions in DeferredTiledLightingCS.hlsl
+#define LIGHT_TILE_SIZE 16
+#define MAX_LIGHTS_PER_TILE 512
+
+// --------------------------------------------------------
+// Results of comparing the tiles against a brute force
+// reference that lights every pixel of a made up G-buffer
+// --------------------------------------------------------
+struct TileTestResults
+{
+	unsigned int Tiles;
+	unsigned int Lights;
+	unsigned int FullTiles;		// Tiles that hit the light cap
+	unsigned int BoundsWrong;	// Tiles whose depth bounds differ from the pixels'
+	unsigned int Missing;		// Lights that reach a pixel but aren't listed
+	unsigned int Extra;			// Listed lights nowhere near the tile
+	unsigned int OrderWrong;	// Lists out of order or not the lowest indices
+	bool Passed;
+};
+
+// --------------------------------------------------------
+// CPU reference for the binning half of tiled deferred
+// lighting.  The screen is split into square tiles, the
+// depth bounds of each tile are found from the G-buffer
+// depths, and every light is tested against the frustum
+// made from the tile's edges and depth bounds.  This does
+// exactly what DeferredTiledLightingCS.hlsl does per thread
+// group, so the results can be checked without a GPU.
+//
+// Tile (x, y) is at index x + y * GetTileCountX(), with
+// y = 0 at the top of the screen.  Lights in each tile are
+// listed in increasing order, and a tile touched by more
+// than MAX_LIGHTS_PER_TILE lights keeps the lowest indices
+// (the shader builds its lists in the same order, so the
+// two match even when tiles are full).
+// --------------------------------------------------------
+class LightTiles
+{
+public:
+	LightTiles();
+
+	void Build(
+		const ClusterCamera& camera,
+		unsigned int screenWidth,
+		unsigned int screenHeight,
+		const float* depths,
+		const ClusterLight* lights,
+		unsigned int lightCount);
+
+	unsigned int GetTileCountX() const;
+	unsigned int GetTileCountY() const;
+	float GetTileMinDepth(unsigned int tile) const;
+	float GetTileMaxDepth(unsigned int tile) const;
+	const std::vector<uint32_t>& GetTileLights(unsigned int tile) const;
+
+	static bool LightTouchesTile(
+		const ClusterCamera& camera,
+		unsigned int screenWidth,
+		unsigned int screenHeight,
+		unsigned int tileX,
+		unsigned int tileY,
+		float minDepth,
+		float maxDepth,
+		const ClusterLight& light);
+
+	static TileTestResults Test();
+
+private:
+	unsigned int tileCountX;
+	unsigned int tileCountY;
+
+	// Per-tile results (view space depth bounds)
+	std::vector<float> tileMinDepths;
+	std::vector<float> tileMaxDepths;
+	std::vector<std::vector<uint32_t>> tileLights;
+};
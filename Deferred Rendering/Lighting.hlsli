@@ -10,7 +10,13 @@ static const float PI_OVER_2 = PI / 2.0f;
 #define IRRADIANCE_SAMPLE_STEP_PHI		0.25f //0.025f // Or larger for performance
 #define IRRADIANCE_SAMPLE_STEP_THETA	0.25f //0.025f // Or larger for performance
 
-#define MAX_LIGHTS 512
+// Size of the light cluster grid - must match LightClusters.h
+#define CLUSTER_COUNT_X 16
+#define CLUSTER_COUNT_Y 9
+#define CLUSTER_COUNT_Z 24
+
+// Shadow views per directional light - must match ShadowAtlas.h
+#define SHADOW_CASCADE_COUNT 3
 
 #define LIGHT_TYPE_DIRECTIONAL	0
 #define LIGHT_TYPE_POINT		1
@@ -31,6 +37,13 @@ struct Light
 	float3	Padding;	// 64 bytes
 };
 
+// One view of a light in the shadow atlas - must match Renderer.h
+struct ShadowViewData
+{
+	matrix	ViewProjection;
+	float4	AtlasRect;	// UV offset (xy) and scale (zw) of the view's tile
+};
+
 // === UTILITY FUNCTIONS ============================================
 
 // Basic sample and unpack
@@ -345,6 +358,112 @@ float3 SpotLightPBR(Light light, float3 normal, float3 worldPos, float3 camPos,
 }
 
 
+// Handles any type of light
+float3 LightPBR(Light light, float3 normal, float3 worldPos, float3 camPos, float roughness, float metalness, float3 surfaceColor, float3 specularColor)
+{
+	switch (light.Type)
+	{
+	case LIGHT_TYPE_DIRECTIONAL: return DirLightPBR(light, normal, worldPos, camPos, roughness, metalness, surfaceColor, specularColor);
+	case LIGHT_TYPE_POINT: return PointLightPBR(light, normal, worldPos, camPos, roughness, metalness, surfaceColor, specularColor);
+	case LIGHT_TYPE_SPOT: return SpotLightPBR(light, normal, worldPos, camPos, roughness, metalness, surfaceColor, specularColor);
+	}
+	return float3(0, 0, 0);
+}
+
+
+// === CLUSTERED LIGHTING ===========================================
+
+// Finds the light cluster holding a pixel, given its SV_POSITION
+// - Must match the grid built by LightClusters on the CPU
+uint ClusterIndex(float4 screenPosition, float2 screenSize, float zNear, float zFar, float depthScale, float depthBias)
+{
+	// Screen tile
+	uint2 tile = uint2(screenPosition.xy / screenSize * float2(CLUSTER_COUNT_X, CLUSTER_COUNT_Y));
+	tile = min(tile, uint2(CLUSTER_COUNT_X - 1, CLUSTER_COUNT_Y - 1));
+
+	// Depth slice - the first slice ends where this becomes positive,
+	// and the rest are spaced exponentially out to the far clip plane
+	float slice = log(LinearDepth(screenPosition.z, zNear, zFar)) * depthScale + depthBias;
+	uint z = slice < 0 ? 0 : min((uint)slice + 1, CLUSTER_COUNT_Z - 1);
+
+	return tile.x + tile.y * CLUSTER_COUNT_X + z * CLUSTER_COUNT_X * CLUSTER_COUNT_Y;
+}
+
+
+// === SHADOWS ======================================================
+
+// Picks the cube face a direction points at, in the
+// order +X, -X, +Y, -Y, +Z, -Z (matching the renderer)
+uint CubeFace(float3 dir)
+{
+	float3 a = abs(dir);
+	if (a.x >= a.y && a.x >= a.z) return dir.x > 0 ? 0 : 1;
+	if (a.y >= a.z) return dir.y > 0 ? 2 : 3;
+	return dir.z > 0 ? 4 : 5;
+}
+
+// Compares a position against one view's depths in the atlas
+// - Returns false (and no shadow) if the view doesn't hold the position
+bool SampleShadowView(ShadowViewData view, float3 worldPos, Texture2D atlas, SamplerComparisonState samp, out float shadow)
+{
+	shadow = 1.0f;
+
+	float4 shadowPos = mul(view.ViewProjection, float4(worldPos, 1.0f));
+	shadowPos.xyz /= shadowPos.w;
+	float2 uv = shadowPos.xy * float2(0.5f, -0.5f) + 0.5f;
+	if (any(uv < 0) || any(uv > 1) || shadowPos.z < 0 || shadowPos.z > 1)
+		return false;
+
+	// Stay half a texel inside the tile so filtering can't reach its neighbors
+	uint width, height;
+	atlas.GetDimensions(width, height);
+	float2 halfTexel = 0.5f / float2(width, height);
+	uv = view.AtlasRect.xy + uv * view.AtlasRect.zw;
+	uv = clamp(uv, view.AtlasRect.xy + halfTexel, view.AtlasRect.xy + view.AtlasRect.zw - halfTexel);
+
+	shadow = atlas.SampleCmpLevelZero(samp, uv, shadowPos.z);
+	return true;
+}
+
+// How much of a light reaches a position (0-1)
+//
+// light		- The light being shadowed
+// firstView	- The light's first view in the atlas (-1 for no shadows)
+// worldPos		- The position to test
+// views		- Every view in the atlas
+// atlas		- The shadow atlas depths
+// samp			- Comparison sampler for filtering
+//
+float ShadowAmount(Light light, int firstView, float3 worldPos, StructuredBuffer<ShadowViewData> views, Texture2D atlas, SamplerComparisonState samp)
+{
+	float shadow = 1.0f;
+	if (firstView < 0)
+		return shadow;
+
+	switch (light.Type)
+	{
+	case LIGHT_TYPE_DIRECTIONAL:
+		// Cascades go from near to far, so use the first that fits
+		for (int c = 0; c < SHADOW_CASCADE_COUNT; c++)
+		{
+			if (SampleShadowView(views[firstView + c], worldPos, atlas, samp, shadow))
+				break;
+		}
+		break;
+
+	case LIGHT_TYPE_POINT:
+		SampleShadowView(views[firstView + CubeFace(worldPos - light.Position)], worldPos, atlas, samp, shadow);
+		break;
+
+	case LIGHT_TYPE_SPOT:
+		SampleShadowView(views[firstView], worldPos, atlas, samp, shadow);
+		break;
+	}
+
+	return shadow;
+}
+
+
 // === INDIRECT PBR (IBL) ===========================================
 
 // Indirect diffuse irradiance for the scene
@@ -0,0 +1,41 @@
+#include "LightingTests.h"
+#include "LightClusters.h"
+#include "LightTiles.h"
+#include "ShadowAtlas.h"
+
+#include <cstdio>
+
+// --------------------------------------------------------
+// Runs every check, printing as it goes
+// --------------------------------------------------------
+bool RunLightingTests()
+{
+	printf("\nLight clusters vs. brute force sphere/box tests:\n");
+	ClusterTestResults clusters = LightClusters::Test();
+	printf("  %u clusters, %u lights, %u assignments: %u missing, %u extra%s\n",
+		clusters.Clusters,
+		clusters.Lights,
+		clusters.Assignments,
+		clusters.Missing,
+		clusters.Extra,
+		clusters.ThreadsMatch ? "" : " - THREADED RESULTS DIFFER");
+
+	printf("\nLight tiles vs. brute force per-pixel tests:\n");
+	TileTestResults tiles = LightTiles::Test();
+	printf("  %u tiles, %u lights, %u full tiles: %u wrong depth bounds, %u missing, %u extra, %u out of order\n",
+		tiles.Tiles,
+		tiles.Lights,
+		tiles.FullTiles,
+		tiles.BoundsWrong,
+		tiles.Missing,
+		tiles.Extra,
+		tiles.OrderWrong);
+
+	printf("\nShadow atlas packing, reuse and invalidation:\n");
+	ShadowAtlasTestResults shadows = ShadowAtlas::Test();
+	printf("  %u checks, %u failed\n", shadows.Checks, shadows.Failures);
+
+	bool passed = clusters.Passed && tiles.Passed && shadows.Passed;
+	printf("\n%s\n", passed ? "All tests passed" : "TESTS FAILED");
+	return passed;
+}
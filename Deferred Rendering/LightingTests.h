@@ -0,0 +1,11 @@
+#pragma once
+
+// --------------------------------------------------------
+// The checks behind "-test": light clusters and light tiles
+// against brute force versions, and the shadow atlas policy.
+// Nothing here needs Windows or D3D, so it runs from WinMain
+// and from the portable LightingTestsMain.cpp.
+//
+// Prints its results and returns true if everything passed.
+// --------------------------------------------------------
+bool RunLightingTests();
@@ -0,0 +1,10 @@
+#include "LightingTests.h"
+
+// --------------------------------------------------------
+// Console entry point for the "-test" checks alone, for
+// building without Windows or D3D (see CMakeLists.txt)
+// --------------------------------------------------------
+int main()
+{
+	return RunLightingTests() ? 0 : 1;
+}
@@ -3,7 +3,10 @@
 #define SIMPLE_SHADER_REPORT_WARNINGS
 
 #include <Windows.h>
+#include <stdio.h>
+#include <string.h>
 #include "Game.h"
+#include "LightingTests.h"
 
 // --------------------------------------------------------
 // Entry point for a graphical (non-console) Windows application
@@ -21,6 +24,22 @@ int WINAPI WinMain(
 	_CrtSetDbgFlag( _CRTDBG_ALLOC_MEM_DF | _CRTDBG_LEAK_CHECK_DF );
 #endif
 
+	// "-test" checks the CPU side of light culling against brute
+	// force versions, and the shadow atlas policy, without opening
+	// a window, and returns non-zero if anything disagrees (also
+	// built without Windows from LightingTestsMain.cpp)
+	if (strstr(lpCmdLine, "-test"))
+	{
+		// Print to the console we were launched from, or a new one
+		if (!AttachConsole(ATTACH_PARENT_PROCESS))
+			AllocConsole();
+		FILE* stream;
+		freopen_s(&stream, "CONOUT$", "w", stdout);
+
+		bool passed = RunLightingTests();
+		return passed ? 0 : 1;
+	}
+
 	// Create the Game object using
 	// the app handle we got from WinMain
 	Game dxGame(hInstance);
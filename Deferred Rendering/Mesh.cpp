@@ -2,6 +2,7 @@
 #include <DirectXMath.h>
 #include <vector>
 #include <fstream>
+#include <cmath>
 
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
@@ -318,6 +319,28 @@ void Mesh::CreateBuffers(Vertex* vertArray, int numVerts, unsigned int* indexArr
 
 	// Save the indices
 	this->numIndices = numIndices;
+
+	// Bounding sphere around the center of the bounding box
+	XMFLOAT3 boundsMin = vertArray[0].Position;
+	XMFLOAT3 boundsMax = vertArray[0].Position;
+	for (int i = 1; i < numVerts; i++)
+	{
+		const XMFLOAT3& p = vertArray[i].Position;
+		boundsMin = XMFLOAT3(fminf(boundsMin.x, p.x), fminf(boundsMin.y, p.y), fminf(boundsMin.z, p.z));
+		boundsMax = XMFLOAT3(fmaxf(boundsMax.x, p.x), fmaxf(boundsMax.y, p.y), fmaxf(boundsMax.z, p.z));
+	}
+	boundsCenter = XMFLOAT3((boundsMin.x + boundsMax.x) / 2, (boundsMin.y + boundsMax.y) / 2, (boundsMin.z + boundsMax.z) / 2);
+
+	float radiusSq = 0;
+	for (int i = 0; i < numVerts; i++)
+	{
+		const XMFLOAT3& p = vertArray[i].Position;
+		float dx = p.x - boundsCenter.x;
+		float dy = p.y - boundsCenter.y;
+		float dz = p.z - boundsCenter.z;
+		radiusSq = fmaxf(radiusSq, dx * dx + dy * dy + dz * dz);
+	}
+	boundsRadius = sqrtf(radiusSq);
 }
 
 
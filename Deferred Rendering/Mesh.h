@@ -17,12 +17,18 @@ public:
 	Microsoft::WRL::ComPtr<ID3D11Buffer> GetIndexBuffer() { return ib; }
 	int GetIndexCount() { return numIndices; }
 
+	// Local space bounding sphere
+	DirectX::XMFLOAT3 GetBoundsCenter() { return boundsCenter; }
+	float GetBoundsRadius() { return boundsRadius; }
+
 	void SetBuffersAndDraw(Microsoft::WRL::ComPtr<ID3D11DeviceContext> context);
 
 private:
 	Microsoft::WRL::ComPtr<ID3D11Buffer> vb;
 	Microsoft::WRL::ComPtr<ID3D11Buffer> ib;
 	int numIndices;
+	DirectX::XMFLOAT3 boundsCenter;
+	float boundsRadius;
 
 	void LoadManually(const char* objFile, Microsoft::WRL::ComPtr<ID3D11Device> device);
 	void LoadAssImp(const char* objFile, Microsoft::WRL::ComPtr<ID3D11Device> device);
@@ -4,9 +4,6 @@
 // Data that only changes once per frame
 cbuffer perFrame : register(b0)
 {
-	// An array of light data
-	Light Lights[MAX_LIGHTS];
-
 	// The amount of lights THIS FRAME
 	int LightCount;
 
@@ -57,6 +54,9 @@ struct PS_Output
 Texture2D AlbedoTexture			: register(t0);
 Texture2D NormalTexture			: register(t1);
 Texture2D RoughnessTexture		: register(t2);
+
+// All light data (as many lights as necessary)
+StructuredBuffer<Light> Lights	: register(t3);
 SamplerState BasicSampler		: register(s0);
 
 
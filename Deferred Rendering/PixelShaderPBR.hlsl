@@ -4,9 +4,6 @@
 // Data that only changes once per frame
 cbuffer perFrame : register(b0)
 {
-	// An array of light data
-	Light Lights[MAX_LIGHTS];
-
 	// The amount of lights THIS FRAME
 	int LightCount;
 
@@ -21,6 +18,14 @@ cbuffer perFrame : register(b0)
 
 	// Intensity factor for IBL (PBR only)
 	float IBLIntensity;
+
+	// Clustered lighting details (see LightClusters.h)
+	int UseClusters;
+	float2 ScreenSize;
+	float ClusterNearClip;
+	float ClusterFarClip;
+	float ClusterDepthScale;
+	float ClusterDepthBias;
 };
 
 // Data that can change per material
@@ -62,9 +67,22 @@ Texture2D BrdfLookUpMap			: register(t4);
 TextureCube IrradianceIBLMap	: register(t5);
 TextureCube SpecularIBLMap		: register(t6);
 
+// Clustered lighting - an offset & count into the index list for each cluster
+StructuredBuffer<uint2> ClusterLightRanges	: register(t7);
+StructuredBuffer<uint> ClusterLightIndices	: register(t8);
+
+// All light data (as many lights as necessary)
+StructuredBuffer<Light> Lights	: register(t9);
+
+// Shadows - the atlas, each view within it and the first view of each light
+Texture2D ShadowAtlas							: register(t10);
+StructuredBuffer<ShadowViewData> ShadowViews	: register(t11);
+StructuredBuffer<int> LightShadowViews			: register(t12);
+
 // Samplers
 SamplerState BasicSampler		: register(s0);
 SamplerState ClampSampler		: register(s1);
+SamplerComparisonState ShadowSampler	: register(s2);
 
 // Entry point for this pixel shader
 PS_Output main(VertexToPixel input)
@@ -90,23 +108,25 @@ PS_Output main(VertexToPixel input)
 	// Total color for this pixel
 	float3 totalDirectLight = float3(0,0,0);
 
-	// Loop through all lights this frame
-	for(int i = 0; i < LightCount; i++)
+	if (UseClusters)
 	{
-		// Which kind of light?
-		switch (Lights[i].Type)
+		// Only loop through the lights that touch this pixel's cluster
+		uint2 range = ClusterLightRanges[ClusterIndex(input.screenPosition, ScreenSize, ClusterNearClip, ClusterFarClip, ClusterDepthScale, ClusterDepthBias)];
+		for (uint i = 0; i < range.y; i++)
 		{
-		case LIGHT_TYPE_DIRECTIONAL:
-			totalDirectLight += DirLightPBR(Lights[i], input.normal, input.worldPos, CameraPosition, roughness, metal, surfaceColor.rgb, specColor);
-			break;
-
-		case LIGHT_TYPE_POINT:
-			totalDirectLight += PointLightPBR(Lights[i], input.normal, input.worldPos, CameraPosition, roughness, metal, surfaceColor.rgb, specColor);
-			break;
-
-		case LIGHT_TYPE_SPOT:
-			totalDirectLight += SpotLightPBR(Lights[i], input.normal, input.worldPos, CameraPosition, roughness, metal, surfaceColor.rgb, specColor);
-			break;
+			uint index = ClusterLightIndices[range.x + i];
+			Light light = Lights[index];
+			float shadow = ShadowAmount(light, LightShadowViews[index], input.worldPos, ShadowViews, ShadowAtlas, ShadowSampler);
+			totalDirectLight += LightPBR(light, input.normal, input.worldPos, CameraPosition, roughness, metal, surfaceColor.rgb, specColor) * shadow;
+		}
+	}
+	else
+	{
+		// Loop through all lights this frame
+		for (int i = 0; i < LightCount; i++)
+		{
+			float shadow = ShadowAmount(Lights[i], LightShadowViews[i], input.worldPos, ShadowViews, ShadowAtlas, ShadowSampler);
+			totalDirectLight += LightPBR(Lights[i], input.normal, input.worldPos, CameraPosition, roughness, metal, surfaceColor.rgb, specColor) * shadow;
 		}
 	}
 
@@ -5,12 +5,19 @@
 #include "ImGui/imgui_impl_dx11.h"
 
 #include "Assets.h"
+#include "LightTiles.h"
 
 #include <DirectXMath.h>
 #include <algorithm>
+#include <chrono>
 
 using namespace DirectX;
 
+// Shadow view near clip plane, and how far behind each directional
+// cascade to look for things that might cast shadows into it
+static const float ShadowNearClip = 0.05f;
+static const float ShadowCasterDistance = 50.0f;
+
 Renderer::Renderer(
 	const std::vector<GameEntity*>& entities,
 	const std::vector<Light>& lights,
@@ -38,17 +45,26 @@ Renderer::Renderer(
 		psPerFrameConstantBuffer(0),
 		pointLightsVisible(false),
 		drawDeferredLightSilhouettes(false),
+		tiledDeferredLighting(true),
 		ssaoSamples(64),
 		ssaoRadius(0.25f),
 		ssaoEnabled(true),
 		ambientNonPBR(0.1f, 0.1f, 0.25f),
 	    iblIntensity(1.0f),
+		clusteredLighting(true),
+		clusterIndexCapacity(0),
+		clusterBuildTime(0),
+		lightDataCapacity(0),
+		uploadedLightCount(0),
+		lightsUploaded(0),
+		shadowsEnabled(true),
+		shadowViewCapacity(0),
+		lightShadowCapacity(0),
+		shadowCameraView(),
+		shadowCameraProjection(),
 		vsPerFrameData(0),
 		psPerFrameData(0)
 {
-	// Validate active light count
-	activeLightCount = min(activeLightCount, MAX_LIGHTS);
-
 	// Grab two shaders on which to base per-frame cbuffers
 	// Note: We're assuming ALL entity/material per-frame buffers are identical!
 	//       And that they're all called "perFrame"
@@ -58,8 +74,6 @@ Renderer::Renderer(
 	SimpleVertexShader* vs = assets.GetVertexShader("VertexShader.cso");
 
 	// Create per frame data structs
-	// (On the heap because the PS one
-	// takes up WAY too much room for the stack)
 	vsPerFrameData = new VSPerFrameData();
 	psPerFrameData = new PSPerFrameData();
 
@@ -76,6 +90,94 @@ Renderer::Renderer(
 	scb = vs->GetBufferInfo("perFrame");
 	scb->ConstantBuffer.Get()->GetDesc(&bufferDesc);
 	device->CreateBuffer(&bufferDesc, 0, vsPerFrameConstantBuffer.GetAddressOf());
+
+	// Buffers for clustered lighting - the index list
+	// starts with a reasonable size and grows as needed
+	clusterIndexCapacity = 4096;
+	CreateStructuredBuffer(sizeof(ClusterRange), CLUSTER_COUNT, D3D11_USAGE_DYNAMIC, clusterRangeBuffer, clusterRangeSRV);
+	CreateStructuredBuffer(sizeof(unsigned int), clusterIndexCapacity, D3D11_USAGE_DYNAMIC, clusterIndexBuffer, clusterIndexSRV);
+
+	// Light data buffer, which also grows as needed
+	lightDataCapacity = 256;
+	uploadedLights.resize(lightDataCapacity);
+	CreateStructuredBuffer(sizeof(Light), lightDataCapacity, D3D11_USAGE_DEFAULT, lightDataBuffer, lightDataSRV);
+
+	// Shadow atlas, which is a single depth texture for all shadows
+	{
+		unsigned int atlasSize = shadowAtlas.GetAtlasSize();
+
+		D3D11_TEXTURE2D_DESC texDesc = {};
+		texDesc.Width = atlasSize;
+		texDesc.Height = atlasSize;
+		texDesc.ArraySize = 1;
+		texDesc.BindFlags = D3D11_BIND_DEPTH_STENCIL | D3D11_BIND_SHADER_RESOURCE;
+		texDesc.CPUAccessFlags = 0;
+		texDesc.Format = DXGI_FORMAT_R32_TYPELESS; // Depth in, float out
+		texDesc.MipLevels = 1;
+		texDesc.MiscFlags = 0;
+		texDesc.SampleDesc.Count = 1;
+		texDesc.SampleDesc.Quality = 0;
+		texDesc.Usage = D3D11_USAGE_DEFAULT;
+		Microsoft::WRL::ComPtr<ID3D11Texture2D> atlasTexture;
+		device->CreateTexture2D(&texDesc, 0, atlasTexture.GetAddressOf());
+
+		D3D11_DEPTH_STENCIL_VIEW_DESC dsvDesc = {};
+		dsvDesc.Format = DXGI_FORMAT_D32_FLOAT;
+		dsvDesc.ViewDimension = D3D11_DSV_DIMENSION_TEXTURE2D;
+		dsvDesc.Texture2D.MipSlice = 0;
+		device->CreateDepthStencilView(atlasTexture.Get(), &dsvDesc, shadowAtlasDSV.GetAddressOf());
+
+		D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+		srvDesc.Format = DXGI_FORMAT_R32_FLOAT;
+		srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
+		srvDesc.Texture2D.MipLevels = 1;
+		srvDesc.Texture2D.MostDetailedMip = 0;
+		device->CreateShaderResourceView(atlasTexture.Get(), &srvDesc, shadowAtlasSRV.GetAddressOf());
+
+		context->ClearDepthStencilView(shadowAtlasDSV.Get(), D3D11_CLEAR_DEPTH, 1.0f, 0);
+
+		// Every tile could hold a view in the worst case
+		unsigned int tilesPerSide = atlasSize / shadowAtlas.GetTileSize(0);
+		shadowViewCapacity = tilesPerSide * tilesPerSide;
+		CreateStructuredBuffer(sizeof(ShadowViewData), shadowViewCapacity, D3D11_USAGE_DYNAMIC, shadowViewBuffer, shadowViewSRV);
+
+		// First view of each light, which grows with the light count
+		lightShadowCapacity = 256;
+		CreateStructuredBuffer(sizeof(int), lightShadowCapacity, D3D11_USAGE_DYNAMIC, lightShadowBuffer, lightShadowSRV);
+	}
+
+	// Hardware filtered comparisons for shadow lookups
+	{
+		D3D11_SAMPLER_DESC sampDesc = {};
+		sampDesc.AddressU = D3D11_TEXTURE_ADDRESS_CLAMP;
+		sampDesc.AddressV = D3D11_TEXTURE_ADDRESS_CLAMP;
+		sampDesc.AddressW = D3D11_TEXTURE_ADDRESS_CLAMP;
+		sampDesc.Filter = D3D11_FILTER_COMPARISON_MIN_MAG_LINEAR_MIP_POINT;
+		sampDesc.ComparisonFunc = D3D11_COMPARISON_LESS_EQUAL;
+		sampDesc.MaxLOD = D3D11_FLOAT32_MAX;
+		device->CreateSamplerState(&sampDesc, shadowSampler.GetAddressOf());
+	}
+
+	// Depth biased rasterizer state for rendering shadows
+	{
+		D3D11_RASTERIZER_DESC rDesc = {};
+		rDesc.FillMode = D3D11_FILL_SOLID;
+		rDesc.CullMode = D3D11_CULL_BACK;
+		rDesc.DepthClipEnable = true;
+		rDesc.DepthBias = 1000;
+		rDesc.DepthBiasClamp = 0.0f;
+		rDesc.SlopeScaledDepthBias = 1.0f;
+		device->CreateRasterizerState(&rDesc, shadowRasterState.GetAddressOf());
+	}
+
+	// Depth state that always writes, for clearing single atlas tiles
+	{
+		D3D11_DEPTH_STENCIL_DESC dsDesc = {};
+		dsDesc.DepthEnable = true;
+		dsDesc.DepthFunc = D3D11_COMPARISON_ALWAYS;
+		dsDesc.DepthWriteMask = D3D11_DEPTH_WRITE_MASK_ALL;
+		device->CreateDepthStencilState(&dsDesc, shadowClearDepthState.GetAddressOf());
+	}
 	
 	// Create render targets (just calling post resize which sets them all up)
 	PostResize(windowWidth, windowHeight, backBufferRTV, depthBufferDSV);
@@ -163,6 +265,11 @@ void Renderer::Render(Camera* camera, bool vsync)
 	context->ClearRenderTargetView(backBufferRTV.Get(), color);
 	context->ClearDepthStencilView(depthBufferDSV.Get(), D3D11_CLEAR_DEPTH | D3D11_CLEAR_STENCIL, 1.0f, 0);
 
+	// Send any light changes to the GPU, then
+	// update any shadows that are out of date
+	UpdateLightBuffer();
+	RenderShadows(camera);
+
 	// Clear render targets
 	for (auto& rt : renderTargetRTVs) context->ClearRenderTargetView(rt.Get(), color);
 	const float depth[4] = { 1,0,0,0 };
@@ -202,8 +309,17 @@ void Renderer::Render(Camera* camera, bool vsync)
 		RenderSceneDeferred(camera); 
 
 		// Draw the lights into the light buffer
-		context->OMSetRenderTargets(1, renderTargetRTVs[RenderTargetType::LIGHT_BUFFER].GetAddressOf(), 0);
-		RenderLightsDeferred(camera);
+		if (tiledDeferredLighting)
+		{
+			// The light buffer can't be a render target and a UAV at once
+			context->OMSetRenderTargets(0, 0, 0);
+			RenderLightsTiled(camera);
+		}
+		else
+		{
+			context->OMSetRenderTargets(1, renderTargetRTVs[RenderTargetType::LIGHT_BUFFER].GetAddressOf(), 0);
+			RenderLightsDeferred(camera);
+		}
 
 		// Final combine before post processing
 		targets[0] = renderTargetRTVs[RenderTargetType::SCENE_NO_AMBIENT].Get();
@@ -341,12 +457,14 @@ void Renderer::RenderSceneForward(Camera* camera)
 		context->UpdateSubresource(vsPerFrameConstantBuffer.Get(), 0, 0, vsPerFrameData, 0, 0);
 
 		// ps ----
-		memcpy(&psPerFrameData->Lights, &lights[0], sizeof(Light) * activeLightCount);
 		psPerFrameData->LightCount = activeLightCount;
 		psPerFrameData->CameraPosition = camera->GetTransform()->GetPosition();
 		psPerFrameData->TotalSpecIBLMipLevels = sky->GetTotalSpecularIBLMipLevels();
 		psPerFrameData->AmbientNonPBR = ambientNonPBR;
 		psPerFrameData->IBLIntensity = iblIntensity;
+		psPerFrameData->UseClusters = clusteredLighting;
+		if (clusteredLighting)
+			BuildLightClusters(camera);
 		context->UpdateSubresource(psPerFrameConstantBuffer.Get(), 0, 0, psPerFrameData, 0, 0);
 		
 	}
@@ -400,6 +518,17 @@ void Renderer::RenderSceneForward(Camera* camera)
 				currentPS->SetShaderResourceView("IrradianceIBLMap", sky->GetIrradianceMap());
 				currentPS->SetShaderResourceView("SpecularIBLMap", sky->GetSpecularMap());
 				currentPS->SetShaderResourceView("BrdfLookUpMap", sky->GetBRDFLookUpTexture());
+
+				// And the lights and per-cluster light lists
+				currentPS->SetShaderResourceView("Lights", lightDataSRV);
+				currentPS->SetShaderResourceView("ClusterLightRanges", clusterRangeSRV);
+				currentPS->SetShaderResourceView("ClusterLightIndices", clusterIndexSRV);
+
+				// And shadows
+				currentPS->SetShaderResourceView("ShadowAtlas", shadowAtlasSRV);
+				currentPS->SetShaderResourceView("ShadowViews", shadowViewSRV);
+				currentPS->SetShaderResourceView("LightShadowViews", lightShadowSRV);
+				currentPS->SetSamplerState("ShadowSampler", shadowSampler);
 			}
 
 			// Now that the material is set, we should
@@ -439,6 +568,482 @@ void Renderer::RenderSceneForward(Camera* camera)
 
 
 
+// --------------------------------------------------------
+// Assigns the active lights to the clusters of the camera's
+// frustum and uploads the results for the forward shaders
+// --------------------------------------------------------
+void Renderer::BuildLightClusters(Camera* camera)
+{
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+	// Gather just the light data the clusters need
+	clusterLights.resize(activeLightCount);
+	for (unsigned int i = 0; i < activeLightCount; i++)
+	{
+		const Light& light = lights[i];
+		ClusterLight& cl = clusterLights[i];
+		cl.Type = light.Type;
+		cl.Position[0] = light.Position.x;
+		cl.Position[1] = light.Position.y;
+		cl.Position[2] = light.Position.z;
+		cl.Direction[0] = light.Direction.x;
+		cl.Direction[1] = light.Direction.y;
+		cl.Direction[2] = light.Direction.z;
+		cl.Range = light.Range;
+		cl.SpotFalloff = light.SpotFalloff;
+	}
+
+	XMFLOAT4X4 view = camera->GetView();
+	XMFLOAT4X4 proj = camera->GetProjection();
+	ClusterCamera clusterCam = {};
+	memcpy(clusterCam.View, &view, sizeof(float) * 16);
+	memcpy(clusterCam.Projection, &proj, sizeof(float) * 16);
+	clusterCam.NearClip = camera->GetNearClip();
+	clusterCam.FarClip = camera->GetFarClip();
+	lightClusters.Build(clusterCam, clusterLights.data(), activeLightCount);
+
+	// Grow the index buffer if this frame needs more room
+	const std::vector<uint32_t>& indices = lightClusters.GetLightIndices();
+	if (indices.size() > clusterIndexCapacity)
+	{
+		clusterIndexCapacity = max((unsigned int)indices.size(), clusterIndexCapacity * 2);
+		clusterIndexBuffer.Reset();
+		clusterIndexSRV.Reset();
+		CreateStructuredBuffer(sizeof(unsigned int), clusterIndexCapacity, D3D11_USAGE_DYNAMIC, clusterIndexBuffer, clusterIndexSRV);
+	}
+
+	// Copy both lists to the GPU
+	D3D11_MAPPED_SUBRESOURCE mapped = {};
+	context->Map(clusterRangeBuffer.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped);
+	memcpy(mapped.pData, lightClusters.GetClusterRanges().data(), sizeof(ClusterRange) * CLUSTER_COUNT);
+	context->Unmap(clusterRangeBuffer.Get(), 0);
+
+	context->Map(clusterIndexBuffer.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped);
+	memcpy(mapped.pData, indices.data(), sizeof(uint32_t) * indices.size());
+	context->Unmap(clusterIndexBuffer.Get(), 0);
+
+	// Values the shaders need to find each pixel's cluster
+	psPerFrameData->ScreenSize = XMFLOAT2((float)windowWidth, (float)windowHeight);
+	psPerFrameData->ClusterNearClip = camera->GetNearClip();
+	psPerFrameData->ClusterFarClip = camera->GetFarClip();
+	psPerFrameData->ClusterDepthScale = lightClusters.GetDepthSliceScale();
+	psPerFrameData->ClusterDepthBias = lightClusters.GetDepthSliceBias();
+
+	std::chrono::duration<float, std::milli> duration = std::chrono::high_resolution_clock::now() - start;
+	clusterBuildTime = duration.count();
+}
+
+
+// --------------------------------------------------------
+// Copies the active lights to the GPU's light buffer,
+// growing it first if necessary.  Lights that haven't
+// changed since they were last uploaded are skipped, and
+// the rest are sent in as few contiguous runs as possible.
+// --------------------------------------------------------
+void Renderer::UpdateLightBuffer()
+{
+	// Grow the buffer (to at least double) if it's too small,
+	// which means everything needs to be sent again
+	if (activeLightCount > lightDataCapacity)
+	{
+		lightDataCapacity = max(activeLightCount, lightDataCapacity * 2);
+		lightDataBuffer.Reset();
+		lightDataSRV.Reset();
+		CreateStructuredBuffer(sizeof(Light), lightDataCapacity, D3D11_USAGE_DEFAULT, lightDataBuffer, lightDataSRV);
+
+		uploadedLights.resize(lightDataCapacity);
+		uploadedLightCount = 0;
+	}
+
+	// Sends a run of lights and remembers what was sent
+	lightsUploaded = 0;
+	auto upload = [&](unsigned int start, unsigned int end)
+	{
+		D3D11_BOX box = {};
+		box.left = start * sizeof(Light);
+		box.right = end * sizeof(Light);
+		box.bottom = 1;
+		box.back = 1;
+		context->UpdateSubresource(lightDataBuffer.Get(), 0, &box, &lights[start], 0, 0);
+
+		memcpy(&uploadedLights[start], &lights[start], sizeof(Light) * (end - start));
+		lightsUploaded += end - start;
+	};
+
+	// Find runs of changed lights in the active range, letting a run
+	// cover a few unchanged lights rather than splitting it in two
+	const unsigned int maxGap = 4;
+	unsigned int runStart = 0;
+	unsigned int runEnd = 0;
+	for (unsigned int i = 0; i < activeLightCount; i++)
+	{
+		bool changed = i >= uploadedLightCount || memcmp(&lights[i], &uploadedLights[i], sizeof(Light)) != 0;
+		if (!changed)
+			continue;
+
+		if (runEnd > runStart && i - runEnd > maxGap)
+		{
+			upload(runStart, runEnd);
+			runStart = i;
+		}
+		else if (runEnd == runStart)
+		{
+			runStart = i;
+		}
+		runEnd = i + 1;
+	}
+	if (runEnd > runStart)
+		upload(runStart, runEnd);
+
+	uploadedLightCount = max(uploadedLightCount, activeLightCount);
+}
+
+
+// --------------------------------------------------------
+// Gets the world space bounding sphere of a mesh
+// --------------------------------------------------------
+static ShadowBounds GetShadowBounds(Mesh* mesh, const XMFLOAT4X4& world)
+{
+	XMFLOAT3 localCenter = mesh->GetBoundsCenter();
+	XMFLOAT3 center;
+	XMStoreFloat3(&center, XMVector3Transform(XMLoadFloat3(&localCenter), XMLoadFloat4x4(&world)));
+
+	// Largest scale along any axis
+	float scale = max(
+		XMVectorGetX(XMVector3Length(XMVectorSet(world._11, world._12, world._13, 0))), max(
+		XMVectorGetX(XMVector3Length(XMVectorSet(world._21, world._22, world._23, 0))),
+		XMVectorGetX(XMVector3Length(XMVectorSet(world._31, world._32, world._33, 0)))));
+
+	ShadowBounds bounds = {};
+	bounds.Center[0] = center.x;
+	bounds.Center[1] = center.y;
+	bounds.Center[2] = center.z;
+	bounds.Radius = mesh->GetBoundsRadius() * scale;
+	return bounds;
+}
+
+
+// --------------------------------------------------------
+// Decides which lights get shadows this frame, places
+// them in the atlas and renders only the views whose
+// depths are out of date.  Also uploads each view's
+// matrix & tile and each light's first view for the
+// lighting shaders.
+// --------------------------------------------------------
+void Renderer::RenderShadows(Camera* camera)
+{
+	// No shadows means no views for any light
+	shadowViewData.clear();
+	lightShadowViews.assign(activeLightCount, -1);
+
+	if (shadowsEnabled)
+	{
+		XMFLOAT4X4 camView = camera->GetView();
+		XMFLOAT4X4 camProj = camera->GetProjection();
+		float nearClip = camera->GetNearClip();
+		float farClip = camera->GetFarClip();
+
+		// Directional cascades follow the camera
+		bool cameraChanged =
+			memcmp(&camView, &shadowCameraView, sizeof(XMFLOAT4X4)) != 0 ||
+			memcmp(&camProj, &shadowCameraProjection, sizeof(XMFLOAT4X4)) != 0;
+		shadowCameraView = camView;
+		shadowCameraProjection = camProj;
+
+		// Gather each light's request, where the importance is roughly
+		// the light's height on screen and lights outside the view
+		// frustum (which can't shadow anything visible) are skipped
+		XMMATRIX viewMat = XMLoadFloat4x4(&camView);
+		float sideScaleX = sqrtf(camProj._11 * camProj._11 + 1);
+		float sideScaleY = sqrtf(camProj._22 * camProj._22 + 1);
+		shadowRequests.clear();
+		for (unsigned int i = 0; i < activeLightCount; i++)
+		{
+			const Light& light = lights[i];
+			bool changed = i >= shadowLights.size() || memcmp(&light, &shadowLights[i], sizeof(Light)) != 0;
+
+			ShadowRequest request = {};
+			request.LightIndex = i;
+			if (light.Type == LIGHT_TYPE_DIRECTIONAL)
+			{
+				request.ViewCount = SHADOW_CASCADE_COUNT;
+				request.Importance = 1.0f;
+				request.Static = !changed && !cameraChanged;
+				request.BoundsRadius = -1.0f;
+			}
+			else
+			{
+				request.ViewCount = light.Type == LIGHT_TYPE_POINT ? SHADOW_CUBE_FACES : 1;
+				request.Static = !changed;
+				request.BoundsCenter[0] = light.Position.x;
+				request.BoundsCenter[1] = light.Position.y;
+				request.BoundsCenter[2] = light.Position.z;
+				request.BoundsRadius = light.Range;
+
+				XMFLOAT3 pos;
+				XMStoreFloat3(&pos, XMVector3Transform(XMLoadFloat3(&light.Position), viewMat));
+				float r = light.Range;
+				bool visible =
+					pos.z + r >= nearClip && pos.z - r <= farClip &&
+					fabsf(pos.x) * camProj._11 - pos.z <= r * sideScaleX &&
+					fabsf(pos.y) * camProj._22 - pos.z <= r * sideScaleY;
+
+				if (!visible)
+					request.Importance = 0.0f;
+				else if (pos.x * pos.x + pos.y * pos.y + pos.z * pos.z <= r * r)
+					request.Importance = 1.0f;
+				else
+					request.Importance = min(1.0f, r * camProj._22 / max(pos.z, nearClip));
+			}
+			shadowRequests.push_back(request);
+		}
+		shadowLights.assign(lights.begin(), lights.begin() + activeLightCount);
+
+		// Find everything that moved, both where it was and where it is
+		shadowMovedBounds.clear();
+		bool entityListChanged = shadowEntityWorlds.size() != entities.size();
+		if (entityListChanged)
+		{
+			shadowEntityWorlds.resize(entities.size());
+			shadowAtlas.InvalidateAll();
+		}
+		for (size_t i = 0; i < entities.size(); i++)
+		{
+			XMFLOAT4X4 world = entities[i]->GetTransform()->GetWorldMatrix();
+			if (memcmp(&world, &shadowEntityWorlds[i], sizeof(XMFLOAT4X4)) == 0)
+				continue;
+
+			if (!entityListChanged)
+				shadowMovedBounds.push_back(GetShadowBounds(entities[i]->GetMesh(), shadowEntityWorlds[i]));
+			shadowMovedBounds.push_back(GetShadowBounds(entities[i]->GetMesh(), world));
+			shadowEntityWorlds[i] = world;
+		}
+
+		shadowAtlas.Update(
+			shadowRequests.data(), (unsigned int)shadowRequests.size(),
+			shadowMovedBounds.data(), (unsigned int)shadowMovedBounds.size());
+
+		// Split the camera's frustum into cascades (halfway between even
+		// and logarithmic splits) and bound each with a sphere, which
+		// keeps the cascade's size steady as the camera turns
+		XMFLOAT4 cascadeSpheres[SHADOW_CASCADE_COUNT];
+		XMMATRIX invView = XMMatrixInverse(0, viewMat);
+		float cornerScale = sqrtf(1.0f / (camProj._11 * camProj._11) + 1.0f / (camProj._22 * camProj._22));
+		float splitNear = nearClip;
+		for (int c = 0; c < SHADOW_CASCADE_COUNT; c++)
+		{
+			float t = (c + 1.0f) / SHADOW_CASCADE_COUNT;
+			float splitFar = 0.5f * nearClip * powf(farClip / nearClip, t) + 0.5f * (nearClip + (farClip - nearClip) * t);
+			float splitMid = (splitNear + splitFar) / 2;
+
+			float radius = sqrtf(
+				(splitFar - splitMid) * (splitFar - splitMid) +
+				(splitFar * cornerScale) * (splitFar * cornerScale));
+
+			XMFLOAT3 center;
+			XMStoreFloat3(&center, XMVector3Transform(XMVectorSet(0, 0, splitMid, 1), invView));
+			cascadeSpheres[c] = XMFLOAT4(center.x, center.y, center.z, radius);
+			splitNear = splitFar;
+		}
+
+		// Matrices and tiles for each view
+		const std::vector<ShadowView>& views = shadowAtlas.GetViews();
+		float atlasSize = (float)shadowAtlas.GetAtlasSize();
+		shadowViewData.resize(views.size());
+		for (size_t v = 0; v < views.size(); v++)
+		{
+			const ShadowView& view = views[v];
+			shadowViewData[v].ViewProjection = CalculateShadowViewProjection(lights[view.LightIndex], view.Face, view.Size, cascadeSpheres);
+			shadowViewData[v].AtlasRect = XMFLOAT4(view.X / atlasSize, view.Y / atlasSize, view.Size / atlasSize, view.Size / atlasSize);
+		}
+		for (unsigned int i = 0; i < activeLightCount; i++)
+			lightShadowViews[i] = shadowAtlas.GetFirstView(i);
+
+		// Render the out of date views, first clearing their tiles (and
+		// only their tiles) with a full screen triangle whose depth is
+		// forced to 1 by the viewport
+		if (shadowAtlas.GetRenderCount() > 0)
+		{
+			Assets& assets = Assets::GetInstance();
+			SimpleVertexShader* fullscreenVS = assets.GetVertexShader("FullscreenVS.cso");
+			SimpleVertexShader* shadowVS = assets.GetVertexShader("ShadowVS.cso");
+
+			// Save the current viewport to put back afterwards
+			D3D11_VIEWPORT prevVP = {};
+			unsigned int viewportCount = 1;
+			context->RSGetViewports(&viewportCount, &prevVP);
+
+			context->OMSetRenderTargets(0, 0, shadowAtlasDSV.Get());
+			context->PSSetShader(0, 0, 0);
+
+			D3D11_VIEWPORT vp = {};
+			fullscreenVS->SetShader();
+			context->OMSetDepthStencilState(shadowClearDepthState.Get(), 0);
+			for (const ShadowView& view : views)
+			{
+				if (!view.NeedsRender)
+					continue;
+
+				vp.TopLeftX = (float)view.X;
+				vp.TopLeftY = (float)view.Y;
+				vp.Width = (float)view.Size;
+				vp.Height = (float)view.Size;
+				vp.MinDepth = 1.0f;
+				vp.MaxDepth = 1.0f;
+				context->RSSetViewports(1, &vp);
+				context->Draw(3, 0);
+			}
+
+			// Now the depths themselves
+			shadowVS->SetShader();
+			context->OMSetDepthStencilState(0, 0);
+			context->RSSetState(shadowRasterState.Get());
+			for (size_t v = 0; v < views.size(); v++)
+			{
+				const ShadowView& view = views[v];
+				if (!view.NeedsRender)
+					continue;
+
+				vp.TopLeftX = (float)view.X;
+				vp.TopLeftY = (float)view.Y;
+				vp.Width = (float)view.Size;
+				vp.Height = (float)view.Size;
+				vp.MinDepth = 0.0f;
+				vp.MaxDepth = 1.0f;
+				context->RSSetViewports(1, &vp);
+
+				shadowVS->SetMatrix4x4("viewProjection", shadowViewData[v].ViewProjection);
+				shadowVS->CopyBufferData("perView");
+
+				const Light& light = lights[view.LightIndex];
+				for (auto ge : entities)
+				{
+					XMFLOAT4X4 world = ge->GetTransform()->GetWorldMatrix();
+
+					// Lights with a range can skip anything out of reach
+					if (light.Type != LIGHT_TYPE_DIRECTIONAL)
+					{
+						ShadowBounds bounds = GetShadowBounds(ge->GetMesh(), world);
+						float dx = bounds.Center[0] - light.Position.x;
+						float dy = bounds.Center[1] - light.Position.y;
+						float dz = bounds.Center[2] - light.Position.z;
+						float reach = bounds.Radius + light.Range;
+						if (dx * dx + dy * dy + dz * dz > reach * reach)
+							continue;
+					}
+
+					shadowVS->SetMatrix4x4("world", world);
+					shadowVS->CopyBufferData("perObject");
+					ge->GetMesh()->SetBuffersAndDraw(context);
+				}
+			}
+
+			// Put things back
+			context->RSSetState(0);
+			context->RSSetViewports(1, &prevVP);
+		}
+	}
+
+	// Grow the per-light buffer if necessary
+	if (activeLightCount > lightShadowCapacity)
+	{
+		lightShadowCapacity = max(activeLightCount, lightShadowCapacity * 2);
+		lightShadowBuffer.Reset();
+		lightShadowSRV.Reset();
+		CreateStructuredBuffer(sizeof(int), lightShadowCapacity, D3D11_USAGE_DYNAMIC, lightShadowBuffer, lightShadowSRV);
+	}
+
+	// Copy the views and per-light lookups to the GPU
+	D3D11_MAPPED_SUBRESOURCE mapped = {};
+	if (!shadowViewData.empty())
+	{
+		context->Map(shadowViewBuffer.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped);
+		memcpy(mapped.pData, shadowViewData.data(), sizeof(ShadowViewData) * shadowViewData.size());
+		context->Unmap(shadowViewBuffer.Get(), 0);
+	}
+
+	if (!lightShadowViews.empty())
+	{
+		context->Map(lightShadowBuffer.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped);
+		memcpy(mapped.pData, lightShadowViews.data(), sizeof(int) * lightShadowViews.size());
+		context->Unmap(lightShadowBuffer.Get(), 0);
+	}
+}
+
+
+// --------------------------------------------------------
+// Builds the view & projection for one view of a light
+//
+// light - The light being shadowed
+// face - Cube face (+X, -X, +Y, -Y, +Z, -Z) or cascade
+// tileSize - Size of the view's atlas tile (in texels)
+// cascadeSpheres - Bounds of each directional cascade
+// --------------------------------------------------------
+XMFLOAT4X4 Renderer::CalculateShadowViewProjection(const Light& light, unsigned int face, unsigned int tileSize, const XMFLOAT4* cascadeSpheres)
+{
+	XMMATRIX viewMat;
+	XMMATRIX projMat;
+
+	switch (light.Type)
+	{
+	case LIGHT_TYPE_DIRECTIONAL:
+	{
+		XMVECTOR dir = XMVector3Normalize(XMLoadFloat3(&light.Direction));
+		XMVECTOR up = fabsf(XMVectorGetY(dir)) > 0.99f ? XMVectorSet(1, 0, 0, 0) : XMVectorSet(0, 1, 0, 0);
+		const XMFLOAT4& sphere = cascadeSpheres[face];
+
+		// Snap the center to whole texels in the light's space,
+		// so edges don't shimmer as the camera moves
+		XMMATRIX lightRotation = XMMatrixLookToLH(XMVectorZero(), dir, up);
+		XMVECTOR center = XMVector3Transform(XMVectorSet(sphere.x, sphere.y, sphere.z, 1), lightRotation);
+		float texel = sphere.w * 2 / tileSize;
+		center = XMVectorSelect(center, XMVectorFloor(center / texel) * texel, XMVectorSelectControl(1, 1, 0, 0));
+		center = XMVector3Transform(center, XMMatrixInverse(0, lightRotation));
+
+		// Back up toward the light so things outside the
+		// cascade can still cast shadows into it
+		viewMat = XMMatrixLookToLH(center - dir * (sphere.w + ShadowCasterDistance), dir, up);
+		projMat = XMMatrixOrthographicLH(sphere.w * 2, sphere.w * 2, 0.0f, sphere.w * 2 + ShadowCasterDistance);
+		break;
+	}
+
+	case LIGHT_TYPE_POINT:
+	{
+		static const XMFLOAT3 faceDirs[SHADOW_CUBE_FACES] = {
+			XMFLOAT3(1, 0, 0), XMFLOAT3(-1, 0, 0),
+			XMFLOAT3(0, 1, 0), XMFLOAT3(0, -1, 0),
+			XMFLOAT3(0, 0, 1), XMFLOAT3(0, 0, -1) };
+		static const XMFLOAT3 faceUps[SHADOW_CUBE_FACES] = {
+			XMFLOAT3(0, 1, 0), XMFLOAT3(0, 1, 0),
+			XMFLOAT3(0, 0, -1), XMFLOAT3(0, 0, 1),
+			XMFLOAT3(0, 1, 0), XMFLOAT3(0, 1, 0) };
+
+		viewMat = XMMatrixLookToLH(XMLoadFloat3(&light.Position), XMLoadFloat3(&faceDirs[face]), XMLoadFloat3(&faceUps[face]));
+		projMat = XMMatrixPerspectiveFovLH(XM_PIDIV2, 1.0f, ShadowNearClip, light.Range);
+		break;
+	}
+
+	default:
+	{
+		// Spot lights fade with pow(cos(angle), falloff), so the cone
+		// ends where that drops below 1/256 (same as the clusters)
+		float cosAngle = powf(1.0f / 256.0f, 1.0f / max(light.SpotFalloff, 0.001f));
+		float fov = max(0.01f, min(2.0f * acosf(cosAngle), XM_PI * 0.9f));
+
+		XMVECTOR dir = XMVector3Normalize(XMLoadFloat3(&light.Direction));
+		XMVECTOR up = fabsf(XMVectorGetY(dir)) > 0.99f ? XMVectorSet(1, 0, 0, 0) : XMVectorSet(0, 1, 0, 0);
+		viewMat = XMMatrixLookToLH(XMLoadFloat3(&light.Position), dir, up);
+		projMat = XMMatrixPerspectiveFovLH(fov, 1.0f, ShadowNearClip, light.Range);
+		break;
+	}
+	}
+
+	XMFLOAT4X4 viewProj;
+	XMStoreFloat4x4(&viewProj, viewMat * projMat);
+	return viewProj;
+}
+
+
 void Renderer::RenderSceneDeferred(Camera* camera)
 {
 	// Collect all per-frame data and copy to GPU
@@ -654,6 +1259,54 @@ void Renderer::RenderLightsDeferred(Camera* camera)
 	
 }
 
+// --------------------------------------------------------
+// Accumulates all deferred lighting with a single compute
+// dispatch.  Each 16x16 tile finds its depth bounds, culls
+// the lights down to those that touch it and then shades
+// them all, reading the G-buffer only once per pixel.
+// --------------------------------------------------------
+void Renderer::RenderLightsTiled(Camera* camera)
+{
+	SimpleComputeShader* tiledCS = Assets::GetInstance().GetComputeShader("DeferredTiledLightingCS.cso");
+	tiledCS->SetShader();
+
+	// Per-frame data
+	XMFLOAT4X4 proj = camera->GetProjection();
+	tiledCS->SetInt("LightCount", activeLightCount);
+	tiledCS->SetFloat3("CameraPosition", camera->GetTransform()->GetPosition());
+	tiledCS->SetMatrix4x4("InvViewProj", camera->GetInverseViewProjection());
+	tiledCS->SetMatrix4x4("View", camera->GetView());
+	tiledCS->SetFloat2("ProjectionScale", XMFLOAT2(proj._11, proj._22));
+	tiledCS->SetFloat2("ScreenSize", XMFLOAT2((float)windowWidth, (float)windowHeight));
+	tiledCS->SetFloat("NearClip", camera->GetNearClip());
+	tiledCS->SetFloat("FarClip", camera->GetFarClip());
+	tiledCS->CopyAllBufferData();
+
+	// G-buffer in, light buffer out
+	tiledCS->SetShaderResourceView("GBufferAlbedo", renderTargetSRVs[RenderTargetType::GBUFFER_ALBEDO]);
+	tiledCS->SetShaderResourceView("GBufferNormals", renderTargetSRVs[RenderTargetType::GBUFFER_NORMALS]);
+	tiledCS->SetShaderResourceView("GBufferDepth", renderTargetSRVs[RenderTargetType::GBUFFER_DEPTH]);
+	tiledCS->SetShaderResourceView("GBufferMetalRough", renderTargetSRVs[RenderTargetType::GBUFFER_METAL_ROUGH]);
+	tiledCS->SetShaderResourceView("Lights", lightDataSRV);
+	tiledCS->SetShaderResourceView("ShadowAtlas", shadowAtlasSRV);
+	tiledCS->SetShaderResourceView("ShadowViews", shadowViewSRV);
+	tiledCS->SetShaderResourceView("LightShadowViews", lightShadowSRV);
+	tiledCS->SetSamplerState("ShadowSampler", shadowSampler);
+	tiledCS->SetUnorderedAccessView("LightBuffer", lightBufferUAV);
+
+	// One thread group per tile
+	tiledCS->DispatchByGroups(
+		(windowWidth + LIGHT_TILE_SIZE - 1) / LIGHT_TILE_SIZE,
+		(windowHeight + LIGHT_TILE_SIZE - 1) / LIGHT_TILE_SIZE,
+		1);
+
+	// Unbind everything so these can be render targets again
+	ID3D11ShaderResourceView* nullSRVs[8] = {};
+	ID3D11UnorderedAccessView* nullUAV = 0;
+	context->CSSetShaderResources(0, 8, nullSRVs);
+	context->CSSetUnorderedAccessViews(0, 1, &nullUAV, 0);
+}
+
 void Renderer::PreResize()
 {
 	backBufferRTV.Reset();
@@ -674,13 +1327,14 @@ void Renderer::PostResize(
 	// Release all of the renderer-specific render targets
 	for (auto& rt : renderTargetSRVs) rt.Reset();
 	for (auto& rt : renderTargetRTVs) rt.Reset();
+	lightBufferUAV.Reset();
 
 	// Recreate using the new window size
 	CreateRenderTarget(windowWidth, windowHeight, renderTargetRTVs[RenderTargetType::GBUFFER_ALBEDO], renderTargetSRVs[RenderTargetType::GBUFFER_ALBEDO]);
 	CreateRenderTarget(windowWidth, windowHeight, renderTargetRTVs[RenderTargetType::GBUFFER_NORMALS], renderTargetSRVs[RenderTargetType::GBUFFER_NORMALS], DXGI_FORMAT_R16G16B16A16_FLOAT);
 	CreateRenderTarget(windowWidth, windowHeight, renderTargetRTVs[RenderTargetType::GBUFFER_DEPTH], renderTargetSRVs[RenderTargetType::GBUFFER_DEPTH], DXGI_FORMAT_R32_FLOAT);
 	CreateRenderTarget(windowWidth, windowHeight, renderTargetRTVs[RenderTargetType::GBUFFER_METAL_ROUGH], renderTargetSRVs[RenderTargetType::GBUFFER_METAL_ROUGH]);
-	CreateRenderTarget(windowWidth, windowHeight, renderTargetRTVs[RenderTargetType::LIGHT_BUFFER], renderTargetSRVs[RenderTargetType::LIGHT_BUFFER], DXGI_FORMAT_R16G16B16A16_FLOAT);
+	CreateRenderTarget(windowWidth, windowHeight, renderTargetRTVs[RenderTargetType::LIGHT_BUFFER], renderTargetSRVs[RenderTargetType::LIGHT_BUFFER], DXGI_FORMAT_R16G16B16A16_FLOAT, &lightBufferUAV);
 	CreateRenderTarget(windowWidth, windowHeight, renderTargetRTVs[RenderTargetType::SCENE_NO_AMBIENT], renderTargetSRVs[RenderTargetType::SCENE_NO_AMBIENT]);
 	CreateRenderTarget(windowWidth, windowHeight, renderTargetRTVs[RenderTargetType::SCENE_AMBIENT], renderTargetSRVs[RenderTargetType::SCENE_AMBIENT]);
 	CreateRenderTarget(windowWidth, windowHeight, renderTargetRTVs[RenderTargetType::SSAO_RESULTS], renderTargetSRVs[RenderTargetType::SSAO_RESULTS]);
@@ -688,7 +1342,8 @@ void Renderer::PostResize(
 }
 
 unsigned int Renderer::GetActiveLightCount() { return activeLightCount; }
-void Renderer::SetActiveLightCount(unsigned int count){	activeLightCount = min(count, MAX_LIGHTS); }
+void Renderer::SetActiveLightCount(unsigned int count){	activeLightCount = min(count, (unsigned int)lights.size()); }
+unsigned int Renderer::GetLightsUploaded() { return lightsUploaded; }
 
 void Renderer::SetPointLightsVisible(bool visible) { pointLightsVisible = visible; }
 bool Renderer::GetPointLightsVisible() { return pointLightsVisible; }
@@ -696,6 +1351,9 @@ bool Renderer::GetPointLightsVisible() { return pointLightsVisible; }
 void Renderer::SetDeferredSilhouettes(bool visible) { drawDeferredLightSilhouettes = visible; }
 bool Renderer::GetDeferredSilhouettes() { return drawDeferredLightSilhouettes; }
 
+void Renderer::SetTiledDeferredLighting(bool enabled) { tiledDeferredLighting = enabled; }
+bool Renderer::GetTiledDeferredLighting() { return tiledDeferredLighting; }
+
 void Renderer::SetRenderPath(RenderPath path) { renderPath = path; }
 RenderPath Renderer::GetRenderPath() { return renderPath; }
 
@@ -714,6 +1372,18 @@ bool Renderer::GetSSAOOutputOnly() { return ssaoOutputOnly; }
 void Renderer::SetIBLIntensity(float intensity) { iblIntensity = intensity; }
 float Renderer::GetIBLIntensity() { return iblIntensity; }
 
+void Renderer::SetClusteredLighting(bool enabled) { clusteredLighting = enabled; }
+bool Renderer::GetClusteredLighting() { return clusteredLighting; }
+float Renderer::GetClusterBuildTime() { return clusterBuildTime; }
+unsigned int Renderer::GetClusterLightIndexCount() { return (unsigned int)lightClusters.GetLightIndices().size(); }
+
+void Renderer::SetShadowsEnabled(bool enabled) { shadowsEnabled = enabled; shadowAtlas.InvalidateAll(); }
+bool Renderer::GetShadowsEnabled() { return shadowsEnabled; }
+void Renderer::SetMaxShadowedLights(unsigned int count) { shadowAtlas.SetMaxShadowedLights(count); }
+unsigned int Renderer::GetMaxShadowedLights() { return shadowAtlas.GetMaxShadowedLights(); }
+unsigned int Renderer::GetShadowViewCount() { return shadowsEnabled ? (unsigned int)shadowAtlas.GetViews().size() : 0; }
+unsigned int Renderer::GetShadowViewsRendered() { return shadowsEnabled ? shadowAtlas.GetRenderCount() : 0; }
+
 Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> Renderer::GetRenderTargetSRV(RenderTargetType type)
 { 
 	if (type < 0 || type >= RenderTargetType::RENDER_TARGET_TYPE_COUNT)
@@ -789,7 +1459,8 @@ void Renderer::CreateRenderTarget(
 	unsigned int height, 
 	Microsoft::WRL::ComPtr<ID3D11RenderTargetView>& rtv, 
 	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>& srv,
-	DXGI_FORMAT colorFormat)
+	DXGI_FORMAT colorFormat,
+	Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView>* uav)
 {
 	// Make the texture
 	Microsoft::WRL::ComPtr<ID3D11Texture2D> rtTexture;
@@ -799,6 +1470,7 @@ void Renderer::CreateRenderTarget(
 	texDesc.Height           = height;
 	texDesc.ArraySize        = 1;
 	texDesc.BindFlags        = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE; // Need both!
+	if (uav) texDesc.BindFlags |= D3D11_BIND_UNORDERED_ACCESS; // And maybe compute shader output
 	texDesc.Format           = colorFormat; 
 	texDesc.MipLevels        = 1; // Usually no mip chain needed for render targets
 	texDesc.MiscFlags        = 0;
@@ -817,4 +1489,37 @@ void Renderer::CreateRenderTarget(
 		rtTexture.Get(),     // Texture resource itself
 		0,                   // Null description = default SRV options
 		srv.GetAddressOf()); // ComPtr<ID3D11ShaderResourceView>
+
+	// And the unordered access view, if requested
+	if (uav)
+		device->CreateUnorderedAccessView(rtTexture.Get(), 0, uav->GetAddressOf());
+}
+
+// --------------------------------------------------------
+// Creates a structured buffer (and SRV).  Dynamic buffers
+// are written by the CPU with Map() and WRITE_DISCARD,
+// while default buffers use UpdateSubresource().
+// --------------------------------------------------------
+void Renderer::CreateStructuredBuffer(
+	unsigned int stride,
+	unsigned int count,
+	D3D11_USAGE usage,
+	Microsoft::WRL::ComPtr<ID3D11Buffer>& buffer,
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>& srv)
+{
+	D3D11_BUFFER_DESC desc = {};
+	desc.ByteWidth           = stride * count;
+	desc.BindFlags           = D3D11_BIND_SHADER_RESOURCE;
+	desc.Usage               = usage;
+	desc.CPUAccessFlags      = usage == D3D11_USAGE_DYNAMIC ? D3D11_CPU_ACCESS_WRITE : 0;
+	desc.MiscFlags           = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+	desc.StructureByteStride = stride;
+	device->CreateBuffer(&desc, 0, buffer.GetAddressOf());
+
+	D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	srvDesc.Format              = DXGI_FORMAT_UNKNOWN; // Required for structured buffers
+	srvDesc.ViewDimension       = D3D11_SRV_DIMENSION_BUFFER;
+	srvDesc.Buffer.FirstElement = 0;
+	srvDesc.Buffer.NumElements  = count;
+	device->CreateShaderResourceView(buffer.Get(), &srvDesc, srv.GetAddressOf());
 }
@@ -7,6 +7,8 @@
 #include "Camera.h"
 #include "GameEntity.h"
 #include "Lights.h"
+#include "LightClusters.h"
+#include "ShadowAtlas.h"
 #include "Sky.h"
 
 enum class RenderPath
@@ -39,14 +41,27 @@ struct VSPerFrameData
 };
 
 // This needs to match the expected per-frame pixel shader data
+// - Lights themselves live in a separate structured buffer
 struct PSPerFrameData
 {
-	Light Lights[MAX_LIGHTS];
 	int LightCount;
 	DirectX::XMFLOAT3 CameraPosition;
 	int TotalSpecIBLMipLevels;
 	DirectX::XMFLOAT3 AmbientNonPBR;
 	float IBLIntensity;
+	int UseClusters;
+	DirectX::XMFLOAT2 ScreenSize;
+	float ClusterNearClip;
+	float ClusterFarClip;
+	float ClusterDepthScale;
+	float ClusterDepthBias;
+};
+
+// One view of a light in the shadow atlas - must match Lighting.hlsli
+struct ShadowViewData
+{
+	DirectX::XMFLOAT4X4 ViewProjection;
+	DirectX::XMFLOAT4 AtlasRect;
 };
 
 class Renderer
@@ -77,6 +92,7 @@ public:
 
 	unsigned int GetActiveLightCount();
 	void SetActiveLightCount(unsigned int count);
+	unsigned int GetLightsUploaded();
 
 	void SetPointLightsVisible(bool visible);
 	bool GetPointLightsVisible();
@@ -84,6 +100,9 @@ public:
 	void SetDeferredSilhouettes(bool visible);
 	bool GetDeferredSilhouettes();
 
+	void SetTiledDeferredLighting(bool enabled);
+	bool GetTiledDeferredLighting();
+
 	void SetRenderPath(RenderPath path);
 	RenderPath GetRenderPath();
 
@@ -102,6 +121,18 @@ public:
 	void SetIBLIntensity(float intensity);
 	float GetIBLIntensity();
 
+	void SetClusteredLighting(bool enabled);
+	bool GetClusteredLighting();
+	float GetClusterBuildTime();
+	unsigned int GetClusterLightIndexCount();
+
+	void SetShadowsEnabled(bool enabled);
+	bool GetShadowsEnabled();
+	void SetMaxShadowedLights(unsigned int count);
+	unsigned int GetMaxShadowedLights();
+	unsigned int GetShadowViewCount();
+	unsigned int GetShadowViewsRendered();
+
 	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> GetRenderTargetSRV(RenderTargetType type);
 
 private:
@@ -121,6 +152,8 @@ private:
 	// Current render path (and other deferred requirements)
 	RenderPath renderPath;
 	bool drawDeferredLightSilhouettes;
+	bool tiledDeferredLighting;
+	Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView> lightBufferUAV;
 	Microsoft::WRL::ComPtr<ID3D11BlendState> deferredAdditiveBlendState;
 	Microsoft::WRL::ComPtr<ID3D11RasterizerState> deferredCullFrontRasterState;
 	Microsoft::WRL::ComPtr<ID3D11DepthStencilState> deferredPointLightDepthState;
@@ -133,6 +166,41 @@ private:
 	bool ssaoEnabled;
 	bool ssaoOutputOnly;
 
+	// Clustered forward lighting
+	bool clusteredLighting;
+	LightClusters lightClusters;
+	std::vector<ClusterLight> clusterLights;
+	Microsoft::WRL::ComPtr<ID3D11Buffer> clusterRangeBuffer;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> clusterRangeSRV;
+	Microsoft::WRL::ComPtr<ID3D11Buffer> clusterIndexBuffer;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> clusterIndexSRV;
+	unsigned int clusterIndexCapacity;
+	float clusterBuildTime;
+
+	// Shadows - one depth atlas for every shadowed light, along with
+	// what's needed to spot lights and entities that have changed
+	bool shadowsEnabled;
+	ShadowAtlas shadowAtlas;
+	Microsoft::WRL::ComPtr<ID3D11DepthStencilView> shadowAtlasDSV;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> shadowAtlasSRV;
+	Microsoft::WRL::ComPtr<ID3D11SamplerState> shadowSampler;
+	Microsoft::WRL::ComPtr<ID3D11RasterizerState> shadowRasterState;
+	Microsoft::WRL::ComPtr<ID3D11DepthStencilState> shadowClearDepthState;
+	Microsoft::WRL::ComPtr<ID3D11Buffer> shadowViewBuffer;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> shadowViewSRV;
+	Microsoft::WRL::ComPtr<ID3D11Buffer> lightShadowBuffer;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> lightShadowSRV;
+	unsigned int shadowViewCapacity;
+	unsigned int lightShadowCapacity;
+	std::vector<ShadowRequest> shadowRequests;
+	std::vector<ShadowBounds> shadowMovedBounds;
+	std::vector<ShadowViewData> shadowViewData;
+	std::vector<int> lightShadowViews;
+	std::vector<Light> shadowLights;
+	std::vector<DirectX::XMFLOAT4X4> shadowEntityWorlds;
+	DirectX::XMFLOAT4X4 shadowCameraView;
+	DirectX::XMFLOAT4X4 shadowCameraProjection;
+
 	// Overall ambient for non-pbr shaders
 	DirectX::XMFLOAT3 ambientNonPBR;
 	float iblIntensity;
@@ -147,6 +215,17 @@ private:
 	Sky* sky;
 	unsigned int activeLightCount;
 
+	// All light data, in a structured buffer that grows as necessary,
+	// along with a copy of what's been uploaded so far so that
+	// unchanged lights can be skipped
+	Microsoft::WRL::ComPtr<ID3D11Buffer> lightDataBuffer;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> lightDataSRV;
+	unsigned int lightDataCapacity;
+	std::vector<Light> uploadedLights;
+	unsigned int uploadedLightCount;
+	unsigned int lightsUploaded;
+	void UpdateLightBuffer();
+
 	// Per-frame constant buffers and data
 	Microsoft::WRL::ComPtr<ID3D11Buffer> psPerFrameConstantBuffer;
 	Microsoft::WRL::ComPtr<ID3D11Buffer> vsPerFrameConstantBuffer;
@@ -157,6 +236,10 @@ private:
 	void RenderSceneForward(Camera* camera);
 	void RenderSceneDeferred(Camera* camera);
 	void RenderLightsDeferred(Camera* camera);
+	void RenderLightsTiled(Camera* camera);
+	void BuildLightClusters(Camera* camera);
+	void RenderShadows(Camera* camera);
+	DirectX::XMFLOAT4X4 CalculateShadowViewProjection(const Light& light, unsigned int face, unsigned int tileSize, const DirectX::XMFLOAT4* cascadeSpheres);
 
 	// Note: Potentially replace this with an instanced "debug drawing" set of methods?
 	void DrawPointLights(Camera* camera);
@@ -167,6 +250,14 @@ private:
 		unsigned int height, 
 		Microsoft::WRL::ComPtr<ID3D11RenderTargetView>& rtv, 
 		Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>& srv,
-		DXGI_FORMAT colorFormat = DXGI_FORMAT_R8G8B8A8_UNORM);
+		DXGI_FORMAT colorFormat = DXGI_FORMAT_R8G8B8A8_UNORM,
+		Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView>* uav = 0);
+
+	void CreateStructuredBuffer(
+		unsigned int stride,
+		unsigned int count,
+		D3D11_USAGE usage,
+		Microsoft::WRL::ComPtr<ID3D11Buffer>& buffer,
+		Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>& srv);
 };
 
@@ -0,0 +1,561 @@
+#include "ShadowAtlas.h"
+
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+
+
+// --------------------------------------------------------
+// Constructor - all sizes are in texels and should be
+// powers of two, with min <= max <= atlas size
+// --------------------------------------------------------
+ShadowAtlas::ShadowAtlas(unsigned int atlasSize, unsigned int minTileSize, unsigned int maxTileSize) :
+	atlasSize(atlasSize),
+	minTileSize(minTileSize),
+	maxTileSize(std::min(maxTileSize, atlasSize)),
+	maxShadowedLights(16),
+	invalidateAll(true),
+	renderCount(0)
+{
+	freeBlocks.resize(GetLevel(minTileSize) + 1);
+}
+
+
+// --------------------------------------------------------
+// Places this frame's shadow views in the atlas and works
+// out which of them need to be rendered
+//
+// requests - Lights that want shadows, in any order
+// requestCount - How many lights are in the array
+// movedBounds - Bounds of everything that moved since the
+//               last update (both before and after moving)
+// movedCount - How many bounds are in the array
+// --------------------------------------------------------
+void ShadowAtlas::Update(
+	const ShadowRequest* requests,
+	unsigned int requestCount,
+	const ShadowBounds* movedBounds,
+	unsigned int movedCount)
+{
+	// Most important lights first, with the light index
+	// as a tie breaker so the order is always the same
+	std::vector<const ShadowRequest*> sorted;
+	for (unsigned int i = 0; i < requestCount; i++)
+	{
+		if (requests[i].Importance > 0 && requests[i].ViewCount > 0)
+			sorted.push_back(&requests[i]);
+	}
+	std::sort(sorted.begin(), sorted.end(), [](const ShadowRequest* a, const ShadowRequest* b)
+		{
+			if (a->Importance != b->Importance)
+				return a->Importance > b->Importance;
+			return a->LightIndex < b->LightIndex;
+		});
+	if (sorted.size() > maxShadowedLights)
+		sorted.resize(maxShadowedLights);
+
+	// Tile sizes, which never increase down the list
+	std::vector<unsigned int> sizes(sorted.size());
+	unsigned long long area = 0;
+	for (size_t i = 0; i < sorted.size(); i++)
+	{
+		sizes[i] = GetTileSize(sorted[i]->Importance);
+		area += (unsigned long long)sizes[i] * sizes[i] * sorted[i]->ViewCount;
+	}
+
+	// Shrink the least important lights until everything fits,
+	// dropping lights entirely once they're already the minimum
+	const unsigned long long atlasArea = (unsigned long long)atlasSize * atlasSize;
+	while (area > atlasArea)
+	{
+		size_t shrink = sizes.size();
+		while (shrink > 0 && sizes[shrink - 1] == minTileSize)
+			shrink--;
+
+		if (shrink > 0)
+		{
+			unsigned long long tileArea = (unsigned long long)sizes[shrink - 1] * sizes[shrink - 1];
+			area -= (tileArea - tileArea / 4) * sorted[shrink - 1]->ViewCount;
+			sizes[shrink - 1] /= 2;
+		}
+		else
+		{
+			area -= (unsigned long long)minTileSize * minTileSize * sorted.back()->ViewCount;
+			sorted.pop_back();
+			sizes.pop_back();
+		}
+	}
+
+	// Lay out the views, saving the last frame's results first
+	views.swap(previousViews);
+	firstViews.swap(previousFirstViews);
+	views.clear();
+	firstViews.clear();
+	for (size_t i = 0; i < sorted.size(); i++)
+	{
+		firstViews[sorted[i]->LightIndex] = (unsigned int)views.size();
+		for (unsigned int face = 0; face < sorted[i]->ViewCount; face++)
+		{
+			ShadowView view = {};
+			view.LightIndex = sorted[i]->LightIndex;
+			view.Face = face;
+			view.Size = sizes[i];
+			views.push_back(view);
+		}
+	}
+
+	// Views that are the same size as last frame try to keep their
+	// old tiles, and everything else goes wherever there's room.
+	// Sizes are powers of two placed largest first, so the second
+	// attempt (from an empty atlas) can't run out of space.
+	std::vector<bool> placed(views.size());
+	for (int attempt = 0; attempt < 2; attempt++)
+	{
+		ResetBlocks();
+		std::fill(placed.begin(), placed.end(), false);
+
+		if (attempt == 0)
+		{
+			for (size_t v = 0; v < views.size(); v++)
+			{
+				auto prev = previousFirstViews.find(views[v].LightIndex);
+				if (prev == previousFirstViews.end())
+					continue;
+
+				unsigned int prevIndex = prev->second + views[v].Face;
+				if (prevIndex >= previousViews.size())
+					continue;
+
+				const ShadowView& old = previousViews[prevIndex];
+				if (old.LightIndex == views[v].LightIndex &&
+					old.Face == views[v].Face &&
+					old.Size == views[v].Size &&
+					Reserve(old.X, old.Y, old.Size))
+				{
+					views[v].X = old.X;
+					views[v].Y = old.Y;
+					placed[v] = true;
+				}
+			}
+		}
+
+		bool success = true;
+		for (size_t v = 0; v < views.size() && success; v++)
+		{
+			if (!placed[v])
+				success = Allocate(views[v].Size, views[v].X, views[v].Y);
+		}
+
+		if (success)
+			break;
+	}
+
+	// Decide what needs rendering - anything new, moved or
+	// resized, any light that changed and any static light
+	// whose bounds overlap something that moved
+	renderCount = 0;
+	for (size_t i = 0; i < sorted.size(); i++)
+	{
+		const ShadowRequest& request = *sorted[i];
+
+		bool touched = request.BoundsRadius < 0 && movedCount > 0;
+		for (unsigned int m = 0; m < movedCount && !touched; m++)
+		{
+			float dx = request.BoundsCenter[0] - movedBounds[m].Center[0];
+			float dy = request.BoundsCenter[1] - movedBounds[m].Center[1];
+			float dz = request.BoundsCenter[2] - movedBounds[m].Center[2];
+			float r = request.BoundsRadius + movedBounds[m].Radius;
+			touched = dx * dx + dy * dy + dz * dz <= r * r;
+		}
+
+		unsigned int first = firstViews[request.LightIndex];
+		for (unsigned int face = 0; face < request.ViewCount; face++)
+		{
+			ShadowView& view = views[first + face];
+
+			bool sameTile = false;
+			auto prev = previousFirstViews.find(request.LightIndex);
+			if (prev != previousFirstViews.end() && prev->second + face < previousViews.size())
+			{
+				const ShadowView& old = previousViews[prev->second + face];
+				sameTile =
+					old.LightIndex == view.LightIndex &&
+					old.Face == view.Face &&
+					old.X == view.X &&
+					old.Y == view.Y &&
+					old.Size == view.Size;
+			}
+
+			view.NeedsRender = invalidateAll || !request.Static || touched || !sameTile;
+			if (view.NeedsRender)
+				renderCount++;
+		}
+	}
+
+	invalidateAll = false;
+}
+
+
+// --------------------------------------------------------
+// Forces every view to be rendered on the next update,
+// for when the atlas contents can't be trusted
+// --------------------------------------------------------
+void ShadowAtlas::InvalidateAll()
+{
+	invalidateAll = true;
+}
+
+
+// --------------------------------------------------------
+// Getters for the results of the most recent Update()
+// --------------------------------------------------------
+const std::vector<ShadowView>& ShadowAtlas::GetViews() const { return views; }
+unsigned int ShadowAtlas::GetRenderCount() const { return renderCount; }
+
+
+// --------------------------------------------------------
+// Gets the index of a light's first view, with the rest
+// of its views directly after it
+//
+// Returns -1 if the light has no shadows this frame
+// --------------------------------------------------------
+int ShadowAtlas::GetFirstView(uint32_t lightIndex) const
+{
+	auto it = firstViews.find(lightIndex);
+	return it == firstViews.end() ? -1 : (int)it->second;
+}
+
+
+// --------------------------------------------------------
+// Gets the tile size for a light of the given importance:
+// the largest power of two that's no bigger than the max
+// tile size scaled by the importance (within the limits)
+// --------------------------------------------------------
+unsigned int ShadowAtlas::GetTileSize(float importance) const
+{
+	float target = importance * maxTileSize;
+	unsigned int size = minTileSize;
+	while (size < maxTileSize && size * 2 <= target)
+		size *= 2;
+	return size;
+}
+
+
+unsigned int ShadowAtlas::GetAtlasSize() const { return atlasSize; }
+void ShadowAtlas::SetMaxShadowedLights(unsigned int count) { maxShadowedLights = count; }
+unsigned int ShadowAtlas::GetMaxShadowedLights() const { return maxShadowedLights; }
+
+
+// --------------------------------------------------------
+// Empties the quadtree so the whole atlas is one free block
+// --------------------------------------------------------
+void ShadowAtlas::ResetBlocks()
+{
+	for (auto& level : freeBlocks)
+		level.clear();
+	freeBlocks[0].push_back({ 0, 0 });
+}
+
+
+// --------------------------------------------------------
+// Gets the quadtree level holding blocks of the given size
+// --------------------------------------------------------
+unsigned int ShadowAtlas::GetLevel(unsigned int size) const
+{
+	unsigned int level = 0;
+	while ((atlasSize >> level) > size)
+		level++;
+	return level;
+}
+
+
+// --------------------------------------------------------
+// Finds a free block of the given size, splitting a larger
+// one if necessary.  Splits always hand out the top left
+// quarter first, so the atlas fills from the top left.
+//
+// Returns false if there's no room left
+// --------------------------------------------------------
+bool ShadowAtlas::Allocate(unsigned int size, unsigned int& x, unsigned int& y)
+{
+	unsigned int level = GetLevel(size);
+
+	// Smallest free block that's big enough
+	int source = (int)level;
+	while (source >= 0 && freeBlocks[source].empty())
+		source--;
+	if (source < 0)
+		return false;
+
+	Block block = freeBlocks[source].back();
+	freeBlocks[source].pop_back();
+
+	// Split down to the requested size, keeping the top left
+	// quarter each time and freeing the other three
+	for (unsigned int l = (unsigned int)source + 1; l <= level; l++)
+	{
+		unsigned int half = atlasSize >> l;
+		freeBlocks[l].push_back({ block.X + half, block.Y + half });
+		freeBlocks[l].push_back({ block.X, block.Y + half });
+		freeBlocks[l].push_back({ block.X + half, block.Y });
+	}
+
+	x = block.X;
+	y = block.Y;
+	return true;
+}
+
+
+// --------------------------------------------------------
+// Claims one specific block, splitting whichever free block
+// holds it as necessary
+//
+// Returns false if any part of that block is already in use
+// --------------------------------------------------------
+bool ShadowAtlas::Reserve(unsigned int x, unsigned int y, unsigned int size)
+{
+	unsigned int level = GetLevel(size);
+
+	// Look for the free block containing this one, from this
+	// size on up through its larger and larger parents
+	for (int l = (int)level; l >= 0; l--)
+	{
+		unsigned int blockSize = atlasSize >> l;
+		unsigned int bx = x / blockSize * blockSize;
+		unsigned int by = y / blockSize * blockSize;
+
+		auto& list = freeBlocks[l];
+		auto it = std::find_if(list.begin(), list.end(), [=](const Block& b) { return b.X == bx && b.Y == by; });
+		if (it == list.end())
+			continue;
+		list.erase(it);
+
+		// Split down to the requested block, freeing the
+		// three quarters that don't contain it each time
+		for (unsigned int s = (unsigned int)l + 1; s <= level; s++)
+		{
+			unsigned int half = atlasSize >> s;
+			unsigned int keepX = x >= bx + half ? bx + half : bx;
+			unsigned int keepY = y >= by + half ? by + half : by;
+			for (unsigned int q = 0; q < 4; q++)
+			{
+				unsigned int qx = bx + (q % 2) * half;
+				unsigned int qy = by + (q / 2) * half;
+				if (qx != keepX || qy != keepY)
+					freeBlocks[s].push_back({ qx, qy });
+			}
+			bx = keepX;
+			by = keepY;
+		}
+		return true;
+	}
+
+	return false;
+}
+
+
+// --------------------------------------------------------
+// Runs the policy over a series of made up frames and checks:
+//  - Views stay inside the atlas, are aligned to their own
+//    tile size (tier) and never overlap each other
+//  - Lights that change tier get a new tile, the tiles they
+//    and evicted lights leave behind get reused, and lights
+//    that didn't change keep theirs
+//  - Cached views are only rendered again when their light
+//    moves or a shadow caster moves within its bounds
+// --------------------------------------------------------
+ShadowAtlasTestResults ShadowAtlas::Test()
+{
+	ShadowAtlasTestResults results = {};
+	auto check = [&](bool condition, const char* description)
+	{
+		results.Checks++;
+		if (!condition)
+		{
+			results.Failures++;
+			printf("  FAILED: %s\n", description);
+		}
+	};
+
+	// Every view in bounds, aligned to its tier and overlapping nothing
+	auto packedCleanly = [](const ShadowAtlas& atlas)
+	{
+		const std::vector<ShadowView>& views = atlas.GetViews();
+		for (size_t a = 0; a < views.size(); a++)
+		{
+			const ShadowView& va = views[a];
+			if (va.Size < atlas.minTileSize || va.Size > atlas.maxTileSize || (va.Size & (va.Size - 1)) != 0 ||
+				va.X % va.Size != 0 || va.Y % va.Size != 0 ||
+				va.X + va.Size > atlas.atlasSize || va.Y + va.Size > atlas.atlasSize)
+				return false;
+
+			for (size_t b = a + 1; b < views.size(); b++)
+			{
+				const ShadowView& vb = views[b];
+				if (va.X < vb.X + vb.Size && vb.X < va.X + va.Size &&
+					va.Y < vb.Y + vb.Size && vb.Y < va.Y + va.Size)
+					return false;
+			}
+		}
+		return true;
+	};
+
+	// Views rendered this frame for a single light
+	auto rendered = [](const ShadowAtlas& atlas, uint32_t lightIndex)
+	{
+		unsigned int count = 0;
+		for (const ShadowView& view : atlas.GetViews())
+			count += view.LightIndex == lightIndex && view.NeedsRender ? 1 : 0;
+		return count;
+	};
+
+	auto tileOf = [](const ShadowAtlas& atlas, uint32_t lightIndex, unsigned int face)
+	{
+		int first = atlas.GetFirstView(lightIndex);
+		return first < 0 ? ShadowView{} : atlas.GetViews()[first + face];
+	};
+
+	auto spot = [](uint32_t lightIndex, float importance, float x)
+	{
+		ShadowRequest request = {};
+		request.LightIndex = lightIndex;
+		request.ViewCount = 1;
+		request.Importance = importance;
+		request.Static = true;
+		request.BoundsCenter[0] = x;
+		request.BoundsRadius = 5.0f;
+		return request;
+	};
+
+	// Packing: lights of every type and tier, including far more than
+	// fit, over a few frames of shifting importance
+	{
+		ShadowAtlas atlas(2048, 64, 512);
+		atlas.SetMaxShadowedLights(64);
+		unsigned int seed = 1234;
+		bool clean = true;
+		bool fits = true;
+		bool shrunk = true;
+		for (int frame = 0; frame < 20; frame++)
+		{
+			std::vector<ShadowRequest> requests;
+			for (uint32_t i = 0; i < 48; i++)
+			{
+				seed = seed * 1664525u + 1013904223u;
+				ShadowRequest request = spot(i, (seed >> 8) / 16777216.0f, i * 20.0f);
+				request.ViewCount = i % 7 == 0 ? SHADOW_CUBE_FACES : (i % 11 == 0 ? SHADOW_CASCADE_COUNT : 1);
+				requests.push_back(request);
+			}
+			atlas.Update(requests.data(), (unsigned int)requests.size(), 0, 0);
+			clean &= packedCleanly(atlas);
+
+			unsigned long long area = 0;
+			for (const ShadowView& view : atlas.GetViews())
+			{
+				area += (unsigned long long)view.Size * view.Size;
+				shrunk &= view.Size <= atlas.GetTileSize(requests[view.LightIndex].Importance);
+			}
+			fits &= area <= (unsigned long long)atlas.atlasSize * atlas.atlasSize;
+		}
+		check(clean, "views are aligned to their tier, inside the atlas and never overlap");
+		check(fits, "an over full atlas drops lights until the rest fit");
+		check(shrunk, "no view is bigger than its light's tier");
+	}
+
+	// Eviction and reuse: four top tier lights exactly fill the atlas
+	{
+		ShadowAtlas atlas(1024, 128, 512);
+		std::vector<ShadowRequest> requests;
+		for (uint32_t i = 0; i < 4; i++)
+			requests.push_back(spot(i, 1.0f, i * 100.0f));
+		atlas.Update(requests.data(), (unsigned int)requests.size(), 0, 0);
+		check(atlas.GetViews().size() == 4 && packedCleanly(atlas), "four top tier lights fill the atlas");
+		check(atlas.GetRenderCount() == 4, "every view is rendered on the first frame");
+
+		ShadowView before[4];
+		for (uint32_t i = 0; i < 4; i++)
+			before[i] = tileOf(atlas, i, 0);
+
+		// Light 0 drops a tier and a new light needs the same tier, so
+		// both have to fit in the space light 0 gave up
+		requests[0].Importance = 0.5f;
+		requests.push_back(spot(4, 0.5f, 400.0f));
+		atlas.Update(requests.data(), (unsigned int)requests.size(), 0, 0);
+		check(atlas.GetViews().size() == 5 && packedCleanly(atlas), "a light that drops a tier shares its old tile");
+		check(tileOf(atlas, 0, 0).Size == 256 && rendered(atlas, 0) == 1, "a light that changes tier is rendered at its new size");
+		check(rendered(atlas, 4) == 1, "a new light is rendered");
+		bool kept = true;
+		for (uint32_t i = 1; i < 4; i++)
+			kept &= tileOf(atlas, i, 0).X == before[i].X && tileOf(atlas, i, 0).Y == before[i].Y && rendered(atlas, i) == 0;
+		check(kept, "lights that keep their tier keep their tile and depths");
+		check(atlas.GetRenderCount() == 2, "only the changed and new lights are rendered");
+
+		// Light 2 goes away and a new top tier light should land in
+		// the only free top tier tile: the one light 2 left behind
+		requests.erase(requests.begin() + 2);
+		requests.push_back(spot(5, 1.0f, 500.0f));
+		atlas.Update(requests.data(), (unsigned int)requests.size(), 0, 0);
+		check(atlas.GetFirstView(2) == -1, "a light that stops asking for shadows is evicted");
+		check(tileOf(atlas, 5, 0).X == before[2].X && tileOf(atlas, 5, 0).Y == before[2].Y && packedCleanly(atlas), "an evicted light's tile is reused");
+		check(atlas.GetRenderCount() == 1 && rendered(atlas, 5) == 1, "only the light moving into a reused tile is rendered");
+
+		// Light 0 goes back up a tier while light 4 falls one, which
+		// over fills the atlas, so the least important top tier light
+		// (the newest, by index) gives up half its size
+		requests[0].Importance = 1.0f;
+		requests[3].Importance = 0.1f;
+		atlas.Update(requests.data(), (unsigned int)requests.size(), 0, 0);
+		check(tileOf(atlas, 0, 0).Size == 512 && rendered(atlas, 0) == 1 && packedCleanly(atlas), "a light that rises a tier gets a new, larger tile");
+		check(tileOf(atlas, 4, 0).Size == 128 && rendered(atlas, 4) == 1, "a light that falls a tier is moved and rendered");
+		check(tileOf(atlas, 5, 0).Size == 256 && rendered(atlas, 5) == 1, "the least important light is shrunk when the atlas is over full");
+	}
+
+	// Invalidation: a spot and point light with bounds, and a directional
+	// light that reaches everywhere
+	{
+		ShadowAtlas atlas(2048, 128, 512);
+		std::vector<ShadowRequest> requests;
+		requests.push_back(spot(0, 1.0f, 0.0f));
+		requests.push_back(spot(1, 1.0f, 100.0f));
+		requests[1].ViewCount = SHADOW_CUBE_FACES;
+		requests.push_back(spot(2, 0.3f, 0.0f));
+		requests[2].ViewCount = SHADOW_CASCADE_COUNT;
+		requests[2].BoundsRadius = -1.0f;
+
+		atlas.Update(requests.data(), (unsigned int)requests.size(), 0, 0);
+		check(atlas.GetRenderCount() == 1 + SHADOW_CUBE_FACES + SHADOW_CASCADE_COUNT, "every view is rendered on the first frame");
+
+		atlas.Update(requests.data(), (unsigned int)requests.size(), 0, 0);
+		atlas.Update(requests.data(), (unsigned int)requests.size(), 0, 0);
+		check(atlas.GetRenderCount() == 0, "nothing is rendered while nothing moves");
+
+		// A caster moving near light 1 (but nowhere near light 0)
+		ShadowBounds moved = { { 103.0f, 0.0f, 0.0f }, 1.0f };
+		atlas.Update(requests.data(), (unsigned int)requests.size(), &moved, 1);
+		check(rendered(atlas, 1) == SHADOW_CUBE_FACES && rendered(atlas, 0) == 0, "a moving caster only invalidates lights whose bounds it touches");
+		check(rendered(atlas, 2) == SHADOW_CASCADE_COUNT, "a moving caster invalidates lights that reach everywhere");
+
+		atlas.Update(requests.data(), (unsigned int)requests.size(), 0, 0);
+		check(atlas.GetRenderCount() == 0, "views are cached again once the caster stops");
+
+		// The light itself moving
+		requests[0].Static = false;
+		atlas.Update(requests.data(), (unsigned int)requests.size(), 0, 0);
+		check(atlas.GetRenderCount() == 1 && rendered(atlas, 0) == 1, "only a light that moved is rendered");
+		requests[0].Static = true;
+
+		// Importance changes within a tier don't touch the tiles
+		requests[2].Importance = 0.4f;
+		atlas.Update(requests.data(), (unsigned int)requests.size(), 0, 0);
+		check(atlas.GetRenderCount() == 0, "importance changes within a tier don't invalidate anything");
+
+		atlas.InvalidateAll();
+		atlas.Update(requests.data(), (unsigned int)requests.size(), 0, 0);
+		check(atlas.GetRenderCount() == 1 + SHADOW_CUBE_FACES + SHADOW_CASCADE_COUNT, "invalidating the atlas renders everything once");
+		atlas.Update(requests.data(), (unsigned int)requests.size(), 0, 0);
+		check(atlas.GetRenderCount() == 0, "invalidating the atlas only lasts one update");
+	}
+
+	results.Passed = results.Failures == 0;
+	return results;
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+
+// Number of shadow views each type of light needs - the
+// cascade count should match the definition in Lighting.hlsli
+#define SHADOW_CASCADE_COUNT	3
+#define SHADOW_CUBE_FACES		6
+
+// --------------------------------------------------------
+// A light that would like space in the shadow atlas
+// --------------------------------------------------------
+struct ShadowRequest
+{
+	uint32_t LightIndex;
+	unsigned int ViewCount;	// 1 for spot, 6 for point, cascade count for directional
+	float Importance;		// Roughly how much of the screen the light covers (0-1)
+	bool Static;			// True if none of the light's views changed since last frame
+
+	// World space sphere holding everything the light's views can see,
+	// with a negative radius for lights that reach everywhere
+	float BoundsCenter[3];
+	float BoundsRadius;
+};
+
+// --------------------------------------------------------
+// World space bounds of something that moved, used to
+// decide which cached shadow views are out of date
+// --------------------------------------------------------
+struct ShadowBounds
+{
+	float Center[3];
+	float Radius;
+};
+
+// --------------------------------------------------------
+// One square tile of the atlas, which holds the depths for
+// a single view of a light (a spot light, one cube face of
+// a point light or one directional cascade)
+// --------------------------------------------------------
+struct ShadowView
+{
+	uint32_t LightIndex;
+	unsigned int Face;		// Cube face or cascade
+	unsigned int X;			// Top left corner in the atlas (texels)
+	unsigned int Y;
+	unsigned int Size;		// Width and height (texels)
+	bool NeedsRender;		// False if the atlas still holds valid depths
+};
+
+// --------------------------------------------------------
+// Results of the atlas policy's self test
+// --------------------------------------------------------
+struct ShadowAtlasTestResults
+{
+	unsigned int Checks;
+	unsigned int Failures;
+	bool Passed;
+};
+
+// --------------------------------------------------------
+// Decides which lights get shadows, where in the atlas each
+// view goes and which views need to be rendered this frame.
+// Nothing here touches the GPU, so the policy can be tested
+// on its own.
+//
+// Tile sizes are powers of two picked from each light's
+// importance, and lights are packed most important first
+// into a quadtree.  If the atlas is too full, the least
+// important lights are shrunk and then dropped.  Views keep
+// their tile from the previous frame whenever possible, and
+// a view whose light is static keeps its depths until
+// something that moved overlaps the light's bounds.
+// --------------------------------------------------------
+class ShadowAtlas
+{
+public:
+	ShadowAtlas(unsigned int atlasSize = 4096, unsigned int minTileSize = 128, unsigned int maxTileSize = 1024);
+
+	void Update(
+		const ShadowRequest* requests,
+		unsigned int requestCount,
+		const ShadowBounds* movedBounds,
+		unsigned int movedCount);
+	void InvalidateAll();
+
+	const std::vector<ShadowView>& GetViews() const;
+	int GetFirstView(uint32_t lightIndex) const;
+	unsigned int GetRenderCount() const;
+
+	unsigned int GetAtlasSize() const;
+	unsigned int GetTileSize(float importance) const;
+
+	void SetMaxShadowedLights(unsigned int count);
+	unsigned int GetMaxShadowedLights() const;
+
+	static ShadowAtlasTestResults Test();
+
+private:
+	struct Block
+	{
+		unsigned int X;
+		unsigned int Y;
+	};
+
+	unsigned int atlasSize;
+	unsigned int minTileSize;
+	unsigned int maxTileSize;
+	unsigned int maxShadowedLights;
+	bool invalidateAll;
+
+	// Free blocks at each level of the quadtree, where
+	// level 0 is the whole atlas and each level below
+	// is half the size of the one above
+	std::vector<std::vector<Block>> freeBlocks;
+
+	// Results of the current and previous frames
+	std::vector<ShadowView> views;
+	std::vector<ShadowView> previousViews;
+	std::unordered_map<uint32_t, unsigned int> firstViews;
+	std::unordered_map<uint32_t, unsigned int> previousFirstViews;
+	unsigned int renderCount;
+
+	void ResetBlocks();
+	unsigned int GetLevel(unsigned int size) const;
+	bool Allocate(unsigned int size, unsigned int& x, unsigned int& y);
+	bool Reserve(unsigned int x, unsigned int y, unsigned int size);
+};
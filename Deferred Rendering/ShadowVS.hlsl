@@ -0,0 +1,32 @@
+
+// Data that changes once per shadow view
+cbuffer perView : register(b0)
+{
+	matrix viewProjection;
+};
+
+// Data that can change per object
+cbuffer perObject : register(b1)
+{
+	matrix world;
+};
+
+
+// Struct representing a single vertex worth of data
+// - Only the position is used, but this matches
+//   the layout of the regular vertex shader
+struct VertexShaderInput
+{
+	float3 position		: POSITION;
+	float2 uv			: TEXCOORD;
+	float3 normal		: NORMAL;
+	float3 tangent		: TANGENT;
+};
+
+// --------------------------------------------------------
+// Renders depth only, into one view of the shadow atlas
+// --------------------------------------------------------
+float4 main(VertexShaderInput input) : SV_POSITION
+{
+	return mul(viewProjection, mul(world, float4(input.position, 1.0f)));
+}